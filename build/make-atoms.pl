@@ -0,0 +1,119 @@
+#!/usr/bin/perl -w
+# This file is part of Hubbub.
+# Licensed under the MIT License,
+#                http://www.opensource.org/licenses/mit-license.php
+# Copyright 2026 agent <agent@local>
+
+use strict;
+
+use constant ATOMS_FILE => 'build/Atoms';
+use constant ATOMS_INC  => 'src/utils/atoms.inc';
+
+# Number of bits in a slot index; there are 2^SLOT_BITS slots
+use constant SLOT_BITS => 11;
+
+# Fibonacci hashing multiplier, spreading hashes over the slots
+use constant MULTIPLIER => 0x9E3779B1;
+
+open(INFILE, "<", ATOMS_FILE) || die "Unable to open " . ATOMS_FILE;
+
+my @atoms;
+my %seen;
+
+while (my $line = <INFILE>) {
+   last unless (defined $line);
+   next if ($line =~ /^#/);
+   chomp $line;
+   next if ($line eq '');
+   my ($name, $atom) = split /\s+/, $line;
+   die "Atom names must be lowercase" if ($name ne lc($name));
+   die "Duplicate atom name $name" if (exists $seen{$name});
+   $seen{$name} = 1;
+   push @atoms, [ $name, $atom ];
+}
+
+close(INFILE);
+
+die "Too many atoms" if (scalar(@atoms) >= (1 << SLOT_BITS) / 2);
+
+# 32 bit multiplication, without relying on integer overflow behaviour
+sub mul32 {
+   my ($a, $b) = @_;
+   my $lo = ($a & 0xFFFF) * $b;
+   my $hi = ((($a >> 16) * $b) & 0xFFFF) << 16;
+
+   return ($lo + $hi) & 0xFFFFFFFF;
+}
+
+# FNV-1a; this must match hubbub_element_hash_step() in src/utils/elements.h
+sub hash {
+   my ($name) = @_;
+   my $hash = 0x811C9DC5;
+
+   foreach my $c (split //, $name) {
+      $hash = mul32($hash ^ ord($c), 0x01000193);
+   }
+
+   return $hash;
+}
+
+# Place each name in its slot, or the next free one after it. Slots hold
+# an index into @atoms, plus one; 0 marks an empty slot
+
+my @slots = (0) x (1 << SLOT_BITS);
+
+for (my $i = 0; $i < @atoms; $i++) {
+   my $slot = mul32(hash($atoms[$i]->[0]), MULTIPLIER) >> (32 - SLOT_BITS);
+
+   $slot = ($slot + 1) % @slots while ($slots[$slot] != 0);
+
+   $slots[$slot] = $i + 1;
+}
+
+my $output = <<'EOH';
+/*
+ * This file is part of Hubbub.
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license.php
+ * Copyright 2026 The NetSurf Project.
+ *
+ * Note: This file is automatically generated by make-atoms.pl
+ *
+ * Do not edit this file, changes will be overwritten during build.
+ */
+
+EOH
+
+$output .= sprintf("#define ATOM_HASH_MULTIPLIER 0x%08Xu\n", MULTIPLIER);
+$output .= "#define ATOM_SLOT_BITS " . SLOT_BITS . "\n\n";
+
+$output .= "static const atom_name atom_names[HUBBUB_ATOM_COUNT] = {\n";
+$output .= "\t[$_->[1]] = { \"$_->[0]\", " . length($_->[0]) . " },\n"
+      foreach (@atoms);
+$output .= "};\n\n";
+
+# Slots hold an atom, or HUBBUB_ATOM_NONE where empty
+
+$output .= "static const uint16_t atom_slots[] = {\n";
+
+for (my $i = 0; $i < @slots; $i += 4) {
+   $output .= "\t" . join(', ', map { $_ == 0 ? 'HUBBUB_ATOM_NONE' :
+         $atoms[$_ - 1]->[1] } @slots[$i .. $i + 3]) . ",\n";
+}
+
+$output .= "};\n";
+
+# Write file out
+
+if (open(EXISTING, "<", ATOMS_INC)) {
+   local $/ = undef();
+   my $now = <EXISTING>;
+   undef($output) if ($output eq $now);
+   close(EXISTING);
+}
+
+if (defined($output)) {
+   open(OUTF, ">", ATOMS_INC);
+   print OUTF $output;
+   close(OUTF);
+}
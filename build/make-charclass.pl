@@ -0,0 +1,80 @@
+#!/usr/bin/perl -w
+# This file is part of Hubbub.
+# Licensed under the MIT License,
+#                http://www.opensource.org/licenses/mit-license.php
+# Copyright 2026 agent <agent@local>
+
+use strict;
+
+use constant CHARCLASS_INC => 'src/utils/charclass.inc';
+
+# Class bits; these must match the HUBBUB_CC_* values in src/utils/charclass.h
+
+my %classes = (
+   HUBBUB_CC_SPACE         => [ 0x01, "\t\n\f\r " ],
+   HUBBUB_CC_UPPER         => [ 0x02, join('', 'A' .. 'Z') ],
+   HUBBUB_CC_LOWER         => [ 0x04, join('', 'a' .. 'z') ],
+   HUBBUB_CC_DIGIT         => [ 0x08, join('', '0' .. '9') ],
+   HUBBUB_CC_HEX           => [ 0x10, join('', '0' .. '9', 'A' .. 'F',
+                                        'a' .. 'f') ],
+   HUBBUB_CC_QUOTE         => [ 0x20, "\"'" ],
+   HUBBUB_CC_TAG_NAME_END  => [ 0x40, "\t\n\f\r />\0" ],
+   HUBBUB_CC_ATTR_NAME_END => [ 0x80, "\t\n\f\r /=>\0" ],
+);
+
+my @class = (0) x 256;
+
+foreach my $name (keys %classes) {
+   my ($bit, $members) = @{$classes{$name}};
+
+   foreach my $c (split //, $members) {
+      $class[ord($c)] |= $bit;
+   }
+}
+
+my @lower = map { ($_ >= ord('A') && $_ <= ord('Z')) ? $_ + 0x20 : $_ }
+      (0 .. 255);
+
+sub table {
+   my ($type, $name, @values) = @_;
+   my $out = "const $type $name\[256\] = {\n";
+
+   for (my $i = 0; $i < 256; $i += 8) {
+      $out .= "\t" . join(', ', map { sprintf("0x%02x", $_) }
+            @values[$i .. $i + 7]) . ",\n";
+   }
+
+   return $out . "};\n";
+}
+
+my $output = <<'EOH';
+/*
+ * This file is part of Hubbub.
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license.php
+ * Copyright 2026 The NetSurf Project.
+ *
+ * Note: This file is automatically generated by make-charclass.pl
+ *
+ * Do not edit this file, changes will be overwritten during build.
+ */
+
+EOH
+
+$output .= table('uint8_t', 'hubbub_char_class', @class) . "\n";
+$output .= table('uint8_t', 'hubbub_char_lower', @lower);
+
+# Write file out
+
+if (open(EXISTING, "<", CHARCLASS_INC)) {
+   local $/ = undef();
+   my $now = <EXISTING>;
+   undef($output) if ($output eq $now);
+   close(EXISTING);
+}
+
+if (defined($output)) {
+   open(OUTF, ">", CHARCLASS_INC);
+   print OUTF $output;
+   close(OUTF);
+}
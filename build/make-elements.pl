@@ -0,0 +1,157 @@
+#!/usr/bin/perl -w
+# This file is part of Hubbub.
+# Licensed under the MIT License,
+#                http://www.opensource.org/licenses/mit-license.php
+# Copyright 2026 agent <agent@local>
+
+use strict;
+
+use constant ELEMENTS_FILE => 'build/Elements';
+use constant ATOMS_FILE    => 'build/Atoms';
+use constant ELEMENTS_INC  => 'src/utils/elements.inc';
+
+# Number of bits in a slot index; there are 2^SLOT_BITS slots
+use constant SLOT_BITS => 10;
+
+open(INFILE, "<", ELEMENTS_FILE) || die "Unable to open " . ELEMENTS_FILE;
+
+my @elements;
+
+while (my $line = <INFILE>) {
+   last unless (defined $line);
+   next if ($line =~ /^#/);
+   chomp $line;
+   next if ($line eq '');
+   my ($name, $type) = split /\s+/, $line;
+   die "Element names must be lowercase" if ($name ne lc($name));
+   push @elements, [ $name, $type ];
+}
+
+close(INFILE);
+
+die "Too many elements" if (scalar(@elements) >= 255);
+
+# Every element name must have an atom, from which its type is found
+
+open(INFILE, "<", ATOMS_FILE) || die "Unable to open " . ATOMS_FILE;
+
+my %atoms;
+
+while (my $line = <INFILE>) {
+   last unless (defined $line);
+   next if ($line =~ /^#/);
+   chomp $line;
+   next if ($line eq '');
+   my ($name, $atom) = split /\s+/, $line;
+   $atoms{$name} = $atom;
+}
+
+close(INFILE);
+
+foreach (@elements) {
+   die "Element $_->[0] has no atom" unless (exists $atoms{$_->[0]});
+}
+
+# 32 bit multiplication, without relying on integer overflow behaviour
+sub mul32 {
+   my ($a, $b) = @_;
+   my $lo = ($a & 0xFFFF) * $b;
+   my $hi = ((($a >> 16) * $b) & 0xFFFF) << 16;
+
+   return ($lo + $hi) & 0xFFFFFFFF;
+}
+
+# FNV-1a; this must match hubbub_element_hash_step() in src/utils/elements.h
+sub hash {
+   my ($name) = @_;
+   my $hash = 0x811C9DC5;
+
+   foreach my $c (split //, $name) {
+      $hash = mul32($hash ^ ord($c), 0x01000193);
+   }
+
+   return $hash;
+}
+
+my @hashes = map { hash($_->[0]) } @elements;
+
+# Find a multiplier which gives every name its own slot
+
+my $multiplier;
+my @slots;
+
+for (my $m = 0x9E3779B1; ; $m = ($m + 0x6A09E668) & 0xFFFFFFFF) {
+   my $collision = 0;
+
+   @slots = (0) x (1 << SLOT_BITS);
+
+   for (my $i = 0; $i < @elements; $i++) {
+      my $slot = mul32($hashes[$i], $m) >> (32 - SLOT_BITS);
+
+      if ($slots[$slot] != 0) {
+         $collision = 1;
+         last;
+      }
+
+      $slots[$slot] = $i + 1;
+   }
+
+   unless ($collision) {
+      $multiplier = $m;
+      last;
+   }
+}
+
+my $output = <<'EOH';
+/*
+ * This file is part of Hubbub.
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license.php
+ * Copyright 2026 The NetSurf Project.
+ *
+ * Note: This file is automatically generated by make-elements.pl
+ *
+ * Do not edit this file, changes will be overwritten during build.
+ */
+
+EOH
+
+$output .= sprintf("#define ELEMENT_HASH_MULTIPLIER 0x%08Xu\n", $multiplier);
+$output .= "#define ELEMENT_SLOT_BITS " . SLOT_BITS . "\n\n";
+
+$output .= "static const element_name element_names[] = {\n";
+$output .= "\t{ \"$_->[0]\", " . length($_->[0]) . ", $_->[1] },\n"
+      foreach (@elements);
+$output .= "};\n\n";
+
+# Slots hold an index into element_names, plus one; 0 marks an empty slot
+
+$output .= "static const uint8_t element_slots[] = {\n";
+
+for (my $i = 0; $i < @slots; $i += 16) {
+   $output .= "\t" . join(', ', @slots[$i .. $i + 15]) . ",\n";
+}
+
+$output .= "};\n\n";
+
+# Types are held plus one; 0 marks an atom which is not an element name
+
+$output .= "static const uint8_t atom_element_types[HUBBUB_ATOM_COUNT] = {\n";
+$output .= "\t[$atoms{$_->[0]}] = $_->[1] + 1,\n"
+      foreach (@elements);
+$output .= "};\n";
+
+# Write file out
+
+if (open(EXISTING, "<", ELEMENTS_INC)) {
+   local $/ = undef();
+   my $now = <EXISTING>;
+   undef($output) if ($output eq $now);
+   close(EXISTING);
+}
+
+if (defined($output)) {
+   open(OUTF, ">", ELEMENTS_INC);
+   print OUTF $output;
+   close(OUTF);
+}
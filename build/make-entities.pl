@@ -36,91 +36,180 @@ my $output = <<'EOH';
  *
  * Note: This file is automatically generated by make-entities.pl
  *
- * Do not edit file file, changes will be overwritten during build.
+ * Do not edit this file, changes will be overwritten during build.
  */
 
 
 EOH
 
-# Build a Trie of the entities
+# Build a trie of the entities, then merge identical subtrees to turn it
+# into a DAFSA (a minimal deterministic acyclic finite state automaton).
+#
+# Each state records whether the characters leading to it spell an entity
+# name and its outgoing edges, keyed on character. As states may be shared
+# by many names, codepoints are not stored in the states. Instead, each
+# edge carries the number of names which sort before those reached through
+# it from its source, so that the sum of the counts along a path is the
+# index of the name it spells in the sorted list of names.
 
-my $heapindex = 0;
+my @names = sort keys %entities;
 
-my @nodelist;
+die "Too many entities" if (scalar(@names) >= 32768);
 
-sub insert_node {
-   my ($parent, $key, $code) = @_;
-   my ($pivot, $tail);
+my $root = { final => 0, edges => {} };
 
-   if (length($key) == 0) {
-      $pivot = ''; $tail = '';
-   } elsif (length($key) == 1) {
-      $pivot = $key; $tail = '';
-   } else {
-      $pivot = substr($key, 0, 1);
-      $tail = substr($key, 1);
+foreach my $name (@names) {
+   my $state = $root;
+
+   foreach my $c (split //, $name) {
+      die "Entity names must be ASCII" if (ord($c) == 0 || ord($c) > 0x7F);
+
+      $state->{edges}{$c} = { final => 0, edges => {} }
+            unless defined($state->{edges}{$c});
+      $state = $state->{edges}{$c};
    }
 
-   unless (defined($parent)) {
-      $parent = { pivot => $pivot, heapindex => $heapindex };
-      push @nodelist, $parent;
-      $heapindex++;
+   $state->{final} = 1;
+}
+
+# Minimise, bottom up. States are identified by their signature, which is
+# built from their finality and the identities of their successors.
+
+my %registry;
+my @states;
+
+sub minimise {
+   my ($state) = @_;
+   my @sig = ($state->{final});
+
+   foreach my $c (sort keys %{$state->{edges}}) {
+      $state->{edges}{$c} = minimise($state->{edges}{$c});
+      push @sig, $c, $state->{edges}{$c}{id};
    }
 
-   if ($pivot lt $parent->{pivot}) {
-      $parent->{lt} = insert_node($parent->{lt}, $key, $code);
-   } elsif ($pivot eq $parent->{pivot}) {
-      if ($pivot eq '') {
-         $parent->{value} = $code;
-      } elsif (substr($tail, 0, 1) eq '') {
-         $parent->{value} = $code;
-         $parent->{eq} = insert_node($parent->{eq}, $tail, $code);
-      } else {
-         $parent->{eq} = insert_node($parent->{eq}, $tail, $code);
-      }
-   } else {
-      $parent->{gt} = insert_node($parent->{gt}, $key, $code);
+   my $sig = join(',', @sig);
+
+   unless (defined($registry{$sig})) {
+      $state->{id} = scalar(@states);
+      push @states, $state;
+      $registry{$sig} = $state;
    }
-   return $parent;
+
+   return $registry{$sig};
 }
 
-my $trie;
+$root = minimise($root);
+
+# Count the names accepted from each state
+
+sub count {
+   my ($state) = @_;
 
-foreach my $key (keys %entities) {
-   $trie = insert_node($trie, $key, $entities{$key});
+   return $state->{count} if (defined($state->{count}));
+
+   my $count = $state->{final};
+
+   foreach my $c (keys %{$state->{edges}}) {
+      $count += count($state->{edges}{$c});
+   }
+
+   return $state->{count} = $count;
 }
 
-# Serialise the Trie to the output string
+count($root);
+
+# Lay out the edge lists of the states after the root, depth first, so that
+# states on common paths are close together. Offset 0 is a dummy entry, so
+# a successor offset of 0 means the state has no outgoing edges. The root
+# gets a table indexed by character instead.
+
+my @dict = ( [ 0, 0, 0, 0 ] );
+my $placed = { $root->{id} => 1 };
 
-$output .= "static hubbub_entity_node dict[] = {\n";
+sub place {
+   my ($state) = @_;
 
-foreach my $node (@nodelist) {
-   my $split = $node->{pivot};
-   my $lt = $node->{lt};
-   my $eq = $node->{eq};
-   my $gt = $node->{gt};
-   my $value = $node->{value};
+   return if (defined($placed->{$state->{id}}));
+   $placed->{$state->{id}} = 1;
 
-   $lt = $lt->{heapindex} if defined($lt);
-   $lt = "-1" unless defined($lt);
+   my @chars = sort keys %{$state->{edges}};
+
+   if (@chars == 0) {
+      $state->{offset} = 0;
+      return;
+   }
+
+   $state->{offset} = scalar(@dict);
+   push @dict, [ $state, $_ ] foreach (@chars);
+
+   place($state->{edges}{$_}) foreach (@chars);
+}
 
-   $eq = $eq->{heapindex} if defined($eq);
-   $eq = "-1" unless defined($eq);
+place($root->{edges}{$_}) foreach (sort keys %{$root->{edges}});
 
-   $gt = $gt->{heapindex} if defined($gt);
-   $gt = "-1" unless defined($gt);
+die "Too many DAFSA edges" if (scalar(@dict) > 65536);
 
-   $split = ord($split) if ($split ne '');
-   $split = 0 if ($split eq '');
+sub edge {
+   my ($state, $c, $last, $skip) = @_;
+   my $next = $state->{edges}{$c};
+   my $flags = ($last ? 'LAST' : '0');
 
-   $value = "0" unless defined($value);
+   $flags = ($last ? 'LAST | FINAL' : 'FINAL') if ($next->{final});
 
-   $output .= "\t{ $split, $lt, $eq, $gt, $value },\n";
+   return sprintf("{ %d, %s, %d, %d }", ord($c), $flags,
+         $next->{offset}, $skip);
+}
+
+# Work out each edge's count from its position in its list
+
+sub edges {
+   my ($state) = @_;
+   my @chars = sort keys %{$state->{edges}};
+   my $skip = $state->{final};
+   my %out;
+
+   for (my $i = 0; $i < @chars; $i++) {
+      $out{$chars[$i]} = edge($state, $chars[$i], $i == $#chars, $skip);
+      $skip += $state->{edges}{$chars[$i]}{count};
+   }
+
+   return %out;
+}
+
+$output .= "static const hubbub_entity_edge dict_root[128] = {\n";
+
+my %root_edges = edges($root);
+
+for (my $i = 0; $i < 128; $i++) {
+   my $edge = $root_edges{chr($i)};
+
+   $edge = "{ 0, 0, 0, 0 }" unless defined($edge);
+   $output .= "\t$edge,\n";
 }
 
 $output .= "};\n\n";
 
-$output .= "static int32_t dict_root = " . $trie->{heapindex} . ";\n";
+$output .= "static const hubbub_entity_edge dict[] = {\n";
+$output .= "\t{ 0, 0, 0, 0 },\n";
+
+my %lists;
+
+for (my $i = 1; $i < @dict; $i++) {
+   my ($state, $c) = @{$dict[$i]};
+
+   %{$lists{$state->{id}}} = edges($state)
+         unless defined($lists{$state->{id}});
+
+   $output .= "\t" . $lists{$state->{id}}{$c} . ",\n";
+}
+
+$output .= "};\n\n";
+
+# Codepoints, in name order
+
+$output .= "static const uint32_t dict_values[] = {\n";
+$output .= "\t$entities{$_},\n" foreach (@names);
+$output .= "};\n\n";
 
 # Write file out
 
@@ -0,0 +1,211 @@
+#!/usr/bin/perl -w
+# This file is part of Hubbub.
+# Licensed under the MIT License,
+#                http://www.opensource.org/licenses/mit-license.php
+# Copyright 2026 agent <agent@local>
+
+use strict;
+
+use constant SVG_TAGNAMES_FILE   => 'build/SvgTagNames';
+use constant SVG_ATTRIBUTES_FILE => 'build/SvgAttributes';
+use constant PUBLIC_IDS_FILE     => 'build/QuirksPublicIds';
+use constant TABLES_INC          => 'src/treebuilder/tables.inc';
+
+# Prefix trie edge flags; these must match the values in tables.c
+use constant PREFIX_LAST  => 0x01;
+use constant PREFIX_FINAL => 0x02;
+
+sub read_lines {
+   my ($file) = @_;
+   my @lines;
+
+   open(INFILE, "<", $file) || die "Unable to open " . $file;
+
+   while (my $line = <INFILE>) {
+      last unless (defined $line);
+      next if ($line =~ /^#/);
+      chomp $line;
+      next if ($line eq '');
+      push @lines, $line;
+   }
+
+   close(INFILE);
+
+   return @lines;
+}
+
+# 32 bit multiplication, without relying on integer overflow behaviour
+sub mul32 {
+   my ($a, $b) = @_;
+   my $lo = ($a & 0xFFFF) * $b;
+   my $hi = ((($a >> 16) * $b) & 0xFFFF) << 16;
+
+   return ($lo + $hi) & 0xFFFFFFFF;
+}
+
+# FNV-1a; this must match hubbub_element_hash_step() in src/utils/elements.h
+sub hash {
+   my ($name) = @_;
+   my $hash = 0x811C9DC5;
+
+   foreach my $c (split //, $name) {
+      $hash = mul32($hash ^ ord($c), 0x01000193);
+   }
+
+   return $hash;
+}
+
+# Emit a perfect hash table for a set of case changes
+sub case_changes {
+   my ($file, $prefix, $name, $slot_bits) = @_;
+   my @changes;
+
+   foreach my $line (read_lines($file)) {
+      my ($lower, $proper) = split /\s+/, $line;
+      die "Names must be lowercase" if ($lower ne lc($lower));
+      die "Proper name differs in more than case" if ($lower ne lc($proper));
+      push @changes, [ $lower, $proper ];
+   }
+
+   die "Too many names in $file" if (scalar(@changes) >= 255);
+
+   my @hashes = map { hash($_->[0]) } @changes;
+
+   # Find a multiplier which gives every name its own slot
+
+   my $multiplier;
+   my @slots;
+
+   for (my $m = 0x9E3779B1; ; $m = ($m + 0x6A09E668) & 0xFFFFFFFF) {
+      my $collision = 0;
+
+      @slots = (0) x (1 << $slot_bits);
+
+      for (my $i = 0; $i < @changes; $i++) {
+         my $slot = mul32($hashes[$i], $m) >> (32 - $slot_bits);
+
+         if ($slots[$slot] != 0) {
+            $collision = 1;
+            last;
+         }
+
+         $slots[$slot] = $i + 1;
+      }
+
+      unless ($collision) {
+         $multiplier = $m;
+         last;
+      }
+   }
+
+   my $out = sprintf("#define %s_MULTIPLIER 0x%08Xu\n", $prefix,
+         $multiplier);
+   $out .= "#define ${prefix}_SLOT_BITS $slot_bits\n\n";
+
+   $out .= "static const case_change ${name}[] = {\n";
+   $out .= "\t{ \"$_->[0]\", " . length($_->[0]) . ", \"$_->[1]\" },\n"
+         foreach (@changes);
+   $out .= "};\n\n";
+
+   # Slots hold an index into the table, plus one; 0 marks an empty slot
+
+   $out .= "static const uint8_t ${name}_slots[] = {\n";
+
+   for (my $i = 0; $i < @slots; $i += 16) {
+      $out .= "\t" . join(', ', @slots[$i .. $i + 15]) . ",\n";
+   }
+
+   return $out . "};\n";
+}
+
+# Emit a trie of case-insensitive prefixes
+#
+# Each node is a run of edges, sorted by character, the last of which is
+# flagged PREFIX_LAST. The root node starts at index 0. An edge flagged
+# PREFIX_FINAL completes a prefix, so nothing below it is ever visited and
+# it has no child node.
+sub prefixes {
+   my ($file, $name) = @_;
+   my %root;
+
+   foreach my $line (read_lines($file)) {
+      my $node = \%root;
+
+      foreach my $c (split //, lc($line)) {
+         last if (exists $node->{''});
+         $node->{$c} = {} unless (exists $node->{$c});
+         $node = $node->{$c};
+      }
+
+      %$node = ('' => 1);
+   }
+
+   # Lay the nodes out breadth first
+
+   my @edges;
+   my @queue = (\%root);
+   my $next = scalar(keys %root);
+
+   while (my $node = shift @queue) {
+      my @chars = sort keys %$node;
+
+      for (my $i = 0; $i < @chars; $i++) {
+         my $child = $node->{$chars[$i]};
+         my $flags = ($i == $#chars) ? PREFIX_LAST : 0;
+         my $index = 0;
+
+         if (exists $child->{''}) {
+            $flags |= PREFIX_FINAL;
+         } else {
+            $index = $next;
+            $next += scalar(keys %$child);
+            push @queue, $child;
+         }
+
+         push @edges, [ ord($chars[$i]), $flags, $index ];
+      }
+   }
+
+   die "Too many edges in $file" if (scalar(@edges) > 65535);
+
+   my $out = "static const prefix_edge ${name}[] = {\n";
+   $out .= sprintf("\t{ 0x%02x, %d, %d },\n", @$_) foreach (@edges);
+
+   return $out . "};\n";
+}
+
+my $output = <<'EOH';
+/*
+ * This file is part of Hubbub.
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license.php
+ * Copyright 2026 The NetSurf Project.
+ *
+ * Note: This file is automatically generated by make-treebuilder-tables.pl
+ *
+ * Do not edit this file, changes will be overwritten during build.
+ */
+
+EOH
+
+$output .= case_changes(SVG_TAGNAMES_FILE, 'SVG_TAGNAME', 'svg_tagnames', 7);
+$output .= "\n";
+$output .= case_changes(SVG_ATTRIBUTES_FILE, 'SVG_ATTRIBUTE',
+      'svg_attributes', 8);
+$output .= "\n";
+$output .= prefixes(PUBLIC_IDS_FILE, 'quirks_public_ids');
+
+# Write file out
+
+if (open(EXISTING, "<", TABLES_INC)) {
+   local $/ = undef();
+   my $now = <EXISTING>;
+   undef($output) if ($output eq $now);
+   close(EXISTING);
+}
+
+if (defined($output)) {
+   open(OUTF, ">", TABLES_INC);
+   print OUTF $output;
+   close(OUTF);
+}
@@ -0,0 +1,54 @@
+/*
+ * This file is part of Hubbub.
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license.php
+ * Copyright 2026 agent <agent@local>
+ */
+
+#ifndef hubbub_arena_h_
+#define hubbub_arena_h_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stddef.h>
+
+#include <hubbub/errors.h>
+#include <hubbub/functypes.h>
+
+/**
+ * Memory arena
+ *
+ * Small objects are carved out of large chunks, and kept on per-size free
+ * lists once released. Everything allocated from an arena is released
+ * when it is destroyed. An arena must not be used by more than one thread
+ * at a time.
+ */
+typedef struct hubbub_arena hubbub_arena;
+
+/* Create a memory arena */
+hubbub_error hubbub_arena_create(hubbub_allocator_fn alloc, void *pw,
+		hubbub_arena **arena);
+/* Destroy a memory arena, and release everything allocated from it */
+hubbub_error hubbub_arena_destroy(hubbub_arena *arena);
+
+/**
+ * Allocate memory from an arena
+ *
+ * This is a hubbub_allocator_fn, which expects the arena as its client data.
+ *
+ * \param ptr   Pointer to object to reallocate, or NULL for a new allocation
+ * \param size  Required length in bytes, or zero to free ::ptr
+ * \param pw    The arena
+ * \return Pointer to allocated object, or NULL on failure
+ */
+void *hubbub_arena_alloc(void *ptr, size_t size, void *pw);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
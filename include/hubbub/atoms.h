@@ -0,0 +1,354 @@
+/*
+ * This file is part of Hubbub.
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license.php
+ * Copyright 2026 agent <agent@local>
+ */
+
+#ifndef hubbub_atoms_h_
+#define hubbub_atoms_h_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stddef.h>
+#include <inttypes.h>
+
+#include <hubbub/types.h>
+
+/**
+ * Atoms
+ *
+ * Known element names, and common attribute names, each have an atom: a
+ * small integer, which is given alongside the name in every tag and
+ * attribute, so that clients may switch on it rather than compare
+ * strings. A name which is both an element and an attribute has the same
+ * atom for each. Namespaces are given as a hubbub_ns, which serves as
+ * their atom.
+ *
+ * A name has its atom only when it is the atom's name exactly, so the
+ * names of elements and attributes in foreign content whose case has been
+ * fixed (such as "viewBox") have none, as have all other names.
+ *
+ * The numbers are stable: new atoms are only ever added at the end.
+ */
+enum {
+	HUBBUB_ATOM_NONE,		/**< No atom, for any other name */
+
+/* Elements */
+	HUBBUB_ATOM_A,
+	HUBBUB_ATOM_ABBR,
+	HUBBUB_ATOM_ADDRESS,
+	HUBBUB_ATOM_ANNOTATION_XML,
+	HUBBUB_ATOM_APPLET,
+	HUBBUB_ATOM_AREA,
+	HUBBUB_ATOM_ARTICLE,
+	HUBBUB_ATOM_ASIDE,
+	HUBBUB_ATOM_AUDIO,
+	HUBBUB_ATOM_B,
+	HUBBUB_ATOM_BASE,
+	HUBBUB_ATOM_BASEFONT,
+	HUBBUB_ATOM_BDI,
+	HUBBUB_ATOM_BDO,
+	HUBBUB_ATOM_BGSOUND,
+	HUBBUB_ATOM_BIG,
+	HUBBUB_ATOM_BLOCKQUOTE,
+	HUBBUB_ATOM_BODY,
+	HUBBUB_ATOM_BR,
+	HUBBUB_ATOM_BUTTON,
+	HUBBUB_ATOM_CANVAS,
+	HUBBUB_ATOM_CAPTION,
+	HUBBUB_ATOM_CENTER,
+	HUBBUB_ATOM_CITE,
+	HUBBUB_ATOM_CODE,
+	HUBBUB_ATOM_COL,
+	HUBBUB_ATOM_COLGROUP,
+	HUBBUB_ATOM_COMMAND,
+	HUBBUB_ATOM_DATA,
+	HUBBUB_ATOM_DATAGRID,
+	HUBBUB_ATOM_DATALIST,
+	HUBBUB_ATOM_DD,
+	HUBBUB_ATOM_DEL,
+	HUBBUB_ATOM_DESC,
+	HUBBUB_ATOM_DETAILS,
+	HUBBUB_ATOM_DFN,
+	HUBBUB_ATOM_DIALOG,
+	HUBBUB_ATOM_DIR,
+	HUBBUB_ATOM_DIV,
+	HUBBUB_ATOM_DL,
+	HUBBUB_ATOM_DT,
+	HUBBUB_ATOM_EM,
+	HUBBUB_ATOM_EMBED,
+	HUBBUB_ATOM_FIELDSET,
+	HUBBUB_ATOM_FIGCAPTION,
+	HUBBUB_ATOM_FIGURE,
+	HUBBUB_ATOM_FONT,
+	HUBBUB_ATOM_FOOTER,
+	HUBBUB_ATOM_FOREIGNOBJECT,
+	HUBBUB_ATOM_FORM,
+	HUBBUB_ATOM_FRAME,
+	HUBBUB_ATOM_FRAMESET,
+	HUBBUB_ATOM_H1,
+	HUBBUB_ATOM_H2,
+	HUBBUB_ATOM_H3,
+	HUBBUB_ATOM_H4,
+	HUBBUB_ATOM_H5,
+	HUBBUB_ATOM_H6,
+	HUBBUB_ATOM_HEAD,
+	HUBBUB_ATOM_HEADER,
+	HUBBUB_ATOM_HGROUP,
+	HUBBUB_ATOM_HR,
+	HUBBUB_ATOM_HTML,
+	HUBBUB_ATOM_I,
+	HUBBUB_ATOM_IFRAME,
+	HUBBUB_ATOM_IMAGE,
+	HUBBUB_ATOM_IMG,
+	HUBBUB_ATOM_INPUT,
+	HUBBUB_ATOM_INS,
+	HUBBUB_ATOM_ISINDEX,
+	HUBBUB_ATOM_KBD,
+	HUBBUB_ATOM_KEYGEN,
+	HUBBUB_ATOM_LABEL,
+	HUBBUB_ATOM_LEGEND,
+	HUBBUB_ATOM_LI,
+	HUBBUB_ATOM_LINK,
+	HUBBUB_ATOM_LISTING,
+	HUBBUB_ATOM_MAIN,
+	HUBBUB_ATOM_MALIGNMARK,
+	HUBBUB_ATOM_MAP,
+	HUBBUB_ATOM_MARK,
+	HUBBUB_ATOM_MARQUEE,
+	HUBBUB_ATOM_MATH,
+	HUBBUB_ATOM_MENU,
+	HUBBUB_ATOM_META,
+	HUBBUB_ATOM_METER,
+	HUBBUB_ATOM_MGLYPH,
+	HUBBUB_ATOM_MI,
+	HUBBUB_ATOM_MN,
+	HUBBUB_ATOM_MO,
+	HUBBUB_ATOM_MS,
+	HUBBUB_ATOM_MTEXT,
+	HUBBUB_ATOM_NAV,
+	HUBBUB_ATOM_NOBR,
+	HUBBUB_ATOM_NOEMBED,
+	HUBBUB_ATOM_NOFRAMES,
+	HUBBUB_ATOM_NOSCRIPT,
+	HUBBUB_ATOM_OBJECT,
+	HUBBUB_ATOM_OL,
+	HUBBUB_ATOM_OPTGROUP,
+	HUBBUB_ATOM_OPTION,
+	HUBBUB_ATOM_OUTPUT,
+	HUBBUB_ATOM_P,
+	HUBBUB_ATOM_PARAM,
+	HUBBUB_ATOM_PICTURE,
+	HUBBUB_ATOM_PLAINTEXT,
+	HUBBUB_ATOM_PRE,
+	HUBBUB_ATOM_PROGRESS,
+	HUBBUB_ATOM_Q,
+	HUBBUB_ATOM_RB,
+	HUBBUB_ATOM_RP,
+	HUBBUB_ATOM_RT,
+	HUBBUB_ATOM_RTC,
+	HUBBUB_ATOM_RUBY,
+	HUBBUB_ATOM_S,
+	HUBBUB_ATOM_SAMP,
+	HUBBUB_ATOM_SCRIPT,
+	HUBBUB_ATOM_SECTION,
+	HUBBUB_ATOM_SELECT,
+	HUBBUB_ATOM_SMALL,
+	HUBBUB_ATOM_SOURCE,
+	HUBBUB_ATOM_SPACER,
+	HUBBUB_ATOM_SPAN,
+	HUBBUB_ATOM_STRIKE,
+	HUBBUB_ATOM_STRONG,
+	HUBBUB_ATOM_STYLE,
+	HUBBUB_ATOM_SUB,
+	HUBBUB_ATOM_SUMMARY,
+	HUBBUB_ATOM_SUP,
+	HUBBUB_ATOM_SVG,
+	HUBBUB_ATOM_TABLE,
+	HUBBUB_ATOM_TBODY,
+	HUBBUB_ATOM_TD,
+	HUBBUB_ATOM_TEMPLATE,
+	HUBBUB_ATOM_TEXTAREA,
+	HUBBUB_ATOM_TFOOT,
+	HUBBUB_ATOM_TH,
+	HUBBUB_ATOM_THEAD,
+	HUBBUB_ATOM_TIME,
+	HUBBUB_ATOM_TITLE,
+	HUBBUB_ATOM_TR,
+	HUBBUB_ATOM_TRACK,
+	HUBBUB_ATOM_TT,
+	HUBBUB_ATOM_U,
+	HUBBUB_ATOM_UL,
+	HUBBUB_ATOM_VAR,
+	HUBBUB_ATOM_VIDEO,
+	HUBBUB_ATOM_WBR,
+	HUBBUB_ATOM_XMP,
+
+/* Attributes, other than those which are also element names */
+	HUBBUB_ATOM_ACCEPT,
+	HUBBUB_ATOM_ACCEPT_CHARSET,
+	HUBBUB_ATOM_ACCESSKEY,
+	HUBBUB_ATOM_ACTION,
+	HUBBUB_ATOM_ALIGN,
+	HUBBUB_ATOM_ALINK,
+	HUBBUB_ATOM_ALT,
+	HUBBUB_ATOM_ARCHIVE,
+	HUBBUB_ATOM_ASYNC,
+	HUBBUB_ATOM_AUTOCOMPLETE,
+	HUBBUB_ATOM_AUTOFOCUS,
+	HUBBUB_ATOM_AUTOPLAY,
+	HUBBUB_ATOM_AXIS,
+	HUBBUB_ATOM_BACKGROUND,
+	HUBBUB_ATOM_BGCOLOR,
+	HUBBUB_ATOM_BORDER,
+	HUBBUB_ATOM_CELLPADDING,
+	HUBBUB_ATOM_CELLSPACING,
+	HUBBUB_ATOM_CHAR,
+	HUBBUB_ATOM_CHAROFF,
+	HUBBUB_ATOM_CHARSET,
+	HUBBUB_ATOM_CHECKED,
+	HUBBUB_ATOM_CLASS,
+	HUBBUB_ATOM_CLASSID,
+	HUBBUB_ATOM_CLEAR,
+	HUBBUB_ATOM_CODEBASE,
+	HUBBUB_ATOM_CODETYPE,
+	HUBBUB_ATOM_COLOR,
+	HUBBUB_ATOM_COLS,
+	HUBBUB_ATOM_COLSPAN,
+	HUBBUB_ATOM_COMPACT,
+	HUBBUB_ATOM_CONTENT,
+	HUBBUB_ATOM_CONTENTEDITABLE,
+	HUBBUB_ATOM_CONTROLS,
+	HUBBUB_ATOM_COORDS,
+	HUBBUB_ATOM_CROSSORIGIN,
+	HUBBUB_ATOM_D,
+	HUBBUB_ATOM_DATETIME,
+	HUBBUB_ATOM_DECLARE,
+	HUBBUB_ATOM_DEFER,
+	HUBBUB_ATOM_DISABLED,
+	HUBBUB_ATOM_DOWNLOAD,
+	HUBBUB_ATOM_DRAGGABLE,
+	HUBBUB_ATOM_ENCTYPE,
+	HUBBUB_ATOM_FACE,
+	HUBBUB_ATOM_FILL,
+	HUBBUB_ATOM_FOR,
+	HUBBUB_ATOM_FORMACTION,
+	HUBBUB_ATOM_FORMENCTYPE,
+	HUBBUB_ATOM_FORMMETHOD,
+	HUBBUB_ATOM_FORMNOVALIDATE,
+	HUBBUB_ATOM_FORMTARGET,
+	HUBBUB_ATOM_FRAMEBORDER,
+	HUBBUB_ATOM_HEADERS,
+	HUBBUB_ATOM_HEIGHT,
+	HUBBUB_ATOM_HIDDEN,
+	HUBBUB_ATOM_HIGH,
+	HUBBUB_ATOM_HREF,
+	HUBBUB_ATOM_HREFLANG,
+	HUBBUB_ATOM_HSPACE,
+	HUBBUB_ATOM_HTTP_EQUIV,
+	HUBBUB_ATOM_ID,
+	HUBBUB_ATOM_INTEGRITY,
+	HUBBUB_ATOM_ISMAP,
+	HUBBUB_ATOM_ITEMPROP,
+	HUBBUB_ATOM_ITEMSCOPE,
+	HUBBUB_ATOM_ITEMTYPE,
+	HUBBUB_ATOM_KIND,
+	HUBBUB_ATOM_LANG,
+	HUBBUB_ATOM_LANGUAGE,
+	HUBBUB_ATOM_LIST,
+	HUBBUB_ATOM_LOOP,
+	HUBBUB_ATOM_LOW,
+	HUBBUB_ATOM_MARGINHEIGHT,
+	HUBBUB_ATOM_MARGINWIDTH,
+	HUBBUB_ATOM_MAX,
+	HUBBUB_ATOM_MAXLENGTH,
+	HUBBUB_ATOM_MEDIA,
+	HUBBUB_ATOM_METHOD,
+	HUBBUB_ATOM_MIN,
+	HUBBUB_ATOM_MULTIPLE,
+	HUBBUB_ATOM_MUTED,
+	HUBBUB_ATOM_NAME,
+	HUBBUB_ATOM_NOHREF,
+	HUBBUB_ATOM_NONCE,
+	HUBBUB_ATOM_NORESIZE,
+	HUBBUB_ATOM_NOSHADE,
+	HUBBUB_ATOM_NOVALIDATE,
+	HUBBUB_ATOM_NOWRAP,
+	HUBBUB_ATOM_ONBLUR,
+	HUBBUB_ATOM_ONCHANGE,
+	HUBBUB_ATOM_ONCLICK,
+	HUBBUB_ATOM_ONERROR,
+	HUBBUB_ATOM_ONFOCUS,
+	HUBBUB_ATOM_ONLOAD,
+	HUBBUB_ATOM_ONSUBMIT,
+	HUBBUB_ATOM_OPEN,
+	HUBBUB_ATOM_OPTIMUM,
+	HUBBUB_ATOM_PATTERN,
+	HUBBUB_ATOM_PLACEHOLDER,
+	HUBBUB_ATOM_POSTER,
+	HUBBUB_ATOM_PRELOAD,
+	HUBBUB_ATOM_PROFILE,
+	HUBBUB_ATOM_READONLY,
+	HUBBUB_ATOM_REFERRERPOLICY,
+	HUBBUB_ATOM_REL,
+	HUBBUB_ATOM_REQUIRED,
+	HUBBUB_ATOM_REV,
+	HUBBUB_ATOM_REVERSED,
+	HUBBUB_ATOM_ROLE,
+	HUBBUB_ATOM_ROWS,
+	HUBBUB_ATOM_ROWSPAN,
+	HUBBUB_ATOM_RULES,
+	HUBBUB_ATOM_SANDBOX,
+	HUBBUB_ATOM_SCOPE,
+	HUBBUB_ATOM_SCROLLING,
+	HUBBUB_ATOM_SELECTED,
+	HUBBUB_ATOM_SHAPE,
+	HUBBUB_ATOM_SIZE,
+	HUBBUB_ATOM_SIZES,
+	HUBBUB_ATOM_SPELLCHECK,
+	HUBBUB_ATOM_SRC,
+	HUBBUB_ATOM_SRCDOC,
+	HUBBUB_ATOM_SRCLANG,
+	HUBBUB_ATOM_SRCSET,
+	HUBBUB_ATOM_START,
+	HUBBUB_ATOM_STEP,
+	HUBBUB_ATOM_STROKE,
+	HUBBUB_ATOM_TABINDEX,
+	HUBBUB_ATOM_TARGET,
+	HUBBUB_ATOM_TEXT,
+	HUBBUB_ATOM_TRANSFORM,
+	HUBBUB_ATOM_TYPE,
+	HUBBUB_ATOM_USEMAP,
+	HUBBUB_ATOM_VALIGN,
+	HUBBUB_ATOM_VALUE,
+	HUBBUB_ATOM_VERSION,
+	HUBBUB_ATOM_VLINK,
+	HUBBUB_ATOM_VSPACE,
+	HUBBUB_ATOM_WIDTH,
+	HUBBUB_ATOM_WRAP,
+	HUBBUB_ATOM_X,
+	HUBBUB_ATOM_XMLNS,
+	HUBBUB_ATOM_Y,
+
+	HUBBUB_ATOM_COUNT		/**< Number of atoms, including none */
+};
+
+/* Find the atom of a name */
+hubbub_atom hubbub_atom_find(const uint8_t *name, size_t len);
+
+/* Retrieve the name of an atom */
+hubbub_string hubbub_atom_string(hubbub_atom atom);
+
+/* Retrieve the URI of a namespace */
+hubbub_string hubbub_ns_uri(hubbub_ns ns);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
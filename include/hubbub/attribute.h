@@ -0,0 +1,38 @@
+/*
+ * This file is part of Hubbub.
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license.php
+ * Copyright 2026 agent <agent@local>
+ */
+
+#ifndef hubbub_attribute_h_
+#define hubbub_attribute_h_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stddef.h>
+#include <inttypes.h>
+
+#include <hubbub/errors.h>
+#include <hubbub/types.h>
+
+/**
+ * Largest length, in bytes, of the decoded value of a raw attribute value
+ * of length len: a NUL is replaced by the three bytes of U+FFFD, while no
+ * character reference is shorter than its character.
+ */
+#define HUBBUB_ATTRIBUTE_DECODED_MAX(len) ((len) * 3)
+
+/* Decode the value of an attribute, as the tokeniser would have */
+hubbub_error hubbub_attribute_decode(const hubbub_attribute *attr,
+		uint8_t *buf, size_t *len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
@@ -0,0 +1,65 @@
+/*
+ * This file is part of Hubbub.
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license.php
+ * Copyright 2026 agent <agent@local>
+ */
+
+#ifndef hubbub_batch_h_
+#define hubbub_batch_h_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stddef.h>
+#include <inttypes.h>
+
+#include <hubbub/errors.h>
+#include <hubbub/functypes.h>
+#include <hubbub/parser.h>
+
+/**
+ * A document to parse, as one of a batch
+ */
+typedef struct hubbub_batch_document {
+	const uint8_t *data;		/**< Document, owned by the client */
+	size_t len;			/**< Length of data, in bytes */
+	const char *charset;		/**< Charset of the document, or NULL
+					 * to detect it */
+
+	hubbub_error error;		/**< Result of parsing the document,
+					 * set by hubbub_parse_batch() */
+} hubbub_batch_document;
+
+/**
+ * Client callbacks for the documents of a batch
+ *
+ * Both are called on whichever thread parses the document, and may be
+ * called for several documents at once, so whatever they share must be
+ * safe to use from many threads.
+ */
+typedef struct hubbub_batch_handler {
+	/** Ready a parser for a document, by setting its tree handler and
+	 * document node (or attaching a tree), and any other options */
+	hubbub_error (*start)(void *pw, size_t index, hubbub_parser *parser);
+
+	/** Take the result of parsing a document. The parser no longer
+	 * refers to the document's tree, so the tree may be released */
+	void (*finish)(void *pw, size_t index, hubbub_error error);
+
+	void *pw;			/**< Client data for the callbacks */
+} hubbub_batch_handler;
+
+/* Parse a batch of documents, on several threads */
+hubbub_error hubbub_parse_batch(hubbub_batch_document *docs, size_t n_docs,
+		const hubbub_batch_handler *handler, unsigned int threads,
+		hubbub_allocator_fn alloc, void *pw);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
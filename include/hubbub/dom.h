@@ -0,0 +1,161 @@
+/*
+ * This file is part of Hubbub.
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license.php
+ * Copyright 2026 agent <agent@local>
+ */
+
+#ifndef hubbub_dom_h_
+#define hubbub_dom_h_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stdbool.h>
+#include <inttypes.h>
+
+#include <hubbub/errors.h>
+#include <hubbub/functypes.h>
+#include <hubbub/parser.h>
+#include <hubbub/types.h>
+
+/**
+ * Compact document tree
+ *
+ * This is a tree handler built into the library, for clients which do not
+ * need a tree of their own. Nodes are numbered, and stored in parallel
+ * arrays. Element and attribute names are interned, so may be compared as
+ * atoms. The content of text nodes, comments and attribute values is held
+ * in a single string buffer.
+ *
+ * Nodes removed from the tree are not freed: everything goes when the tree
+ * is destroyed. A tree must not be used by more than one thread at a time.
+ */
+typedef struct hubbub_dom hubbub_dom;
+
+/**
+ * A node in a tree
+ */
+typedef uint32_t hubbub_dom_node;
+
+/**
+ * An interned name
+ */
+typedef uint32_t hubbub_dom_atom;
+
+/** No node, or no atom */
+#define HUBBUB_DOM_NONE ((uint32_t) 0xFFFFFFFFu)
+
+/** The document node, which is the root of every tree */
+#define HUBBUB_DOM_ROOT ((hubbub_dom_node) 0)
+
+/**
+ * Type of a node
+ */
+typedef enum hubbub_dom_node_type {
+	HUBBUB_DOM_NODE_DOCUMENT,
+	HUBBUB_DOM_NODE_DOCTYPE,
+	HUBBUB_DOM_NODE_ELEMENT,
+	HUBBUB_DOM_NODE_TEXT,
+	HUBBUB_DOM_NODE_COMMENT
+} hubbub_dom_node_type;
+
+/**
+ * An attribute of an element
+ */
+typedef struct hubbub_dom_attribute {
+	hubbub_ns ns;			/**< Attribute namespace */
+	hubbub_dom_atom name;		/**< Attribute name */
+	hubbub_string value;		/**< Attribute value */
+} hubbub_dom_attribute;
+
+/**
+ * Callback for hubbub_dom_walk
+ *
+ * \param dom   The tree being walked
+ * \param node  The node being entered or left
+ * \param pw    Client's private data
+ * \return HUBBUB_OK to continue, anything else to stop the walk
+ */
+typedef hubbub_error (*hubbub_dom_walk_cb)(const hubbub_dom *dom,
+		hubbub_dom_node node, void *pw);
+
+/* Create a tree, containing only its document node */
+hubbub_error hubbub_dom_create(hubbub_allocator_fn alloc, void *pw,
+		hubbub_dom **dom);
+/* Destroy a tree */
+hubbub_error hubbub_dom_destroy(hubbub_dom *dom);
+
+/* Have a parser build its document in a tree */
+hubbub_error hubbub_dom_attach(hubbub_dom *dom, hubbub_parser *parser);
+/* Have a parser build a fragment under a node of a tree */
+hubbub_error hubbub_dom_attach_fragment(hubbub_dom *dom,
+		hubbub_parser *parser, hubbub_ns ns, const hubbub_string *name,
+		hubbub_dom_node root);
+
+/* Retrieve the quirks mode of a tree's document */
+hubbub_quirks_mode hubbub_dom_quirks_mode(const hubbub_dom *dom);
+
+/* Retrieve the type of a node */
+hubbub_dom_node_type hubbub_dom_type(const hubbub_dom *dom,
+		hubbub_dom_node node);
+/* Retrieve the parent of a node */
+hubbub_dom_node hubbub_dom_parent(const hubbub_dom *dom,
+		hubbub_dom_node node);
+/* Retrieve the first child of a node */
+hubbub_dom_node hubbub_dom_first_child(const hubbub_dom *dom,
+		hubbub_dom_node node);
+/* Retrieve the last child of a node */
+hubbub_dom_node hubbub_dom_last_child(const hubbub_dom *dom,
+		hubbub_dom_node node);
+/* Retrieve the next sibling of a node */
+hubbub_dom_node hubbub_dom_next_sibling(const hubbub_dom *dom,
+		hubbub_dom_node node);
+/* Retrieve the previous sibling of a node */
+hubbub_dom_node hubbub_dom_prev_sibling(const hubbub_dom *dom,
+		hubbub_dom_node node);
+
+/* Find the node following another, in document order, within a subtree */
+hubbub_dom_node hubbub_dom_next(const hubbub_dom *dom,
+		hubbub_dom_node node, hubbub_dom_node root);
+/* Visit every node in a subtree, in document order */
+hubbub_error hubbub_dom_walk(const hubbub_dom *dom, hubbub_dom_node root,
+		hubbub_dom_walk_cb enter, hubbub_dom_walk_cb leave, void *pw);
+
+/* Retrieve the name of an element */
+hubbub_dom_atom hubbub_dom_name(const hubbub_dom *dom,
+		hubbub_dom_node node);
+/* Retrieve the namespace of an element */
+hubbub_ns hubbub_dom_ns(const hubbub_dom *dom, hubbub_dom_node node);
+/* Retrieve the number of attributes of an element */
+uint32_t hubbub_dom_attribute_count(const hubbub_dom *dom,
+		hubbub_dom_node node);
+/* Retrieve an attribute of an element */
+hubbub_error hubbub_dom_attribute_get(const hubbub_dom *dom,
+		hubbub_dom_node node, uint32_t index,
+		hubbub_dom_attribute *attribute);
+/* Find the value of an element's attribute */
+bool hubbub_dom_attribute_find(const hubbub_dom *dom, hubbub_dom_node node,
+		hubbub_dom_atom name, hubbub_string *value);
+
+/* Retrieve the content of a text or comment node */
+hubbub_string hubbub_dom_data(const hubbub_dom *dom, hubbub_dom_node node);
+/* Retrieve the details of a doctype node */
+hubbub_error hubbub_dom_doctype(const hubbub_dom *dom, hubbub_dom_node node,
+		hubbub_doctype *doctype);
+
+/* Retrieve the text of an atom */
+hubbub_string hubbub_dom_atom_string(const hubbub_dom *dom,
+		hubbub_dom_atom atom);
+/* Find the atom for a name, if it is in use */
+hubbub_dom_atom hubbub_dom_atom_find(const hubbub_dom *dom,
+		const uint8_t *name, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
@@ -20,6 +20,8 @@ typedef enum hubbub_error {
 	HUBBUB_REPROCESS	= 1,
 	HUBBUB_ENCODINGCHANGE	= 2,
 	HUBBUB_PAUSED		= 3, /**< tokenisation is paused */
+	HUBBUB_STOPPED		= 4, /**< parsing is over, as nothing more
+				      * is wanted */
 
 	HUBBUB_NOMEM            = 5,
 	HUBBUB_BADPARM          = 6,
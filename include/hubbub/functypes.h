@@ -41,6 +41,46 @@ typedef void *(*hubbub_allocator_fn)(void *ptr, size_t size, void *pw);
 typedef hubbub_error (*hubbub_token_handler)(
 		const hubbub_token *token, void *pw);
 
+/**
+ * Type of batched token handling function
+ *
+ * The tokens, and the strings and attributes they refer to, are only
+ * valid for the duration of the call.
+ *
+ * \param tokens    Array of tokens to handle, in document order
+ * \param n_tokens  Number of tokens in ::tokens
+ * \param pw        Pointer to client data
+ * \return HUBBUB_OK on success, appropriate error otherwise.
+ */
+typedef hubbub_error (*hubbub_token_batch_handler)(
+		const hubbub_token *tokens, size_t n_tokens, void *pw);
+
+/**
+ * Type of compact token handling function
+ *
+ * The token, and the strings and attributes it refers to, are only valid
+ * for the duration of the call.
+ *
+ * \param token  Pointer to token to handle
+ * \param pw     Pointer to client data
+ * \return HUBBUB_OK on success, appropriate error otherwise.
+ */
+typedef hubbub_error (*hubbub_compact_token_handler)(
+		const hubbub_compact_token *token, void *pw);
+
+/**
+ * Type of structural event handling function
+ *
+ * The event, and the strings and attributes it refers to, are only valid
+ * for the duration of the call.
+ *
+ * \param event  Pointer to event to handle
+ * \param pw     Pointer to client data
+ * \return HUBBUB_OK on success, appropriate error otherwise.
+ */
+typedef hubbub_error (*hubbub_event_handler)(
+		const hubbub_event *event, void *pw);
+
 /**
  * Type of parse error handling function
  *
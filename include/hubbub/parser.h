@@ -17,12 +17,15 @@ extern "C"
 #include <inttypes.h>
 
 #include <hubbub/errors.h>
+#include <hubbub/arena.h>
 #include <hubbub/functypes.h>
 #include <hubbub/tree.h>
 #include <hubbub/types.h>
 
 typedef struct hubbub_parser hubbub_parser;
 
+typedef struct hubbub_checkpoint hubbub_checkpoint;
+
 /**
  * Hubbub parser option types
  */
@@ -34,7 +37,21 @@ typedef enum hubbub_parser_opttype {
 	HUBBUB_PARSER_DOCUMENT_NODE,
 	HUBBUB_PARSER_ENABLE_SCRIPTING,
 	HUBBUB_PARSER_PAUSE,
-	HUBBUB_PARSER_ENABLE_STYLING
+	HUBBUB_PARSER_ENABLE_STYLING,
+	HUBBUB_PARSER_TRACK_POSITION,
+	HUBBUB_PARSER_TOKEN_BATCH_HANDLER,
+	HUBBUB_PARSER_DROP_COMMENTS,
+	HUBBUB_PARSER_TOKEN_LIMIT,
+	HUBBUB_PARSER_TREE_HANDLER_EXT,
+	HUBBUB_PARSER_FRAGMENT,
+	HUBBUB_PARSER_EVENT_HANDLER,
+	HUBBUB_PARSER_HEAD_ONLY,
+	HUBBUB_PARSER_THREADS,
+	HUBBUB_PARSER_PIPELINE,
+	HUBBUB_PARSER_BUDGET,
+	HUBBUB_PARSER_COMPACT_TOKEN_HANDLER,
+	HUBBUB_PARSER_MAX_DEPTH,
+	HUBBUB_PARSER_RAW_ATTRIBUTE_VALUES
 } hubbub_parser_opttype;
 
 /**
@@ -57,20 +74,133 @@ typedef union hubbub_parser_optparams {
 
 	hubbub_tree_handler *tree_handler;	/**< Tree handling callbacks */
 
+	hubbub_tree_handler_ext *tree_handler_ext;
+					/**< Extended tree handling callbacks,
+					 * or NULL for none */
+
 	void *document_node;		/**< Document node */
 
+	hubbub_fragment fragment;	/**< Parse a fragment, rather than a
+					 * document. This must be set after
+					 * the tree handler and scripting
+					 * option, and before any data is
+					 * parsed */
+
+	struct {
+		hubbub_event_handler handler;
+		void *pw;
+	} event_handler;		/**< Structural event callback. If no
+					 * tree handler is set, the tree is
+					 * not built, and only events are
+					 * produced */
+
 	bool enable_scripting;		/**< Whether to enable scripting */
 	bool enable_styling;		/**< Whether to enable styling */
 
+	bool drop_comments;		/**< Whether to discard comments,
+					 * rather than passing them on */
+
+	bool raw_attribute_values;	/**< Whether to pass on attribute
+					 * values which contain character
+					 * references, NULs or CRs as
+					 * written, flagged as raw, for
+					 * hubbub_attribute_decode(), rather
+					 * than copying them to decode them.
+					 * Only for clients of the token
+					 * handlers */
+
+	bool head_only;			/**< Whether to stop at the body. Once
+					 * the head is complete, nothing more
+					 * is built, and parsing returns
+					 * HUBBUB_STOPPED; the rest of the
+					 * document may then be discarded */
+
+	uint32_t max_depth;		/**< Most elements to nest in the
+					 * tree, counting the html element,
+					 * or 0 for no limit. Elements any
+					 * deeper are inserted as siblings
+					 * of the deepest, as browsers do.
+					 * Must not be 1 */
+
+	size_t token_limit;		/**< Maximum size, in bytes, of the
+					 * data of a token, or 0 for none.
+					 * Longer runs of characters and
+					 * comments are passed on in pieces
+					 * (of which the treebuilder keeps
+					 * the first, for comments); longer
+					 * attribute values are truncated */
+
+	unsigned int threads;		/**< Number of threads on which to
+					 * tokenise a large document given
+					 * to hubbub_parser_parse_buffer(),
+					 * or 0 or 1 for just the caller's.
+					 * The allocator must then be safe to
+					 * call from any thread, so this is
+					 * not for parsers with an arena */
+
+	bool pipeline;			/**< Whether to tokenise a document
+					 * given to
+					 * hubbub_parser_parse_buffer() on a
+					 * thread of its own, ahead of the
+					 * treebuilder, unless it is to be
+					 * tokenised on several threads.
+					 * The allocator must then be safe to
+					 * call from any thread, so this is
+					 * not for parsers with an arena */
+
+	struct {
+		size_t tokens;		/**< Tokens, or 0 for no limit */
+		size_t bytes;		/**< Bytes of input, or 0 for none */
+	} budget;			/**< Work to do in each call which
+					 * parses, before the parser pauses
+					 * and HUBBUB_PAUSED is returned.
+					 * Parsing resumes, with a budget
+					 * as large, once the pause is
+					 * cleared. Budgets are counted in
+					 * whole tokens, so may be exceeded
+					 * by a token or two */
+
 	bool pause_parse;		/**< Pause parsing */
+
+	bool track_position;		/**< Whether to set the location of
+					 * each token passed to the token
+					 * handler */
+
+	struct {
+		hubbub_token_batch_handler handler;
+		void *pw;
+		size_t size;		/**< Maximum tokens per batch */
+	} token_batch_handler;		/**< Batched token handling callback,
+					 * used in place of the token handler
+					 * when set. Tokens are passed on
+					 * once a batch is full, and at the
+					 * end of each call which parses
+					 * data */
+
+	struct {
+		hubbub_compact_token_handler handler;
+		void *pw;
+	} compact_token_handler;	/**< Compact token handling callback,
+					 * used in place of the token handler
+					 * when set. Unless batched, tokens
+					 * are passed on as compact tokens */
 } hubbub_parser_optparams;
 
 /* Create a hubbub parser */
 hubbub_error hubbub_parser_create(const char *enc, bool fix_enc,
 		hubbub_allocator_fn alloc, void *pw, hubbub_parser **parser);
+/* Create a hubbub parser which allocates from its own arena */
+hubbub_error hubbub_parser_create_arena(const char *enc, bool fix_enc,
+		hubbub_allocator_fn alloc, void *pw, hubbub_parser **parser);
 /* Destroy a hubbub parser */
 hubbub_error hubbub_parser_destroy(hubbub_parser *parser);
 
+/* Return a hubbub parser to its initial state, to parse another document */
+hubbub_error hubbub_parser_reset(hubbub_parser *parser, const char *enc);
+
+/* Retrieve the arena owned by a hubbub parser */
+hubbub_arena *hubbub_parser_get_arena(hubbub_parser *parser);
+
 /* Configure a hubbub parser */
 hubbub_error hubbub_parser_setopt(hubbub_parser *parser,
 		hubbub_parser_opttype type,
@@ -81,6 +211,11 @@ hubbub_error hubbub_parser_setopt(hubbub_parser *parser,
 hubbub_error hubbub_parser_parse_chunk(hubbub_parser *parser,
 		const uint8_t *data, size_t len);
 
+/* Parse a whole document, held in a buffer owned by the client */
+/* This data is encoded in the input charset */
+hubbub_error hubbub_parser_parse_buffer(hubbub_parser *parser,
+		const uint8_t *data, size_t len);
+
 /**
  * Insert a chunk of data into a hubbub parser input stream
  *
@@ -104,6 +239,26 @@ hubbub_error hubbub_parser_completed(hubbub_parser *parser);
 const char *hubbub_parser_read_charset(hubbub_parser *parser,
 		hubbub_charset_source *source);
 
+/* Take a checkpoint of a parse, from which other documents may be parsed */
+hubbub_error hubbub_parser_checkpoint(hubbub_parser *parser,
+		hubbub_checkpoint **checkpoint);
+
+/* Destroy a checkpoint */
+void hubbub_parser_checkpoint_destroy(hubbub_parser *parser,
+		hubbub_checkpoint *checkpoint);
+
+/* Find where in its document a checkpoint was taken */
+size_t hubbub_checkpoint_offset(const hubbub_checkpoint *checkpoint);
+
+/* Determine whether two checkpoints parse what follows alike */
+bool hubbub_checkpoint_converged(const hubbub_checkpoint *a,
+		const hubbub_checkpoint *b);
+
+/* Parse a document from a checkpoint, taken of a parse of an earlier one */
+hubbub_error hubbub_parser_parse_from(hubbub_parser *parser,
+		const hubbub_checkpoint *checkpoint,
+		const uint8_t *data, size_t len);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,65 @@
+/*
+ * This file is part of Hubbub.
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license.php
+ * Copyright 2026 agent <agent@local>
+ */
+
+#ifndef hubbub_preload_h_
+#define hubbub_preload_h_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <hubbub/errors.h>
+#include <hubbub/parser.h>
+#include <hubbub/types.h>
+
+/**
+ * Types of resource found by the preload scanner
+ */
+typedef enum hubbub_preload_type {
+	HUBBUB_PRELOAD_BASE,		/**< Base URL, from <base href>.
+					 * Only the first is reported */
+	HUBBUB_PRELOAD_SCRIPT,		/**< Script, from <script src> */
+	HUBBUB_PRELOAD_STYLESHEET,	/**< Stylesheet, from
+					 * <link rel=stylesheet href> */
+	HUBBUB_PRELOAD_IMAGE		/**< Image, from <img src>,
+					 * <input type=image src>, or a
+					 * candidate of <img srcset> or
+					 * <source srcset> */
+} hubbub_preload_type;
+
+/**
+ * A resource found by the preload scanner
+ */
+typedef struct hubbub_preload {
+	hubbub_preload_type type;	/**< Type of resource */
+	hubbub_string url;		/**< URL, as given in the document,
+					 * without surrounding whitespace */
+} hubbub_preload;
+
+/**
+ * Type of preload handling function
+ *
+ * The URL is only valid for the duration of the call.
+ *
+ * \param preload  Pointer to resource found
+ * \param pw       Pointer to client data
+ * \return HUBBUB_OK to carry on scanning, HUBBUB_STOPPED to stop
+ */
+typedef hubbub_error (*hubbub_preload_handler)(
+		const hubbub_preload *preload, void *pw);
+
+/* Scan the input a paused parser has yet to parse, for resources */
+hubbub_error hubbub_parser_preload(hubbub_parser *parser,
+		hubbub_preload_handler handler, void *pw);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
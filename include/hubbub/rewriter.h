@@ -0,0 +1,98 @@
+/*
+ * This file is part of Hubbub.
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license.php
+ * Copyright 2026 agent <agent@local>
+ */
+
+#ifndef hubbub_rewriter_h_
+#define hubbub_rewriter_h_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stddef.h>
+#include <inttypes.h>
+
+#include <hubbub/errors.h>
+#include <hubbub/functypes.h>
+#include <hubbub/types.h>
+
+/**
+ * Streaming rewriter
+ *
+ * A rewriter tokenises a document, and writes it out again to a sink, a
+ * token at a time. Each token is handed to the client first, which may
+ * write text of its own before it, or replace it or drop it. The source of
+ * every token which the client leaves alone is copied out as it was, in
+ * runs as long as the input allows, so only replaced tokens are ever
+ * serialised.
+ *
+ * There is no treebuilder. In its place, the content model is set after
+ * each start tag whose content is text, as the preload scanner does.
+ */
+typedef struct hubbub_rewriter hubbub_rewriter;
+
+/**
+ * Type of rewriter output function
+ *
+ * \param data  Output, valid only for the duration of the call
+ * \param len   Length, in bytes, of data
+ * \param pw    Pointer to client data
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ */
+typedef hubbub_error (*hubbub_rewriter_sink)(const uint8_t *data,
+		size_t len, void *pw);
+
+/**
+ * Type of rewriter token handling function
+ *
+ * The token is copied out once the handler returns, unless the handler has
+ * copied, replaced or dropped it already.
+ *
+ * \param rewriter  Rewriter the token is from
+ * \param token     Token to handle, valid only for the duration of the call
+ * \param pw        Pointer to client data
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ */
+typedef hubbub_error (*hubbub_rewriter_handler)(hubbub_rewriter *rewriter,
+		const hubbub_token *token, void *pw);
+
+/* Create a rewriter */
+hubbub_error hubbub_rewriter_create(hubbub_rewriter_handler handler,
+		hubbub_rewriter_sink sink, void *pw,
+		hubbub_allocator_fn alloc, void *alloc_pw,
+		hubbub_rewriter **rewriter);
+
+/* Destroy a rewriter */
+hubbub_error hubbub_rewriter_destroy(hubbub_rewriter *rewriter);
+
+/* Pass a chunk of UTF-8 data to a rewriter */
+hubbub_error hubbub_rewriter_process_chunk(hubbub_rewriter *rewriter,
+		const uint8_t *data, size_t len);
+
+/* Inform the rewriter that the last chunk of data has been passed to it */
+hubbub_error hubbub_rewriter_completed(hubbub_rewriter *rewriter);
+
+/* Write text of the client's to the output */
+hubbub_error hubbub_rewriter_write(hubbub_rewriter *rewriter,
+		const uint8_t *data, size_t len);
+
+/* Copy the source of the current token to the output */
+hubbub_error hubbub_rewriter_copy(hubbub_rewriter *rewriter);
+
+/* Write a token in place of the current token */
+hubbub_error hubbub_rewriter_replace(hubbub_rewriter *rewriter,
+		const hubbub_token *token);
+
+/* Drop the current token from the output */
+hubbub_error hubbub_rewriter_drop(hubbub_rewriter *rewriter);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
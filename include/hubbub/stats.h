@@ -0,0 +1,101 @@
+/*
+ * This file is part of Hubbub.
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license.php
+ * Copyright 2026 agent <agent@local>
+ */
+
+#ifndef hubbub_stats_h_
+#define hubbub_stats_h_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stddef.h>
+#include <inttypes.h>
+
+#include <hubbub/errors.h>
+#include <hubbub/parser.h>
+#include <hubbub/types.h>
+
+/** Number of token types counted */
+#define HUBBUB_STATS_TOKEN_TYPES (HUBBUB_TOKEN_EOF + 1)
+
+/**
+ * Tree handler callbacks, as counted
+ */
+typedef enum hubbub_tree_call {
+	HUBBUB_TREE_CREATE_COMMENT,
+	HUBBUB_TREE_CREATE_DOCTYPE,
+	HUBBUB_TREE_CREATE_ELEMENT,
+	HUBBUB_TREE_CREATE_TEXT,
+	HUBBUB_TREE_REF_NODE,
+	HUBBUB_TREE_UNREF_NODE,
+	HUBBUB_TREE_APPEND_CHILD,
+	HUBBUB_TREE_INSERT_BEFORE,
+	HUBBUB_TREE_REMOVE_CHILD,
+	HUBBUB_TREE_CLONE_NODE,
+	HUBBUB_TREE_REPARENT_CHILDREN,
+	HUBBUB_TREE_GET_PARENT,
+	HUBBUB_TREE_HAS_CHILDREN,
+	HUBBUB_TREE_FORM_ASSOCIATE,
+	HUBBUB_TREE_ADD_ATTRIBUTES,
+	HUBBUB_TREE_SET_QUIRKS_MODE,
+	HUBBUB_TREE_ENCODING_CHANGE,
+	HUBBUB_TREE_COMPLETE_SCRIPT,
+	HUBBUB_TREE_COMPLETE_STYLE,
+	HUBBUB_TREE_CREATE_AND_APPEND_ELEMENT,	/**< Extended handler */
+	HUBBUB_TREE_APPEND_TEXT,		/**< Extended handler */
+	HUBBUB_TREE_SKIP_ELEMENT,		/**< Extended handler */
+	HUBBUB_TREE_ELEMENT_COMPLETE,		/**< Extended handler */
+
+	HUBBUB_TREE_CALLS			/**< Number of callbacks */
+} hubbub_tree_call;
+
+/**
+ * Counters of the work done by a parser, since it was created
+ *
+ * Work done on other threads, by tokenisers reading ahead (see
+ * HUBBUB_PARSER_THREADS and HUBBUB_PARSER_PIPELINE), is not counted,
+ * other than their allocations; the tokens they find are counted as the
+ * parser replays them.
+ */
+typedef struct hubbub_parser_stats {
+	uint64_t bytes;			/**< Bytes of input given to the
+					 * parser, before decoding */
+	uint64_t tokens[HUBBUB_STATS_TOKEN_TYPES];
+					/**< Tokens emitted, by type */
+	uint64_t tree_calls[HUBBUB_TREE_CALLS];
+					/**< Tree handler calls, by callback */
+
+	uint64_t alloc_calls;		/**< Calls to the allocator */
+	size_t peak_alloc;		/**< Most bytes allocated at once */
+
+	uint32_t max_depth;		/**< Greatest depth of the stack of
+					 * open elements */
+	uint32_t max_formatting;	/**< Greatest length of the list of
+					 * active formatting elements */
+	uint64_t adoptions;		/**< Runs of the adoption agency */
+	uint64_t foster_parented;	/**< Nodes inserted into a foster
+					 * parent */
+	uint64_t entity_lookups;	/**< Named character references
+					 * looked up */
+	uint32_t encoding_restarts;	/**< Changes of charset part way
+					 * through, in place or by the
+					 * client starting again */
+	uint64_t depth_limited;		/**< Elements inserted beside the
+					 * deepest, at the depth limit */
+} hubbub_parser_stats;
+
+/* Retrieve the counters of the work done by a parser */
+hubbub_error hubbub_parser_get_stats(hubbub_parser *parser,
+		hubbub_parser_stats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
@@ -65,6 +65,10 @@ typedef hubbub_error (*hubbub_tree_create_element)(void *ctx,
  * \param result  Pointer to location to receive created node
  * \return HUBBUB_OK on success, appropriate error otherwise.
  *
+ * Consecutive character data for the same parent is collected into a
+ * single text node, which is created only when something else is inserted
+ * into the tree or a token other than characters is processed.
+ *
  * Postcondition: if successful, result's reference count must be 1.
  */
 typedef hubbub_error (*hubbub_tree_create_text)(void *ctx, 
@@ -189,6 +193,11 @@ typedef hubbub_error (*hubbub_tree_reparent_children)(void *ctx,
  * If there is a parent node, but it is not an element node and element_only
  * is true, then act as if no parent existed.
  *
+ * The treebuilder remembers where it inserted the elements it holds, and
+ * the parents it has been told of, until the client has had the chance to
+ * change the tree (by running a script, or between chunks of input). So
+ * this is only called for nodes it has lost track of.
+ *
  * Postcondition: if there is a parent, then result's reference count must be
  * increased.
  */
@@ -204,6 +213,8 @@ typedef hubbub_error (*hubbub_tree_get_parent)(void *ctx,
  * \param node    The node to inspect
  * \param result  Location to receive result
  * \return HUBBUB_OK on success, appropriate error otherwise.
+ *
+ * The treebuilder does not call this, so it may be NULL.
  */
 typedef hubbub_error (*hubbub_tree_has_children)(void *ctx, 
 		void *node, 
@@ -254,6 +265,10 @@ typedef hubbub_error (*hubbub_tree_set_quirks_mode)(void *ctx,
  *         HUBBUB_ENCODINGCHANGE to stop processing immediately and 
  *                               return control to the client,
  *         appropriate error otherwise.
+ *
+ * This is not called where the charset being used was not given by the
+ * client, and the document so far decodes the same in the new one: the
+ * parser then switches to the new charset itself, and carries on.
  */
 typedef hubbub_error (*hubbub_tree_encoding_change)(void *ctx, 
 		const char *encname);
@@ -302,6 +317,127 @@ typedef struct hubbub_tree_handler {
 	void *ctx;					/**< Context pointer */
 } hubbub_tree_handler;
 
+/**
+ * Create an element node and append it to the end of another's child list
+ *
+ * \param ctx     Client's context
+ * \param parent  The node to append to
+ * \param tag     Data for element node (namespace, name, attributes)
+ * \param result  Pointer to location to receive appended node
+ * \return HUBBUB_OK on success, appropriate error otherwise.
+ *
+ * This has the same effect as create_element, then append_child, then
+ * unref_node on the created node.
+ *
+ * Postcondition: if successful, result's reference count must be 1.
+ */
+typedef hubbub_error (*hubbub_tree_create_and_append_element)(void *ctx,
+		void *parent,
+		const hubbub_tag *tag,
+		void **result);
+
+/**
+ * Append text to the end of a node's child list
+ *
+ * \param ctx     Client's context
+ * \param parent  The node to append to
+ * \param data    String content of text
+ * \return HUBBUB_OK on success, appropriate error otherwise.
+ *
+ * This has the same effect as create_text, then append_child, then
+ * unref_node on both the created and the appended node. As for
+ * append_child, the text may be merged into a text node which is already
+ * the last child of parent.
+ */
+typedef hubbub_error (*hubbub_tree_append_text)(void *ctx,
+		void *parent,
+		const hubbub_string *data);
+
+/**
+ * Decide whether an element is to be built at all
+ *
+ * \param ctx   Client's context
+ * \param tag   Data for element node (namespace, name, attributes)
+ * \param skip  Pointer to location to receive true to skip the element
+ * \return HUBBUB_OK on success, appropriate error otherwise.
+ *
+ * This is consulted before an element is inserted. A skipped element is
+ * still tracked by the treebuilder, so that errors in its content are
+ * recovered from as usual, but no node is created for it, nor for anything
+ * inside it, and its text is discarded without being copied. The client
+ * is not asked about elements inside a skipped one, nor about the html,
+ * head, body and frameset elements, which are always built.
+ */
+typedef hubbub_error (*hubbub_tree_skip_element)(void *ctx,
+		const hubbub_tag *tag,
+		bool *skip);
+
+/**
+ * Notification that an element is complete
+ *
+ * \param ctx   Client's context
+ * \param node  The element which has been closed
+ * \return HUBBUB_OK on success, appropriate error otherwise.
+ *
+ * This is called when an element is popped from the stack of open
+ * elements, and for each element still open, innermost first, once the
+ * end of the document has been processed or parsing has stopped. An
+ * element which is removed from the middle of the stack, because of
+ * misnested markup, is not reported; it is complete when its parent is.
+ *
+ * Once an element is complete, nothing will be added to it, nor removed
+ * from it, with these exceptions:
+ *
+ *  + The element itself may be moved to another parent, if its parent is
+ *    still open, when the adoption agency moves its siblings.
+ *  + A formatting element (a, b, big, code, em, font, i, nobr, s, small,
+ *    strike, strong, tt, u) may be shallow cloned; and a form element may
+ *    be associated with controls, until the next form is inserted or the
+ *    form's end tag is seen.
+ *  + The head element may be reopened, to insert elements which follow
+ *    it; it is then completed once more.
+ *
+ * So the content of a complete element may be processed, and released,
+ * at once; the element itself may be released when none of these apply.
+ */
+typedef hubbub_error (*hubbub_tree_element_complete)(void *ctx, void *node);
+
+/**
+ * The client does not count references to nodes, so ref_node and
+ * unref_node are never called (and may be NULL)
+ */
+#define HUBBUB_TREE_NO_REFCOUNT		(1 << 0)
+
+/**
+ * Hubbub extended tree handler
+ *
+ * This supplements a hubbub_tree_handler, with the same context pointer.
+ * Operations which are NULL are performed using the basic tree handler.
+ */
+typedef struct hubbub_tree_handler_ext {
+	hubbub_tree_create_and_append_element create_and_append_element;
+					/**< Create and append element */
+	hubbub_tree_append_text append_text;	/**< Append text */
+	uint32_t flags;				/**< HUBBUB_TREE_* flags */
+	hubbub_tree_skip_element skip_element;	/**< Filter elements */
+	hubbub_tree_element_complete element_complete;
+						/**< Element complete */
+} hubbub_tree_handler_ext;
+
+/**
+ * Context in which a document fragment is parsed
+ *
+ * The fragment is parsed as if it were the content of an element with the
+ * given name, and the nodes built from it are appended to root in place of
+ * that element. There is no html, head or body element unless the fragment
+ * or the context calls for one.
+ */
+typedef struct hubbub_fragment {
+	hubbub_ns ns;			/**< Namespace of context element */
+	hubbub_string name;		/**< Name of context element */
+	void *root;			/**< Node to append the fragment to */
+} hubbub_fragment;
+
 #ifdef __cplusplus
 }
 #endif
@@ -70,6 +70,11 @@ typedef enum hubbub_ns {
 	HUBBUB_NS_XMLNS
 } hubbub_ns;
 
+/**
+ * Atom of a name, one of those in hubbub/atoms.h
+ */
+typedef uint32_t hubbub_atom;
+
 /**
  * Tokeniser string type
  */
@@ -83,8 +88,12 @@ typedef struct hubbub_string {
  */
 typedef struct hubbub_attribute {
 	hubbub_ns ns;			/**< Attribute namespace */
+	hubbub_atom atom;		/**< Atom of name, if any */
 	hubbub_string name;		/**< Attribute name */
 	hubbub_string value;		/**< Attribute value */
+	bool raw;			/**< Whether the value is as written,
+					 * and needs decoding (see
+					 * hubbub/attribute.h) */
 } hubbub_attribute;
 
 /**
@@ -107,12 +116,30 @@ typedef struct hubbub_doctype {
  */
 typedef struct hubbub_tag {
 	hubbub_ns ns;			/**< Tag namespace */
+	hubbub_atom atom;		/**< Atom of name, if any */
 	hubbub_string name;		/**< Tag name */
 	uint32_t n_attributes;		/**< Count of attributes */
 	hubbub_attribute *attributes;	/**< Array of attribute data */
 	bool self_closing;		/**< Whether the tag can have children */
 } hubbub_tag;
 
+/**
+ * Location of a token in the source data
+ *
+ * Offsets count bytes of the input stream, after conversion to UTF-8. The
+ * spans of successive tokens are contiguous, so any input which does not
+ * produce a token of its own (such as "</>") is included in the span of
+ * the token which follows it. Comments which are being dropped are the
+ * exception: nothing covers them.
+ */
+typedef struct hubbub_location {
+	size_t start;			/**< Offset of start of token */
+	size_t end;			/**< Offset just past end of token */
+	uint32_t line;			/**< Line of start of token (from 1) */
+	uint32_t col;			/**< Byte column of start of token
+					 * (from 1) */
+} hubbub_location;
+
 /**
  * Token data
  */
@@ -128,8 +155,128 @@ typedef struct hubbub_token {
 
 		hubbub_string character;
 	} data;				/**< Type-specific data */
+
+	bool incomplete;		/**< Whether the data continues in the
+					 * next token, as this character or
+					 * comment token was split at the
+					 * token limit */
+	bool whitespace;		/**< Whether this character token is
+					 * known to be all whitespace. If
+					 * false, it may be so regardless */
+
+	hubbub_location location;	/**< Location of token in source
+					 * (only set when tracking the
+					 * position in the input) */
 } hubbub_token;
 
+/**
+ * String of a compact token, relative to the token's string base
+ */
+typedef struct hubbub_span {
+	uint32_t off;			/**< Offset of data from base */
+	uint32_t len;			/**< Byte length of string */
+} hubbub_span;
+
+/**
+ * Tag attribute data, in a compact token
+ */
+typedef struct hubbub_compact_attribute {
+	hubbub_span name;		/**< Attribute name */
+	hubbub_span value;		/**< Attribute value */
+	uint16_t atom;			/**< Atom of name, if any */
+	uint8_t ns;			/**< Attribute namespace, a hubbub_ns */
+	uint8_t raw;			/**< Whether the value needs decoding */
+} hubbub_compact_attribute;
+
+/**
+ * Flags of a compact token
+ */
+#define HUBBUB_COMPACT_INCOMPLETE	(1 << 0)	/**< Data continues in
+							 * the next token */
+#define HUBBUB_COMPACT_SELF_CLOSING	(1 << 1)	/**< Tag is
+							 * self-closing */
+#define HUBBUB_COMPACT_FORCE_QUIRKS	(1 << 2)	/**< Doctype
+							 * force-quirks flag */
+#define HUBBUB_COMPACT_PUBLIC_MISSING	(1 << 3)	/**< Doctype public id
+							 * is missing */
+#define HUBBUB_COMPACT_SYSTEM_MISSING	(1 << 4)	/**< Doctype system id
+							 * is missing */
+#define HUBBUB_COMPACT_WHITESPACE	(1 << 5)	/**< Character data is
+							 * known to be all
+							 * whitespace */
+
+/**
+ * Compact token data
+ *
+ * This is the same token as a hubbub_token, laid out to be smaller: each
+ * string is a 32-bit offset and length from one base pointer, rather than
+ * a pointer and size_t of its own, and namespaces are a byte. Where all of
+ * a token's strings lie in the input, base points into it, and nothing is
+ * copied.
+ */
+typedef struct hubbub_compact_token {
+	const uint8_t *base;		/**< Base of the token's strings */
+
+	uint8_t type;			/**< The token type, a
+					 * hubbub_token_type */
+	uint8_t ns;			/**< Tag namespace, a hubbub_ns */
+	uint8_t flags;			/**< HUBBUB_COMPACT_ flags */
+	uint32_t atom;			/**< Atom of tag name, if any */
+
+	hubbub_span data;		/**< Tag or doctype name, or the
+					 * comment or character data */
+	hubbub_span public_id;		/**< Doctype public identifier */
+	hubbub_span system_id;		/**< Doctype system identifier */
+
+	uint32_t n_attributes;		/**< Count of attributes of tag */
+	const hubbub_compact_attribute *attributes;
+					/**< Array of attribute data */
+
+	const hubbub_location *location;
+					/**< Location of token in source,
+					 * or NULL unless tracking the
+					 * position in the input */
+} hubbub_compact_token;
+
+/**
+ * Structural event types
+ */
+typedef enum hubbub_event_type {
+	HUBBUB_EVENT_OPEN,		/**< An element has been opened */
+	HUBBUB_EVENT_CLOSE,		/**< An element has been closed */
+	HUBBUB_EVENT_TEXT		/**< Character data */
+} hubbub_event_type;
+
+/**
+ * A structural event
+ *
+ * Events are found from the treebuilder's stack of open elements, so are
+ * always correctly nested. Where the treebuilder rearranges open elements
+ * (when recovering from misnested formatting elements, for instance), the
+ * elements affected are closed, and then opened again as continuations.
+ * Content which a tree would have foster parented out of a table is
+ * reported where it was found.
+ */
+typedef struct hubbub_event {
+	hubbub_event_type type;		/**< The event type */
+
+	uint32_t depth;			/**< Number of open elements which
+					 * enclose the element or text */
+
+	hubbub_ns ns;			/**< Namespace of element */
+	hubbub_string name;		/**< Name of element, or the text */
+
+	uint32_t n_attributes;		/**< Count of attributes */
+	const hubbub_attribute *attributes;
+					/**< Attributes of element, when
+					 * opened by its start tag */
+
+	bool continued;			/**< Whether the element opened is a
+					 * continuation of one closed earlier,
+					 * or was reopened to hold content
+					 * (and so has no attributes) */
+} hubbub_event;
+
 #ifdef __cplusplus
 }
 #endif
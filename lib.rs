@@ -1 +1,1416 @@
-// Intentionally blank
+/*
+ * This file is part of Hubbub.
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license.php
+ * Copyright 2008 John-Mark Bell <jmb@netsurf-browser.org>
+ */
+
+//! Bindings to the Hubbub HTML parser
+//!
+//! `ffi` declares the C interface as it is. The rest of the crate wraps it
+//! without copying: the strings of tokens and tree handler calls are handed
+//! out as `&[u8]` slices of the parser's own buffers, which borrow no longer
+//! than the callback they are passed to.
+//!
+//! A tree is built with an implementation of `TreeSink`. The parser calls it
+//! through functions instantiated for that type alone, so each call is a
+//! direct one, with no trait object between the parser and the sink.
+//!
+//! Callbacks must not panic: a panic cannot unwind through the parser, so
+//! aborts the process.
+
+#![allow(non_camel_case_types)]
+
+use std::borrow::Cow;
+use std::ffi::{CStr, CString};
+use std::fmt;
+use std::marker::PhantomData;
+use std::num::NonZeroUsize;
+use std::os::raw::{c_char, c_void};
+use std::ptr;
+use std::slice;
+
+pub mod ffi {
+	//! Declarations of the C interface (see include/hubbub)
+
+	use std::os::raw::{c_char, c_uint, c_void};
+
+	pub type hubbub_error = c_uint;
+	pub const HUBBUB_OK: hubbub_error = 0;
+	pub const HUBBUB_REPROCESS: hubbub_error = 1;
+	pub const HUBBUB_ENCODINGCHANGE: hubbub_error = 2;
+	pub const HUBBUB_PAUSED: hubbub_error = 3;
+	pub const HUBBUB_STOPPED: hubbub_error = 4;
+	pub const HUBBUB_NOMEM: hubbub_error = 5;
+	pub const HUBBUB_BADPARM: hubbub_error = 6;
+	pub const HUBBUB_INVALID: hubbub_error = 7;
+	pub const HUBBUB_FILENOTFOUND: hubbub_error = 8;
+	pub const HUBBUB_NEEDDATA: hubbub_error = 9;
+	pub const HUBBUB_BADENCODING: hubbub_error = 10;
+	pub const HUBBUB_UNKNOWN: hubbub_error = 11;
+
+	pub type hubbub_charset_source = c_uint;
+	pub const HUBBUB_CHARSET_UNKNOWN: hubbub_charset_source = 0;
+	pub const HUBBUB_CHARSET_TENTATIVE: hubbub_charset_source = 1;
+	pub const HUBBUB_CHARSET_CONFIDENT: hubbub_charset_source = 2;
+
+	pub type hubbub_content_model = c_uint;
+	pub const HUBBUB_CONTENT_MODEL_PCDATA: hubbub_content_model = 0;
+	pub const HUBBUB_CONTENT_MODEL_RCDATA: hubbub_content_model = 1;
+	pub const HUBBUB_CONTENT_MODEL_CDATA: hubbub_content_model = 2;
+	pub const HUBBUB_CONTENT_MODEL_PLAINTEXT: hubbub_content_model = 3;
+
+	pub type hubbub_quirks_mode = c_uint;
+	pub const HUBBUB_QUIRKS_MODE_NONE: hubbub_quirks_mode = 0;
+	pub const HUBBUB_QUIRKS_MODE_LIMITED: hubbub_quirks_mode = 1;
+	pub const HUBBUB_QUIRKS_MODE_FULL: hubbub_quirks_mode = 2;
+
+	pub type hubbub_token_type = c_uint;
+	pub const HUBBUB_TOKEN_DOCTYPE: hubbub_token_type = 0;
+	pub const HUBBUB_TOKEN_START_TAG: hubbub_token_type = 1;
+	pub const HUBBUB_TOKEN_END_TAG: hubbub_token_type = 2;
+	pub const HUBBUB_TOKEN_COMMENT: hubbub_token_type = 3;
+	pub const HUBBUB_TOKEN_CHARACTER: hubbub_token_type = 4;
+	pub const HUBBUB_TOKEN_EOF: hubbub_token_type = 5;
+
+	pub type hubbub_ns = c_uint;
+	pub const HUBBUB_NS_NULL: hubbub_ns = 0;
+	pub const HUBBUB_NS_HTML: hubbub_ns = 1;
+	pub const HUBBUB_NS_MATHML: hubbub_ns = 2;
+	pub const HUBBUB_NS_SVG: hubbub_ns = 3;
+	pub const HUBBUB_NS_XLINK: hubbub_ns = 4;
+	pub const HUBBUB_NS_XML: hubbub_ns = 5;
+	pub const HUBBUB_NS_XMLNS: hubbub_ns = 6;
+
+	pub type hubbub_atom = u32;
+	pub const HUBBUB_ATOM_NONE: hubbub_atom = 0;
+
+	#[repr(C)]
+	#[derive(Clone, Copy)]
+	pub struct hubbub_string {
+		pub ptr: *const u8,
+		pub len: usize,
+	}
+
+	#[repr(C)]
+	#[derive(Clone, Copy)]
+	pub struct hubbub_attribute {
+		pub ns: hubbub_ns,
+		pub atom: hubbub_atom,
+		pub name: hubbub_string,
+		pub value: hubbub_string,
+		pub raw: bool,
+	}
+
+	#[repr(C)]
+	#[derive(Clone, Copy)]
+	pub struct hubbub_doctype {
+		pub name: hubbub_string,
+		pub public_missing: bool,
+		pub public_id: hubbub_string,
+		pub system_missing: bool,
+		pub system_id: hubbub_string,
+		pub force_quirks: bool,
+	}
+
+	#[repr(C)]
+	#[derive(Clone, Copy)]
+	pub struct hubbub_tag {
+		pub ns: hubbub_ns,
+		pub atom: hubbub_atom,
+		pub name: hubbub_string,
+		pub n_attributes: u32,
+		pub attributes: *mut hubbub_attribute,
+		pub self_closing: bool,
+	}
+
+	#[repr(C)]
+	#[derive(Clone, Copy)]
+	pub struct hubbub_location {
+		pub start: usize,
+		pub end: usize,
+		pub line: u32,
+		pub col: u32,
+	}
+
+	#[repr(C)]
+	#[derive(Clone, Copy)]
+	pub union hubbub_token_data {
+		pub doctype: hubbub_doctype,
+		pub tag: hubbub_tag,
+		pub comment: hubbub_string,
+		pub character: hubbub_string,
+	}
+
+	#[repr(C)]
+	#[derive(Clone, Copy)]
+	pub struct hubbub_token {
+		pub type_: hubbub_token_type,
+		pub data: hubbub_token_data,
+		pub incomplete: bool,
+		pub whitespace: bool,
+		pub location: hubbub_location,
+	}
+
+	pub type hubbub_allocator_fn = Option<unsafe extern "C" fn(
+			ptr: *mut c_void, size: usize,
+			pw: *mut c_void) -> *mut c_void>;
+
+	pub type hubbub_token_handler = Option<unsafe extern "C" fn(
+			token: *const hubbub_token,
+			pw: *mut c_void) -> hubbub_error>;
+
+	pub type hubbub_error_handler = Option<unsafe extern "C" fn(
+			line: u32, col: u32, message: *const c_char,
+			pw: *mut c_void)>;
+
+	pub type hubbub_tree_create_comment = Option<unsafe extern "C" fn(
+			ctx: *mut c_void, data: *const hubbub_string,
+			result: *mut *mut c_void) -> hubbub_error>;
+	pub type hubbub_tree_create_doctype = Option<unsafe extern "C" fn(
+			ctx: *mut c_void, doctype: *const hubbub_doctype,
+			result: *mut *mut c_void) -> hubbub_error>;
+	pub type hubbub_tree_create_element = Option<unsafe extern "C" fn(
+			ctx: *mut c_void, tag: *const hubbub_tag,
+			result: *mut *mut c_void) -> hubbub_error>;
+	pub type hubbub_tree_create_text = Option<unsafe extern "C" fn(
+			ctx: *mut c_void, data: *const hubbub_string,
+			result: *mut *mut c_void) -> hubbub_error>;
+	pub type hubbub_tree_ref_node = Option<unsafe extern "C" fn(
+			ctx: *mut c_void, node: *mut c_void) -> hubbub_error>;
+	pub type hubbub_tree_unref_node = Option<unsafe extern "C" fn(
+			ctx: *mut c_void, node: *mut c_void) -> hubbub_error>;
+	pub type hubbub_tree_append_child = Option<unsafe extern "C" fn(
+			ctx: *mut c_void, parent: *mut c_void,
+			child: *mut c_void,
+			result: *mut *mut c_void) -> hubbub_error>;
+	pub type hubbub_tree_insert_before = Option<unsafe extern "C" fn(
+			ctx: *mut c_void, parent: *mut c_void,
+			child: *mut c_void, ref_child: *mut c_void,
+			result: *mut *mut c_void) -> hubbub_error>;
+	pub type hubbub_tree_remove_child = Option<unsafe extern "C" fn(
+			ctx: *mut c_void, parent: *mut c_void,
+			child: *mut c_void,
+			result: *mut *mut c_void) -> hubbub_error>;
+	pub type hubbub_tree_clone_node = Option<unsafe extern "C" fn(
+			ctx: *mut c_void, node: *mut c_void, deep: bool,
+			result: *mut *mut c_void) -> hubbub_error>;
+	pub type hubbub_tree_reparent_children = Option<unsafe extern "C" fn(
+			ctx: *mut c_void, node: *mut c_void,
+			new_parent: *mut c_void) -> hubbub_error>;
+	pub type hubbub_tree_get_parent = Option<unsafe extern "C" fn(
+			ctx: *mut c_void, node: *mut c_void,
+			element_only: bool,
+			result: *mut *mut c_void) -> hubbub_error>;
+	pub type hubbub_tree_has_children = Option<unsafe extern "C" fn(
+			ctx: *mut c_void, node: *mut c_void,
+			result: *mut bool) -> hubbub_error>;
+	pub type hubbub_tree_form_associate = Option<unsafe extern "C" fn(
+			ctx: *mut c_void, form: *mut c_void,
+			node: *mut c_void) -> hubbub_error>;
+	pub type hubbub_tree_add_attributes = Option<unsafe extern "C" fn(
+			ctx: *mut c_void, node: *mut c_void,
+			attributes: *const hubbub_attribute,
+			n_attributes: u32) -> hubbub_error>;
+	pub type hubbub_tree_set_quirks_mode = Option<unsafe extern "C" fn(
+			ctx: *mut c_void,
+			mode: hubbub_quirks_mode) -> hubbub_error>;
+	pub type hubbub_tree_encoding_change = Option<unsafe extern "C" fn(
+			ctx: *mut c_void,
+			encname: *const c_char) -> hubbub_error>;
+	pub type hubbub_tree_complete_script = Option<unsafe extern "C" fn(
+			ctx: *mut c_void, script: *mut c_void) -> hubbub_error>;
+	pub type hubbub_tree_complete_style = Option<unsafe extern "C" fn(
+			ctx: *mut c_void, style: *mut c_void) -> hubbub_error>;
+
+	#[repr(C)]
+	pub struct hubbub_tree_handler {
+		pub create_comment: hubbub_tree_create_comment,
+		pub create_doctype: hubbub_tree_create_doctype,
+		pub create_element: hubbub_tree_create_element,
+		pub create_text: hubbub_tree_create_text,
+		pub ref_node: hubbub_tree_ref_node,
+		pub unref_node: hubbub_tree_unref_node,
+		pub append_child: hubbub_tree_append_child,
+		pub insert_before: hubbub_tree_insert_before,
+		pub remove_child: hubbub_tree_remove_child,
+		pub clone_node: hubbub_tree_clone_node,
+		pub reparent_children: hubbub_tree_reparent_children,
+		pub get_parent: hubbub_tree_get_parent,
+		pub has_children: hubbub_tree_has_children,
+		pub form_associate: hubbub_tree_form_associate,
+		pub add_attributes: hubbub_tree_add_attributes,
+		pub set_quirks_mode: hubbub_tree_set_quirks_mode,
+		pub encoding_change: hubbub_tree_encoding_change,
+		pub complete_script: hubbub_tree_complete_script,
+		pub complete_style: hubbub_tree_complete_style,
+		pub ctx: *mut c_void,
+	}
+
+	#[repr(C)]
+	#[derive(Clone, Copy)]
+	pub struct hubbub_fragment {
+		pub ns: hubbub_ns,
+		pub name: hubbub_string,
+		pub root: *mut c_void,
+	}
+
+	pub type hubbub_parser_opttype = c_uint;
+	pub const HUBBUB_PARSER_TOKEN_HANDLER: hubbub_parser_opttype = 0;
+	pub const HUBBUB_PARSER_ERROR_HANDLER: hubbub_parser_opttype = 1;
+	pub const HUBBUB_PARSER_CONTENT_MODEL: hubbub_parser_opttype = 2;
+	pub const HUBBUB_PARSER_TREE_HANDLER: hubbub_parser_opttype = 3;
+	pub const HUBBUB_PARSER_DOCUMENT_NODE: hubbub_parser_opttype = 4;
+	pub const HUBBUB_PARSER_ENABLE_SCRIPTING: hubbub_parser_opttype = 5;
+	pub const HUBBUB_PARSER_PAUSE: hubbub_parser_opttype = 6;
+	pub const HUBBUB_PARSER_ENABLE_STYLING: hubbub_parser_opttype = 7;
+	pub const HUBBUB_PARSER_TRACK_POSITION: hubbub_parser_opttype = 8;
+	pub const HUBBUB_PARSER_DROP_COMMENTS: hubbub_parser_opttype = 10;
+	pub const HUBBUB_PARSER_TOKEN_LIMIT: hubbub_parser_opttype = 11;
+	pub const HUBBUB_PARSER_FRAGMENT: hubbub_parser_opttype = 13;
+	pub const HUBBUB_PARSER_HEAD_ONLY: hubbub_parser_opttype = 15;
+	pub const HUBBUB_PARSER_BUDGET: hubbub_parser_opttype = 18;
+	pub const HUBBUB_PARSER_MAX_DEPTH: hubbub_parser_opttype = 20;
+	pub const HUBBUB_PARSER_RAW_ATTRIBUTE_VALUES: hubbub_parser_opttype =
+			21;
+
+	#[repr(C)]
+	#[derive(Clone, Copy)]
+	pub struct hubbub_parser_token_handler {
+		pub handler: hubbub_token_handler,
+		pub pw: *mut c_void,
+	}
+
+	#[repr(C)]
+	#[derive(Clone, Copy)]
+	pub struct hubbub_parser_error_handler {
+		pub handler: hubbub_error_handler,
+		pub pw: *mut c_void,
+	}
+
+	#[repr(C)]
+	#[derive(Clone, Copy)]
+	pub struct hubbub_parser_budget {
+		pub tokens: usize,
+		pub bytes: usize,
+	}
+
+	/// Parameters of the options above. Those of the options not
+	/// declared here (batched, compact and event handlers, threads)
+	/// are no larger than the fragment, so the union is the C size.
+	#[repr(C)]
+	#[derive(Clone, Copy)]
+	pub union hubbub_parser_optparams {
+		pub token_handler: hubbub_parser_token_handler,
+		pub error_handler: hubbub_parser_error_handler,
+		pub content_model: hubbub_content_model,
+		pub tree_handler: *mut hubbub_tree_handler,
+		pub document_node: *mut c_void,
+		pub fragment: hubbub_fragment,
+		pub enable_scripting: bool,
+		pub enable_styling: bool,
+		pub drop_comments: bool,
+		pub raw_attribute_values: bool,
+		pub head_only: bool,
+		pub max_depth: u32,
+		pub token_limit: usize,
+		pub budget: hubbub_parser_budget,
+		pub pause_parse: bool,
+		pub track_position: bool,
+	}
+
+	pub enum hubbub_parser {}
+
+	extern "C" {
+		pub fn hubbub_error_to_string(error: hubbub_error)
+				-> *const c_char;
+
+		pub fn hubbub_parser_create(enc: *const c_char,
+				fix_enc: bool, alloc: hubbub_allocator_fn,
+				pw: *mut c_void,
+				parser: *mut *mut hubbub_parser)
+				-> hubbub_error;
+		pub fn hubbub_parser_destroy(parser: *mut hubbub_parser)
+				-> hubbub_error;
+		pub fn hubbub_parser_setopt(parser: *mut hubbub_parser,
+				type_: hubbub_parser_opttype,
+				params: *mut hubbub_parser_optparams)
+				-> hubbub_error;
+		pub fn hubbub_parser_parse_chunk(parser: *mut hubbub_parser,
+				data: *const u8, len: usize) -> hubbub_error;
+		pub fn hubbub_parser_parse_buffer(parser: *mut hubbub_parser,
+				data: *const u8, len: usize) -> hubbub_error;
+		pub fn hubbub_parser_insert_chunk(parser: *mut hubbub_parser,
+				data: *const u8, len: usize) -> hubbub_error;
+		pub fn hubbub_parser_completed(parser: *mut hubbub_parser)
+				-> hubbub_error;
+		pub fn hubbub_parser_read_charset(parser: *mut hubbub_parser,
+				source: *mut hubbub_charset_source)
+				-> *const c_char;
+
+		pub fn hubbub_attribute_decode(attr: *const hubbub_attribute,
+				buf: *mut u8, len: *mut usize) -> hubbub_error;
+	}
+}
+
+/// An error, or other status, returned by the parser or a callback
+#[derive(Clone, Copy, PartialEq, Eq)]
+pub struct Error(pub ffi::hubbub_error);
+
+impl Error {
+	/// Parsing is paused
+	pub const PAUSED: Error = Error(ffi::HUBBUB_PAUSED);
+	/// Parsing is over, as nothing more is wanted
+	pub const STOPPED: Error = Error(ffi::HUBBUB_STOPPED);
+	/// The document's encoding has changed, so it must be reparsed
+	pub const ENCODINGCHANGE: Error = Error(ffi::HUBBUB_ENCODINGCHANGE);
+	/// Memory was exhausted
+	pub const NOMEM: Error = Error(ffi::HUBBUB_NOMEM);
+	/// A bad parameter was passed
+	pub const BADPARM: Error = Error(ffi::HUBBUB_BADPARM);
+
+	/// The description of the error, as the library has it
+	pub fn as_str(&self) -> &'static str {
+		let s = unsafe {
+			CStr::from_ptr(ffi::hubbub_error_to_string(self.0))
+		};
+
+		s.to_str().unwrap_or("Unknown error")
+	}
+}
+
+impl fmt::Debug for Error {
+	fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
+		write!(f, "Error({}: {})", self.0, self.as_str())
+	}
+}
+
+impl fmt::Display for Error {
+	fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
+		f.write_str(self.as_str())
+	}
+}
+
+impl std::error::Error for Error {}
+
+pub type Result<T> = std::result::Result<T, Error>;
+
+fn check(error: ffi::hubbub_error) -> Result<()> {
+	if error == ffi::HUBBUB_OK {
+		Ok(())
+	} else {
+		Err(Error(error))
+	}
+}
+
+fn status(result: Result<()>) -> ffi::hubbub_error {
+	match result {
+		Ok(()) => ffi::HUBBUB_OK,
+		Err(Error(error)) => error,
+	}
+}
+
+/// The bytes of a string of the parser's, for as long as the string lives
+unsafe fn bytes<'a>(s: &ffi::hubbub_string) -> &'a [u8] {
+	if s.len == 0 {
+		&[]
+	} else {
+		slice::from_raw_parts(s.ptr, s.len)
+	}
+}
+
+/// An attribute of a tag
+#[repr(transparent)]
+pub struct Attribute(ffi::hubbub_attribute);
+
+impl Attribute {
+	/// Namespace of the attribute
+	pub fn ns(&self) -> ffi::hubbub_ns {
+		self.0.ns
+	}
+
+	/// Atom of the attribute's name, or HUBBUB_ATOM_NONE
+	pub fn atom(&self) -> ffi::hubbub_atom {
+		self.0.atom
+	}
+
+	/// Name of the attribute
+	pub fn name(&self) -> &[u8] {
+		unsafe { bytes(&self.0.name) }
+	}
+
+	/// Value of the attribute, as written if it is raw
+	pub fn value(&self) -> &[u8] {
+		unsafe { bytes(&self.0.value) }
+	}
+
+	/// Whether the value is as written, and needs decoding
+	pub fn is_raw(&self) -> bool {
+		self.0.raw
+	}
+
+	/// Value of the attribute, decoded if it is raw
+	pub fn decoded_value<'a>(&'a self) -> Cow<'a, [u8]> {
+		if !self.0.raw {
+			return Cow::Borrowed(self.value());
+		}
+
+		// A NUL, decoded, is the three bytes of U+FFFD
+		let mut len = self.0.value.len * 3;
+		let mut buf = Vec::with_capacity(len);
+		unsafe {
+			let error = ffi::hubbub_attribute_decode(&self.0,
+					buf.as_mut_ptr(), &mut len);
+			assert!(error == ffi::HUBBUB_OK);
+			buf.set_len(len);
+		}
+		Cow::Owned(buf)
+	}
+}
+
+unsafe fn attributes<'a>(attributes: *const ffi::hubbub_attribute,
+		n_attributes: u32) -> &'a [Attribute] {
+	if n_attributes == 0 {
+		&[]
+	} else {
+		slice::from_raw_parts(attributes as *const Attribute,
+				n_attributes as usize)
+	}
+}
+
+/// A start or end tag
+#[derive(Clone, Copy)]
+pub struct Tag<'a>(&'a ffi::hubbub_tag);
+
+impl<'a> Tag<'a> {
+	/// Namespace of the tag
+	pub fn ns(&self) -> ffi::hubbub_ns {
+		self.0.ns
+	}
+
+	/// Atom of the tag's name, or HUBBUB_ATOM_NONE
+	pub fn atom(&self) -> ffi::hubbub_atom {
+		self.0.atom
+	}
+
+	/// Name of the tag
+	pub fn name(&self) -> &'a [u8] {
+		unsafe { bytes(&self.0.name) }
+	}
+
+	/// Attributes of the tag
+	pub fn attributes(&self) -> &'a [Attribute] {
+		unsafe { attributes(self.0.attributes, self.0.n_attributes) }
+	}
+
+	/// Whether the tag is self-closing
+	pub fn self_closing(&self) -> bool {
+		self.0.self_closing
+	}
+}
+
+/// A doctype
+#[derive(Clone, Copy)]
+pub struct Doctype<'a>(&'a ffi::hubbub_doctype);
+
+impl<'a> Doctype<'a> {
+	/// Name of the doctype
+	pub fn name(&self) -> &'a [u8] {
+		unsafe { bytes(&self.0.name) }
+	}
+
+	/// Public identifier of the doctype, if it has one
+	pub fn public_id(&self) -> Option<&'a [u8]> {
+		if self.0.public_missing {
+			None
+		} else {
+			Some(unsafe { bytes(&self.0.public_id) })
+		}
+	}
+
+	/// System identifier of the doctype, if it has one
+	pub fn system_id(&self) -> Option<&'a [u8]> {
+		if self.0.system_missing {
+			None
+		} else {
+			Some(unsafe { bytes(&self.0.system_id) })
+		}
+	}
+
+	/// Whether the doctype forces quirks mode
+	pub fn force_quirks(&self) -> bool {
+		self.0.force_quirks
+	}
+}
+
+/// A token, borrowed from the parser for the duration of a callback
+#[derive(Clone, Copy)]
+pub enum Token<'a> {
+	Doctype(Doctype<'a>),
+	StartTag(Tag<'a>),
+	EndTag(Tag<'a>),
+	Comment(&'a [u8]),
+	Character(&'a [u8]),
+	Eof,
+}
+
+impl<'a> Token<'a> {
+	unsafe fn from_raw(token: &'a ffi::hubbub_token) -> Token<'a> {
+		match token.type_ {
+			ffi::HUBBUB_TOKEN_DOCTYPE =>
+				Token::Doctype(Doctype(&token.data.doctype)),
+			ffi::HUBBUB_TOKEN_START_TAG =>
+				Token::StartTag(Tag(&token.data.tag)),
+			ffi::HUBBUB_TOKEN_END_TAG =>
+				Token::EndTag(Tag(&token.data.tag)),
+			ffi::HUBBUB_TOKEN_COMMENT =>
+				Token::Comment(bytes(&token.data.comment)),
+			ffi::HUBBUB_TOKEN_CHARACTER =>
+				Token::Character(bytes(&token.data.character)),
+			_ => Token::Eof,
+		}
+	}
+}
+
+/// A node of the client's tree. The parser holds nodes as pointers, which
+/// are never null, so a sink may use any non-zero value: the address of
+/// the node, or its index in an arena, plus one.
+pub type Node = NonZeroUsize;
+
+fn node(ptr: *mut c_void) -> Node {
+	debug_assert!(!ptr.is_null());
+
+	unsafe { NonZeroUsize::new_unchecked(ptr as usize) }
+}
+
+fn node_ptr(node: Node) -> *mut c_void {
+	node.get() as *mut c_void
+}
+
+/// Builder of a tree, as the parser directs
+///
+/// These are the callbacks of hubbub_tree_handler (see hubbub/tree.h),
+/// which describes them in full. Each node returned is referenced once on
+/// behalf of the parser, as are the nodes returned by the C callbacks.
+pub trait TreeSink {
+	/// Create a comment
+	fn create_comment(&mut self, data: &[u8]) -> Result<Node>;
+
+	/// Create a doctype
+	fn create_doctype(&mut self, doctype: Doctype) -> Result<Node>;
+
+	/// Create an element
+	fn create_element(&mut self, tag: Tag) -> Result<Node>;
+
+	/// Create a text node
+	fn create_text(&mut self, data: &[u8]) -> Result<Node>;
+
+	/// Add a reference to a node
+	fn ref_node(&mut self, _node: Node) -> Result<()> {
+		Ok(())
+	}
+
+	/// Remove a reference from a node
+	fn unref_node(&mut self, _node: Node) -> Result<()> {
+		Ok(())
+	}
+
+	/// Append a node to the children of another, returning the node
+	/// appended, which may be other than the child when text is merged
+	fn append_child(&mut self, parent: Node, child: Node) -> Result<Node>;
+
+	/// Insert a node before a child of another
+	fn insert_before(&mut self, parent: Node, child: Node,
+			ref_child: Node) -> Result<Node>;
+
+	/// Remove a child of a node
+	fn remove_child(&mut self, parent: Node, child: Node) -> Result<Node>;
+
+	/// Clone a node, and its descendants if deep
+	fn clone_node(&mut self, node: Node, deep: bool) -> Result<Node>;
+
+	/// Move the children of a node to the end of those of another
+	fn reparent_children(&mut self, node: Node, new_parent: Node)
+			-> Result<()>;
+
+	/// The parent of a node, if it has one (and, if element_only, if it
+	/// is an element)
+	fn get_parent(&mut self, node: Node, element_only: bool)
+			-> Result<Option<Node>>;
+
+	/// Whether a node has children
+	fn has_children(&mut self, node: Node) -> Result<bool>;
+
+	/// Associate a control with a form
+	fn form_associate(&mut self, _form: Node, _node: Node) -> Result<()> {
+		Ok(())
+	}
+
+	/// Add attributes to an element, of those it does not have already
+	fn add_attributes(&mut self, node: Node, attributes: &[Attribute])
+			-> Result<()>;
+
+	/// Set the quirks mode of the document
+	fn set_quirks_mode(&mut self, _mode: ffi::hubbub_quirks_mode)
+			-> Result<()> {
+		Ok(())
+	}
+
+	/// The document declares another encoding. Return
+	/// Err(Error::ENCODINGCHANGE) to have it reparsed in that one
+	fn encoding_change(&mut self, _encoding: &str) -> Result<()> {
+		Ok(())
+	}
+
+	/// A script element is complete
+	fn complete_script(&mut self, _script: Node) -> Result<()> {
+		Ok(())
+	}
+
+	/// A style element is complete
+	fn complete_style(&mut self, _style: Node) -> Result<()> {
+		Ok(())
+	}
+}
+
+/* Calls from the parser to a sink of type S, whose address is ctx */
+
+unsafe fn sink<'a, S: TreeSink>(ctx: *mut c_void) -> &'a mut S {
+	&mut *(ctx as *mut S)
+}
+
+unsafe fn put(result: *mut *mut c_void, node: Result<Node>)
+		-> ffi::hubbub_error {
+	match node {
+		Ok(node) => {
+			*result = node_ptr(node);
+			ffi::HUBBUB_OK
+		}
+		Err(Error(error)) => error,
+	}
+}
+
+unsafe extern "C" fn create_comment<S: TreeSink>(ctx: *mut c_void,
+		data: *const ffi::hubbub_string,
+		result: *mut *mut c_void) -> ffi::hubbub_error {
+	put(result, sink::<S>(ctx).create_comment(bytes(&*data)))
+}
+
+unsafe extern "C" fn create_doctype<S: TreeSink>(ctx: *mut c_void,
+		doctype: *const ffi::hubbub_doctype,
+		result: *mut *mut c_void) -> ffi::hubbub_error {
+	put(result, sink::<S>(ctx).create_doctype(Doctype(&*doctype)))
+}
+
+unsafe extern "C" fn create_element<S: TreeSink>(ctx: *mut c_void,
+		tag: *const ffi::hubbub_tag,
+		result: *mut *mut c_void) -> ffi::hubbub_error {
+	put(result, sink::<S>(ctx).create_element(Tag(&*tag)))
+}
+
+unsafe extern "C" fn create_text<S: TreeSink>(ctx: *mut c_void,
+		data: *const ffi::hubbub_string,
+		result: *mut *mut c_void) -> ffi::hubbub_error {
+	put(result, sink::<S>(ctx).create_text(bytes(&*data)))
+}
+
+unsafe extern "C" fn ref_node<S: TreeSink>(ctx: *mut c_void,
+		n: *mut c_void) -> ffi::hubbub_error {
+	status(sink::<S>(ctx).ref_node(node(n)))
+}
+
+unsafe extern "C" fn unref_node<S: TreeSink>(ctx: *mut c_void,
+		n: *mut c_void) -> ffi::hubbub_error {
+	status(sink::<S>(ctx).unref_node(node(n)))
+}
+
+unsafe extern "C" fn append_child<S: TreeSink>(ctx: *mut c_void,
+		parent: *mut c_void, child: *mut c_void,
+		result: *mut *mut c_void) -> ffi::hubbub_error {
+	put(result, sink::<S>(ctx).append_child(node(parent), node(child)))
+}
+
+unsafe extern "C" fn insert_before<S: TreeSink>(ctx: *mut c_void,
+		parent: *mut c_void, child: *mut c_void,
+		ref_child: *mut c_void,
+		result: *mut *mut c_void) -> ffi::hubbub_error {
+	put(result, sink::<S>(ctx).insert_before(node(parent), node(child),
+			node(ref_child)))
+}
+
+unsafe extern "C" fn remove_child<S: TreeSink>(ctx: *mut c_void,
+		parent: *mut c_void, child: *mut c_void,
+		result: *mut *mut c_void) -> ffi::hubbub_error {
+	put(result, sink::<S>(ctx).remove_child(node(parent), node(child)))
+}
+
+unsafe extern "C" fn clone_node<S: TreeSink>(ctx: *mut c_void,
+		n: *mut c_void, deep: bool,
+		result: *mut *mut c_void) -> ffi::hubbub_error {
+	put(result, sink::<S>(ctx).clone_node(node(n), deep))
+}
+
+unsafe extern "C" fn reparent_children<S: TreeSink>(ctx: *mut c_void,
+		n: *mut c_void, new_parent: *mut c_void) -> ffi::hubbub_error {
+	status(sink::<S>(ctx).reparent_children(node(n), node(new_parent)))
+}
+
+unsafe extern "C" fn get_parent<S: TreeSink>(ctx: *mut c_void,
+		n: *mut c_void, element_only: bool,
+		result: *mut *mut c_void) -> ffi::hubbub_error {
+	match sink::<S>(ctx).get_parent(node(n), element_only) {
+		Ok(parent) => {
+			*result = parent.map_or(ptr::null_mut(), node_ptr);
+			ffi::HUBBUB_OK
+		}
+		Err(Error(error)) => error,
+	}
+}
+
+unsafe extern "C" fn has_children<S: TreeSink>(ctx: *mut c_void,
+		n: *mut c_void, result: *mut bool) -> ffi::hubbub_error {
+	match sink::<S>(ctx).has_children(node(n)) {
+		Ok(children) => {
+			*result = children;
+			ffi::HUBBUB_OK
+		}
+		Err(Error(error)) => error,
+	}
+}
+
+unsafe extern "C" fn form_associate<S: TreeSink>(ctx: *mut c_void,
+		form: *mut c_void, n: *mut c_void) -> ffi::hubbub_error {
+	status(sink::<S>(ctx).form_associate(node(form), node(n)))
+}
+
+unsafe extern "C" fn add_attributes<S: TreeSink>(ctx: *mut c_void,
+		n: *mut c_void, attrs: *const ffi::hubbub_attribute,
+		n_attrs: u32) -> ffi::hubbub_error {
+	status(sink::<S>(ctx).add_attributes(node(n),
+			attributes(attrs, n_attrs)))
+}
+
+unsafe extern "C" fn set_quirks_mode<S: TreeSink>(ctx: *mut c_void,
+		mode: ffi::hubbub_quirks_mode) -> ffi::hubbub_error {
+	status(sink::<S>(ctx).set_quirks_mode(mode))
+}
+
+unsafe extern "C" fn encoding_change<S: TreeSink>(ctx: *mut c_void,
+		encname: *const c_char) -> ffi::hubbub_error {
+	match CStr::from_ptr(encname).to_str() {
+		Ok(name) => status(sink::<S>(ctx).encoding_change(name)),
+		Err(_) => ffi::HUBBUB_OK,
+	}
+}
+
+unsafe extern "C" fn complete_script<S: TreeSink>(ctx: *mut c_void,
+		script: *mut c_void) -> ffi::hubbub_error {
+	status(sink::<S>(ctx).complete_script(node(script)))
+}
+
+unsafe extern "C" fn complete_style<S: TreeSink>(ctx: *mut c_void,
+		style: *mut c_void) -> ffi::hubbub_error {
+	status(sink::<S>(ctx).complete_style(node(style)))
+}
+
+unsafe extern "C" fn tokens<F>(token: *const ffi::hubbub_token,
+		pw: *mut c_void) -> ffi::hubbub_error
+		where F: FnMut(Token) -> Result<()> {
+	let handler = &mut *(pw as *mut F);
+
+	status(handler(Token::from_raw(&*token)))
+}
+
+unsafe extern "C" fn errors<F>(line: u32, col: u32, message: *const c_char,
+		pw: *mut c_void) where F: FnMut(u32, u32, &str) {
+	let handler = &mut *(pw as *mut F);
+	let message = CStr::from_ptr(message);
+
+	handler(line, col, message.to_str().unwrap_or(""))
+}
+
+extern "C" {
+	fn realloc(ptr: *mut c_void, size: usize) -> *mut c_void;
+	fn free(ptr: *mut c_void);
+}
+
+unsafe extern "C" fn alloc(ptr: *mut c_void, size: usize, _pw: *mut c_void)
+		-> *mut c_void {
+	if size == 0 {
+		free(ptr);
+		ptr::null_mut()
+	} else {
+		realloc(ptr, size)
+	}
+}
+
+/// A parser
+///
+/// The handlers and sink given to a parser are borrowed for 'h, its
+/// lifetime, as the parser calls them until it is dropped.
+pub struct Parser<'h> {
+	raw: *mut ffi::hubbub_parser,
+	tree_handler: Option<Box<ffi::hubbub_tree_handler>>,
+	handlers: PhantomData<&'h mut ()>,
+}
+
+impl<'h> Parser<'h> {
+	/// Create a parser, for input in the encoding named, or detected
+	/// from the input if None. Unless fix_encoding, the document may
+	/// declare another encoding as it is parsed
+	pub fn new(encoding: Option<&str>, fix_encoding: bool)
+			-> Result<Parser<'h>> {
+		let encoding = match encoding {
+			Some(name) => Some(CString::new(name)
+					.map_err(|_| Error::BADPARM)?),
+			None => None,
+		};
+		let mut raw = ptr::null_mut();
+
+		check(unsafe {
+			ffi::hubbub_parser_create(encoding.as_ref()
+					.map_or(ptr::null(), |s| s.as_ptr()),
+					fix_encoding, Some(alloc),
+					ptr::null_mut(), &mut raw)
+		})?;
+
+		Ok(Parser {
+			raw: raw,
+			tree_handler: None,
+			handlers: PhantomData,
+		})
+	}
+
+	/// The raw parser, for options not wrapped here
+	pub fn as_raw(&mut self) -> *mut ffi::hubbub_parser {
+		self.raw
+	}
+
+	fn setopt(&mut self, type_: ffi::hubbub_parser_opttype,
+			mut params: ffi::hubbub_parser_optparams)
+			-> Result<()> {
+		check(unsafe {
+			ffi::hubbub_parser_setopt(self.raw, type_, &mut params)
+		})
+	}
+
+	/// Pass each token to handler, in place of the treebuilder
+	pub fn set_token_handler<F>(&mut self, handler: &'h mut F)
+			-> Result<()>
+			where F: FnMut(Token) -> Result<()> {
+		self.setopt(ffi::HUBBUB_PARSER_TOKEN_HANDLER,
+				ffi::hubbub_parser_optparams {
+			token_handler: ffi::hubbub_parser_token_handler {
+				handler: Some(tokens::<F>),
+				pw: handler as *mut F as *mut c_void,
+			}
+		})
+	}
+
+	/// Pass each parse error to handler, with its line and column
+	pub fn set_error_handler<F>(&mut self, handler: &'h mut F)
+			-> Result<()>
+			where F: FnMut(u32, u32, &str) {
+		self.setopt(ffi::HUBBUB_PARSER_ERROR_HANDLER,
+				ffi::hubbub_parser_optparams {
+			error_handler: ffi::hubbub_parser_error_handler {
+				handler: Some(errors::<F>),
+				pw: handler as *mut F as *mut c_void,
+			}
+		})
+	}
+
+	/// Build the tree in sink, under the document node given
+	pub fn set_tree_sink<S: TreeSink>(&mut self, sink: &'h mut S,
+			document: Node) -> Result<()> {
+		let mut handler = Box::new(ffi::hubbub_tree_handler {
+			create_comment: Some(create_comment::<S>),
+			create_doctype: Some(create_doctype::<S>),
+			create_element: Some(create_element::<S>),
+			create_text: Some(create_text::<S>),
+			ref_node: Some(ref_node::<S>),
+			unref_node: Some(unref_node::<S>),
+			append_child: Some(append_child::<S>),
+			insert_before: Some(insert_before::<S>),
+			remove_child: Some(remove_child::<S>),
+			clone_node: Some(clone_node::<S>),
+			reparent_children: Some(reparent_children::<S>),
+			get_parent: Some(get_parent::<S>),
+			has_children: Some(has_children::<S>),
+			form_associate: Some(form_associate::<S>),
+			add_attributes: Some(add_attributes::<S>),
+			set_quirks_mode: Some(set_quirks_mode::<S>),
+			encoding_change: Some(encoding_change::<S>),
+			complete_script: Some(complete_script::<S>),
+			complete_style: Some(complete_style::<S>),
+			ctx: sink as *mut S as *mut c_void,
+		});
+
+		/* The parser keeps a pointer to the handler */
+		self.setopt(ffi::HUBBUB_PARSER_TREE_HANDLER,
+				ffi::hubbub_parser_optparams {
+			tree_handler: &mut *handler,
+		})?;
+		self.tree_handler = Some(handler);
+
+		self.setopt(ffi::HUBBUB_PARSER_DOCUMENT_NODE,
+				ffi::hubbub_parser_optparams {
+			document_node: node_ptr(document),
+		})
+	}
+
+	/// Set whether scripting is enabled
+	pub fn enable_scripting(&mut self, enable: bool) -> Result<()> {
+		self.setopt(ffi::HUBBUB_PARSER_ENABLE_SCRIPTING,
+				ffi::hubbub_parser_optparams {
+			enable_scripting: enable,
+		})
+	}
+
+	/// Set whether attribute values which need decoding are left as
+	/// written, for Attribute::decoded_value(). Only for token handlers
+	pub fn raw_attribute_values(&mut self, raw: bool) -> Result<()> {
+		self.setopt(ffi::HUBBUB_PARSER_RAW_ATTRIBUTE_VALUES,
+				ffi::hubbub_parser_optparams {
+			raw_attribute_values: raw,
+		})
+	}
+
+	/// Pause parsing, or resume it
+	pub fn pause(&mut self, pause: bool) -> Result<()> {
+		self.setopt(ffi::HUBBUB_PARSER_PAUSE,
+				ffi::hubbub_parser_optparams {
+			pause_parse: pause,
+		})
+	}
+
+	/// Parse a chunk of the document
+	pub fn parse_chunk(&mut self, data: &[u8]) -> Result<()> {
+		check(unsafe {
+			ffi::hubbub_parser_parse_chunk(self.raw, data.as_ptr(),
+					data.len())
+		})
+	}
+
+	/// Parse a whole document, read in place. The strings of the
+	/// tokens, and of the tree, may then point into data itself
+	pub fn parse_buffer(&mut self, data: &'h [u8]) -> Result<()> {
+		check(unsafe {
+			ffi::hubbub_parser_parse_buffer(self.raw,
+					data.as_ptr(), data.len())
+		})
+	}
+
+	/// Inform the parser the last chunk of the document has been parsed
+	pub fn completed(&mut self) -> Result<()> {
+		check(unsafe { ffi::hubbub_parser_completed(self.raw) })
+	}
+
+	/// The charset of the document, and how sure the parser is of it
+	pub fn charset(&mut self)
+			-> Option<(&str, ffi::hubbub_charset_source)> {
+		let mut source = ffi::HUBBUB_CHARSET_UNKNOWN;
+		let name = unsafe {
+			ffi::hubbub_parser_read_charset(self.raw, &mut source)
+		};
+
+		if name.is_null() {
+			return None;
+		}
+
+		unsafe { CStr::from_ptr(name) }.to_str().ok()
+				.map(|name| (name, source))
+	}
+}
+
+impl<'h> Drop for Parser<'h> {
+	fn drop(&mut self) {
+		unsafe {
+			ffi::hubbub_parser_destroy(self.raw);
+		}
+	}
+}
+
+#[cfg(test)]
+mod tests {
+	use super::*;
+	use std::mem::{align_of, size_of};
+
+	/* Sizes and alignments of the C structs, from sizeof and _Alignof */
+	#[cfg(target_pointer_width = "64")]
+	const C_LAYOUT: [(usize, usize); 10] = [(16, 8), (48, 8), (72, 8),
+			(48, 8), (24, 8), (112, 8), (160, 8), (32, 8),
+			(16, 8), (32, 8)];
+	#[cfg(target_pointer_width = "32")]
+	const C_LAYOUT: [(usize, usize); 10] = [(8, 4), (28, 4), (36, 4),
+			(28, 4), (16, 4), (60, 4), (80, 4), (16, 4),
+			(8, 4), (16, 4)];
+
+	fn layout<T>() -> (usize, usize) {
+		(size_of::<T>(), align_of::<T>())
+	}
+
+	#[test]
+	fn layout_matches_c() {
+		let rust = [layout::<ffi::hubbub_string>(),
+				layout::<ffi::hubbub_attribute>(),
+				layout::<ffi::hubbub_doctype>(),
+				layout::<ffi::hubbub_tag>(),
+				layout::<ffi::hubbub_location>(),
+				layout::<ffi::hubbub_token>(),
+				layout::<ffi::hubbub_tree_handler>(),
+				layout::<ffi::hubbub_fragment>(),
+				layout::<ffi::hubbub_parser_budget>(),
+				layout::<ffi::hubbub_parser_optparams>()];
+
+		assert_eq!(rust, C_LAYOUT);
+	}
+
+	/* The fields after the token data, as the C library sets them */
+	type Fields = Vec<(ffi::hubbub_token_type, bool, ffi::hubbub_location)>;
+
+	unsafe extern "C" fn locations(token: *const ffi::hubbub_token,
+			pw: *mut c_void) -> ffi::hubbub_error {
+		let seen = &mut *(pw as *mut Fields);
+		let token = &*token;
+
+		seen.push((token.type_, token.incomplete, token.location));
+
+		ffi::HUBBUB_OK
+	}
+
+	#[test]
+	fn token_fields_match_c() {
+		let mut seen: Fields = Vec::new();
+		let mut parser = Parser::new(Some("UTF-8"), true).unwrap();
+
+		parser.setopt(ffi::HUBBUB_PARSER_TOKEN_HANDLER,
+				ffi::hubbub_parser_optparams {
+			token_handler: ffi::hubbub_parser_token_handler {
+				handler: Some(locations),
+				pw: &mut seen as *mut _ as *mut c_void,
+			}
+		}).unwrap();
+		parser.setopt(ffi::HUBBUB_PARSER_TRACK_POSITION,
+				ffi::hubbub_parser_optparams {
+			track_position: true,
+		}).unwrap();
+		parser.parse_chunk(b"x\n  <b>").unwrap();
+		parser.completed().unwrap();
+		drop(parser);
+
+		let (type_, incomplete, location) = seen[1];
+		assert_eq!(type_, ffi::HUBBUB_TOKEN_START_TAG);
+		assert!(!incomplete);
+		assert_eq!((location.start, location.end), (4, 7));
+		assert_eq!((location.line, location.col), (2, 3));
+	}
+
+	#[test]
+	fn tokenise() {
+		let mut seen = Vec::new();
+		{
+			let mut handler = |token: Token| -> Result<()> {
+				seen.push(match token {
+				Token::Doctype(d) => format!("doctype {}",
+						text(d.name())),
+				Token::StartTag(t) => format!("<{}{}{}>",
+						text(t.name()),
+						t.attributes().iter().map(|a|
+							format!(" {}={}",
+							text(a.name()),
+							text(a.value())))
+							.collect::<String>(),
+						if t.self_closing() { "/" }
+							else { "" }),
+				Token::EndTag(t) => format!("</{}>",
+						text(t.name())),
+				Token::Comment(c) => format!("<!--{}-->",
+						text(c)),
+				Token::Character(c) => text(c),
+				Token::Eof => "EOF".to_string(),
+				});
+				Ok(())
+			};
+			let mut parser = Parser::new(Some("UTF-8"), true)
+					.unwrap();
+
+			parser.set_token_handler(&mut handler).unwrap();
+			for chunk in b"<!DOCTYPE html><p id=a x='b'>c</p>\
+					<!--d--><br/>".chunks(3) {
+				parser.parse_chunk(chunk).unwrap();
+			}
+			parser.completed().unwrap();
+		}
+
+		assert_eq!(merge(seen), ["doctype html", "<p id=a x=b>", "c",
+				"</p>", "<!--d-->", "<br/>", "EOF"]);
+	}
+
+	#[test]
+	fn strings_borrow_input() {
+		let data = b"<a href=x title='&amp;'>text</a>";
+		let start = data.as_ptr() as usize;
+		let end = start + data.len();
+		let within = |s: &[u8]| {
+			let p = s.as_ptr() as usize;
+			start <= p && p + s.len() <= end
+		};
+		let mut checked = 0;
+		{
+			let mut handler = |token: Token| -> Result<()> {
+				match token {
+				Token::StartTag(t) => {
+					let attrs = t.attributes();
+
+					assert!(within(t.name()));
+					assert!(within(attrs[0].value()));
+					match attrs[0].decoded_value() {
+						Cow::Borrowed(v) =>
+							assert_eq!(v, b"x"),
+						Cow::Owned(_) => panic!(),
+					}
+					assert!(attrs[1].is_raw());
+					match attrs[1].decoded_value() {
+						Cow::Owned(v) =>
+							assert_eq!(v, b"&"),
+						Cow::Borrowed(_) => panic!(),
+					}
+					checked += 1;
+				}
+				Token::Character(c) => {
+					assert_eq!(c, b"text");
+					assert!(within(c));
+					checked += 1;
+				}
+				_ => {}
+				}
+				Ok(())
+			};
+			let mut parser = Parser::new(Some("UTF-8"), true)
+					.unwrap();
+
+			parser.set_token_handler(&mut handler).unwrap();
+			parser.raw_attribute_values(true).unwrap();
+			parser.parse_buffer(data).unwrap();
+		}
+
+		assert_eq!(checked, 2);
+	}
+
+	struct Element {
+		name: String,
+		parent: Option<usize>,
+		children: Vec<usize>,
+	}
+
+	/* A sink which keeps its nodes in a vector, each node being its
+	 * index plus one */
+	struct Arena {
+		nodes: Vec<Element>,
+	}
+
+	impl Arena {
+		fn add(&mut self, name: String) -> Result<Node> {
+			self.nodes.push(Element {
+				name: name,
+				parent: None,
+				children: Vec::new(),
+			});
+			Ok(Node::new(self.nodes.len()).unwrap())
+		}
+
+		fn detach(&mut self, child: usize) {
+			if let Some(parent) = self.nodes[child].parent.take() {
+				self.nodes[parent].children
+						.retain(|&c| c != child);
+			}
+		}
+
+		fn attach(&mut self, parent: Node, child: Node,
+				at: Option<usize>) -> Node {
+			let (p, c) = (parent.get() - 1, child.get() - 1);
+
+			self.detach(c);
+			self.nodes[c].parent = Some(p);
+			match at {
+				Some(at) => self.nodes[p].children.insert(at, c),
+				None => self.nodes[p].children.push(c),
+			}
+			child
+		}
+
+		fn dump(&self, node: usize, depth: usize,
+				out: &mut Vec<String>) {
+			out.push(format!("{}{}", "  ".repeat(depth),
+					self.nodes[node].name));
+			for &child in &self.nodes[node].children {
+				self.dump(child, depth + 1, out);
+			}
+		}
+	}
+
+	impl TreeSink for Arena {
+		fn create_comment(&mut self, data: &[u8]) -> Result<Node> {
+			self.add(format!("<!-- {} -->", text(data)))
+		}
+
+		fn create_doctype(&mut self, doctype: Doctype) -> Result<Node> {
+			self.add(format!("<!DOCTYPE {}>", text(doctype.name())))
+		}
+
+		fn create_element(&mut self, tag: Tag) -> Result<Node> {
+			self.add(format!("<{}>", text(tag.name())))
+		}
+
+		fn create_text(&mut self, data: &[u8]) -> Result<Node> {
+			self.add(format!("\"{}\"", text(data)))
+		}
+
+		fn append_child(&mut self, parent: Node, child: Node)
+				-> Result<Node> {
+			let p = parent.get() - 1;
+			let c = child.get() - 1;
+
+			/* Merge text into a text node before it */
+			if let Some(&last) = self.nodes[p].children.last() {
+				if self.nodes[last].name.starts_with('"') &&
+						self.nodes[c].name
+						.starts_with('"') {
+					let more = self.nodes[c].name[1..]
+							.to_string();
+
+					self.nodes[last].name.pop();
+					self.nodes[last].name.push_str(&more);
+					return Ok(Node::new(last + 1).unwrap());
+				}
+			}
+
+			Ok(self.attach(parent, child, None))
+		}
+
+		fn insert_before(&mut self, parent: Node, child: Node,
+				ref_child: Node) -> Result<Node> {
+			let at = self.nodes[parent.get() - 1].children.iter()
+					.position(|&c| c == ref_child.get() - 1);
+
+			Ok(self.attach(parent, child, at))
+		}
+
+		fn remove_child(&mut self, _parent: Node, child: Node)
+				-> Result<Node> {
+			self.detach(child.get() - 1);
+			Ok(child)
+		}
+
+		fn clone_node(&mut self, node: Node, deep: bool)
+				-> Result<Node> {
+			let name = self.nodes[node.get() - 1].name.clone();
+			let copy = self.add(name)?;
+
+			if deep {
+				let children = self.nodes[node.get() - 1]
+						.children.clone();
+
+				for child in children {
+					let child = self.clone_node(
+						Node::new(child + 1).unwrap(),
+						true)?;
+					self.attach(copy, child, None);
+				}
+			}
+
+			Ok(copy)
+		}
+
+		fn reparent_children(&mut self, node: Node, new_parent: Node)
+				-> Result<()> {
+			let children = self.nodes[node.get() - 1]
+					.children.clone();
+
+			for child in children {
+				self.attach(new_parent,
+						Node::new(child + 1).unwrap(),
+						None);
+			}
+			Ok(())
+		}
+
+		fn get_parent(&mut self, node: Node, _element_only: bool)
+				-> Result<Option<Node>> {
+			Ok(self.nodes[node.get() - 1].parent
+					.map(|p| Node::new(p + 1).unwrap()))
+		}
+
+		fn has_children(&mut self, node: Node) -> Result<bool> {
+			Ok(!self.nodes[node.get() - 1].children.is_empty())
+		}
+
+		fn add_attributes(&mut self, _node: Node,
+				_attributes: &[Attribute]) -> Result<()> {
+			Ok(())
+		}
+	}
+
+	#[test]
+	fn build_tree() {
+		let mut arena = Arena { nodes: Vec::new() };
+		let document = arena.add("#document".to_string()).unwrap();
+		{
+			let mut parser = Parser::new(Some("UTF-8"), true)
+					.unwrap();
+
+			parser.set_tree_sink(&mut arena, document).unwrap();
+			for chunk in b"<!DOCTYPE html><title>T</title>\
+					<p>a<b>b<i>c</b>d</i><!--e-->"
+					.chunks(4) {
+				parser.parse_chunk(chunk).unwrap();
+			}
+			parser.completed().unwrap();
+		}
+
+		let mut tree = Vec::new();
+		arena.dump(0, 0, &mut tree);
+		assert_eq!(tree, ["#document",
+				"  <!DOCTYPE html>",
+				"  <html>",
+				"    <head>",
+				"      <title>",
+				"        \"T\"",
+				"    <body>",
+				"      <p>",
+				"        \"a\"",
+				"        <b>",
+				"          \"b\"",
+				"          <i>",
+				"            \"c\"",
+				"        <i>",
+				"          \"d\"",
+				"        <!-- e -->"]);
+	}
+
+	fn text(data: &[u8]) -> String {
+		String::from_utf8_lossy(data).into_owned()
+	}
+
+	/* Join runs of character tokens, which may be split anywhere */
+	fn merge(tokens: Vec<String>) -> Vec<String> {
+		let mut merged: Vec<String> = Vec::new();
+		let mut in_text = false;
+
+		for token in tokens {
+			let is_text = !token.starts_with('<') &&
+					!token.starts_with("doctype ") &&
+					token != "EOF";
+
+			if is_text && in_text {
+				merged.last_mut().unwrap().push_str(&token);
+			} else {
+				merged.push(token);
+			}
+			in_text = is_text;
+		}
+
+		merged
+	}
+}
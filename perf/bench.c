@@ -0,0 +1,552 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <hubbub/hubbub.h>
+#include <hubbub/dom.h>
+#include <hubbub/parser.h>
+#include <hubbub/tree.h>
+
+#define UNUSED(x) ((x) = (x))
+
+/**
+ * Benchmark harness
+ *
+ * Each document of the corpus is parsed a number of times, in each of
+ * three ways: tokenising alone, treebuilding with a handler which builds
+ * nothing, and building the library's own tree. Each is done with input
+ * given in chunks of several sizes, from a byte at a time up to the whole
+ * document, and with the document read in place. For each combination, a
+ * line is written of tab-separated fields:
+ *
+ *   mode chunk docs bytes MB/s vs_file tokens/s allocs/KB peak_KB p50_us
+ *   p99_us
+ *
+ * where bytes is the size of the corpus, vs_file is the throughput as a
+ * fraction of that with the document in one chunk (so the cost of small
+ * chunks shows), peak_KB is the most memory live at once while parsing any
+ * one document, and p50_us and p99_us are percentiles of the time taken to
+ * parse a document, in microseconds. The document in one chunk is run
+ * first, for each way of parsing, to be compared with.
+ */
+
+typedef enum mode {
+	MODE_TOKENS,			/* Tokeniser alone */
+	MODE_NULL_TREE,			/* Treebuilder, building nothing */
+	MODE_DOM			/* Built-in tree */
+} mode;
+
+static const char *mode_names[] = { "tokens", "null-tree", "dom" };
+
+typedef struct document {
+	char *name;			/* Path of file */
+	uint8_t *data;			/* Contents */
+	size_t len;			/* Length of data */
+	size_t tokens;			/* Tokens in document */
+} document;
+
+/* Chunk sizes, where 0 is the whole document, read in place */
+static const size_t default_chunks[] = { 1, 16, 256, 4096, 65536,
+		(size_t) -1, 0 };
+
+static size_t allocations;
+static size_t live;
+static size_t peak;
+
+/* Header in front of each block, recording its size */
+typedef union header {
+	size_t len;
+	long double align_ld;
+	void *align_p;
+	uint64_t align_u64;
+} header;
+
+/* The null tree's nodes are just numbers, which must differ */
+static uintptr_t null_nodes;
+
+static void *counting_realloc(void *ptr, size_t len, void *pw)
+{
+	header *h = NULL;
+	size_t old = 0;
+
+	UNUSED(pw);
+
+	if (ptr != NULL) {
+		h = (header *) ptr - 1;
+		old = h->len;
+	}
+
+	if (len == 0) {
+		live -= old;
+		free(h);
+		return NULL;
+	}
+
+	h = realloc(h, sizeof(header) + len);
+	if (h == NULL)
+		return NULL;
+	h->len = len;
+
+	allocations++;
+	live += len - old;
+	if (peak < live)
+		peak = live;
+
+	return h + 1;
+}
+
+static hubbub_error count_token(const hubbub_token *token, void *pw)
+{
+	UNUSED(token);
+
+	(*((size_t *) pw))++;
+
+	return HUBBUB_OK;
+}
+
+static hubbub_error null_create(void *ctx, const void *data, void **result)
+{
+	UNUSED(ctx);
+	UNUSED(data);
+
+	*result = (void *) ++null_nodes;
+
+	return HUBBUB_OK;
+}
+
+static hubbub_error null_create_comment(void *ctx,
+		const hubbub_string *data, void **result)
+{
+	return null_create(ctx, data, result);
+}
+
+static hubbub_error null_create_doctype(void *ctx,
+		const hubbub_doctype *doctype, void **result)
+{
+	return null_create(ctx, doctype, result);
+}
+
+static hubbub_error null_create_element(void *ctx, const hubbub_tag *tag,
+		void **result)
+{
+	return null_create(ctx, tag, result);
+}
+
+static hubbub_error null_create_text(void *ctx, const hubbub_string *data,
+		void **result)
+{
+	return null_create(ctx, data, result);
+}
+
+static hubbub_error null_ref(void *ctx, void *node)
+{
+	UNUSED(ctx);
+	UNUSED(node);
+
+	return HUBBUB_OK;
+}
+
+static hubbub_error null_append_child(void *ctx, void *parent, void *child,
+		void **result)
+{
+	UNUSED(ctx);
+	UNUSED(parent);
+
+	*result = child;
+
+	return HUBBUB_OK;
+}
+
+static hubbub_error null_insert_before(void *ctx, void *parent, void *child,
+		void *ref_child, void **result)
+{
+	UNUSED(ref_child);
+
+	return null_append_child(ctx, parent, child, result);
+}
+
+static hubbub_error null_clone_node(void *ctx, void *node, bool deep,
+		void **result)
+{
+	UNUSED(deep);
+
+	return null_create(ctx, node, result);
+}
+
+static hubbub_error null_reparent_children(void *ctx, void *node,
+		void *new_parent)
+{
+	UNUSED(new_parent);
+
+	return null_ref(ctx, node);
+}
+
+static hubbub_error null_get_parent(void *ctx, void *node,
+		bool element_only, void **result)
+{
+	UNUSED(ctx);
+	UNUSED(node);
+	UNUSED(element_only);
+
+	*result = NULL;
+
+	return HUBBUB_OK;
+}
+
+static hubbub_error null_has_children(void *ctx, void *node, bool *result)
+{
+	UNUSED(ctx);
+	UNUSED(node);
+
+	*result = false;
+
+	return HUBBUB_OK;
+}
+
+static hubbub_error null_form_associate(void *ctx, void *form, void *node)
+{
+	UNUSED(form);
+
+	return null_ref(ctx, node);
+}
+
+static hubbub_error null_add_attributes(void *ctx, void *node,
+		const hubbub_attribute *attributes, uint32_t n_attributes)
+{
+	UNUSED(attributes);
+	UNUSED(n_attributes);
+
+	return null_ref(ctx, node);
+}
+
+static hubbub_error null_set_quirks_mode(void *ctx, hubbub_quirks_mode mode)
+{
+	UNUSED(ctx);
+	UNUSED(mode);
+
+	return HUBBUB_OK;
+}
+
+static hubbub_error null_encoding_change(void *ctx, const char *encname)
+{
+	UNUSED(ctx);
+	UNUSED(encname);
+
+	return HUBBUB_OK;
+}
+
+static hubbub_tree_handler null_tree = {
+	null_create_comment,
+	null_create_doctype,
+	null_create_element,
+	null_create_text,
+	null_ref,
+	null_ref,
+	null_append_child,
+	null_insert_before,
+	null_append_child,
+	null_clone_node,
+	null_reparent_children,
+	null_get_parent,
+	null_has_children,
+	null_form_associate,
+	null_add_attributes,
+	null_set_quirks_mode,
+	null_encoding_change,
+	null_ref,
+	null_ref,
+	NULL
+};
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Parse a document, returning the time taken, in seconds */
+static double parse(const document *doc, mode m, size_t chunk, size_t *tokens)
+{
+	hubbub_parser_optparams params;
+	hubbub_parser *parser;
+	hubbub_dom *dom = NULL;
+	hubbub_error error;
+	double start;
+	size_t pos;
+
+	start = now();
+
+	if (hubbub_parser_create("UTF-8", false, counting_realloc, NULL,
+			&parser) != HUBBUB_OK) {
+		fprintf(stderr, "Failed creating parser\n");
+		exit(1);
+	}
+
+	switch (m) {
+	case MODE_TOKENS:
+		params.token_handler.handler = count_token;
+		params.token_handler.pw = tokens;
+		hubbub_parser_setopt(parser, HUBBUB_PARSER_TOKEN_HANDLER,
+				&params);
+		break;
+	case MODE_NULL_TREE:
+		params.tree_handler = &null_tree;
+		hubbub_parser_setopt(parser, HUBBUB_PARSER_TREE_HANDLER,
+				&params);
+		params.document_node = (void *) ++null_nodes;
+		hubbub_parser_setopt(parser, HUBBUB_PARSER_DOCUMENT_NODE,
+				&params);
+		break;
+	case MODE_DOM:
+		if (hubbub_dom_create(counting_realloc, NULL, &dom) !=
+				HUBBUB_OK || hubbub_dom_attach(dom, parser) !=
+				HUBBUB_OK) {
+			fprintf(stderr, "Failed creating tree\n");
+			exit(1);
+		}
+		break;
+	}
+
+	if (chunk == 0) {
+		error = hubbub_parser_parse_buffer(parser, doc->data, doc->len);
+	} else {
+		error = HUBBUB_OK;
+		for (pos = 0; pos < doc->len && error == HUBBUB_OK;
+				pos += chunk) {
+			size_t len = doc->len - pos < chunk ?
+					doc->len - pos : chunk;
+
+			error = hubbub_parser_parse_chunk(parser,
+					doc->data + pos, len);
+		}
+		if (error == HUBBUB_OK)
+			error = hubbub_parser_completed(parser);
+	}
+
+	if (error != HUBBUB_OK) {
+		fprintf(stderr, "Failed parsing %s: %s\n", doc->name,
+				hubbub_error_to_string(error));
+		exit(1);
+	}
+
+	hubbub_parser_destroy(parser);
+	if (dom != NULL)
+		hubbub_dom_destroy(dom);
+
+	return now() - start;
+}
+
+static int compare_times(const void *a, const void *b)
+{
+	double x = *((const double *) a), y = *((const double *) b);
+
+	return x < y ? -1 : x > y ? 1 : 0;
+}
+
+/* Parse the corpus in one way, and report on it, returning the throughput,
+ * to compare others with, if it is not known (whole is 0) */
+static double run(const document *docs, size_t n_docs, mode m, size_t chunk,
+		unsigned int repeats, double *times, double whole)
+{
+	size_t bytes = 0, tokens = 0, n_times = 0, i;
+	double total = 0, throughput;
+	unsigned int r;
+	char name[32];
+
+	allocations = 0;
+	peak = 0;
+
+	for (r = 0; r < repeats; r++) {
+		for (i = 0; i < n_docs; i++) {
+			size_t counted = 0;
+
+			times[n_times] = parse(&docs[i], m, chunk, &counted);
+			total += times[n_times++];
+
+			bytes += docs[i].len;
+			tokens += docs[i].tokens;
+		}
+	}
+
+	qsort(times, n_times, sizeof(double), compare_times);
+
+	if (chunk == 0)
+		strcpy(name, "buffer");
+	else if (chunk == (size_t) -1)
+		strcpy(name, "file");
+	else
+		sprintf(name, "%" PRIuPTR, (uintptr_t) chunk);
+
+	throughput = bytes / total / (1024 * 1024);
+
+	printf("%s\t%s\t%" PRIuPTR "\t%" PRIuPTR "\t%.2f\t%.2f\t%.0f"
+			"\t%.2f\t%.1f\t%.1f\t%.1f\n", mode_names[m], name,
+			(uintptr_t) n_docs, (uintptr_t) (bytes / repeats),
+			throughput, whole > 0 ? throughput / whole : 1.0,
+			tokens / total,
+			allocations / (bytes / 1024.0), peak / 1024.0,
+			times[n_times / 2] * 1e6,
+			times[(n_times * 99) / 100] * 1e6);
+	fflush(stdout);
+
+	return throughput;
+}
+
+static void load(document *doc, const char *name)
+{
+	FILE *fp;
+	long len;
+
+	fp = fopen(name, "rb");
+	if (fp == NULL) {
+		fprintf(stderr, "Failed opening %s\n", name);
+		exit(1);
+	}
+
+	fseek(fp, 0, SEEK_END);
+	len = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+
+	doc->name = strdup(name);
+	doc->len = len;
+	doc->data = malloc(len > 0 ? len : 1);
+	if (doc->name == NULL || doc->data == NULL ||
+			fread(doc->data, 1, len, fp) != (size_t) len) {
+		fprintf(stderr, "Failed reading %s\n", name);
+		exit(1);
+	}
+
+	fclose(fp);
+
+	/* Count the tokens once, for every way of parsing it */
+	doc->tokens = 0;
+	parse(doc, MODE_TOKENS, 0, &doc->tokens);
+}
+
+/* Add the documents listed in a directory's INDEX to the corpus */
+static size_t load_index(document **docs, size_t n_docs, const char *dir)
+{
+	char path[4096], line[1024];
+	FILE *fp;
+
+	snprintf(path, sizeof path, "%s/INDEX", dir);
+	fp = fopen(path, "r");
+	if (fp == NULL) {
+		fprintf(stderr, "Failed opening %s\n", path);
+		exit(1);
+	}
+
+	while (fgets(line, sizeof line, fp) != NULL) {
+		size_t len = strcspn(line, "\t\r\n");
+
+		if (line[0] == '#' || len == 0)
+			continue;
+		line[len] = '\0';
+
+		*docs = realloc(*docs, (n_docs + 1) * sizeof(document));
+		if (*docs == NULL) {
+			fprintf(stderr, "No memory\n");
+			exit(1);
+		}
+
+		snprintf(path, sizeof path, "%s/%s", dir, line);
+		load(&(*docs)[n_docs++], path);
+	}
+
+	fclose(fp);
+
+	return n_docs;
+}
+
+int main(int argc, char **argv)
+{
+	document *docs = NULL;
+	size_t n_docs = 0, n_chunks = 0, i, c;
+	size_t chunks[32];
+	unsigned int repeats = 5;
+	double *times;
+	int arg, m;
+
+	for (arg = 1; arg < argc; arg++) {
+		if (strcmp(argv[arg], "-r") == 0 && arg + 1 < argc) {
+			repeats = atoi(argv[++arg]);
+		} else if (strcmp(argv[arg], "-c") == 0 && arg + 1 < argc &&
+				n_chunks < sizeof chunks / sizeof chunks[0]) {
+			arg++;
+			if (strcmp(argv[arg], "buffer") == 0)
+				chunks[n_chunks++] = 0;
+			else if (strcmp(argv[arg], "file") == 0)
+				chunks[n_chunks++] = (size_t) -1;
+			else
+				chunks[n_chunks++] = strtoul(argv[arg],
+						NULL, 10);
+		} else if (strcmp(argv[arg], "-d") == 0 && arg + 1 < argc) {
+			n_docs = load_index(&docs, n_docs, argv[++arg]);
+		} else if (argv[arg][0] != '-') {
+			docs = realloc(docs, (n_docs + 1) * sizeof(document));
+			if (docs == NULL) {
+				fprintf(stderr, "No memory\n");
+				return 1;
+			}
+			load(&docs[n_docs++], argv[arg]);
+		} else {
+			break;
+		}
+	}
+
+	if (arg < argc || n_docs == 0 || repeats == 0) {
+		printf("Usage: %s [-r repeats] [-c chunk|file|buffer]... "
+				"[-d dir] [file]...\n", argv[0]);
+		return 1;
+	}
+
+	if (n_chunks == 0) {
+		memcpy(chunks, default_chunks, sizeof default_chunks);
+		n_chunks = sizeof default_chunks / sizeof default_chunks[0];
+	}
+
+	times = malloc(n_docs * repeats * sizeof(double));
+	if (times == NULL) {
+		fprintf(stderr, "No memory\n");
+		return 1;
+	}
+
+	printf("# mode\tchunk\tdocs\tbytes\tMB/s\tvs_file\ttokens/s"
+			"\tallocs/KB\tpeak_KB\tp50_us\tp99_us\n");
+
+	for (m = MODE_TOKENS; m <= MODE_DOM; m++) {
+		double whole = 0;
+
+		/* The document in one chunk first, to compare with */
+		for (c = 0; c < n_chunks; c++) {
+			if (chunks[c] == (size_t) -1) {
+				whole = run(docs, n_docs, m, chunks[c],
+						repeats, times, 0);
+				break;
+			}
+		}
+
+		for (c = 0; c < n_chunks; c++) {
+			if (chunks[c] != (size_t) -1)
+				run(docs, n_docs, m, chunks[c], repeats,
+						times, whole);
+		}
+	}
+
+	for (i = 0; i < n_docs; i++) {
+		free(docs[i].name);
+		free(docs[i].data);
+	}
+	free(docs);
+	free(times);
+
+	return 0;
+}
+
@@ -0,0 +1,228 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <hubbub/hubbub.h>
+#include <hubbub/dom.h>
+#include <hubbub/parser.h>
+
+#define UNUSED(x) ((x) = (x))
+
+/**
+ * Complexity regression suite
+ *
+ * Each pattern is a document generated to be hard on some part of the
+ * parser, such as deep nesting or a tag with thousands of attributes,
+ * given some number of repeats of a unit. Each is parsed into the tree in
+ * hubbub/dom.h at 1, 10 and 100 times a base number of repeats. A line is
+ * written of tab-separated fields for each:
+ *
+ *   pattern scale bytes us allocs us/KB
+ *
+ * where us is the best of several times to parse the document, in
+ * microseconds, and allocs counts calls to the allocator. At 10 and 100
+ * times, the time and allocations must be within an envelope of linear
+ * growth, from those at 1 times; otherwise, the pattern fails, and the
+ * suite exits with a failure.
+ */
+
+/* Envelope of linear growth, as a multiple of linear */
+#define ENVELOPE 4
+
+typedef struct pattern {
+	const char *name;		/* Name of pattern */
+	const char *prefix;		/* Text before the units */
+	const char *unit;		/* Unit, as a printf format, given its
+					 * index */
+	const char *suffix;		/* Text after the units */
+	size_t base;			/* Units at 1 times */
+} pattern;
+
+static const pattern patterns[] = {
+	/* Stack of open elements, and scope checks of it */
+	{ "nesting", "", "<div>", "x", 1000 },
+	{ "inline-nesting", "", "<span>", "x", 1000 },
+	/* Active formatting elements, reconstructed for the text */
+	{ "formatting", "", "<b><i><u>", "x", 1000 },
+	/* Attributes, all distinct or all the same */
+	{ "attributes", "<p", " a%u=x", ">", 1000 },
+	{ "duplicate-attributes", "<p", " a=x", ">", 1000 },
+	/* The adoption agency */
+	{ "misnested", "", "<b><p>x</b>", "", 1000 },
+	{ "anchors", "", "<a>x", "", 1000 },
+	/* Character references, or what might be */
+	{ "entities", "", "&amp", "", 1000 },
+	{ "ampersands", "", "&", "", 10000 },
+	{ "numeric-entity", "&#", "9", ";", 10000 },
+	/* Foster parenting, out of a table */
+	{ "foster-parenting", "<table>", "x<b>", "", 1000 },
+};
+
+static const unsigned int scales[] = { 1, 10, 100 };
+
+/* Times to parse each document, keeping the best */
+static const unsigned int repeats = 3;
+
+static size_t allocations;
+
+static void *counting_realloc(void *ptr, size_t len, void *pw)
+{
+	UNUSED(pw);
+
+	if (len == 0) {
+		free(ptr);
+		return NULL;
+	}
+
+	allocations++;
+
+	return realloc(ptr, len);
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Generate a pattern's document, of some number of units */
+static uint8_t *generate(const pattern *p, size_t units, size_t *len)
+{
+	size_t alloc = strlen(p->prefix) + strlen(p->suffix) + 1, used, i;
+	uint8_t *data;
+	char unit[64];
+
+	for (i = 0; i < units; i++) {
+		alloc += snprintf(unit, sizeof unit, p->unit,
+				(unsigned int) i);
+	}
+
+	data = malloc(alloc);
+	if (data == NULL) {
+		fprintf(stderr, "No memory\n");
+		exit(1);
+	}
+
+	used = sprintf((char *) data, "%s", p->prefix);
+	for (i = 0; i < units; i++) {
+		used += sprintf((char *) data + used, p->unit,
+				(unsigned int) i);
+	}
+	used += sprintf((char *) data + used, "%s", p->suffix);
+
+	*len = used;
+
+	return data;
+}
+
+/* Parse a document, returning the time taken, in seconds */
+static double parse(const uint8_t *data, size_t len)
+{
+	hubbub_parser *parser;
+	hubbub_dom *dom;
+	double start;
+
+	start = now();
+
+	if (hubbub_parser_create("UTF-8", false, counting_realloc, NULL,
+			&parser) != HUBBUB_OK ||
+			hubbub_dom_create(counting_realloc, NULL, &dom) !=
+			HUBBUB_OK || hubbub_dom_attach(dom, parser) !=
+			HUBBUB_OK) {
+		fprintf(stderr, "Failed creating parser\n");
+		exit(1);
+	}
+
+	if (hubbub_parser_parse_chunk(parser, data, len) != HUBBUB_OK ||
+			hubbub_parser_completed(parser) != HUBBUB_OK) {
+		fprintf(stderr, "Failed parsing\n");
+		exit(1);
+	}
+
+	hubbub_parser_destroy(parser);
+	hubbub_dom_destroy(dom);
+
+	return now() - start;
+}
+
+/* Run a pattern at each scale, returning whether it grew linearly */
+static bool run(const pattern *p)
+{
+	double base_time = 0, base_allocs = 0;
+	bool linear = true;
+	size_t s;
+
+	for (s = 0; s < sizeof scales / sizeof scales[0]; s++) {
+		double best = 0, t;
+		size_t len, allocs = 0;
+		unsigned int r;
+		uint8_t *data;
+
+		data = generate(p, p->base * scales[s], &len);
+
+		for (r = 0; r < repeats; r++) {
+			allocations = 0;
+			t = parse(data, len);
+			if (r == 0 || t < best)
+				best = t;
+			allocs = allocations;
+		}
+
+		free(data);
+
+		if (s == 0) {
+			base_time = best;
+			base_allocs = allocs;
+		} else if (best > base_time * scales[s] * ENVELOPE ||
+				allocs > base_allocs * scales[s] * ENVELOPE) {
+			linear = false;
+		}
+
+		printf("%s\t%u\t%" PRIuPTR "\t%.0f\t%" PRIuPTR "\t%.2f%s\n",
+				p->name, scales[s], (uintptr_t) len,
+				best * 1e6, (uintptr_t) allocs,
+				best * 1e6 / (len / 1024.0),
+				linear ? "" : "\tFAIL");
+		fflush(stdout);
+	}
+
+	return linear;
+}
+
+int main(int argc, char **argv)
+{
+	size_t i, failed = 0;
+	int arg;
+
+	printf("# pattern\tscale\tbytes\tus\tallocs\tus/KB\n");
+
+	for (i = 0; i < sizeof patterns / sizeof patterns[0]; i++) {
+		/* Only the patterns named, if any are */
+		for (arg = 1; arg < argc; arg++) {
+			if (strcmp(argv[arg], patterns[i].name) == 0)
+				break;
+		}
+		if (argc > 1 && arg == argc)
+			continue;
+
+		if (run(&patterns[i]) == false)
+			failed++;
+	}
+
+	if (failed > 0) {
+		printf("FAIL: %" PRIuPTR " patterns grew faster than "
+				"linearly\n", (uintptr_t) failed);
+		return 1;
+	}
+
+	printf("PASS\n");
+
+	return 0;
+}
@@ -0,0 +1,56 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/fcntl.h>
+#include <sys/mman.h>
+
+#include <hubbub/hubbub.h>
+#include <hubbub/dom.h>
+#include <hubbub/parser.h>
+
+static void *myrealloc(void *ptr, size_t len, void *pw)
+{
+	(void) pw;
+
+	return realloc(ptr, len);
+}
+
+int main(int argc, char **argv)
+{
+	hubbub_parser *parser;
+	hubbub_dom *dom;
+
+	struct stat info;
+	int fd;
+	uint8_t *file;
+
+	if (argc != 2) {
+		printf("Usage: %s <file>\n", argv[0]);
+		return 1;
+	}
+
+	assert(hubbub_dom_create(myrealloc, NULL, &dom) == HUBBUB_OK);
+
+	assert(hubbub_parser_create("UTF-8", false, myrealloc, NULL, &parser) ==
+			HUBBUB_OK);
+
+	assert(hubbub_dom_attach(dom, parser) == HUBBUB_OK);
+
+	stat(argv[1], &info);
+	fd = open(argv[1], 0);
+	file = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+
+	/* The document is read in place, rather than copied */
+	assert(hubbub_parser_parse_buffer(parser, file, info.st_size)
+			== HUBBUB_OK);
+
+	hubbub_parser_destroy(parser);
+
+	assert(hubbub_dom_destroy(dom) == HUBBUB_OK);
+
+	return 0;
+}
+
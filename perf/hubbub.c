@@ -152,7 +152,7 @@ int main(int argc, char **argv)
 	fd = open(argv[2], 0);
 	file = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
 
-	assert(hubbub_parser_parse_chunk(parser, file, info.st_size)
+	assert(hubbub_parser_parse_buffer(parser, file, info.st_size)
 			== HUBBUB_OK);
 
 	assert(hubbub_finalise(myrealloc, NULL) == HUBBUB_OK);
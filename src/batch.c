@@ -0,0 +1,272 @@
+/*
+ * This file is part of Hubbub.
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license.php
+ * Copyright 2026 agent <agent@local>
+ */
+
+#include <hubbub/batch.h>
+
+#include "utils/thread.h"
+#include "utils/utils.h"
+
+/**
+ * A thread parsing documents of a batch
+ *
+ * Each worker starts with a run of the documents to itself, which it
+ * parses from the front. Once its own are gone, it takes the back half of
+ * the run remaining to another worker, so the batch is shared out however
+ * long the documents take to parse.
+ */
+typedef struct hubbub_batch_worker {
+	struct hubbub_batch *batch;	/**< Batch being parsed */
+
+	hubbub_thread thread;		/**< Thread, unless it is the caller */
+
+	hubbub_mutex lock;		/**< Lock on the documents left */
+	size_t next;			/**< First document left */
+	size_t end;			/**< One past the last document left */
+
+	hubbub_parser *parser;		/**< Parser, reused for each document,
+					 * or NULL if not yet created */
+} hubbub_batch_worker;
+
+/**
+ * A batch of documents, being parsed
+ */
+typedef struct hubbub_batch {
+	hubbub_batch_document *docs;	/**< Documents */
+	const hubbub_batch_handler *handler;	/**< Client callbacks */
+
+	hubbub_batch_worker *workers;	/**< Workers */
+	unsigned int n_workers;		/**< Number of workers */
+
+	hubbub_allocator_fn alloc;	/**< Memory (de)allocation function */
+	void *pw;			/**< Client data for alloc */
+} hubbub_batch;
+
+static bool take_own(hubbub_batch_worker *worker, size_t *index);
+static bool take_other(hubbub_batch_worker *worker, size_t *index);
+static void parse_document(hubbub_batch_worker *worker, size_t index);
+static void run_worker(void *arg);
+
+/**
+ * Parse a batch of documents, on several threads
+ *
+ * \param docs     Documents to parse
+ * \param n_docs   Number of documents
+ * \param handler  Client callbacks, to ready a parser for each document
+ *                 and take the result
+ * \param threads  Number of threads to parse on, including the caller's
+ * \param alloc    Memory (de)allocation function, which must be safe to
+ *                 call from any thread
+ * \param pw       Pointer to client-specific private data (may be NULL)
+ * \return HUBBUB_OK once all the documents are parsed, appropriate error
+ *         if the batch could not be started
+ *
+ * The result of parsing each document is set in its error member, and
+ * passed to the handler's finish callback. Each thread creates a parser
+ * on first use, and resets it for every other document it parses.
+ *
+ * Without thread support, or with threads of 0 or 1, the documents are
+ * parsed one after another on the caller's thread.
+ */
+hubbub_error hubbub_parse_batch(hubbub_batch_document *docs, size_t n_docs,
+		const hubbub_batch_handler *handler, unsigned int threads,
+		hubbub_allocator_fn alloc, void *pw)
+{
+	hubbub_batch batch;
+	unsigned int i, started;
+
+	if ((docs == NULL && n_docs > 0) || handler == NULL ||
+			handler->start == NULL || alloc == NULL)
+		return HUBBUB_BADPARM;
+
+	if (threads == 0)
+		threads = 1;
+	/* There is no point in a thread with nothing to do */
+	if (threads > n_docs)
+		threads = n_docs > 0 ? n_docs : 1;
+
+	batch.docs = docs;
+	batch.handler = handler;
+	batch.n_workers = threads;
+	batch.alloc = alloc;
+	batch.pw = pw;
+
+	batch.workers = alloc(NULL, threads * sizeof(hubbub_batch_worker), pw);
+	if (batch.workers == NULL)
+		return HUBBUB_NOMEM;
+
+	/* Share the documents out evenly to start with */
+	for (i = 0; i < threads; i++) {
+		hubbub_batch_worker *worker = &batch.workers[i];
+
+		worker->batch = &batch;
+		worker->next = n_docs * i / threads;
+		worker->end = n_docs * (i + 1) / threads;
+		worker->parser = NULL;
+
+		if (hubbub_mutex_init(&worker->lock) == false)
+			break;
+	}
+
+	if (i < threads) {
+		while (i-- > 0)
+			hubbub_mutex_destroy(&batch.workers[i].lock);
+		alloc(batch.workers, 0, pw);
+		return HUBBUB_UNKNOWN;
+	}
+
+	/* The caller is the first worker, and starts the others */
+	for (started = 1; started < threads; started++) {
+		hubbub_thread_start(&batch.workers[started].thread,
+				run_worker, &batch.workers[started]);
+	}
+
+	run_worker(&batch.workers[0]);
+
+	for (i = 1; i < threads; i++)
+		hubbub_thread_join(&batch.workers[i].thread);
+
+	for (i = 0; i < threads; i++) {
+		if (batch.workers[i].parser != NULL)
+			hubbub_parser_destroy(batch.workers[i].parser);
+		hubbub_mutex_destroy(&batch.workers[i].lock);
+	}
+
+	alloc(batch.workers, 0, pw);
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Take the next of a worker's own documents
+ *
+ * \param worker  Worker to take from
+ * \param index   Pointer to location to receive the document's index
+ * \return true if a document was taken, false if the worker has none left
+ */
+bool take_own(hubbub_batch_worker *worker, size_t *index)
+{
+	bool taken = false;
+
+	hubbub_mutex_lock(&worker->lock);
+
+	if (worker->next < worker->end) {
+		*index = worker->next++;
+		taken = true;
+	}
+
+	hubbub_mutex_unlock(&worker->lock);
+
+	return taken;
+}
+
+/**
+ * Take documents from another worker, once a worker's own are gone
+ *
+ * \param worker  Worker which has no documents left
+ * \param index   Pointer to location to receive the index of the first
+ *                document taken
+ * \return true if documents were taken, false if none are left anywhere
+ *
+ * The back half of the documents left to the first worker with any is
+ * taken. The first is for the worker to parse now, and the rest become its
+ * own, to parse or to be taken in turn. Only one lock is held at a time.
+ */
+bool take_other(hubbub_batch_worker *worker, size_t *index)
+{
+	hubbub_batch *batch = worker->batch;
+	unsigned int self = worker - batch->workers;
+	unsigned int i;
+
+	for (i = 1; i < batch->n_workers; i++) {
+		hubbub_batch_worker *victim =
+				&batch->workers[(self + i) % batch->n_workers];
+		size_t start, end;
+
+		hubbub_mutex_lock(&victim->lock);
+
+		end = victim->end;
+		start = victim->next + (end - victim->next) / 2;
+		victim->end = start;
+
+		hubbub_mutex_unlock(&victim->lock);
+
+		if (start < end) {
+			*index = start;
+
+			hubbub_mutex_lock(&worker->lock);
+			worker->next = start + 1;
+			worker->end = end;
+			hubbub_mutex_unlock(&worker->lock);
+
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/**
+ * Parse one document of a batch
+ *
+ * \param worker  Worker parsing the document
+ * \param index   Index of the document
+ */
+void parse_document(hubbub_batch_worker *worker, size_t index)
+{
+	hubbub_batch *batch = worker->batch;
+	hubbub_batch_document *doc = &batch->docs[index];
+	const hubbub_batch_handler *handler = batch->handler;
+	hubbub_error error;
+
+	if (worker->parser == NULL) {
+		error = hubbub_parser_create(doc->charset, false, batch->alloc,
+				batch->pw, &worker->parser);
+		if (error != HUBBUB_OK)
+			worker->parser = NULL;
+	} else if (doc->charset != NULL) {
+		/* The parser was reset after its last document, but without
+		 * a charset */
+		error = hubbub_parser_reset(worker->parser, doc->charset);
+	} else {
+		error = HUBBUB_OK;
+	}
+
+	if (error == HUBBUB_OK)
+		error = handler->start(handler->pw, index, worker->parser);
+
+	if (error == HUBBUB_OK) {
+		error = hubbub_parser_parse_buffer(worker->parser,
+				doc->data, doc->len);
+	}
+
+	/* Have the parser let go of the tree before the client takes it */
+	if (worker->parser != NULL && hubbub_parser_reset(worker->parser,
+			NULL) != HUBBUB_OK) {
+		hubbub_parser_destroy(worker->parser);
+		worker->parser = NULL;
+	}
+
+	doc->error = error;
+
+	if (handler->finish != NULL)
+		handler->finish(handler->pw, index, error);
+}
+
+/**
+ * Parse documents of a batch until none are left
+ *
+ * \param arg  Worker to parse with
+ */
+void run_worker(void *arg)
+{
+	hubbub_batch_worker *worker = arg;
+	size_t index;
+
+	while (take_own(worker, &index) || take_other(worker, &index))
+		parse_document(worker, index);
+}
+
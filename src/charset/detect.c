@@ -13,10 +13,20 @@
 
 #include <hubbub/types.h>
 
+#include "utils/scan.h"
 #include "utils/utils.h"
 
 #include "detect.h"
 
+/** Number of bytes at the start of the data examined by autodetection */
+#define AUTODETECT_SAMPLE 4096
+
+/** Number of characters after which autodetection has evidence enough */
+#define AUTODETECT_CHARS 256
+
+/** Confidence below which an autodetected charset is not trusted */
+#define AUTODETECT_THRESHOLD 50
+
 static uint16_t hubbub_charset_read_bom(const uint8_t *data, size_t len);
 static uint16_t hubbub_charset_scan_meta(const uint8_t *data, size_t len);
 static uint16_t hubbub_charset_parse_attributes(const uint8_t **pos,
@@ -25,6 +35,8 @@ static bool hubbub_charset_get_attribute(const uint8_t **data,
 		const uint8_t *end,
 		const uint8_t **name, uint32_t *namelen,
 		const uint8_t **value, uint32_t *valuelen);
+static uint32_t hubbub_charset_confidence(size_t hits, size_t n,
+		uint32_t expected);
 
 /**
  * Extract a charset from a chunk of data
@@ -44,6 +56,7 @@ parserutils_error hubbub_charset_extract(const uint8_t *data, size_t len,
 		uint16_t *mibenum, uint32_t *source)
 {
 	uint16_t charset = 0;
+	uint32_t confidence;
 
 	if (data == NULL || mibenum == NULL || source == NULL)
 		return PARSERUTILS_BADPARM;
@@ -127,10 +140,19 @@ parserutils_error hubbub_charset_extract(const uint8_t *data, size_t len,
 		}
 	}
 
+	/* 6. */
+
 	/* No charset was specified within the document, attempt to
 	 * autodetect the encoding from the data that we have available. */
+	charset = hubbub_charset_autodetect(data, len, &confidence);
+	if (charset != 0 && confidence >= AUTODETECT_THRESHOLD) {
+		hubbub_charset_fix_charset(&charset);
+
+		*mibenum = charset;
+		*source = HUBBUB_CHARSET_TENTATIVE;
 
-	/** \todo Charset autodetection */
+		return PARSERUTILS_OK;
+	}
 
 	/* We failed to autodetect a charset, so use the default fallback */
 default_encoding:
@@ -713,3 +735,310 @@ void hubbub_charset_fix_charset(uint16_t *charset)
 	if (tmp != 0)
 		*charset = tmp;
 }
+
+/**
+ * Determine whether a charset encodes ASCII characters as ASCII does
+ *
+ * \param charset  MIB enum of charset
+ * \return true if data in the charset which contains only bytes below 0x80
+ *         decodes to the same bytes, false otherwise (or if unsure)
+ */
+bool hubbub_charset_ascii_compatible(uint16_t charset)
+{
+	static const char *const names[] = {
+		"US-ASCII", "UTF-8",
+		"ISO-8859-1", "ISO-8859-2", "ISO-8859-3", "ISO-8859-4",
+		"ISO-8859-5", "ISO-8859-6", "ISO-8859-7", "ISO-8859-8",
+		"ISO-8859-9", "ISO-8859-10", "ISO-8859-13", "ISO-8859-14",
+		"ISO-8859-15", "ISO-8859-16",
+		"Windows-874", "Windows-1250", "Windows-1251", "Windows-1252",
+		"Windows-1253", "Windows-1254", "Windows-1255", "Windows-1256",
+		"Windows-1257", "Windows-1258",
+		"KOI8-R", "KOI8-U", "EUC-JP", "EUC-KR", "GBK", "Big5"
+	};
+	size_t i;
+
+	if (charset == 0)
+		return false;
+
+	for (i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+		if (charset == parserutils_charset_mibenum_from_name(names[i],
+				strlen(names[i])))
+			return true;
+	}
+
+	return false;
+}
+
+#define IN_RANGE(c, r) ((c) >= (r)[0] && (c) <= (r)[1])
+
+/**
+ * Model of a multibyte charset: the bytes its characters are made of, and
+ * the characters seen most often in running text written in it
+ */
+typedef struct hubbub_charset_multibyte {
+	const char *name;		/**< Name of charset */
+	uint8_t lead[2][2];		/**< Ranges of lead bytes */
+	uint8_t trail[2][2];		/**< Ranges of trail bytes */
+	uint8_t single[2];		/**< Range of high bytes which stand
+					 * alone, if any */
+	uint16_t common[16];		/**< Frequent characters, in order */
+} hubbub_charset_multibyte;
+
+static const hubbub_charset_multibyte multibyte_models[] = {
+	/* Hiragana particles and inflections */
+	{ "Shift_JIS", { { 0x81, 0x9f }, { 0xe0, 0xfc } },
+		{ { 0x40, 0x7e }, { 0x80, 0xfc } }, { 0xa1, 0xdf },
+		{ 0x82a2, 0x82aa, 0x82b5, 0x82b7, 0x82bd, 0x82c4, 0x82c5,
+		0x82c6, 0x82c8, 0x82c9, 0x82cc, 0x82cd, 0x82dc, 0x82e9,
+		0x82f0, 0x82f1 } },
+	{ "EUC-JP", { { 0x8e, 0x8e }, { 0xa1, 0xfe } },
+		{ { 0xa1, 0xfe }, { 0xa1, 0xfe } }, { 0x00, 0x00 },
+		{ 0xa4a4, 0xa4ac, 0xa4b7, 0xa4b9, 0xa4bf, 0xa4c6, 0xa4c7,
+		0xa4c8, 0xa4ca, 0xa4cb, 0xa4ce, 0xa4cf, 0xa4de, 0xa4eb,
+		0xa4f2, 0xa4f3 } },
+	/* The commonest hanzi, simplified and traditional */
+	{ "GBK", { { 0x81, 0xfe }, { 0x81, 0xfe } },
+		{ { 0x40, 0x7e }, { 0x80, 0xfe } }, { 0x00, 0x00 },
+		{ 0xb2bb, 0xb4f3, 0xb5c4, 0xb9fa, 0xc1cb, 0xc8cb, 0xc9cf,
+		0xcac7, 0xcbfb, 0xceaa, 0xced2, 0xd2bb, 0xd3d0, 0xd4da,
+		0xd5e2, 0xd6d0 } },
+	{ "Big5", { { 0x81, 0xfe }, { 0x81, 0xfe } },
+		{ { 0x40, 0x7e }, { 0xa1, 0xfe } }, { 0x00, 0x00 },
+		{ 0xa440, 0xa446, 0xa448, 0xa457, 0xa46a, 0xa4a3, 0xa4a4,
+		0xa54c, 0xa662, 0xa6b3, 0xa7da, 0xaaba, 0xac4f, 0xacb0,
+		0xb0ea, 0xb36f } },
+	/* The commonest Hangul syllables */
+	{ "EUC-KR", { { 0xa1, 0xfe }, { 0xa1, 0xfe } },
+		{ { 0xa1, 0xfe }, { 0xa1, 0xfe } }, { 0x00, 0x00 },
+		{ 0xb0a1, 0xb0ed, 0xb1e2, 0xb4c2, 0xb4d9, 0xb7ce, 0xb8ae,
+		0xbbe7, 0xbcad, 0xbfa1, 0xc0bb, 0xc0c7, 0xc0cc, 0xc1f6,
+		0xc7cf, 0xc7d1 } },
+};
+
+/**
+ * Model of a single byte charset: the letters seen most often in running
+ * text written in it
+ */
+typedef struct hubbub_charset_singlebyte {
+	const char *name;		/**< Name of charset */
+	uint8_t common[10];		/**< Frequent letters */
+} hubbub_charset_singlebyte;
+
+static const hubbub_charset_singlebyte singlebyte_models[] = {
+	/* Lower case o, e, a, i, n, t, s, r, v and l in Russian */
+	{ "Windows-1251", { 0xee, 0xe5, 0xe0, 0xe8, 0xed, 0xf2, 0xf1, 0xf0,
+		0xe2, 0xeb } },
+	{ "KOI8-R", { 0xcf, 0xc5, 0xc1, 0xc9, 0xce, 0xd4, 0xd3, 0xd2,
+		0xd7, 0xcc } },
+};
+
+/**
+ * Determine how far some data agrees with a model of a charset
+ *
+ * \param hits      Number of characters the model expects to be frequent
+ * \param n         Number of characters
+ * \param expected  Percentage of frequent characters in text of the charset
+ * \return Confidence, from 0 to 100
+ */
+uint32_t hubbub_charset_confidence(size_t hits, size_t n, uint32_t expected)
+{
+	uint32_t confidence;
+
+	if (n == 0)
+		return 0;
+
+	confidence = hits * 100 * 100 / (n * expected);
+	if (confidence > 100)
+		confidence = 100;
+
+	/* A handful of characters is only weak evidence */
+	if (n < 16)
+		confidence = confidence * n / 16;
+
+	return confidence;
+}
+
+/**
+ * Score data against a model of a multibyte charset
+ *
+ * \param model  Model of charset
+ * \param data   Pointer to data, which begins with a high byte
+ * \param len    Length of data
+ * \return Confidence that the data is in the charset, from 0 to 100
+ */
+static uint32_t hubbub_charset_score_multibyte(
+		const hubbub_charset_multibyte *model,
+		const uint8_t *data, size_t len)
+{
+	size_t pos = 0, chars = 0, hits = 0, errors = 0;
+	size_t lo, hi, mid;
+	uint16_t c;
+
+	while (pos < len && chars < AUTODETECT_CHARS) {
+		pos += hubbub_scan_ascii(data + pos, len - pos);
+		if (pos == len)
+			break;
+
+		c = data[pos++];
+		if (IN_RANGE(c, model->single))
+			continue;
+
+		if (IN_RANGE(c, model->lead[0]) ||
+				IN_RANGE(c, model->lead[1])) {
+			/* Cut short by the end of the sample */
+			if (pos == len)
+				break;
+
+			if (IN_RANGE(data[pos], model->trail[0]) ||
+					IN_RANGE(data[pos], model->trail[1])) {
+				c = (c << 8) | data[pos++];
+				chars++;
+
+				lo = 0;
+				hi = N_ELEMENTS(model->common);
+				while (lo < hi) {
+					mid = (lo + hi) / 2;
+					if (model->common[mid] < c)
+						lo = mid + 1;
+					else
+						hi = mid;
+				}
+				if (lo < N_ELEMENTS(model->common) &&
+						model->common[lo] == c)
+					hits++;
+
+				continue;
+			}
+		}
+
+		/* More than the odd stray byte means the data is not in
+		 * this charset at all */
+		if (++errors > 2 + chars / 32)
+			return 0;
+	}
+
+	return hubbub_charset_confidence(hits, chars, 20);
+}
+
+/**
+ * Guess the charset of some data from its content
+ *
+ * \param data        Pointer to buffer containing data
+ * \param len         Buffer length
+ * \param confidence  Pointer to location to receive confidence in the
+ *                    guess, from 0 to 100
+ * \return MIB enum of the likeliest charset, or 0 if there is no evidence
+ *
+ * Only the start of the data is examined.
+ */
+uint16_t hubbub_charset_autodetect(const uint8_t *data, size_t len,
+		uint32_t *confidence)
+{
+	uint16_t counts[4][256], high[128];
+	size_t pos, run, n_high = 0, leads = 0, seen = 0, adjacent = 0;
+	size_t hits, i, j;
+	uint32_t score, best = 0;
+	uint16_t charset, guess = 0;
+
+	*confidence = 0;
+
+	if (len > AUTODETECT_SAMPLE)
+		len = AUTODETECT_SAMPLE;
+
+	/* Skip to the first high byte: ASCII tells us nothing */
+	pos = hubbub_scan_ascii(data, len);
+	if (pos == len)
+		return 0;
+	data += pos;
+	len -= pos;
+
+	/* Histogram the bytes, into several tables so that neighbouring
+	 * updates don't wait on one another */
+	memset(counts, 0, sizeof(counts));
+	for (pos = 0; pos + 4 <= len; pos += 4) {
+		counts[0][data[pos]]++;
+		counts[1][data[pos + 1]]++;
+		counts[2][data[pos + 2]]++;
+		counts[3][data[pos + 3]]++;
+	}
+	for (; pos < len; pos++)
+		counts[0][data[pos]]++;
+
+	for (i = 0; i < N_ELEMENTS(high); i++) {
+		high[i] = counts[0][0x80 + i] + counts[1][0x80 + i] +
+				counts[2][0x80 + i] + counts[3][0x80 + i];
+		n_high += high[i];
+		if (i >= 0x40)
+			leads += high[i];
+	}
+
+	/* UTF-8 is very unlikely to happen by accident, beyond a character
+	 * or so */
+	if (hubbub_scan_utf8_valid(data, len) ==
+			hubbub_scan_utf8_complete(data, len)) {
+		*confidence = leads < 4 ? leads * 25 : 100;
+
+		return parserutils_charset_mibenum_from_name("UTF-8",
+				SLEN("UTF-8"));
+	}
+
+	for (i = 0; i < N_ELEMENTS(multibyte_models); i++) {
+		score = hubbub_charset_score_multibyte(&multibyte_models[i],
+				data, len);
+		if (score <= best)
+			continue;
+
+		charset = parserutils_charset_mibenum_from_name(
+				multibyte_models[i].name,
+				strlen(multibyte_models[i].name));
+		if (charset != 0) {
+			best = score;
+			guess = charset;
+		}
+	}
+
+	/* Letters of a single byte charset come in runs of high bytes,
+	 * which accented Latin letters mostly don't */
+	for (pos = 0; pos < len && seen < AUTODETECT_CHARS; pos += run) {
+		pos += hubbub_scan_ascii(data + pos, len - pos);
+
+		for (run = 0; pos + run < len && data[pos + run] >= 0x80; )
+			run++;
+
+		if (run > 0) {
+			seen += run;
+			adjacent += run - 1;
+		}
+	}
+
+	if (adjacent * 2 < seen)
+		goto done;
+
+	for (i = 0; i < N_ELEMENTS(singlebyte_models); i++) {
+		const uint8_t *common = singlebyte_models[i].common;
+
+		hits = 0;
+		for (j = 0; j < N_ELEMENTS(singlebyte_models[i].common); j++)
+			hits += high[common[j] - 0x80];
+
+		score = hubbub_charset_confidence(hits, n_high, 60);
+		if (score <= best)
+			continue;
+
+		charset = parserutils_charset_mibenum_from_name(
+				singlebyte_models[i].name,
+				strlen(singlebyte_models[i].name));
+		if (charset != 0) {
+			best = score;
+			guess = charset;
+		}
+	}
+
+done:
+	*confidence = best;
+
+	return guess;
+}
+
+#undef IN_RANGE
@@ -8,6 +8,7 @@
 #ifndef hubbub_charset_detect_h_
 #define hubbub_charset_detect_h_
 
+#include <stdbool.h>
 #include <inttypes.h>
 
 #include <parserutils/errors.h>
@@ -16,6 +17,10 @@
 parserutils_error hubbub_charset_extract(const uint8_t *data, size_t len,
 		uint16_t *mibenum, uint32_t *source);
 
+/* Guess the charset of a chunk of data from its content */
+uint16_t hubbub_charset_autodetect(const uint8_t *data, size_t len,
+		uint32_t *confidence);
+
 /* Parse a Content-Type string for an encoding */
 uint16_t hubbub_charset_parse_content(const uint8_t *value,
                 uint32_t valuelen);
@@ -23,5 +28,8 @@ uint16_t hubbub_charset_parse_content(const uint8_t *value,
 /* Fix up frequently misused character sets */
 void hubbub_charset_fix_charset(uint16_t *charset);
 
+/* Determine whether a charset encodes ASCII characters as ASCII does */
+bool hubbub_charset_ascii_compatible(uint16_t charset);
+
 #endif
 
@@ -0,0 +1,1729 @@
+/*
+ * This file is part of Hubbub.
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license.php
+ * Copyright 2026 agent <agent@local>
+ */
+
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <hubbub/atoms.h>
+#include <hubbub/dom.h>
+#include <hubbub/tree.h>
+
+#include "utils/utils.h"
+
+/** Smallest number of entries allocated for any array */
+#define DOM_MIN_ALLOC 64
+
+/**
+ * A span of the string buffer
+ */
+typedef struct dom_span {
+	uint32_t off;		/**< Offset of first byte */
+	uint32_t len;		/**< Length, in bytes */
+} dom_span;
+
+/**
+ * An attribute, in an element's slab of them
+ */
+typedef struct dom_attribute {
+	hubbub_dom_atom name;	/**< Attribute name */
+	uint32_t ns;		/**< Attribute namespace */
+	dom_span value;		/**< Attribute value */
+} dom_attribute;
+
+/**
+ * The details of a doctype node
+ */
+typedef struct dom_doctype {
+	dom_span name;		/**< Doctype name */
+	dom_span public_id;	/**< Public identifier */
+	dom_span system_id;	/**< System identifier */
+	bool public_missing;	/**< Whether the public id is missing */
+	bool system_missing;	/**< Whether the system id is missing */
+	bool force_quirks;	/**< Doctype force-quirks flag */
+} dom_doctype;
+
+/**
+ * An interned name
+ */
+typedef struct dom_atom {
+	dom_span text;		/**< Text of name */
+	uint32_t hash;		/**< Hash of text */
+} dom_atom;
+
+/**
+ * Compact document tree
+ *
+ * Each node is an index into the node arrays. The meaning of a node's data
+ * and len entries depends upon its type:
+ *
+ *   + Elements: the index of the first of their attributes, and the number
+ *     of attributes. An element's attributes are contiguous.
+ *   + Text and comments: the offset of their content in the string buffer,
+ *     and its length.
+ *   + Doctypes: the index of their details, and nothing.
+ */
+struct hubbub_dom {
+	uint8_t *type;			/**< Node types */
+	uint8_t *ns;			/**< Element namespaces */
+	hubbub_dom_atom *name;		/**< Element names */
+	hubbub_dom_node *parent;	/**< Parents of nodes */
+	hubbub_dom_node *first_child;	/**< First children of nodes */
+	hubbub_dom_node *last_child;	/**< Last children of nodes */
+	hubbub_dom_node *next_sibling;	/**< Next siblings of nodes */
+	hubbub_dom_node *prev_sibling;	/**< Previous siblings of nodes */
+	uint32_t *data;			/**< Per-type node data */
+	uint32_t *len;			/**< Per-type node data */
+	uint32_t n_nodes;		/**< Number of nodes */
+	uint32_t nodes_alloc;		/**< Number of nodes allocated */
+
+	dom_attribute *attrs;		/**< Attributes of all elements */
+	uint32_t n_attrs;		/**< Number of attributes */
+	uint32_t attrs_alloc;		/**< Number of attributes allocated */
+
+	dom_doctype *doctypes;		/**< Details of doctype nodes */
+	uint32_t n_doctypes;		/**< Number of doctypes */
+	uint32_t doctypes_alloc;	/**< Number of doctypes allocated */
+
+	uint8_t *strings;		/**< String buffer */
+	uint32_t strings_len;		/**< Bytes used in string buffer */
+	uint32_t strings_alloc;		/**< Size of string buffer */
+
+	dom_atom *atoms;		/**< Interned names */
+	uint32_t n_atoms;		/**< Number of atoms */
+	uint32_t atoms_alloc;		/**< Number of atoms allocated */
+	uint32_t *atom_slots;		/**< Hash table of atoms, each plus 1 */
+	uint32_t atom_slots_size;	/**< Size of hash table, power of 2 */
+	hubbub_dom_atom known[HUBBUB_ATOM_COUNT];	/**< Atoms of names
+					 * with hubbub atoms, or NONE */
+
+	hubbub_quirks_mode quirks;	/**< Quirks mode of document */
+
+	hubbub_tree_handler handler;	/**< Tree handler for parser */
+	hubbub_tree_handler_ext handler_ext;	/**< Extended tree handler */
+
+	hubbub_allocator_fn alloc;	/**< Memory (de)allocation function */
+	void *pw;			/**< Client private data */
+};
+
+static hubbub_error create_comment(void *ctx, const hubbub_string *data,
+		void **result);
+static hubbub_error create_doctype(void *ctx, const hubbub_doctype *doctype,
+		void **result);
+static hubbub_error create_element(void *ctx, const hubbub_tag *tag,
+		void **result);
+static hubbub_error create_text(void *ctx, const hubbub_string *data,
+		void **result);
+static hubbub_error ref_node(void *ctx, void *node);
+static hubbub_error unref_node(void *ctx, void *node);
+static hubbub_error append_child(void *ctx, void *parent, void *child,
+		void **result);
+static hubbub_error insert_before(void *ctx, void *parent, void *child,
+		void *ref_child, void **result);
+static hubbub_error remove_child(void *ctx, void *parent, void *child,
+		void **result);
+static hubbub_error clone_node(void *ctx, void *node, bool deep,
+		void **result);
+static hubbub_error reparent_children(void *ctx, void *node,
+		void *new_parent);
+static hubbub_error get_parent(void *ctx, void *node, bool element_only,
+		void **result);
+static hubbub_error has_children(void *ctx, void *node, bool *result);
+static hubbub_error form_associate(void *ctx, void *form, void *node);
+static hubbub_error add_attributes(void *ctx, void *node,
+		const hubbub_attribute *attributes, uint32_t n_attributes);
+static hubbub_error set_quirks_mode(void *ctx, hubbub_quirks_mode mode);
+static hubbub_error complete_script(void *ctx, void *script);
+static hubbub_error complete_style(void *ctx, void *style);
+static hubbub_error create_and_append_element(void *ctx, void *parent,
+		const hubbub_tag *tag, void **result);
+static hubbub_error append_text(void *ctx, void *parent,
+		const hubbub_string *data);
+
+static const hubbub_tree_handler tree_handler = {
+	create_comment,
+	create_doctype,
+	create_element,
+	create_text,
+	ref_node,
+	unref_node,
+	append_child,
+	insert_before,
+	remove_child,
+	clone_node,
+	reparent_children,
+	get_parent,
+	has_children,
+	form_associate,
+	add_attributes,
+	set_quirks_mode,
+	NULL,
+	complete_script,
+	complete_style,
+	NULL
+};
+
+static const hubbub_tree_handler_ext tree_handler_ext = {
+	create_and_append_element,
+	append_text,
+	HUBBUB_TREE_NO_REFCOUNT,
+	NULL,
+	NULL
+};
+
+/**
+ * Convert a node to the form used by the tree handler
+ *
+ * Node 0 is the document, so nodes are offset by one to keep them apart
+ * from NULL.
+ */
+static inline void *node_to_ptr(hubbub_dom_node node)
+{
+	return (void *) ((uintptr_t) node + 1);
+}
+
+/**
+ * Convert a tree handler's node back into a node
+ */
+static inline hubbub_dom_node ptr_to_node(void *ptr)
+{
+	return (hubbub_dom_node) ((uintptr_t) ptr - 1);
+}
+
+/**
+ * Find the new size of an array
+ *
+ * \param used   Number of entries in use
+ * \param more   Number of entries required beyond those in use
+ * \param alloc  Number of entries allocated
+ * \param size   Size of an entry, in bytes
+ * \param want   Pointer to location to receive new number of entries
+ * \return true if the array must grow, false if it need not
+ *
+ * If the array must grow, but cannot, then *want is set to 0.
+ */
+static bool dom_array_size(uint32_t used, uint32_t more, uint32_t alloc,
+		size_t size, uint32_t *want)
+{
+	uint32_t need;
+
+	if (more <= alloc - used)
+		return false;
+
+	/* Keep clear of HUBBUB_DOM_NONE */
+	if (more >= HUBBUB_DOM_NONE - used ||
+			used + more > SIZE_MAX / size) {
+		*want = 0;
+		return true;
+	}
+
+	need = used + more;
+
+	*want = alloc < DOM_MIN_ALLOC ? DOM_MIN_ALLOC : alloc;
+	while (*want < need)
+		*want = (*want < HUBBUB_DOM_NONE / 2) ? *want * 2 : need;
+
+	if (*want > SIZE_MAX / size)
+		*want = need;
+
+	return true;
+}
+
+/**
+ * Ensure an array has space for more entries
+ *
+ * \param dom    The tree
+ * \param array  The array
+ * \param used   Number of entries in use
+ * \param more   Number of entries required beyond those in use
+ * \param alloc  Pointer to number of entries allocated, updated on exit
+ * \param size   Size of an entry, in bytes
+ * \return Pointer to array, which may have moved, or NULL on failure
+ */
+static void *dom_reserve(hubbub_dom *dom, void *array, uint32_t used,
+		uint32_t more, uint32_t *alloc, size_t size)
+{
+	uint32_t want;
+	void *temp;
+
+	if (dom_array_size(used, more, *alloc, size, &want) == false)
+		return array;
+
+	if (want == 0)
+		return NULL;
+
+	temp = dom->alloc(array, want * size, dom->pw);
+	if (temp == NULL)
+		return NULL;
+
+	*alloc = want;
+
+	return temp;
+}
+
+/**
+ * Ensure the string buffer has space for more bytes
+ *
+ * \param dom   The tree
+ * \param more  Number of bytes required
+ * \return HUBBUB_OK on success, HUBBUB_NOMEM on memory exhaustion
+ */
+static hubbub_error dom_reserve_strings(hubbub_dom *dom, size_t more)
+{
+	uint8_t *temp;
+
+	if (more == 0)
+		return HUBBUB_OK;
+
+	if (more >= HUBBUB_DOM_NONE)
+		return HUBBUB_NOMEM;
+
+	temp = dom_reserve(dom, dom->strings, dom->strings_len,
+			(uint32_t) more, &dom->strings_alloc, 1);
+	if (temp == NULL)
+		return HUBBUB_NOMEM;
+
+	dom->strings = temp;
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Copy a string into the string buffer
+ *
+ * \param dom   The tree
+ * \param str   The string to copy, which must not be in the buffer
+ * \param span  Pointer to location to receive span of copy
+ * \return HUBBUB_OK on success, HUBBUB_NOMEM on memory exhaustion
+ */
+static hubbub_error dom_store(hubbub_dom *dom, const hubbub_string *str,
+		dom_span *span)
+{
+	hubbub_error error;
+
+	error = dom_reserve_strings(dom, str->len);
+	if (error != HUBBUB_OK)
+		return error;
+
+	if (str->len > 0)
+		memcpy(dom->strings + dom->strings_len, str->ptr, str->len);
+
+	span->off = dom->strings_len;
+	span->len = (uint32_t) str->len;
+
+	dom->strings_len += (uint32_t) str->len;
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Hash a name
+ *
+ * \param name  The name
+ * \param len   Length of name, in bytes
+ * \return Hash of name
+ */
+static uint32_t dom_hash(const uint8_t *name, size_t len)
+{
+	uint32_t hash = 0x811C9DC5u;
+
+	while (len-- > 0)
+		hash = (hash ^ *name++) * 0x01000193u;
+
+	return hash;
+}
+
+/**
+ * Find the hash table slot for a name
+ *
+ * \param dom   The tree, which must have a hash table
+ * \param name  The name
+ * \param len   Length of name, in bytes
+ * \param hash  Hash of name
+ * \return Index of slot holding the name's atom, or of the empty slot
+ *         where it belongs
+ */
+static uint32_t dom_atom_slot(const hubbub_dom *dom, const uint8_t *name,
+		size_t len, uint32_t hash)
+{
+	uint32_t mask = dom->atom_slots_size - 1;
+	uint32_t slot = hash & mask;
+
+	while (dom->atom_slots[slot] != 0) {
+		const dom_atom *atom = &dom->atoms[dom->atom_slots[slot] - 1];
+
+		if (atom->hash == hash && atom->text.len == len &&
+				memcmp(dom->strings + atom->text.off,
+						name, len) == 0)
+			break;
+
+		slot = (slot + 1) & mask;
+	}
+
+	return slot;
+}
+
+/**
+ * Grow the hash table of atoms
+ *
+ * \param dom  The tree
+ * \return HUBBUB_OK on success, HUBBUB_NOMEM on memory exhaustion
+ */
+static hubbub_error dom_grow_atom_slots(hubbub_dom *dom)
+{
+	uint32_t size = dom->atom_slots_size == 0
+			? DOM_MIN_ALLOC : dom->atom_slots_size * 2;
+	uint32_t *slots;
+	uint32_t i;
+
+	if (size == 0 || size > HUBBUB_DOM_NONE / sizeof(uint32_t))
+		return HUBBUB_NOMEM;
+
+	slots = dom->alloc(NULL, size * sizeof(uint32_t), dom->pw);
+	if (slots == NULL)
+		return HUBBUB_NOMEM;
+
+	memset(slots, 0, size * sizeof(uint32_t));
+
+	for (i = 0; i < dom->n_atoms; i++) {
+		uint32_t slot = dom->atoms[i].hash & (size - 1);
+
+		while (slots[slot] != 0)
+			slot = (slot + 1) & (size - 1);
+
+		slots[slot] = i + 1;
+	}
+
+	if (dom->atom_slots != NULL)
+		dom->alloc(dom->atom_slots, 0, dom->pw);
+
+	dom->atom_slots = slots;
+	dom->atom_slots_size = size;
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Intern a name
+ *
+ * \param dom    The tree
+ * \param name   The name
+ * \param known  The name's hubbub atom, or HUBBUB_ATOM_NONE
+ * \param atom   Pointer to location to receive atom
+ * \return HUBBUB_OK on success, HUBBUB_NOMEM on memory exhaustion
+ *
+ * Names with hubbub atoms are interned once, then found without hashing.
+ */
+static hubbub_error dom_intern(hubbub_dom *dom, const hubbub_string *name,
+		hubbub_atom known, hubbub_dom_atom *atom)
+{
+	dom_atom *temp;
+	hubbub_error error;
+	uint32_t hash, slot;
+
+	if (known >= HUBBUB_ATOM_COUNT)
+		known = HUBBUB_ATOM_NONE;
+
+	if (known != HUBBUB_ATOM_NONE &&
+			dom->known[known] != HUBBUB_DOM_NONE) {
+		*atom = dom->known[known];
+		return HUBBUB_OK;
+	}
+
+	hash = dom_hash(name->ptr, name->len);
+
+	/* Keep the hash table at most half full */
+	if (dom->n_atoms >= dom->atom_slots_size / 2) {
+		error = dom_grow_atom_slots(dom);
+		if (error != HUBBUB_OK)
+			return error;
+	}
+
+	slot = dom_atom_slot(dom, name->ptr, name->len, hash);
+	if (dom->atom_slots[slot] != 0) {
+		*atom = dom->atom_slots[slot] - 1;
+		if (known != HUBBUB_ATOM_NONE)
+			dom->known[known] = *atom;
+		return HUBBUB_OK;
+	}
+
+	temp = dom_reserve(dom, dom->atoms, dom->n_atoms, 1,
+			&dom->atoms_alloc, sizeof(dom_atom));
+	if (temp == NULL)
+		return HUBBUB_NOMEM;
+	dom->atoms = temp;
+
+	error = dom_store(dom, name, &dom->atoms[dom->n_atoms].text);
+	if (error != HUBBUB_OK)
+		return error;
+
+	dom->atoms[dom->n_atoms].hash = hash;
+	dom->atom_slots[slot] = dom->n_atoms + 1;
+
+	*atom = dom->n_atoms++;
+	if (known != HUBBUB_ATOM_NONE)
+		dom->known[known] = *atom;
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Create a node
+ *
+ * \param dom   The tree
+ * \param type  Type of node
+ * \param node  Pointer to location to receive node
+ * \return HUBBUB_OK on success, HUBBUB_NOMEM on memory exhaustion
+ *
+ * The node is created without parent, siblings, children or data.
+ */
+static hubbub_error dom_new_node(hubbub_dom *dom, hubbub_dom_node_type type,
+		hubbub_dom_node *node)
+{
+	uint32_t want;
+	hubbub_dom_node n;
+
+	if (dom_array_size(dom->n_nodes, 1, dom->nodes_alloc,
+			sizeof(hubbub_dom_node), &want)) {
+		void *temp;
+
+		if (want == 0)
+			return HUBBUB_NOMEM;
+
+/* Grow one node array, leaving nodes_alloc for the last of them */
+#define GROW(array)							\
+		temp = dom->alloc(dom->array,				\
+				want * sizeof(*dom->array), dom->pw);	\
+		if (temp == NULL)					\
+			return HUBBUB_NOMEM;				\
+		dom->array = temp
+
+		GROW(type);
+		GROW(ns);
+		GROW(name);
+		GROW(parent);
+		GROW(first_child);
+		GROW(last_child);
+		GROW(next_sibling);
+		GROW(prev_sibling);
+		GROW(data);
+		GROW(len);
+
+#undef GROW
+
+		dom->nodes_alloc = want;
+	}
+
+	n = dom->n_nodes++;
+
+	dom->type[n] = (uint8_t) type;
+	dom->ns[n] = HUBBUB_NS_NULL;
+	dom->name[n] = HUBBUB_DOM_NONE;
+	dom->parent[n] = HUBBUB_DOM_NONE;
+	dom->first_child[n] = HUBBUB_DOM_NONE;
+	dom->last_child[n] = HUBBUB_DOM_NONE;
+	dom->next_sibling[n] = HUBBUB_DOM_NONE;
+	dom->prev_sibling[n] = HUBBUB_DOM_NONE;
+	dom->data[n] = 0;
+	dom->len[n] = 0;
+
+	*node = n;
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Append a node to the end of another's child list
+ *
+ * \param dom     The tree
+ * \param parent  The node to append to
+ * \param child   The node to append, which must have no parent
+ */
+static void dom_link_append(hubbub_dom *dom, hubbub_dom_node parent,
+		hubbub_dom_node child)
+{
+	hubbub_dom_node prev = dom->last_child[parent];
+
+	dom->parent[child] = parent;
+	dom->prev_sibling[child] = prev;
+	dom->next_sibling[child] = HUBBUB_DOM_NONE;
+
+	if (prev == HUBBUB_DOM_NONE)
+		dom->first_child[parent] = child;
+	else
+		dom->next_sibling[prev] = child;
+
+	dom->last_child[parent] = child;
+}
+
+/**
+ * Insert a node into another's child list
+ *
+ * \param dom        The tree
+ * \param parent     The node to insert into
+ * \param child      The node to insert, which must have no parent
+ * \param ref_child  The child of parent to insert before
+ */
+static void dom_link_before(hubbub_dom *dom, hubbub_dom_node parent,
+		hubbub_dom_node child, hubbub_dom_node ref_child)
+{
+	hubbub_dom_node prev = dom->prev_sibling[ref_child];
+
+	dom->parent[child] = parent;
+	dom->prev_sibling[child] = prev;
+	dom->next_sibling[child] = ref_child;
+	dom->prev_sibling[ref_child] = child;
+
+	if (prev == HUBBUB_DOM_NONE)
+		dom->first_child[parent] = child;
+	else
+		dom->next_sibling[prev] = child;
+}
+
+/**
+ * Remove a node from its parent's child list
+ *
+ * \param dom   The tree
+ * \param node  The node to remove, if it has a parent
+ */
+static void dom_unlink(hubbub_dom *dom, hubbub_dom_node node)
+{
+	hubbub_dom_node parent = dom->parent[node];
+	hubbub_dom_node prev = dom->prev_sibling[node];
+	hubbub_dom_node next = dom->next_sibling[node];
+
+	if (parent == HUBBUB_DOM_NONE)
+		return;
+
+	if (prev == HUBBUB_DOM_NONE)
+		dom->first_child[parent] = next;
+	else
+		dom->next_sibling[prev] = next;
+
+	if (next == HUBBUB_DOM_NONE)
+		dom->last_child[parent] = prev;
+	else
+		dom->prev_sibling[next] = prev;
+
+	dom->parent[node] = HUBBUB_DOM_NONE;
+	dom->prev_sibling[node] = HUBBUB_DOM_NONE;
+	dom->next_sibling[node] = HUBBUB_DOM_NONE;
+}
+
+/**
+ * Append a string to the content of a text node
+ *
+ * \param dom   The tree
+ * \param node  The text node
+ * \param data  The string to append
+ * \param len   Length of string, in bytes
+ * \return HUBBUB_OK on success, HUBBUB_NOMEM on memory exhaustion
+ *
+ * If data is in the string buffer, the caller must have ensured that the
+ * buffer will not need to grow: that is, that it has space for the
+ * existing content of the node and the string.
+ */
+static hubbub_error dom_text_append(hubbub_dom *dom, hubbub_dom_node node,
+		const uint8_t *data, size_t len)
+{
+	uint32_t off = dom->data[node];
+	uint32_t old = dom->len[node];
+	hubbub_error error;
+
+	if (len >= HUBBUB_DOM_NONE - old)
+		return HUBBUB_NOMEM;
+
+	if (off + old == dom->strings_len) {
+		/* The content is at the end of the buffer: extend it */
+		error = dom_reserve_strings(dom, len);
+		if (error != HUBBUB_OK)
+			return error;
+	} else {
+		/* Otherwise, move it to the end and extend it there */
+		error = dom_reserve_strings(dom, old + len);
+		if (error != HUBBUB_OK)
+			return error;
+
+		memcpy(dom->strings + dom->strings_len,
+				dom->strings + off, old);
+
+		dom->data[node] = dom->strings_len;
+		dom->strings_len += old;
+	}
+
+	memcpy(dom->strings + dom->strings_len, data, len);
+	dom->strings_len += (uint32_t) len;
+	dom->len[node] += (uint32_t) len;
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Merge the content of one text node into another
+ *
+ * \param dom   The tree
+ * \param node  The text node to extend
+ * \param text  The text node to take content from
+ * \return HUBBUB_OK on success, HUBBUB_NOMEM on memory exhaustion
+ */
+static hubbub_error dom_text_merge(hubbub_dom *dom, hubbub_dom_node node,
+		hubbub_dom_node text)
+{
+	hubbub_error error;
+
+	/* Text created straight after the node's is already in place */
+	if (dom->data[node] + dom->len[node] == dom->data[text] &&
+			dom->len[text] < HUBBUB_DOM_NONE - dom->len[node]) {
+		dom->len[node] += dom->len[text];
+		return HUBBUB_OK;
+	}
+
+	/* Make room first, so the content does not move under us */
+	if (dom->len[text] >= HUBBUB_DOM_NONE - dom->len[node])
+		return HUBBUB_NOMEM;
+
+	error = dom_reserve_strings(dom, dom->len[node] + dom->len[text]);
+	if (error != HUBBUB_OK)
+		return error;
+
+	return dom_text_append(dom, node, dom->strings + dom->data[text],
+			dom->len[text]);
+}
+
+/**
+ * Add attributes to an element
+ *
+ * \param dom           The tree
+ * \param node          The element
+ * \param attributes    Array of attributes to add
+ * \param n_attributes  Number of entries in array
+ * \return HUBBUB_OK on success, HUBBUB_NOMEM on memory exhaustion
+ *
+ * An element's attributes are contiguous. If they are not at the end of
+ * the attribute array, they are copied there first. Clones of an element
+ * share its attributes, which works because the view each has of them
+ * does not change when attributes are added to another.
+ */
+static hubbub_error dom_add_attributes(hubbub_dom *dom, hubbub_dom_node node,
+		const hubbub_attribute *attributes, uint32_t n_attributes)
+{
+	uint32_t first = dom->data[node];
+	uint32_t count = dom->len[node];
+	dom_attribute *temp;
+	hubbub_error error;
+	uint32_t i;
+
+	if (n_attributes == 0)
+		return HUBBUB_OK;
+
+	if (n_attributes >= HUBBUB_DOM_NONE - count)
+		return HUBBUB_NOMEM;
+
+	temp = dom_reserve(dom, dom->attrs, dom->n_attrs,
+			count + n_attributes, &dom->attrs_alloc,
+			sizeof(dom_attribute));
+	if (temp == NULL)
+		return HUBBUB_NOMEM;
+	dom->attrs = temp;
+
+	if (count == 0) {
+		dom->data[node] = dom->n_attrs;
+	} else if (first + count != dom->n_attrs) {
+		memcpy(dom->attrs + dom->n_attrs, dom->attrs + first,
+				count * sizeof(dom_attribute));
+
+		dom->data[node] = dom->n_attrs;
+		dom->n_attrs += count;
+	}
+
+	for (i = 0; i < n_attributes; i++) {
+		dom_attribute *attr = &dom->attrs[dom->n_attrs];
+
+		attr->ns = attributes[i].ns;
+
+		error = dom_intern(dom, &attributes[i].name,
+				attributes[i].atom, &attr->name);
+		if (error != HUBBUB_OK)
+			return error;
+
+		error = dom_store(dom, &attributes[i].value, &attr->value);
+		if (error != HUBBUB_OK)
+			return error;
+
+		dom->n_attrs++;
+		dom->len[node]++;
+	}
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Create a text or comment node
+ *
+ * \param dom   The tree
+ * \param type  Type of node
+ * \param data  Content of node
+ * \param node  Pointer to location to receive node
+ * \return HUBBUB_OK on success, HUBBUB_NOMEM on memory exhaustion
+ */
+static hubbub_error dom_new_character_data(hubbub_dom *dom,
+		hubbub_dom_node_type type, const hubbub_string *data,
+		hubbub_dom_node *node)
+{
+	hubbub_error error;
+	dom_span span;
+
+	error = dom_store(dom, data, &span);
+	if (error != HUBBUB_OK)
+		return error;
+
+	error = dom_new_node(dom, type, node);
+	if (error != HUBBUB_OK)
+		return error;
+
+	dom->data[*node] = span.off;
+	dom->len[*node] = span.len;
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Create a copy of a node, without its children
+ *
+ * \param dom    The tree
+ * \param node   The node to copy
+ * \param clone  Pointer to location to receive copy
+ * \return HUBBUB_OK on success, HUBBUB_NOMEM on memory exhaustion
+ *
+ * The copy shares its content with the original.
+ */
+static hubbub_error dom_clone_one(hubbub_dom *dom, hubbub_dom_node node,
+		hubbub_dom_node *clone)
+{
+	hubbub_error error;
+
+	error = dom_new_node(dom, (hubbub_dom_node_type) dom->type[node],
+			clone);
+	if (error != HUBBUB_OK)
+		return error;
+
+	dom->ns[*clone] = dom->ns[node];
+	dom->name[*clone] = dom->name[node];
+	dom->data[*clone] = dom->data[node];
+	dom->len[*clone] = dom->len[node];
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Create a tree, containing only its document node
+ *
+ * \param alloc  Memory (de)allocation function
+ * \param pw     Pointer to client-specific private data (may be NULL)
+ * \param dom    Pointer to location to receive tree instance
+ * \return HUBBUB_OK on success,
+ *         HUBBUB_BADPARM on bad parameters,
+ *         HUBBUB_NOMEM on memory exhaustion
+ */
+hubbub_error hubbub_dom_create(hubbub_allocator_fn alloc, void *pw,
+		hubbub_dom **dom)
+{
+	hubbub_dom *d;
+	hubbub_dom_node root;
+	size_t i;
+
+	if (alloc == NULL || dom == NULL)
+		return HUBBUB_BADPARM;
+
+	d = alloc(NULL, sizeof(hubbub_dom), pw);
+	if (d == NULL)
+		return HUBBUB_NOMEM;
+
+	memset(d, 0, sizeof(hubbub_dom));
+
+	d->quirks = HUBBUB_QUIRKS_MODE_NONE;
+
+	for (i = 0; i < HUBBUB_ATOM_COUNT; i++)
+		d->known[i] = HUBBUB_DOM_NONE;
+
+	d->handler = tree_handler;
+	d->handler.ctx = d;
+	d->handler_ext = tree_handler_ext;
+
+	d->alloc = alloc;
+	d->pw = pw;
+
+	/* Make sure there is a string buffer, even if it remains empty */
+	if (dom_reserve_strings(d, 1) != HUBBUB_OK ||
+			dom_new_node(d, HUBBUB_DOM_NODE_DOCUMENT,
+					&root) != HUBBUB_OK) {
+		hubbub_dom_destroy(d);
+		return HUBBUB_NOMEM;
+	}
+
+	assert(root == HUBBUB_DOM_ROOT);
+
+	*dom = d;
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Destroy a tree
+ *
+ * \param dom  The tree to destroy
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ */
+hubbub_error hubbub_dom_destroy(hubbub_dom *dom)
+{
+	void *arrays[15];
+	size_t i;
+
+	if (dom == NULL)
+		return HUBBUB_BADPARM;
+
+	arrays[0] = dom->type;
+	arrays[1] = dom->ns;
+	arrays[2] = dom->name;
+	arrays[3] = dom->parent;
+	arrays[4] = dom->first_child;
+	arrays[5] = dom->last_child;
+	arrays[6] = dom->next_sibling;
+	arrays[7] = dom->prev_sibling;
+	arrays[8] = dom->data;
+	arrays[9] = dom->len;
+	arrays[10] = dom->attrs;
+	arrays[11] = dom->doctypes;
+	arrays[12] = dom->strings;
+	arrays[13] = dom->atoms;
+	arrays[14] = dom->atom_slots;
+
+	for (i = 0; i < N_ELEMENTS(arrays); i++) {
+		if (arrays[i] != NULL)
+			dom->alloc(arrays[i], 0, dom->pw);
+	}
+
+	dom->alloc(dom, 0, dom->pw);
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Have a parser build its document in a tree
+ *
+ * \param dom     The tree, which should contain only its document node
+ * \param parser  The parser, which must not have started parsing
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ *
+ * This sets the parser's tree handler and document node. The tree must
+ * remain in existence for as long as the parser does, or until the parser
+ * is reset and attached to another tree.
+ */
+hubbub_error hubbub_dom_attach(hubbub_dom *dom, hubbub_parser *parser)
+{
+	hubbub_parser_optparams params;
+	hubbub_error error;
+
+	if (dom == NULL || parser == NULL)
+		return HUBBUB_BADPARM;
+
+	/* Forget any tree the parser was last attached to first, as it may
+	 * no longer exist */
+	params.tree_handler_ext = NULL;
+	error = hubbub_parser_setopt(parser, HUBBUB_PARSER_TREE_HANDLER_EXT,
+			&params);
+	if (error != HUBBUB_OK)
+		return error;
+
+	params.tree_handler = &dom->handler;
+	error = hubbub_parser_setopt(parser, HUBBUB_PARSER_TREE_HANDLER,
+			&params);
+	if (error != HUBBUB_OK)
+		return error;
+
+	params.tree_handler_ext = &dom->handler_ext;
+	error = hubbub_parser_setopt(parser, HUBBUB_PARSER_TREE_HANDLER_EXT,
+			&params);
+	if (error != HUBBUB_OK)
+		return error;
+
+	params.document_node = node_to_ptr(HUBBUB_DOM_ROOT);
+	return hubbub_parser_setopt(parser, HUBBUB_PARSER_DOCUMENT_NODE,
+			&params);
+}
+
+/**
+ * Have a parser build a fragment in a tree
+ *
+ * \param dom     The tree
+ * \param parser  The parser, which must not have started parsing
+ * \param ns      Namespace of the fragment's context element
+ * \param name    Name of the fragment's context element
+ * \param root    Document or element node to append the fragment to
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ *
+ * As hubbub_dom_attach, but the nodes parsed are appended to root, and no
+ * html, head or body elements are created around them. Scripting must be
+ * enabled, or not, before this is called.
+ */
+hubbub_error hubbub_dom_attach_fragment(hubbub_dom *dom,
+		hubbub_parser *parser, hubbub_ns ns, const hubbub_string *name,
+		hubbub_dom_node root)
+{
+	hubbub_parser_optparams params;
+	hubbub_error error;
+
+	if (dom == NULL || parser == NULL || name == NULL ||
+			root >= dom->n_nodes ||
+			(dom->type[root] != HUBBUB_DOM_NODE_DOCUMENT &&
+			dom->type[root] != HUBBUB_DOM_NODE_ELEMENT))
+		return HUBBUB_BADPARM;
+
+	error = hubbub_dom_attach(dom, parser);
+	if (error != HUBBUB_OK)
+		return error;
+
+	params.fragment.ns = ns;
+	params.fragment.name = *name;
+	params.fragment.root = node_to_ptr(root);
+	return hubbub_parser_setopt(parser, HUBBUB_PARSER_FRAGMENT, &params);
+}
+
+/**
+ * Retrieve the quirks mode of a tree's document
+ *
+ * \param dom  The tree
+ * \return The quirks mode, as set by the parser
+ */
+hubbub_quirks_mode hubbub_dom_quirks_mode(const hubbub_dom *dom)
+{
+	return dom->quirks;
+}
+
+/**
+ * Retrieve the type of a node
+ *
+ * \param dom   The tree
+ * \param node  The node
+ * \return The type of node
+ */
+hubbub_dom_node_type hubbub_dom_type(const hubbub_dom *dom,
+		hubbub_dom_node node)
+{
+	return (hubbub_dom_node_type) dom->type[node];
+}
+
+/**
+ * Retrieve the parent of a node
+ *
+ * \param dom   The tree
+ * \param node  The node
+ * \return The parent, or HUBBUB_DOM_NONE if there is none
+ */
+hubbub_dom_node hubbub_dom_parent(const hubbub_dom *dom,
+		hubbub_dom_node node)
+{
+	return dom->parent[node];
+}
+
+/**
+ * Retrieve the first child of a node
+ *
+ * \param dom   The tree
+ * \param node  The node
+ * \return The first child, or HUBBUB_DOM_NONE if there is none
+ */
+hubbub_dom_node hubbub_dom_first_child(const hubbub_dom *dom,
+		hubbub_dom_node node)
+{
+	return dom->first_child[node];
+}
+
+/**
+ * Retrieve the last child of a node
+ *
+ * \param dom   The tree
+ * \param node  The node
+ * \return The last child, or HUBBUB_DOM_NONE if there is none
+ */
+hubbub_dom_node hubbub_dom_last_child(const hubbub_dom *dom,
+		hubbub_dom_node node)
+{
+	return dom->last_child[node];
+}
+
+/**
+ * Retrieve the next sibling of a node
+ *
+ * \param dom   The tree
+ * \param node  The node
+ * \return The next sibling, or HUBBUB_DOM_NONE if there is none
+ */
+hubbub_dom_node hubbub_dom_next_sibling(const hubbub_dom *dom,
+		hubbub_dom_node node)
+{
+	return dom->next_sibling[node];
+}
+
+/**
+ * Retrieve the previous sibling of a node
+ *
+ * \param dom   The tree
+ * \param node  The node
+ * \return The previous sibling, or HUBBUB_DOM_NONE if there is none
+ */
+hubbub_dom_node hubbub_dom_prev_sibling(const hubbub_dom *dom,
+		hubbub_dom_node node)
+{
+	return dom->prev_sibling[node];
+}
+
+/**
+ * Find the node following another, in document order, within a subtree
+ *
+ * \param dom   The tree
+ * \param node  The node, which must be root or one of its descendants
+ * \param root  The root of the subtree
+ * \return The following node, or HUBBUB_DOM_NONE at the end of the subtree
+ *
+ * Starting from root, this visits every node of the subtree, parents
+ * before their children.
+ */
+hubbub_dom_node hubbub_dom_next(const hubbub_dom *dom,
+		hubbub_dom_node node, hubbub_dom_node root)
+{
+	if (dom->first_child[node] != HUBBUB_DOM_NONE)
+		return dom->first_child[node];
+
+	while (node != root) {
+		if (dom->next_sibling[node] != HUBBUB_DOM_NONE)
+			return dom->next_sibling[node];
+
+		node = dom->parent[node];
+	}
+
+	return HUBBUB_DOM_NONE;
+}
+
+/**
+ * Visit every node in a subtree, in document order
+ *
+ * \param dom    The tree
+ * \param root   The root of the subtree
+ * \param enter  Callback to call before a node's children, or NULL
+ * \param leave  Callback to call after a node's children, or NULL
+ * \param pw     Client's private data for callbacks
+ * \return HUBBUB_OK on success, or the error with which a callback stopped
+ *         the walk
+ *
+ * The tree must not be changed during the walk.
+ */
+hubbub_error hubbub_dom_walk(const hubbub_dom *dom, hubbub_dom_node root,
+		hubbub_dom_walk_cb enter, hubbub_dom_walk_cb leave, void *pw)
+{
+	hubbub_dom_node node = root;
+	hubbub_error error;
+
+	while (true) {
+		if (enter != NULL) {
+			error = enter(dom, node, pw);
+			if (error != HUBBUB_OK)
+				return error;
+		}
+
+		if (dom->first_child[node] != HUBBUB_DOM_NONE) {
+			node = dom->first_child[node];
+			continue;
+		}
+
+		/* Leave this node, and every ancestor it was the last of */
+		while (true) {
+			if (leave != NULL) {
+				error = leave(dom, node, pw);
+				if (error != HUBBUB_OK)
+					return error;
+			}
+
+			if (node == root)
+				return HUBBUB_OK;
+
+			if (dom->next_sibling[node] != HUBBUB_DOM_NONE) {
+				node = dom->next_sibling[node];
+				break;
+			}
+
+			node = dom->parent[node];
+		}
+	}
+}
+
+/**
+ * Retrieve the name of an element
+ *
+ * \param dom   The tree
+ * \param node  The element
+ * \return The name of the element, or HUBBUB_DOM_NONE if node is not one
+ */
+hubbub_dom_atom hubbub_dom_name(const hubbub_dom *dom,
+		hubbub_dom_node node)
+{
+	return dom->name[node];
+}
+
+/**
+ * Retrieve the namespace of an element
+ *
+ * \param dom   The tree
+ * \param node  The element
+ * \return The namespace of the element, or HUBBUB_NS_NULL if node is not one
+ */
+hubbub_ns hubbub_dom_ns(const hubbub_dom *dom, hubbub_dom_node node)
+{
+	return (hubbub_ns) dom->ns[node];
+}
+
+/**
+ * Retrieve the number of attributes of an element
+ *
+ * \param dom   The tree
+ * \param node  The element
+ * \return The number of attributes, or 0 if node is not an element
+ */
+uint32_t hubbub_dom_attribute_count(const hubbub_dom *dom,
+		hubbub_dom_node node)
+{
+	if (dom->type[node] != HUBBUB_DOM_NODE_ELEMENT)
+		return 0;
+
+	return dom->len[node];
+}
+
+/**
+ * Retrieve an attribute of an element
+ *
+ * \param dom        The tree
+ * \param node       The element
+ * \param index      Index of attribute, in order of addition
+ * \param attribute  Pointer to location to receive attribute
+ * \return HUBBUB_OK on success,
+ *         HUBBUB_BADPARM if node is not an element, or index is too large
+ *
+ * The attribute value remains valid until the tree is next changed.
+ */
+hubbub_error hubbub_dom_attribute_get(const hubbub_dom *dom,
+		hubbub_dom_node node, uint32_t index,
+		hubbub_dom_attribute *attribute)
+{
+	const dom_attribute *attr;
+
+	if (index >= hubbub_dom_attribute_count(dom, node) ||
+			attribute == NULL)
+		return HUBBUB_BADPARM;
+
+	attr = &dom->attrs[dom->data[node] + index];
+
+	attribute->ns = (hubbub_ns) attr->ns;
+	attribute->name = attr->name;
+	attribute->value.ptr = dom->strings + attr->value.off;
+	attribute->value.len = attr->value.len;
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Find the value of an element's attribute
+ *
+ * \param dom    The tree
+ * \param node   The element
+ * \param name   Name of attribute, in any namespace
+ * \param value  Pointer to location to receive value, or NULL
+ * \return true if the element has the attribute, false otherwise
+ *
+ * The value remains valid until the tree is next changed.
+ */
+bool hubbub_dom_attribute_find(const hubbub_dom *dom, hubbub_dom_node node,
+		hubbub_dom_atom name, hubbub_string *value)
+{
+	uint32_t count = hubbub_dom_attribute_count(dom, node);
+	const dom_attribute *attr;
+
+	for (attr = &dom->attrs[dom->data[node]]; count > 0; attr++, count--) {
+		if (attr->name == name) {
+			if (value != NULL) {
+				value->ptr = dom->strings + attr->value.off;
+				value->len = attr->value.len;
+			}
+
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/**
+ * Retrieve the content of a text or comment node
+ *
+ * \param dom   The tree
+ * \param node  The node
+ * \return The content of the node, which is empty for other types of node
+ *
+ * The content remains valid until the tree is next changed.
+ */
+hubbub_string hubbub_dom_data(const hubbub_dom *dom, hubbub_dom_node node)
+{
+	hubbub_string data = { NULL, 0 };
+
+	if (dom->type[node] == HUBBUB_DOM_NODE_TEXT ||
+			dom->type[node] == HUBBUB_DOM_NODE_COMMENT) {
+		data.ptr = dom->strings + dom->data[node];
+		data.len = dom->len[node];
+	}
+
+	return data;
+}
+
+/**
+ * Retrieve the details of a doctype node
+ *
+ * \param dom      The tree
+ * \param node     The doctype node
+ * \param doctype  Pointer to location to receive details
+ * \return HUBBUB_OK on success, HUBBUB_BADPARM if node is not a doctype
+ *
+ * The details remain valid until the tree is next changed.
+ */
+hubbub_error hubbub_dom_doctype(const hubbub_dom *dom, hubbub_dom_node node,
+		hubbub_doctype *doctype)
+{
+	const dom_doctype *d;
+
+	if (dom->type[node] != HUBBUB_DOM_NODE_DOCTYPE || doctype == NULL)
+		return HUBBUB_BADPARM;
+
+	d = &dom->doctypes[dom->data[node]];
+
+	doctype->name.ptr = dom->strings + d->name.off;
+	doctype->name.len = d->name.len;
+	doctype->public_missing = d->public_missing;
+	doctype->public_id.ptr = dom->strings + d->public_id.off;
+	doctype->public_id.len = d->public_id.len;
+	doctype->system_missing = d->system_missing;
+	doctype->system_id.ptr = dom->strings + d->system_id.off;
+	doctype->system_id.len = d->system_id.len;
+	doctype->force_quirks = d->force_quirks;
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Retrieve the text of an atom
+ *
+ * \param dom   The tree
+ * \param atom  The atom
+ * \return The text of the atom, which remains valid until the tree is next
+ *         changed
+ */
+hubbub_string hubbub_dom_atom_string(const hubbub_dom *dom,
+		hubbub_dom_atom atom)
+{
+	hubbub_string text = { NULL, 0 };
+
+	if (atom < dom->n_atoms) {
+		text.ptr = dom->strings + dom->atoms[atom].text.off;
+		text.len = dom->atoms[atom].text.len;
+	}
+
+	return text;
+}
+
+/**
+ * Find the atom for a name, if it is in use
+ *
+ * \param dom   The tree
+ * \param name  The name, which is case sensitive
+ * \param len   Length of name, in bytes
+ * \return The atom for the name, or HUBBUB_DOM_NONE if no element or
+ *         attribute in the tree has ever had this name
+ */
+hubbub_dom_atom hubbub_dom_atom_find(const hubbub_dom *dom,
+		const uint8_t *name, size_t len)
+{
+	uint32_t slot;
+
+	if (dom->atom_slots_size == 0)
+		return HUBBUB_DOM_NONE;
+
+	slot = dom_atom_slot(dom, name, len, dom_hash(name, len));
+	if (dom->atom_slots[slot] == 0)
+		return HUBBUB_DOM_NONE;
+
+	return dom->atom_slots[slot] - 1;
+}
+
+/*** Tree handler ***/
+
+hubbub_error create_comment(void *ctx, const hubbub_string *data,
+		void **result)
+{
+	hubbub_dom *dom = ctx;
+	hubbub_dom_node node;
+	hubbub_error error;
+
+	error = dom_new_character_data(dom, HUBBUB_DOM_NODE_COMMENT, data,
+			&node);
+	if (error != HUBBUB_OK)
+		return error;
+
+	*result = node_to_ptr(node);
+
+	return HUBBUB_OK;
+}
+
+hubbub_error create_doctype(void *ctx, const hubbub_doctype *doctype,
+		void **result)
+{
+	hubbub_dom *dom = ctx;
+	dom_doctype *temp;
+	dom_doctype *d;
+	hubbub_dom_node node;
+	hubbub_error error;
+
+	temp = dom_reserve(dom, dom->doctypes, dom->n_doctypes, 1,
+			&dom->doctypes_alloc, sizeof(dom_doctype));
+	if (temp == NULL)
+		return HUBBUB_NOMEM;
+	dom->doctypes = temp;
+
+	d = &dom->doctypes[dom->n_doctypes];
+
+	error = dom_store(dom, &doctype->name, &d->name);
+	if (error == HUBBUB_OK)
+		error = dom_store(dom, &doctype->public_id, &d->public_id);
+	if (error == HUBBUB_OK)
+		error = dom_store(dom, &doctype->system_id, &d->system_id);
+	if (error != HUBBUB_OK)
+		return error;
+
+	d->public_missing = doctype->public_missing;
+	d->system_missing = doctype->system_missing;
+	d->force_quirks = doctype->force_quirks;
+
+	error = dom_new_node(dom, HUBBUB_DOM_NODE_DOCTYPE, &node);
+	if (error != HUBBUB_OK)
+		return error;
+
+	dom->data[node] = dom->n_doctypes++;
+
+	*result = node_to_ptr(node);
+
+	return HUBBUB_OK;
+}
+
+hubbub_error create_element(void *ctx, const hubbub_tag *tag, void **result)
+{
+	hubbub_dom *dom = ctx;
+	hubbub_dom_atom name;
+	hubbub_dom_node node;
+	hubbub_error error;
+
+	error = dom_intern(dom, &tag->name, tag->atom, &name);
+	if (error != HUBBUB_OK)
+		return error;
+
+	error = dom_new_node(dom, HUBBUB_DOM_NODE_ELEMENT, &node);
+	if (error != HUBBUB_OK)
+		return error;
+
+	dom->ns[node] = (uint8_t) tag->ns;
+	dom->name[node] = name;
+
+	error = dom_add_attributes(dom, node, tag->attributes,
+			tag->n_attributes);
+	if (error != HUBBUB_OK)
+		return error;
+
+	*result = node_to_ptr(node);
+
+	return HUBBUB_OK;
+}
+
+hubbub_error create_text(void *ctx, const hubbub_string *data, void **result)
+{
+	hubbub_dom *dom = ctx;
+	hubbub_dom_node node;
+	hubbub_error error;
+
+	error = dom_new_character_data(dom, HUBBUB_DOM_NODE_TEXT, data, &node);
+	if (error != HUBBUB_OK)
+		return error;
+
+	*result = node_to_ptr(node);
+
+	return HUBBUB_OK;
+}
+
+hubbub_error ref_node(void *ctx, void *node)
+{
+	UNUSED(ctx);
+	UNUSED(node);
+
+	return HUBBUB_OK;
+}
+
+hubbub_error unref_node(void *ctx, void *node)
+{
+	UNUSED(ctx);
+	UNUSED(node);
+
+	return HUBBUB_OK;
+}
+
+hubbub_error append_child(void *ctx, void *parent, void *child,
+		void **result)
+{
+	hubbub_dom *dom = ctx;
+	hubbub_dom_node p = ptr_to_node(parent);
+	hubbub_dom_node c = ptr_to_node(child);
+	hubbub_dom_node last = dom->last_child[p];
+
+	dom_unlink(dom, c);
+
+	if (dom->type[c] == HUBBUB_DOM_NODE_TEXT && last != HUBBUB_DOM_NONE &&
+			dom->type[last] == HUBBUB_DOM_NODE_TEXT) {
+		*result = node_to_ptr(last);
+		return dom_text_merge(dom, last, c);
+	}
+
+	dom_link_append(dom, p, c);
+
+	*result = child;
+
+	return HUBBUB_OK;
+}
+
+hubbub_error insert_before(void *ctx, void *parent, void *child,
+		void *ref_child, void **result)
+{
+	hubbub_dom *dom = ctx;
+	hubbub_dom_node p = ptr_to_node(parent);
+	hubbub_dom_node c = ptr_to_node(child);
+	hubbub_dom_node ref = ptr_to_node(ref_child);
+	hubbub_dom_node prev;
+
+	dom_unlink(dom, c);
+
+	prev = dom->prev_sibling[ref];
+
+	if (dom->type[c] == HUBBUB_DOM_NODE_TEXT && prev != HUBBUB_DOM_NONE &&
+			dom->type[prev] == HUBBUB_DOM_NODE_TEXT) {
+		*result = node_to_ptr(prev);
+		return dom_text_merge(dom, prev, c);
+	}
+
+	dom_link_before(dom, p, c, ref);
+
+	*result = child;
+
+	return HUBBUB_OK;
+}
+
+hubbub_error remove_child(void *ctx, void *parent, void *child,
+		void **result)
+{
+	hubbub_dom *dom = ctx;
+
+	UNUSED(parent);
+
+	dom_unlink(dom, ptr_to_node(child));
+
+	*result = child;
+
+	return HUBBUB_OK;
+}
+
+hubbub_error clone_node(void *ctx, void *node, bool deep, void **result)
+{
+	hubbub_dom *dom = ctx;
+	hubbub_dom_node root = ptr_to_node(node);
+	hubbub_dom_node n = root;
+	hubbub_dom_node clone, copy;
+	hubbub_error error;
+
+	error = dom_clone_one(dom, root, &clone);
+	if (error != HUBBUB_OK)
+		return error;
+
+	*result = node_to_ptr(clone);
+
+	if (deep == false)
+		return HUBBUB_OK;
+
+	/* Walk the subtree, keeping copy as the copy of n */
+	copy = clone;
+
+	while (true) {
+		hubbub_dom_node parent;
+
+		if (dom->first_child[n] != HUBBUB_DOM_NONE) {
+			n = dom->first_child[n];
+			parent = copy;
+		} else {
+			while (n != root && dom->next_sibling[n] ==
+					HUBBUB_DOM_NONE) {
+				n = dom->parent[n];
+				copy = dom->parent[copy];
+			}
+
+			if (n == root)
+				break;
+
+			n = dom->next_sibling[n];
+			parent = dom->parent[copy];
+		}
+
+		error = dom_clone_one(dom, n, &copy);
+		if (error != HUBBUB_OK)
+			return error;
+
+		dom_link_append(dom, parent, copy);
+	}
+
+	return HUBBUB_OK;
+}
+
+hubbub_error reparent_children(void *ctx, void *node, void *new_parent)
+{
+	hubbub_dom *dom = ctx;
+	hubbub_dom_node from = ptr_to_node(node);
+	hubbub_dom_node to = ptr_to_node(new_parent);
+	hubbub_dom_node first = dom->first_child[from];
+	hubbub_dom_node child;
+
+	if (first == HUBBUB_DOM_NONE)
+		return HUBBUB_OK;
+
+	for (child = first; child != HUBBUB_DOM_NONE;
+			child = dom->next_sibling[child])
+		dom->parent[child] = to;
+
+	if (dom->last_child[to] == HUBBUB_DOM_NONE) {
+		dom->first_child[to] = first;
+	} else {
+		dom->next_sibling[dom->last_child[to]] = first;
+		dom->prev_sibling[first] = dom->last_child[to];
+	}
+
+	dom->last_child[to] = dom->last_child[from];
+
+	dom->first_child[from] = HUBBUB_DOM_NONE;
+	dom->last_child[from] = HUBBUB_DOM_NONE;
+
+	return HUBBUB_OK;
+}
+
+hubbub_error get_parent(void *ctx, void *node, bool element_only,
+		void **result)
+{
+	hubbub_dom *dom = ctx;
+	hubbub_dom_node parent = dom->parent[ptr_to_node(node)];
+
+	if (parent == HUBBUB_DOM_NONE || (element_only &&
+			dom->type[parent] != HUBBUB_DOM_NODE_ELEMENT))
+		*result = NULL;
+	else
+		*result = node_to_ptr(parent);
+
+	return HUBBUB_OK;
+}
+
+hubbub_error has_children(void *ctx, void *node, bool *result)
+{
+	hubbub_dom *dom = ctx;
+
+	*result = dom->first_child[ptr_to_node(node)] != HUBBUB_DOM_NONE;
+
+	return HUBBUB_OK;
+}
+
+hubbub_error form_associate(void *ctx, void *form, void *node)
+{
+	UNUSED(ctx);
+	UNUSED(form);
+	UNUSED(node);
+
+	return HUBBUB_OK;
+}
+
+hubbub_error add_attributes(void *ctx, void *node,
+		const hubbub_attribute *attributes, uint32_t n_attributes)
+{
+	return dom_add_attributes(ctx, ptr_to_node(node), attributes,
+			n_attributes);
+}
+
+hubbub_error set_quirks_mode(void *ctx, hubbub_quirks_mode mode)
+{
+	hubbub_dom *dom = ctx;
+
+	dom->quirks = mode;
+
+	return HUBBUB_OK;
+}
+
+hubbub_error complete_script(void *ctx, void *script)
+{
+	UNUSED(ctx);
+	UNUSED(script);
+
+	return HUBBUB_OK;
+}
+
+hubbub_error complete_style(void *ctx, void *style)
+{
+	UNUSED(ctx);
+	UNUSED(style);
+
+	return HUBBUB_OK;
+}
+
+hubbub_error create_and_append_element(void *ctx, void *parent,
+		const hubbub_tag *tag, void **result)
+{
+	hubbub_error error;
+
+	error = create_element(ctx, tag, result);
+	if (error != HUBBUB_OK)
+		return error;
+
+	dom_link_append(ctx, ptr_to_node(parent), ptr_to_node(*result));
+
+	return HUBBUB_OK;
+}
+
+hubbub_error append_text(void *ctx, void *parent, const hubbub_string *data)
+{
+	hubbub_dom *dom = ctx;
+	hubbub_dom_node p = ptr_to_node(parent);
+	hubbub_dom_node last = dom->last_child[p];
+	hubbub_dom_node node;
+	hubbub_error error;
+
+	/* Text for the end of an existing text node usually is in place */
+	if (last != HUBBUB_DOM_NONE &&
+			dom->type[last] == HUBBUB_DOM_NODE_TEXT)
+		return dom_text_append(dom, last, data->ptr, data->len);
+
+	error = dom_new_character_data(dom, HUBBUB_DOM_NODE_TEXT, data, &node);
+	if (error != HUBBUB_OK)
+		return error;
+
+	dom_link_append(dom, p, node);
+
+	return HUBBUB_OK;
+}
+
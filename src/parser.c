@@ -11,12 +11,19 @@
 #include <parserutils/charset/mibenum.h>
 #include <parserutils/input/inputstream.h>
 
+#include <hubbub/arena.h>
 #include <hubbub/parser.h>
+#include <hubbub/preload.h>
+#include <hubbub/stats.h>
 
 #include "charset/detect.h"
+#include "tokeniser/preload.h"
 #include "tokeniser/tokeniser.h"
 #include "treebuilder/treebuilder.h"
 #include "utils/parserutilserror.h"
+#include "utils/scan.h"
+#include "utils/stats.h"
+#include "utils/utils.h"
 
 /**
  * Hubbub parser object
@@ -28,8 +35,216 @@ struct hubbub_parser {
 
 	hubbub_allocator_fn alloc;	/**< Memory (de)allocation function */
 	void *pw;			/**< Client data */
+
+	bool fix_enc;			/**< Whether to fix up encodings */
+	bool had_data;			/**< Whether data has been appended to
+					 * the input stream */
+	bool had_buffer;		/**< Whether a whole document has
+					 * been given */
+	bool pass_through;		/**< Whether input is UTF-8, passed
+					 * straight to the tokeniser */
+	bool ascii;			/**< Whether all data given so far
+					 * is ASCII */
+	uint16_t switch_to;		/**< Charset to switch to in place
+					 * once tokenising stops, or 0 */
+	size_t bom;			/**< Length of the BOM stripped from
+					 * a borrowed document */
+
+	hubbub_arena *arena;		/**< Parser's own arena, or NULL */
+
+#ifdef HUBBUB_WRAP_TREE_HANDLER
+	hubbub_stats stats;		/**< Counters of work done */
+#endif
+};
+
+/**
+ * Checkpoint of a parse, from which other documents may be parsed
+ */
+struct hubbub_checkpoint {
+	hubbub_tokeniser_checkpoint tok;	/**< Tokeniser state */
+	hubbub_treebuilder_checkpoint *tb;	/**< Treebuilder state */
+	uint16_t mibenum;			/**< Charset of document */
+	size_t bom;				/**< Length of BOM stripped
+						 * from document */
 };
 
+/**
+ * Create the input stream for a document
+ *
+ * \param enc      Source document encoding, or NULL to autodetect
+ * \param fix_enc  Permit fixing up of encoding if it's frequently misused
+ * \param alloc    Memory (de)allocation function
+ * \param pw       Pointer to client-specific private data (may be NULL)
+ * \param stream   Pointer to location to receive input stream
+ * \return PARSERUTILS_OK on success, appropriate error otherwise
+ */
+static parserutils_error create_stream(const char *enc, bool fix_enc,
+		hubbub_allocator_fn alloc, void *pw,
+		parserutils_inputstream **stream)
+{
+	/* If we have an encoding and we're permitted to fix up likely broken
+	 * ones, then attempt to do so. */
+	if (enc != NULL && fix_enc == true) {
+		uint16_t mibenum = parserutils_charset_mibenum_from_name(enc,
+				strlen(enc));
+
+		if (mibenum != 0) {
+			hubbub_charset_fix_charset(&mibenum);
+
+			enc = parserutils_charset_mibenum_to_name(mibenum);
+		}
+	}
+
+	return parserutils_inputstream_create(enc,
+		enc != NULL ? HUBBUB_CHARSET_CONFIDENT : HUBBUB_CHARSET_UNKNOWN,
+		hubbub_charset_extract, alloc, pw, stream);
+}
+
+/**
+ * Find the charset of an input stream, if it is known for certain
+ *
+ * \param stream  Input stream to query
+ * \return MIB enum of charset given by the client, or 0 if it was not
+ */
+static uint16_t confident_charset(parserutils_inputstream *stream)
+{
+	const char *name;
+	uint32_t source;
+
+	name = parserutils_inputstream_read_charset(stream, &source);
+	if (name == NULL || source != HUBBUB_CHARSET_CONFIDENT)
+		return 0;
+
+	return parserutils_charset_mibenum_from_name(name, strlen(name));
+}
+
+/**
+ * Determine whether input in a charset can bypass the input stream
+ *
+ * \param mibenum  MIB enum of charset
+ * \return true if the charset is UTF-8, which needs no conversion
+ */
+static bool is_utf8(uint16_t mibenum)
+{
+	return mibenum != 0 && mibenum ==
+			parserutils_charset_mibenum_from_name("UTF-8",
+			SLEN("UTF-8"));
+}
+
+/**
+ * Handle a charset found in a meta element, by switching to it in place
+ *
+ * \param charset  Name of the charset
+ * \param pw       The parser
+ * \return true if the switch can be made in place, false if the client
+ *         must start again
+ *
+ * Where everything given to the parser so far is ASCII, and both the old
+ * and new charsets are ASCII-compatible, it all decodes identically either
+ * way, so the input stream may be replaced without restarting the parse.
+ * This is common, as the head of a document tends to be ASCII. The switch
+ * is made once the tokeniser stops, as until then it may be reading the
+ * input stream; no more data is given to the parser in the meantime.
+ */
+static bool meta_charset(const char *charset, void *pw)
+{
+	hubbub_parser *parser = pw;
+	uint16_t current, mibenum;
+	const char *name;
+	uint32_t source;
+
+	/* A charset which was given is left to the client, as ever */
+	name = parserutils_inputstream_read_charset(parser->stream, &source);
+	if (name == NULL || source == HUBBUB_CHARSET_CONFIDENT ||
+			parser->switch_to != 0)
+		return false;
+
+	current = parserutils_charset_mibenum_from_name(name, strlen(name));
+	mibenum = parserutils_charset_mibenum_from_name(charset,
+			strlen(charset));
+	if (mibenum == 0)
+		return false;
+
+	if (mibenum != current && (parser->ascii == false ||
+			hubbub_charset_ascii_compatible(current) == false ||
+			hubbub_charset_ascii_compatible(mibenum) == false))
+		return false;
+
+	parser->switch_to = mibenum;
+
+	return true;
+}
+
+/**
+ * Make any switch of charset found to be needed while tokenising
+ *
+ * \param parser  Parser instance to use
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ */
+static hubbub_error switch_charset(hubbub_parser *parser)
+{
+	parserutils_inputstream *stream;
+	parserutils_error perror;
+	hubbub_error error;
+	bool utf8;
+
+	if (parser->switch_to == 0)
+		return HUBBUB_OK;
+
+	utf8 = is_utf8(parser->switch_to);
+
+	/* The charset is now certain. Where it is UTF-8, the new stream
+	 * serves only to say so, as the rest of the input is passed
+	 * through instead. */
+	perror = create_stream(
+			parserutils_charset_mibenum_to_name(parser->switch_to),
+			false, parser->alloc, parser->pw, &stream);
+	if (perror != PARSERUTILS_OK)
+		return hubbub_error_from_parserutils_error(perror);
+
+	error = hubbub_tokeniser_switch_input(parser->tok,
+			utf8 ? NULL : stream);
+	if (error != HUBBUB_OK) {
+		parserutils_inputstream_destroy(stream);
+		return error;
+	}
+
+	parserutils_inputstream_destroy(parser->stream);
+	parser->stream = stream;
+	parser->pass_through = utf8;
+	parser->switch_to = 0;
+
+	HUBBUB_STATS_ADD(&parser->stats.counts, encoding_restarts, 1);
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Free a parser, and its arena if it has one
+ *
+ * \param parser  Parser instance to free
+ */
+static void free_parser(hubbub_parser *parser)
+{
+	hubbub_allocator_fn alloc = parser->alloc;
+	void *pw = parser->pw;
+
+#ifdef HUBBUB_WRAP_TREE_HANDLER
+	/* The parser itself was not allocated with the counting allocator */
+	alloc = parser->stats.alloc;
+	pw = parser->stats.pw;
+
+	hubbub_stats_fini(&parser->stats);
+#endif
+
+	if (parser->arena != NULL) {
+		/* The parser itself lives in the arena */
+		hubbub_arena_destroy(parser->arena);
+	} else {
+		alloc(parser, 0, pw);
+	}
+}
+
 /**
  * Create a hubbub parser
  *
@@ -46,6 +261,7 @@ struct hubbub_parser {
 hubbub_error hubbub_parser_create(const char *enc, bool fix_enc,
 		hubbub_allocator_fn alloc, void *pw, hubbub_parser **parser)
 {
+	hubbub_treebuilder_optparams params;
 	parserutils_error perror;
 	hubbub_error error;
 	hubbub_parser *p;
@@ -57,31 +273,37 @@ hubbub_error hubbub_parser_create(const char *enc, bool fix_enc,
 	if (p == NULL)
 		return HUBBUB_NOMEM;
 
-	/* If we have an encoding and we're permitted to fix up likely broken
-	 * ones, then attempt to do so. */
-	if (enc != NULL && fix_enc == true) {
-		uint16_t mibenum = parserutils_charset_mibenum_from_name(enc,
-				strlen(enc));
+#ifdef HUBBUB_WRAP_TREE_HANDLER
+	if (hubbub_stats_init(&p->stats, alloc, pw) == false) {
+		alloc(p, 0, pw);
+		return HUBBUB_NOMEM;
+	}
+#endif
 
-		if (mibenum != 0) {
-			hubbub_charset_fix_charset(&mibenum);
+#ifdef HUBBUB_WITH_STATS
+	/* Everything else is allocated through the counting allocator */
+	p->stats.counts.alloc_calls = 1;
+	p->stats.allocated = sizeof(hubbub_parser);
+	p->stats.counts.peak_alloc = sizeof(hubbub_parser);
 
-			enc = parserutils_charset_mibenum_to_name(mibenum);
-		}
-	}
+	alloc = hubbub_stats_alloc;
+	pw = &p->stats;
+#endif
 
-	perror = parserutils_inputstream_create(enc,
-		enc != NULL ? HUBBUB_CHARSET_CONFIDENT : HUBBUB_CHARSET_UNKNOWN,
-		hubbub_charset_extract, alloc, pw, &p->stream);
+	p->alloc = alloc;
+	p->pw = pw;
+	p->arena = NULL;
+
+	perror = create_stream(enc, fix_enc, alloc, pw, &p->stream);
 	if (perror != PARSERUTILS_OK) {
-		alloc(p, 0, pw);
+		free_parser(p);
 		return hubbub_error_from_parserutils_error(perror);
 	}
 
 	error = hubbub_tokeniser_create(p->stream, alloc, pw, &p->tok);
 	if (error != HUBBUB_OK) {
 		parserutils_inputstream_destroy(p->stream);
-		alloc(p, 0, pw);
+		free_parser(p);
 		return error;
 	}
 
@@ -89,18 +311,83 @@ hubbub_error hubbub_parser_create(const char *enc, bool fix_enc,
 	if (error != HUBBUB_OK) {
 		hubbub_tokeniser_destroy(p->tok);
 		parserutils_inputstream_destroy(p->stream);
-		alloc(p, 0, pw);
+		free_parser(p);
 		return error;
 	}
 
-	p->alloc = alloc;
-	p->pw = pw;
+	p->fix_enc = fix_enc;
+	p->had_data = false;
+	p->had_buffer = false;
+	p->pass_through = is_utf8(confident_charset(p->stream));
+	p->ascii = true;
+	p->switch_to = 0;
+	p->bom = 0;
+
+	params.charset_handler.handler = meta_charset;
+	params.charset_handler.pw = p;
+	hubbub_treebuilder_setopt(p->tb, HUBBUB_TREEBUILDER_CHARSET_HANDLER,
+			&params);
+
+#ifdef HUBBUB_WITH_STATS
+	{
+		hubbub_tokeniser_optparams tparams;
+
+		tparams.stats = &p->stats.counts;
+		hubbub_tokeniser_setopt(p->tok, HUBBUB_TOKENISER_STATS,
+				&tparams);
+
+		params.stats = &p->stats.counts;
+		hubbub_treebuilder_setopt(p->tb, HUBBUB_TREEBUILDER_STATS,
+				&params);
+	}
+#endif
 
 	*parser = p;
 
 	return HUBBUB_OK;
 }
 
+/**
+ * Create a hubbub parser whose allocations all come from its own arena
+ *
+ * \param enc      Source document encoding, or NULL to autodetect
+ * \param fix_enc  Permit fixing up of encoding if it's frequently misused
+ * \param alloc    Memory (de)allocation function backing the arena
+ * \param pw       Pointer to client-specific private data (may be NULL)
+ * \param parser   Pointer to location to receive parser instance
+ * \return HUBBUB_OK on success,
+ *         HUBBUB_BADPARM on bad parameters,
+ *         HUBBUB_NOMEM on memory exhaustion,
+ *         HUBBUB_BADENCODING if ::enc is unsupported
+ *
+ * The arena is released in one go when the parser is destroyed. It is
+ * available to the client through hubbub_parser_get_arena().
+ */
+hubbub_error hubbub_parser_create_arena(const char *enc, bool fix_enc,
+		hubbub_allocator_fn alloc, void *pw, hubbub_parser **parser)
+{
+	hubbub_arena *arena;
+	hubbub_error error;
+
+	if (alloc == NULL || parser == NULL)
+		return HUBBUB_BADPARM;
+
+	error = hubbub_arena_create(alloc, pw, &arena);
+	if (error != HUBBUB_OK)
+		return error;
+
+	error = hubbub_parser_create(enc, fix_enc, hubbub_arena_alloc, arena,
+			parser);
+	if (error != HUBBUB_OK) {
+		hubbub_arena_destroy(arena);
+		return error;
+	}
+
+	(*parser)->arena = arena;
+
+	return HUBBUB_OK;
+}
+
 /**
  * Destroy a hubbub parser
  *
@@ -118,11 +405,82 @@ hubbub_error hubbub_parser_destroy(hubbub_parser *parser)
 
 	parserutils_inputstream_destroy(parser->stream);
 
-	parser->alloc(parser, 0, parser->pw);
+	free_parser(parser);
 
 	return HUBBUB_OK;
 }
 
+/**
+ * Return a hubbub parser to its initial state, to parse another document
+ *
+ * \param parser  Parser instance to reset
+ * \param enc     Source document encoding, or NULL to autodetect
+ * \return HUBBUB_OK on success,
+ *         HUBBUB_BADPARM on bad parameters,
+ *         HUBBUB_NOMEM on memory exhaustion,
+ *         HUBBUB_BADENCODING if ::enc is unsupported
+ *
+ * Options and handlers are kept, as is memory the tokeniser and treebuilder
+ * have allocated, so a parser may be reused for many documents. The
+ * treebuilder releases the nodes of the last document, so a new document
+ * node must be supplied before parsing again. On failure, the parser is
+ * left as it was.
+ */
+hubbub_error hubbub_parser_reset(hubbub_parser *parser, const char *enc)
+{
+	parserutils_inputstream *stream;
+	parserutils_error perror;
+	hubbub_error error;
+
+	if (parser == NULL)
+		return HUBBUB_BADPARM;
+
+	/* The input stream has no means of being reset, so is replaced */
+	perror = create_stream(enc, parser->fix_enc, parser->alloc,
+			parser->pw, &stream);
+	if (perror != PARSERUTILS_OK)
+		return hubbub_error_from_parserutils_error(perror);
+
+	error = hubbub_tokeniser_reset(parser->tok, stream);
+	if (error != HUBBUB_OK) {
+		parserutils_inputstream_destroy(stream);
+		return error;
+	}
+
+	parserutils_inputstream_destroy(parser->stream);
+	parser->stream = stream;
+
+	parser->had_data = false;
+	parser->had_buffer = false;
+	parser->pass_through = is_utf8(confident_charset(stream));
+	parser->ascii = true;
+	parser->switch_to = 0;
+	parser->bom = 0;
+
+	if (parser->tb != NULL)
+		return hubbub_treebuilder_reset(parser->tb);
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Retrieve the arena owned by a parser
+ *
+ * \param parser  Parser instance to query
+ * \return The parser's arena, or NULL if it has none
+ *
+ * Clients may allocate from the arena, by passing it to hubbub_arena_alloc()
+ * as client data. Such allocations are released when the parser is
+ * destroyed.
+ */
+hubbub_arena *hubbub_parser_get_arena(hubbub_parser *parser)
+{
+	if (parser == NULL)
+		return NULL;
+
+	return parser->arena;
+}
+
 /**
  * Configure a hubbub parser
  *
@@ -153,6 +511,30 @@ hubbub_error hubbub_parser_setopt(hubbub_parser *parser,
 				(hubbub_tokeniser_optparams *) params);
 		break;
 
+	case HUBBUB_PARSER_TOKEN_BATCH_HANDLER:
+		if (parser->tb != NULL) {
+			/* As for the token handler, the client replaces
+			 * the default treebuilder */
+			hubbub_treebuilder_destroy(parser->tb);
+			parser->tb = NULL;
+		}
+		result = hubbub_tokeniser_setopt(parser->tok,
+				HUBBUB_TOKENISER_TOKEN_BATCH_HANDLER,
+				(hubbub_tokeniser_optparams *) params);
+		break;
+
+	case HUBBUB_PARSER_COMPACT_TOKEN_HANDLER:
+		if (parser->tb != NULL) {
+			/* As for the token handler, the client replaces
+			 * the default treebuilder */
+			hubbub_treebuilder_destroy(parser->tb);
+			parser->tb = NULL;
+		}
+		result = hubbub_tokeniser_setopt(parser->tok,
+				HUBBUB_TOKENISER_COMPACT_TOKEN_HANDLER,
+				(hubbub_tokeniser_optparams *) params);
+		break;
+
 	case HUBBUB_PARSER_ERROR_HANDLER:
 		/* The error handler does not cascade, so tell both the
 		 * treebuilder (if extant) and the tokeniser. */
@@ -175,16 +557,96 @@ hubbub_error hubbub_parser_setopt(hubbub_parser *parser,
 		break;
 
 	case HUBBUB_PARSER_PAUSE:
+		/* The client may have changed the tree while paused */
+		if (params->pause_parse == false && parser->tb != NULL)
+			hubbub_treebuilder_forget_parents(parser->tb);
+
 		result = hubbub_tokeniser_setopt(parser->tok,
 				HUBBUB_TOKENISER_PAUSE,
 				(hubbub_tokeniser_optparams *) params);
 		break;
 
+	case HUBBUB_PARSER_DROP_COMMENTS:
+		result = hubbub_tokeniser_setopt(parser->tok,
+				HUBBUB_TOKENISER_DROP_COMMENTS,
+				(hubbub_tokeniser_optparams *) params);
+		break;
+
+	case HUBBUB_PARSER_TOKEN_LIMIT:
+		result = hubbub_tokeniser_setopt(parser->tok,
+				HUBBUB_TOKENISER_TOKEN_LIMIT,
+				(hubbub_tokeniser_optparams *) params);
+		break;
+
+	case HUBBUB_PARSER_THREADS:
+		/* An arena may only be used by one thread at a time */
+		if (parser->arena != NULL && params->threads > 1) {
+			result = HUBBUB_BADPARM;
+		} else {
+			result = hubbub_tokeniser_setopt(parser->tok,
+					HUBBUB_TOKENISER_THREADS,
+					(hubbub_tokeniser_optparams *) params);
+		}
+		break;
+
+	case HUBBUB_PARSER_BUDGET:
+		result = hubbub_tokeniser_setopt(parser->tok,
+				HUBBUB_TOKENISER_BUDGET,
+				(hubbub_tokeniser_optparams *) params);
+		break;
+
+	case HUBBUB_PARSER_PIPELINE:
+		if (parser->arena != NULL && params->pipeline) {
+			result = HUBBUB_BADPARM;
+		} else {
+			result = hubbub_tokeniser_setopt(parser->tok,
+					HUBBUB_TOKENISER_PIPELINE,
+					(hubbub_tokeniser_optparams *) params);
+		}
+		break;
+
+	case HUBBUB_PARSER_TRACK_POSITION:
+		result = hubbub_tokeniser_setopt(parser->tok,
+				HUBBUB_TOKENISER_TRACK_POSITION,
+				(hubbub_tokeniser_optparams *) params);
+		break;
+
 	case HUBBUB_PARSER_TREE_HANDLER:
 		if (parser->tb != NULL) {
+#ifdef HUBBUB_WRAP_TREE_HANDLER
+			/* Count, or trace, each call the treebuilder makes */
+			hubbub_treebuilder_optparams tparams;
+
+			tparams.tree_handler = hubbub_stats_tree_handler(
+					&parser->stats, params->tree_handler);
+			result = hubbub_treebuilder_setopt(parser->tb,
+					HUBBUB_TREEBUILDER_TREE_HANDLER,
+					&tparams);
+#else
 			result = hubbub_treebuilder_setopt(parser->tb,
 					HUBBUB_TREEBUILDER_TREE_HANDLER,
 					(hubbub_treebuilder_optparams *) params);
+#endif
+		}
+		break;
+
+	case HUBBUB_PARSER_TREE_HANDLER_EXT:
+		if (parser->tb != NULL) {
+#ifdef HUBBUB_WRAP_TREE_HANDLER
+			hubbub_treebuilder_optparams tparams;
+
+			tparams.tree_handler_ext =
+					hubbub_stats_tree_handler_ext(
+					&parser->stats,
+					params->tree_handler_ext);
+			result = hubbub_treebuilder_setopt(parser->tb,
+					HUBBUB_TREEBUILDER_TREE_HANDLER_EXT,
+					&tparams);
+#else
+			result = hubbub_treebuilder_setopt(parser->tb,
+					HUBBUB_TREEBUILDER_TREE_HANDLER_EXT,
+					(hubbub_treebuilder_optparams *) params);
+#endif
 		}
 		break;
 
@@ -196,6 +658,57 @@ hubbub_error hubbub_parser_setopt(hubbub_parser *parser,
 		}
 		break;
 
+	case HUBBUB_PARSER_EVENT_HANDLER:
+		if (parser->tb != NULL) {
+			result = hubbub_treebuilder_setopt(parser->tb,
+					HUBBUB_TREEBUILDER_EVENT_HANDLER,
+					(hubbub_treebuilder_optparams *) params);
+		} else {
+			result = HUBBUB_BADPARM;
+		}
+		break;
+
+	case HUBBUB_PARSER_HEAD_ONLY:
+		if (parser->tb != NULL) {
+			result = hubbub_treebuilder_setopt(parser->tb,
+					HUBBUB_TREEBUILDER_HEAD_ONLY,
+					(hubbub_treebuilder_optparams *) params);
+		} else {
+			result = HUBBUB_BADPARM;
+		}
+		break;
+
+	case HUBBUB_PARSER_MAX_DEPTH:
+		if (parser->tb != NULL) {
+			result = hubbub_treebuilder_setopt(parser->tb,
+					HUBBUB_TREEBUILDER_MAX_DEPTH,
+					(hubbub_treebuilder_optparams *) params);
+		} else {
+			result = HUBBUB_BADPARM;
+		}
+		break;
+
+	case HUBBUB_PARSER_RAW_ATTRIBUTE_VALUES:
+		/* The treebuilder needs the values decoded */
+		if (parser->tb != NULL) {
+			result = HUBBUB_BADPARM;
+		} else {
+			result = hubbub_tokeniser_setopt(parser->tok,
+					HUBBUB_TOKENISER_RAW_ATTRIBUTE_VALUES,
+					(hubbub_tokeniser_optparams *) params);
+		}
+		break;
+
+	case HUBBUB_PARSER_FRAGMENT:
+		if (parser->tb != NULL) {
+			result = hubbub_treebuilder_setopt(parser->tb,
+					HUBBUB_TREEBUILDER_FRAGMENT,
+					(hubbub_treebuilder_optparams *) params);
+		} else {
+			result = HUBBUB_BADPARM;
+		}
+		break;
+
 	case HUBBUB_PARSER_ENABLE_SCRIPTING:
 		if (parser->tb != NULL) {
 			result = hubbub_treebuilder_setopt(parser->tb,
@@ -241,25 +754,54 @@ hubbub_error hubbub_parser_insert_chunk(hubbub_parser *parser,
 }
 
 /**
- * Pass a chunk of data to a hubbub parser for parsing
+ * Scan the input a paused parser has yet to parse, for resources
  *
- * \param parser  Parser instance to use
- * \param data    Data to parse (encoded in the input charset)
- * \param len     Length, in bytes, of data
+ * \param parser   Parser instance to use
+ * \param handler  Callback to report each resource to
+ * \param pw       Pointer to client data for handler
  * \return HUBBUB_OK on success, appropriate error otherwise
+ *
+ * This is for a parser paused for a script, so the resources further on
+ * in the document may be fetched while the script runs. The input buffered
+ * after the point reached is scanned for base, script, stylesheet and image
+ * URLs, with a tokeniser of its own; the parser's state is untouched.
+ * Input given to the parser but not yet decoded is decoded first, so is
+ * scanned too, and held decoded until it is parsed. Input not yet given
+ * to the parser is not scanned.
  */
-hubbub_error hubbub_parser_parse_chunk(hubbub_parser *parser,
-		const uint8_t *data, size_t len)
+hubbub_error hubbub_parser_preload(hubbub_parser *parser,
+		hubbub_preload_handler handler, void *pw)
 {
-	parserutils_error perror;
+	const uint8_t *data, *more;
+	size_t len, more_len;
 	hubbub_error error;
 
-	if (parser == NULL || data == NULL)
+	if (parser == NULL || handler == NULL)
 		return HUBBUB_BADPARM;
 
-	perror = parserutils_inputstream_append(parser->stream, data, len);
-	if (perror != PARSERUTILS_OK)
-		return hubbub_error_from_parserutils_error(perror);
+	error = hubbub_tokeniser_remainder(parser->tok, &data, &len,
+			&more, &more_len);
+	if (error != HUBBUB_OK)
+		return error;
+
+	return hubbub_preload_scan(parser->stream, data, len, more, more_len,
+			handler, pw, parser->alloc, parser->pw);
+}
+
+/**
+ * Process the data appended to a parser's input stream
+ *
+ * \param parser  Parser instance to use
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ */
+static hubbub_error parse_appended(hubbub_parser *parser)
+{
+	parserutils_error perror;
+	hubbub_error error;
+
+	/* The client may have changed the tree since the last chunk */
+	if (parser->tb != NULL)
+		hubbub_treebuilder_forget_parents(parser->tb);
 
 	error = hubbub_tokeniser_run(parser->tok);
 	if (error == HUBBUB_BADENCODING) {
@@ -280,12 +822,167 @@ hubbub_error hubbub_parser_parse_chunk(hubbub_parser *parser,
 		error = hubbub_tokeniser_run(parser->tok);
 	}
 
+	if (error == HUBBUB_OK || error == HUBBUB_PAUSED) {
+		hubbub_error err = switch_charset(parser);
+		if (err != HUBBUB_OK)
+			return err;
+	}
+
+	return error;
+}
+
+/**
+ * Append data to a parser's input
+ *
+ * \param parser  Parser instance to use
+ * \param data    Data to append, or NULL to flag the end of the input
+ * \param len     Length, in bytes, of data
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ */
+static hubbub_error append_data(hubbub_parser *parser, const uint8_t *data,
+		size_t len)
+{
+	parserutils_error perror;
+	hubbub_error error;
+
+	/* A switch of charset must be made before any more data arrives */
+	error = switch_charset(parser);
 	if (error != HUBBUB_OK)
 		return error;
 
+	if (parser->pass_through)
+		return hubbub_tokeniser_append(parser->tok, data, len);
+
+	if (parser->ascii && data != NULL)
+		parser->ascii = (hubbub_scan_ascii(data, len) == len);
+
+	perror = parserutils_inputstream_append(parser->stream, data, len);
+	if (perror != PARSERUTILS_OK)
+		return hubbub_error_from_parserutils_error(perror);
+
 	return HUBBUB_OK;
 }
 
+/**
+ * Pass a chunk of data to a hubbub parser for parsing
+ *
+ * \param parser  Parser instance to use
+ * \param data    Data to parse (encoded in the input charset)
+ * \param len     Length, in bytes, of data
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ *
+ * Where the parser was created for UTF-8, the data needs no conversion, so
+ * bypasses the input stream: it is validated in bulk, and passed straight
+ * to the tokeniser, with any invalid sequences replaced by U+FFFD.
+ */
+hubbub_error hubbub_parser_parse_chunk(hubbub_parser *parser,
+		const uint8_t *data, size_t len)
+{
+	hubbub_error error;
+
+	if (parser == NULL || data == NULL || parser->had_buffer)
+		return HUBBUB_BADPARM;
+
+	HUBBUB_STATS_ADD(&parser->stats.counts, bytes, len);
+
+	error = append_data(parser, data, len);
+	if (error != HUBBUB_OK)
+		return error;
+
+	parser->had_data = true;
+
+	return parse_appended(parser);
+}
+
+/**
+ * Determine whether a document can be read in place
+ *
+ * \param parser  Parser instance to use
+ * \param data    The document
+ * \param len     Length, in bytes, of data
+ * \return true if the document, as decoded, would be unchanged
+ */
+static bool can_borrow(hubbub_parser *parser, const uint8_t *data,
+		size_t len)
+{
+	uint16_t mibenum;
+
+	if (parser->had_data)
+		return false;
+
+	/* The encoding must be known, rather than detected from the data */
+	mibenum = confident_charset(parser->stream);
+	if (mibenum == 0)
+		return false;
+
+	if (is_utf8(mibenum))
+		return hubbub_scan_utf8_valid(data, len) == len;
+
+	return hubbub_charset_ascii_compatible(mibenum) &&
+			hubbub_scan_ascii(data, len) == len;
+}
+
+/**
+ * Parse a whole document, held in a buffer owned by the client
+ *
+ * \param parser  Parser instance to use
+ * \param data    The document (encoded in the input charset)
+ * \param len     Length, in bytes, of data
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ *
+ * This is equivalent to passing the document to hubbub_parser_parse_chunk()
+ * and then calling hubbub_parser_completed(). However, where no data has
+ * yet been passed to the parser, the encoding was given when the parser
+ * was created, and the document would be unchanged by decoding (valid
+ * UTF-8, or ASCII in an ASCII-compatible encoding), it is read in place
+ * rather than being copied into the input stream.
+ *
+ * The buffer must then remain unchanged until the parser is destroyed or
+ * reset, as parsing may be paused and resumed. No more data may be passed
+ * to the parser, although data may still be inserted.
+ */
+hubbub_error hubbub_parser_parse_buffer(hubbub_parser *parser,
+		const uint8_t *data, size_t len)
+{
+	hubbub_error error;
+
+	if (parser == NULL || data == NULL || parser->had_buffer)
+		return HUBBUB_BADPARM;
+
+	parser->had_buffer = true;
+
+	HUBBUB_STATS_ADD(&parser->stats.counts, bytes, len);
+
+	if (can_borrow(parser, data, len)) {
+		/* The input stream would strip a UTF-8 BOM */
+		if (len >= 3 && data[0] == 0xEF && data[1] == 0xBB &&
+				data[2] == 0xBF) {
+			data += 3;
+			len -= 3;
+			parser->bom = 3;
+		}
+
+		error = hubbub_tokeniser_borrow(parser->tok, data, len);
+		if (error != HUBBUB_OK)
+			return error;
+
+		if (parser->tb != NULL)
+			hubbub_treebuilder_forget_parents(parser->tb);
+
+		return hubbub_tokeniser_run(parser->tok);
+	}
+
+	error = append_data(parser, data, len);
+	if (error == HUBBUB_OK)
+		error = append_data(parser, NULL, 0);
+	if (error != HUBBUB_OK)
+		return error;
+
+	parser->had_data = true;
+
+	return parse_appended(parser);
+}
+
 /**
  * Inform the parser that the last chunk of data has been parsed
  *
@@ -294,23 +991,197 @@ hubbub_error hubbub_parser_parse_chunk(hubbub_parser *parser,
  */
 hubbub_error hubbub_parser_completed(hubbub_parser *parser)
 {
-	parserutils_error perror;
 	hubbub_error error;
 
 	if (parser == NULL)
 		return HUBBUB_BADPARM;
 
-	perror = parserutils_inputstream_append(parser->stream, NULL, 0);
-	if (perror != PARSERUTILS_OK)
-		return hubbub_error_from_parserutils_error(perror);
-
-	error = hubbub_tokeniser_run(parser->tok);
+	error = append_data(parser, NULL, 0);
 	if (error != HUBBUB_OK)
 		return error;
 
+	return parse_appended(parser);
+}
+
+/**
+ * Take a checkpoint of a parse, from which other documents may be parsed
+ *
+ * \param parser      Parser instance to use
+ * \param checkpoint  Pointer to location to receive checkpoint
+ * \return HUBBUB_OK on success,
+ *         HUBBUB_BADPARM on bad parameters,
+ *         HUBBUB_NOMEM on memory exhaustion,
+ *         HUBBUB_INVALID if no checkpoint may be taken here
+ *
+ * Checkpoints may be taken of a document given to
+ * hubbub_parser_parse_buffer() (or hubbub_parser_parse_from()) and read in
+ * place, while parsing is paused (by a budget, or a callback), straight
+ * after a tag, comment or doctype. The checkpoint holds a reference to
+ * each node the treebuilder does, until it is destroyed.
+ */
+hubbub_error hubbub_parser_checkpoint(hubbub_parser *parser,
+		hubbub_checkpoint **checkpoint)
+{
+	hubbub_checkpoint *cp;
+	hubbub_error error;
+
+	if (parser == NULL || checkpoint == NULL)
+		return HUBBUB_BADPARM;
+
+	cp = parser->alloc(NULL, sizeof(hubbub_checkpoint), parser->pw);
+	if (cp == NULL)
+		return HUBBUB_NOMEM;
+
+	cp->tb = NULL;
+	cp->mibenum = confident_charset(parser->stream);
+	cp->bom = parser->bom;
+
+	error = hubbub_tokeniser_save(parser->tok, &cp->tok);
+	if (error == HUBBUB_OK && parser->tb != NULL)
+		error = hubbub_treebuilder_save(parser->tb, &cp->tb);
+	if (error != HUBBUB_OK) {
+		parser->alloc(cp, 0, parser->pw);
+		return error;
+	}
+
+	*checkpoint = cp;
+
 	return HUBBUB_OK;
 }
 
+/**
+ * Destroy a checkpoint
+ *
+ * \param parser      Parser instance the checkpoint was taken of
+ * \param checkpoint  Checkpoint to destroy
+ *
+ * The references the checkpoint holds are released with the parser's tree
+ * handler, which must be the one in use when it was taken.
+ */
+void hubbub_parser_checkpoint_destroy(hubbub_parser *parser,
+		hubbub_checkpoint *checkpoint)
+{
+	if (parser == NULL || checkpoint == NULL)
+		return;
+
+	if (checkpoint->tb != NULL)
+		hubbub_treebuilder_release(parser->tb, checkpoint->tb);
+
+	parser->alloc(checkpoint, 0, parser->pw);
+}
+
+/**
+ * Find where in its document a checkpoint was taken
+ *
+ * \param checkpoint  Checkpoint to query
+ * \return Offset, in bytes, in the document, of the input yet to be parsed
+ */
+size_t hubbub_checkpoint_offset(const hubbub_checkpoint *checkpoint)
+{
+	if (checkpoint == NULL)
+		return 0;
+
+	return checkpoint->bom + checkpoint->tok.offset;
+}
+
+/**
+ * Determine whether two checkpoints parse what follows alike
+ *
+ * \param a  A checkpoint
+ * \param b  Another checkpoint
+ * \return true if the same input, following either, is parsed the same
+ *
+ * Once an edited document's parse reaches a checkpoint which converges with
+ * one of the old document's, after the edit, the rest of the two documents
+ * is the same and is parsed the same, so need not be parsed again. The
+ * nodes held are not compared, only their places: the client is to treat
+ * those of one checkpoint as standing for those of the other.
+ */
+bool hubbub_checkpoint_converged(const hubbub_checkpoint *a,
+		const hubbub_checkpoint *b)
+{
+	if (a == NULL || b == NULL || a->mibenum != b->mibenum ||
+			(a->tb == NULL) != (b->tb == NULL))
+		return false;
+
+	if (hubbub_tokeniser_same_state(&a->tok, &b->tok) == false)
+		return false;
+
+	return a->tb == NULL || hubbub_treebuilder_same_state(a->tb, b->tb);
+}
+
+/**
+ * Parse a document from a checkpoint, taken of a parse of an earlier one
+ *
+ * \param parser      Parser instance to use
+ * \param checkpoint  Checkpoint to parse from
+ * \param data        The document, owned by the client
+ * \param len         Length, in bytes, of data
+ * \return HUBBUB_OK on success,
+ *         HUBBUB_BADPARM on bad parameters, or if the document cannot be
+ *                        read in place from the checkpoint,
+ *         appropriate error otherwise
+ *
+ * This is for reparsing a document after an edit. The parser is reset to
+ * the charset of the checkpoint's document, which must be the same as this
+ * one up to the checkpoint, and is then parsed from there just as
+ * hubbub_parser_parse_buffer() would, so parsing may be paused, and more
+ * checkpoints taken. The client must first bring its tree back to the way
+ * it was when the checkpoint was taken, keeping the nodes it holds.
+ *
+ * The parser must use the same tree handler as the one the checkpoint was
+ * taken of, but need not be the same parser. The checkpoint is unchanged,
+ * so may be parsed from again.
+ */
+hubbub_error hubbub_parser_parse_from(hubbub_parser *parser,
+		const hubbub_checkpoint *checkpoint,
+		const uint8_t *data, size_t len)
+{
+	hubbub_error error;
+	size_t bom = 0;
+
+	if (parser == NULL || checkpoint == NULL || data == NULL ||
+			(checkpoint->tb == NULL) != (parser->tb == NULL))
+		return HUBBUB_BADPARM;
+
+	error = hubbub_parser_reset(parser,
+			parserutils_charset_mibenum_to_name(
+					checkpoint->mibenum));
+	if (error != HUBBUB_OK)
+		return error;
+
+	if (can_borrow(parser, data, len) == false)
+		return HUBBUB_BADPARM;
+
+	if (len >= 3 && data[0] == 0xEF && data[1] == 0xBB &&
+			data[2] == 0xBF)
+		bom = 3;
+
+	/* What precedes the checkpoint is unchanged, as is the BOM */
+	if (bom != checkpoint->bom || checkpoint->tok.offset > len - bom)
+		return HUBBUB_BADPARM;
+
+	parser->had_buffer = true;
+	parser->bom = bom;
+
+	/* Only what follows the checkpoint is parsed */
+	HUBBUB_STATS_ADD(&parser->stats.counts, bytes,
+			len - bom - checkpoint->tok.offset);
+
+	error = hubbub_tokeniser_borrow(parser->tok, data + bom, len - bom);
+	if (error == HUBBUB_OK)
+		error = hubbub_tokeniser_restore(parser->tok, &checkpoint->tok);
+	if (error == HUBBUB_OK && parser->tb != NULL)
+		error = hubbub_treebuilder_restore(parser->tb, checkpoint->tb);
+	if (error != HUBBUB_OK)
+		return error;
+
+	if (parser->tb != NULL)
+		hubbub_treebuilder_forget_parents(parser->tb);
+
+	return hubbub_tokeniser_run(parser->tok);
+}
+
 /**
  * Read the document charset
  *
@@ -334,3 +1205,34 @@ const char *hubbub_parser_read_charset(hubbub_parser *parser,
 	return name;
 }
 
+/**
+ * Retrieve the counters of the work done by a parser
+ *
+ * \param parser  Parser instance to query
+ * \param stats   Pointer to location to receive counters
+ * \return HUBBUB_OK on success,
+ *         HUBBUB_BADPARM on bad parameters,
+ *         HUBBUB_INVALID if the library was built without HUBBUB_WITH_STATS
+ *
+ * The counters cover the life of the parser, across any resets. Counting
+ * is compiled in only when the library is built with HUBBUB_WITH_STATS
+ * (WITH_STATS=yes in Makefile.config); otherwise, nothing is counted.
+ */
+hubbub_error hubbub_parser_get_stats(hubbub_parser *parser,
+		hubbub_parser_stats *stats)
+{
+	if (parser == NULL || stats == NULL)
+		return HUBBUB_BADPARM;
+
+#ifdef HUBBUB_WITH_STATS
+	/* Allocations may be made on other threads */
+	hubbub_mutex_lock(&parser->stats.lock);
+	*stats = parser->stats.counts;
+	hubbub_mutex_unlock(&parser->stats.lock);
+
+	return HUBBUB_OK;
+#else
+	return HUBBUB_INVALID;
+#endif
+}
+
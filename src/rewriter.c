@@ -0,0 +1,727 @@
+/*
+ * This file is part of Hubbub.
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license.php
+ * Copyright 2026 agent <agent@local>
+ */
+
+#include <string.h>
+
+#include <parserutils/input/inputstream.h>
+#include <parserutils/utils/buffer.h>
+
+#include <hubbub/rewriter.h>
+
+#include "charset/detect.h"
+#include "tokeniser/tokeniser.h"
+#include "utils/elements.h"
+#include "utils/parserutilserror.h"
+#include "utils/utils.h"
+
+/** UTF-8 byte order mark, which the tokeniser drops */
+static const uint8_t bom[] = { 0xEF, 0xBB, 0xBF };
+
+/** Value of hubbub_rewriter.bom once there is none to write */
+#define NO_BOM ((size_t) -1)
+
+/**
+ * Rewriter
+ *
+ * The run is the source of the tokens copied out since the sink was last
+ * written to. It is held by the tokeniser until more input is appended, so
+ * is written out at the end of each chunk, and before anything else.
+ */
+struct hubbub_rewriter {
+	hubbub_rewriter_handler handler;	/**< Token handler, or NULL */
+	hubbub_rewriter_sink sink;	/**< Output function */
+	void *pw;			/**< Client data for callbacks */
+
+	parserutils_inputstream *stream;	/**< Input stream, which is
+					 * not read, as input is appended */
+	hubbub_tokeniser *tok;		/**< Tokeniser */
+	hubbub_content_model model;	/**< Content model of the input */
+
+	const hubbub_token *token;	/**< Token being handled, or NULL */
+	bool done;			/**< Whether the token has been
+					 * copied, replaced or dropped */
+
+	size_t run_start;		/**< Offset of start of run */
+	size_t run_end;			/**< Offset just past end of run */
+
+	size_t bom;			/**< Bytes of a BOM at the start of the
+					 * input, or NO_BOM */
+	parserutils_buffer *out;	/**< Replacement tokens, serialised */
+
+	hubbub_allocator_fn alloc;	/**< Memory (de)allocation function */
+	void *alloc_pw;			/**< Client data for alloc */
+};
+
+static hubbub_error rewriter_token(const hubbub_token *token, void *pw);
+static hubbub_error emit(hubbub_rewriter *rewriter, const uint8_t *data,
+		size_t len);
+static hubbub_error flush(hubbub_rewriter *rewriter);
+static hubbub_error skip(hubbub_rewriter *rewriter);
+static hubbub_error put(hubbub_rewriter *rewriter, const uint8_t *data,
+		size_t len);
+static hubbub_error put_escaped(hubbub_rewriter *rewriter,
+		const hubbub_string *str, bool attribute);
+static hubbub_error serialise(hubbub_rewriter *rewriter,
+		const hubbub_token *token);
+static hubbub_error serialise_doctype(hubbub_rewriter *rewriter,
+		const hubbub_doctype *doctype);
+static hubbub_error serialise_tag(hubbub_rewriter *rewriter,
+		const hubbub_tag *tag, bool end);
+static hubbub_content_model content_model(const hubbub_tag *tag);
+
+#define S(s)		(const uint8_t *) s, SLEN(s)
+
+/**
+ * Create a rewriter
+ *
+ * \param handler   Callback to pass each token to, or NULL to copy every
+ *                  token out as it is
+ * \param sink      Callback to write the output to
+ * \param pw        Pointer to client data for handler and sink
+ * \param alloc     Memory (de)allocation function
+ * \param alloc_pw  Pointer to client data for alloc
+ * \param rewriter  Pointer to location to receive rewriter
+ * \return HUBBUB_OK on success,
+ *         HUBBUB_BADPARM on bad parameters,
+ *         HUBBUB_NOMEM on memory exhaustion
+ */
+hubbub_error hubbub_rewriter_create(hubbub_rewriter_handler handler,
+		hubbub_rewriter_sink sink, void *pw,
+		hubbub_allocator_fn alloc, void *alloc_pw,
+		hubbub_rewriter **rewriter)
+{
+	hubbub_tokeniser_optparams params;
+	parserutils_error perror;
+	hubbub_error error;
+	hubbub_rewriter *rw;
+
+	if (sink == NULL || alloc == NULL || rewriter == NULL)
+		return HUBBUB_BADPARM;
+
+	rw = alloc(NULL, sizeof(hubbub_rewriter), alloc_pw);
+	if (rw == NULL)
+		return HUBBUB_NOMEM;
+
+	memset(rw, 0, sizeof(hubbub_rewriter));
+
+	rw->handler = handler;
+	rw->sink = sink;
+	rw->pw = pw;
+	rw->model = HUBBUB_CONTENT_MODEL_PCDATA;
+	rw->alloc = alloc;
+	rw->alloc_pw = alloc_pw;
+
+	perror = parserutils_inputstream_create("UTF-8",
+			HUBBUB_CHARSET_CONFIDENT, hubbub_charset_extract,
+			alloc, alloc_pw, &rw->stream);
+	if (perror == PARSERUTILS_OK)
+		perror = parserutils_buffer_create(alloc, alloc_pw, &rw->out);
+	if (perror != PARSERUTILS_OK) {
+		hubbub_rewriter_destroy(rw);
+		return hubbub_error_from_parserutils_error(perror);
+	}
+
+	error = hubbub_tokeniser_create(rw->stream, alloc, alloc_pw, &rw->tok);
+	if (error != HUBBUB_OK) {
+		hubbub_rewriter_destroy(rw);
+		return error;
+	}
+
+	/* The source of tokens is found from their locations */
+	params.token_handler.handler = rewriter_token;
+	params.token_handler.pw = rw;
+	hubbub_tokeniser_setopt(rw->tok, HUBBUB_TOKENISER_TOKEN_HANDLER,
+			&params);
+
+	params.track_position = true;
+	hubbub_tokeniser_setopt(rw->tok, HUBBUB_TOKENISER_TRACK_POSITION,
+			&params);
+
+	params.keep_source = true;
+	hubbub_tokeniser_setopt(rw->tok, HUBBUB_TOKENISER_KEEP_SOURCE,
+			&params);
+
+	*rewriter = rw;
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Destroy a rewriter
+ *
+ * \param rewriter  The rewriter to destroy
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ */
+hubbub_error hubbub_rewriter_destroy(hubbub_rewriter *rewriter)
+{
+	if (rewriter == NULL)
+		return HUBBUB_BADPARM;
+
+	if (rewriter->tok != NULL)
+		hubbub_tokeniser_destroy(rewriter->tok);
+
+	if (rewriter->out != NULL)
+		parserutils_buffer_destroy(rewriter->out);
+
+	if (rewriter->stream != NULL)
+		parserutils_inputstream_destroy(rewriter->stream);
+
+	rewriter->alloc(rewriter, 0, rewriter->alloc_pw);
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Pass a chunk of UTF-8 data to a rewriter
+ *
+ * \param rewriter  Rewriter to use
+ * \param data      Data to rewrite (UTF-8)
+ * \param len       Length, in bytes, of data
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ *
+ * Invalid sequences in the data are replaced by U+FFFD, in the output as
+ * well as in the tokens.
+ */
+hubbub_error hubbub_rewriter_process_chunk(hubbub_rewriter *rewriter,
+		const uint8_t *data, size_t len)
+{
+	hubbub_error error, err;
+	size_t i;
+
+	if (rewriter == NULL || data == NULL)
+		return HUBBUB_BADPARM;
+
+	/* The tokeniser drops a BOM, so it is written out separately */
+	for (i = 0; rewriter->bom < sizeof(bom) && i < len; i++) {
+		if (data[i] != bom[rewriter->bom]) {
+			rewriter->bom = NO_BOM;
+			break;
+		}
+
+		rewriter->bom++;
+	}
+
+	error = hubbub_tokeniser_append(rewriter->tok, data, len);
+	if (error == HUBBUB_OK)
+		error = hubbub_tokeniser_run(rewriter->tok);
+
+	/* Appending more input may drop the run */
+	err = flush(rewriter);
+
+	return error != HUBBUB_OK ? error : err;
+}
+
+/**
+ * Inform the rewriter that the last chunk of data has been passed to it
+ *
+ * \param rewriter  Rewriter to inform
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ */
+hubbub_error hubbub_rewriter_completed(hubbub_rewriter *rewriter)
+{
+	hubbub_error error, err;
+
+	if (rewriter == NULL)
+		return HUBBUB_BADPARM;
+
+	/* A BOM cut short is no BOM */
+	if (rewriter->bom < sizeof(bom))
+		rewriter->bom = NO_BOM;
+
+	error = hubbub_tokeniser_append(rewriter->tok, NULL, 0);
+	if (error == HUBBUB_OK)
+		error = hubbub_tokeniser_run(rewriter->tok);
+
+	err = flush(rewriter);
+
+	return error != HUBBUB_OK ? error : err;
+}
+
+/**
+ * Write text of the client's to the output
+ *
+ * \param rewriter  Rewriter to write to
+ * \param data      Text to write, written as it is
+ * \param len       Length, in bytes, of data
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ *
+ * From within the token handler, the text precedes the current token,
+ * unless the token has been copied or replaced already.
+ */
+hubbub_error hubbub_rewriter_write(hubbub_rewriter *rewriter,
+		const uint8_t *data, size_t len)
+{
+	hubbub_error error;
+
+	if (rewriter == NULL || (data == NULL && len > 0))
+		return HUBBUB_BADPARM;
+
+	error = flush(rewriter);
+	if (error != HUBBUB_OK)
+		return error;
+
+	return emit(rewriter, data, len);
+}
+
+/**
+ * Copy the source of the current token to the output
+ *
+ * \param rewriter  Rewriter to use
+ * \return HUBBUB_OK on success,
+ *         HUBBUB_BADPARM if there is no current token, or it has been
+ *                        copied, replaced or dropped already
+ *
+ * This need only be called in order to write text after the token, as it
+ * is copied otherwise once the token handler returns.
+ */
+hubbub_error hubbub_rewriter_copy(hubbub_rewriter *rewriter)
+{
+	const hubbub_location *location;
+	hubbub_error error = HUBBUB_OK;
+
+	if (rewriter == NULL || rewriter->token == NULL || rewriter->done)
+		return HUBBUB_BADPARM;
+
+	location = &rewriter->token->location;
+
+	/* Start another run if something has come between */
+	if (location->start != rewriter->run_end) {
+		error = flush(rewriter);
+		rewriter->run_start = rewriter->run_end = location->start;
+	}
+
+	rewriter->run_end = location->end;
+	rewriter->done = true;
+
+	return error;
+}
+
+/**
+ * Write a token in place of the current token
+ *
+ * \param rewriter  Rewriter to use
+ * \param token     Token to write, such as a modified copy of the current
+ *                  token
+ * \return HUBBUB_OK on success,
+ *         HUBBUB_BADPARM if there is no current token, or it has been
+ *                        copied, replaced or dropped already,
+ *         appropriate error otherwise
+ *
+ * Character data is escaped, unless the current token is in the content
+ * of an element whose content is text, such as a script. Attribute
+ * namespaces are ignored.
+ */
+hubbub_error hubbub_rewriter_replace(hubbub_rewriter *rewriter,
+		const hubbub_token *token)
+{
+	hubbub_error error;
+
+	if (rewriter == NULL || token == NULL || rewriter->token == NULL ||
+			rewriter->done)
+		return HUBBUB_BADPARM;
+
+	error = serialise(rewriter, token);
+	if (error == HUBBUB_OK)
+		error = skip(rewriter);
+	if (error == HUBBUB_OK) {
+		error = emit(rewriter, rewriter->out->data,
+				rewriter->out->length);
+	}
+
+	if (rewriter->out->length > 0) {
+		parserutils_buffer_discard(rewriter->out, 0,
+				rewriter->out->length);
+	}
+
+	rewriter->done = true;
+
+	return error;
+}
+
+/**
+ * Drop the current token from the output
+ *
+ * \param rewriter  Rewriter to use
+ * \return HUBBUB_OK on success,
+ *         HUBBUB_BADPARM if there is no current token, or it has been
+ *                        copied, replaced or dropped already,
+ *         appropriate error otherwise
+ */
+hubbub_error hubbub_rewriter_drop(hubbub_rewriter *rewriter)
+{
+	if (rewriter == NULL || rewriter->token == NULL || rewriter->done)
+		return HUBBUB_BADPARM;
+
+	rewriter->done = true;
+
+	return skip(rewriter);
+}
+
+/**
+ * Handle a token from the rewriter's tokeniser
+ *
+ * \param token  Token to handle
+ * \param pw     Rewriter
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ */
+hubbub_error rewriter_token(const hubbub_token *token, void *pw)
+{
+	hubbub_rewriter *rewriter = pw;
+	hubbub_tokeniser_optparams params;
+	hubbub_error error = HUBBUB_OK;
+
+	rewriter->token = token;
+	rewriter->done = false;
+
+	if (rewriter->handler != NULL)
+		error = rewriter->handler(rewriter, token, rewriter->pw);
+
+	if (error == HUBBUB_OK && rewriter->done == false)
+		error = hubbub_rewriter_copy(rewriter);
+
+	rewriter->token = NULL;
+
+	/* Set the content model, in place of the treebuilder. The
+	 * tokeniser returns to PCDATA after each end tag itself. */
+	if (token->type == HUBBUB_TOKEN_START_TAG) {
+		params.content_model.model = content_model(&token->data.tag);
+		if (params.content_model.model !=
+				HUBBUB_CONTENT_MODEL_PCDATA) {
+			hubbub_tokeniser_setopt(rewriter->tok,
+					HUBBUB_TOKENISER_CONTENT_MODEL,
+					&params);
+		}
+		rewriter->model = params.content_model.model;
+	} else if (token->type == HUBBUB_TOKEN_END_TAG) {
+		rewriter->model = HUBBUB_CONTENT_MODEL_PCDATA;
+	}
+
+	return error;
+}
+
+/**
+ * Write to the sink, preceded by any BOM the input started with
+ *
+ * \param rewriter  Rewriter to use
+ * \param data      Data to write
+ * \param len       Length, in bytes, of data
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ */
+hubbub_error emit(hubbub_rewriter *rewriter, const uint8_t *data,
+		size_t len)
+{
+	hubbub_error error;
+
+	if (rewriter->bom == sizeof(bom)) {
+		rewriter->bom = NO_BOM;
+
+		error = rewriter->sink(bom, sizeof(bom), rewriter->pw);
+		if (error != HUBBUB_OK)
+			return error;
+	}
+
+	if (len == 0)
+		return HUBBUB_OK;
+
+	return rewriter->sink(data, len, rewriter->pw);
+}
+
+/**
+ * Write the run out to the sink
+ *
+ * \param rewriter  Rewriter to use
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ */
+hubbub_error flush(hubbub_rewriter *rewriter)
+{
+	const uint8_t *data;
+	hubbub_error error;
+
+	if (rewriter->run_end == rewriter->run_start)
+		return HUBBUB_OK;
+
+	error = hubbub_tokeniser_source(rewriter->tok, rewriter->run_start,
+			rewriter->run_end, &data);
+	if (error == HUBBUB_OK) {
+		error = emit(rewriter, data,
+				rewriter->run_end - rewriter->run_start);
+	}
+
+	rewriter->run_start = rewriter->run_end;
+
+	return error;
+}
+
+/**
+ * Move past the current token, leaving it out of the output
+ *
+ * \param rewriter  Rewriter to use
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ */
+hubbub_error skip(hubbub_rewriter *rewriter)
+{
+	hubbub_error error;
+
+	error = flush(rewriter);
+
+	rewriter->run_start = rewriter->run_end =
+			rewriter->token->location.end;
+
+	return error;
+}
+
+/**
+ * Add data to the serialised replacements
+ *
+ * \param rewriter  Rewriter to use
+ * \param data      Data to add
+ * \param len       Length, in bytes, of data
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ */
+hubbub_error put(hubbub_rewriter *rewriter, const uint8_t *data,
+		size_t len)
+{
+	parserutils_error perror;
+
+	if (len == 0)
+		return HUBBUB_OK;
+
+	perror = parserutils_buffer_append(rewriter->out, data, len);
+
+	return hubbub_error_from_parserutils_error(perror);
+}
+
+/**
+ * Add text to the serialised replacements, escaped
+ *
+ * \param rewriter   Rewriter to use
+ * \param str        Text to add
+ * \param attribute  Whether the text is an attribute value, so has only
+ *                   '&' and '"' escaped, rather than '&', '<' and '>'
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ */
+hubbub_error put_escaped(hubbub_rewriter *rewriter,
+		const hubbub_string *str, bool attribute)
+{
+	hubbub_error error = HUBBUB_OK;
+	size_t start = 0, i;
+
+	for (i = 0; error == HUBBUB_OK && i < str->len; i++) {
+		const uint8_t *escape = NULL;
+		size_t len = 0;
+
+		switch (str->ptr[i]) {
+		case '&':
+			escape = (const uint8_t *) "&amp;";
+			len = SLEN("&amp;");
+			break;
+		case '"':
+			if (attribute) {
+				escape = (const uint8_t *) "&quot;";
+				len = SLEN("&quot;");
+			}
+			break;
+		case '<':
+			if (attribute == false) {
+				escape = (const uint8_t *) "&lt;";
+				len = SLEN("&lt;");
+			}
+			break;
+		case '>':
+			if (attribute == false) {
+				escape = (const uint8_t *) "&gt;";
+				len = SLEN("&gt;");
+			}
+			break;
+		}
+
+		if (escape != NULL) {
+			error = put(rewriter, str->ptr + start, i - start);
+			if (error == HUBBUB_OK)
+				error = put(rewriter, escape, len);
+			start = i + 1;
+		}
+	}
+
+	if (error == HUBBUB_OK)
+		error = put(rewriter, str->ptr + start, str->len - start);
+
+	return error;
+}
+
+/**
+ * Serialise a token
+ *
+ * \param rewriter  Rewriter to use
+ * \param token     Token to serialise
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ */
+hubbub_error serialise(hubbub_rewriter *rewriter, const hubbub_token *token)
+{
+	hubbub_error error = HUBBUB_OK;
+
+	switch (token->type) {
+	case HUBBUB_TOKEN_DOCTYPE:
+		error = serialise_doctype(rewriter, &token->data.doctype);
+		break;
+	case HUBBUB_TOKEN_START_TAG:
+		error = serialise_tag(rewriter, &token->data.tag, false);
+		break;
+	case HUBBUB_TOKEN_END_TAG:
+		error = serialise_tag(rewriter, &token->data.tag, true);
+		break;
+	case HUBBUB_TOKEN_COMMENT:
+		error = put(rewriter, S("<!--"));
+		if (error == HUBBUB_OK) {
+			error = put(rewriter, token->data.comment.ptr,
+					token->data.comment.len);
+		}
+		if (error == HUBBUB_OK)
+			error = put(rewriter, S("-->"));
+		break;
+	case HUBBUB_TOKEN_CHARACTER:
+		/* Text is only read for references in PCDATA and RCDATA */
+		if (rewriter->model == HUBBUB_CONTENT_MODEL_PCDATA ||
+				rewriter->model ==
+						HUBBUB_CONTENT_MODEL_RCDATA) {
+			error = put_escaped(rewriter, &token->data.character,
+					false);
+		} else {
+			error = put(rewriter, token->data.character.ptr,
+					token->data.character.len);
+		}
+		break;
+	case HUBBUB_TOKEN_EOF:
+		break;
+	}
+
+	return error;
+}
+
+/**
+ * Serialise a doctype
+ *
+ * \param rewriter  Rewriter to use
+ * \param doctype   Doctype to serialise
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ */
+hubbub_error serialise_doctype(hubbub_rewriter *rewriter,
+		const hubbub_doctype *doctype)
+{
+	hubbub_error error;
+
+	error = put(rewriter, S("<!DOCTYPE"));
+
+	if (error == HUBBUB_OK && doctype->name.len > 0) {
+		error = put(rewriter, S(" "));
+		if (error == HUBBUB_OK) {
+			error = put(rewriter, doctype->name.ptr,
+					doctype->name.len);
+		}
+	}
+
+	if (error == HUBBUB_OK && doctype->public_missing == false) {
+		error = put(rewriter, S(" PUBLIC \""));
+		if (error == HUBBUB_OK) {
+			error = put(rewriter, doctype->public_id.ptr,
+					doctype->public_id.len);
+		}
+		if (error == HUBBUB_OK)
+			error = put(rewriter, S("\""));
+	}
+
+	if (error == HUBBUB_OK && doctype->system_missing == false) {
+		if (doctype->public_missing)
+			error = put(rewriter, S(" SYSTEM"));
+		if (error == HUBBUB_OK)
+			error = put(rewriter, S(" \""));
+		if (error == HUBBUB_OK) {
+			error = put(rewriter, doctype->system_id.ptr,
+					doctype->system_id.len);
+		}
+		if (error == HUBBUB_OK)
+			error = put(rewriter, S("\""));
+	}
+
+	if (error == HUBBUB_OK)
+		error = put(rewriter, S(">"));
+
+	return error;
+}
+
+/**
+ * Serialise a tag
+ *
+ * \param rewriter  Rewriter to use
+ * \param tag       Tag to serialise
+ * \param end       Whether the tag is an end tag, so has no attributes
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ */
+hubbub_error serialise_tag(hubbub_rewriter *rewriter,
+		const hubbub_tag *tag, bool end)
+{
+	hubbub_error error;
+	uint32_t i;
+
+	error = end ? put(rewriter, S("</")) : put(rewriter, S("<"));
+	if (error == HUBBUB_OK)
+		error = put(rewriter, tag->name.ptr, tag->name.len);
+
+	for (i = 0; end == false && error == HUBBUB_OK &&
+			i < tag->n_attributes; i++) {
+		const hubbub_attribute *attr = &tag->attributes[i];
+
+		error = put(rewriter, S(" "));
+		if (error == HUBBUB_OK)
+			error = put(rewriter, attr->name.ptr, attr->name.len);
+		if (error == HUBBUB_OK)
+			error = put(rewriter, S("=\""));
+		if (error == HUBBUB_OK)
+			error = put_escaped(rewriter, &attr->value, true);
+		if (error == HUBBUB_OK)
+			error = put(rewriter, S("\""));
+	}
+
+	if (error == HUBBUB_OK && end == false && tag->self_closing)
+		error = put(rewriter, S(" /"));
+	if (error == HUBBUB_OK)
+		error = put(rewriter, S(">"));
+
+	return error;
+}
+
+/**
+ * Find the content model which follows a start tag
+ *
+ * \param tag  Start tag
+ * \return Content model of the element's content
+ *
+ * As for the preload scanner, scripting is taken to be enabled.
+ */
+hubbub_content_model content_model(const hubbub_tag *tag)
+{
+	switch (tag->atom) {
+	case HUBBUB_ATOM_TITLE:
+	case HUBBUB_ATOM_TEXTAREA:
+		return HUBBUB_CONTENT_MODEL_RCDATA;
+	case HUBBUB_ATOM_SCRIPT:
+	case HUBBUB_ATOM_STYLE:
+	case HUBBUB_ATOM_XMP:
+	case HUBBUB_ATOM_IFRAME:
+	case HUBBUB_ATOM_NOEMBED:
+	case HUBBUB_ATOM_NOFRAMES:
+	case HUBBUB_ATOM_NOSCRIPT:
+		return HUBBUB_CONTENT_MODEL_CDATA;
+	case HUBBUB_ATOM_PLAINTEXT:
+		return HUBBUB_CONTENT_MODEL_PLAINTEXT;
+	default:
+		break;
+	}
+
+	return HUBBUB_CONTENT_MODEL_PCDATA;
+}
+
@@ -8,20 +8,24 @@
 #include "utils/utils.h"
 #include "tokeniser/entities.h"
 
-/** Node in our entity tree */
-typedef struct hubbub_entity_node {
-        /* Do not reorder this without fixing make-entities.pl */
-	uint8_t split;	/**< Data to split on */
-	int32_t lt;	/**< Subtree for data less than split */
-	int32_t eq;	/**< Subtree for data equal to split */
-	int32_t gt;	/**< Subtree for data greater than split */
-	uint32_t value;	/**< Data for this node */
-} hubbub_entity_node;
+/** Edge in our entity DAFSA */
+typedef struct hubbub_entity_edge {
+	/* Do not reorder this without fixing make-entities.pl */
+	uint8_t c;	/**< Character on edge */
+	uint8_t flags;	/**< Edge flags */
+	uint16_t next;	/**< Offset of the target's first edge in dict[],
+			 * or 0 if the target has none */
+	uint16_t skip;	/**< Number of names passed over by taking edge */
+} hubbub_entity_edge;
+
+/** Edge flags */
+#define LAST	0x01	/**< Last edge leaving its state */
+#define FINAL	0x02	/**< Target state completes an entity name */
 
 #include "entities.inc"
 
 /**
- * Step-wise search for a key in our entity tree
+ * Step-wise search for a key in our entity DAFSA
  *
  * \param c        Character to look for
  * \param result   Pointer to location for result
@@ -30,57 +34,65 @@ typedef struct hubbub_entity_node {
  *         HUBBUB_NEEDDATA if more steps are required
  *         HUBBUB_INVALID if nothing matches
  *
- * The value pointed to by ::context must be NULL for the first call.
+ * The value pointed to by ::context must be -1 for the first call.
  * Thereafter, pass in the same value as returned by the previous call.
- * The context is opaque to the caller and should not be inspected.
+ * The context holds the offset of the current state's edges in the low
+ * 16 bits, and the index of the first name reachable from it above them.
  *
- * The location pointed to by ::result will be set to NULL unless a match
- * is found.
+ * The location pointed to by ::result will be left unmodified unless a
+ * match is found.
  */
-static hubbub_error hubbub_entity_tree_search_step(uint8_t c,
+static hubbub_error hubbub_entity_dafsa_search_step(uint8_t c,
 		uint32_t *result, int32_t *context)
 {
-	bool match = false;
-	int32_t p;
+	const hubbub_entity_edge *edge;
+	uint32_t index;
 
 	if (result == NULL || context == NULL)
 		return HUBBUB_BADPARM;
 
 	if (*context == -1) {
-		p = dict_root;
+		/* The first character is looked up directly */
+		if (c >= N_ELEMENTS(dict_root) || dict_root[c].c != c ||
+				c == '\0') {
+			*context = -1;
+			return HUBBUB_INVALID;
+		}
+
+		edge = &dict_root[c];
+		index = 0;
 	} else {
-		p = *context;
-	}
+		uint32_t offset = (uint32_t) *context & 0xFFFF;
+
+		index = (uint32_t) *context >> 16;
 
-	while (p != -1) {
-		if (c < dict[p].split) {
-			p = dict[p].lt;
-		} else if (c == dict[p].split) {
-			if (dict[p].split == '\0') {
-				match = true;
-				p = -1;
-			} else if (dict[p].eq != -1 && dict[dict[p].eq].split == '\0') {
-				match = true;
-				*result = dict[dict[p].eq].value;
-				p = dict[p].eq;
-			} else if (dict[p].value != 0) {
-				match = true;
-				*result = dict[p].value;
-				p = dict[p].eq;
-			} else {
-				p = dict[p].eq;
-			}
-
-			break;
-		} else {
-			p = dict[p].gt;
+		if (offset == 0) {
+			/* Nothing follows the current state */
+			*context = -1;
+			return HUBBUB_INVALID;
+		}
+
+		/* Siblings are sorted by character */
+		edge = &dict[offset];
+		while (edge->c < c && (edge->flags & LAST) == 0)
+			edge++;
+
+		if (edge->c != c) {
+			*context = -1;
+			return HUBBUB_INVALID;
 		}
 	}
 
-	*context = p;
+	index += edge->skip;
+
+	*context = (int32_t) ((index << 16) | edge->next);
+
+	if ((edge->flags & FINAL) == 0)
+		return HUBBUB_NEEDDATA;
+
+	*result = dict_values[index];
 
-	return (match) ? HUBBUB_OK :
-			(p == -1) ? HUBBUB_INVALID : HUBBUB_NEEDDATA;
+	return HUBBUB_OK;
 }
 
 /**
@@ -108,5 +120,5 @@ hubbub_error hubbub_entities_search_step(uint8_t c, uint32_t *result,
 
         *result = 0xFFFD;
         
-	return hubbub_entity_tree_search_step(c, result, context);
+	return hubbub_entity_dafsa_search_step(c, result, context);
 }
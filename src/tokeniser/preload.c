@@ -0,0 +1,367 @@
+/*
+ * This file is part of Hubbub.
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license.php
+ * Copyright 2026 agent <agent@local>
+ */
+
+#include "tokeniser/preload.h"
+#include "tokeniser/tokeniser.h"
+#include "utils/charclass.h"
+#include "utils/elements.h"
+#include "utils/string.h"
+#include "utils/utils.h"
+
+#define S(s)		(const uint8_t *) s, SLEN(s)
+
+/**
+ * Preload scanner
+ *
+ * The scanner reads the input with a tokeniser of its own, and no
+ * treebuilder. In the treebuilder's place, it sets the content model after
+ * each start tag whose content is text, so that what looks like markup in
+ * a script or stylesheet is not taken for tags. It is assumed that
+ * scripting is enabled, as the parser is paused for a script. Otherwise,
+ * what the treebuilder does makes no difference to the resources found.
+ */
+typedef struct hubbub_preloader {
+	hubbub_preload_handler handler;	/**< Client callback */
+	void *pw;			/**< Client data for handler */
+
+	hubbub_tokeniser *tok;		/**< Tokeniser */
+	bool had_base;			/**< Whether a base URL was found */
+} hubbub_preloader;
+
+static const hubbub_string *find_attribute(const hubbub_tag *tag,
+		const uint8_t *name, size_t len);
+static bool has_keyword(const hubbub_string *value,
+		const uint8_t *keyword, size_t len);
+static hubbub_error report(hubbub_preloader *preloader,
+		hubbub_preload_type type, const hubbub_string *url);
+static hubbub_error report_srcset(hubbub_preloader *preloader,
+		const hubbub_string *srcset);
+static hubbub_error scan_start_tag(hubbub_preloader *preloader,
+		const hubbub_tag *tag);
+static hubbub_error preload_token(const hubbub_token *token, void *pw);
+
+/**
+ * Scan UTF-8 input for resources, without building a tree
+ *
+ * \param input     Input stream for the tokeniser, which is not read
+ * \param data      Input to scan
+ * \param len       Length, in bytes, of data
+ * \param more      Input following data, or NULL for none
+ * \param more_len  Length, in bytes, of more
+ * \param handler   Callback to report each resource to
+ * \param pw        Pointer to client data for handler
+ * \param alloc     Memory (de)allocation function
+ * \param alloc_pw  Pointer to client data for alloc
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ *
+ * The input is taken to be part way through a document, in the data
+ * state: a token left unfinished at its end is not reported.
+ */
+hubbub_error hubbub_preload_scan(parserutils_inputstream *input,
+		const uint8_t *data, size_t len,
+		const uint8_t *more, size_t more_len,
+		hubbub_preload_handler handler, void *pw,
+		hubbub_allocator_fn alloc, void *alloc_pw)
+{
+	hubbub_tokeniser_optparams params;
+	hubbub_preloader preloader;
+	hubbub_error error;
+
+	preloader.handler = handler;
+	preloader.pw = pw;
+	preloader.had_base = false;
+
+	error = hubbub_tokeniser_create(input, alloc, alloc_pw,
+			&preloader.tok);
+	if (error != HUBBUB_OK)
+		return error;
+
+	params.token_handler.handler = preload_token;
+	params.token_handler.pw = &preloader;
+	error = hubbub_tokeniser_setopt(preloader.tok,
+			HUBBUB_TOKENISER_TOKEN_HANDLER, &params);
+
+	params.drop_comments = true;
+	if (error == HUBBUB_OK) {
+		error = hubbub_tokeniser_setopt(preloader.tok,
+				HUBBUB_TOKENISER_DROP_COMMENTS, &params);
+	}
+
+	if (error == HUBBUB_OK)
+		error = hubbub_tokeniser_append(preloader.tok, data, len);
+	if (error == HUBBUB_OK && more_len > 0) {
+		error = hubbub_tokeniser_append(preloader.tok,
+				more, more_len);
+	}
+
+	/* The end of the input is not flagged, so nothing is made of a
+	 * token cut short by it */
+	if (error == HUBBUB_OK)
+		error = hubbub_tokeniser_run(preloader.tok);
+	if (error == HUBBUB_STOPPED)
+		error = HUBBUB_OK;
+
+	hubbub_tokeniser_destroy(preloader.tok);
+
+	return error;
+}
+
+/**
+ * Find an attribute of a tag
+ *
+ * \param tag   Tag to search
+ * \param name  Name of attribute, in lowercase
+ * \param len   Length, in bytes, of name
+ * \return Pointer to the attribute's value, or NULL if it is missing
+ */
+const hubbub_string *find_attribute(const hubbub_tag *tag,
+		const uint8_t *name, size_t len)
+{
+	uint32_t i;
+
+	for (i = 0; i < tag->n_attributes; i++) {
+		if (hubbub_string_match(tag->attributes[i].name.ptr,
+				tag->attributes[i].name.len, name, len))
+			return &tag->attributes[i].value;
+	}
+
+	return NULL;
+}
+
+/**
+ * Determine if an attribute value has a keyword among its space-separated
+ * tokens
+ *
+ * \param value    Attribute value, or NULL
+ * \param keyword  Keyword to look for, in lowercase
+ * \param len      Length, in bytes, of keyword
+ * \return true if the keyword is present, false otherwise
+ */
+bool has_keyword(const hubbub_string *value, const uint8_t *keyword,
+		size_t len)
+{
+	size_t pos = 0, start;
+
+	if (value == NULL)
+		return false;
+
+	while (pos < value->len) {
+		while (pos < value->len &&
+				hubbub_char_is_space(value->ptr[pos]))
+			pos++;
+
+		start = pos;
+		while (pos < value->len &&
+				hubbub_char_is_space(value->ptr[pos]) == false)
+			pos++;
+
+		if (pos > start && hubbub_string_match_ci(value->ptr + start,
+				pos - start, keyword, len))
+			return true;
+	}
+
+	return false;
+}
+
+/**
+ * Report a resource to the client
+ *
+ * \param preloader  Preload scanner
+ * \param type       Type of resource
+ * \param url        URL of resource, or NULL
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ *
+ * Whitespace around the URL is dropped, and nothing is reported if it is
+ * missing or empty.
+ */
+hubbub_error report(hubbub_preloader *preloader, hubbub_preload_type type,
+		const hubbub_string *url)
+{
+	hubbub_preload preload;
+
+	if (url == NULL)
+		return HUBBUB_OK;
+
+	preload.type = type;
+	preload.url = *url;
+
+	while (preload.url.len > 0 &&
+			hubbub_char_is_space(preload.url.ptr[0])) {
+		preload.url.ptr++;
+		preload.url.len--;
+	}
+	while (preload.url.len > 0 && hubbub_char_is_space(
+			preload.url.ptr[preload.url.len - 1]))
+		preload.url.len--;
+
+	if (preload.url.len == 0)
+		return HUBBUB_OK;
+
+	return preloader->handler(&preload, preloader->pw);
+}
+
+/**
+ * Report the URL of each candidate image in a srcset attribute
+ *
+ * \param preloader  Preload scanner
+ * \param srcset     Value of attribute, or NULL
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ *
+ * Candidates are separated by commas, each a URL followed by descriptors.
+ * A URL may itself contain commas, though not at either end.
+ */
+hubbub_error report_srcset(hubbub_preloader *preloader,
+		const hubbub_string *srcset)
+{
+	const uint8_t *pos, *end;
+	hubbub_string url;
+	hubbub_error error;
+
+	if (srcset == NULL)
+		return HUBBUB_OK;
+
+	pos = srcset->ptr;
+	end = pos + srcset->len;
+
+	while (pos < end) {
+		uint32_t parens = 0;
+
+		while (pos < end && (hubbub_char_is_space(*pos) ||
+				*pos == ','))
+			pos++;
+
+		url.ptr = pos;
+		while (pos < end && hubbub_char_is_space(*pos) == false)
+			pos++;
+		url.len = pos - url.ptr;
+
+		if (url.len > 0 && url.ptr[url.len - 1] == ',') {
+			/* Commas after the URL end the candidate */
+			while (url.len > 0 && url.ptr[url.len - 1] == ',')
+				url.len--;
+		} else {
+			/* Skip the descriptors, which may have commas in
+			 * brackets */
+			while (pos < end && (*pos != ',' || parens > 0)) {
+				if (*pos == '(')
+					parens++;
+				else if (*pos == ')' && parens > 0)
+					parens--;
+				pos++;
+			}
+		}
+
+		error = report(preloader, HUBBUB_PRELOAD_IMAGE, &url);
+		if (error != HUBBUB_OK)
+			return error;
+	}
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Scan a start tag for resources, and set the content model for what
+ * follows it
+ *
+ * \param preloader  Preload scanner
+ * \param tag        Start tag
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ */
+hubbub_error scan_start_tag(hubbub_preloader *preloader,
+		const hubbub_tag *tag)
+{
+	hubbub_tokeniser_optparams params;
+	hubbub_error error = HUBBUB_OK;
+
+	params.content_model.model = HUBBUB_CONTENT_MODEL_PCDATA;
+
+	switch (tag->atom) {
+	case HUBBUB_ATOM_BASE:
+		/* Only the first base URL with an href applies */
+		if (preloader->had_base == false &&
+				find_attribute(tag, S("href")) != NULL) {
+			preloader->had_base = true;
+			error = report(preloader, HUBBUB_PRELOAD_BASE,
+					find_attribute(tag, S("href")));
+		}
+		break;
+	case HUBBUB_ATOM_LINK:
+		if (has_keyword(find_attribute(tag, S("rel")),
+				S("stylesheet"))) {
+			error = report(preloader, HUBBUB_PRELOAD_STYLESHEET,
+					find_attribute(tag, S("href")));
+		}
+		break;
+	case HUBBUB_ATOM_IMG:
+		error = report(preloader, HUBBUB_PRELOAD_IMAGE,
+				find_attribute(tag, S("src")));
+		if (error == HUBBUB_OK) {
+			error = report_srcset(preloader,
+					find_attribute(tag, S("srcset")));
+		}
+		break;
+	case HUBBUB_ATOM_INPUT:
+		if (has_keyword(find_attribute(tag, S("type")),
+				S("image"))) {
+			error = report(preloader, HUBBUB_PRELOAD_IMAGE,
+					find_attribute(tag, S("src")));
+		}
+		break;
+	case HUBBUB_ATOM_SCRIPT:
+		error = report(preloader, HUBBUB_PRELOAD_SCRIPT,
+				find_attribute(tag, S("src")));
+		params.content_model.model = HUBBUB_CONTENT_MODEL_CDATA;
+		break;
+	case HUBBUB_ATOM_TITLE:
+	case HUBBUB_ATOM_TEXTAREA:
+		params.content_model.model = HUBBUB_CONTENT_MODEL_RCDATA;
+		break;
+	case HUBBUB_ATOM_STYLE:
+	case HUBBUB_ATOM_XMP:
+	case HUBBUB_ATOM_IFRAME:
+	case HUBBUB_ATOM_NOEMBED:
+	case HUBBUB_ATOM_NOFRAMES:
+	case HUBBUB_ATOM_NOSCRIPT:
+		params.content_model.model = HUBBUB_CONTENT_MODEL_CDATA;
+		break;
+	case HUBBUB_ATOM_PLAINTEXT:
+		params.content_model.model = HUBBUB_CONTENT_MODEL_PLAINTEXT;
+		break;
+	default:
+		/* Source is not among the element types */
+		if (hubbub_string_match(tag->name.ptr, tag->name.len,
+				S("source"))) {
+			error = report_srcset(preloader,
+					find_attribute(tag, S("srcset")));
+		}
+		break;
+	}
+
+	if (error == HUBBUB_OK && params.content_model.model !=
+			HUBBUB_CONTENT_MODEL_PCDATA) {
+		error = hubbub_tokeniser_setopt(preloader->tok,
+				HUBBUB_TOKENISER_CONTENT_MODEL, &params);
+	}
+
+	return error;
+}
+
+/**
+ * Handle a token from the scanner's tokeniser
+ *
+ * \param token  Token to handle
+ * \param pw     Preload scanner
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ */
+hubbub_error preload_token(const hubbub_token *token, void *pw)
+{
+	if (token->type != HUBBUB_TOKEN_START_TAG)
+		return HUBBUB_OK;
+
+	return scan_start_tag(pw, &token->data.tag);
+}
+
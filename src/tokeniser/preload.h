@@ -0,0 +1,28 @@
+/*
+ * This file is part of Hubbub.
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license.php
+ * Copyright 2026 agent <agent@local>
+ */
+
+#ifndef hubbub_tokeniser_preload_h_
+#define hubbub_tokeniser_preload_h_
+
+#include <stddef.h>
+#include <inttypes.h>
+
+#include <hubbub/errors.h>
+#include <hubbub/functypes.h>
+#include <hubbub/preload.h>
+
+#include <parserutils/input/inputstream.h>
+
+/* Scan UTF-8 input for resources, without building a tree */
+hubbub_error hubbub_preload_scan(parserutils_inputstream *input,
+		const uint8_t *data, size_t len,
+		const uint8_t *more, size_t more_len,
+		hubbub_preload_handler handler, void *pw,
+		hubbub_allocator_fn alloc, void *alloc_pw);
+
+#endif
+
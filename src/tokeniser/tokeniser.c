@@ -9,13 +9,20 @@
 #include <stdbool.h>
 #include <string.h>
 
-#include <stdio.h>
-
 #include <parserutils/charset/utf8.h>
 
+#include "utils/atoms.h"
+#include "utils/charclass.h"
+#include "utils/elements.h"
 #include "utils/parserutilserror.h"
+#include "utils/scan.h"
+#include "utils/stats.h"
+#include "utils/thread.h"
+#include "utils/trace.h"
 #include "utils/utils.h"
 
+#include "hubbub/arena.h"
+#include "hubbub/attribute.h"
 #include "hubbub/errors.h"
 #include "tokeniser/entities.h"
 #include "tokeniser/tokeniser.h"
@@ -34,14 +41,12 @@ static const uint32_t cp1252Table[32] = {
  * UTF-8 encoding of U+FFFD REPLACEMENT CHARACTER
  */
 static const uint8_t u_fffd[3] = { '\xEF', '\xBF', '\xBD' };
-static const hubbub_string u_fffd_str = { u_fffd, sizeof(u_fffd) };
 
 
 /**
  * String for when we want to emit newlines
  */
 static const uint8_t lf = '\n';
-static const hubbub_string lf_str = { &lf, 1 };
 
 
 /**
@@ -93,6 +98,23 @@ typedef enum hubbub_tokeniser_state {
 	STATE_NAMED_ENTITY
 } hubbub_tokeniser_state;
 
+/**
+ * Sources of an attribute's name and value
+ */
+typedef struct hubbub_tokeniser_attribute_src {
+	size_t name;				/**< Source of name */
+	size_t value;				/**< Source of value */
+} hubbub_tokeniser_attribute_src;
+
+/**
+ * Sources of a doctype's name and identifiers
+ */
+typedef struct hubbub_tokeniser_doctype_src {
+	size_t name;				/**< Source of name */
+	size_t public_id;			/**< Source of public id */
+	size_t system_id;			/**< Source of system id */
+} hubbub_tokeniser_doctype_src;
+
 /**
  * Context for tokeniser
  */
@@ -100,10 +122,24 @@ typedef struct hubbub_tokeniser_context {
 	size_t pending;				/**< Count of pending chars */
 
 	hubbub_string current_comment;		/**< Current comment text */
+	size_t current_comment_src;		/**< Source of comment text */
 
 	hubbub_token_type current_tag_type;	/**< Type of current_tag */
 	hubbub_tag current_tag;			/**< Current tag */
+	size_t current_tag_name_src;		/**< Source of tag name */
+	uint32_t current_tag_name_hash;		/**< Element name hash of
+						 * tag name */
+	hubbub_tokeniser_attribute_src *attribute_src;	/**< Sources of
+						 * attribute names and
+						 * values */
+	uint32_t attribute_space;		/**< Number of attributes
+						 * current_tag has space for */
+	uint32_t *attribute_hash;		/**< Hash table for finding
+						 * duplicate attributes, of
+						 * twice attribute_space */
 	hubbub_doctype current_doctype;		/**< Current doctype */
+	hubbub_tokeniser_doctype_src current_doctype_src;	/**< Sources
+						 * of doctype strings */
 	hubbub_tokeniser_state prev_state;	/**< Previous state */
 
 	uint8_t last_start_tag_name[10];	/**< Name of the last start tag
@@ -150,10 +186,35 @@ typedef struct hubbub_tokeniser_context {
 	} match_entity;				/**< Entity matching state */
 
 	struct {
-		uint32_t line;			/**< Current line of input */
-		uint32_t col;			/**< Current character in
-						 * line */
-	} position;				/**< Position in source data */
+		size_t offset;			/**< Offset of cursor */
+		uint32_t line;			/**< Line of cursor */
+		size_t line_start;		/**< Offset of start of line */
+		bool after_cr;			/**< Whether the byte before
+						 * the cursor is CR */
+		hubbub_location mark;		/**< Location of the start of
+						 * the next token */
+	} position;				/**< Position in source data,
+						 * if tracked */
+
+	struct {
+		bool buffered;			/**< Whether the pending
+						 * characters have been
+						 * copied into buffer */
+		size_t copied;			/**< Pending input bytes
+						 * copied so far */
+		uint32_t dashes;		/**< Number of '-' (at most
+						 * two) ending the piece of
+						 * raw text last split off */
+		size_t space;			/**< Pending input bytes
+						 * known to be whitespace */
+	} chars;				/**< Pending character data */
+
+	bool incomplete;			/**< Whether the token being
+						 * emitted is continued by
+						 * the next */
+	bool value_truncated;			/**< Whether the current
+						 * attribute value has been
+						 * cut at the token limit */
 
 	uint32_t allowed_char;			/**< Used for quote matching */
 
@@ -168,22 +229,102 @@ struct hubbub_tokeniser {
 						 * model flag */
 	bool escape_flag;		/**< Escape flag **/
 	bool process_cdata_section;	/**< Whether to process CDATA sections*/
+	bool track_position;		/**< Whether to set token locations */
+	bool drop_comments;		/**< Whether to discard comments */
+	bool keep_source;		/**< Whether to keep the input passed
+					 * through from the start of the
+					 * current token */
+	bool raw_values;		/**< Whether to leave attribute values
+					 * as written */
+	size_t token_limit;		/**< Size at which token data is split
+					 * or truncated, in bytes */
+	struct {
+		size_t tokens;		/**< Tokens per call, or 0 for any */
+		size_t bytes;		/**< Bytes per call, or 0 for any */
+		size_t spent_tokens;	/**< Tokens emitted in this call */
+		size_t spent_bytes;	/**< Bytes moved over in this call */
+	} budget;			/**< Work to do in each call */
 	bool paused; /**< flag for if parsing is currently paused */
+	bool stopped;			/**< Whether the token handler has
+					 * stopped parsing */
+	unsigned int threads;		/**< Threads to tokenise borrowed
+					 * input on */
+	bool pipeline;			/**< Whether to tokenise borrowed
+					 * input on a thread of its own */
+	bool speculating;		/**< Whether tokenising borrowed input
+					 * in chunks, on several threads */
 
 	parserutils_inputstream *input;	/**< Input stream */
 	parserutils_buffer *buffer;	/**< Input buffer */
 	parserutils_buffer *insert_buf; /**< Stream insertion buffer */
 
+	bool borrowing;			/**< Whether reading borrowed data */
+	struct {
+		parserutils_inputstream stream;	/**< Stream read from, in
+						 * place of input */
+		parserutils_buffer view;	/**< Data the stream reads */
+		const uint8_t *data;		/**< Borrowed data */
+		size_t len;			/**< Length of borrowed data */
+		size_t resume;			/**< Offset in borrowed data
+						 * to read from once the side
+						 * buffer is used up */
+		bool in_side;			/**< Whether reading from
+						 * the side buffer */
+		size_t copied;			/**< Length of borrowed data
+						 * at the end of the side
+						 * buffer */
+		parserutils_buffer *side;	/**< Inserted data, followed
+						 * by any borrowed data which
+						 * the same token spans */
+		bool passing;			/**< Whether the data is our
+						 * own, passed through */
+		parserutils_buffer *own;	/**< Data passed through */
+		size_t own_offset;		/**< Offset in the input of
+						 * the start of own */
+		bool started;			/**< Whether any data has
+						 * been passed through */
+		uint8_t carry[4];		/**< Incomplete character at
+						 * the end of the last data
+						 * passed through */
+		size_t carry_len;		/**< Length of carry */
+	} borrowed;				/**< Borrowed input */
+
 	hubbub_tokeniser_context context;	/**< Tokeniser context */
 
 	hubbub_token_handler token_handler;	/**< Token handling callback */
 	void *token_pw;				/**< Token handler data */
 
+	struct {
+		hubbub_token_batch_handler handler;	/**< Callback */
+		void *pw;			/**< Callback data */
+		size_t size;			/**< Maximum tokens in batch */
+		size_t count;			/**< Tokens in batch */
+		hubbub_token *tokens;		/**< Tokens in batch */
+		hubbub_attribute *attrs;	/**< Attributes of tags */
+		size_t n_attrs;			/**< Attributes in use */
+		size_t alloc_attrs;		/**< Attributes allocated */
+		parserutils_buffer *strings;	/**< Strings of tokens */
+	} batch;				/**< Batched token delivery */
+
+	struct {
+		hubbub_compact_token_handler handler;	/**< Callback */
+		void *pw;			/**< Callback data */
+		hubbub_compact_attribute *attrs;	/**< Attributes of
+							 * tags */
+		uint32_t alloc_attrs;		/**< Attributes allocated */
+		parserutils_buffer *strings;	/**< Strings of tokens not
+						 * in the input */
+	} compact;				/**< Compact token delivery */
+
 	hubbub_error_handler error_handler;	/**< Error handling callback */
 	void *error_pw;				/**< Error handler data */
 
 	hubbub_allocator_fn alloc;	/**< Memory (de)allocation function */
 	void *alloc_pw;			/**< Client private data */
+
+#ifdef HUBBUB_WITH_STATS
+	hubbub_parser_stats *stats;	/**< Counters, or NULL */
+#endif
 };
 
 static hubbub_error hubbub_tokeniser_handle_data(hubbub_tokeniser *tokeniser);
@@ -265,6 +406,10 @@ static hubbub_error hubbub_tokeniser_handle_numbered_entity(
 		hubbub_tokeniser *tokeniser);
 static hubbub_error hubbub_tokeniser_handle_named_entity(
 		hubbub_tokeniser *tokeniser);
+static uint32_t hubbub_tokeniser_numbered_codepoint(uint32_t cp,
+		bool overflow);
+static size_t hubbub_tokeniser_decode_reference(const uint8_t *s,
+		size_t len, uint32_t *cp);
 
 static inline hubbub_error emit_character_token(hubbub_tokeniser *tokeniser,
 		const hubbub_string *chars);
@@ -275,6 +420,20 @@ static inline hubbub_error emit_current_doctype(hubbub_tokeniser *tokeniser,
 		bool force_quirks);
 static hubbub_error hubbub_tokeniser_emit_token(hubbub_tokeniser *tokeniser,
 		hubbub_token *token);
+static hubbub_error hubbub_tokeniser_set_batch_handler(
+		hubbub_tokeniser *tokeniser,
+		const hubbub_tokeniser_optparams *params);
+static hubbub_error hubbub_tokeniser_flush_batch(hubbub_tokeniser *tokeniser);
+static hubbub_error hubbub_tokeniser_set_compact_handler(
+		hubbub_tokeniser *tokeniser,
+		const hubbub_tokeniser_optparams *params);
+static hubbub_error hubbub_tokeniser_emit_compact(
+		hubbub_tokeniser *tokeniser, const hubbub_token *token);
+static hubbub_error hubbub_tokeniser_tokenise(hubbub_tokeniser *tokeniser);
+static bool hubbub_tokeniser_can_speculate(hubbub_tokeniser *tokeniser);
+static hubbub_error hubbub_tokeniser_speculate(hubbub_tokeniser *tokeniser);
+static bool hubbub_tokeniser_can_pipeline(hubbub_tokeniser *tokeniser);
+static hubbub_error hubbub_tokeniser_pipeline(hubbub_tokeniser *tokeniser);
 
 /**
  * Create a hubbub tokeniser
@@ -319,21 +478,47 @@ hubbub_error hubbub_tokeniser_create(parserutils_inputstream *input,
 
 	tok->escape_flag = false;
 	tok->process_cdata_section = false;
+	tok->track_position = false;
+	tok->drop_comments = false;
+	tok->keep_source = false;
+	tok->raw_values = false;
+	tok->token_limit = (size_t) -1;
+	tok->budget.tokens = 0;
+	tok->budget.bytes = 0;
+	tok->budget.spent_tokens = 0;
+	tok->budget.spent_bytes = 0;
 
 	tok->paused = false;
+	tok->stopped = false;
+	tok->threads = 0;
+	tok->pipeline = false;
+	tok->speculating = false;
 
 	tok->input = input;
 
+	tok->borrowing = false;
+	memset(&tok->borrowed, 0, sizeof(tok->borrowed));
+
 	tok->token_handler = NULL;
 	tok->token_pw = NULL;
 
+	memset(&tok->batch, 0, sizeof(tok->batch));
+	memset(&tok->compact, 0, sizeof(tok->compact));
+
 	tok->error_handler = NULL;
 	tok->error_pw = NULL;
 
 	tok->alloc = alloc;
 	tok->alloc_pw = pw;
 
+#ifdef HUBBUB_WITH_STATS
+	tok->stats = NULL;
+#endif
+
 	memset(&tok->context, 0, sizeof(hubbub_tokeniser_context));
+	tok->context.position.line = 1;
+	tok->context.position.mark.line = 1;
+	tok->context.position.mark.col = 1;
 
 	*tokeniser = tok;
 
@@ -356,15 +541,119 @@ hubbub_error hubbub_tokeniser_destroy(hubbub_tokeniser *tokeniser)
 				0, tokeniser->alloc_pw);
 	}
 
+	if (tokeniser->context.attribute_src != NULL) {
+		tokeniser->alloc(tokeniser->context.attribute_src,
+				0, tokeniser->alloc_pw);
+	}
+
+	if (tokeniser->context.attribute_hash != NULL) {
+		tokeniser->alloc(tokeniser->context.attribute_hash,
+				0, tokeniser->alloc_pw);
+	}
+
 	parserutils_buffer_destroy(tokeniser->insert_buf);
 
 	parserutils_buffer_destroy(tokeniser->buffer);
 
+	if (tokeniser->borrowed.side != NULL)
+		parserutils_buffer_destroy(tokeniser->borrowed.side);
+	if (tokeniser->borrowed.own != NULL)
+		parserutils_buffer_destroy(tokeniser->borrowed.own);
+
+	if (tokeniser->batch.strings != NULL)
+		parserutils_buffer_destroy(tokeniser->batch.strings);
+	if (tokeniser->batch.tokens != NULL)
+		tokeniser->alloc(tokeniser->batch.tokens, 0,
+				tokeniser->alloc_pw);
+	if (tokeniser->batch.attrs != NULL)
+		tokeniser->alloc(tokeniser->batch.attrs, 0,
+				tokeniser->alloc_pw);
+
+	if (tokeniser->compact.strings != NULL)
+		parserutils_buffer_destroy(tokeniser->compact.strings);
+	if (tokeniser->compact.attrs != NULL)
+		tokeniser->alloc(tokeniser->compact.attrs, 0,
+				tokeniser->alloc_pw);
+
 	tokeniser->alloc(tokeniser, 0, tokeniser->alloc_pw);
 
 	return HUBBUB_OK;
 }
 
+/**
+ * Return a hubbub tokeniser to its initial state
+ *
+ * \param tokeniser  The tokeniser instance to reset
+ * \param input      Input stream to read from, from now on
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ *
+ * Options and handlers are kept, as is the memory allocated for buffers,
+ * attributes and batches. Any tokens batched but not yet delivered are
+ * discarded.
+ */
+hubbub_error hubbub_tokeniser_reset(hubbub_tokeniser *tokeniser,
+		parserutils_inputstream *input)
+{
+	hubbub_tokeniser_context *ctx;
+	hubbub_attribute *attributes;
+	hubbub_tokeniser_attribute_src *attribute_src;
+	uint32_t *attribute_hash;
+	uint32_t attribute_space;
+
+	if (tokeniser == NULL || input == NULL)
+		return HUBBUB_BADPARM;
+
+	ctx = &tokeniser->context;
+
+	attributes = ctx->current_tag.attributes;
+	attribute_src = ctx->attribute_src;
+	attribute_hash = ctx->attribute_hash;
+	attribute_space = ctx->attribute_space;
+
+	memset(ctx, 0, sizeof(hubbub_tokeniser_context));
+	ctx->current_tag.attributes = attributes;
+	ctx->attribute_src = attribute_src;
+	ctx->attribute_hash = attribute_hash;
+	ctx->attribute_space = attribute_space;
+	ctx->position.line = 1;
+	ctx->position.mark.line = 1;
+	ctx->position.mark.col = 1;
+
+	tokeniser->state = STATE_DATA;
+	tokeniser->content_model = HUBBUB_CONTENT_MODEL_PCDATA;
+
+	tokeniser->escape_flag = false;
+	tokeniser->process_cdata_section = false;
+
+	tokeniser->paused = false;
+	tokeniser->stopped = false;
+
+	tokeniser->input = input;
+	tokeniser->borrowing = false;
+	tokeniser->borrowed.in_side = false;
+	tokeniser->borrowed.copied = 0;
+	tokeniser->borrowed.passing = false;
+	tokeniser->borrowed.carry_len = 0;
+
+	parserutils_buffer_discard(tokeniser->buffer, 0,
+			tokeniser->buffer->length);
+	parserutils_buffer_discard(tokeniser->insert_buf, 0,
+			tokeniser->insert_buf->length);
+
+	tokeniser->batch.count = 0;
+	tokeniser->batch.n_attrs = 0;
+	if (tokeniser->batch.strings != NULL) {
+		parserutils_buffer_discard(tokeniser->batch.strings, 0,
+				tokeniser->batch.strings->length);
+	}
+	if (tokeniser->compact.strings != NULL) {
+		parserutils_buffer_discard(tokeniser->compact.strings, 0,
+				tokeniser->compact.strings->length);
+	}
+
+	return HUBBUB_OK;
+}
+
 /**
  * Configure a hubbub tokeniser
  *
@@ -397,6 +686,44 @@ hubbub_error hubbub_tokeniser_setopt(hubbub_tokeniser *tokeniser,
 	case HUBBUB_TOKENISER_PROCESS_CDATA:
 		tokeniser->process_cdata_section = params->process_cdata;
 		break;
+	case HUBBUB_TOKENISER_TRACK_POSITION:
+		tokeniser->track_position = params->track_position;
+		break;
+	case HUBBUB_TOKENISER_DROP_COMMENTS:
+		tokeniser->drop_comments = params->drop_comments;
+		break;
+	case HUBBUB_TOKENISER_KEEP_SOURCE:
+		tokeniser->keep_source = params->keep_source;
+		break;
+	case HUBBUB_TOKENISER_RAW_ATTRIBUTE_VALUES:
+		tokeniser->raw_values = params->raw_attribute_values;
+		break;
+	case HUBBUB_TOKENISER_TOKEN_LIMIT:
+		/* No limit is the same as the largest one */
+		tokeniser->token_limit = (params->token_limit == 0) ?
+				(size_t) -1 : params->token_limit;
+		break;
+	case HUBBUB_TOKENISER_TOKEN_BATCH_HANDLER:
+		err = hubbub_tokeniser_set_batch_handler(tokeniser, params);
+		break;
+	case HUBBUB_TOKENISER_COMPACT_TOKEN_HANDLER:
+		err = hubbub_tokeniser_set_compact_handler(tokeniser, params);
+		break;
+	case HUBBUB_TOKENISER_THREADS:
+		tokeniser->threads = params->threads;
+		break;
+	case HUBBUB_TOKENISER_PIPELINE:
+		tokeniser->pipeline = params->pipeline;
+		break;
+	case HUBBUB_TOKENISER_BUDGET:
+		tokeniser->budget.tokens = params->budget.tokens;
+		tokeniser->budget.bytes = params->budget.bytes;
+		break;
+	case HUBBUB_TOKENISER_STATS:
+#ifdef HUBBUB_WITH_STATS
+		tokeniser->stats = params->stats;
+#endif
+		break;
 	case HUBBUB_TOKENISER_PAUSE:
 		if (params->pause_parse == true) {
 			tokeniser->paused = true;
@@ -438,697 +765,3779 @@ hubbub_error hubbub_tokeniser_insert_chunk(hubbub_tokeniser *tokeniser,
 }
 
 /**
- * Process remaining data in the input stream
+ * Read the whole of the input from data owned by the client
  *
- * \param tokeniser  The tokeniser instance to invoke
+ * \param tokeniser  Tokeniser instance
+ * \param data       The input (valid UTF-8)
+ * \param len        Length, in bytes, of data
  * \return HUBBUB_OK on success, appropriate error otherwise
+ *
+ * The data is read in place, rather than through the input stream, so
+ * must remain unchanged until the tokeniser has finished with it, or is
+ * reset. No input may have been read from the input stream. Data inserted
+ * with hubbub_tokeniser_insert_chunk() is kept in a side buffer, which is
+ * read before the rest of the borrowed data.
  */
-hubbub_error hubbub_tokeniser_run(hubbub_tokeniser *tokeniser)
+hubbub_error hubbub_tokeniser_borrow(hubbub_tokeniser *tokeniser,
+		const uint8_t *data, size_t len)
 {
-	hubbub_error cont = HUBBUB_OK;
+	if (tokeniser == NULL || (data == NULL && len > 0))
+		return HUBBUB_BADPARM;
 
-	if (tokeniser == NULL)
+	if (tokeniser->borrowing)
 		return HUBBUB_BADPARM;
 
-	if (tokeniser->paused == true)
-		return HUBBUB_PAUSED;
+	tokeniser->borrowed.data = data;
+	tokeniser->borrowed.len = len;
+	tokeniser->borrowed.resume = 0;
+	tokeniser->borrowed.in_side = false;
+	tokeniser->borrowed.copied = 0;
 
-#if 0
-#define state(x) \
-		case x: \
-			printf( #x "\n");
-#else
-#define state(x) \
-		case x:
-#endif
+	/* The stream is never given to parserutils, so owns nothing */
+	tokeniser->borrowed.view.data = (uint8_t *) data;
+	tokeniser->borrowed.view.length = len;
+	tokeniser->borrowed.view.allocated = len;
+	tokeniser->borrowed.view.alloc = NULL;
+	tokeniser->borrowed.view.pw = NULL;
 
-	while (cont == HUBBUB_OK) {
-		switch (tokeniser->state) {
-		state(STATE_DATA)
-			cont = hubbub_tokeniser_handle_data(tokeniser);
-			break;
-		state(STATE_CHARACTER_REFERENCE_DATA)
-			cont = hubbub_tokeniser_handle_character_reference_data(
-					tokeniser);
-			break;
-		state(STATE_TAG_OPEN)
-			cont = hubbub_tokeniser_handle_tag_open(tokeniser);
-			break;
-		state(STATE_CLOSE_TAG_OPEN)
-			cont = hubbub_tokeniser_handle_close_tag_open(
-					tokeniser);
-			break;
-		state(STATE_TAG_NAME)
-			cont = hubbub_tokeniser_handle_tag_name(tokeniser);
-			break;
-		state(STATE_BEFORE_ATTRIBUTE_NAME)
-			cont = hubbub_tokeniser_handle_before_attribute_name(
-					tokeniser);
-			break;
-		state(STATE_ATTRIBUTE_NAME)
-			cont = hubbub_tokeniser_handle_attribute_name(
-					tokeniser);
-			break;
-		state(STATE_AFTER_ATTRIBUTE_NAME)
-			cont = hubbub_tokeniser_handle_after_attribute_name(
-					tokeniser);
-			break;
-		state(STATE_BEFORE_ATTRIBUTE_VALUE)
-			cont = hubbub_tokeniser_handle_before_attribute_value(
-					tokeniser);
-			break;
-		state(STATE_ATTRIBUTE_VALUE_DQ)
-			cont = hubbub_tokeniser_handle_attribute_value_dq(
-					tokeniser);
-			break;
-		state(STATE_ATTRIBUTE_VALUE_SQ)
-			cont = hubbub_tokeniser_handle_attribute_value_sq(
-					tokeniser);
-			break;
-		state(STATE_ATTRIBUTE_VALUE_UQ)
-			cont = hubbub_tokeniser_handle_attribute_value_uq(
-					tokeniser);
-			break;
-		state(STATE_CHARACTER_REFERENCE_IN_ATTRIBUTE_VALUE)
-			cont = hubbub_tokeniser_handle_character_reference_in_attribute_value(
-					tokeniser);
-			break;
-		state(STATE_AFTER_ATTRIBUTE_VALUE_Q)
-			cont = hubbub_tokeniser_handle_after_attribute_value_q(
-					tokeniser);
-			break;
-		state(STATE_SELF_CLOSING_START_TAG)
-			cont = hubbub_tokeniser_handle_self_closing_start_tag(
-					tokeniser);
-			break;
-		state(STATE_BOGUS_COMMENT)
-			cont = hubbub_tokeniser_handle_bogus_comment(
-					tokeniser);
-			break;
-		state(STATE_MARKUP_DECLARATION_OPEN)
-			cont = hubbub_tokeniser_handle_markup_declaration_open(
-					tokeniser);
-			break;
-		state(STATE_MATCH_COMMENT)
-			cont = hubbub_tokeniser_handle_match_comment(
-					tokeniser);
-			break;
-		case STATE_COMMENT_START:
-		case STATE_COMMENT_START_DASH:
-		case STATE_COMMENT:
-		case STATE_COMMENT_END_DASH:
-		case STATE_COMMENT_END:
-			cont = hubbub_tokeniser_handle_comment(tokeniser);
-			break;
-		state(STATE_MATCH_DOCTYPE)
-			cont = hubbub_tokeniser_handle_match_doctype(
-					tokeniser);
-			break;
-		state(STATE_DOCTYPE)
-			cont = hubbub_tokeniser_handle_doctype(tokeniser);
-			break;
-		state(STATE_BEFORE_DOCTYPE_NAME)
-			cont = hubbub_tokeniser_handle_before_doctype_name(
-					tokeniser);
-			break;
-		state(STATE_DOCTYPE_NAME)
-			cont = hubbub_tokeniser_handle_doctype_name(
-					tokeniser);
-			break;
-		state(STATE_AFTER_DOCTYPE_NAME)
-			cont = hubbub_tokeniser_handle_after_doctype_name(
-					tokeniser);
-			break;
+	tokeniser->borrowed.stream.utf8 = &tokeniser->borrowed.view;
+	tokeniser->borrowed.stream.cursor = 0;
+	tokeniser->borrowed.stream.had_eof = true;
 
-		state(STATE_MATCH_PUBLIC)
-			cont = hubbub_tokeniser_handle_match_public(
-					tokeniser);
-			break;
-		state(STATE_BEFORE_DOCTYPE_PUBLIC)
-			cont = hubbub_tokeniser_handle_before_doctype_public(
-					tokeniser);
-			break;
-		state(STATE_DOCTYPE_PUBLIC_DQ)
-			cont = hubbub_tokeniser_handle_doctype_public_dq(
-					tokeniser);
-			break;
-		state(STATE_DOCTYPE_PUBLIC_SQ)
-			cont = hubbub_tokeniser_handle_doctype_public_sq(
-					tokeniser);
-			break;
-		state(STATE_AFTER_DOCTYPE_PUBLIC)
-			cont = hubbub_tokeniser_handle_after_doctype_public(
-					tokeniser);
-			break;
-		state(STATE_MATCH_SYSTEM)
-			cont = hubbub_tokeniser_handle_match_system(
-					tokeniser);
-			break;
-		state(STATE_BEFORE_DOCTYPE_SYSTEM)
-			cont = hubbub_tokeniser_handle_before_doctype_system(
-					tokeniser);
-			break;
-		state(STATE_DOCTYPE_SYSTEM_DQ)
-			cont = hubbub_tokeniser_handle_doctype_system_dq(
-					tokeniser);
-			break;
-		state(STATE_DOCTYPE_SYSTEM_SQ)
-			cont = hubbub_tokeniser_handle_doctype_system_sq(
-					tokeniser);
-			break;
-		state(STATE_AFTER_DOCTYPE_SYSTEM)
-			cont = hubbub_tokeniser_handle_after_doctype_system(
-					tokeniser);
-			break;
-		state(STATE_BOGUS_DOCTYPE)
-			cont = hubbub_tokeniser_handle_bogus_doctype(
-					tokeniser);
-			break;
-		state(STATE_MATCH_CDATA)
-			cont = hubbub_tokeniser_handle_match_cdata(
-					tokeniser);
-			break;
-		state(STATE_CDATA_BLOCK)
-			cont = hubbub_tokeniser_handle_cdata_block(
-					tokeniser);
-			break;
-		state(STATE_NUMBERED_ENTITY)
-			cont = hubbub_tokeniser_handle_numbered_entity(
-					tokeniser);
-			break;
-		state(STATE_NAMED_ENTITY)
-			cont = hubbub_tokeniser_handle_named_entity(
-					tokeniser);
-			break;
-		}
-	}
+	tokeniser->input = &tokeniser->borrowed.stream;
+	tokeniser->borrowing = true;
 
-	return (cont == HUBBUB_NEEDDATA) ? HUBBUB_OK : cont;
+	return HUBBUB_OK;
 }
 
-
 /**
- * Various macros for manipulating buffers.
+ * Add data to the end of the input passed through
  *
- * \todo make some of these inline functions (type-safety)
- * \todo document them properly here
+ * \param tokeniser  Tokeniser instance
+ * \param data       Data to add (valid UTF-8)
+ * \param len        Length, in bytes, of data
+ * \return HUBBUB_OK on success, appropriate error otherwise
  */
+static hubbub_error hubbub_tokeniser_pass(hubbub_tokeniser *tokeniser,
+		const uint8_t *data, size_t len)
+{
+	parserutils_error perror;
 
-#define START_BUF(str, cptr, length) \
-	do { \
-		parserutils_error perror; \
-		perror = parserutils_buffer_append(tokeniser->buffer, \
-				(uint8_t *) (cptr), (length)); \
-		if (perror != PARSERUTILS_OK) \
-			return hubbub_error_from_parserutils_error(perror); \
-		(str).len = (length); \
-	} while (0)
+	if (len == 0)
+		return HUBBUB_OK;
 
-#define COLLECT(str, cptr, length) \
-	do { \
-		parserutils_error perror; \
-		assert(str.len != 0); \
-		perror = parserutils_buffer_append(tokeniser->buffer, \
-				(uint8_t *) (cptr), (length)); \
-		if (perror != PARSERUTILS_OK) \
-			return hubbub_error_from_parserutils_error(perror); \
-		(str).len += (length); \
-	} while (0)
+	if (tokeniser->borrowed.started == false) {
+		tokeniser->borrowed.started = true;
 
-#define COLLECT_MS(str, cptr, length) \
-	do { \
-		parserutils_error perror; \
-		perror = parserutils_buffer_append(tokeniser->buffer, \
-				(uint8_t *) (cptr), (length)); \
-		if (perror != PARSERUTILS_OK) \
-			return hubbub_error_from_parserutils_error(perror); \
-		(str).len += (length); \
-	} while (0)
+		/* The input stream would strip a BOM. Being a complete
+		 * character, it arrives in the one piece. */
+		if (len >= 3 && data[0] == 0xEF && data[1] == 0xBB &&
+				data[2] == 0xBF) {
+			data += 3;
+			len -= 3;
+		}
+	}
 
+	perror = parserutils_buffer_append(tokeniser->borrowed.own, data, len);
+	if (perror != PARSERUTILS_OK)
+		return hubbub_error_from_parserutils_error(perror);
 
-/* this should always be called with an empty "chars" buffer */
-hubbub_error hubbub_tokeniser_handle_data(hubbub_tokeniser *tokeniser)
-{
-	parserutils_error error;
-	hubbub_token token;
-	const uint8_t *cptr;
-	size_t len;
+	return HUBBUB_OK;
+}
 
-	while ((error = parserutils_inputstream_peek(tokeniser->input,
-			tokeniser->context.pending, &cptr, &len)) ==
-					PARSERUTILS_OK) {
-		const uint8_t c = *cptr;
+/**
+ * Add UTF-8 to the end of the input passed through, replacing invalid
+ * sequences with U+FFFD
+ *
+ * \param tokeniser  Tokeniser instance
+ * \param data       Data to add
+ * \param len        Length, in bytes, of data
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ *
+ * A character which is cut short by the end of the data is carried over
+ * to the next call.
+ */
+static hubbub_error hubbub_tokeniser_pass_utf8(hubbub_tokeniser *tokeniser,
+		const uint8_t *data, size_t len)
+{
+	uint8_t *carry = tokeniser->borrowed.carry;
+	hubbub_utf8_sequence seq;
+	hubbub_error error;
+	size_t n;
+
+	/* Complete the character carried over, a byte at a time */
+	while (tokeniser->borrowed.carry_len > 0 && len > 0) {
+		carry[tokeniser->borrowed.carry_len++] = *data++;
+		len--;
+
+		seq = hubbub_scan_utf8_sequence(carry,
+				tokeniser->borrowed.carry_len, &n);
+		if (seq == HUBBUB_UTF8_TRUNCATED)
+			continue;
+
+		if (seq == HUBBUB_UTF8_VALID) {
+			error = hubbub_tokeniser_pass(tokeniser, carry, n);
+		} else {
+			/* The byte just taken ended the maximal subpart,
+			 * and is looked at afresh below */
+			error = hubbub_tokeniser_pass(tokeniser, u_fffd,
+					sizeof(u_fffd));
+			data--;
+			len++;
+		}
+		if (error != HUBBUB_OK)
+			return error;
 
-		if (c == '&' &&
-				(tokeniser->content_model == HUBBUB_CONTENT_MODEL_PCDATA ||
-				tokeniser->content_model == HUBBUB_CONTENT_MODEL_RCDATA) &&
-				tokeniser->escape_flag == false) {
-			tokeniser->state =
-					STATE_CHARACTER_REFERENCE_DATA;
-			/* Don't eat the '&'; it'll be handled by entity
-			 * consumption */
-			break;
-		} else if (c == '-' &&
-				tokeniser->escape_flag == false &&
-				(tokeniser->content_model ==
-						HUBBUB_CONTENT_MODEL_RCDATA ||
-				tokeniser->content_model ==
-						HUBBUB_CONTENT_MODEL_CDATA) &&
-				tokeniser->context.pending >= 3) {
-			size_t ignore;
-			error = parserutils_inputstream_peek(
-					tokeniser->input,
-					tokeniser->context.pending - 3,
-					&cptr,
-					&ignore);
+		tokeniser->borrowed.carry_len = 0;
+	}
 
-			assert(error == PARSERUTILS_OK);
+	while (len > 0) {
+		/* The bulk of the data is expected to be valid */
+		n = hubbub_scan_utf8_valid(data, len);
 
-			if (strncmp((char *)cptr,
-					"<!--", SLEN("<!--")) == 0) {
-				tokeniser->escape_flag = true;
-			}
+		error = hubbub_tokeniser_pass(tokeniser, data, n);
+		if (error != HUBBUB_OK)
+			return error;
 
-			tokeniser->context.pending += len;
-		} else if (c == '<' && (tokeniser->content_model ==
-						HUBBUB_CONTENT_MODEL_PCDATA ||
-					((tokeniser->content_model ==
-						HUBBUB_CONTENT_MODEL_RCDATA ||
-					tokeniser->content_model ==
-						HUBBUB_CONTENT_MODEL_CDATA) &&
-				tokeniser->escape_flag == false))) {
-			if (tokeniser->context.pending > 0) {
-				/* Emit any pending characters */
-				emit_current_chars(tokeniser);
-			}
+		data += n;
+		len -= n;
+		if (len == 0)
+			break;
 
-			/* Buffer '<' */
-			tokeniser->context.pending = len;
-			tokeniser->state = STATE_TAG_OPEN;
+		seq = hubbub_scan_utf8_sequence(data, len, &n);
+		if (seq == HUBBUB_UTF8_TRUNCATED) {
+			memcpy(carry, data, n);
+			tokeniser->borrowed.carry_len = n;
 			break;
-		} else if (c == '>' && tokeniser->escape_flag == true &&
-				(tokeniser->content_model ==
-						HUBBUB_CONTENT_MODEL_RCDATA ||
-				tokeniser->content_model ==
-						HUBBUB_CONTENT_MODEL_CDATA)) {
-			/* no need to check that there are enough characters,
-			 * since you can only run into this if the flag is
-			 * true in the first place, which requires four
-			 * characters. */
-			error = parserutils_inputstream_peek(
-					tokeniser->input,
-					tokeniser->context.pending - 2,
-					&cptr,
-					&len);
+		}
 
-			assert(error == PARSERUTILS_OK);
+		error = hubbub_tokeniser_pass(tokeniser, u_fffd,
+				sizeof(u_fffd));
+		if (error != HUBBUB_OK)
+			return error;
 
-			if (strncmp((char *) cptr, "-->", SLEN("-->")) == 0) {
-				tokeniser->escape_flag = false;
-			}
+		data += n;
+		len -= n;
+	}
 
-			tokeniser->context.pending += len;
-		} else if (c == '\0') {
-			if (tokeniser->context.pending > 0) {
-				/* Emit any pending characters */
-				emit_current_chars(tokeniser);
-			}
+	return HUBBUB_OK;
+}
+
+/**
+ * Start passing input through, in place of reading the input stream
+ *
+ * \param tokeniser  Tokeniser instance
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ */
+static hubbub_error hubbub_tokeniser_start_passing(
+		hubbub_tokeniser *tokeniser)
+{
+	parserutils_inputstream *input = &tokeniser->borrowed.stream;
+	parserutils_error perror;
 
-			/* Emit a replacement character */
-			emit_character_token(tokeniser, &u_fffd_str);
+	if (tokeniser->borrowed.own == NULL) {
+		perror = parserutils_buffer_create(tokeniser->alloc,
+				tokeniser->alloc_pw, &tokeniser->borrowed.own);
+		if (perror != PARSERUTILS_OK)
+			return hubbub_error_from_parserutils_error(perror);
+	}
 
-			/* Advance past NUL */
-			parserutils_inputstream_advance(tokeniser->input, 1);
-		} else if (c == '\r') {
-			error = parserutils_inputstream_peek(
-					tokeniser->input,
-					tokeniser->context.pending + len,
-					&cptr,
-					&len);
+	parserutils_buffer_discard(tokeniser->borrowed.own, 0,
+			tokeniser->borrowed.own->length);
+	tokeniser->borrowed.own_offset = 0;
 
-			if (error != PARSERUTILS_OK && 
-					error != PARSERUTILS_EOF) {
-				break;
-			}
+	tokeniser->borrowed.resume = 0;
+	tokeniser->borrowed.in_side = false;
+	tokeniser->borrowed.copied = 0;
+	tokeniser->borrowed.passing = true;
+	tokeniser->borrowed.started = false;
+	tokeniser->borrowed.carry_len = 0;
 
-			if (tokeniser->context.pending > 0) {
-				/* Emit any pending characters */
-				emit_current_chars(tokeniser);
-			}
+	tokeniser->borrowed.view.alloc = NULL;
+	tokeniser->borrowed.view.pw = NULL;
 
-			if (error == PARSERUTILS_EOF ||	*cptr != '\n') {
-				/* Emit newline */
-				emit_character_token(tokeniser, &lf_str);
-			}
+	input->utf8 = &tokeniser->borrowed.view;
+	input->cursor = 0;
+	input->had_eof = false;
 
-			/* Advance over */
-			parserutils_inputstream_advance(tokeniser->input, 1);
-		} else {
-			/* Just collect into buffer */
-			tokeniser->context.pending += len;
-		}
+	tokeniser->input = input;
+	tokeniser->borrowing = true;
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Bring the view of the data passed through up to date
+ *
+ * \param tokeniser  Tokeniser instance
+ */
+static void hubbub_tokeniser_view_own(hubbub_tokeniser *tokeniser)
+{
+	parserutils_buffer *own = tokeniser->borrowed.own;
+
+	tokeniser->borrowed.data = own->data;
+	tokeniser->borrowed.len = own->length;
+	if (tokeniser->borrowed.in_side == false) {
+		tokeniser->borrowed.view.data = own->data;
+		tokeniser->borrowed.view.length = own->length;
+		tokeniser->borrowed.view.allocated = own->length;
 	}
+}
 
-	if (tokeniser->state != STATE_TAG_OPEN &&
-		(tokeniser->state != STATE_DATA || error == PARSERUTILS_EOF) &&
-			tokeniser->context.pending > 0) {
-		/* Emit any pending characters */
-		emit_current_chars(tokeniser);
+/**
+ * Append data to the input, passing it through rather than reading it
+ * from the input stream
+ *
+ * \param tokeniser  Tokeniser instance
+ * \param data       Data to append (UTF-8), or NULL to flag the end of the
+ *                   input
+ * \param len        Length, in bytes, of data
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ *
+ * This is for input which is known to be UTF-8, so has no need of the
+ * input stream's charset detection and conversion. The data is validated
+ * in bulk, with invalid sequences replaced by U+FFFD, and read in the same
+ * way as borrowed data, from a buffer of our own. No input may have been
+ * read from the input stream, unless hubbub_tokeniser_switch_input() has
+ * been used to move on from it, and no data may have been borrowed. Data
+ * appended after the end of the input is ignored.
+ */
+hubbub_error hubbub_tokeniser_append(hubbub_tokeniser *tokeniser,
+		const uint8_t *data, size_t len)
+{
+	parserutils_inputstream *input;
+	hubbub_error error;
+	size_t used;
+
+	if (tokeniser == NULL || (data == NULL && len > 0))
+		return HUBBUB_BADPARM;
+
+	if (tokeniser->borrowing == false) {
+		error = hubbub_tokeniser_start_passing(tokeniser);
+		if (error != HUBBUB_OK)
+			return error;
+	} else if (tokeniser->borrowed.passing == false) {
+		return HUBBUB_BADPARM;
 	}
 
-	if (error == PARSERUTILS_EOF) {
-		token.type = HUBBUB_TOKEN_EOF;
-		hubbub_tokeniser_emit_token(tokeniser, &token);
+	input = &tokeniser->borrowed.stream;
+	if (input->had_eof)
+		return HUBBUB_OK;
+
+	/* Drop what has been read, and copied into the side buffer, once it
+	 * is at least as much as what remains. A long token arriving in
+	 * small chunks is then moved down the buffer only as often as it
+	 * doubles in length, rather than for every chunk. */
+	used = tokeniser->borrowed.in_side ? tokeniser->borrowed.resume :
+			input->cursor;
+	if (tokeniser->keep_source && used >
+			tokeniser->context.position.mark.start -
+			tokeniser->borrowed.own_offset) {
+		/* Keep the source of the current token */
+		used = tokeniser->context.position.mark.start -
+				tokeniser->borrowed.own_offset;
+	}
+	if (used > 0 && used >= tokeniser->borrowed.own->length - used) {
+		parserutils_buffer_discard(tokeniser->borrowed.own, 0, used);
+		tokeniser->borrowed.own_offset += used;
+		if (tokeniser->borrowed.in_side)
+			tokeniser->borrowed.resume -= used;
+		else
+			input->cursor -= used;
 	}
 
-	if (error == PARSERUTILS_EOF) {
-		return HUBBUB_NEEDDATA;
+	if (data != NULL) {
+		error = hubbub_tokeniser_pass_utf8(tokeniser, data, len);
 	} else {
-		return hubbub_error_from_parserutils_error(error);
+		/* A character cut short by the end is invalid */
+		error = HUBBUB_OK;
+		if (tokeniser->borrowed.carry_len > 0) {
+			error = hubbub_tokeniser_pass(tokeniser, u_fffd,
+					sizeof(u_fffd));
+			tokeniser->borrowed.carry_len = 0;
+		}
+		input->had_eof = true;
 	}
+
+	hubbub_tokeniser_view_own(tokeniser);
+
+	return error;
 }
 
-/* emit any pending tokens before calling */
-hubbub_error hubbub_tokeniser_handle_character_reference_data(
-		hubbub_tokeniser *tokeniser)
+/**
+ * Move on from the input stream to another, part way through the input
+ *
+ * \param tokeniser  Tokeniser instance
+ * \param input      Input stream to read the rest of the input from, or
+ *                   NULL to read it from data passed through
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ *
+ * This is for when the input's charset is found to differ from the one it
+ * is being decoded as, but the input so far decodes identically in both.
+ * The input which the current stream has yet to deliver is decoded with
+ * the old charset and carried over, ahead of anything given to the new
+ * stream (or to hubbub_tokeniser_append()). The old stream is then no
+ * longer used, and may be destroyed.
+ */
+hubbub_error hubbub_tokeniser_switch_input(hubbub_tokeniser *tokeniser,
+		parserutils_inputstream *input)
 {
-	assert(tokeniser->context.pending == 0);
-
-	if (tokeniser->context.match_entity.complete == false) {
-		return hubbub_tokeniser_consume_character_reference(tokeniser,
-				tokeniser->context.pending);
-	} else {
-		hubbub_token token;
+	parserutils_inputstream *old;
+	parserutils_error perror;
+	const uint8_t *c;
+	size_t off, len;
+	hubbub_error error;
 
-		uint8_t utf8[6];
-		uint8_t *utf8ptr = utf8;
-		size_t len = sizeof(utf8);
+	if (tokeniser == NULL || tokeniser->borrowing)
+		return HUBBUB_BADPARM;
 
-		token.type = HUBBUB_TOKEN_CHARACTER;
+	old = tokeniser->input;
 
-		if (tokeniser->context.match_entity.codepoint) {
-			parserutils_charset_utf8_from_ucs4(
-				tokeniser->context.match_entity.codepoint,
-				&utf8ptr, &len);
+	/* Have the old stream decode everything it holds */
+	for (off = 0; (perror = parserutils_inputstream_peek(old, off,
+			&c, &len)) == PARSERUTILS_OK; off += len)
+		;
+	if (perror != PARSERUTILS_EOF && perror != PARSERUTILS_NEEDDATA)
+		return hubbub_error_from_parserutils_error(perror);
 
-			token.data.character.ptr = utf8;
-			token.data.character.len = sizeof(utf8) - len;
+	c = old->utf8->data + old->cursor;
+	len = old->utf8->length - old->cursor;
 
-			hubbub_tokeniser_emit_token(tokeniser, &token);
+	if (input != NULL) {
+		/* Already decoded, so bypass the new stream's decoder */
+		perror = parserutils_inputstream_insert(input, c, len);
+		if (perror == PARSERUTILS_OK && old->had_eof)
+			perror = parserutils_inputstream_append(input,
+					NULL, 0);
+		if (perror != PARSERUTILS_OK)
+			return hubbub_error_from_parserutils_error(perror);
 
-			/* +1 for ampersand */
-			parserutils_inputstream_advance(tokeniser->input,
-					tokeniser->context.match_entity.length
-							+ 1);
-		} else {
-			parserutils_error error;
-			const uint8_t *cptr = NULL;
+		tokeniser->input = input;
 
-			error = parserutils_inputstream_peek(
-					tokeniser->input,
-					tokeniser->context.pending,
-					&cptr,
-					&len);
-			if (error != PARSERUTILS_OK) {
-				return hubbub_error_from_parserutils_error(
-						error);
-			}
+		return HUBBUB_OK;
+	}
 
-			token.data.character.ptr = cptr;
-			token.data.character.len = len;
+	error = hubbub_tokeniser_start_passing(tokeniser);
+	if (error != HUBBUB_OK)
+		return error;
 
-			hubbub_tokeniser_emit_token(tokeniser, &token);
-			parserutils_inputstream_advance(tokeniser->input, len);
-		}
+	/* This is not the start of the input, so has no BOM to strip */
+	tokeniser->borrowed.started = true;
+	tokeniser->borrowed.stream.had_eof = old->had_eof;
 
-		/* Reset for next time */
-		tokeniser->context.match_entity.complete = false;
+	error = hubbub_tokeniser_pass(tokeniser, c, len);
 
-		tokeniser->state = STATE_DATA;
-	}
+	hubbub_tokeniser_view_own(tokeniser);
 
-	return HUBBUB_OK;
+	return error;
 }
 
-/* this state always switches to another state straight away */
-/* this state expects the current character to be '<' */
-hubbub_error hubbub_tokeniser_handle_tag_open(hubbub_tokeniser *tokeniser)
+/**
+ * Save the tokeniser's state, where it is between tokens
+ *
+ * \param tokeniser   Tokeniser instance
+ * \param checkpoint  Pointer to location to receive the state
+ * \return HUBBUB_OK on success,
+ *         HUBBUB_BADPARM on bad parameters,
+ *         HUBBUB_INVALID if the state may not be saved here
+ *
+ * The state may only be saved while reading borrowed data, in the data
+ * state, with no characters pending and nothing inserted left to read:
+ * that is, once a tag, comment or doctype has been emitted. What remains
+ * is the offset in the input and the little state which outlasts a token.
+ */
+hubbub_error hubbub_tokeniser_save(hubbub_tokeniser *tokeniser,
+		hubbub_tokeniser_checkpoint *checkpoint)
 {
-	hubbub_tag *ctag = &tokeniser->context.current_tag;
-
-	size_t len;
-	const uint8_t *cptr;
-	parserutils_error error;
-	uint8_t c;
+	hubbub_tokeniser_context *ctx;
 
-	assert(tokeniser->context.pending == 1);
-/*	assert(tokeniser->context.chars.ptr[0] == '<'); */
+	if (tokeniser == NULL || checkpoint == NULL)
+		return HUBBUB_BADPARM;
 
-	error = parserutils_inputstream_peek(tokeniser->input, 
-			tokeniser->context.pending, &cptr, &len);
+	ctx = &tokeniser->context;
 
-	if (error != PARSERUTILS_OK) {
-		if (error == PARSERUTILS_EOF) {
-			/* Return to data state with '<' still in "chars" */
-			tokeniser->state = STATE_DATA;
-			return HUBBUB_OK;
-		} else {
-			return hubbub_error_from_parserutils_error(error);
-		}
-	}
+	if (tokeniser->borrowing == false ||
+			tokeniser->borrowed.passing ||
+			tokeniser->borrowed.in_side ||
+			tokeniser->speculating ||
+			tokeniser->stopped ||
+			tokeniser->state != STATE_DATA ||
+			ctx->pending > 0 ||
+			ctx->incomplete ||
+			tokeniser->insert_buf->length > 0 ||
+			tokeniser->batch.count > 0)
+		return HUBBUB_INVALID;
 
-	c = *cptr;
+	checkpoint->offset = tokeniser->input->cursor;
 
-	if (c == '/') {
-		tokeniser->context.pending += len;
+	checkpoint->content_model = tokeniser->content_model;
+	checkpoint->escape_flag = tokeniser->escape_flag;
+	checkpoint->process_cdata_section = tokeniser->process_cdata_section;
 
-		tokeniser->context.close_tag_match.match = false;
-		tokeniser->context.close_tag_match.count = 0;
+	memcpy(checkpoint->last_start_tag_name, ctx->last_start_tag_name,
+			sizeof(ctx->last_start_tag_name));
+	checkpoint->last_start_tag_len = ctx->last_start_tag_len;
+	checkpoint->dashes = ctx->chars.dashes;
 
-		tokeniser->state = STATE_CLOSE_TAG_OPEN;
-	} else if (tokeniser->content_model == HUBBUB_CONTENT_MODEL_RCDATA ||
-			tokeniser->content_model ==
-					HUBBUB_CONTENT_MODEL_CDATA) {
-		/* Return to data state with '<' still in "chars" */
-		tokeniser->state = STATE_DATA;
-	} else if (tokeniser->content_model == HUBBUB_CONTENT_MODEL_PCDATA) {
-		if (c == '!') {
-			parserutils_inputstream_advance(tokeniser->input,
-					SLEN("<!"));
+	checkpoint->position.offset = ctx->position.offset;
+	checkpoint->position.line = ctx->position.line;
+	checkpoint->position.line_start = ctx->position.line_start;
+	checkpoint->position.after_cr = ctx->position.after_cr;
 
-			tokeniser->context.pending = 0;
-			tokeniser->state = STATE_MARKUP_DECLARATION_OPEN;
-		} else if ('A' <= c && c <= 'Z') {
-			uint8_t lc = (c + 0x20);
+	return HUBBUB_OK;
+}
 
-			START_BUF(ctag->name, &lc, len);
-			ctag->n_attributes = 0;
-			tokeniser->context.current_tag_type =
-					HUBBUB_TOKEN_START_TAG;
+/**
+ * Resume tokenising borrowed input from a saved state
+ *
+ * \param tokeniser   Tokeniser instance, which has just borrowed its input
+ * \param checkpoint  State to resume from
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ *
+ * The input need not be the one the state was saved from, but is read from
+ * the same offset, so must be the same up to there. Nothing may have been
+ * read since the input was borrowed.
+ */
+hubbub_error hubbub_tokeniser_restore(hubbub_tokeniser *tokeniser,
+		const hubbub_tokeniser_checkpoint *checkpoint)
+{
+	hubbub_tokeniser_context *ctx;
 
-			tokeniser->context.pending += len;
+	if (tokeniser == NULL || checkpoint == NULL)
+		return HUBBUB_BADPARM;
 
-			tokeniser->state = STATE_TAG_NAME;
-		} else if ('a' <= c && c <= 'z') {
-			START_BUF(ctag->name, cptr, len);
-			ctag->n_attributes = 0;
-			tokeniser->context.current_tag_type =
-					HUBBUB_TOKEN_START_TAG;
+	ctx = &tokeniser->context;
 
-			tokeniser->context.pending += len;
+	if (tokeniser->borrowing == false || tokeniser->borrowed.passing ||
+			tokeniser->input->cursor != 0 ||
+			checkpoint->offset > tokeniser->borrowed.len)
+		return HUBBUB_BADPARM;
 
-			tokeniser->state = STATE_TAG_NAME;
-		} else if (c == '>') {
-			/** \todo parse error */
+	tokeniser->input->cursor = checkpoint->offset;
 
-			tokeniser->context.pending += len;
-			tokeniser->state = STATE_DATA;
-		} else if (c == '?') {
-			/** \todo parse error */
+	tokeniser->state = STATE_DATA;
+	tokeniser->content_model = checkpoint->content_model;
+	tokeniser->escape_flag = checkpoint->escape_flag;
+	tokeniser->process_cdata_section = checkpoint->process_cdata_section;
 
-			/* Cursor still at "<", need to advance past it */
-			parserutils_inputstream_advance(
-					tokeniser->input, SLEN("<"));
-			tokeniser->context.pending = 0;
+	memcpy(ctx->last_start_tag_name, checkpoint->last_start_tag_name,
+			sizeof(ctx->last_start_tag_name));
+	ctx->last_start_tag_len = checkpoint->last_start_tag_len;
+	ctx->chars.dashes = checkpoint->dashes;
 
-			tokeniser->state = STATE_BOGUS_COMMENT;
-		} else {
-			/* Return to data state with '<' still in "chars" */
-			tokeniser->state = STATE_DATA;
-		}
-	}
+	ctx->position.offset = checkpoint->position.offset;
+	ctx->position.line = checkpoint->position.line;
+	ctx->position.line_start = checkpoint->position.line_start;
+	ctx->position.after_cr = checkpoint->position.after_cr;
 
 	return HUBBUB_OK;
 }
 
-/* this state expects tokeniser->context.chars to be "</" */
-/* this state never stays in this state for more than one character */
-hubbub_error hubbub_tokeniser_handle_close_tag_open(hubbub_tokeniser *tokeniser)
-{
+/**
+ * Determine whether two saved states tokenise what follows alike
+ *
+ * \param a  A saved state
+ * \param b  Another saved state
+ * \return true if the same input, following either, gives the same tokens
+ *
+ * The offsets and positions at which the states were saved are ignored.
+ */
+bool hubbub_tokeniser_same_state(const hubbub_tokeniser_checkpoint *a,
+		const hubbub_tokeniser_checkpoint *b)
+{
+	return a->content_model == b->content_model &&
+			a->escape_flag == b->escape_flag &&
+			a->process_cdata_section ==
+					b->process_cdata_section &&
+			a->last_start_tag_len == b->last_start_tag_len &&
+			memcmp(a->last_start_tag_name, b->last_start_tag_name,
+					a->last_start_tag_len) == 0 &&
+			a->dashes == b->dashes;
+}
+
+/**
+ * Find the input buffered but not yet read
+ *
+ * \param tokeniser  Tokeniser instance
+ * \param data       Pointer to location to receive the first run of input
+ * \param len        Pointer to location to receive its length, in bytes
+ * \param more       Pointer to location to receive the run which follows,
+ *                   if any, else NULL
+ * \param more_len   Pointer to location to receive its length, in bytes
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ *
+ * The input is UTF-8, and belongs to the tokeniser, so is only valid
+ * until it next reads any. Inserted data still to be read comes first,
+ * followed by the rest of the borrowed data. Input read through the input
+ * stream is decoded first, as far as it has been given, so all of it is
+ * included, but it is then held decoded until the tokeniser reads it.
+ */
+hubbub_error hubbub_tokeniser_remainder(hubbub_tokeniser *tokeniser,
+		const uint8_t **data, size_t *len,
+		const uint8_t **more, size_t *more_len)
+{
+	parserutils_inputstream *input;
+	parserutils_error perror;
+	const uint8_t *c;
+	size_t off, clen;
+
+	if (tokeniser == NULL || data == NULL || len == NULL ||
+			more == NULL || more_len == NULL)
+		return HUBBUB_BADPARM;
+
+	input = tokeniser->input;
+
+	if (tokeniser->borrowing == false) {
+		/* Have the stream decode everything it holds, not just
+		 * what it has decoded so far */
+		for (off = 0; (perror = parserutils_inputstream_peek(input,
+				off, &c, &clen)) == PARSERUTILS_OK;
+				off += clen)
+			;
+		if (perror != PARSERUTILS_EOF &&
+				perror != PARSERUTILS_NEEDDATA)
+			return hubbub_error_from_parserutils_error(perror);
+	}
+
+	*data = input->utf8->data + input->cursor;
+	*len = input->utf8->length - input->cursor;
+	*more = NULL;
+	*more_len = 0;
+
+	if (tokeniser->borrowing && tokeniser->borrowed.in_side) {
+		/* The borrowed data copied after what was inserted is read
+		 * from where it was copied from */
+		size_t copied = tokeniser->borrowed.copied;
+		size_t from = tokeniser->borrowed.resume - copied;
+
+		if (*len > copied) {
+			*len -= copied;
+		} else {
+			/* The cursor is in the copied data */
+			from = tokeniser->borrowed.resume - *len;
+			*len = 0;
+		}
+
+		*more = tokeniser->borrowed.data + from;
+		*more_len = tokeniser->borrowed.len - from;
+	}
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Find the source of part of the input passed through
+ *
+ * \param tokeniser  Tokeniser instance
+ * \param start      Offset in the input of the start of the part
+ * \param end        Offset in the input just past its end
+ * \param data       Pointer to location to receive the part
+ * \return HUBBUB_OK on success,
+ *         HUBBUB_BADPARM if the part is no longer held
+ *
+ * The offsets are those of token locations, so the part is UTF-8, with
+ * invalid sequences replaced by U+FFFD and any BOM dropped. With
+ * HUBBUB_TOKENISER_KEEP_SOURCE, the source of the current token is held
+ * until the token has been emitted, and any input before it until more is
+ * appended. The data belongs to the tokeniser.
+ */
+hubbub_error hubbub_tokeniser_source(hubbub_tokeniser *tokeniser,
+		size_t start, size_t end, const uint8_t **data)
+{
+	parserutils_buffer *own;
+
+	if (tokeniser == NULL || data == NULL || start > end)
+		return HUBBUB_BADPARM;
+
+	if (tokeniser->borrowing == false ||
+			tokeniser->borrowed.passing == false)
+		return HUBBUB_BADPARM;
+
+	own = tokeniser->borrowed.own;
+
+	if (start < tokeniser->borrowed.own_offset ||
+			end - tokeniser->borrowed.own_offset > own->length)
+		return HUBBUB_BADPARM;
+
+	*data = own->data + (start - tokeniser->borrowed.own_offset);
+
+	return HUBBUB_OK;
+}
+
+/* Threaded dispatch relies on GCC's labels as values extension */
+#if defined(HUBBUB_THREADED_DISPATCH) && !defined(__GNUC__)
+#undef HUBBUB_THREADED_DISPATCH
+#endif
+
+#ifdef HUBBUB_THREADED_DISPATCH
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+#endif
+
+/**
+ * Process remaining data in the input stream
+ *
+ * \param tokeniser  The tokeniser instance to invoke
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ */
+hubbub_error hubbub_tokeniser_run(hubbub_tokeniser *tokeniser)
+{
+	if (tokeniser == NULL)
+		return HUBBUB_BADPARM;
+
+	/* Each call has a budget of its own */
+	tokeniser->budget.spent_tokens = 0;
+	tokeniser->budget.spent_bytes = 0;
+
+	if (hubbub_tokeniser_can_speculate(tokeniser))
+		return hubbub_tokeniser_speculate(tokeniser);
+
+	if (hubbub_tokeniser_can_pipeline(tokeniser))
+		return hubbub_tokeniser_pipeline(tokeniser);
+
+	return hubbub_tokeniser_tokenise(tokeniser);
+}
+
+/**
+ * Tokenise the input available, on the caller's thread
+ *
+ * \param tokeniser  The tokeniser instance to invoke
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ */
+hubbub_error hubbub_tokeniser_tokenise(hubbub_tokeniser *tokeniser)
+{
+	hubbub_error cont = HUBBUB_OK;
+
+#ifdef HUBBUB_THREADED_DISPATCH
+	/* Each handler jumps straight to the handler for the next state,
+	 * rather than going back through the switch. This gives every
+	 * transition its own indirect branch, which predicts far better
+	 * than the single shared one. The switch is only used on entry. */
+	static const void *const dispatch[] = {
+		[STATE_DATA] = &&l_STATE_DATA,
+		[STATE_CHARACTER_REFERENCE_DATA] =
+			&&l_STATE_CHARACTER_REFERENCE_DATA,
+		[STATE_TAG_OPEN] = &&l_STATE_TAG_OPEN,
+		[STATE_CLOSE_TAG_OPEN] = &&l_STATE_CLOSE_TAG_OPEN,
+		[STATE_TAG_NAME] = &&l_STATE_TAG_NAME,
+		[STATE_BEFORE_ATTRIBUTE_NAME] = &&l_STATE_BEFORE_ATTRIBUTE_NAME,
+		[STATE_ATTRIBUTE_NAME] = &&l_STATE_ATTRIBUTE_NAME,
+		[STATE_AFTER_ATTRIBUTE_NAME] = &&l_STATE_AFTER_ATTRIBUTE_NAME,
+		[STATE_BEFORE_ATTRIBUTE_VALUE] =
+			&&l_STATE_BEFORE_ATTRIBUTE_VALUE,
+		[STATE_ATTRIBUTE_VALUE_DQ] = &&l_STATE_ATTRIBUTE_VALUE_DQ,
+		[STATE_ATTRIBUTE_VALUE_SQ] = &&l_STATE_ATTRIBUTE_VALUE_SQ,
+		[STATE_ATTRIBUTE_VALUE_UQ] = &&l_STATE_ATTRIBUTE_VALUE_UQ,
+		[STATE_CHARACTER_REFERENCE_IN_ATTRIBUTE_VALUE] =
+			&&l_STATE_CHARACTER_REFERENCE_IN_ATTRIBUTE_VALUE,
+		[STATE_AFTER_ATTRIBUTE_VALUE_Q] =
+			&&l_STATE_AFTER_ATTRIBUTE_VALUE_Q,
+		[STATE_SELF_CLOSING_START_TAG] =
+			&&l_STATE_SELF_CLOSING_START_TAG,
+		[STATE_BOGUS_COMMENT] = &&l_STATE_BOGUS_COMMENT,
+		[STATE_MARKUP_DECLARATION_OPEN] =
+			&&l_STATE_MARKUP_DECLARATION_OPEN,
+		[STATE_MATCH_COMMENT] = &&l_STATE_MATCH_COMMENT,
+		[STATE_COMMENT_START] = &&l_STATE_COMMENT_START,
+		[STATE_COMMENT_START_DASH] = &&l_STATE_COMMENT_START_DASH,
+		[STATE_COMMENT] = &&l_STATE_COMMENT,
+		[STATE_COMMENT_END_DASH] = &&l_STATE_COMMENT_END_DASH,
+		[STATE_COMMENT_END] = &&l_STATE_COMMENT_END,
+		[STATE_MATCH_DOCTYPE] = &&l_STATE_MATCH_DOCTYPE,
+		[STATE_DOCTYPE] = &&l_STATE_DOCTYPE,
+		[STATE_BEFORE_DOCTYPE_NAME] = &&l_STATE_BEFORE_DOCTYPE_NAME,
+		[STATE_DOCTYPE_NAME] = &&l_STATE_DOCTYPE_NAME,
+		[STATE_AFTER_DOCTYPE_NAME] = &&l_STATE_AFTER_DOCTYPE_NAME,
+		[STATE_MATCH_PUBLIC] = &&l_STATE_MATCH_PUBLIC,
+		[STATE_BEFORE_DOCTYPE_PUBLIC] = &&l_STATE_BEFORE_DOCTYPE_PUBLIC,
+		[STATE_DOCTYPE_PUBLIC_DQ] = &&l_STATE_DOCTYPE_PUBLIC_DQ,
+		[STATE_DOCTYPE_PUBLIC_SQ] = &&l_STATE_DOCTYPE_PUBLIC_SQ,
+		[STATE_AFTER_DOCTYPE_PUBLIC] = &&l_STATE_AFTER_DOCTYPE_PUBLIC,
+		[STATE_MATCH_SYSTEM] = &&l_STATE_MATCH_SYSTEM,
+		[STATE_BEFORE_DOCTYPE_SYSTEM] = &&l_STATE_BEFORE_DOCTYPE_SYSTEM,
+		[STATE_DOCTYPE_SYSTEM_DQ] = &&l_STATE_DOCTYPE_SYSTEM_DQ,
+		[STATE_DOCTYPE_SYSTEM_SQ] = &&l_STATE_DOCTYPE_SYSTEM_SQ,
+		[STATE_AFTER_DOCTYPE_SYSTEM] = &&l_STATE_AFTER_DOCTYPE_SYSTEM,
+		[STATE_BOGUS_DOCTYPE] = &&l_STATE_BOGUS_DOCTYPE,
+		[STATE_MATCH_CDATA] = &&l_STATE_MATCH_CDATA,
+		[STATE_CDATA_BLOCK] = &&l_STATE_CDATA_BLOCK,
+		[STATE_NUMBERED_ENTITY] = &&l_STATE_NUMBERED_ENTITY,
+		[STATE_NAMED_ENTITY] = &&l_STATE_NAMED_ENTITY,
+	};
+#endif
+
+	if (tokeniser == NULL)
+		return HUBBUB_BADPARM;
+
+	if (tokeniser->stopped == true)
+		return HUBBUB_STOPPED;
+
+	if (tokeniser->paused == true)
+		return HUBBUB_PAUSED;
+
+#ifdef HUBBUB_THREADED_DISPATCH
+#define state_label(x) l_##x:
+#define next_state() \
+			if (cont != HUBBUB_OK || tokeniser->paused) \
+				goto done; \
+			HUBBUB_TRACE2(tokeniser__state, tokeniser, \
+					tokeniser->state); \
+			goto *dispatch[tokeniser->state]
+#else
+#define state_label(x)
+#define next_state() \
+			break
+#endif
+
+#define state(x) \
+		case x: state_label(x)
+
+	/* A pause takes effect between states, where it is safe to stop */
+	while (cont == HUBBUB_OK && tokeniser->paused == false) {
+		HUBBUB_TRACE2(tokeniser__state, tokeniser, tokeniser->state);
+
+		switch (tokeniser->state) {
+		state(STATE_DATA)
+			cont = hubbub_tokeniser_handle_data(tokeniser);
+			next_state();
+		state(STATE_CHARACTER_REFERENCE_DATA)
+			cont = hubbub_tokeniser_handle_character_reference_data(
+					tokeniser);
+			next_state();
+		state(STATE_TAG_OPEN)
+			cont = hubbub_tokeniser_handle_tag_open(tokeniser);
+			next_state();
+		state(STATE_CLOSE_TAG_OPEN)
+			cont = hubbub_tokeniser_handle_close_tag_open(
+					tokeniser);
+			next_state();
+		state(STATE_TAG_NAME)
+			cont = hubbub_tokeniser_handle_tag_name(tokeniser);
+			next_state();
+		state(STATE_BEFORE_ATTRIBUTE_NAME)
+			cont = hubbub_tokeniser_handle_before_attribute_name(
+					tokeniser);
+			next_state();
+		state(STATE_ATTRIBUTE_NAME)
+			cont = hubbub_tokeniser_handle_attribute_name(
+					tokeniser);
+			next_state();
+		state(STATE_AFTER_ATTRIBUTE_NAME)
+			cont = hubbub_tokeniser_handle_after_attribute_name(
+					tokeniser);
+			next_state();
+		state(STATE_BEFORE_ATTRIBUTE_VALUE)
+			cont = hubbub_tokeniser_handle_before_attribute_value(
+					tokeniser);
+			next_state();
+		state(STATE_ATTRIBUTE_VALUE_DQ)
+			cont = hubbub_tokeniser_handle_attribute_value_dq(
+					tokeniser);
+			next_state();
+		state(STATE_ATTRIBUTE_VALUE_SQ)
+			cont = hubbub_tokeniser_handle_attribute_value_sq(
+					tokeniser);
+			next_state();
+		state(STATE_ATTRIBUTE_VALUE_UQ)
+			cont = hubbub_tokeniser_handle_attribute_value_uq(
+					tokeniser);
+			next_state();
+		state(STATE_CHARACTER_REFERENCE_IN_ATTRIBUTE_VALUE)
+			cont = hubbub_tokeniser_handle_character_reference_in_attribute_value(
+					tokeniser);
+			next_state();
+		state(STATE_AFTER_ATTRIBUTE_VALUE_Q)
+			cont = hubbub_tokeniser_handle_after_attribute_value_q(
+					tokeniser);
+			next_state();
+		state(STATE_SELF_CLOSING_START_TAG)
+			cont = hubbub_tokeniser_handle_self_closing_start_tag(
+					tokeniser);
+			next_state();
+		state(STATE_BOGUS_COMMENT)
+			cont = hubbub_tokeniser_handle_bogus_comment(
+					tokeniser);
+			next_state();
+		state(STATE_MARKUP_DECLARATION_OPEN)
+			cont = hubbub_tokeniser_handle_markup_declaration_open(
+					tokeniser);
+			next_state();
+		state(STATE_MATCH_COMMENT)
+			cont = hubbub_tokeniser_handle_match_comment(
+					tokeniser);
+			next_state();
+		state(STATE_COMMENT_START)
+		state(STATE_COMMENT_START_DASH)
+		state(STATE_COMMENT)
+		state(STATE_COMMENT_END_DASH)
+		state(STATE_COMMENT_END)
+			cont = hubbub_tokeniser_handle_comment(tokeniser);
+			next_state();
+		state(STATE_MATCH_DOCTYPE)
+			cont = hubbub_tokeniser_handle_match_doctype(
+					tokeniser);
+			next_state();
+		state(STATE_DOCTYPE)
+			cont = hubbub_tokeniser_handle_doctype(tokeniser);
+			next_state();
+		state(STATE_BEFORE_DOCTYPE_NAME)
+			cont = hubbub_tokeniser_handle_before_doctype_name(
+					tokeniser);
+			next_state();
+		state(STATE_DOCTYPE_NAME)
+			cont = hubbub_tokeniser_handle_doctype_name(
+					tokeniser);
+			next_state();
+		state(STATE_AFTER_DOCTYPE_NAME)
+			cont = hubbub_tokeniser_handle_after_doctype_name(
+					tokeniser);
+			next_state();
+
+		state(STATE_MATCH_PUBLIC)
+			cont = hubbub_tokeniser_handle_match_public(
+					tokeniser);
+			next_state();
+		state(STATE_BEFORE_DOCTYPE_PUBLIC)
+			cont = hubbub_tokeniser_handle_before_doctype_public(
+					tokeniser);
+			next_state();
+		state(STATE_DOCTYPE_PUBLIC_DQ)
+			cont = hubbub_tokeniser_handle_doctype_public_dq(
+					tokeniser);
+			next_state();
+		state(STATE_DOCTYPE_PUBLIC_SQ)
+			cont = hubbub_tokeniser_handle_doctype_public_sq(
+					tokeniser);
+			next_state();
+		state(STATE_AFTER_DOCTYPE_PUBLIC)
+			cont = hubbub_tokeniser_handle_after_doctype_public(
+					tokeniser);
+			next_state();
+		state(STATE_MATCH_SYSTEM)
+			cont = hubbub_tokeniser_handle_match_system(
+					tokeniser);
+			next_state();
+		state(STATE_BEFORE_DOCTYPE_SYSTEM)
+			cont = hubbub_tokeniser_handle_before_doctype_system(
+					tokeniser);
+			next_state();
+		state(STATE_DOCTYPE_SYSTEM_DQ)
+			cont = hubbub_tokeniser_handle_doctype_system_dq(
+					tokeniser);
+			next_state();
+		state(STATE_DOCTYPE_SYSTEM_SQ)
+			cont = hubbub_tokeniser_handle_doctype_system_sq(
+					tokeniser);
+			next_state();
+		state(STATE_AFTER_DOCTYPE_SYSTEM)
+			cont = hubbub_tokeniser_handle_after_doctype_system(
+					tokeniser);
+			next_state();
+		state(STATE_BOGUS_DOCTYPE)
+			cont = hubbub_tokeniser_handle_bogus_doctype(
+					tokeniser);
+			next_state();
+		state(STATE_MATCH_CDATA)
+			cont = hubbub_tokeniser_handle_match_cdata(
+					tokeniser);
+			next_state();
+		state(STATE_CDATA_BLOCK)
+			cont = hubbub_tokeniser_handle_cdata_block(
+					tokeniser);
+			next_state();
+		state(STATE_NUMBERED_ENTITY)
+			cont = hubbub_tokeniser_handle_numbered_entity(
+					tokeniser);
+			next_state();
+		state(STATE_NAMED_ENTITY)
+			cont = hubbub_tokeniser_handle_named_entity(
+					tokeniser);
+			next_state();
+		}
+	}
+
+#ifdef HUBBUB_THREADED_DISPATCH
+done:
+#endif
+#undef next_state
+#undef state_label
+#undef state
+
+	if (tokeniser->batch.count > 0) {
+		/* Pass on what has been batched up during this call */
+		hubbub_error err = hubbub_tokeniser_flush_batch(tokeniser);
+
+		if (cont == HUBBUB_OK || cont == HUBBUB_NEEDDATA)
+			cont = err;
+	}
+
+	if ((cont == HUBBUB_OK || cont == HUBBUB_NEEDDATA) && tokeniser->paused)
+		return HUBBUB_PAUSED;
+
+	return (cont == HUBBUB_NEEDDATA) ? HUBBUB_OK : cont;
+}
+
+#ifdef HUBBUB_THREADED_DISPATCH
+#pragma GCC diagnostic pop
+#endif
+
+
+/**
+ * Borrowed input
+ *
+ * Borrowed data is read through a stream of our own, whose buffer is a
+ * view of either the borrowed data or the side buffer. Inserted data goes
+ * in the side buffer, and the view moves to it until it has been consumed.
+ * A token which begins in inserted data may run on into the borrowed data;
+ * as much of that as the token needs is copied after it, as the tokeniser
+ * requires the characters of a token to be contiguous. Once the cursor is
+ * in the copied data, the view can move back to the borrowed data.
+ *
+ * Input passed through is read in just the same way, from a buffer of our
+ * own in place of the borrowed data, which grows as data is appended.
+ */
+
+#define BORROWED_COPY_CHUNK 256
+
+/**
+ * Move the view back from the side buffer to the borrowed data
+ *
+ * \param tokeniser  Tokeniser instance, whose cursor is not before the
+ *                   borrowed data copied into the side buffer
+ */
+static void hubbub_tokeniser_leave_side(hubbub_tokeniser *tokeniser)
+{
+	parserutils_inputstream *input = &tokeniser->borrowed.stream;
+	parserutils_buffer *side = tokeniser->borrowed.side;
+
+	assert(input->cursor + tokeniser->borrowed.copied >= side->length);
+
+	input->cursor = tokeniser->borrowed.resume - (side->length -
+			input->cursor);
+	parserutils_buffer_discard(side, 0, side->length);
+
+	tokeniser->borrowed.in_side = false;
+	tokeniser->borrowed.copied = 0;
+	tokeniser->borrowed.view.data = (uint8_t *) tokeniser->borrowed.data;
+	tokeniser->borrowed.view.length = tokeniser->borrowed.len;
+}
+
+/**
+ * Peek past the end of the data in view, when reading borrowed data
+ *
+ * \param tokeniser  Tokeniser instance
+ * \param offset     Offset of character from cursor
+ * \param ptr        Pointer to location to receive character
+ * \param length     Pointer to location to receive character's length
+ * \return PARSERUTILS_OK on success,
+ *         PARSERUTILS_EOF at the end of the input,
+ *         PARSERUTILS_NEEDDATA at the end of the data passed through so
+ *                              far, before the end of the input,
+ *         PARSERUTILS_NOMEM on memory exhaustion
+ */
+static parserutils_error hubbub_tokeniser_peek_borrowed(
+		hubbub_tokeniser *tokeniser, size_t offset,
+		const uint8_t **ptr, size_t *length)
+{
+	parserutils_inputstream *input = &tokeniser->borrowed.stream;
+	parserutils_buffer *side = tokeniser->borrowed.side;
+	size_t from = tokeniser->borrowed.resume;
+	parserutils_error perror;
+	parserutils_error end_of_data = input->had_eof ?
+			PARSERUTILS_EOF : PARSERUTILS_NEEDDATA;
+	size_t end;
+
+	if (tokeniser->borrowed.in_side &&
+			input->cursor + tokeniser->borrowed.copied >=
+			side->length) {
+		/* Nothing inserted remains, so return to the borrowed data,
+		 * where the pending characters also are */
+		hubbub_tokeniser_leave_side(tokeniser);
+
+		if (input->cursor + offset < tokeniser->borrowed.len)
+			return parserutils_inputstream_peek(input, offset,
+					ptr, length);
+	}
+
+	if (tokeniser->borrowed.in_side == false)
+		return end_of_data;
+
+	end = from + (input->cursor + offset - side->length);
+	if (end >= tokeniser->borrowed.len)
+		return end_of_data;
+
+	/* Copy at least the character wanted, and a little beyond, so as
+	 * not to come back here for every character of a long token */
+	end += BORROWED_COPY_CHUNK;
+	if (end > tokeniser->borrowed.len)
+		end = tokeniser->borrowed.len;
+	while (end < tokeniser->borrowed.len &&
+			(tokeniser->borrowed.data[end] & 0xc0) == 0x80)
+		end++;
+
+	perror = parserutils_buffer_append(side,
+			tokeniser->borrowed.data + from, end - from);
+	if (perror != PARSERUTILS_OK)
+		return perror;
+
+	tokeniser->borrowed.resume = end;
+	tokeniser->borrowed.copied += end - from;
+	tokeniser->borrowed.view.data = side->data;
+	tokeniser->borrowed.view.length = side->length;
+
+	return parserutils_inputstream_peek(input, offset, ptr, length);
+}
+
+/**
+ * Peek at a character in the input
+ *
+ * \param tokeniser  Tokeniser instance
+ * \param offset     Offset of character from cursor
+ * \param ptr        Pointer to location to receive character
+ * \param length     Pointer to location to receive character's length
+ * \return As for parserutils_inputstream_peek()
+ */
+static inline parserutils_error hubbub_tokeniser_peek(
+		hubbub_tokeniser *tokeniser, size_t offset,
+		const uint8_t **ptr, size_t *length)
+{
+	parserutils_inputstream *input = tokeniser->input;
+
+	/* Borrowed data is never passed to parserutils to extend */
+	if (tokeniser->borrowing &&
+			input->cursor + offset >= input->utf8->length) {
+		return hubbub_tokeniser_peek_borrowed(tokeniser, offset,
+				ptr, length);
+	}
+
+	return parserutils_inputstream_peek(input, offset, ptr, length);
+}
+
+/**
+ * Insertion
+ *
+ * Inserted data is read before the rest of the input, so belongs at the
+ * cursor. Rather than move everything after the cursor along to make room
+ * for it, it is written over the bytes just before the cursor, which have
+ * been consumed, and the cursor moved back to its start. Data inserted in
+ * turn, while reading it, stacks up in front of it in the same way, so
+ * inserting costs no more than the data inserted, however much input is
+ * left to read. Only where there are too few bytes before the cursor is
+ * the unread data moved, and then far enough to leave a gap in proportion
+ * to it, so the move is paid for by the insertions the gap takes.
+ */
+
+#define INSERT_GAP 256
+
+/**
+ * Insert data at the cursor of a buffer
+ *
+ * \param buffer  Buffer to insert into
+ * \param cursor  Pointer to cursor in buffer, updated to the start of the
+ *                inserted data
+ * \param data    Data to insert
+ * \param len     Length, in bytes, of data
+ * \return PARSERUTILS_OK on success, PARSERUTILS_NOMEM on memory exhaustion
+ */
+static parserutils_error hubbub_tokeniser_stack(parserutils_buffer *buffer,
+		uint32_t *cursor, const uint8_t *data, size_t len)
+{
+	parserutils_error perror;
+
+	if (*cursor < len) {
+		size_t unread = buffer->length - *cursor;
+		size_t gap = len + INSERT_GAP + unread / 2;
+
+		while (buffer->allocated < gap + unread) {
+			perror = parserutils_buffer_grow(buffer);
+			if (perror != PARSERUTILS_OK)
+				return perror;
+		}
+
+		memmove(buffer->data + gap, buffer->data + *cursor, unread);
+		buffer->length = gap + unread;
+		*cursor = gap;
+	}
+
+	*cursor -= len;
+	memcpy(buffer->data + *cursor, data, len);
+
+	return PARSERUTILS_OK;
+}
+
+/**
+ * Insert the data in the insertion buffer at the cursor
+ *
+ * \param tokeniser  Tokeniser instance
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ *
+ * Borrowed data cannot be written to, so data inserted into it goes in the
+ * side buffer, which the view moves to.
+ */
+static hubbub_error hubbub_tokeniser_insert(hubbub_tokeniser *tokeniser)
+{
+	parserutils_inputstream *input = tokeniser->input;
+	parserutils_buffer *insert = tokeniser->insert_buf;
+	parserutils_error perror;
+
+	if (tokeniser->borrowing == false) {
+		perror = hubbub_tokeniser_stack(input->utf8, &input->cursor,
+				insert->data, insert->length);
+		return hubbub_error_from_parserutils_error(perror);
+	}
+
+	if (tokeniser->borrowed.side == NULL) {
+		perror = parserutils_buffer_create(tokeniser->alloc,
+				tokeniser->alloc_pw, &tokeniser->borrowed.side);
+		if (perror != PARSERUTILS_OK)
+			return hubbub_error_from_parserutils_error(perror);
+	}
+
+	if (tokeniser->borrowed.in_side && input->cursor +
+			tokeniser->borrowed.copied >=
+			tokeniser->borrowed.side->length)
+		hubbub_tokeniser_leave_side(tokeniser);
+
+	if (tokeniser->borrowed.in_side == false) {
+		tokeniser->borrowed.resume = input->cursor;
+		tokeniser->borrowed.in_side = true;
+		input->cursor = 0;
+		parserutils_buffer_discard(tokeniser->borrowed.side, 0,
+				tokeniser->borrowed.side->length);
+	}
+
+	perror = hubbub_tokeniser_stack(tokeniser->borrowed.side,
+			&input->cursor, insert->data, insert->length);
+	if (perror != PARSERUTILS_OK)
+		return hubbub_error_from_parserutils_error(perror);
+
+	tokeniser->borrowed.view.data = tokeniser->borrowed.side->data;
+	tokeniser->borrowed.view.length = tokeniser->borrowed.side->length;
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Position tracking
+ *
+ * When enabled, the offset, line and line start of the cursor are kept up
+ * to date as the cursor moves, by counting the line breaks in the bytes
+ * being moved over. The cursor only moves over whole runs of input (most
+ * often the pending characters of a token, as it is emitted), so these are
+ * counted in bulk. Each token starts where the one before it ended; the
+ * mark records the location of that point.
+ */
+
+/**
+ * Advance the input stream's cursor, tracking the position in the input
+ * if required
+ *
+ * \param tokeniser  Tokeniser instance
+ * \param len        Number of bytes to advance by
+ */
+static inline void hubbub_tokeniser_advance(hubbub_tokeniser *tokeniser,
+		size_t len)
+{
+	if (tokeniser->track_position) {
+		const uint8_t *data = tokeniser->input->utf8->data +
+				tokeniser->input->cursor;
+		size_t line_start = (size_t) -1;
+
+		tokeniser->context.position.line += hubbub_scan_count_lines(
+				data, len, &tokeniser->context.position.after_cr,
+				&line_start);
+
+		if (line_start != (size_t) -1) {
+			tokeniser->context.position.line_start =
+					tokeniser->context.position.offset +
+					line_start;
+		}
+
+		tokeniser->context.position.offset += len;
+	}
+
+	parserutils_inputstream_advance(tokeniser->input, len);
+}
+
+/**
+ * Mark the cursor's position as the start of the next token
+ *
+ * \param tokeniser  Tokeniser instance
+ */
+static inline void hubbub_tokeniser_mark(hubbub_tokeniser *tokeniser)
+{
+	hubbub_location *mark = &tokeniser->context.position.mark;
+
+	mark->start = tokeniser->context.position.offset;
+	mark->line = tokeniser->context.position.line;
+	mark->col = tokeniser->context.position.offset -
+			tokeniser->context.position.line_start + 1;
+}
+
+
+/**
+ * Token strings and their sources
+ *
+ * The strings making up a token (tag and attribute names and values,
+ * comment text and doctype fields) are collected without copying for as
+ * long as they are an exact slice of the input stream. Each one has a
+ * source, which is its offset from the input stream's cursor. Offsets are
+ * used rather than pointers as the stream's buffer may move as more data
+ * is read, but the data after the cursor is only consumed once the token
+ * has been emitted.
+ *
+ * The first time a string is extended with something other than the next
+ * bytes of the input (a lowercased letter, U+FFFD, a normalised newline,
+ * or the expansion of a character reference), the characters collected so
+ * far are copied to the end of tokeniser->buffer and the source becomes
+ * STRING_BUFFERED. Only the string at the end of the token is ever being
+ * collected, so the buffered strings of a token appear in the buffer in
+ * the order they occur in the token, and their pointers can be worked out
+ * from their lengths when the token is emitted.
+ */
+
+/** Source of a string which has been copied into the tokeniser's buffer */
+#define STRING_BUFFERED ((size_t) -1)
+
+/**
+ * Copy the characters of a string collected so far into the tokeniser's
+ * buffer, if they are not there already
+ *
+ * \param tokeniser  Tokeniser instance
+ * \param str        String to buffer
+ * \param src        Pointer to source of string, updated on exit
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ */
+static hubbub_error hubbub_tokeniser_buffer_string(
+		hubbub_tokeniser *tokeniser, const hubbub_string *str,
+		size_t *src)
+{
+	parserutils_error perror;
+
+	if (*src == STRING_BUFFERED)
+		return HUBBUB_OK;
+
+	if (str->len > 0) {
+		perror = parserutils_buffer_append(tokeniser->buffer,
+				tokeniser->input->utf8->data +
+				tokeniser->input->cursor + *src, str->len);
+		if (perror != PARSERUTILS_OK)
+			return hubbub_error_from_parserutils_error(perror);
+	}
+
+	*src = STRING_BUFFERED;
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Append characters to a string
+ *
+ * If the string is still a slice of the input, and the characters are the
+ * same as those which follow it in the input, the slice is extended.
+ * Otherwise, the string is buffered and the characters appended to it.
+ *
+ * \param tokeniser  Tokeniser instance
+ * \param str        String to append to
+ * \param src        Pointer to source of string, updated on exit
+ * \param data       Characters to append
+ * \param length     Length of data, in bytes
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ */
+static inline hubbub_error hubbub_tokeniser_collect(
+		hubbub_tokeniser *tokeniser, hubbub_string *str, size_t *src,
+		const uint8_t *data, size_t length)
+{
+	parserutils_error perror;
+	hubbub_error err;
+
+	if (*src != STRING_BUFFERED) {
+		const parserutils_buffer *utf8 = tokeniser->input->utf8;
+		size_t end = tokeniser->input->cursor + *src + str->len;
+
+		if (utf8->data + end == data || (end + length <= utf8->length &&
+				memcmp(utf8->data + end, data, length) == 0)) {
+			str->len += length;
+			return HUBBUB_OK;
+		}
+
+		err = hubbub_tokeniser_buffer_string(tokeniser, str, src);
+		if (err != HUBBUB_OK)
+			return err;
+	}
+
+	perror = parserutils_buffer_append(tokeniser->buffer, data, length);
+	if (perror != PARSERUTILS_OK)
+		return hubbub_error_from_parserutils_error(perror);
+
+	str->len += length;
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Work out where a string collected for a token lives, now that the token
+ * is about to be emitted
+ *
+ * \param tokeniser  Tokeniser instance
+ * \param str        String to update
+ * \param src        Source of string
+ * \param buffered   Pointer to location of the string's characters in the
+ *                   tokeniser buffer, if buffered; updated on exit to point
+ *                   past them
+ */
+static inline void hubbub_tokeniser_resolve_string(
+		hubbub_tokeniser *tokeniser, hubbub_string *str, size_t src,
+		const uint8_t **buffered)
+{
+	if (src == STRING_BUFFERED) {
+		str->ptr = *buffered;
+		*buffered += str->len;
+	} else {
+		str->ptr = tokeniser->input->utf8->data +
+				tokeniser->input->cursor + src;
+	}
+}
+
+/**
+ * Various macros for manipulating token strings.
+ *
+ * Each takes the string and its source, which must both be lvalues. See
+ * docs/Macros for details.
+ */
+
+#define START(str, src, cptr, length) \
+	do { \
+		hubbub_error serr; \
+		(str).len = 0; \
+		(src) = tokeniser->context.pending; \
+		serr = hubbub_tokeniser_collect(tokeniser, &(str), &(src), \
+				(const uint8_t *) (cptr), (length)); \
+		if (serr != HUBBUB_OK) \
+			return serr; \
+	} while (0)
+
+#define COLLECT(str, src, cptr, length) \
+	do { \
+		hubbub_error serr; \
+		assert((str).len != 0); \
+		serr = hubbub_tokeniser_collect(tokeniser, &(str), &(src), \
+				(const uint8_t *) (cptr), (length)); \
+		if (serr != HUBBUB_OK) \
+			return serr; \
+	} while (0)
+
+#define COLLECT_MS(str, src, cptr, length) \
+	do { \
+		hubbub_error serr; \
+		if ((str).len == 0) \
+			(src) = tokeniser->context.pending; \
+		serr = hubbub_tokeniser_collect(tokeniser, &(str), &(src), \
+				(const uint8_t *) (cptr), (length)); \
+		if (serr != HUBBUB_OK) \
+			return serr; \
+	} while (0)
+
+/**
+ * Stop bytes for runs of characters collected in bulk by the attribute
+ * value, comment and doctype identifier states
+ */
+static const uint8_t attribute_value_dq_stops[] = { '"', '&', '\0', '\r' };
+static const uint8_t attribute_value_sq_stops[] = { '\'', '&', '\0', '\r' };
+static const uint8_t attribute_value_uq_stops[] = {
+	'\t', '\n', '\f', ' ', '\r', '&', '>', '\0'
+};
+static const uint8_t comment_stops[] = { '-', '\0', '\r' };
+static const uint8_t comment_drop_stops[] = { '-' };
+static const uint8_t bogus_comment_drop_stops[] = { '>' };
+static const uint8_t doctype_id_dq_stops[] = { '"', '>', '\0', '\r' };
+static const uint8_t doctype_id_sq_stops[] = { '\'', '>', '\0', '\r' };
+
+/** Number of attributes to make space for when the first is seen */
+#define ATTRIBUTE_CHUNK 8
+
+/**
+ * Ensure there is space for another attribute on the current tag
+ *
+ * The attribute array is kept for the lifetime of the tokeniser and
+ * doubles in size whenever it fills, so once it has grown to fit the
+ * largest tag seen, starting a new attribute never needs to allocate.
+ *
+ * \param tokeniser  Tokeniser instance
+ * \return HUBBUB_OK on success, HUBBUB_NOMEM on memory exhaustion
+ */
+static inline hubbub_error hubbub_tokeniser_grow_attributes(
+		hubbub_tokeniser *tokeniser)
+{
+	hubbub_tag *ctag = &tokeniser->context.current_tag;
+	hubbub_attribute *attr;
+	hubbub_tokeniser_attribute_src *src;
+	uint32_t *hash;
+	uint32_t space = tokeniser->context.attribute_space;
+
+	if (ctag->n_attributes < space)
+		return HUBBUB_OK;
+
+	space = (space == 0) ? ATTRIBUTE_CHUNK : space * 2;
+
+	attr = tokeniser->alloc(ctag->attributes,
+			space * sizeof(hubbub_attribute), tokeniser->alloc_pw);
+	if (attr == NULL)
+		return HUBBUB_NOMEM;
+
+	ctag->attributes = attr;
+
+	src = tokeniser->alloc(tokeniser->context.attribute_src,
+			space * sizeof(hubbub_tokeniser_attribute_src),
+			tokeniser->alloc_pw);
+	if (src == NULL)
+		return HUBBUB_NOMEM;
+
+	tokeniser->context.attribute_src = src;
+
+	hash = tokeniser->alloc(tokeniser->context.attribute_hash,
+			2 * space * sizeof(uint32_t), tokeniser->alloc_pw);
+	if (hash == NULL)
+		return HUBBUB_NOMEM;
+
+	tokeniser->context.attribute_hash = hash;
+	tokeniser->context.attribute_space = space;
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Find the length of the run of characters after the pending characters
+ * which contains none of the given stop bytes
+ *
+ * Only data which is already in the input stream's buffer is examined,
+ * no more than max bytes of it, and the run never ends part way through
+ * a character.
+ *
+ * \param tokeniser  Tokeniser instance
+ * \param stops      Array of stop bytes (all ASCII)
+ * \param n_stops    Number of stop bytes
+ * \param max        Largest length of run to find
+ * \return Length of run, in bytes
+ */
+static inline size_t hubbub_tokeniser_scan_run(hubbub_tokeniser *tokeniser,
+		const uint8_t *stops, size_t n_stops, size_t max)
+{
+	const parserutils_buffer *utf8 = tokeniser->input->utf8;
+	size_t off = tokeniser->input->cursor + tokeniser->context.pending;
+	size_t avail, run;
+
+	if (off >= utf8->length || max == 0)
+		return 0;
+
+	avail = utf8->length - off;
+	if (avail > max)
+		avail = max;
+
+	run = hubbub_scan_until_any(utf8->data + off, avail, stops, n_stops);
+
+	/* Leave any incomplete trailing character to the slow path */
+	if (run == avail)
+		run = hubbub_scan_utf8_complete(utf8->data + off, run);
+
+	return run;
+}
+
+/**
+ * Find the length of the run of whitespace after the pending characters
+ *
+ * As for hubbub_tokeniser_scan_run(), only data which is already in the
+ * input stream's buffer, and no more than max bytes of it, is examined.
+ *
+ * \param tokeniser  Tokeniser instance
+ * \param max        Largest length of run to find
+ * \return Length of run, in bytes
+ */
+static inline size_t hubbub_tokeniser_scan_space(hubbub_tokeniser *tokeniser,
+		size_t max)
+{
+	const parserutils_buffer *utf8 = tokeniser->input->utf8;
+	size_t off = tokeniser->input->cursor + tokeniser->context.pending;
+	size_t avail;
+
+	if (off >= utf8->length || max == 0)
+		return 0;
+
+	avail = utf8->length - off;
+	if (avail > max)
+		avail = max;
+
+	return hubbub_scan_whitespace(utf8->data + off, avail);
+}
+
+/**
+ * Find how many more bytes of characters the pending token may take before
+ * it reaches the token limit
+ *
+ * \param tokeniser  Tokeniser instance
+ * \return Number of bytes
+ */
+static inline size_t hubbub_tokeniser_chars_room(hubbub_tokeniser *tokeniser)
+{
+	if (tokeniser->context.pending >= tokeniser->token_limit)
+		return 0;
+
+	return tokeniser->token_limit - tokeniser->context.pending;
+}
+
+/**
+ * Collect a run of characters which need no special treatment in the
+ * current state into a string, consuming them.
+ *
+ * \param tokeniser  Tokeniser instance
+ * \param str        String being collected
+ * \param src        Pointer to source of string
+ * \param stops      Array of stop bytes (all ASCII)
+ * \param n_stops    Number of stop bytes
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ */
+static inline hubbub_error hubbub_tokeniser_collect_run(
+		hubbub_tokeniser *tokeniser, hubbub_string *str, size_t *src,
+		const uint8_t *stops, size_t n_stops)
+{
+	hubbub_error err;
+	size_t run;
+
+	/* Don't run far past the token limit before it is checked */
+	run = hubbub_tokeniser_scan_run(tokeniser, stops, n_stops,
+			tokeniser->token_limit);
+
+	if (run == 0)
+		return HUBBUB_OK;
+
+	err = hubbub_tokeniser_collect(tokeniser, str, src,
+			tokeniser->input->utf8->data +
+			tokeniser->input->cursor + tokeniser->context.pending,
+			run);
+	if (err != HUBBUB_OK)
+		return err;
+
+	tokeniser->context.pending += run;
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Append a string of the current tag to the tokeniser's buffer, as part
+ * of hubbub_tokeniser_buffer_tag()
+ *
+ * \param tokeniser  Tokeniser instance
+ * \param str        String to copy
+ * \param src        Pointer to source of string, updated on exit
+ * \param offset     Pointer to offset in buffer of the string, if it is
+ *                   already buffered; updated on exit to point past it
+ */
+static void hubbub_tokeniser_rebuffer_string(hubbub_tokeniser *tokeniser,
+		const hubbub_string *str, size_t *src, size_t *offset)
+{
+	const uint8_t *data;
+
+	if (*src == STRING_BUFFERED) {
+		data = tokeniser->buffer->data + *offset;
+		*offset += str->len;
+	} else {
+		data = tokeniser->input->utf8->data +
+				tokeniser->input->cursor + *src;
+		*src = STRING_BUFFERED;
+	}
+
+	/* There is room for this, so the buffer does not move */
+	if (str->len > 0)
+		parserutils_buffer_append(tokeniser->buffer, data, str->len);
+}
+
+/**
+ * Copy every string of the current tag into the tokeniser's buffer, and
+ * move the cursor past the pending input
+ *
+ * Nothing refers to the input read so far after this, so it need not be
+ * kept while the rest of the tag is read.
+ *
+ * \param tokeniser  Tokeniser instance
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ */
+static hubbub_error hubbub_tokeniser_buffer_tag(hubbub_tokeniser *tokeniser)
+{
+	hubbub_tag *ctag = &tokeniser->context.current_tag;
+	hubbub_tokeniser_attribute_src *asrc = tokeniser->context.attribute_src;
+	parserutils_buffer *buffer = tokeniser->buffer;
+	size_t old = buffer->length;
+	size_t needed = old + ctag->name.len;
+	size_t offset = 0;
+	parserutils_error perror;
+	uint32_t i;
+
+	for (i = 0; i < ctag->n_attributes; i++) {
+		needed += ctag->attributes[i].name.len +
+				ctag->attributes[i].value.len;
+	}
+
+	/* Make room for all of it first, so the strings which are already
+	 * buffered stay put while they are copied */
+	while (buffer->allocated <= needed) {
+		perror = parserutils_buffer_grow(buffer);
+		if (perror != PARSERUTILS_OK)
+			return hubbub_error_from_parserutils_error(perror);
+	}
+
+	/* Copy the strings in order, after the old ones */
+	hubbub_tokeniser_rebuffer_string(tokeniser, &ctag->name,
+			&tokeniser->context.current_tag_name_src, &offset);
+
+	for (i = 0; i < ctag->n_attributes; i++) {
+		hubbub_tokeniser_rebuffer_string(tokeniser,
+				&ctag->attributes[i].name, &asrc[i].name,
+				&offset);
+		hubbub_tokeniser_rebuffer_string(tokeniser,
+				&ctag->attributes[i].value, &asrc[i].value,
+				&offset);
+	}
+
+	parserutils_buffer_discard(buffer, 0, old);
+
+	hubbub_tokeniser_advance(tokeniser, tokeniser->context.pending);
+	tokeniser->context.pending = 0;
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Stop collecting the current attribute value if it has reached the token
+ * limit
+ *
+ * The value is cut back to the limit, at the start of a character, and the
+ * rest of it is skipped. So that the input is not kept while it is, the
+ * strings of the tag are buffered.
+ *
+ * \param tokeniser  Tokeniser instance
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ */
+static inline hubbub_error hubbub_tokeniser_limit_value(
+		hubbub_tokeniser *tokeniser)
+{
+	hubbub_tag *ctag = &tokeniser->context.current_tag;
+	hubbub_string *value = &ctag->attributes[ctag->n_attributes - 1].value;
+	size_t src = tokeniser->context.attribute_src[
+			ctag->n_attributes - 1].value;
+	size_t len = tokeniser->token_limit;
+
+	if (tokeniser->context.value_truncated || value->len < len)
+		return HUBBUB_OK;
+
+	if (value->len > len) {
+		const uint8_t *data;
+
+		if (src == STRING_BUFFERED) {
+			data = tokeniser->buffer->data +
+					tokeniser->buffer->length - value->len;
+		} else {
+			data = tokeniser->input->utf8->data +
+					tokeniser->input->cursor + src;
+		}
+
+		while (len > 0 && (data[len] & 0xC0) == 0x80)
+			len--;
+
+		if (src == STRING_BUFFERED) {
+			parserutils_buffer_discard(tokeniser->buffer,
+					tokeniser->buffer->length -
+					(value->len - len), value->len - len);
+		}
+
+		value->len = len;
+	}
+
+	tokeniser->context.value_truncated = true;
+
+	return hubbub_tokeniser_buffer_tag(tokeniser);
+}
+
+/**
+ * Collect a run of characters which need no special treatment in the
+ * current state into a string, converting them to lowercase and consuming
+ * them.
+ *
+ * The character at the current position must not be in any of the given
+ * classes, so the run is never empty.
+ *
+ * \param tokeniser  Tokeniser instance
+ * \param str        String being collected
+ * \param src        Pointer to source of string
+ * \param end        Classes of the bytes which end the run
+ * \param hash       Pointer to element name hash of string, updated on
+ *                   exit, or NULL if not required
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ */
+static inline hubbub_error hubbub_tokeniser_collect_lower_run(
+		hubbub_tokeniser *tokeniser, hubbub_string *str, size_t *src,
+		uint8_t end, uint32_t *hash)
+{
+	const parserutils_buffer *utf8 = tokeniser->input->utf8;
+	size_t off = tokeniser->input->cursor + tokeniser->context.pending;
+	const uint8_t *data = utf8->data + off;
+	size_t avail = utf8->length - off;
+	parserutils_error perror;
+	hubbub_error err;
+	bool upper = false;
+	uint32_t h = (hash != NULL) ? *hash : 0;
+	uint8_t *lower;
+	size_t run, i;
+
+	for (run = 0; run < avail; run++) {
+		if (hubbub_char_is(data[run], end))
+			break;
+
+		upper |= hubbub_char_is(data[run], HUBBUB_CC_UPPER);
+		h = hubbub_element_hash_step(h, hubbub_char_tolower(data[run]));
+	}
+
+	/* Leave any incomplete trailing character to the slow path */
+	if (run == avail) {
+		size_t complete = hubbub_scan_utf8_complete(data, run);
+
+		if (complete != run && hash != NULL) {
+			h = *hash;
+			for (i = 0; i < complete; i++) {
+				h = hubbub_element_hash_step(h,
+						hubbub_char_tolower(data[i]));
+			}
+		}
+
+		run = complete;
+	}
+
+	assert(run > 0);
+
+	if (hash != NULL)
+		*hash = h;
+
+	if (upper == false) {
+		/* Already lowercase, so the input will do */
+		err = hubbub_tokeniser_collect(tokeniser, str, src,
+				data, run);
+		if (err != HUBBUB_OK)
+			return err;
+	} else {
+		err = hubbub_tokeniser_buffer_string(tokeniser, str, src);
+		if (err != HUBBUB_OK)
+			return err;
+
+		perror = parserutils_buffer_append(tokeniser->buffer,
+				data, run);
+		if (perror != PARSERUTILS_OK)
+			return hubbub_error_from_parserutils_error(perror);
+
+		lower = tokeniser->buffer->data +
+				tokeniser->buffer->length - run;
+		for (i = 0; i < run; i++)
+			lower[i] = hubbub_char_tolower(lower[i]);
+
+		str->len += run;
+	}
+
+	tokeniser->context.pending += run;
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Stop bytes for runs of characters skipped in bulk by the data state.
+ * There is one set for each content model, and RCDATA and CDATA have a
+ * further set for use while the escape flag is set.
+ */
+static const uint8_t data_pcdata_stops[] = { '<', '&', '\0', '\r' };
+static const uint8_t data_rcdata_stops[] = { '<', '&', '\0', '\r' };
+static const uint8_t data_cdata_stops[] = { '<', '\0', '\r' };
+static const uint8_t data_escaped_stops[] = { '>', '\0', '\r' };
+static const uint8_t data_plaintext_stops[] = { '\0', '\r' };
+
+/**
+ * What a '<' in RCDATA or CDATA turns out to start
+ */
+typedef enum hubbub_tokeniser_raw_lt {
+	RAW_LT_DATA,		/**< Nothing; '<' is a character like any other */
+	RAW_LT_ESCAPE,		/**< "<!--", which sets the escape flag */
+	RAW_LT_END_TAG,		/**< An end tag for the last start tag */
+	RAW_LT_NEEDDATA		/**< Not known until more data arrives */
+} hubbub_tokeniser_raw_lt;
+
+/**
+ * Work out what a '<' in the data state starts, when in the RCDATA or
+ * CDATA content models and the escape flag is not set
+ *
+ * Only "<!--" and "</" followed by the last start tag's name and a
+ * character which can end a tag name (or the end of the input) leave the
+ * data state in these content models, so this looks a few bytes ahead in
+ * the input stream's buffer rather than visiting the tag open states for
+ * every '<' in a script or style sheet.
+ *
+ * \param tokeniser  Tokeniser instance, with the '<' at offset pending
+ * \return What the '<' starts
+ */
+static hubbub_tokeniser_raw_lt hubbub_tokeniser_classify_raw_lt(
+		hubbub_tokeniser *tokeniser)
+{
+	const uint8_t *name = tokeniser->context.last_start_tag_name;
+	size_t name_len = tokeniser->context.last_start_tag_len;
+	size_t need = SLEN("</") + name_len + 1;
+	const parserutils_buffer *utf8;
+	parserutils_error error;
+	const uint8_t *data;
+	size_t avail, i;
+	bool eof = false;
+
+	/* Make sure as much of the longest construct we're interested in
+	 * ("<!--", or "</", the name, and the character after it) is in the
+	 * buffer as there is input for */
+	if (need < SLEN("<!--"))
+		need = SLEN("<!--");
+
+	while (true) {
+		utf8 = tokeniser->input->utf8;
+		avail = utf8->length - tokeniser->input->cursor -
+				tokeniser->context.pending;
+
+		if (avail >= need)
+			break;
+
+		error = hubbub_tokeniser_peek(tokeniser,
+				tokeniser->context.pending + avail,
+				&data, &i);
+		if (error == PARSERUTILS_EOF) {
+			eof = true;
+			break;
+		} else if (error != PARSERUTILS_OK) {
+			/* Stop here and let the data state deal with it */
+			return RAW_LT_NEEDDATA;
+		}
+	}
+
+	data = utf8->data + tokeniser->input->cursor +
+			tokeniser->context.pending;
+
+	assert(avail > 0 && data[0] == '<');
+
+	if (avail < 2)
+		return eof ? RAW_LT_DATA : RAW_LT_NEEDDATA;
+
+	if (data[1] == '!') {
+		if (avail < SLEN("<!--"))
+			return eof ? RAW_LT_DATA : RAW_LT_NEEDDATA;
+
+		return (data[2] == '-' && data[3] == '-') ?
+				RAW_LT_ESCAPE : RAW_LT_DATA;
+	}
+
+	/* Without a start tag name, nothing ends the raw text */
+	if (data[1] != '/' || name_len == 0)
+		return RAW_LT_DATA;
+
+	/* The last start tag name is already lowercase */
+	for (i = 0; i < name_len; i++) {
+		if (SLEN("</") + i == avail)
+			return eof ? RAW_LT_DATA : RAW_LT_NEEDDATA;
+
+		if (hubbub_char_tolower(data[SLEN("</") + i]) != name[i])
+			return RAW_LT_DATA;
+	}
+
+	if (SLEN("</") + name_len == avail)
+		return eof ? RAW_LT_END_TAG : RAW_LT_NEEDDATA;
+
+	switch (data[SLEN("</") + name_len]) {
+	case '\t': case '\n': case '\f': case ' ': case '>': case '/':
+		return RAW_LT_END_TAG;
+	}
+
+	return RAW_LT_DATA;
+}
+
+/**
+ * Copy the pending characters which have not been copied yet into the
+ * tokeniser's buffer
+ *
+ * \param tokeniser  Tokeniser instance
+ * \return PARSERUTILS_OK on success, appropriate error otherwise
+ */
+static parserutils_error hubbub_tokeniser_buffer_chars(
+		hubbub_tokeniser *tokeniser)
+{
+	size_t copied = tokeniser->context.chars.copied;
+	parserutils_error perror;
+
+	assert(copied <= tokeniser->context.pending);
+
+	if (tokeniser->context.pending > copied) {
+		perror = parserutils_buffer_append(tokeniser->buffer,
+				tokeniser->input->utf8->data +
+				tokeniser->input->cursor + copied,
+				tokeniser->context.pending - copied);
+		if (perror != PARSERUTILS_OK)
+			return perror;
+	}
+
+	tokeniser->context.chars.buffered = true;
+	tokeniser->context.chars.copied = tokeniser->context.pending;
+
+	return PARSERUTILS_OK;
+}
+
+/**
+ * Replace the next input bytes in a run of pending characters
+ *
+ * The pending characters are an exact slice of the input until the first
+ * time one of them needs rewriting. From then on, they are copied into the
+ * tokeniser's buffer, with the replacement, so the run is still emitted as
+ * a single character token.
+ *
+ * \param tokeniser  Tokeniser instance
+ * \param skip       Number of input bytes to replace
+ * \param data       Replacement characters
+ * \param length     Length of data, in bytes
+ * \return PARSERUTILS_OK on success, appropriate error otherwise
+ */
+static parserutils_error hubbub_tokeniser_rewrite_chars(
+		hubbub_tokeniser *tokeniser, size_t skip,
+		const uint8_t *data, size_t length)
+{
+	parserutils_error perror;
+
+	perror = hubbub_tokeniser_buffer_chars(tokeniser);
+	if (perror != PARSERUTILS_OK)
+		return perror;
+
+	if (length > 0) {
+		perror = parserutils_buffer_append(tokeniser->buffer,
+				data, length);
+		if (perror != PARSERUTILS_OK)
+			return perror;
+	}
+
+	tokeniser->context.pending += skip;
+	tokeniser->context.chars.copied = tokeniser->context.pending;
+
+	return PARSERUTILS_OK;
+}
+
+/**
+ * Handle a NUL in character data, replacing it with U+FFFD
+ *
+ * \param tokeniser  Tokeniser instance
+ * \return PARSERUTILS_OK on success, appropriate error otherwise
+ */
+static inline parserutils_error hubbub_tokeniser_data_nul(
+		hubbub_tokeniser *tokeniser)
+{
+	return hubbub_tokeniser_rewrite_chars(tokeniser, 1,
+			u_fffd, sizeof(u_fffd));
+}
+
+/**
+ * Handle a CR in character data, replacing it with LF unless it is
+ * followed by LF, in which case it is dropped
+ *
+ * \param tokeniser  Tokeniser instance
+ * \param len        Length of the CR, in bytes
+ * \return PARSERUTILS_OK on success, or the error encountered while trying
+ *         to read the character after the CR
+ */
+static inline parserutils_error hubbub_tokeniser_data_cr(
+		hubbub_tokeniser *tokeniser, size_t len)
+{
+	parserutils_error error;
+	const uint8_t *cptr;
+
+	error = hubbub_tokeniser_peek(tokeniser,
+			tokeniser->context.pending + len, &cptr, &len);
+
+	if (error != PARSERUTILS_OK && error != PARSERUTILS_EOF)
+		return error;
+
+	if (error == PARSERUTILS_EOF || *cptr != '\n') {
+		/* Replace CR with LF */
+		return hubbub_tokeniser_rewrite_chars(tokeniser, 1, &lf, 1);
+	}
+
+	/* Drop CR; the LF is collected as usual */
+	return hubbub_tokeniser_rewrite_chars(tokeniser, 1, NULL, 0);
+}
+
+/**
+ * Emit the pending characters early, as they have reached the token limit
+ *
+ * The token is marked incomplete, and the characters which follow are
+ * emitted as a new token.
+ *
+ * \param tokeniser  Tokeniser instance
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ */
+static hubbub_error hubbub_tokeniser_split_chars(hubbub_tokeniser *tokeniser)
+{
+	const uint8_t *data = tokeniser->input->utf8->data +
+			tokeniser->input->cursor;
+	size_t pending = tokeniser->context.pending;
+	uint32_t dashes = 0;
+	hubbub_error err;
+
+	if (tokeniser->escape_flag) {
+		/* Remember the dashes which end this piece, so a "-->"
+		 * which straddles the split still ends the escape */
+		while (dashes < SLEN("--") && dashes < pending &&
+				data[pending - dashes - 1] == '-')
+			dashes++;
+
+		if (dashes == pending) {
+			dashes += tokeniser->context.chars.dashes;
+			if (dashes > SLEN("--"))
+				dashes = SLEN("--");
+		}
+	}
+
+	tokeniser->context.incomplete = true;
+	err = emit_current_chars(tokeniser);
+
+	tokeniser->context.chars.dashes = dashes;
+
+	return err;
+}
+
+/**
+ * Finish a visit to the data state, emitting any pending characters and,
+ * at the end of the input, the EOF token
+ *
+ * \param tokeniser  Tokeniser instance
+ * \param error      Error which ended the data state's loop
+ * \return HUBBUB_NEEDDATA at EOF, or the result of converting error
+ */
+static hubbub_error hubbub_tokeniser_data_end(hubbub_tokeniser *tokeniser,
+		parserutils_error error)
+{
+	hubbub_token token;
+
+	if (tokeniser->state != STATE_TAG_OPEN &&
+		(tokeniser->state != STATE_DATA || error == PARSERUTILS_EOF) &&
+			tokeniser->context.pending > 0) {
+		/* Emit any pending characters */
+		emit_current_chars(tokeniser);
+	}
+
+	/* Once paused, the EOF token waits until parsing is resumed */
+	if (error == PARSERUTILS_EOF && tokeniser->paused == false) {
+		token.type = HUBBUB_TOKEN_EOF;
+		hubbub_tokeniser_emit_token(tokeniser, &token);
+	}
+
+	if (error == PARSERUTILS_EOF) {
+		return HUBBUB_NEEDDATA;
+	} else {
+		return hubbub_error_from_parserutils_error(error);
+	}
+}
+
+/**
+ * Data state for the PCDATA content model
+ *
+ * \param tokeniser  Tokeniser instance
+ * \return As for hubbub_tokeniser_handle_data()
+ */
+static inline hubbub_error hubbub_tokeniser_handle_data_pcdata(
+		hubbub_tokeniser *tokeniser)
+{
+	parserutils_error error;
+	const uint8_t *cptr;
+	size_t len;
+
+	while ((error = hubbub_tokeniser_peek(tokeniser,
+			tokeniser->context.pending, &cptr, &len)) ==
+					PARSERUTILS_OK) {
+		const uint8_t c = *cptr;
+
+		if (c == '&' && tokeniser->escape_flag == false) {
+			tokeniser->state =
+					STATE_CHARACTER_REFERENCE_DATA;
+			/* Don't eat the '&'; it'll be handled by entity
+			 * consumption */
+			break;
+		} else if (c == '<') {
+			if (tokeniser->context.pending > 0) {
+				/* Emit any pending characters */
+				emit_current_chars(tokeniser);
+			}
+
+			/* Buffer '<' */
+			tokeniser->context.pending = len;
+			tokeniser->state = STATE_TAG_OPEN;
+			break;
+		} else if (c == '\0') {
+			error = hubbub_tokeniser_data_nul(tokeniser);
+			if (error != PARSERUTILS_OK)
+				break;
+		} else if (c == '\r') {
+			bool space = tokeniser->context.chars.space ==
+					tokeniser->context.pending;
+
+			error = hubbub_tokeniser_data_cr(tokeniser, len);
+			if (error != PARSERUTILS_OK)
+				break;
+
+			/* The CR became an LF, or was dropped */
+			if (space) {
+				tokeniser->context.chars.space =
+						tokeniser->context.pending;
+			}
+		} else if (tokeniser->context.chars.space ==
+					tokeniser->context.pending &&
+				hubbub_char_is(c, HUBBUB_CC_SPACE)) {
+			/* So far, the characters are all whitespace, as
+			 * between the tags of an indented document. Collect
+			 * the run of whitespace, so the treebuilder need not
+			 * look for it again */
+			tokeniser->context.pending += len;
+			tokeniser->context.pending +=
+					hubbub_tokeniser_scan_space(tokeniser,
+					hubbub_tokeniser_chars_room(tokeniser));
+			tokeniser->context.chars.space =
+					tokeniser->context.pending;
+		} else {
+			/* Just collect into buffer, along with any run of
+			 * similarly uninteresting characters after it */
+			tokeniser->context.pending += len;
+			tokeniser->context.pending +=
+					hubbub_tokeniser_scan_run(tokeniser,
+					data_pcdata_stops,
+					N_ELEMENTS(data_pcdata_stops),
+					hubbub_tokeniser_chars_room(tokeniser));
+		}
+
+		if (tokeniser->context.pending >= tokeniser->token_limit) {
+			/* Pass on what there is so far, and stop there if
+			 * that pauses the tokeniser or spends its budget */
+			hubbub_error err =
+					hubbub_tokeniser_split_chars(tokeniser);
+
+			if (err != HUBBUB_OK || tokeniser->paused)
+				return err;
+		}
+	}
+
+	return hubbub_tokeniser_data_end(tokeniser, error);
+}
+
+/**
+ * Data state for the RCDATA and CDATA content models
+ *
+ * These differ only in whether character references are recognised, and
+ * this is always inlined with a constant for that, giving a separate loop
+ * for each.
+ *
+ * \param tokeniser  Tokeniser instance
+ * \param rcdata     Whether the content model is RCDATA
+ * \return As for hubbub_tokeniser_handle_data()
+ */
+static inline hubbub_error hubbub_tokeniser_handle_data_rcdata(
+		hubbub_tokeniser *tokeniser, const bool rcdata)
+{
+	parserutils_error error;
+	const uint8_t *cptr;
+	size_t len;
+
+	while ((error = hubbub_tokeniser_peek(tokeniser,
+			tokeniser->context.pending, &cptr, &len)) ==
+					PARSERUTILS_OK) {
+		const uint8_t c = *cptr;
+
+		if (c == '&' && rcdata && tokeniser->escape_flag == false) {
+			tokeniser->state =
+					STATE_CHARACTER_REFERENCE_DATA;
+			/* Don't eat the '&'; it'll be handled by entity
+			 * consumption */
+			break;
+		} else if (c == '<' && tokeniser->escape_flag == false) {
+			hubbub_tokeniser_raw_lt what =
+				hubbub_tokeniser_classify_raw_lt(tokeniser);
+
+			if (what == RAW_LT_NEEDDATA) {
+				error = PARSERUTILS_NEEDDATA;
+				break;
+			} else if (what == RAW_LT_ESCAPE) {
+				tokeniser->escape_flag = true;
+				tokeniser->context.pending += SLEN("<!--");
+			} else if (what == RAW_LT_DATA) {
+				tokeniser->context.pending += len;
+			} else {
+				if (tokeniser->context.pending > 0) {
+					/* Emit any pending characters */
+					emit_current_chars(tokeniser);
+				}
+
+				/* Buffer '<' */
+				tokeniser->context.pending = len;
+				tokeniser->state = STATE_TAG_OPEN;
+				break;
+			}
+		} else if (c == '>' && tokeniser->escape_flag == true) {
+			if (tokeniser->context.pending < SLEN("--")) {
+				/* Some of the text before this was split
+				 * off, so count the dashes it ended with */
+				uint32_t dashes =
+					tokeniser->context.chars.dashes;
+
+				if (tokeniser->context.pending == 1) {
+					error = hubbub_tokeniser_peek(
+							tokeniser, 0,
+							&cptr, &len);
+					assert(error == PARSERUTILS_OK);
+
+					dashes = (*cptr == '-') ?
+							dashes + 1 : 0;
+				}
+
+				if (dashes >= SLEN("--"))
+					tokeniser->escape_flag = false;
+
+				tokeniser->context.pending += 1;
+				continue;
+			}
+
+			/* no need to check that there are enough characters,
+			 * since you can only run into this if the flag is
+			 * true in the first place, which requires four
+			 * characters, or the text before it was split off,
+			 * which is handled above. */
+			error = hubbub_tokeniser_peek(
+					tokeniser,
+					tokeniser->context.pending - 2,
+					&cptr,
+					&len);
+
+			assert(error == PARSERUTILS_OK);
+
+			if (strncmp((char *) cptr, "-->", SLEN("-->")) == 0) {
+				tokeniser->escape_flag = false;
+			}
+
+			tokeniser->context.pending += len;
+		} else if (c == '\0') {
+			error = hubbub_tokeniser_data_nul(tokeniser);
+			if (error != PARSERUTILS_OK)
+				break;
+		} else if (c == '\r') {
+			error = hubbub_tokeniser_data_cr(tokeniser, len);
+			if (error != PARSERUTILS_OK)
+				break;
+		} else {
+			/* Just collect into buffer, along with any run of
+			 * similarly uninteresting characters after it */
+			tokeniser->context.pending += len;
+
+			if (tokeniser->escape_flag) {
+				tokeniser->context.pending +=
+					hubbub_tokeniser_scan_run(tokeniser,
+					data_escaped_stops,
+					N_ELEMENTS(data_escaped_stops),
+					hubbub_tokeniser_chars_room(tokeniser));
+			} else if (rcdata) {
+				tokeniser->context.pending +=
+					hubbub_tokeniser_scan_run(tokeniser,
+					data_rcdata_stops,
+					N_ELEMENTS(data_rcdata_stops),
+					hubbub_tokeniser_chars_room(tokeniser));
+			} else {
+				tokeniser->context.pending +=
+					hubbub_tokeniser_scan_run(tokeniser,
+					data_cdata_stops,
+					N_ELEMENTS(data_cdata_stops),
+					hubbub_tokeniser_chars_room(tokeniser));
+			}
+		}
+
+		if (tokeniser->context.pending >= tokeniser->token_limit) {
+			/* Pass on what there is so far, and stop there if
+			 * that pauses the tokeniser or spends its budget */
+			hubbub_error err =
+					hubbub_tokeniser_split_chars(tokeniser);
+
+			if (err != HUBBUB_OK || tokeniser->paused)
+				return err;
+		}
+	}
+
+	return hubbub_tokeniser_data_end(tokeniser, error);
+}
+
+/**
+ * Data state for the PLAINTEXT content model
+ *
+ * \param tokeniser  Tokeniser instance
+ * \return As for hubbub_tokeniser_handle_data()
+ */
+static inline hubbub_error hubbub_tokeniser_handle_data_plaintext(
+		hubbub_tokeniser *tokeniser)
+{
+	parserutils_error error;
+	const uint8_t *cptr;
+	size_t len;
+
+	while ((error = hubbub_tokeniser_peek(tokeniser,
+			tokeniser->context.pending, &cptr, &len)) ==
+					PARSERUTILS_OK) {
+		const uint8_t c = *cptr;
+
+		if (c == '\0') {
+			error = hubbub_tokeniser_data_nul(tokeniser);
+			if (error != PARSERUTILS_OK)
+				break;
+		} else if (c == '\r') {
+			error = hubbub_tokeniser_data_cr(tokeniser, len);
+			if (error != PARSERUTILS_OK)
+				break;
+		} else {
+			/* Nothing else means anything here */
+			tokeniser->context.pending += len;
+			tokeniser->context.pending +=
+					hubbub_tokeniser_scan_run(tokeniser,
+					data_plaintext_stops,
+					N_ELEMENTS(data_plaintext_stops),
+					hubbub_tokeniser_chars_room(tokeniser));
+		}
+
+		if (tokeniser->context.pending >= tokeniser->token_limit) {
+			/* Pass on what there is so far, and stop there if
+			 * that pauses the tokeniser or spends its budget */
+			hubbub_error err =
+					hubbub_tokeniser_split_chars(tokeniser);
+
+			if (err != HUBBUB_OK || tokeniser->paused)
+				return err;
+		}
+	}
+
+	return hubbub_tokeniser_data_end(tokeniser, error);
+}
+
+/* this should always be called with an empty "chars" buffer */
+hubbub_error hubbub_tokeniser_handle_data(hubbub_tokeniser *tokeniser)
+{
+	/* The content model only changes between visits to this state, so
+	 * pick the loop for it once, rather than testing it for every
+	 * character */
+	switch (tokeniser->content_model) {
+	case HUBBUB_CONTENT_MODEL_PCDATA:
+		return hubbub_tokeniser_handle_data_pcdata(tokeniser);
+	case HUBBUB_CONTENT_MODEL_RCDATA:
+		return hubbub_tokeniser_handle_data_rcdata(tokeniser, true);
+	case HUBBUB_CONTENT_MODEL_CDATA:
+		return hubbub_tokeniser_handle_data_rcdata(tokeniser, false);
+	case HUBBUB_CONTENT_MODEL_PLAINTEXT:
+		break;
+	}
+
+	return hubbub_tokeniser_handle_data_plaintext(tokeniser);
+}
+
+/* emit any pending tokens before calling */
+hubbub_error hubbub_tokeniser_handle_character_reference_data(
+		hubbub_tokeniser *tokeniser)
+{
+	assert(tokeniser->context.pending == 0);
+
+	if (tokeniser->context.match_entity.complete == false) {
+		return hubbub_tokeniser_consume_character_reference(tokeniser,
+				tokeniser->context.pending);
+	} else {
+		hubbub_token token;
+
+		uint8_t utf8[6];
+		uint8_t *utf8ptr = utf8;
+		size_t len = sizeof(utf8);
+
+		token.type = HUBBUB_TOKEN_CHARACTER;
+		token.whitespace = false;
+
+		if (tokeniser->context.match_entity.codepoint) {
+			parserutils_charset_utf8_from_ucs4(
+				tokeniser->context.match_entity.codepoint,
+				&utf8ptr, &len);
+
+			token.data.character.ptr = utf8;
+			token.data.character.len = sizeof(utf8) - len;
+
+			/* +1 for ampersand */
+			tokeniser->context.pending =
+					tokeniser->context.match_entity.length
+							+ 1;
+
+			hubbub_tokeniser_emit_token(tokeniser, &token);
+		} else {
+			parserutils_error error;
+			const uint8_t *cptr = NULL;
+
+			error = hubbub_tokeniser_peek(
+					tokeniser,
+					tokeniser->context.pending,
+					&cptr,
+					&len);
+			if (error != PARSERUTILS_OK) {
+				return hubbub_error_from_parserutils_error(
+						error);
+			}
+
+			token.data.character.ptr = cptr;
+			token.data.character.len = len;
+
+			tokeniser->context.pending = len;
+			hubbub_tokeniser_emit_token(tokeniser, &token);
+		}
+
+		/* Reset for next time */
+		tokeniser->context.match_entity.complete = false;
+
+		tokeniser->state = STATE_DATA;
+	}
+
+	return HUBBUB_OK;
+}
+
+/* this state always switches to another state straight away */
+/* this state expects the current character to be '<' */
+hubbub_error hubbub_tokeniser_handle_tag_open(hubbub_tokeniser *tokeniser)
+{
+	hubbub_tag *ctag = &tokeniser->context.current_tag;
+
+	size_t len;
+	const uint8_t *cptr;
+	parserutils_error error;
+	uint8_t c;
+
+	assert(tokeniser->context.pending == 1);
+/*	assert(tokeniser->context.chars.ptr[0] == '<'); */
+
+	error = hubbub_tokeniser_peek(tokeniser,
+			tokeniser->context.pending, &cptr, &len);
+
+	if (error != PARSERUTILS_OK) {
+		if (error == PARSERUTILS_EOF) {
+			/* Return to data state with '<' still in "chars" */
+			tokeniser->state = STATE_DATA;
+			return HUBBUB_OK;
+		} else {
+			return hubbub_error_from_parserutils_error(error);
+		}
+	}
+
+	c = *cptr;
+
+	if (c == '/') {
+		tokeniser->context.pending += len;
+
+		tokeniser->context.close_tag_match.match = false;
+		tokeniser->context.close_tag_match.count = 0;
+
+		tokeniser->state = STATE_CLOSE_TAG_OPEN;
+	} else if (tokeniser->content_model == HUBBUB_CONTENT_MODEL_RCDATA ||
+			tokeniser->content_model ==
+					HUBBUB_CONTENT_MODEL_CDATA) {
+		/* Return to data state with '<' still in "chars" */
+		tokeniser->state = STATE_DATA;
+	} else if (tokeniser->content_model == HUBBUB_CONTENT_MODEL_PCDATA) {
+		if (c == '!') {
+			hubbub_tokeniser_advance(tokeniser, SLEN("<!"));
+
+			tokeniser->context.pending = 0;
+			tokeniser->state = STATE_MARKUP_DECLARATION_OPEN;
+		} else if (hubbub_char_is(c, HUBBUB_CC_ALPHA)) {
+			uint8_t lc = hubbub_char_tolower(c);
+
+			START(ctag->name,
+					tokeniser->context.current_tag_name_src,
+					&lc, len);
+			tokeniser->context.current_tag_name_hash =
+					hubbub_element_hash_step(
+					HUBBUB_ELEMENT_HASH_INIT, lc);
+			ctag->n_attributes = 0;
+			tokeniser->context.current_tag_type =
+					HUBBUB_TOKEN_START_TAG;
+
+			tokeniser->context.pending += len;
+
+			tokeniser->state = STATE_TAG_NAME;
+		} else if (c == '>') {
+			/** \todo parse error */
+
+			tokeniser->context.pending += len;
+			tokeniser->state = STATE_DATA;
+		} else if (c == '?') {
+			/** \todo parse error */
+
+			/* Cursor still at "<", need to advance past it */
+			hubbub_tokeniser_advance(tokeniser, SLEN("<"));
+			tokeniser->context.pending = 0;
+
+			tokeniser->state = STATE_BOGUS_COMMENT;
+		} else {
+			/* Return to data state with '<' still in "chars" */
+			tokeniser->state = STATE_DATA;
+		}
+	}
+
+	return HUBBUB_OK;
+}
+
+/* this state expects tokeniser->context.chars to be "</" */
+/* this state never stays in this state for more than one character */
+hubbub_error hubbub_tokeniser_handle_close_tag_open(hubbub_tokeniser *tokeniser)
+{
 	hubbub_tokeniser_context *ctx = &tokeniser->context;
 
 	size_t len;
 	const uint8_t *cptr;
 	parserutils_error error;
-	uint8_t c;
+	uint8_t c;
+
+	assert(tokeniser->context.pending == 2);
+/*	assert(tokeniser->context.chars.ptr[0] == '<'); */
+/*	assert(tokeniser->context.chars.ptr[1] == '/'); */
+
+	/**\todo fragment case */
+
+	if (tokeniser->content_model == HUBBUB_CONTENT_MODEL_RCDATA ||
+			tokeniser->content_model ==
+					HUBBUB_CONTENT_MODEL_CDATA) {
+		uint8_t *start_tag_name =
+			tokeniser->context.last_start_tag_name;
+		size_t start_tag_len =
+			tokeniser->context.last_start_tag_len;
+
+		while ((error = hubbub_tokeniser_peek(tokeniser,
+					ctx->pending +
+						ctx->close_tag_match.count,
+					&cptr,
+					&len)) == PARSERUTILS_OK) {
+			c = *cptr;
+
+			/* The last start tag name is already lowercase. If the
+			 * whole name matched before we ran out of data, we're
+			 * only here again to look at the character after it. */
+			if (ctx->close_tag_match.count == start_tag_len ||
+					start_tag_name[ctx->close_tag_match.count]
+					!= hubbub_char_tolower(c)) {
+				break;
+			}
+
+			ctx->close_tag_match.count += len;
+
+			if (ctx->close_tag_match.count == start_tag_len) {
+				ctx->close_tag_match.match = true;
+				break;
+			}
+		}
+
+		if (error != PARSERUTILS_OK && error != PARSERUTILS_EOF) {
+			return hubbub_error_from_parserutils_error(error);
+		}
+
+		if (ctx->close_tag_match.match == true) {
+			error = hubbub_tokeniser_peek(
+			 		tokeniser,
+			 		ctx->pending +
+				 		ctx->close_tag_match.count,
+					&cptr,
+			 		&len);
+
+			if (error != PARSERUTILS_OK && 
+					error != PARSERUTILS_EOF) {
+				return hubbub_error_from_parserutils_error(
+						error);
+			} else if (error != PARSERUTILS_EOF) {
+				c = *cptr;
+
+				if (c != '\t' && c != '\n' && c != '\f' &&
+						c != ' ' && c != '>' &&
+						c != '/') {
+					ctx->close_tag_match.match = false;
+				}
+			}
+		}
+	}
+
+	if (ctx->close_tag_match.match == false &&
+			tokeniser->content_model !=
+					HUBBUB_CONTENT_MODEL_PCDATA) {
+		/* We should emit "</" here, but instead we leave it in the
+		 * buffer so the data state emits it with any characters
+		 * following it */
+		tokeniser->state = STATE_DATA;
+	} else {
+		error = hubbub_tokeniser_peek(tokeniser,
+				tokeniser->context.pending, &cptr, &len);
+
+		if (error == PARSERUTILS_EOF) {
+			/** \todo parse error */
+
+			/* Return to data state with "</" pending */
+			tokeniser->state = STATE_DATA;
+			return HUBBUB_OK;
+		} else if (error != PARSERUTILS_OK) {
+			return hubbub_error_from_parserutils_error(error);
+		}
+
+		c = *cptr;
+
+		if (hubbub_char_is(c, HUBBUB_CC_ALPHA)) {
+			uint8_t lc = hubbub_char_tolower(c);
+			START(tokeniser->context.current_tag.name,
+					tokeniser->context.current_tag_name_src,
+					&lc, len);
+			tokeniser->context.current_tag_name_hash =
+					hubbub_element_hash_step(
+					HUBBUB_ELEMENT_HASH_INIT, lc);
+			tokeniser->context.current_tag.n_attributes = 0;
+
+			tokeniser->context.current_tag_type =
+					HUBBUB_TOKEN_END_TAG;
+
+			tokeniser->context.pending += len;
+
+			tokeniser->state = STATE_TAG_NAME;
+		} else if (c == '>') {
+			/* Cursor still at "</", need to collect ">" */
+			tokeniser->context.pending += len;
+
+			/* Now need to advance past "</>" */
+			hubbub_tokeniser_advance(tokeniser,
+					tokeniser->context.pending);
+			tokeniser->context.pending = 0;
+
+			/** \todo parse error */
+			tokeniser->state = STATE_DATA;
+		} else {
+			/** \todo parse error */
+
+			/* Cursor still at "</", need to advance past it */
+			hubbub_tokeniser_advance(tokeniser,
+					tokeniser->context.pending);
+			tokeniser->context.pending = 0;
+
+			tokeniser->state = STATE_BOGUS_COMMENT;
+		}
+	}
+
+	return HUBBUB_OK;
+}
+
+/* this state expects tokeniser->context.current_tag to already have its
+   first character set */
+hubbub_error hubbub_tokeniser_handle_tag_name(hubbub_tokeniser *tokeniser)
+{
+	hubbub_tag *ctag = &tokeniser->context.current_tag;
+
+	size_t len;
+	const uint8_t *cptr;
+	parserutils_error error;
+	uint8_t c;
+
+	assert(tokeniser->context.pending > 0);
+/*	assert(tokeniser->context.chars.ptr[0] == '<'); */
+	assert(ctag->name.len > 0);
+/*	assert(ctag->name.ptr); */
+
+	error = hubbub_tokeniser_peek(tokeniser,
+			tokeniser->context.pending, &cptr, &len);
+
+	if (error != PARSERUTILS_OK) {
+		if (error == PARSERUTILS_EOF) {
+			tokeniser->state = STATE_DATA;
+			return emit_current_tag(tokeniser);
+		} else {
+			return hubbub_error_from_parserutils_error(error);
+		}
+	}
+
+	c = *cptr;
+
+	if (hubbub_char_is_space(c)) {
+		tokeniser->context.pending += len;
+		tokeniser->state = STATE_BEFORE_ATTRIBUTE_NAME;
+	} else if (c == '>') {
+		tokeniser->context.pending += len;
+		tokeniser->state = STATE_DATA;
+		return emit_current_tag(tokeniser);
+	} else if (c == '\0') {
+		size_t i;
+
+		COLLECT(ctag->name, tokeniser->context.current_tag_name_src,
+				u_fffd, sizeof(u_fffd));
+
+		for (i = 0; i < sizeof(u_fffd); i++) {
+			tokeniser->context.current_tag_name_hash =
+					hubbub_element_hash_step(
+					tokeniser->context.current_tag_name_hash,
+					u_fffd[i]);
+		}
+
+		tokeniser->context.pending += len;
+	} else if (c == '/') {
+		tokeniser->context.pending += len;
+		tokeniser->state = STATE_SELF_CLOSING_START_TAG;
+	} else {
+		return hubbub_tokeniser_collect_lower_run(tokeniser,
+				&ctag->name,
+				&tokeniser->context.current_tag_name_src,
+				HUBBUB_CC_TAG_NAME_END,
+				&tokeniser->context.current_tag_name_hash);
+	}
+
+	return HUBBUB_OK;
+}
+
+hubbub_error hubbub_tokeniser_handle_before_attribute_name(
+		hubbub_tokeniser *tokeniser)
+{
+	hubbub_tag *ctag = &tokeniser->context.current_tag;
+
+	size_t len;
+	const uint8_t *cptr;
+	parserutils_error error;
+	uint8_t c;
+
+	error = hubbub_tokeniser_peek(tokeniser,
+			tokeniser->context.pending, &cptr, &len);
+
+	if (error != PARSERUTILS_OK) {
+		if (error == PARSERUTILS_EOF) {
+			tokeniser->state = STATE_DATA;
+			return emit_current_tag(tokeniser);
+		} else {
+			return hubbub_error_from_parserutils_error(error);
+		}
+	}
+
+	c = *cptr;
+
+	if (hubbub_char_is_space(c)) {
+		/* pass over in silence */
+		tokeniser->context.pending += len;
+	} else if (c == '>') {
+		tokeniser->context.pending += len;
+		tokeniser->state = STATE_DATA;
+		return emit_current_tag(tokeniser);
+	} else if (c == '/') {
+		tokeniser->context.pending += len;
+		tokeniser->state = STATE_SELF_CLOSING_START_TAG;
+	} else {
+		hubbub_attribute *attr;
+		hubbub_tokeniser_attribute_src *asrc;
+		hubbub_error err;
+
+		if (hubbub_char_is(c, HUBBUB_CC_QUOTE) || c == '=') {
+			/** \todo parse error */
+		}
+
+		err = hubbub_tokeniser_grow_attributes(tokeniser);
+		if (err != HUBBUB_OK)
+			return err;
+
+		attr = &ctag->attributes[ctag->n_attributes];
+		asrc = &tokeniser->context.attribute_src[ctag->n_attributes];
+
+		if (hubbub_char_is(c, HUBBUB_CC_UPPER)) {
+			uint8_t lc = hubbub_char_tolower(c);
+			START(attr->name, asrc->name, &lc, len);
+		} else if (c == '\0') {
+			START(attr->name, asrc->name, u_fffd, sizeof(u_fffd));
+		} else {
+			START(attr->name, asrc->name, cptr, len);
+		}
+
+		attr->ns = HUBBUB_NS_NULL;
+		attr->value.ptr = NULL;
+		attr->value.len = 0;
+		attr->raw = false;
+		asrc->value = STRING_BUFFERED;
+		tokeniser->context.value_truncated = false;
+
+		ctag->n_attributes++;
+
+		tokeniser->context.pending += len;
+		tokeniser->state = STATE_ATTRIBUTE_NAME;
+	}
+
+	return HUBBUB_OK;
+}
+
+hubbub_error hubbub_tokeniser_handle_attribute_name(hubbub_tokeniser *tokeniser)
+{
+	hubbub_tag *ctag = &tokeniser->context.current_tag;
+	hubbub_tokeniser_attribute_src *asrc =
+			&tokeniser->context.attribute_src[
+			ctag->n_attributes - 1];
+
+	size_t len;
+	const uint8_t *cptr;
+	parserutils_error error;
+	uint8_t c;
+
+	assert(ctag->attributes[ctag->n_attributes - 1].name.len > 0);
+
+	error = hubbub_tokeniser_peek(tokeniser,
+			tokeniser->context.pending, &cptr, &len);
+
+	if (error != PARSERUTILS_OK) {
+		if (error == PARSERUTILS_EOF) {
+			tokeniser->state = STATE_DATA;
+			return emit_current_tag(tokeniser);
+		} else {
+			return hubbub_error_from_parserutils_error(error);
+		}
+	}
+
+	c = *cptr;
+
+	if (hubbub_char_is_space(c)) {
+		tokeniser->context.pending += len;
+		tokeniser->state = STATE_AFTER_ATTRIBUTE_NAME;
+	} else if (c == '=') {
+		tokeniser->context.pending += len;
+		tokeniser->state = STATE_BEFORE_ATTRIBUTE_VALUE;
+	} else if (c == '>') {
+		tokeniser->context.pending += len;
+		tokeniser->state = STATE_DATA;
+		return emit_current_tag(tokeniser);
+	} else if (c == '/') {
+		tokeniser->context.pending += len;
+		tokeniser->state = STATE_SELF_CLOSING_START_TAG;
+	} else if (c == '\0') {
+		COLLECT(ctag->attributes[ctag->n_attributes - 1].name,
+				asrc->name, u_fffd, sizeof(u_fffd));
+		tokeniser->context.pending += len;
+	} else {
+		return hubbub_tokeniser_collect_lower_run(tokeniser,
+				&ctag->attributes[ctag->n_attributes - 1].name,
+				&asrc->name, HUBBUB_CC_ATTR_NAME_END, NULL);
+	}
+
+	return HUBBUB_OK;
+}
+
+hubbub_error hubbub_tokeniser_handle_after_attribute_name(
+		hubbub_tokeniser *tokeniser)
+{
+	hubbub_tag *ctag = &tokeniser->context.current_tag;
+
+	size_t len;
+	const uint8_t *cptr;
+	parserutils_error error;
+	uint8_t c;
+
+	error = hubbub_tokeniser_peek(tokeniser,
+			tokeniser->context.pending, &cptr, &len);
+
+	if (error != PARSERUTILS_OK) {
+		if (error == PARSERUTILS_EOF) {
+			tokeniser->state = STATE_DATA;
+			return emit_current_tag(tokeniser);
+		} else {
+			return hubbub_error_from_parserutils_error(error);
+		}
+	}
+
+	c = *cptr;
+
+	if (hubbub_char_is_space(c)) {
+		tokeniser->context.pending += len;
+	} else if (c == '=') {
+		tokeniser->context.pending += len;
+		tokeniser->state = STATE_BEFORE_ATTRIBUTE_VALUE;
+	} else if (c == '>') {
+		tokeniser->context.pending += len;
+
+		tokeniser->state = STATE_DATA;
+		return emit_current_tag(tokeniser);
+	} else if (c == '/') {
+		tokeniser->context.pending += len;
+		tokeniser->state = STATE_SELF_CLOSING_START_TAG;
+	} else {
+		hubbub_attribute *attr;
+		hubbub_tokeniser_attribute_src *asrc;
+		hubbub_error err;
+
+		if (hubbub_char_is(c, HUBBUB_CC_QUOTE)) {
+			/** \todo parse error */
+		}
+
+		err = hubbub_tokeniser_grow_attributes(tokeniser);
+		if (err != HUBBUB_OK)
+			return err;
+
+		attr = &ctag->attributes[ctag->n_attributes];
+		asrc = &tokeniser->context.attribute_src[ctag->n_attributes];
+
+		if (hubbub_char_is(c, HUBBUB_CC_UPPER)) {
+			uint8_t lc = hubbub_char_tolower(c);
+			START(attr->name, asrc->name, &lc, len);
+		} else if (c == '\0') {
+			START(attr->name, asrc->name, u_fffd, sizeof(u_fffd));
+		} else {
+			START(attr->name, asrc->name, cptr, len);
+		}
+
+		attr->ns = HUBBUB_NS_NULL;
+		attr->value.ptr = NULL;
+		attr->value.len = 0;
+		attr->raw = false;
+		asrc->value = STRING_BUFFERED;
+		tokeniser->context.value_truncated = false;
+
+		ctag->n_attributes++;
+
+		tokeniser->context.pending += len;
+		tokeniser->state = STATE_ATTRIBUTE_NAME;
+	}
+
+	return HUBBUB_OK;
+}
+
+/* this state is only ever triggered by an '=' */
+hubbub_error hubbub_tokeniser_handle_before_attribute_value(
+		hubbub_tokeniser *tokeniser)
+{
+	hubbub_tag *ctag = &tokeniser->context.current_tag;
+	hubbub_tokeniser_attribute_src *asrc =
+			&tokeniser->context.attribute_src[
+			ctag->n_attributes - 1];
+
+	size_t len;
+	const uint8_t *cptr;
+	parserutils_error error;
+	uint8_t c;
+
+	error = hubbub_tokeniser_peek(tokeniser,
+			tokeniser->context.pending, &cptr, &len);
+
+	if (error != PARSERUTILS_OK) {
+		if (error == PARSERUTILS_EOF) {
+			/** \todo parse error */
+			tokeniser->state = STATE_DATA;
+			return emit_current_tag(tokeniser);
+		} else {
+			return hubbub_error_from_parserutils_error(error);
+		}
+	}
+
+	c = *cptr;
+
+	if (hubbub_char_is_space(c)) {
+		tokeniser->context.pending += len;
+	} else if (c == '"') {
+		tokeniser->context.pending += len;
+		tokeniser->state = STATE_ATTRIBUTE_VALUE_DQ;
+	} else if (c == '&' || (c == '\0' && tokeniser->raw_values)) {
+		/* Don't consume it -- reprocess in UQ state */
+		tokeniser->state = STATE_ATTRIBUTE_VALUE_UQ;
+	} else if (c == '\'') {
+		tokeniser->context.pending += len;
+		tokeniser->state = STATE_ATTRIBUTE_VALUE_SQ;
+	} else if (c == '>') {
+		/** \todo parse error */
+		tokeniser->context.pending += len;
+
+		tokeniser->state = STATE_DATA;
+		return emit_current_tag(tokeniser);
+	} else if (c == '\0') {
+		START(ctag->attributes[ctag->n_attributes - 1].value,
+				asrc->value, u_fffd, sizeof(u_fffd));
+		tokeniser->context.pending += len;
+		tokeniser->state = STATE_ATTRIBUTE_VALUE_UQ;
+	} else {
+		if (c == '=') {
+			/** \todo parse error */
+		}
+
+		START(ctag->attributes[ctag->n_attributes - 1].value,
+				asrc->value, cptr, len);
+
+		tokeniser->context.pending += len;
+		tokeniser->state = STATE_ATTRIBUTE_VALUE_UQ;
+	}
+
+	return HUBBUB_OK;
+}
+
+hubbub_error hubbub_tokeniser_handle_attribute_value_dq(
+		hubbub_tokeniser *tokeniser)
+{
+	hubbub_tag *ctag = &tokeniser->context.current_tag;
+	hubbub_tokeniser_attribute_src *asrc =
+			&tokeniser->context.attribute_src[
+			ctag->n_attributes - 1];
+
+	size_t len;
+	const uint8_t *cptr;
+	parserutils_error error;
+	hubbub_error err;
+	uint8_t c;
+
+	err = hubbub_tokeniser_limit_value(tokeniser);
+	if (err != HUBBUB_OK)
+		return err;
+
+	error = hubbub_tokeniser_peek(tokeniser,
+			tokeniser->context.pending, &cptr, &len);
+
+	if (error != PARSERUTILS_OK) {
+		if (error == PARSERUTILS_EOF) {
+			tokeniser->state = STATE_DATA;
+			return emit_current_tag(tokeniser);
+		} else {
+			return hubbub_error_from_parserutils_error(error);
+		}
+	}
+
+	c = *cptr;
+
+	if (c == '"') {
+		tokeniser->context.pending += len;
+		tokeniser->state = STATE_AFTER_ATTRIBUTE_VALUE_Q;
+	} else if (tokeniser->raw_values &&
+			tokeniser->context.value_truncated == false &&
+			(c == '&' || c == '\0' || c == '\r')) {
+		/* Leave the value as written, for the client to decode */
+		ctag->attributes[ctag->n_attributes - 1].raw = true;
+
+		COLLECT_MS(ctag->attributes[ctag->n_attributes - 1].value,
+				asrc->value, cptr, len);
+		tokeniser->context.pending += len;
+
+		return hubbub_tokeniser_collect_run(tokeniser,
+				&ctag->attributes[ctag->n_attributes - 1].value,
+				&asrc->value,
+				attribute_value_dq_stops,
+				N_ELEMENTS(attribute_value_dq_stops));
+	} else if (c == '&') {
+		tokeniser->context.prev_state = tokeniser->state;
+		tokeniser->state = STATE_CHARACTER_REFERENCE_IN_ATTRIBUTE_VALUE;
+		tokeniser->context.allowed_char = '"';
+		/* Don't eat the '&'; it'll be handled by entity consumption */
+	} else if (tokeniser->context.value_truncated) {
+		/* Skip the rest of the value */
+		tokeniser->context.pending += len;
+		tokeniser->context.pending += hubbub_tokeniser_scan_run(
+				tokeniser, attribute_value_dq_stops,
+				N_ELEMENTS(attribute_value_dq_stops),
+				tokeniser->token_limit);
+
+		hubbub_tokeniser_advance(tokeniser,
+				tokeniser->context.pending);
+		tokeniser->context.pending = 0;
+	} else if (c == '\0') {
+		COLLECT_MS(ctag->attributes[ctag->n_attributes - 1].value,
+				asrc->value, u_fffd, sizeof(u_fffd));
+		tokeniser->context.pending += len;
+	} else if (c == '\r') {
+		error = hubbub_tokeniser_peek(
+				tokeniser,
+				tokeniser->context.pending + len,
+				&cptr,
+				&len);
+
+		if (error != PARSERUTILS_OK && error != PARSERUTILS_EOF) {
+			return hubbub_error_from_parserutils_error(error);
+		} else if (error == PARSERUTILS_EOF || *cptr != '\n') {
+			COLLECT_MS(ctag->attributes[
+					ctag->n_attributes - 1].value,
+					asrc->value, &lf, sizeof(lf));
+		}
+
+		/* Consume '\r' */
+		tokeniser->context.pending += 1;
+	} else {
+		COLLECT_MS(ctag->attributes[ctag->n_attributes - 1].value,
+				asrc->value, cptr, len);
+		tokeniser->context.pending += len;
+
+		return hubbub_tokeniser_collect_run(tokeniser,
+				&ctag->attributes[ctag->n_attributes - 1].value,
+				&asrc->value,
+				attribute_value_dq_stops,
+				N_ELEMENTS(attribute_value_dq_stops));
+	}
+
+	return HUBBUB_OK;
+}
+
+hubbub_error hubbub_tokeniser_handle_attribute_value_sq(
+		hubbub_tokeniser *tokeniser)
+{
+	hubbub_tag *ctag = &tokeniser->context.current_tag;
+	hubbub_tokeniser_attribute_src *asrc =
+			&tokeniser->context.attribute_src[
+			ctag->n_attributes - 1];
+
+	size_t len;
+	const uint8_t *cptr;
+	parserutils_error error;
+	hubbub_error err;
+	uint8_t c;
+
+	err = hubbub_tokeniser_limit_value(tokeniser);
+	if (err != HUBBUB_OK)
+		return err;
+
+	error = hubbub_tokeniser_peek(tokeniser,
+			tokeniser->context.pending, &cptr, &len);
+
+	if (error != PARSERUTILS_OK) {
+		if (error == PARSERUTILS_EOF) {
+			tokeniser->state = STATE_DATA;
+			return emit_current_tag(tokeniser);
+		} else {
+			return hubbub_error_from_parserutils_error(error);
+		}
+	}
+
+	c = *cptr;
+
+	if (c == '\'') {
+		tokeniser->context.pending += len;
+		tokeniser->state = STATE_AFTER_ATTRIBUTE_VALUE_Q;
+	} else if (tokeniser->raw_values &&
+			tokeniser->context.value_truncated == false &&
+			(c == '&' || c == '\0' || c == '\r')) {
+		/* Leave the value as written, for the client to decode */
+		ctag->attributes[ctag->n_attributes - 1].raw = true;
+
+		COLLECT_MS(ctag->attributes[ctag->n_attributes - 1].value,
+				asrc->value, cptr, len);
+		tokeniser->context.pending += len;
+
+		return hubbub_tokeniser_collect_run(tokeniser,
+				&ctag->attributes[ctag->n_attributes - 1].value,
+				&asrc->value,
+				attribute_value_sq_stops,
+				N_ELEMENTS(attribute_value_sq_stops));
+	} else if (c == '&') {
+		tokeniser->context.prev_state = tokeniser->state;
+		tokeniser->state = STATE_CHARACTER_REFERENCE_IN_ATTRIBUTE_VALUE;
+		tokeniser->context.allowed_char = '\'';
+		/* Don't eat the '&'; it'll be handled by entity consumption */
+	} else if (tokeniser->context.value_truncated) {
+		/* Skip the rest of the value */
+		tokeniser->context.pending += len;
+		tokeniser->context.pending += hubbub_tokeniser_scan_run(
+				tokeniser, attribute_value_sq_stops,
+				N_ELEMENTS(attribute_value_sq_stops),
+				tokeniser->token_limit);
+
+		hubbub_tokeniser_advance(tokeniser,
+				tokeniser->context.pending);
+		tokeniser->context.pending = 0;
+	} else if (c == '\0') {
+		COLLECT_MS(ctag->attributes[ctag->n_attributes - 1].value,
+				asrc->value, u_fffd, sizeof(u_fffd));
+		tokeniser->context.pending += len;
+	} else if (c == '\r') {
+		error = hubbub_tokeniser_peek(
+				tokeniser,
+				tokeniser->context.pending + len,
+				&cptr,
+				&len);
+
+		if (error != PARSERUTILS_OK && error != PARSERUTILS_EOF) {
+			return hubbub_error_from_parserutils_error(error);
+		} else if (error == PARSERUTILS_EOF || *cptr != '\n') {
+			COLLECT_MS(ctag->attributes[
+					ctag->n_attributes - 1].value,
+					asrc->value, &lf, sizeof(lf));
+		}
+
+		/* Consume \r */
+		tokeniser->context.pending += 1;
+	} else {
+		COLLECT_MS(ctag->attributes[ctag->n_attributes - 1].value,
+				asrc->value, cptr, len);
+		tokeniser->context.pending += len;
+
+		return hubbub_tokeniser_collect_run(tokeniser,
+				&ctag->attributes[ctag->n_attributes - 1].value,
+				&asrc->value,
+				attribute_value_sq_stops,
+				N_ELEMENTS(attribute_value_sq_stops));
+	}
+
+	return HUBBUB_OK;
+}
+
+hubbub_error hubbub_tokeniser_handle_attribute_value_uq(
+		hubbub_tokeniser *tokeniser)
+{
+	hubbub_tag *ctag = &tokeniser->context.current_tag;
+	hubbub_tokeniser_attribute_src *asrc =
+			&tokeniser->context.attribute_src[
+			ctag->n_attributes - 1];
+	uint8_t c;
+
+	size_t len;
+	const uint8_t *cptr;
+	parserutils_error error;
+	hubbub_error err;
+
+	err = hubbub_tokeniser_limit_value(tokeniser);
+	if (err != HUBBUB_OK)
+		return err;
+
+	error = hubbub_tokeniser_peek(tokeniser,
+			tokeniser->context.pending, &cptr, &len);
+
+	if (error != PARSERUTILS_OK) {
+		if (error == PARSERUTILS_EOF) {
+			tokeniser->state = STATE_DATA;
+			return emit_current_tag(tokeniser);
+		} else {
+			return hubbub_error_from_parserutils_error(error);
+		}
+	}
+
+	c = *cptr;
+
+	assert(c == '&' || (c == '\0' && tokeniser->raw_values) ||
+		tokeniser->context.value_truncated ||
+		ctag->attributes[ctag->n_attributes - 1].value.len >= 1);
+
+	if (hubbub_char_is_space(c)) {
+		tokeniser->context.pending += len;
+		tokeniser->state = STATE_BEFORE_ATTRIBUTE_NAME;
+	} else if (tokeniser->raw_values &&
+			tokeniser->context.value_truncated == false &&
+			(c == '&' || c == '\0')) {
+		/* Leave the value as written, for the client to decode */
+		ctag->attributes[ctag->n_attributes - 1].raw = true;
+
+		COLLECT_MS(ctag->attributes[ctag->n_attributes - 1].value,
+				asrc->value, cptr, len);
+		tokeniser->context.pending += len;
+
+		return hubbub_tokeniser_collect_run(tokeniser,
+				&ctag->attributes[ctag->n_attributes - 1].value,
+				&asrc->value,
+				attribute_value_uq_stops,
+				N_ELEMENTS(attribute_value_uq_stops));
+	} else if (c == '&') {
+		tokeniser->context.prev_state = tokeniser->state;
+		tokeniser->state = STATE_CHARACTER_REFERENCE_IN_ATTRIBUTE_VALUE;
+		/* Don't eat the '&'; it'll be handled by entity consumption */
+	} else if (c == '>') {
+		tokeniser->context.pending += len;
+		tokeniser->state = STATE_DATA;
+		return emit_current_tag(tokeniser);
+	} else if (tokeniser->context.value_truncated) {
+		/* Skip the rest of the value */
+		tokeniser->context.pending += len;
+		tokeniser->context.pending += hubbub_tokeniser_scan_run(
+				tokeniser, attribute_value_uq_stops,
+				N_ELEMENTS(attribute_value_uq_stops),
+				tokeniser->token_limit);
+
+		hubbub_tokeniser_advance(tokeniser,
+				tokeniser->context.pending);
+		tokeniser->context.pending = 0;
+	} else if (c == '\0') {
+		COLLECT(ctag->attributes[ctag->n_attributes - 1].value,
+				asrc->value, u_fffd, sizeof(u_fffd));
+		tokeniser->context.pending += len;
+	} else {
+		if (hubbub_char_is(c, HUBBUB_CC_QUOTE) || c == '=') {
+			/** \todo parse error */
+		}
+
+		COLLECT(ctag->attributes[ctag->n_attributes - 1].value,
+				asrc->value, cptr, len);
+		tokeniser->context.pending += len;
+
+		return hubbub_tokeniser_collect_run(tokeniser,
+				&ctag->attributes[ctag->n_attributes - 1].value,
+				&asrc->value,
+				attribute_value_uq_stops,
+				N_ELEMENTS(attribute_value_uq_stops));
+	}
+
+	return HUBBUB_OK;
+}
+
+hubbub_error hubbub_tokeniser_handle_character_reference_in_attribute_value(
+		hubbub_tokeniser *tokeniser)
+{
+	if (tokeniser->context.match_entity.complete == false) {
+		return hubbub_tokeniser_consume_character_reference(tokeniser,
+				tokeniser->context.pending);
+	} else {
+		hubbub_tag *ctag = &tokeniser->context.current_tag;
+		hubbub_attribute *attr = &ctag->attributes[
+				ctag->n_attributes - 1];
+		hubbub_tokeniser_attribute_src *asrc =
+				&tokeniser->context.attribute_src[
+				ctag->n_attributes - 1];
+
+		uint8_t utf8[6];
+		uint8_t *utf8ptr = utf8;
+		size_t len = sizeof(utf8);
+
+		if (tokeniser->context.match_entity.codepoint) {
+			parserutils_charset_utf8_from_ucs4(
+				tokeniser->context.match_entity.codepoint,
+				&utf8ptr, &len);
+
+			if (tokeniser->context.value_truncated == false) {
+				COLLECT_MS(attr->value, asrc->value,
+						utf8, sizeof(utf8) - len);
+			}
+
+			/* +1 for the ampersand */
+			tokeniser->context.pending +=
+					tokeniser->context.match_entity.length
+					+ 1;
+		} else {
+			size_t len = 0;
+			const uint8_t *cptr = NULL;
+			parserutils_error error;
+
+			error = hubbub_tokeniser_peek(
+					tokeniser,
+					tokeniser->context.pending, 
+					&cptr,
+					&len);
+			if (error != PARSERUTILS_OK) {
+				return hubbub_error_from_parserutils_error(
+						error);
+			}
+
+			/* Insert the ampersand */
+			if (tokeniser->context.value_truncated == false) {
+				COLLECT_MS(attr->value, asrc->value,
+						cptr, len);
+			}
+			tokeniser->context.pending += len;
+		}
+
+		/* Reset for next time */
+		tokeniser->context.match_entity.complete = false;
+
+		/* And back to the previous state */
+		tokeniser->state = tokeniser->context.prev_state;
+	}
+
+	return HUBBUB_OK;
+}
+
+/* always switches state */
+hubbub_error hubbub_tokeniser_handle_after_attribute_value_q(
+		hubbub_tokeniser *tokeniser)
+{
+	size_t len;
+	const uint8_t *cptr;
+	parserutils_error error;
+	uint8_t c;
+
+	error = hubbub_tokeniser_peek(tokeniser,
+			tokeniser->context.pending, &cptr, &len);
+
+	if (error != PARSERUTILS_OK) {
+		if (error == PARSERUTILS_EOF) {
+			tokeniser->state = STATE_DATA;
+			return emit_current_tag(tokeniser);
+		} else {
+			return hubbub_error_from_parserutils_error(error);
+		}
+	}
+
+	c = *cptr;
+
+	if (hubbub_char_is_space(c)) {
+		tokeniser->context.pending += len;
+		tokeniser->state = STATE_BEFORE_ATTRIBUTE_NAME;
+	} else if (c == '>') {
+		tokeniser->context.pending += len;
+
+		tokeniser->state = STATE_DATA;
+		return emit_current_tag(tokeniser);
+	} else if (c == '/') {
+		tokeniser->context.pending += len;
+		tokeniser->state = STATE_SELF_CLOSING_START_TAG;
+	} else {
+		/** \todo parse error */
+		/* Reprocess character in before attribute name state */
+		tokeniser->state = STATE_BEFORE_ATTRIBUTE_NAME;
+	}
+
+	return HUBBUB_OK;
+}
+
+hubbub_error hubbub_tokeniser_handle_self_closing_start_tag(
+		hubbub_tokeniser *tokeniser)
+{
+	size_t len;
+	const uint8_t *cptr;
+	parserutils_error error;
+	uint8_t c;
+
+	error = hubbub_tokeniser_peek(tokeniser,
+			tokeniser->context.pending, &cptr, &len);
+
+	if (error != PARSERUTILS_OK) {
+		if (error == PARSERUTILS_EOF) {
+			tokeniser->state = STATE_DATA;
+			return emit_current_tag(tokeniser);
+		} else {
+			return hubbub_error_from_parserutils_error(error);
+		}
+	}
+
+	c = *cptr;
+
+	if (c == '>') {
+		tokeniser->context.pending += len;
+		tokeniser->state = STATE_DATA;
+
+		tokeniser->context.current_tag.self_closing = true;
+		return emit_current_tag(tokeniser);
+	} else {
+		/* Reprocess character in before attribute name state */
+		tokeniser->state = STATE_BEFORE_ATTRIBUTE_NAME;
+	}
+
+	return HUBBUB_OK;
+}
+
+/* this state expects tokeniser->context.chars to be empty on first entry */
+hubbub_error hubbub_tokeniser_handle_bogus_comment(hubbub_tokeniser *tokeniser)
+{
+	hubbub_string *comment = &tokeniser->context.current_comment;
+	size_t *src = &tokeniser->context.current_comment_src;
+	size_t len;
+	const uint8_t *cptr;
+	parserutils_error error;
+	uint8_t c;
+
+	error = hubbub_tokeniser_peek(tokeniser,
+			tokeniser->context.pending, &cptr, &len);
+
+	if (error != PARSERUTILS_OK) {
+		if (error == PARSERUTILS_EOF) {
+			tokeniser->state = STATE_DATA;
+			return emit_current_comment(tokeniser);
+		} else {
+			return hubbub_error_from_parserutils_error(error);
+		}
+	}
+
+	c = *cptr;
+
+	if (c == '>') {
+		tokeniser->context.pending += len;
+		tokeniser->state = STATE_DATA;
+		return emit_current_comment(tokeniser);
+	} else if (tokeniser->drop_comments) {
+		/* Nothing is kept, so skip straight to the next '>' */
+		tokeniser->context.pending += len;
+		tokeniser->context.pending += hubbub_tokeniser_scan_run(
+				tokeniser, bogus_comment_drop_stops,
+				N_ELEMENTS(bogus_comment_drop_stops),
+				tokeniser->token_limit);
+	} else if (c == '\0') {
+		COLLECT_MS(*comment, *src, u_fffd, sizeof(u_fffd));
+
+		tokeniser->context.pending += len;
+	} else if (c == '\r') {
+		error = hubbub_tokeniser_peek(
+				tokeniser,
+				tokeniser->context.pending,
+				&cptr,
+				&len);
+
+		if (error != PARSERUTILS_OK && error != PARSERUTILS_EOF) {
+			return hubbub_error_from_parserutils_error(error);
+		} else if (error == PARSERUTILS_EOF || *cptr != '\n') {
+			COLLECT_MS(*comment, *src, &lf, sizeof(lf));
+		}
+		tokeniser->context.pending += len;
+	} else {
+		COLLECT_MS(*comment, *src, cptr, len);
+
+		tokeniser->context.pending += len;
+	}
+
+	if (comment->len >= tokeniser->token_limit) {
+		/* Pass on what there is so far */
+		tokeniser->context.incomplete = true;
+		return emit_current_comment(tokeniser);
+	}
+
+	return HUBBUB_OK;
+}
+
+/* this state always switches to another state straight away */
+hubbub_error hubbub_tokeniser_handle_markup_declaration_open(
+		hubbub_tokeniser *tokeniser)
+{
+	size_t len;
+	const uint8_t *cptr;
+	parserutils_error error;
+	uint8_t c;
+
+	assert(tokeniser->context.pending == 0);
+
+	error = hubbub_tokeniser_peek(tokeniser, 0, &cptr, &len);
+
+	if (error != PARSERUTILS_OK) {
+		if (error == PARSERUTILS_EOF) {
+			tokeniser->state = STATE_BOGUS_COMMENT;
+			return HUBBUB_OK;
+		} else {
+			return hubbub_error_from_parserutils_error(error);
+		}
+	}
+
+	c = *cptr;
+
+	if (c == '-') {
+		tokeniser->context.pending = len;
+		tokeniser->state = STATE_MATCH_COMMENT;
+	} else if ((c & ~0x20) == 'D') {
+		tokeniser->context.pending = len;
+		tokeniser->context.match_doctype.count = len;
+		tokeniser->state = STATE_MATCH_DOCTYPE;
+	} else if (tokeniser->process_cdata_section == true && c == '[') {
+		tokeniser->context.pending = len;
+		tokeniser->context.match_cdata.count = len;
+		tokeniser->state = STATE_MATCH_CDATA;
+	} else {
+		tokeniser->state = STATE_BOGUS_COMMENT;
+	}
+
+	return HUBBUB_OK;
+}
+
+
+hubbub_error hubbub_tokeniser_handle_match_comment(hubbub_tokeniser *tokeniser)
+{
+	size_t len;
+	const uint8_t *cptr;
+	parserutils_error error;
 
-	assert(tokeniser->context.pending == 2);
-/*	assert(tokeniser->context.chars.ptr[0] == '<'); */
-/*	assert(tokeniser->context.chars.ptr[1] == '/'); */
+	error = hubbub_tokeniser_peek(tokeniser,
+			tokeniser->context.pending, &cptr, &len);
 
-	/**\todo fragment case */
+	if (error != PARSERUTILS_OK) {
+		if (error == PARSERUTILS_EOF) {
+			tokeniser->context.pending =
+				tokeniser->context.current_comment.len = 0;
+			tokeniser->state = STATE_BOGUS_COMMENT;
+			return HUBBUB_OK;
+		} else {
+			return hubbub_error_from_parserutils_error(error);
+		}
+	}
 
-	if (tokeniser->content_model == HUBBUB_CONTENT_MODEL_RCDATA ||
-			tokeniser->content_model ==
-					HUBBUB_CONTENT_MODEL_CDATA) {
-		uint8_t *start_tag_name =
-			tokeniser->context.last_start_tag_name;
-		size_t start_tag_len =
-			tokeniser->context.last_start_tag_len;
+	tokeniser->context.pending = tokeniser->context.current_comment.len = 0;
 
-		while ((error = parserutils_inputstream_peek(tokeniser->input,
-					ctx->pending +
-						ctx->close_tag_match.count,
-					&cptr,
-					&len)) == PARSERUTILS_OK) {
-			c = *cptr;
+	if (*cptr == '-') {
+		hubbub_tokeniser_advance(tokeniser, SLEN("--"));
+		tokeniser->state = STATE_COMMENT_START;
+	} else {
+		tokeniser->state = STATE_BOGUS_COMMENT;
+	}
 
-			if ((start_tag_name[ctx->close_tag_match.count] & ~0x20)
-					!= (c & ~0x20)) {
-				break;
-			}
+	return HUBBUB_OK;
+}
 
-			ctx->close_tag_match.count += len;
 
-			if (ctx->close_tag_match.count == start_tag_len) {
-				ctx->close_tag_match.match = true;
-				break;
-			}
-		}
+hubbub_error hubbub_tokeniser_handle_comment(hubbub_tokeniser *tokeniser)
+{
+	hubbub_string *comment = &tokeniser->context.current_comment;
+	size_t *src = &tokeniser->context.current_comment_src;
+	size_t len;
+	const uint8_t *cptr;
+	parserutils_error error;
+	hubbub_error err;
+	uint8_t c;
 
-		if (error != PARSERUTILS_OK && error != PARSERUTILS_EOF) {
+	error = hubbub_tokeniser_peek(tokeniser,
+			tokeniser->context.pending, &cptr, &len);
+
+	if (error != PARSERUTILS_OK) {
+		if (error == PARSERUTILS_EOF) {
+			tokeniser->state = STATE_DATA;
+			return emit_current_comment(tokeniser);
+		} else {
 			return hubbub_error_from_parserutils_error(error);
 		}
+	}
 
-		if (ctx->close_tag_match.match == true) {
-			error = parserutils_inputstream_peek(
-			 		tokeniser->input,
-			 		ctx->pending +
-				 		ctx->close_tag_match.count,
-					&cptr,
-			 		&len);
+	c = *cptr;
+
+	if (c == '>' && (tokeniser->state == STATE_COMMENT_START_DASH ||
+			tokeniser->state == STATE_COMMENT_START ||
+			tokeniser->state == STATE_COMMENT_END)) {
+		tokeniser->context.pending += len;
+
+		/** \todo parse error if state != COMMENT_END */
+		tokeniser->state = STATE_DATA;
+		return emit_current_comment(tokeniser);
+	} else if (c == '-') {
+		if (tokeniser->state == STATE_COMMENT_START) {
+			tokeniser->state = STATE_COMMENT_START_DASH;
+		} else if (tokeniser->state == STATE_COMMENT_START_DASH) {
+			tokeniser->state = STATE_COMMENT_END;
+		} else if (tokeniser->state == STATE_COMMENT) {
+			tokeniser->state = STATE_COMMENT_END_DASH;
+		} else if (tokeniser->state == STATE_COMMENT_END_DASH) {
+			tokeniser->state = STATE_COMMENT_END;
+		} else if (tokeniser->state == STATE_COMMENT_END &&
+				tokeniser->drop_comments == false) {
+			COLLECT_MS(*comment, *src, "-", SLEN("-"));
+		}
+
+		tokeniser->context.pending += len;
+	} else if (tokeniser->drop_comments) {
+		/* Nothing is kept, so skip straight to the next '-' */
+		tokeniser->context.pending += len;
+		tokeniser->state = STATE_COMMENT;
+
+		tokeniser->context.pending += hubbub_tokeniser_scan_run(
+				tokeniser, comment_drop_stops,
+				N_ELEMENTS(comment_drop_stops),
+				tokeniser->token_limit);
+	} else {
+		if (tokeniser->state == STATE_COMMENT_START_DASH ||
+				tokeniser->state == STATE_COMMENT_END_DASH) {
+			COLLECT_MS(*comment, *src, "-", SLEN("-"));
+		} else if (tokeniser->state == STATE_COMMENT_END) {
+			COLLECT_MS(*comment, *src, "--", SLEN("--"));
+		}
 
+		if (c == '\0') {
+			COLLECT_MS(*comment, *src, u_fffd, sizeof(u_fffd));
+		} else if (c == '\r') {
+			size_t next_len;
+			error = hubbub_tokeniser_peek(
+					tokeniser,
+					tokeniser->context.pending + len,
+					&cptr,
+					&next_len);
 			if (error != PARSERUTILS_OK && 
 					error != PARSERUTILS_EOF) {
 				return hubbub_error_from_parserutils_error(
 						error);
-			} else if (error != PARSERUTILS_EOF) {
-				c = *cptr;
-
-				if (c != '\t' && c != '\n' && c != '\f' &&
-						c != ' ' && c != '>' &&
-						c != '/') {
-					ctx->close_tag_match.match = false;
-				}
+			} else if (error != PARSERUTILS_EOF && *cptr != '\n') {
+				COLLECT_MS(*comment, *src, &lf, sizeof(lf));
 			}
+		} else {
+			COLLECT_MS(*comment, *src, cptr, len);
 		}
-	}
 
-	if (ctx->close_tag_match.match == false &&
-			tokeniser->content_model !=
-					HUBBUB_CONTENT_MODEL_PCDATA) {
-		/* We should emit "</" here, but instead we leave it in the
-		 * buffer so the data state emits it with any characters
-		 * following it */
-		tokeniser->state = STATE_DATA;
-	} else {
-		error = parserutils_inputstream_peek(tokeniser->input,
-				tokeniser->context.pending, &cptr, &len);
+		tokeniser->context.pending += len;
+		tokeniser->state = STATE_COMMENT;
 
-		if (error == PARSERUTILS_EOF) {
-			/** \todo parse error */
+		/* Anything up to the next '-' is plain comment text */
+		err = hubbub_tokeniser_collect_run(tokeniser, comment, src,
+				comment_stops, N_ELEMENTS(comment_stops));
+		if (err != HUBBUB_OK)
+			return err;
 
-			/* Return to data state with "</" pending */
-			tokeniser->state = STATE_DATA;
-			return HUBBUB_OK;
-		} else if (error != PARSERUTILS_OK) {
-			return hubbub_error_from_parserutils_error(error);
+		if (comment->len >= tokeniser->token_limit) {
+			/* Pass on what there is so far */
+			tokeniser->context.incomplete = true;
+			return emit_current_comment(tokeniser);
 		}
+	}
 
-		c = *cptr;
+	return HUBBUB_OK;
+}
 
-		if ('A' <= c && c <= 'Z') {
-			uint8_t lc = (c + 0x20);
-			START_BUF(tokeniser->context.current_tag.name,
-					&lc, len);
-			tokeniser->context.current_tag.n_attributes = 0;
 
-			tokeniser->context.current_tag_type =
-					HUBBUB_TOKEN_END_TAG;
 
-			tokeniser->context.pending += len;
 
-			tokeniser->state = STATE_TAG_NAME;
-		} else if ('a' <= c && c <= 'z') {
-			START_BUF(tokeniser->context.current_tag.name,
-					cptr, len);
-			tokeniser->context.current_tag.n_attributes = 0;
+#define DOCTYPE		"DOCTYPE"
+#define DOCTYPE_LEN	(SLEN(DOCTYPE) - 1)
 
-			tokeniser->context.current_tag_type =
-					HUBBUB_TOKEN_END_TAG;
+hubbub_error hubbub_tokeniser_handle_match_doctype(hubbub_tokeniser *tokeniser)
+{
+	size_t len;
+	const uint8_t *cptr;
+	parserutils_error error;
+	uint8_t c;
 
-			tokeniser->context.pending += len;
+	error = hubbub_tokeniser_peek(tokeniser,
+			tokeniser->context.match_doctype.count, &cptr, &len);
 
-			tokeniser->state = STATE_TAG_NAME;
-		} else if (c == '>') {
-			/* Cursor still at "</", need to collect ">" */
-			tokeniser->context.pending += len;
+	if (error != PARSERUTILS_OK) {
+		if (error == PARSERUTILS_EOF) {
+			tokeniser->context.current_comment.len =
+					tokeniser->context.pending = 0;
+			tokeniser->state = STATE_BOGUS_COMMENT;
+			return HUBBUB_OK;
+		} else {
+			return hubbub_error_from_parserutils_error(error);
+		}
+	}
 
-			/* Now need to advance past "</>" */
-			parserutils_inputstream_advance(tokeniser->input,
-					tokeniser->context.pending);
-			tokeniser->context.pending = 0;
+	c = *cptr;
 
-			/** \todo parse error */
-			tokeniser->state = STATE_DATA;
-		} else {
-			/** \todo parse error */
+	assert(tokeniser->context.match_doctype.count <= DOCTYPE_LEN);
 
-			/* Cursor still at "</", need to advance past it */
-			parserutils_inputstream_advance(tokeniser->input,
-					tokeniser->context.pending);
-			tokeniser->context.pending = 0;
+	if (DOCTYPE[tokeniser->context.match_doctype.count] != (c & ~0x20)) {
+		tokeniser->context.current_comment.len =
+				tokeniser->context.pending = 0;
+		tokeniser->state = STATE_BOGUS_COMMENT;
+		return HUBBUB_OK;
+	}
 
-			tokeniser->state = STATE_BOGUS_COMMENT;
-		}
+	tokeniser->context.pending += len;
+
+	if (tokeniser->context.match_doctype.count == DOCTYPE_LEN) {
+		/* Skip over the DOCTYPE bit */
+		hubbub_tokeniser_advance(tokeniser,
+				tokeniser->context.pending);
+
+		memset(&tokeniser->context.current_doctype, 0,
+				sizeof tokeniser->context.current_doctype);
+		tokeniser->context.current_doctype.public_missing = true;
+		tokeniser->context.current_doctype.system_missing = true;
+		tokeniser->context.current_doctype_src.public_id =
+				STRING_BUFFERED;
+		tokeniser->context.current_doctype_src.system_id =
+				STRING_BUFFERED;
+		tokeniser->context.pending = 0;
+
+		tokeniser->state = STATE_DOCTYPE;
 	}
 
+	tokeniser->context.match_doctype.count++;
+
 	return HUBBUB_OK;
 }
 
-/* this state expects tokeniser->context.current_tag to already have its
-   first character set */
-hubbub_error hubbub_tokeniser_handle_tag_name(hubbub_tokeniser *tokeniser)
-{
-	hubbub_tag *ctag = &tokeniser->context.current_tag;
-
-	size_t len;
-	const uint8_t *cptr;
-	parserutils_error error;
-	uint8_t c;
+#undef DOCTYPE
+#undef DOCTYPE_LEN
 
-	assert(tokeniser->context.pending > 0);
-/*	assert(tokeniser->context.chars.ptr[0] == '<'); */
-	assert(ctag->name.len > 0);
-/*	assert(ctag->name.ptr); */
+hubbub_error hubbub_tokeniser_handle_doctype(hubbub_tokeniser *tokeniser)
+{
+	size_t len;
+	const uint8_t *cptr;
+	parserutils_error error;
+	uint8_t c;
 
-	error = parserutils_inputstream_peek(tokeniser->input, 
+	error = hubbub_tokeniser_peek(tokeniser,
 			tokeniser->context.pending, &cptr, &len);
 
 	if (error != PARSERUTILS_OK) {
 		if (error == PARSERUTILS_EOF) {
-			tokeniser->state = STATE_DATA;
-			return emit_current_tag(tokeniser);
+			tokeniser->state = STATE_BEFORE_DOCTYPE_NAME;
+			return HUBBUB_OK;
 		} else {
 			return hubbub_error_from_parserutils_error(error);
 		}
@@ -1136,48 +4545,35 @@ hubbub_error hubbub_tokeniser_handle_tag_name(hubbub_tokeniser *tokeniser)
 
 	c = *cptr;
 
-	if (c == '\t' || c == '\n' || c == '\f' || c == ' ' || c == '\r') {
-		tokeniser->context.pending += len;
-		tokeniser->state = STATE_BEFORE_ATTRIBUTE_NAME;
-	} else if (c == '>') {
-		tokeniser->context.pending += len;
-		tokeniser->state = STATE_DATA;
-		return emit_current_tag(tokeniser);
-	} else if (c == '\0') {
-		COLLECT(ctag->name, u_fffd, sizeof(u_fffd));
-		tokeniser->context.pending += len;
-	} else if (c == '/') {
-		tokeniser->context.pending += len;
-		tokeniser->state = STATE_SELF_CLOSING_START_TAG;
-	} else if ('A' <= c && c <= 'Z') {
-		uint8_t lc = (c + 0x20);
-		COLLECT(ctag->name, &lc, len);
-		tokeniser->context.pending += len;
-	} else {
-		COLLECT(ctag->name, cptr, len);
+	if (hubbub_char_is_space(c)) {
 		tokeniser->context.pending += len;
 	}
 
+	tokeniser->state = STATE_BEFORE_DOCTYPE_NAME;
+
 	return HUBBUB_OK;
 }
 
-hubbub_error hubbub_tokeniser_handle_before_attribute_name(
+hubbub_error hubbub_tokeniser_handle_before_doctype_name(
 		hubbub_tokeniser *tokeniser)
 {
-	hubbub_tag *ctag = &tokeniser->context.current_tag;
-
+	hubbub_doctype *cdoc = &tokeniser->context.current_doctype;
+	hubbub_tokeniser_doctype_src *dsrc =
+			&tokeniser->context.current_doctype_src;
 	size_t len;
 	const uint8_t *cptr;
 	parserutils_error error;
 	uint8_t c;
 
-	error = parserutils_inputstream_peek(tokeniser->input, 
+	error = hubbub_tokeniser_peek(tokeniser,
 			tokeniser->context.pending, &cptr, &len);
 
 	if (error != PARSERUTILS_OK) {
 		if (error == PARSERUTILS_EOF) {
+			/** \todo parse error */
+			/* Emit current doctype, force-quirks on */
 			tokeniser->state = STATE_DATA;
-			return emit_current_tag(tokeniser);
+			return emit_current_doctype(tokeniser, true);
 		} else {
 			return hubbub_error_from_parserutils_error(error);
 		}
@@ -1185,73 +4581,49 @@ hubbub_error hubbub_tokeniser_handle_before_attribute_name(
 
 	c = *cptr;
 
-	if (c == '\t' || c == '\n' || c == '\f' || c == ' ' || c == '\r') {
+	if (hubbub_char_is_space(c)) {
 		/* pass over in silence */
 		tokeniser->context.pending += len;
 	} else if (c == '>') {
+		/** \todo parse error */
 		tokeniser->context.pending += len;
 		tokeniser->state = STATE_DATA;
-		return emit_current_tag(tokeniser);
-	} else if (c == '/') {
-		tokeniser->context.pending += len;
-		tokeniser->state = STATE_SELF_CLOSING_START_TAG;
+		return emit_current_doctype(tokeniser, true);
 	} else {
-		hubbub_attribute *attr;
-
-		if (c == '"' || c == '\'' || c == '=') {
-			/** \todo parse error */
-		}
-
-		attr = tokeniser->alloc(ctag->attributes,
-				(ctag->n_attributes + 1) *
-					sizeof(hubbub_attribute),
-				tokeniser->alloc_pw);
-		if (attr == NULL)
-			return HUBBUB_NOMEM;
-
-		ctag->attributes = attr;
+		if (c == '\0') {
+			START(cdoc->name, dsrc->name, u_fffd, sizeof(u_fffd));
+		} else if (hubbub_char_is(c, HUBBUB_CC_UPPER)) {
+			uint8_t lc = hubbub_char_tolower(c);
 
-		if ('A' <= c && c <= 'Z') {
-			uint8_t lc = (c + 0x20);
-			START_BUF(attr[ctag->n_attributes].name, &lc, len);
-		} else if (c == '\0') {
-			START_BUF(attr[ctag->n_attributes].name,
-					u_fffd, sizeof(u_fffd));
+			START(cdoc->name, dsrc->name, &lc, len);
 		} else {
-			START_BUF(attr[ctag->n_attributes].name, cptr, len);
+			START(cdoc->name, dsrc->name, cptr, len);
 		}
 
-		attr[ctag->n_attributes].ns = HUBBUB_NS_NULL;
-		attr[ctag->n_attributes].value.ptr = NULL;
-		attr[ctag->n_attributes].value.len = 0;
-
-		ctag->n_attributes++;
-
 		tokeniser->context.pending += len;
-		tokeniser->state = STATE_ATTRIBUTE_NAME;
+		tokeniser->state = STATE_DOCTYPE_NAME;
 	}
 
 	return HUBBUB_OK;
 }
 
-hubbub_error hubbub_tokeniser_handle_attribute_name(hubbub_tokeniser *tokeniser)
+hubbub_error hubbub_tokeniser_handle_doctype_name(hubbub_tokeniser *tokeniser)
 {
-	hubbub_tag *ctag = &tokeniser->context.current_tag;
-
+	hubbub_doctype *cdoc = &tokeniser->context.current_doctype;
+	hubbub_tokeniser_doctype_src *dsrc =
+			&tokeniser->context.current_doctype_src;
 	size_t len;
 	const uint8_t *cptr;
 	parserutils_error error;
 	uint8_t c;
 
-	assert(ctag->attributes[ctag->n_attributes - 1].name.len > 0);
-
-	error = parserutils_inputstream_peek(tokeniser->input, 
+	error = hubbub_tokeniser_peek(tokeniser,
 			tokeniser->context.pending, &cptr, &len);
 
 	if (error != PARSERUTILS_OK) {
 		if (error == PARSERUTILS_EOF) {
 			tokeniser->state = STATE_DATA;
-			return emit_current_tag(tokeniser);
+			return emit_current_doctype(tokeniser, true);
 		} else {
 			return hubbub_error_from_parserutils_error(error);
 		}
@@ -1259,193 +4631,180 @@ hubbub_error hubbub_tokeniser_handle_attribute_name(hubbub_tokeniser *tokeniser)
 
 	c = *cptr;
 
-	if (c == '\t' || c == '\n' || c == '\f' || c == ' ' || c == '\r') {
-		tokeniser->context.pending += len;
-		tokeniser->state = STATE_AFTER_ATTRIBUTE_NAME;
-	} else if (c == '=') {
+	if (hubbub_char_is_space(c)) {
 		tokeniser->context.pending += len;
-		tokeniser->state = STATE_BEFORE_ATTRIBUTE_VALUE;
+		tokeniser->state = STATE_AFTER_DOCTYPE_NAME;
 	} else if (c == '>') {
 		tokeniser->context.pending += len;
 		tokeniser->state = STATE_DATA;
-		return emit_current_tag(tokeniser);
-	} else if (c == '/') {
-		tokeniser->context.pending += len;
-		tokeniser->state = STATE_SELF_CLOSING_START_TAG;
+		return emit_current_doctype(tokeniser, false);
 	} else if (c == '\0') {
-		COLLECT(ctag->attributes[ctag->n_attributes - 1].name,
-				u_fffd, sizeof(u_fffd));
+		COLLECT(cdoc->name, dsrc->name, u_fffd, sizeof(u_fffd));
 		tokeniser->context.pending += len;
-	} else if ('A' <= c && c <= 'Z') {
-		uint8_t lc = (c + 0x20);
-		COLLECT(ctag->attributes[ctag->n_attributes - 1].name,
-				&lc, len);
+	} else if (hubbub_char_is(c, HUBBUB_CC_UPPER)) {
+		uint8_t lc = hubbub_char_tolower(c);
+		COLLECT(cdoc->name, dsrc->name, &lc, len);
 		tokeniser->context.pending += len;
 	} else {
-		COLLECT(ctag->attributes[ctag->n_attributes - 1].name,
-				cptr, len);
+		COLLECT(cdoc->name, dsrc->name, cptr, len);
 		tokeniser->context.pending += len;
 	}
 
 	return HUBBUB_OK;
 }
 
-hubbub_error hubbub_tokeniser_handle_after_attribute_name(
+hubbub_error hubbub_tokeniser_handle_after_doctype_name(
 		hubbub_tokeniser *tokeniser)
 {
-	hubbub_tag *ctag = &tokeniser->context.current_tag;
-
 	size_t len;
 	const uint8_t *cptr;
 	parserutils_error error;
 	uint8_t c;
 
-	error = parserutils_inputstream_peek(tokeniser->input, 
+	error = hubbub_tokeniser_peek(tokeniser,
 			tokeniser->context.pending, &cptr, &len);
 
 	if (error != PARSERUTILS_OK) {
 		if (error == PARSERUTILS_EOF) {
 			tokeniser->state = STATE_DATA;
-			return emit_current_tag(tokeniser);
+			return emit_current_doctype(tokeniser, true);
 		} else {
 			return hubbub_error_from_parserutils_error(error);
 		}
 	}
 
 	c = *cptr;
+	tokeniser->context.pending += len;
 
-	if (c == '\t' || c == '\n' || c == '\f' || c == ' ' || c == '\r') {
-		tokeniser->context.pending += len;
-	} else if (c == '=') {
-		tokeniser->context.pending += len;
-		tokeniser->state = STATE_BEFORE_ATTRIBUTE_VALUE;
+	if (hubbub_char_is_space(c)) {
+		/* pass over in silence */
 	} else if (c == '>') {
-		tokeniser->context.pending += len;
-
 		tokeniser->state = STATE_DATA;
-		return emit_current_tag(tokeniser);
-	} else if (c == '/') {
-		tokeniser->context.pending += len;
-		tokeniser->state = STATE_SELF_CLOSING_START_TAG;
+		return emit_current_doctype(tokeniser, false);
+	} else if ((c & ~0x20) == 'P') {
+		tokeniser->context.match_doctype.count = 1;
+		tokeniser->state = STATE_MATCH_PUBLIC;
+	} else if ((c & ~0x20) == 'S') {
+		tokeniser->context.match_doctype.count = 1;
+		tokeniser->state = STATE_MATCH_SYSTEM;
 	} else {
-		hubbub_attribute *attr;
+		tokeniser->state = STATE_BOGUS_DOCTYPE;
+		tokeniser->context.current_doctype.force_quirks = true;
+	}
 
-		if (c == '"' || c == '\'') {
-			/** \todo parse error */
-		}
+	return HUBBUB_OK;
+}
 
-		attr = tokeniser->alloc(ctag->attributes,
-				(ctag->n_attributes + 1) *
-					sizeof(hubbub_attribute),
-				tokeniser->alloc_pw);
-		if (attr == NULL)
-			return HUBBUB_NOMEM;
+#define PUBLIC		"PUBLIC"
+#define PUBLIC_LEN	(SLEN(PUBLIC) - 1)
 
-		ctag->attributes = attr;
+hubbub_error hubbub_tokeniser_handle_match_public(hubbub_tokeniser *tokeniser)
+{
+	size_t len;
+	const uint8_t *cptr;
+	parserutils_error error;
+	uint8_t c;
 
-		if ('A' <= c && c <= 'Z') {
-			uint8_t lc = (c + 0x20);
-			START_BUF(attr[ctag->n_attributes].name, &lc, len);
-		} else if (c == '\0') {
-			START_BUF(attr[ctag->n_attributes].name,
-					u_fffd, sizeof(u_fffd));
+	error = hubbub_tokeniser_peek(tokeniser,
+			tokeniser->context.pending, &cptr, &len);
+
+	if (error != PARSERUTILS_OK) {
+		if (error == PARSERUTILS_EOF) {
+			tokeniser->context.current_doctype.force_quirks = true;
+			tokeniser->state = STATE_BOGUS_DOCTYPE;
+			return HUBBUB_OK;
 		} else {
-			START_BUF(attr[ctag->n_attributes].name, cptr, len);
+			return hubbub_error_from_parserutils_error(error);
 		}
+	}
 
-		attr[ctag->n_attributes].ns = HUBBUB_NS_NULL;
-		attr[ctag->n_attributes].value.ptr = NULL;
-		attr[ctag->n_attributes].value.len = 0;
+	c = *cptr;
 
-		ctag->n_attributes++;
+	assert(tokeniser->context.match_doctype.count <= PUBLIC_LEN);
 
-		tokeniser->context.pending += len;
-		tokeniser->state = STATE_ATTRIBUTE_NAME;
+	if (PUBLIC[tokeniser->context.match_doctype.count] != (c & ~0x20)) {
+		tokeniser->context.current_doctype.force_quirks = true;
+		tokeniser->state = STATE_BOGUS_DOCTYPE;
+		return HUBBUB_OK;
+	}
+
+	tokeniser->context.pending += len;
+
+	if (tokeniser->context.match_doctype.count == PUBLIC_LEN) {
+		tokeniser->state = STATE_BEFORE_DOCTYPE_PUBLIC;
 	}
 
+	tokeniser->context.match_doctype.count++;
+
 	return HUBBUB_OK;
 }
 
-/* this state is only ever triggered by an '=' */
-hubbub_error hubbub_tokeniser_handle_before_attribute_value(
+#undef PUBLIC
+#undef PUBLIC_LEN
+
+hubbub_error hubbub_tokeniser_handle_before_doctype_public(
 		hubbub_tokeniser *tokeniser)
 {
-	hubbub_tag *ctag = &tokeniser->context.current_tag;
-
+	hubbub_doctype *cdoc = &tokeniser->context.current_doctype;
 	size_t len;
 	const uint8_t *cptr;
 	parserutils_error error;
 	uint8_t c;
 
-	error = parserutils_inputstream_peek(tokeniser->input, 
+	error = hubbub_tokeniser_peek(tokeniser,
 			tokeniser->context.pending, &cptr, &len);
 
 	if (error != PARSERUTILS_OK) {
 		if (error == PARSERUTILS_EOF) {
-			/** \todo parse error */
 			tokeniser->state = STATE_DATA;
-			return emit_current_tag(tokeniser);
+			return emit_current_doctype(tokeniser, true);
 		} else {
 			return hubbub_error_from_parserutils_error(error);
 		}
 	}
 
 	c = *cptr;
+	tokeniser->context.pending += len;
 
-	if (c == '\t' || c == '\n' || c == '\f' || c == ' ' || c == '\r') {
-		tokeniser->context.pending += len;
+	if (hubbub_char_is_space(c)) {
+		/* pass over in silence */
 	} else if (c == '"') {
-		tokeniser->context.pending += len;
-		tokeniser->state = STATE_ATTRIBUTE_VALUE_DQ;
-	} else if (c == '&') {
-		/* Don't consume the '&' -- reprocess in UQ state */
-		tokeniser->state = STATE_ATTRIBUTE_VALUE_UQ;
+		cdoc->public_missing = false;
+		cdoc->public_id.len = 0;
+		tokeniser->state = STATE_DOCTYPE_PUBLIC_DQ;
 	} else if (c == '\'') {
-		tokeniser->context.pending += len;
-		tokeniser->state = STATE_ATTRIBUTE_VALUE_SQ;
+		cdoc->public_missing = false;
+		cdoc->public_id.len = 0;
+		tokeniser->state = STATE_DOCTYPE_PUBLIC_SQ;
 	} else if (c == '>') {
-		/** \todo parse error */
-		tokeniser->context.pending += len;
-
 		tokeniser->state = STATE_DATA;
-		return emit_current_tag(tokeniser);
-	} else if (c == '\0') {
-		START_BUF(ctag->attributes[ctag->n_attributes - 1].value,
-				u_fffd, sizeof(u_fffd));
-		tokeniser->context.pending += len;
-		tokeniser->state = STATE_ATTRIBUTE_VALUE_UQ;
+		return emit_current_doctype(tokeniser, true);
 	} else {
-		if (c == '=') {
-			/** \todo parse error */
-		}
-
-		START_BUF(ctag->attributes[ctag->n_attributes - 1].value,
-				cptr, len);
-
-		tokeniser->context.pending += len;
-		tokeniser->state = STATE_ATTRIBUTE_VALUE_UQ;
+		cdoc->force_quirks = true;
+		tokeniser->state = STATE_BOGUS_DOCTYPE;
 	}
 
 	return HUBBUB_OK;
 }
 
-hubbub_error hubbub_tokeniser_handle_attribute_value_dq(
+hubbub_error hubbub_tokeniser_handle_doctype_public_dq(
 		hubbub_tokeniser *tokeniser)
 {
-	hubbub_tag *ctag = &tokeniser->context.current_tag;
-
+	hubbub_doctype *cdoc = &tokeniser->context.current_doctype;
+	hubbub_tokeniser_doctype_src *dsrc =
+			&tokeniser->context.current_doctype_src;
 	size_t len;
 	const uint8_t *cptr;
 	parserutils_error error;
 	uint8_t c;
 
-	error = parserutils_inputstream_peek(tokeniser->input, 
+	error = hubbub_tokeniser_peek(tokeniser,
 			tokeniser->context.pending, &cptr, &len);
 
 	if (error != PARSERUTILS_OK) {
 		if (error == PARSERUTILS_EOF) {
 			tokeniser->state = STATE_DATA;
-			return emit_current_tag(tokeniser);
+			return emit_current_doctype(tokeniser, true);
 		} else {
 			return hubbub_error_from_parserutils_error(error);
 		}
@@ -1455,59 +4814,62 @@ hubbub_error hubbub_tokeniser_handle_attribute_value_dq(
 
 	if (c == '"') {
 		tokeniser->context.pending += len;
-		tokeniser->state = STATE_AFTER_ATTRIBUTE_VALUE_Q;
-	} else if (c == '&') {
-		tokeniser->context.prev_state = tokeniser->state;
-		tokeniser->state = STATE_CHARACTER_REFERENCE_IN_ATTRIBUTE_VALUE;
-		tokeniser->context.allowed_char = '"';
-		/* Don't eat the '&'; it'll be handled by entity consumption */
+		tokeniser->state = STATE_AFTER_DOCTYPE_PUBLIC;
+	} else if (c == '>') {
+		tokeniser->context.pending += len;
+		tokeniser->state = STATE_DATA;
+		return emit_current_doctype(tokeniser, true);
 	} else if (c == '\0') {
-		COLLECT_MS(ctag->attributes[ctag->n_attributes - 1].value,
+		COLLECT_MS(cdoc->public_id, dsrc->public_id,
 				u_fffd, sizeof(u_fffd));
 		tokeniser->context.pending += len;
 	} else if (c == '\r') {
-		error = parserutils_inputstream_peek(
-				tokeniser->input,
-				tokeniser->context.pending + len,
+		error = hubbub_tokeniser_peek(
+				tokeniser,
+				tokeniser->context.pending,
 				&cptr,
 				&len);
 
 		if (error != PARSERUTILS_OK && error != PARSERUTILS_EOF) {
 			return hubbub_error_from_parserutils_error(error);
 		} else if (error == PARSERUTILS_EOF || *cptr != '\n') {
-			COLLECT_MS(ctag->attributes[
-					ctag->n_attributes - 1].value,
+			COLLECT_MS(cdoc->public_id, dsrc->public_id,
 					&lf, sizeof(lf));
 		}
 
-		/* Consume '\r' */
+		/* Collect '\r' */
 		tokeniser->context.pending += 1;
 	} else {
-		COLLECT_MS(ctag->attributes[ctag->n_attributes - 1].value,
-				cptr, len);
+		COLLECT_MS(cdoc->public_id, dsrc->public_id, cptr, len);
+
 		tokeniser->context.pending += len;
+
+		return hubbub_tokeniser_collect_run(tokeniser, &cdoc->public_id,
+				&dsrc->public_id, doctype_id_dq_stops,
+				N_ELEMENTS(doctype_id_dq_stops));
 	}
 
 	return HUBBUB_OK;
 }
 
-hubbub_error hubbub_tokeniser_handle_attribute_value_sq(
+hubbub_error hubbub_tokeniser_handle_doctype_public_sq(
 		hubbub_tokeniser *tokeniser)
 {
-	hubbub_tag *ctag = &tokeniser->context.current_tag;
-
+	hubbub_doctype *cdoc = &tokeniser->context.current_doctype;
+	hubbub_tokeniser_doctype_src *dsrc =
+			&tokeniser->context.current_doctype_src;
 	size_t len;
 	const uint8_t *cptr;
 	parserutils_error error;
 	uint8_t c;
 
-	error = parserutils_inputstream_peek(tokeniser->input, 
+	error = hubbub_tokeniser_peek(tokeniser,
 			tokeniser->context.pending, &cptr, &len);
 
 	if (error != PARSERUTILS_OK) {
 		if (error == PARSERUTILS_EOF) {
 			tokeniser->state = STATE_DATA;
-			return emit_current_tag(tokeniser);
+			return emit_current_doctype(tokeniser, true);
 		} else {
 			return hubbub_error_from_parserutils_error(error);
 		}
@@ -1517,211 +4879,205 @@ hubbub_error hubbub_tokeniser_handle_attribute_value_sq(
 
 	if (c == '\'') {
 		tokeniser->context.pending += len;
-		tokeniser->state = STATE_AFTER_ATTRIBUTE_VALUE_Q;
-	} else if (c == '&') {
-		tokeniser->context.prev_state = tokeniser->state;
-		tokeniser->state = STATE_CHARACTER_REFERENCE_IN_ATTRIBUTE_VALUE;
-		tokeniser->context.allowed_char = '\'';
-		/* Don't eat the '&'; it'll be handled by entity consumption */
+		tokeniser->state = STATE_AFTER_DOCTYPE_PUBLIC;
+	} else if (c == '>') {
+		tokeniser->context.pending += len;
+		tokeniser->state = STATE_DATA;
+		return emit_current_doctype(tokeniser, true);
 	} else if (c == '\0') {
-		COLLECT_MS(ctag->attributes[ctag->n_attributes - 1].value,
+		COLLECT_MS(cdoc->public_id, dsrc->public_id,
 				u_fffd, sizeof(u_fffd));
 		tokeniser->context.pending += len;
 	} else if (c == '\r') {
-		error = parserutils_inputstream_peek(
-				tokeniser->input,
-				tokeniser->context.pending + len,
+		error = hubbub_tokeniser_peek(
+				tokeniser,
+				tokeniser->context.pending,
 				&cptr,
 				&len);
 
 		if (error != PARSERUTILS_OK && error != PARSERUTILS_EOF) {
 			return hubbub_error_from_parserutils_error(error);
 		} else if (error == PARSERUTILS_EOF || *cptr != '\n') {
-			COLLECT_MS(ctag->attributes[
-					ctag->n_attributes - 1].value,
+			COLLECT_MS(cdoc->public_id, dsrc->public_id,
 					&lf, sizeof(lf));
 		}
-
-		/* Consume \r */
+	
+		/* Collect '\r' */
 		tokeniser->context.pending += 1;
 	} else {
-		COLLECT_MS(ctag->attributes[ctag->n_attributes - 1].value,
-				cptr, len);
+		COLLECT_MS(cdoc->public_id, dsrc->public_id, cptr, len);
 		tokeniser->context.pending += len;
+
+		return hubbub_tokeniser_collect_run(tokeniser, &cdoc->public_id,
+				&dsrc->public_id, doctype_id_sq_stops,
+				N_ELEMENTS(doctype_id_sq_stops));
 	}
 
 	return HUBBUB_OK;
 }
 
-hubbub_error hubbub_tokeniser_handle_attribute_value_uq(
+
+hubbub_error hubbub_tokeniser_handle_after_doctype_public(
 		hubbub_tokeniser *tokeniser)
 {
-	hubbub_tag *ctag = &tokeniser->context.current_tag;
-	uint8_t c;
-
+	hubbub_doctype *cdoc = &tokeniser->context.current_doctype;
 	size_t len;
 	const uint8_t *cptr;
 	parserutils_error error;
+	uint8_t c;
 
-	error = parserutils_inputstream_peek(tokeniser->input, 
+	error = hubbub_tokeniser_peek(tokeniser,
 			tokeniser->context.pending, &cptr, &len);
 
 	if (error != PARSERUTILS_OK) {
 		if (error == PARSERUTILS_EOF) {
 			tokeniser->state = STATE_DATA;
-			return emit_current_tag(tokeniser);
+			return emit_current_doctype(tokeniser, true);
 		} else {
 			return hubbub_error_from_parserutils_error(error);
 		}
 	}
 
 	c = *cptr;
+	tokeniser->context.pending += len;
 
-	assert(c == '&' ||
-		ctag->attributes[ctag->n_attributes - 1].value.len >= 1);
+	if (hubbub_char_is_space(c)) {
+		/* pass over in silence */
+	} else if (c == '"') {
+		cdoc->system_missing = false;
+		cdoc->system_id.len = 0;
 
-	if (c == '\t' || c == '\n' || c == '\f' || c == ' ' || c == '\r') {
-		tokeniser->context.pending += len;
-		tokeniser->state = STATE_BEFORE_ATTRIBUTE_NAME;
-	} else if (c == '&') {
-		tokeniser->context.prev_state = tokeniser->state;
-		tokeniser->state = STATE_CHARACTER_REFERENCE_IN_ATTRIBUTE_VALUE;
-		/* Don't eat the '&'; it'll be handled by entity consumption */
+		tokeniser->state = STATE_DOCTYPE_SYSTEM_DQ;
+	} else if (c == '\'') {
+		cdoc->system_missing = false;
+		cdoc->system_id.len = 0;
+
+		tokeniser->state = STATE_DOCTYPE_SYSTEM_SQ;
 	} else if (c == '>') {
-		tokeniser->context.pending += len;
 		tokeniser->state = STATE_DATA;
-		return emit_current_tag(tokeniser);
-	} else if (c == '\0') {
-		COLLECT(ctag->attributes[ctag->n_attributes - 1].value,
-				u_fffd, sizeof(u_fffd));
-		tokeniser->context.pending += len;
+		return emit_current_doctype(tokeniser, false);
 	} else {
-		if (c == '"' || c == '\'' || c == '=') {
-			/** \todo parse error */
-		}
-
-		COLLECT(ctag->attributes[ctag->n_attributes - 1].value,
-				cptr, len);
-		tokeniser->context.pending += len;
+		cdoc->force_quirks = true;
+		tokeniser->state = STATE_BOGUS_DOCTYPE;
 	}
 
 	return HUBBUB_OK;
 }
 
-hubbub_error hubbub_tokeniser_handle_character_reference_in_attribute_value(
-		hubbub_tokeniser *tokeniser)
-{
-	if (tokeniser->context.match_entity.complete == false) {
-		return hubbub_tokeniser_consume_character_reference(tokeniser,
-				tokeniser->context.pending);
-	} else {
-		hubbub_tag *ctag = &tokeniser->context.current_tag;
-		hubbub_attribute *attr = &ctag->attributes[
-				ctag->n_attributes - 1];
 
-		uint8_t utf8[6];
-		uint8_t *utf8ptr = utf8;
-		size_t len = sizeof(utf8);
 
-		if (tokeniser->context.match_entity.codepoint) {
-			parserutils_charset_utf8_from_ucs4(
-				tokeniser->context.match_entity.codepoint,
-				&utf8ptr, &len);
+#define SYSTEM		"SYSTEM"
+#define SYSTEM_LEN	(SLEN(SYSTEM) - 1)
 
-			COLLECT_MS(attr->value, utf8, sizeof(utf8) - len);
+hubbub_error hubbub_tokeniser_handle_match_system(hubbub_tokeniser *tokeniser)
+{
+	size_t len;
+	const uint8_t *cptr;
+	parserutils_error error;
+	uint8_t c;
 
-			/* +1 for the ampersand */
-			tokeniser->context.pending +=
-					tokeniser->context.match_entity.length
-					+ 1;
+	error = hubbub_tokeniser_peek(tokeniser,
+			tokeniser->context.pending, &cptr, &len);
+
+	if (error != PARSERUTILS_OK){
+		if (error == PARSERUTILS_EOF) {
+			tokeniser->context.current_doctype.force_quirks = true;
+			tokeniser->state = STATE_BOGUS_DOCTYPE;
+			return HUBBUB_OK;
 		} else {
-			size_t len = 0;
-			const uint8_t *cptr = NULL;
-			parserutils_error error;
+			return hubbub_error_from_parserutils_error(error);
+		}
+	}
 
-			error = parserutils_inputstream_peek(
-					tokeniser->input,
-					tokeniser->context.pending, 
-					&cptr,
-					&len);
-			if (error != PARSERUTILS_OK) {
-				return hubbub_error_from_parserutils_error(
-						error);
-			}
+	c = *cptr;
 
-			/* Insert the ampersand */
-			COLLECT_MS(attr->value, cptr, len);
-			tokeniser->context.pending += len;
-		}
+	assert(tokeniser->context.match_doctype.count <= SYSTEM_LEN);
 
-		/* Reset for next time */
-		tokeniser->context.match_entity.complete = false;
+	if (SYSTEM[tokeniser->context.match_doctype.count] != (c & ~0x20)) {
+		tokeniser->context.current_doctype.force_quirks = true;
+		tokeniser->state = STATE_BOGUS_DOCTYPE;
+		return HUBBUB_OK;
+	}
 
-		/* And back to the previous state */
-		tokeniser->state = tokeniser->context.prev_state;
+	tokeniser->context.pending += len;
+
+	if (tokeniser->context.match_doctype.count == SYSTEM_LEN) {
+		tokeniser->state = STATE_BEFORE_DOCTYPE_SYSTEM;
 	}
 
+	tokeniser->context.match_doctype.count++;
+
 	return HUBBUB_OK;
 }
 
-/* always switches state */
-hubbub_error hubbub_tokeniser_handle_after_attribute_value_q(
+#undef SYSTEM
+#undef SYSTEM_LEN
+
+hubbub_error hubbub_tokeniser_handle_before_doctype_system(
 		hubbub_tokeniser *tokeniser)
 {
+	hubbub_doctype *cdoc = &tokeniser->context.current_doctype;
 	size_t len;
 	const uint8_t *cptr;
 	parserutils_error error;
 	uint8_t c;
 
-	error = parserutils_inputstream_peek(tokeniser->input, 
+	error = hubbub_tokeniser_peek(tokeniser,
 			tokeniser->context.pending, &cptr, &len);
 
 	if (error != PARSERUTILS_OK) {
 		if (error == PARSERUTILS_EOF) {
 			tokeniser->state = STATE_DATA;
-			return emit_current_tag(tokeniser);
+			return emit_current_doctype(tokeniser, true);
 		} else {
 			return hubbub_error_from_parserutils_error(error);
 		}
 	}
 
 	c = *cptr;
+	tokeniser->context.pending += len;
 
-	if (c == '\t' || c == '\n' || c == '\f' || c == ' ' || c == '\r') {
-		tokeniser->context.pending += len;
-		tokeniser->state = STATE_BEFORE_ATTRIBUTE_NAME;
-	} else if (c == '>') {
-		tokeniser->context.pending += len;
+	if (hubbub_char_is_space(c)) {
+		/* pass over */
+	} else if (c == '"') {
+		cdoc->system_missing = false;
+		cdoc->system_id.len = 0;
+
+		tokeniser->state = STATE_DOCTYPE_SYSTEM_DQ;
+	} else if (c == '\'') {
+		cdoc->system_missing = false;
+		cdoc->system_id.len = 0;
 
+		tokeniser->state = STATE_DOCTYPE_SYSTEM_SQ;
+	} else if (c == '>') {
 		tokeniser->state = STATE_DATA;
-		return emit_current_tag(tokeniser);
-	} else if (c == '/') {
-		tokeniser->context.pending += len;
-		tokeniser->state = STATE_SELF_CLOSING_START_TAG;
+		return emit_current_doctype(tokeniser, true);
 	} else {
-		/** \todo parse error */
-		/* Reprocess character in before attribute name state */
-		tokeniser->state = STATE_BEFORE_ATTRIBUTE_NAME;
+		cdoc->force_quirks = true;
+		tokeniser->state = STATE_BOGUS_DOCTYPE;
 	}
 
 	return HUBBUB_OK;
 }
 
-hubbub_error hubbub_tokeniser_handle_self_closing_start_tag(
+hubbub_error hubbub_tokeniser_handle_doctype_system_dq(
 		hubbub_tokeniser *tokeniser)
 {
+	hubbub_doctype *cdoc = &tokeniser->context.current_doctype;
+	hubbub_tokeniser_doctype_src *dsrc =
+			&tokeniser->context.current_doctype_src;
 	size_t len;
 	const uint8_t *cptr;
 	parserutils_error error;
 	uint8_t c;
 
-	error = parserutils_inputstream_peek(tokeniser->input,
+	error = hubbub_tokeniser_peek(tokeniser,
 			tokeniser->context.pending, &cptr, &len);
 
 	if (error != PARSERUTILS_OK) {
 		if (error == PARSERUTILS_EOF) {
 			tokeniser->state = STATE_DATA;
-			return emit_current_tag(tokeniser);
+			return emit_current_doctype(tokeniser, true);
 		} else {
 			return hubbub_error_from_parserutils_error(error);
 		}
@@ -1729,35 +5085,63 @@ hubbub_error hubbub_tokeniser_handle_self_closing_start_tag(
 
 	c = *cptr;
 
-	if (c == '>') {
+	if (c == '"') {
+		tokeniser->context.pending += len;
+		tokeniser->state = STATE_AFTER_DOCTYPE_SYSTEM;
+	} else if (c == '>') {
 		tokeniser->context.pending += len;
 		tokeniser->state = STATE_DATA;
+		return emit_current_doctype(tokeniser, true);
+	} else if (c == '\0') {
+		COLLECT_MS(cdoc->system_id, dsrc->system_id,
+				u_fffd, sizeof(u_fffd));
+		tokeniser->context.pending += len;
+	} else if (c == '\r') {
+		error = hubbub_tokeniser_peek(
+				tokeniser,
+				tokeniser->context.pending,
+				&cptr,
+				&len);
 
-		tokeniser->context.current_tag.self_closing = true;
-		return emit_current_tag(tokeniser);
+		if (error != PARSERUTILS_OK && error != PARSERUTILS_EOF) {
+			return hubbub_error_from_parserutils_error(error);
+		} else if (error == PARSERUTILS_EOF || *cptr != '\n') {
+			COLLECT_MS(cdoc->system_id, dsrc->system_id,
+					&lf, sizeof(lf));
+		}
+
+		/* Collect '\r' */
+		tokeniser->context.pending += 1;
 	} else {
-		/* Reprocess character in before attribute name state */
-		tokeniser->state = STATE_BEFORE_ATTRIBUTE_NAME;
+		COLLECT_MS(cdoc->system_id, dsrc->system_id, cptr, len);
+		tokeniser->context.pending += len;
+
+		return hubbub_tokeniser_collect_run(tokeniser, &cdoc->system_id,
+				&dsrc->system_id, doctype_id_dq_stops,
+				N_ELEMENTS(doctype_id_dq_stops));
 	}
 
 	return HUBBUB_OK;
 }
 
-/* this state expects tokeniser->context.chars to be empty on first entry */
-hubbub_error hubbub_tokeniser_handle_bogus_comment(hubbub_tokeniser *tokeniser)
+hubbub_error hubbub_tokeniser_handle_doctype_system_sq(
+		hubbub_tokeniser *tokeniser)
 {
+	hubbub_doctype *cdoc = &tokeniser->context.current_doctype;
+	hubbub_tokeniser_doctype_src *dsrc =
+			&tokeniser->context.current_doctype_src;
 	size_t len;
 	const uint8_t *cptr;
 	parserutils_error error;
 	uint8_t c;
 
-	error = parserutils_inputstream_peek(tokeniser->input,
+	error = hubbub_tokeniser_peek(tokeniser,
 			tokeniser->context.pending, &cptr, &len);
 
 	if (error != PARSERUTILS_OK) {
 		if (error == PARSERUTILS_EOF) {
 			tokeniser->state = STATE_DATA;
-			return emit_current_comment(tokeniser);
+			return emit_current_doctype(tokeniser, true);
 		} else {
 			return hubbub_error_from_parserutils_error(error);
 		}
@@ -1765,20 +5149,20 @@ hubbub_error hubbub_tokeniser_handle_bogus_comment(hubbub_tokeniser *tokeniser)
 
 	c = *cptr;
 
-	if (c == '>') {
+	if (c == '\'') {
+		tokeniser->context.pending += len;
+		tokeniser->state = STATE_AFTER_DOCTYPE_SYSTEM;
+	} else if (c == '>') {
 		tokeniser->context.pending += len;
 		tokeniser->state = STATE_DATA;
-		return emit_current_comment(tokeniser);
+		return emit_current_doctype(tokeniser, true);
 	} else if (c == '\0') {
-		error = parserutils_buffer_append(tokeniser->buffer,
+		COLLECT_MS(cdoc->system_id, dsrc->system_id,
 				u_fffd, sizeof(u_fffd));
-		if (error != PARSERUTILS_OK)
-			return hubbub_error_from_parserutils_error(error);
-
 		tokeniser->context.pending += len;
 	} else if (c == '\r') {
-		error = parserutils_inputstream_peek(
-				tokeniser->input,
+		error = hubbub_tokeniser_peek(
+				tokeniser,
 				tokeniser->context.pending,
 				&cptr,
 				&len);
@@ -1786,28 +5170,25 @@ hubbub_error hubbub_tokeniser_handle_bogus_comment(hubbub_tokeniser *tokeniser)
 		if (error != PARSERUTILS_OK && error != PARSERUTILS_EOF) {
 			return hubbub_error_from_parserutils_error(error);
 		} else if (error == PARSERUTILS_EOF || *cptr != '\n') {
-			error = parserutils_buffer_append(tokeniser->buffer,
+			COLLECT_MS(cdoc->system_id, dsrc->system_id,
 					&lf, sizeof(lf));
-			if (error != PARSERUTILS_OK) {
-				return hubbub_error_from_parserutils_error(
-						error);
-			}
 		}
-		tokeniser->context.pending += len;
-	} else {
-		error = parserutils_buffer_append(tokeniser->buffer,
-				(uint8_t *) cptr, len);
-		if (error != PARSERUTILS_OK)
-			return hubbub_error_from_parserutils_error(error);
 
+		/* Collect '\r' */
+		tokeniser->context.pending += 1;
+	} else {
+		COLLECT_MS(cdoc->system_id, dsrc->system_id, cptr, len);
 		tokeniser->context.pending += len;
+
+		return hubbub_tokeniser_collect_run(tokeniser, &cdoc->system_id,
+				&dsrc->system_id, doctype_id_sq_stops,
+				N_ELEMENTS(doctype_id_sq_stops));
 	}
 
 	return HUBBUB_OK;
 }
 
-/* this state always switches to another state straight away */
-hubbub_error hubbub_tokeniser_handle_markup_declaration_open(
+hubbub_error hubbub_tokeniser_handle_after_doctype_system(
 		hubbub_tokeniser *tokeniser)
 {
 	size_t len;
@@ -1815,53 +5196,83 @@ hubbub_error hubbub_tokeniser_handle_markup_declaration_open(
 	parserutils_error error;
 	uint8_t c;
 
-	assert(tokeniser->context.pending == 0);
-
-	error = parserutils_inputstream_peek(tokeniser->input, 0, &cptr, &len);
+	error = hubbub_tokeniser_peek(tokeniser,
+			tokeniser->context.pending, &cptr, &len);
 
 	if (error != PARSERUTILS_OK) {
 		if (error == PARSERUTILS_EOF) {
-			tokeniser->state = STATE_BOGUS_COMMENT;
-			return HUBBUB_OK;
+			tokeniser->state = STATE_DATA;
+			return emit_current_doctype(tokeniser, true);
 		} else {
 			return hubbub_error_from_parserutils_error(error);
 		}
 	}
 
 	c = *cptr;
+	tokeniser->context.pending += len;
 
-	if (c == '-') {
-		tokeniser->context.pending = len;
-		tokeniser->state = STATE_MATCH_COMMENT;
-	} else if ((c & ~0x20) == 'D') {
-		tokeniser->context.pending = len;
-		tokeniser->context.match_doctype.count = len;
-		tokeniser->state = STATE_MATCH_DOCTYPE;
-	} else if (tokeniser->process_cdata_section == true && c == '[') {
-		tokeniser->context.pending = len;
-		tokeniser->context.match_cdata.count = len;
-		tokeniser->state = STATE_MATCH_CDATA;
+	if (hubbub_char_is_space(c)) {
+		/* pass over in silence */
+	} else if (c == '>') {
+		tokeniser->state = STATE_DATA;
+		return emit_current_doctype(tokeniser, false);
 	} else {
-		tokeniser->state = STATE_BOGUS_COMMENT;
+		tokeniser->state = STATE_BOGUS_DOCTYPE;
+	}
+
+	return HUBBUB_OK;
+}
+
+
+hubbub_error hubbub_tokeniser_handle_bogus_doctype(hubbub_tokeniser *tokeniser)
+{
+	size_t len;
+	const uint8_t *cptr;
+	parserutils_error error;
+	uint8_t c;
+
+	error = hubbub_tokeniser_peek(tokeniser,
+			tokeniser->context.pending, &cptr, &len);
+
+	if (error != PARSERUTILS_OK) {
+		if (error == PARSERUTILS_EOF) {
+			tokeniser->state = STATE_DATA;
+			return emit_current_doctype(tokeniser, false);
+		} else {
+			return hubbub_error_from_parserutils_error(error);
+		}
+	}
+
+	c = *cptr;
+	tokeniser->context.pending += len;
+
+	if (c == '>') {
+		tokeniser->state = STATE_DATA;
+		return emit_current_doctype(tokeniser, false);
 	}
 
 	return HUBBUB_OK;
 }
 
 
-hubbub_error hubbub_tokeniser_handle_match_comment(hubbub_tokeniser *tokeniser)
+
+#define CDATA		"[CDATA["
+#define CDATA_LEN	(SLEN(CDATA) - 1)
+
+hubbub_error hubbub_tokeniser_handle_match_cdata(hubbub_tokeniser *tokeniser)
 {
 	size_t len;
 	const uint8_t *cptr;
 	parserutils_error error;
+	uint8_t c;
 
-	error = parserutils_inputstream_peek(tokeniser->input, 
+	error = hubbub_tokeniser_peek(tokeniser,
 			tokeniser->context.pending, &cptr, &len);
 
 	if (error != PARSERUTILS_OK) {
 		if (error == PARSERUTILS_EOF) {
-			tokeniser->context.pending =
-				tokeniser->context.current_comment.len = 0;
+			tokeniser->context.current_comment.len =
+					tokeniser->context.pending = 0;
 			tokeniser->state = STATE_BOGUS_COMMENT;
 			return HUBBUB_OK;
 		} else {
@@ -1869,33 +5280,53 @@ hubbub_error hubbub_tokeniser_handle_match_comment(hubbub_tokeniser *tokeniser)
 		}
 	}
 
-	tokeniser->context.pending = tokeniser->context.current_comment.len = 0;
+	c = *cptr;
 
-	if (*cptr == '-') {
-		parserutils_inputstream_advance(tokeniser->input, SLEN("--"));
-		tokeniser->state = STATE_COMMENT_START;
-	} else {
+	assert(tokeniser->context.match_cdata.count <= CDATA_LEN);
+
+	if (CDATA[tokeniser->context.match_cdata.count] != (c & ~0x20)) {
+		tokeniser->context.current_comment.len =
+				tokeniser->context.pending =
+				0;
 		tokeniser->state = STATE_BOGUS_COMMENT;
+		return HUBBUB_OK;
+	}
+
+	tokeniser->context.pending += len;
+
+	if (tokeniser->context.match_cdata.count == CDATA_LEN) {
+		hubbub_tokeniser_advance(tokeniser,
+				tokeniser->context.match_cdata.count + len);
+		tokeniser->context.pending = 0;
+		tokeniser->context.match_cdata.end = 0;
+		tokeniser->state = STATE_CDATA_BLOCK;
 	}
 
+	tokeniser->context.match_cdata.count += len;
+
 	return HUBBUB_OK;
 }
 
+#undef CDATA
+#undef CDATA_LEN
+
 
-hubbub_error hubbub_tokeniser_handle_comment(hubbub_tokeniser *tokeniser)
+hubbub_error hubbub_tokeniser_handle_cdata_block(hubbub_tokeniser *tokeniser)
 {
 	size_t len;
 	const uint8_t *cptr;
 	parserutils_error error;
 	uint8_t c;
 
-	error = parserutils_inputstream_peek(tokeniser->input, 
+	error = hubbub_tokeniser_peek(tokeniser,
 			tokeniser->context.pending, &cptr, &len);
 
 	if (error != PARSERUTILS_OK) {
 		if (error == PARSERUTILS_EOF) {
 			tokeniser->state = STATE_DATA;
-			return emit_current_comment(tokeniser);
+			if (tokeniser->context.pending == 0)
+				return HUBBUB_OK;
+			return emit_current_chars(tokeniser);
 		} else {
 			return hubbub_error_from_parserutils_error(error);
 		}
@@ -1903,115 +5334,77 @@ hubbub_error hubbub_tokeniser_handle_comment(hubbub_tokeniser *tokeniser)
 
 	c = *cptr;
 
-	if (c == '>' && (tokeniser->state == STATE_COMMENT_START_DASH ||
-			tokeniser->state == STATE_COMMENT_START ||
-			tokeniser->state == STATE_COMMENT_END)) {
+	if (c == ']' && (tokeniser->context.match_cdata.end == 0 ||
+			tokeniser->context.match_cdata.end == 1)) {
 		tokeniser->context.pending += len;
+		tokeniser->context.match_cdata.end += len;
+	} else if (c == '>' && tokeniser->context.match_cdata.end == 2) {
+		/* Remove the previous two "]]" */
+		tokeniser->context.pending -= 2;
 
-		/** \todo parse error if state != COMMENT_END */
-		tokeniser->state = STATE_DATA;
-		return emit_current_comment(tokeniser);
-	} else if (c == '-') {
-		if (tokeniser->state == STATE_COMMENT_START) {
-			tokeniser->state = STATE_COMMENT_START_DASH;
-		} else if (tokeniser->state == STATE_COMMENT_START_DASH) {
-			tokeniser->state = STATE_COMMENT_END;
-		} else if (tokeniser->state == STATE_COMMENT) {
-			tokeniser->state = STATE_COMMENT_END_DASH;
-		} else if (tokeniser->state == STATE_COMMENT_END_DASH) {
-			tokeniser->state = STATE_COMMENT_END;
-		} else if (tokeniser->state == STATE_COMMENT_END) {
-			error = parserutils_buffer_append(tokeniser->buffer,
-					(uint8_t *) "-", SLEN("-"));
-			if (error != PARSERUTILS_OK) {
-				return hubbub_error_from_parserutils_error(
-						error);
-			}
+		if (tokeniser->context.pending > 0) {
+			/* Emit any pending characters */
+			emit_current_chars(tokeniser);
 		}
 
-		tokeniser->context.pending += len;
-	} else {
-		if (tokeniser->state == STATE_COMMENT_START_DASH ||
-				tokeniser->state == STATE_COMMENT_END_DASH) {
-			error = parserutils_buffer_append(tokeniser->buffer,
-					(uint8_t *) "-", SLEN("-"));
-			if (error != PARSERUTILS_OK) {
-				return hubbub_error_from_parserutils_error(
-						error);
-			}
-		} else if (tokeniser->state == STATE_COMMENT_END) {
-			error = parserutils_buffer_append(tokeniser->buffer,
-					(uint8_t *) "--", SLEN("--"));
-			if (error != PARSERUTILS_OK) {
-				return hubbub_error_from_parserutils_error(
-						error);
-			}
-		}
+		/* Now move past the "]]>" bit */
+		hubbub_tokeniser_advance(tokeniser, SLEN("]]>"));
 
-		if (c == '\0') {
-			error = parserutils_buffer_append(tokeniser->buffer,
-					u_fffd, sizeof(u_fffd));
-			if (error != PARSERUTILS_OK) {
-				return hubbub_error_from_parserutils_error(
-						error);
-			}
-		} else if (c == '\r') {
-			size_t next_len;
-			error = parserutils_inputstream_peek(
-					tokeniser->input,
-					tokeniser->context.pending + len,
-					&cptr,
-					&next_len);
-			if (error != PARSERUTILS_OK && 
-					error != PARSERUTILS_EOF) {
-				return hubbub_error_from_parserutils_error(
-						error);
-			} else if (error != PARSERUTILS_EOF && *cptr != '\n') {
-				error = parserutils_buffer_append(
-						tokeniser->buffer,
-						&lf, sizeof(lf));
-				if (error != PARSERUTILS_OK) {
-					return hubbub_error_from_parserutils_error(
-							error);
-				}
-			}
-		} else {
-			error = parserutils_buffer_append(tokeniser->buffer, 
-					cptr, len);
-			if (error != PARSERUTILS_OK) {
-				return hubbub_error_from_parserutils_error(
-						error);
-			}
-		}
+		tokeniser->state = STATE_DATA;
+	} else if (c == '\0') {
+		error = hubbub_tokeniser_data_nul(tokeniser);
+		if (error != PARSERUTILS_OK)
+			return hubbub_error_from_parserutils_error(error);
+
+		tokeniser->context.match_cdata.end = 0;
+	} else if (c == '\r') {
+		error = hubbub_tokeniser_data_cr(tokeniser, len);
+		if (error != PARSERUTILS_OK)
+			return hubbub_error_from_parserutils_error(error);
 
+		tokeniser->context.match_cdata.end = 0;
+	} else {
 		tokeniser->context.pending += len;
-		tokeniser->state = STATE_COMMENT;
+		tokeniser->context.match_cdata.end = 0;
 	}
 
+	/* Don't split between "]]" and a possible '>' */
+	if (tokeniser->context.match_cdata.end == 0 &&
+			tokeniser->context.pending >= tokeniser->token_limit)
+		return hubbub_tokeniser_split_chars(tokeniser);
+
 	return HUBBUB_OK;
 }
 
 
-
-
-#define DOCTYPE		"DOCTYPE"
-#define DOCTYPE_LEN	(SLEN(DOCTYPE) - 1)
-
-hubbub_error hubbub_tokeniser_handle_match_doctype(hubbub_tokeniser *tokeniser)
+hubbub_error hubbub_tokeniser_consume_character_reference(
+		hubbub_tokeniser *tokeniser, size_t pos)
 {
+	uint32_t allowed_char = tokeniser->context.allowed_char;
+
 	size_t len;
 	const uint8_t *cptr;
 	parserutils_error error;
 	uint8_t c;
+	size_t off;
 
-	error = parserutils_inputstream_peek(tokeniser->input,
-			tokeniser->context.match_doctype.count, &cptr, &len);
+	error = hubbub_tokeniser_peek(tokeniser, pos,
+			&cptr, &len);
+
+	/* We should always start on an ampersand */
+	assert(error == PARSERUTILS_OK);
+	assert(len == 1 && *cptr == '&');
+
+	off = pos + len;
+
+	/* Look at the character after the ampersand */
+	error = hubbub_tokeniser_peek(tokeniser, off,
+			&cptr, &len);
 
 	if (error != PARSERUTILS_OK) {
 		if (error == PARSERUTILS_EOF) {
-			tokeniser->context.current_comment.len =
-					tokeniser->context.pending = 0;
-			tokeniser->state = STATE_BOGUS_COMMENT;
+			tokeniser->context.match_entity.complete = true;
+			tokeniser->context.match_entity.codepoint = 0;
 			return HUBBUB_OK;
 		} else {
 			return hubbub_error_from_parserutils_error(error);
@@ -2020,1425 +5413,2396 @@ hubbub_error hubbub_tokeniser_handle_match_doctype(hubbub_tokeniser *tokeniser)
 
 	c = *cptr;
 
-	assert(tokeniser->context.match_doctype.count <= DOCTYPE_LEN);
+	/* Set things up */
+	tokeniser->context.match_entity.offset = off;
+	tokeniser->context.match_entity.poss_length = 0;
+	tokeniser->context.match_entity.length = 0;
+	tokeniser->context.match_entity.base = 0;
+	tokeniser->context.match_entity.codepoint = 0;
+	tokeniser->context.match_entity.had_data = false;
+	tokeniser->context.match_entity.return_state = tokeniser->state;
+	tokeniser->context.match_entity.complete = false;
+	tokeniser->context.match_entity.overflow = false;
+	tokeniser->context.match_entity.context = -1;
+	tokeniser->context.match_entity.prev_len = len;
 
-	if (DOCTYPE[tokeniser->context.match_doctype.count] != (c & ~0x20)) {
-		tokeniser->context.current_comment.len =
-				tokeniser->context.pending = 0;
-		tokeniser->state = STATE_BOGUS_COMMENT;
-		return HUBBUB_OK;
+	/* Reset allowed character for future calls */
+	tokeniser->context.allowed_char = '\0';
+
+	if (c == '\t' || c == '\n' || c == '\f' || c == ' ' ||
+			c == '<' || c == '&' ||
+			(allowed_char && c == allowed_char)) {
+		tokeniser->context.match_entity.complete = true;
+		tokeniser->context.match_entity.codepoint = 0;
+	} else if (c == '#') {
+		tokeniser->context.match_entity.length += len;
+		tokeniser->state = STATE_NUMBERED_ENTITY;
+	} else {
+		tokeniser->state = STATE_NAMED_ENTITY;
+		HUBBUB_STATS_ADD(tokeniser->stats, entity_lookups, 1);
 	}
 
-	tokeniser->context.pending += len;
+	return HUBBUB_OK;
+}
 
-	if (tokeniser->context.match_doctype.count == DOCTYPE_LEN) {
-		/* Skip over the DOCTYPE bit */
-		parserutils_inputstream_advance(tokeniser->input,
-				tokeniser->context.pending);
 
-		memset(&tokeniser->context.current_doctype, 0,
-				sizeof tokeniser->context.current_doctype);
-		tokeniser->context.current_doctype.public_missing = true;
-		tokeniser->context.current_doctype.system_missing = true;
-		tokeniser->context.pending = 0;
+hubbub_error hubbub_tokeniser_handle_numbered_entity(
+		hubbub_tokeniser *tokeniser)
+{
+	hubbub_tokeniser_context *ctx = &tokeniser->context;
 
-		tokeniser->state = STATE_DOCTYPE;
+	size_t len;
+	const uint8_t *cptr;
+	parserutils_error error;
+
+	error = hubbub_tokeniser_peek(tokeniser,
+			ctx->match_entity.offset + ctx->match_entity.length,
+			&cptr, &len);
+
+	if (error != PARSERUTILS_OK && error != PARSERUTILS_EOF) {
+		return hubbub_error_from_parserutils_error(error);
+	}
+
+	if (error != PARSERUTILS_EOF && ctx->match_entity.base == 0) {
+		uint8_t c = *cptr;
+		if ((c & ~0x20) == 'X') {
+			ctx->match_entity.base = 16;
+			ctx->match_entity.length += len;
+		} else {
+			ctx->match_entity.base = 10;
+		}
+	}
+
+	while ((error = hubbub_tokeniser_peek(tokeniser,
+			ctx->match_entity.offset + ctx->match_entity.length,
+			&cptr, &len)) == PARSERUTILS_OK) {
+		uint8_t c = *cptr;
+
+		if (ctx->match_entity.base == 10 &&
+				hubbub_char_is(c, HUBBUB_CC_DIGIT)) {
+			ctx->match_entity.had_data = true;
+			ctx->match_entity.codepoint =
+				ctx->match_entity.codepoint * 10 + (c - '0');
+
+			ctx->match_entity.length += len;
+		} else if (ctx->match_entity.base == 16 &&
+				hubbub_char_is(c, HUBBUB_CC_HEX)) {
+			ctx->match_entity.had_data = true;
+			ctx->match_entity.codepoint *= 16;
+
+			if (hubbub_char_is(c, HUBBUB_CC_DIGIT)) {
+				ctx->match_entity.codepoint += (c - '0');
+			} else {
+				ctx->match_entity.codepoint +=
+					hubbub_char_tolower(c) - 'a' + 10;
+			}
+
+			ctx->match_entity.length += len;
+		} else {
+			break;
+		}
+
+		if (ctx->match_entity.codepoint >= 0x10FFFF) {
+			ctx->match_entity.overflow = true;
+		}
+	}
+
+	if (error != PARSERUTILS_OK && error != PARSERUTILS_EOF) {
+		return hubbub_error_from_parserutils_error(error);
+	}
+
+	/* Eat trailing semicolon, if any */
+	if (error != PARSERUTILS_EOF && *cptr == ';') {
+		ctx->match_entity.length += len;
+	}
+
+	/* Had data, so calculate final codepoint */
+	if (ctx->match_entity.had_data) {
+		ctx->match_entity.codepoint =
+				hubbub_tokeniser_numbered_codepoint(
+				ctx->match_entity.codepoint,
+				ctx->match_entity.overflow);
 	}
 
-	tokeniser->context.match_doctype.count++;
+	/* Flag completion */
+	ctx->match_entity.complete = true;
+
+	/* And back to the state we were entered in */
+	tokeniser->state = ctx->match_entity.return_state;
 
 	return HUBBUB_OK;
 }
 
-#undef DOCTYPE
-#undef DOCTYPE_LEN
-
-hubbub_error hubbub_tokeniser_handle_doctype(hubbub_tokeniser *tokeniser)
+hubbub_error hubbub_tokeniser_handle_named_entity(hubbub_tokeniser *tokeniser)
 {
+	hubbub_tokeniser_context *ctx = &tokeniser->context;
+
 	size_t len;
 	const uint8_t *cptr;
 	parserutils_error error;
-	uint8_t c;
 
-	error = parserutils_inputstream_peek(tokeniser->input,
-			tokeniser->context.pending, &cptr, &len);
+	while ((error = hubbub_tokeniser_peek(tokeniser,
+			ctx->match_entity.offset +
+					ctx->match_entity.poss_length,
+			&cptr, &len)) == PARSERUTILS_OK) {
+		uint32_t cp;
 
-	if (error != PARSERUTILS_OK) {
-		if (error == PARSERUTILS_EOF) {
-			tokeniser->state = STATE_BEFORE_DOCTYPE_NAME;
-			return HUBBUB_OK;
+		uint8_t c = *cptr;
+		hubbub_error error;
+
+		if (c > 0x7F) {
+			/* Entity names are ASCII only */
+			break;
+		}
+
+		error = hubbub_entities_search_step(c, &cp,
+				&ctx->match_entity.context);
+		if (error == HUBBUB_OK) {
+			/* Had a match - store it for later */
+			ctx->match_entity.codepoint = cp;
+
+			ctx->match_entity.length =
+					ctx->match_entity.poss_length + len;
+			ctx->match_entity.poss_length =
+					ctx->match_entity.length;
+		} else if (error == HUBBUB_INVALID) {
+			/* No further matches - use last found */
+			break;
 		} else {
-			return hubbub_error_from_parserutils_error(error);
+			/* Need more data */
+			ctx->match_entity.poss_length += len;
 		}
 	}
 
-	c = *cptr;
-
-	if (c == '\t' || c == '\n' || c == '\f' || c == ' ' || c == '\r') {
-		tokeniser->context.pending += len;
+	if (error != PARSERUTILS_OK && error != PARSERUTILS_EOF) {
+		return hubbub_error_from_parserutils_error(error);
 	}
 
-	tokeniser->state = STATE_BEFORE_DOCTYPE_NAME;
+	if (ctx->match_entity.length > 0) {
+		uint8_t c;
+		error = hubbub_tokeniser_peek(tokeniser,
+				ctx->match_entity.offset + 
+					ctx->match_entity.length - 1,
+				&cptr, &len);
+		/* We're re-reading a character we've already read after. 
+		 * Therefore, there's no way that an error may occur as 
+		 * a result. */
+		assert(error == PARSERUTILS_OK);
 
-	return HUBBUB_OK;
-}
+		c = *cptr;
 
-hubbub_error hubbub_tokeniser_handle_before_doctype_name(
-		hubbub_tokeniser *tokeniser)
-{
-	hubbub_doctype *cdoc = &tokeniser->context.current_doctype;
-	size_t len;
-	const uint8_t *cptr;
-	parserutils_error error;
-	uint8_t c;
+		if ((tokeniser->context.match_entity.return_state ==
+				STATE_CHARACTER_REFERENCE_IN_ATTRIBUTE_VALUE) &&
+				c != ';') {
+			error = hubbub_tokeniser_peek(tokeniser,
+					ctx->match_entity.offset +
+						ctx->match_entity.length,
+					&cptr, &len);
+			/* We must have attempted to read one more character 
+			 * than was present in the entity name, as that is the 
+			 * only way to break out of the loop above. If that 
+			 * failed, then any non-EOF case will have been handled
+			 * by the if statement after the loop thus it cannot 
+			 * occur here. */
+			assert(error == PARSERUTILS_OK || 
+					error == PARSERUTILS_EOF);
 
-	error = parserutils_inputstream_peek(tokeniser->input,
-			tokeniser->context.pending, &cptr, &len);
+			if (error == PARSERUTILS_EOF) {
+				ctx->match_entity.codepoint = 0;
+			}
 
-	if (error != PARSERUTILS_OK) {
-		if (error == PARSERUTILS_EOF) {
-			/** \todo parse error */
-			/* Emit current doctype, force-quirks on */
-			tokeniser->state = STATE_DATA;
-			return emit_current_doctype(tokeniser, true);
-		} else {
-			return hubbub_error_from_parserutils_error(error);
+			c = *cptr;
+			if ((0x0030 <= c && c <= 0x0039) ||
+					(0x0041 <= c && c <= 0x005A) ||
+					(0x0061 <= c && c <= 0x007A)) {
+				ctx->match_entity.codepoint = 0;
+			}
 		}
 	}
 
-	c = *cptr;
+	/* Flag completion */
+	ctx->match_entity.complete = true;
 
-	if (c == '\t' || c == '\n' || c == '\f' || c == ' ' || c == '\r') {
-		/* pass over in silence */
-		tokeniser->context.pending += len;
-	} else if (c == '>') {
-		/** \todo parse error */
-		tokeniser->context.pending += len;
-		tokeniser->state = STATE_DATA;
-		return emit_current_doctype(tokeniser, true);
-	} else {
-		if (c == '\0') {
-			START_BUF(cdoc->name, u_fffd, sizeof(u_fffd));
-		} else if ('A' <= c && c <= 'Z') {
-			uint8_t lc = c + 0x20;
+	/* And back to the state from whence we came */
+	tokeniser->state = ctx->match_entity.return_state;
 
-			START_BUF(cdoc->name, &lc, len);
-		} else {
-			START_BUF(cdoc->name, cptr, len);
-		}
+	return HUBBUB_OK;
+}
 
-		tokeniser->context.pending += len;
-		tokeniser->state = STATE_DOCTYPE_NAME;
+/**
+ * Find the character a numeric character reference stands for
+ *
+ * \param cp        Value of the reference
+ * \param overflow  Whether the value exceeded the largest codepoint
+ * \return Codepoint of the character
+ */
+uint32_t hubbub_tokeniser_numbered_codepoint(uint32_t cp, bool overflow)
+{
+	if (0x80 <= cp && cp <= 0x9F) {
+		cp = cp1252Table[cp - 0x80];
+	} else if (cp == 0x0D) {
+		cp = 0x000A;
+	} else if (overflow ||
+			cp <= 0x0008 || cp == 0x000B ||
+			(0x000E <= cp && cp <= 0x001F) ||
+			(0x007F <= cp && cp <= 0x009F) ||
+			(0xD800 <= cp && cp <= 0xDFFF) ||
+			(0xFDD0 <= cp && cp <= 0xFDEF) ||
+			(cp & 0xFFFE) == 0xFFFE) {
+		/* the check for cp > 0x10FFFF per spec is performed
+		 * by the caller to avoid overflow */
+		cp = 0xFFFD;
 	}
 
-	return HUBBUB_OK;
+	return cp;
 }
 
-hubbub_error hubbub_tokeniser_handle_doctype_name(hubbub_tokeniser *tokeniser)
+/**
+ * Decode a character reference in a raw attribute value
+ *
+ * \param s    Pointer to the data after the ampersand
+ * \param len  Length, in bytes, of the rest of the value
+ * \param cp   Pointer to location to receive codepoint
+ * \return Length, in bytes, of the reference after the ampersand,
+ *         or 0 if the ampersand does not start one
+ *
+ * The rules are those of the character reference in attribute value state,
+ * where the end of the value is followed by a character which is neither
+ * alphanumeric nor part of an entity name.
+ */
+size_t hubbub_tokeniser_decode_reference(const uint8_t *s, size_t len,
+		uint32_t *cp)
 {
-	hubbub_doctype *cdoc = &tokeniser->context.current_doctype;
-	size_t len;
-	const uint8_t *cptr;
-	parserutils_error error;
-	uint8_t c;
+	uint32_t value = 0;
+	size_t n = 0;
 
-	error = parserutils_inputstream_peek(tokeniser->input,
-			tokeniser->context.pending, &cptr, &len);
+	if (len == 0)
+		return 0;
 
-	if (error != PARSERUTILS_OK) {
-		if (error == PARSERUTILS_EOF) {
-			tokeniser->state = STATE_DATA;
-			return emit_current_doctype(tokeniser, true);
-		} else {
-			return hubbub_error_from_parserutils_error(error);
+	if (s[0] == '#') {
+		uint32_t base = 10;
+		bool had_data = false;
+		bool overflow = false;
+
+		n = 1;
+
+		if (n < len && (s[n] & ~0x20) == 'X') {
+			base = 16;
+			n++;
 		}
-	}
 
-	c = *cptr;
+		for (; n < len; n++) {
+			uint8_t c = s[n];
 
-	if (c == '\t' || c == '\n' || c == '\f' || c == ' ' || c == '\r') {
-		tokeniser->context.pending += len;
-		tokeniser->state = STATE_AFTER_DOCTYPE_NAME;
-	} else if (c == '>') {
-		tokeniser->context.pending += len;
-		tokeniser->state = STATE_DATA;
-		return emit_current_doctype(tokeniser, false);
-	} else if (c == '\0') {
-		COLLECT(cdoc->name, u_fffd, sizeof(u_fffd));
-		tokeniser->context.pending += len;
-	} else if ('A' <= c && c <= 'Z') {
-		uint8_t lc = c + 0x20;
-		COLLECT(cdoc->name, &lc, len);
-		tokeniser->context.pending += len;
+			if (base == 10 && hubbub_char_is(c, HUBBUB_CC_DIGIT)) {
+				value = value * 10 + (c - '0');
+			} else if (base == 16 &&
+					hubbub_char_is(c, HUBBUB_CC_HEX)) {
+				value *= 16;
+
+				if (hubbub_char_is(c, HUBBUB_CC_DIGIT))
+					value += (c - '0');
+				else
+					value += hubbub_char_tolower(c) -
+							'a' + 10;
+			} else {
+				break;
+			}
+
+			had_data = true;
+
+			if (value >= 0x10FFFF)
+				overflow = true;
+		}
+
+		if (had_data == false)
+			return 0;
+
+		/* Eat trailing semicolon, if any */
+		if (n < len && s[n] == ';')
+			n++;
+
+		*cp = hubbub_tokeniser_numbered_codepoint(value, overflow);
 	} else {
-		COLLECT(cdoc->name, cptr, len);
-		tokeniser->context.pending += len;
+		int32_t context = -1;
+		size_t poss_length = 0;
+
+		/* Spaces, '<' and '&' are in no entity's name, so are left
+		 * alone here, as they are by the tokeniser */
+		while (poss_length < len && s[poss_length] <= 0x7F) {
+			hubbub_error error;
+			uint32_t match;
+
+			error = hubbub_entities_search_step(s[poss_length],
+					&match, &context);
+			if (error == HUBBUB_OK) {
+				/* Had a match - store it for later */
+				value = match;
+				n = poss_length + 1;
+				poss_length = n;
+			} else if (error == HUBBUB_INVALID) {
+				/* No further matches - use last found */
+				break;
+			} else {
+				/* Need more data */
+				poss_length++;
+			}
+		}
+
+		/* In an attribute value, a reference without its semicolon
+		 * is left alone if followed by an alphanumeric character */
+		if (n == 0 || (s[n - 1] != ';' && n < len &&
+				hubbub_char_is(s[n],
+				HUBBUB_CC_ALPHA | HUBBUB_CC_DIGIT)))
+			return 0;
+
+		*cp = value;
 	}
 
-	return HUBBUB_OK;
+	return n;
 }
 
-hubbub_error hubbub_tokeniser_handle_after_doctype_name(
-		hubbub_tokeniser *tokeniser)
+/**
+ * Decode the value of an attribute
+ *
+ * \param attr  The attribute
+ * \param buf   Pointer to buffer to receive the value
+ * \param len   Pointer to length of buffer, in bytes, updated to the
+ *              length of the value on exit
+ * \return HUBBUB_OK on success,
+ *         HUBBUB_BADPARM on bad parameters, or if the buffer is too small
+ *
+ * The value of an attribute which is not raw is copied unchanged. A buffer
+ * of HUBBUB_ATTRIBUTE_DECODED_MAX(attr->value.len) bytes is always large
+ * enough for the value.
+ *
+ * The value is decoded as if followed by its closing quote, so a value cut
+ * short by the end of the document which ends in a reference without its
+ * semicolon has the reference decoded, though the tokeniser would not.
+ */
+hubbub_error hubbub_attribute_decode(const hubbub_attribute *attr,
+		uint8_t *buf, size_t *len)
 {
-	size_t len;
-	const uint8_t *cptr;
-	parserutils_error error;
-	uint8_t c;
+	static const uint8_t stops[] = { '&', '\0', '\r' };
+	const uint8_t *s, *end;
+	size_t used = 0;
 
-	error = parserutils_inputstream_peek(tokeniser->input,
-			tokeniser->context.pending, &cptr, &len);
+	if (attr == NULL || len == NULL || (buf == NULL && *len > 0))
+		return HUBBUB_BADPARM;
 
-	if (error != PARSERUTILS_OK) {
-		if (error == PARSERUTILS_EOF) {
-			tokeniser->state = STATE_DATA;
-			return emit_current_doctype(tokeniser, true);
-		} else {
-			return hubbub_error_from_parserutils_error(error);
-		}
+	if (attr->raw == false) {
+		if (attr->value.len > *len)
+			return HUBBUB_BADPARM;
+
+		if (attr->value.len > 0)
+			memcpy(buf, attr->value.ptr, attr->value.len);
+		*len = attr->value.len;
+
+		return HUBBUB_OK;
 	}
 
-	c = *cptr;
-	tokeniser->context.pending += len;
+	s = attr->value.ptr;
+	end = s + attr->value.len;
 
-	if (c == '\t' || c == '\n' || c == '\f' || c == ' ' || c == '\r') {
-		/* pass over in silence */
-	} else if (c == '>') {
-		tokeniser->state = STATE_DATA;
-		return emit_current_doctype(tokeniser, false);
-	} else if ((c & ~0x20) == 'P') {
-		tokeniser->context.match_doctype.count = 1;
-		tokeniser->state = STATE_MATCH_PUBLIC;
-	} else if ((c & ~0x20) == 'S') {
-		tokeniser->context.match_doctype.count = 1;
-		tokeniser->state = STATE_MATCH_SYSTEM;
-	} else {
-		tokeniser->state = STATE_BOGUS_DOCTYPE;
-		tokeniser->context.current_doctype.force_quirks = true;
+	while (s < end) {
+		uint8_t utf8[6];
+		const uint8_t *data = s;
+		size_t n = hubbub_scan_until_any(s, end - s,
+				stops, N_ELEMENTS(stops));
+		size_t advance = n;
+
+		if (n == 0 && *s == '\0') {
+			data = u_fffd;
+			n = sizeof(u_fffd);
+			advance = 1;
+		} else if (n == 0 && *s == '\r') {
+			/* CRLF becomes LF, as does a lone CR */
+			data = &lf;
+			n = (s + 1 < end && s[1] == '\n') ? 0 : 1;
+			advance = 1;
+		} else if (n == 0) {
+			uint32_t cp;
+
+			advance = 1 + hubbub_tokeniser_decode_reference(s + 1,
+					end - s - 1, &cp);
+			n = 1;
+
+			if (advance > 1) {
+				uint8_t *utf8ptr = utf8;
+				size_t left = sizeof(utf8);
+
+				parserutils_charset_utf8_from_ucs4(cp,
+						&utf8ptr, &left);
+
+				data = utf8;
+				n = sizeof(utf8) - left;
+			}
+		}
+
+		if (n > *len - used)
+			return HUBBUB_BADPARM;
+
+		memcpy(buf + used, data, n);
+		used += n;
+		s += advance;
 	}
 
+	*len = used;
+
 	return HUBBUB_OK;
 }
 
-#define PUBLIC		"PUBLIC"
-#define PUBLIC_LEN	(SLEN(PUBLIC) - 1)
 
-hubbub_error hubbub_tokeniser_handle_match_public(hubbub_tokeniser *tokeniser)
+
+/*** Token emitting bits ***/
+
+/**
+ * Emit a character token.
+ *
+ * \param tokeniser	Tokeniser instance
+ * \param chars		Pointer to hubbub_string to emit
+ * \return	true
+ */
+hubbub_error emit_character_token(hubbub_tokeniser *tokeniser,
+		const hubbub_string *chars)
+{
+	hubbub_token token;
+
+	token.type = HUBBUB_TOKEN_CHARACTER;
+	token.data.character = *chars;
+	token.whitespace = false;
+
+	return hubbub_tokeniser_emit_token(tokeniser, &token);
+}
+
+/**
+ * Emit the current pending characters being stored in the tokeniser context.
+ *
+ * \param tokeniser	Tokeniser instance
+ * \return	true
+ */
+hubbub_error emit_current_chars(hubbub_tokeniser *tokeniser)
 {
+	hubbub_token token;
 	size_t len;
-	const uint8_t *cptr;
+	const uint8_t *cptr = NULL;
 	parserutils_error error;
-	uint8_t c;
 
-	error = parserutils_inputstream_peek(tokeniser->input,
-			tokeniser->context.pending, &cptr, &len);
+	/* Calling this with nothing to output is a probable bug */
+	assert(tokeniser->context.pending > 0);
 
-	if (error != PARSERUTILS_OK) {
-		if (error == PARSERUTILS_EOF) {
-			tokeniser->context.current_doctype.force_quirks = true;
-			tokeniser->state = STATE_BOGUS_DOCTYPE;
-			return HUBBUB_OK;
-		} else {
+	token.type = HUBBUB_TOKEN_CHARACTER;
+	token.whitespace = tokeniser->context.chars.space ==
+			tokeniser->context.pending;
+
+	if (tokeniser->context.chars.buffered) {
+		/* Some characters were rewritten, so the whole run is in
+		 * the buffer, once the rest of it has been copied there */
+		error = hubbub_tokeniser_buffer_chars(tokeniser);
+		if (error != PARSERUTILS_OK)
 			return hubbub_error_from_parserutils_error(error);
-		}
+
+		token.data.character.ptr = tokeniser->buffer->data;
+		token.data.character.len = tokeniser->buffer->length;
+	} else {
+		error = hubbub_tokeniser_peek(tokeniser, 0,
+				&cptr, &len);
+		if (error != PARSERUTILS_OK)
+			return hubbub_error_from_parserutils_error(error);
+
+		token.data.character.ptr = cptr;
+		token.data.character.len = tokeniser->context.pending;
 	}
 
-	c = *cptr;
+	return hubbub_tokeniser_emit_token(tokeniser, &token);
+}
 
-	assert(tokeniser->context.match_doctype.count <= PUBLIC_LEN);
+/**
+ * Determine if two attributes have the same name
+ *
+ * \param a  First attribute
+ * \param b  Second attribute
+ * \return true if the names match, false otherwise
+ */
+static inline bool hubbub_tokeniser_attribute_names_match(
+		const hubbub_attribute *a, const hubbub_attribute *b)
+{
+	return a->name.len == b->name.len &&
+			memcmp(a->name.ptr, b->name.ptr, a->name.len) == 0;
+}
 
-	if (PUBLIC[tokeniser->context.match_doctype.count] != (c & ~0x20)) {
-		tokeniser->context.current_doctype.force_quirks = true;
-		tokeniser->state = STATE_BOGUS_DOCTYPE;
-		return HUBBUB_OK;
-	}
+/**
+ * Discard all but the first of each set of attributes sharing a name,
+ * keeping the survivors in their original order
+ *
+ * Small tags are handled by comparing each attribute with those already
+ * kept. Larger ones use an open-addressed hash table, sized to fit the
+ * tag, so the work done is linear in the number of attributes.
+ *
+ * \param tokeniser     Tokeniser instance
+ * \param attrs         Array of attributes, with name pointers set
+ * \param n_attributes  Number of entries in attrs
+ * \return Number of attributes remaining
+ */
+static uint32_t hubbub_tokeniser_discard_duplicate_attributes(
+		hubbub_tokeniser *tokeniser, hubbub_attribute *attrs,
+		uint32_t n_attributes)
+{
+	uint32_t *hash = tokeniser->context.attribute_hash;
+	uint32_t kept = 0;
+	uint32_t size, i, j;
+
+	if (n_attributes < ATTRIBUTE_CHUNK) {
+		for (i = 0; i < n_attributes; i++) {
+			for (j = 0; j < kept; j++) {
+				if (hubbub_tokeniser_attribute_names_match(
+						&attrs[j], &attrs[i]))
+					break;
+			}
 
-	tokeniser->context.pending += len;
+			if (j == kept)
+				attrs[kept++] = attrs[i];
+		}
 
-	if (tokeniser->context.match_doctype.count == PUBLIC_LEN) {
-		tokeniser->state = STATE_BEFORE_DOCTYPE_PUBLIC;
+		return kept;
 	}
 
-	tokeniser->context.match_doctype.count++;
+	/* Keep the table no more than half full. This fits within the
+	 * space allocated, which is twice the size of the attribute array,
+	 * itself a power of two. */
+	for (size = 2 * ATTRIBUTE_CHUNK; size < 2 * n_attributes; size *= 2)
+		;
 
-	return HUBBUB_OK;
-}
+	assert(size <= 2 * tokeniser->context.attribute_space);
 
-#undef PUBLIC
-#undef PUBLIC_LEN
+	/* Entries are 1 + the index of a kept attribute, or 0 if empty */
+	memset(hash, 0, size * sizeof(uint32_t));
 
-hubbub_error hubbub_tokeniser_handle_before_doctype_public(
-		hubbub_tokeniser *tokeniser)
-{
-	hubbub_doctype *cdoc = &tokeniser->context.current_doctype;
-	size_t len;
-	const uint8_t *cptr;
-	parserutils_error error;
-	uint8_t c;
+	for (i = 0; i < n_attributes; i++) {
+		const uint8_t *name = attrs[i].name.ptr;
+		uint32_t h = 2166136261u;
 
-	error = parserutils_inputstream_peek(tokeniser->input,
-			tokeniser->context.pending, &cptr, &len);
+		/* FNV-1a */
+		for (j = 0; j < attrs[i].name.len; j++)
+			h = (h ^ name[j]) * 16777619u;
 
-	if (error != PARSERUTILS_OK) {
-		if (error == PARSERUTILS_EOF) {
-			tokeniser->state = STATE_DATA;
-			return emit_current_doctype(tokeniser, true);
-		} else {
-			return hubbub_error_from_parserutils_error(error);
+		for (h &= size - 1; hash[h] != 0; h = (h + 1) & (size - 1)) {
+			if (hubbub_tokeniser_attribute_names_match(
+					&attrs[hash[h] - 1], &attrs[i]))
+				break;
+		}
+
+		if (hash[h] != 0) {
+			/* Duplicate of an earlier attribute */
+			continue;
 		}
+
+		attrs[kept++] = attrs[i];
+		hash[h] = kept;
 	}
 
-	c = *cptr;
-	tokeniser->context.pending += len;
+	return kept;
+}
 
-	if (c == '\t' || c == '\n' || c == '\f' || c == ' ' || c == '\r') {
-		/* pass over in silence */
-	} else if (c == '"') {
-		cdoc->public_missing = false;
-		cdoc->public_id.len = 0;
-		tokeniser->state = STATE_DOCTYPE_PUBLIC_DQ;
-	} else if (c == '\'') {
-		cdoc->public_missing = false;
-		cdoc->public_id.len = 0;
-		tokeniser->state = STATE_DOCTYPE_PUBLIC_SQ;
-	} else if (c == '>') {
-		tokeniser->state = STATE_DATA;
-		return emit_current_doctype(tokeniser, true);
+/**
+ * Save the name of a start tag, for matching the end of R?CDATA
+ *
+ * \param tokeniser  Tokeniser instance
+ * \param name       Name of the start tag
+ */
+static inline void hubbub_tokeniser_save_start_tag_name(
+		hubbub_tokeniser *tokeniser, const hubbub_string *name)
+{
+	if (name->len < sizeof(tokeniser->context.last_start_tag_name)) {
+		strncpy((char *) tokeniser->context.last_start_tag_name,
+				(const char *) name->ptr, name->len);
+		tokeniser->context.last_start_tag_len = name->len;
 	} else {
-		cdoc->force_quirks = true;
-		tokeniser->state = STATE_BOGUS_DOCTYPE;
+		tokeniser->context.last_start_tag_name[0] = '\0';
+		tokeniser->context.last_start_tag_len = 0;
 	}
-
-	return HUBBUB_OK;
 }
 
-hubbub_error hubbub_tokeniser_handle_doctype_public_dq(
-		hubbub_tokeniser *tokeniser)
+/**
+ * Emit the current tag token being stored in the tokeniser context.
+ *
+ * \param tokeniser	Tokeniser instance
+ * \return	true
+ */
+hubbub_error emit_current_tag(hubbub_tokeniser *tokeniser)
 {
-	hubbub_doctype *cdoc = &tokeniser->context.current_doctype;
-	size_t len;
-	const uint8_t *cptr;
-	parserutils_error error;
-	uint8_t c;
+	hubbub_error err;
+	hubbub_token token;
+	uint32_t n_attributes;
+	hubbub_attribute *attrs;
+	const hubbub_tokeniser_attribute_src *srcs;
+	const uint8_t *buffered;
+	uint32_t i;
 
-	error = parserutils_inputstream_peek(tokeniser->input,
-			tokeniser->context.pending, &cptr, &len);
+	/* Emit current tag */
+	token.type = tokeniser->context.current_tag_type;
+	token.data.tag = tokeniser->context.current_tag;
+ 	token.data.tag.ns = HUBBUB_NS_HTML;
 
-	if (error != PARSERUTILS_OK) {
-		if (error == PARSERUTILS_EOF) {
-			tokeniser->state = STATE_DATA;
-			return emit_current_doctype(tokeniser, true);
-		} else {
-			return hubbub_error_from_parserutils_error(error);
-		}
+
+	n_attributes = token.data.tag.n_attributes;
+	attrs = token.data.tag.attributes;
+
+	/* Set pointers correctly... */
+	srcs = tokeniser->context.attribute_src;
+	buffered = tokeniser->buffer->data;
+	hubbub_tokeniser_resolve_string(tokeniser, &token.data.tag.name,
+			tokeniser->context.current_tag_name_src, &buffered);
+	token.data.tag.atom = hubbub_atom_lookup(
+			tokeniser->context.current_tag_name_hash,
+			token.data.tag.name.ptr, token.data.tag.name.len);
+
+	for (i = 0; i < n_attributes; i++) {
+		hubbub_tokeniser_resolve_string(tokeniser, &attrs[i].name,
+				srcs[i].name, &buffered);
+		hubbub_tokeniser_resolve_string(tokeniser, &attrs[i].value,
+				srcs[i].value, &buffered);
 	}
 
-	c = *cptr;
+	/* Discard duplicate attributes */
+	n_attributes = hubbub_tokeniser_discard_duplicate_attributes(
+			tokeniser, attrs, n_attributes);
 
-	if (c == '"') {
-		tokeniser->context.pending += len;
-		tokeniser->state = STATE_AFTER_DOCTYPE_PUBLIC;
-	} else if (c == '>') {
-		tokeniser->context.pending += len;
-		tokeniser->state = STATE_DATA;
-		return emit_current_doctype(tokeniser, true);
-	} else if (c == '\0') {
-		COLLECT_MS(cdoc->public_id, u_fffd, sizeof(u_fffd));
-		tokeniser->context.pending += len;
-	} else if (c == '\r') {
-		error = parserutils_inputstream_peek(
-				tokeniser->input,
-				tokeniser->context.pending,
-				&cptr,
-				&len);
+	token.data.tag.n_attributes = n_attributes;
 
-		if (error != PARSERUTILS_OK && error != PARSERUTILS_EOF) {
-			return hubbub_error_from_parserutils_error(error);
-		} else if (error == PARSERUTILS_EOF || *cptr != '\n') {
-			COLLECT_MS(cdoc->public_id, &lf, sizeof(lf));
-		}
+	for (i = 0; i < n_attributes; i++) {
+		attrs[i].atom = hubbub_atom_find(attrs[i].name.ptr,
+				attrs[i].name.len);
+	}
 
-		/* Collect '\r' */
-		tokeniser->context.pending += 1;
-	} else {
-		COLLECT_MS(cdoc->public_id, cptr, len);
+	/* The name may point into the input, which is consumed by emitting
+	 * the token, so save it first */
+	if (token.type == HUBBUB_TOKEN_START_TAG)
+		hubbub_tokeniser_save_start_tag_name(tokeniser,
+				&token.data.tag.name);
 
-		tokeniser->context.pending += len;
+	err = hubbub_tokeniser_emit_token(tokeniser, &token);
+
+	if (token.type == HUBBUB_TOKEN_END_TAG) {
+		/* Reset content model after R?CDATA elements */
+		tokeniser->content_model = HUBBUB_CONTENT_MODEL_PCDATA;
 	}
 
-	return HUBBUB_OK;
+	/* Reset the self-closing flag */
+	tokeniser->context.current_tag.self_closing = false;
+
+	return err;
 }
 
-hubbub_error hubbub_tokeniser_handle_doctype_public_sq(
-		hubbub_tokeniser *tokeniser)
+/**
+ * Emit the current comment token being stored in the tokeniser context.
+ *
+ * \param tokeniser	Tokeniser instance
+ * \return	true
+ */
+hubbub_error emit_current_comment(hubbub_tokeniser *tokeniser)
 {
-	hubbub_doctype *cdoc = &tokeniser->context.current_doctype;
-	size_t len;
-	const uint8_t *cptr;
-	parserutils_error error;
-	uint8_t c;
+	hubbub_token token;
 
-	error = parserutils_inputstream_peek(tokeniser->input,
-			tokeniser->context.pending, &cptr, &len);
+	const uint8_t *buffered = tokeniser->buffer->data;
+	hubbub_error err;
 
-	if (error != PARSERUTILS_OK) {
-		if (error == PARSERUTILS_EOF) {
-			tokeniser->state = STATE_DATA;
-			return emit_current_doctype(tokeniser, true);
-		} else {
-			return hubbub_error_from_parserutils_error(error);
+	if (tokeniser->drop_comments) {
+		/* Just move past the comment */
+		if (tokeniser->buffer->length) {
+			parserutils_buffer_discard(tokeniser->buffer, 0,
+					tokeniser->buffer->length);
 		}
-	}
 
-	c = *cptr;
+		if (tokeniser->context.pending) {
+			hubbub_tokeniser_advance(tokeniser,
+					tokeniser->context.pending);
+			tokeniser->context.pending = 0;
+		}
 
-	if (c == '\'') {
-		tokeniser->context.pending += len;
-		tokeniser->state = STATE_AFTER_DOCTYPE_PUBLIC;
-	} else if (c == '>') {
-		tokeniser->context.pending += len;
-		tokeniser->state = STATE_DATA;
-		return emit_current_doctype(tokeniser, true);
-	} else if (c == '\0') {
-		COLLECT_MS(cdoc->public_id, u_fffd, sizeof(u_fffd));
-		tokeniser->context.pending += len;
-	} else if (c == '\r') {
-		error = parserutils_inputstream_peek(
-				tokeniser->input,
-				tokeniser->context.pending,
-				&cptr,
-				&len);
+		if (tokeniser->track_position)
+			hubbub_tokeniser_mark(tokeniser);
 
-		if (error != PARSERUTILS_OK && error != PARSERUTILS_EOF) {
-			return hubbub_error_from_parserutils_error(error);
-		} else if (error == PARSERUTILS_EOF || *cptr != '\n') {
-			COLLECT_MS(cdoc->public_id, &lf, sizeof(lf));
-		}
-	
-		/* Collect '\r' */
-		tokeniser->context.pending += 1;
-	} else {
-		COLLECT_MS(cdoc->public_id, cptr, len);
-		tokeniser->context.pending += len;
+		tokeniser->context.current_comment.len = 0;
+
+		return HUBBUB_OK;
 	}
 
-	return HUBBUB_OK;
-}
+	token.type = HUBBUB_TOKEN_COMMENT;
+	token.data.comment = tokeniser->context.current_comment;
+	hubbub_tokeniser_resolve_string(tokeniser, &token.data.comment,
+			tokeniser->context.current_comment_src, &buffered);
 
+	err = hubbub_tokeniser_emit_token(tokeniser, &token);
 
-hubbub_error hubbub_tokeniser_handle_after_doctype_public(
-		hubbub_tokeniser *tokeniser)
-{
-	hubbub_doctype *cdoc = &tokeniser->context.current_doctype;
-	size_t len;
-	const uint8_t *cptr;
-	parserutils_error error;
-	uint8_t c;
+	tokeniser->context.current_comment.len = 0;
 
-	error = parserutils_inputstream_peek(tokeniser->input,
-			tokeniser->context.pending, &cptr, &len);
+	return err;
+}
 
-	if (error != PARSERUTILS_OK) {
-		if (error == PARSERUTILS_EOF) {
-			tokeniser->state = STATE_DATA;
-			return emit_current_doctype(tokeniser, true);
-		} else {
-			return hubbub_error_from_parserutils_error(error);
-		}
-	}
+/**
+ * Emit the current doctype token being stored in the tokeniser context.
+ *
+ * \param tokeniser	Tokeniser instance
+ * \param force_quirks	Force quirks mode on this document
+ * \return	true
+ */
+hubbub_error emit_current_doctype(hubbub_tokeniser *tokeniser,
+		bool force_quirks)
+{
+	const hubbub_tokeniser_doctype_src *dsrc =
+			&tokeniser->context.current_doctype_src;
+	const uint8_t *buffered = tokeniser->buffer->data;
+	hubbub_token token;
 
-	c = *cptr;
-	tokeniser->context.pending += len;
+	/* Emit doctype */
+	token.type = HUBBUB_TOKEN_DOCTYPE;
+	token.data.doctype = tokeniser->context.current_doctype;
+	if (force_quirks == true)
+		token.data.doctype.force_quirks = true;
 
-	if (c == '\t' || c == '\n' || c == '\f' || c == ' ' || c == '\r') {
-		/* pass over in silence */
-	} else if (c == '"') {
-		cdoc->system_missing = false;
-		cdoc->system_id.len = 0;
+	/* Set pointers correctly */
+	hubbub_tokeniser_resolve_string(tokeniser, &token.data.doctype.name,
+			dsrc->name, &buffered);
 
-		tokeniser->state = STATE_DOCTYPE_SYSTEM_DQ;
-	} else if (c == '\'') {
-		cdoc->system_missing = false;
-		cdoc->system_id.len = 0;
+	if (token.data.doctype.public_missing == false) {
+		hubbub_tokeniser_resolve_string(tokeniser,
+				&token.data.doctype.public_id,
+				dsrc->public_id, &buffered);
+	}
 
-		tokeniser->state = STATE_DOCTYPE_SYSTEM_SQ;
-	} else if (c == '>') {
-		tokeniser->state = STATE_DATA;
-		return emit_current_doctype(tokeniser, false);
-	} else {
-		cdoc->force_quirks = true;
-		tokeniser->state = STATE_BOGUS_DOCTYPE;
+	if (token.data.doctype.system_missing == false) {
+		hubbub_tokeniser_resolve_string(tokeniser,
+				&token.data.doctype.system_id,
+				dsrc->system_id, &buffered);
 	}
 
-	return HUBBUB_OK;
+	return hubbub_tokeniser_emit_token(tokeniser, &token);
 }
 
+/**
+ * Batched token delivery
+ *
+ * When a batch handler is registered, emitted tokens are copied into the
+ * batch rather than being passed on one at a time. The strings of each
+ * token are appended to batch.strings in a fixed order (tag name, then
+ * the name and value of each attribute; doctype name, public id, then
+ * system id), and the attributes of tags to batch.attrs. Both of these
+ * may move as they grow, so the pointers of the batched tokens are only
+ * worked out from the string lengths and attribute counts when the batch
+ * is delivered: once it is full, and at the end of each call to
+ * hubbub_tokeniser_run().
+ */
 
-
-#define SYSTEM		"SYSTEM"
-#define SYSTEM_LEN	(SLEN(SYSTEM) - 1)
-
-hubbub_error hubbub_tokeniser_handle_match_system(hubbub_tokeniser *tokeniser)
+/**
+ * Set the batched token handler
+ *
+ * \param tokeniser  Tokeniser instance
+ * \param params     Option parameters
+ * \return HUBBUB_OK on success,
+ *         HUBBUB_BADPARM if the batch size is zero,
+ *         HUBBUB_NOMEM on memory exhaustion
+ */
+hubbub_error hubbub_tokeniser_set_batch_handler(hubbub_tokeniser *tokeniser,
+		const hubbub_tokeniser_optparams *params)
 {
-	size_t len;
-	const uint8_t *cptr;
-	parserutils_error error;
-	uint8_t c;
+	hubbub_token_batch_handler handler =
+			params->token_batch_handler.handler;
+	size_t size = params->token_batch_handler.size;
+	parserutils_error perror;
+	hubbub_token *tokens;
 
-	error = parserutils_inputstream_peek(tokeniser->input,
-			tokeniser->context.pending, &cptr, &len);
+	if (handler != NULL && size == 0)
+		return HUBBUB_BADPARM;
 
-	if (error != PARSERUTILS_OK){
-		if (error == PARSERUTILS_EOF) {
-			tokeniser->context.current_doctype.force_quirks = true;
-			tokeniser->state = STATE_BOGUS_DOCTYPE;
-			return HUBBUB_OK;
-		} else {
-			return hubbub_error_from_parserutils_error(error);
-		}
+	if (tokeniser->batch.count > 0) {
+		/* Hand anything already batched to the old handler */
+		hubbub_error err = hubbub_tokeniser_flush_batch(tokeniser);
+		if (err != HUBBUB_OK)
+			return err;
 	}
 
-	c = *cptr;
-
-	assert(tokeniser->context.match_doctype.count <= SYSTEM_LEN);
-
-	if (SYSTEM[tokeniser->context.match_doctype.count] != (c & ~0x20)) {
-		tokeniser->context.current_doctype.force_quirks = true;
-		tokeniser->state = STATE_BOGUS_DOCTYPE;
+	if (handler == NULL) {
+		tokeniser->batch.handler = NULL;
+		tokeniser->batch.pw = NULL;
 		return HUBBUB_OK;
 	}
 
-	tokeniser->context.pending += len;
+	if (tokeniser->batch.strings == NULL) {
+		perror = parserutils_buffer_create(tokeniser->alloc,
+				tokeniser->alloc_pw, &tokeniser->batch.strings);
+		if (perror != PARSERUTILS_OK)
+			return hubbub_error_from_parserutils_error(perror);
+	}
 
-	if (tokeniser->context.match_doctype.count == SYSTEM_LEN) {
-		tokeniser->state = STATE_BEFORE_DOCTYPE_SYSTEM;
+	if (size != tokeniser->batch.size) {
+		tokens = tokeniser->alloc(tokeniser->batch.tokens,
+				size * sizeof(hubbub_token),
+				tokeniser->alloc_pw);
+		if (tokens == NULL)
+			return HUBBUB_NOMEM;
+
+		tokeniser->batch.tokens = tokens;
+		tokeniser->batch.size = size;
 	}
 
-	tokeniser->context.match_doctype.count++;
+	tokeniser->batch.handler = handler;
+	tokeniser->batch.pw = params->token_batch_handler.pw;
 
 	return HUBBUB_OK;
 }
 
-#undef SYSTEM
-#undef SYSTEM_LEN
+/**
+ * Copy a string into the current batch
+ *
+ * \param tokeniser  Tokeniser instance
+ * \param str        String to copy
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ */
+static inline hubbub_error hubbub_tokeniser_batch_string(
+		hubbub_tokeniser *tokeniser, const hubbub_string *str)
+{
+	parserutils_error perror;
 
-hubbub_error hubbub_tokeniser_handle_before_doctype_system(
-		hubbub_tokeniser *tokeniser)
+	if (str->len == 0)
+		return HUBBUB_OK;
+
+	perror = parserutils_buffer_append(tokeniser->batch.strings,
+			str->ptr, str->len);
+
+	return hubbub_error_from_parserutils_error(perror);
+}
+
+/**
+ * Copy a token into the current batch
+ *
+ * \param tokeniser  Tokeniser instance
+ * \param token      Token to copy
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ */
+static hubbub_error hubbub_tokeniser_batch_token(hubbub_tokeniser *tokeniser,
+		const hubbub_token *token)
 {
-	hubbub_doctype *cdoc = &tokeniser->context.current_doctype;
-	size_t len;
-	const uint8_t *cptr;
-	parserutils_error error;
-	uint8_t c;
+	hubbub_token *copy = &tokeniser->batch.tokens[tokeniser->batch.count];
+	hubbub_error err = HUBBUB_OK;
+	uint32_t i;
 
-	error = parserutils_inputstream_peek(tokeniser->input,
-			tokeniser->context.pending, &cptr, &len);
+	assert(tokeniser->batch.count < tokeniser->batch.size);
 
-	if (error != PARSERUTILS_OK) {
-		if (error == PARSERUTILS_EOF) {
-			tokeniser->state = STATE_DATA;
-			return emit_current_doctype(tokeniser, true);
-		} else {
-			return hubbub_error_from_parserutils_error(error);
-		}
-	}
+	*copy = *token;
 
-	c = *cptr;
-	tokeniser->context.pending += len;
+	switch (token->type) {
+	case HUBBUB_TOKEN_DOCTYPE:
+		err = hubbub_tokeniser_batch_string(tokeniser,
+				&token->data.doctype.name);
+		if (err == HUBBUB_OK && token->data.doctype.public_missing)
+			copy->data.doctype.public_id.len = 0;
+		else if (err == HUBBUB_OK)
+			err = hubbub_tokeniser_batch_string(tokeniser,
+					&token->data.doctype.public_id);
+		if (err == HUBBUB_OK && token->data.doctype.system_missing)
+			copy->data.doctype.system_id.len = 0;
+		else if (err == HUBBUB_OK)
+			err = hubbub_tokeniser_batch_string(tokeniser,
+					&token->data.doctype.system_id);
+		break;
+	case HUBBUB_TOKEN_START_TAG:
+	case HUBBUB_TOKEN_END_TAG:
+	{
+		const hubbub_tag *tag = &token->data.tag;
+		size_t needed = tokeniser->batch.n_attrs + tag->n_attributes;
 
-	if (c == '\t' || c == '\n' || c == '\f' || c == ' ' || c == '\r') {
-		/* pass over */
-	} else if (c == '"') {
-		cdoc->system_missing = false;
-		cdoc->system_id.len = 0;
+		if (needed > tokeniser->batch.alloc_attrs) {
+			size_t n = tokeniser->batch.alloc_attrs * 2;
+			hubbub_attribute *attrs;
 
-		tokeniser->state = STATE_DOCTYPE_SYSTEM_DQ;
-	} else if (c == '\'') {
-		cdoc->system_missing = false;
-		cdoc->system_id.len = 0;
+			if (n < needed)
+				n = needed;
 
-		tokeniser->state = STATE_DOCTYPE_SYSTEM_SQ;
-	} else if (c == '>') {
-		tokeniser->state = STATE_DATA;
-		return emit_current_doctype(tokeniser, true);
-	} else {
-		cdoc->force_quirks = true;
-		tokeniser->state = STATE_BOGUS_DOCTYPE;
+			attrs = tokeniser->alloc(tokeniser->batch.attrs,
+					n * sizeof(hubbub_attribute),
+					tokeniser->alloc_pw);
+			if (attrs == NULL)
+				return HUBBUB_NOMEM;
+
+			tokeniser->batch.attrs = attrs;
+			tokeniser->batch.alloc_attrs = n;
+		}
+
+		err = hubbub_tokeniser_batch_string(tokeniser, &tag->name);
+
+		for (i = 0; err == HUBBUB_OK && i < tag->n_attributes; i++) {
+			err = hubbub_tokeniser_batch_string(tokeniser,
+					&tag->attributes[i].name);
+			if (err == HUBBUB_OK)
+				err = hubbub_tokeniser_batch_string(tokeniser,
+						&tag->attributes[i].value);
+		}
+
+		if (tag->n_attributes > 0) {
+			memcpy(tokeniser->batch.attrs +
+					tokeniser->batch.n_attrs,
+					tag->attributes, tag->n_attributes *
+					sizeof(hubbub_attribute));
+		}
+		tokeniser->batch.n_attrs = needed;
+	}
+		break;
+	case HUBBUB_TOKEN_COMMENT:
+		err = hubbub_tokeniser_batch_string(tokeniser,
+				&token->data.comment);
+		break;
+	case HUBBUB_TOKEN_CHARACTER:
+		err = hubbub_tokeniser_batch_string(tokeniser,
+				&token->data.character);
+		break;
+	case HUBBUB_TOKEN_EOF:
+		break;
 	}
 
+	if (err != HUBBUB_OK)
+		return err;
+
+	tokeniser->batch.count++;
+
 	return HUBBUB_OK;
 }
 
-hubbub_error hubbub_tokeniser_handle_doctype_system_dq(
-		hubbub_tokeniser *tokeniser)
+/**
+ * Point a batched string at its characters
+ *
+ * \param str     String to update
+ * \param cursor  Pointer to location of the string's characters; updated
+ *                on exit to point past them
+ */
+static inline void hubbub_tokeniser_resolve_batch_string(hubbub_string *str,
+		const uint8_t **cursor)
 {
-	hubbub_doctype *cdoc = &tokeniser->context.current_doctype;
-	size_t len;
-	const uint8_t *cptr;
-	parserutils_error error;
-	uint8_t c;
-
-	error = parserutils_inputstream_peek(tokeniser->input,
-			tokeniser->context.pending, &cptr, &len);
+	str->ptr = *cursor;
+	*cursor += str->len;
+}
 
-	if (error != PARSERUTILS_OK) {
-		if (error == PARSERUTILS_EOF) {
-			tokeniser->state = STATE_DATA;
-			return emit_current_doctype(tokeniser, true);
-		} else {
-			return hubbub_error_from_parserutils_error(error);
+/**
+ * Pass the current batch of tokens to the batch handler
+ *
+ * \param tokeniser  Tokeniser instance
+ * \return The result of the batch handler
+ */
+hubbub_error hubbub_tokeniser_flush_batch(hubbub_tokeniser *tokeniser)
+{
+	const uint8_t *cursor = tokeniser->batch.strings->data;
+	hubbub_attribute *attrs = tokeniser->batch.attrs;
+	hubbub_error err;
+	size_t i;
+	uint32_t j;
+
+	for (i = 0; i < tokeniser->batch.count; i++) {
+		hubbub_token *token = &tokeniser->batch.tokens[i];
+
+		switch (token->type) {
+		case HUBBUB_TOKEN_DOCTYPE:
+			hubbub_tokeniser_resolve_batch_string(
+					&token->data.doctype.name, &cursor);
+			hubbub_tokeniser_resolve_batch_string(
+					&token->data.doctype.public_id,
+					&cursor);
+			hubbub_tokeniser_resolve_batch_string(
+					&token->data.doctype.system_id,
+					&cursor);
+			break;
+		case HUBBUB_TOKEN_START_TAG:
+		case HUBBUB_TOKEN_END_TAG:
+			hubbub_tokeniser_resolve_batch_string(
+					&token->data.tag.name, &cursor);
+
+			token->data.tag.attributes = attrs;
+			for (j = 0; j < token->data.tag.n_attributes; j++) {
+				hubbub_tokeniser_resolve_batch_string(
+						&attrs[j].name, &cursor);
+				hubbub_tokeniser_resolve_batch_string(
+						&attrs[j].value, &cursor);
+			}
+			attrs += token->data.tag.n_attributes;
+			break;
+		case HUBBUB_TOKEN_COMMENT:
+			hubbub_tokeniser_resolve_batch_string(
+					&token->data.comment, &cursor);
+			break;
+		case HUBBUB_TOKEN_CHARACTER:
+			hubbub_tokeniser_resolve_batch_string(
+					&token->data.character, &cursor);
+			break;
+		case HUBBUB_TOKEN_EOF:
+			break;
 		}
 	}
 
-	c = *cptr;
-
-	if (c == '"') {
-		tokeniser->context.pending += len;
-		tokeniser->state = STATE_AFTER_DOCTYPE_SYSTEM;
-	} else if (c == '>') {
-		tokeniser->context.pending += len;
-		tokeniser->state = STATE_DATA;
-		return emit_current_doctype(tokeniser, true);
-	} else if (c == '\0') {
-		COLLECT_MS(cdoc->system_id, u_fffd, sizeof(u_fffd));
-		tokeniser->context.pending += len;
-	} else if (c == '\r') {
-		error = parserutils_inputstream_peek(
-				tokeniser->input,
-				tokeniser->context.pending,
-				&cptr,
-				&len);
+	err = tokeniser->batch.handler(tokeniser->batch.tokens,
+			tokeniser->batch.count, tokeniser->batch.pw);
 
-		if (error != PARSERUTILS_OK && error != PARSERUTILS_EOF) {
-			return hubbub_error_from_parserutils_error(error);
-		} else if (error == PARSERUTILS_EOF || *cptr != '\n') {
-			COLLECT_MS(cdoc->system_id, &lf, sizeof(lf));
-		}
+	tokeniser->batch.count = 0;
+	tokeniser->batch.n_attrs = 0;
+	parserutils_buffer_discard(tokeniser->batch.strings, 0,
+			tokeniser->batch.strings->length);
 
-		/* Collect '\r' */
-		tokeniser->context.pending += 1;
-	} else {
-		COLLECT_MS(cdoc->system_id, cptr, len);
-		tokeniser->context.pending += len;
-	}
+	/* Ensure callback can pause or stop the tokeniser */
+	if (err == HUBBUB_PAUSED)
+		tokeniser->paused = true;
+	else if (err == HUBBUB_STOPPED)
+		tokeniser->stopped = true;
 
-	return HUBBUB_OK;
+	return err;
 }
 
-hubbub_error hubbub_tokeniser_handle_doctype_system_sq(
-		hubbub_tokeniser *tokeniser)
-{
-	hubbub_doctype *cdoc = &tokeniser->context.current_doctype;
-	size_t len;
-	const uint8_t *cptr;
-	parserutils_error error;
-	uint8_t c;
+/**
+ * Compact token delivery
+ *
+ * When a compact token handler is registered, each token is passed on as
+ * a hubbub_compact_token instead. The string of a token with only one is
+ * its own base. Otherwise, strings are given relative to the unconsumed
+ * input, where they all lie within it, or else to the tokeniser buffer,
+ * where they all lie within that. Failing both (for a tag with attribute
+ * values both from the input and with character references replaced,
+ * say), they are copied to compact.strings, in turn.
+ */
 
-	error = parserutils_inputstream_peek(tokeniser->input,
-			tokeniser->context.pending, &cptr, &len);
+/**
+ * Set the compact token handler
+ *
+ * \param tokeniser  Tokeniser instance
+ * \param params     Option parameters
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ */
+hubbub_error hubbub_tokeniser_set_compact_handler(
+		hubbub_tokeniser *tokeniser,
+		const hubbub_tokeniser_optparams *params)
+{
+	parserutils_error perror;
 
-	if (error != PARSERUTILS_OK) {
-		if (error == PARSERUTILS_EOF) {
-			tokeniser->state = STATE_DATA;
-			return emit_current_doctype(tokeniser, true);
-		} else {
-			return hubbub_error_from_parserutils_error(error);
-		}
+	if (params->compact_token_handler.handler != NULL &&
+			tokeniser->compact.strings == NULL) {
+		perror = parserutils_buffer_create(tokeniser->alloc,
+				tokeniser->alloc_pw,
+				&tokeniser->compact.strings);
+		if (perror != PARSERUTILS_OK)
+			return hubbub_error_from_parserutils_error(perror);
 	}
 
-	c = *cptr;
+	tokeniser->compact.handler = params->compact_token_handler.handler;
+	tokeniser->compact.pw = params->compact_token_handler.pw;
 
-	if (c == '\'') {
-		tokeniser->context.pending += len;
-		tokeniser->state = STATE_AFTER_DOCTYPE_SYSTEM;
-	} else if (c == '>') {
-		tokeniser->context.pending += len;
-		tokeniser->state = STATE_DATA;
-		return emit_current_doctype(tokeniser, true);
-	} else if (c == '\0') {
-		COLLECT_MS(cdoc->system_id, u_fffd, sizeof(u_fffd));
-		tokeniser->context.pending += len;
-	} else if (c == '\r') {
-		error = parserutils_inputstream_peek(
-				tokeniser->input,
-				tokeniser->context.pending,
-				&cptr,
-				&len);
+	return HUBBUB_OK;
+}
 
-		if (error != PARSERUTILS_OK && error != PARSERUTILS_EOF) {
-			return hubbub_error_from_parserutils_error(error);
-		} else if (error == PARSERUTILS_EOF || *cptr != '\n') {
-			COLLECT_MS(cdoc->system_id, &lf, sizeof(lf));
-		}
+/**
+ * Determine whether a string lies within some data, with an offset into
+ * it which a span can hold
+ *
+ * \param str   String to consider
+ * \param data  Pointer to data
+ * \param len   Length, in bytes, of data
+ * \return true if the string lies within the data, false otherwise
+ */
+static inline bool hubbub_tokeniser_compact_within(const hubbub_string *str,
+		const uint8_t *data, size_t len)
+{
+	uintptr_t ptr = (uintptr_t) str->ptr, start = (uintptr_t) data;
+
+	if (str->len == 0)
+		return true;
 
-		/* Collect '\r' */
-		tokeniser->context.pending += 1;
-	} else {
-		COLLECT_MS(cdoc->system_id, cptr, len);
-		tokeniser->context.pending += len;
-	}
+	if (len > UINT32_MAX)
+		len = UINT32_MAX;
 
-	return HUBBUB_OK;
+	return ptr >= start && str->len <= len && ptr - start <= len - str->len;
 }
 
-hubbub_error hubbub_tokeniser_handle_after_doctype_system(
-		hubbub_tokeniser *tokeniser)
+/**
+ * Find the span of a compact token's string
+ *
+ * \param tokeniser  Tokeniser instance
+ * \param str        String to find
+ * \param base       Base of the token's strings, or NULL to copy the
+ *                   string to compact.strings
+ * \param span       Pointer to location to receive span
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ */
+static inline hubbub_error hubbub_tokeniser_compact_span(
+		hubbub_tokeniser *tokeniser, const hubbub_string *str,
+		const uint8_t *base, hubbub_span *span)
 {
-	size_t len;
-	const uint8_t *cptr;
-	parserutils_error error;
-	uint8_t c;
+	parserutils_buffer *strings = tokeniser->compact.strings;
+	parserutils_error perror;
 
-	error = parserutils_inputstream_peek(tokeniser->input,
-			tokeniser->context.pending, &cptr, &len);
+	span->len = str->len;
 
-	if (error != PARSERUTILS_OK) {
-		if (error == PARSERUTILS_EOF) {
-			tokeniser->state = STATE_DATA;
-			return emit_current_doctype(tokeniser, true);
-		} else {
-			return hubbub_error_from_parserutils_error(error);
-		}
-	}
+	if (str->len == 0) {
+		span->off = 0;
+	} else if (base != NULL) {
+		span->off = str->ptr - base;
+	} else {
+		if (strings->length + str->len > UINT32_MAX)
+			return HUBBUB_NOMEM;
 
-	c = *cptr;
-	tokeniser->context.pending += len;
+		span->off = strings->length;
 
-	if (c == '\t' || c == '\n' || c == '\f' || c == ' ' || c == '\r') {
-		/* pass over in silence */
-	} else if (c == '>') {
-		tokeniser->state = STATE_DATA;
-		return emit_current_doctype(tokeniser, false);
-	} else {
-		tokeniser->state = STATE_BOGUS_DOCTYPE;
+		perror = parserutils_buffer_append(strings, str->ptr,
+				str->len);
+		if (perror != PARSERUTILS_OK)
+			return hubbub_error_from_parserutils_error(perror);
 	}
 
 	return HUBBUB_OK;
 }
 
-
-hubbub_error hubbub_tokeniser_handle_bogus_doctype(hubbub_tokeniser *tokeniser)
+/**
+ * Pass a token to the compact token handler
+ *
+ * \param tokeniser  Tokeniser instance
+ * \param token      Token to pass on
+ * \return The result of the compact token handler, or an error
+ */
+hubbub_error hubbub_tokeniser_emit_compact(hubbub_tokeniser *tokeniser,
+		const hubbub_token *token)
 {
-	size_t len;
-	const uint8_t *cptr;
-	parserutils_error error;
-	uint8_t c;
+	const parserutils_buffer *utf8 = tokeniser->input->utf8;
+	const hubbub_string *strs[3];
+	const hubbub_attribute *attrs = NULL;
+	const uint8_t *data[2], *base = NULL;
+	size_t len[2];
+	hubbub_compact_token compact;
+	hubbub_compact_attribute *cattrs;
+	hubbub_error err = HUBBUB_OK;
+	uint32_t n_strs = 0, n_attrs = 0, i, j;
+	bool within;
 
-	error = parserutils_inputstream_peek(tokeniser->input,
-			tokeniser->context.pending, &cptr, &len);
+	memset(&compact, 0, sizeof compact);
+	compact.type = token->type;
 
-	if (error != PARSERUTILS_OK) {
-		if (error == PARSERUTILS_EOF) {
-			tokeniser->state = STATE_DATA;
-			return emit_current_doctype(tokeniser, false);
-		} else {
-			return hubbub_error_from_parserutils_error(error);
+	if (token->incomplete)
+		compact.flags |= HUBBUB_COMPACT_INCOMPLETE;
+	if (token->type == HUBBUB_TOKEN_CHARACTER && token->whitespace)
+		compact.flags |= HUBBUB_COMPACT_WHITESPACE;
+
+	switch (token->type) {
+	case HUBBUB_TOKEN_DOCTYPE:
+		strs[n_strs++] = &token->data.doctype.name;
+		if (token->data.doctype.public_missing)
+			compact.flags |= HUBBUB_COMPACT_PUBLIC_MISSING;
+		else
+			strs[n_strs++] = &token->data.doctype.public_id;
+		if (token->data.doctype.system_missing)
+			compact.flags |= HUBBUB_COMPACT_SYSTEM_MISSING;
+		else
+			strs[n_strs++] = &token->data.doctype.system_id;
+		if (token->data.doctype.force_quirks)
+			compact.flags |= HUBBUB_COMPACT_FORCE_QUIRKS;
+		break;
+	case HUBBUB_TOKEN_START_TAG:
+	case HUBBUB_TOKEN_END_TAG:
+		strs[n_strs++] = &token->data.tag.name;
+		attrs = token->data.tag.attributes;
+		n_attrs = token->data.tag.n_attributes;
+		compact.ns = token->data.tag.ns;
+		compact.atom = token->data.tag.atom;
+		if (token->data.tag.self_closing)
+			compact.flags |= HUBBUB_COMPACT_SELF_CLOSING;
+		break;
+	case HUBBUB_TOKEN_COMMENT:
+		strs[n_strs++] = &token->data.comment;
+		break;
+	case HUBBUB_TOKEN_CHARACTER:
+		strs[n_strs++] = &token->data.character;
+		break;
+	case HUBBUB_TOKEN_EOF:
+		break;
+	}
+
+	/* Find somewhere that all of the strings lie within, if anywhere */
+	data[0] = utf8->data + tokeniser->input->cursor;
+	len[0] = utf8->length - tokeniser->input->cursor;
+	data[1] = tokeniser->buffer->data;
+	len[1] = tokeniser->buffer->length;
+
+	/* A lone string is its own base */
+	if (n_strs == 1 && n_attrs == 0)
+		base = strs[0]->ptr;
+
+	for (j = 0; base == NULL && j < 2; j++) {
+		within = true;
+
+		for (i = 0; within && i < n_strs; i++) {
+			within = hubbub_tokeniser_compact_within(strs[i],
+					data[j], len[j]);
+		}
+		for (i = 0; within && i < n_attrs; i++) {
+			within = hubbub_tokeniser_compact_within(
+					&attrs[i].name, data[j], len[j]) &&
+					hubbub_tokeniser_compact_within(
+					&attrs[i].value, data[j], len[j]);
 		}
+
+		if (within)
+			base = data[j];
 	}
 
-	c = *cptr;
-	tokeniser->context.pending += len;
+	if (n_attrs > tokeniser->compact.alloc_attrs) {
+		cattrs = tokeniser->alloc(tokeniser->compact.attrs,
+				n_attrs * sizeof(hubbub_compact_attribute),
+				tokeniser->alloc_pw);
+		if (cattrs == NULL)
+			return HUBBUB_NOMEM;
 
-	if (c == '>') {
-		tokeniser->state = STATE_DATA;
-		return emit_current_doctype(tokeniser, false);
+		tokeniser->compact.attrs = cattrs;
+		tokeniser->compact.alloc_attrs = n_attrs;
 	}
+	cattrs = tokeniser->compact.attrs;
 
-	return HUBBUB_OK;
-}
+	if (n_strs > 0) {
+		err = hubbub_tokeniser_compact_span(tokeniser, strs[0], base,
+				&compact.data);
+	}
+	if (err == HUBBUB_OK && token->type == HUBBUB_TOKEN_DOCTYPE &&
+			token->data.doctype.public_missing == false) {
+		err = hubbub_tokeniser_compact_span(tokeniser,
+				&token->data.doctype.public_id, base,
+				&compact.public_id);
+	}
+	if (err == HUBBUB_OK && token->type == HUBBUB_TOKEN_DOCTYPE &&
+			token->data.doctype.system_missing == false) {
+		err = hubbub_tokeniser_compact_span(tokeniser,
+				&token->data.doctype.system_id, base,
+				&compact.system_id);
+	}
+	for (i = 0; err == HUBBUB_OK && i < n_attrs; i++) {
+		cattrs[i].ns = attrs[i].ns;
+		cattrs[i].atom = attrs[i].atom;
+		cattrs[i].raw = attrs[i].raw;
+		err = hubbub_tokeniser_compact_span(tokeniser,
+				&attrs[i].name, base, &cattrs[i].name);
+		if (err == HUBBUB_OK)
+			err = hubbub_tokeniser_compact_span(tokeniser,
+					&attrs[i].value, base,
+					&cattrs[i].value);
+	}
 
+	if (err == HUBBUB_OK) {
+		compact.base = (base != NULL) ? base
+				: tokeniser->compact.strings->data;
+		compact.n_attributes = n_attrs;
+		compact.attributes = (n_attrs > 0) ? cattrs : NULL;
+		compact.location = tokeniser->track_position
+				? &token->location : NULL;
 
+		err = tokeniser->compact.handler(&compact,
+				tokeniser->compact.pw);
+	}
 
-#define CDATA		"[CDATA["
-#define CDATA_LEN	(SLEN(CDATA) - 1)
+	if (tokeniser->compact.strings->length > 0) {
+		parserutils_buffer_discard(tokeniser->compact.strings, 0,
+				tokeniser->compact.strings->length);
+	}
 
-hubbub_error hubbub_tokeniser_handle_match_cdata(hubbub_tokeniser *tokeniser)
+	return err;
+}
+
+/**
+ * Emit a token, performing sanity checks if necessary
+ *
+ * \param tokeniser  Tokeniser instance
+ * \param token      Token to emit
+ */
+hubbub_error hubbub_tokeniser_emit_token(hubbub_tokeniser *tokeniser,
+		hubbub_token *token)
 {
-	size_t len;
-	const uint8_t *cptr;
-	parserutils_error error;
-	uint8_t c;
+	hubbub_error err = HUBBUB_OK;
 
-	error = parserutils_inputstream_peek(tokeniser->input,
-			tokeniser->context.pending, &cptr, &len);
+	assert(tokeniser != NULL);
+	assert(token != NULL);
+	assert(tokeniser->insert_buf->length == 0);
 
-	if (error != PARSERUTILS_OK) {
-		if (error == PARSERUTILS_EOF) {
-			tokeniser->context.current_comment.len =
-					tokeniser->context.pending = 0;
-			tokeniser->state = STATE_BOGUS_COMMENT;
-			return HUBBUB_OK;
-		} else {
-			return hubbub_error_from_parserutils_error(error);
+#ifndef NDEBUG
+	/* Sanity checks */
+	switch (token->type) {
+	case HUBBUB_TOKEN_DOCTYPE:
+		assert(memchr(token->data.doctype.name.ptr, 0xff, 
+				token->data.doctype.name.len) == NULL);
+		if (token->data.doctype.public_missing == false)
+			assert(memchr(token->data.doctype.public_id.ptr, 0xff,
+				token->data.doctype.public_id.len) == NULL);
+		if (token->data.doctype.system_missing == false)
+			assert(memchr(token->data.doctype.system_id.ptr, 0xff,
+				token->data.doctype.system_id.len) == NULL);
+		break;
+	case HUBBUB_TOKEN_START_TAG:
+	case HUBBUB_TOKEN_END_TAG:
+	{
+		uint32_t i;
+		assert(memchr(token->data.tag.name.ptr, 0xff, 
+				token->data.tag.name.len) == NULL);
+		for (i = 0; i < token->data.tag.n_attributes; i++) {
+			hubbub_attribute *attr = &token->data.tag.attributes[i];
+
+			assert(memchr(attr->name.ptr, 0xff, attr->name.len) == 
+					NULL);
+			assert(memchr(attr->value.ptr, 0xff, attr->value.len) ==
+					NULL);
 		}
 	}
+		break;
+	case HUBBUB_TOKEN_COMMENT:
+		assert(memchr(token->data.comment.ptr, 0xff, 
+				token->data.comment.len) == NULL);
+		break;
+	case HUBBUB_TOKEN_CHARACTER:
+		assert(memchr(token->data.character.ptr, 0xff,
+				token->data.character.len) == NULL);
+		break;
+	case HUBBUB_TOKEN_EOF:
+		break;
+	}
+#endif
+
+	token->incomplete = tokeniser->context.incomplete;
+	tokeniser->context.incomplete = false;
+
+	if (tokeniser->track_position) {
+		token->location = tokeniser->context.position.mark;
+		token->location.end = tokeniser->context.position.offset +
+				tokeniser->context.pending;
+	}
 
-	c = *cptr;
+	HUBBUB_TRACE3(tokeniser__token, tokeniser, token->type, token);
 
-	assert(tokeniser->context.match_cdata.count <= CDATA_LEN);
+	/* Emit the token, unless nothing more is wanted */
+	if (tokeniser->stopped) {
+		err = HUBBUB_STOPPED;
+	} else if (tokeniser->batch.handler) {
+		err = hubbub_tokeniser_batch_token(tokeniser, token);
 
-	if (CDATA[tokeniser->context.match_cdata.count] != (c & ~0x20)) {
-		tokeniser->context.current_comment.len =
-				tokeniser->context.pending =
-				0;
-		tokeniser->state = STATE_BOGUS_COMMENT;
-		return HUBBUB_OK;
+		if (err == HUBBUB_OK &&
+				tokeniser->batch.count == tokeniser->batch.size)
+			err = hubbub_tokeniser_flush_batch(tokeniser);
+	} else if (tokeniser->compact.handler) {
+		err = hubbub_tokeniser_emit_compact(tokeniser, token);
+	} else if (tokeniser->token_handler) {
+		err = tokeniser->token_handler(token, tokeniser->token_pw);
 	}
 
-	tokeniser->context.pending += len;
+	/* Discard current buffer */
+	if (tokeniser->buffer->length) {
+		parserutils_buffer_discard(tokeniser->buffer, 0,
+				tokeniser->buffer->length);
+	}
 
-	if (tokeniser->context.match_cdata.count == CDATA_LEN) {
-		parserutils_inputstream_advance(tokeniser->input,
-				tokeniser->context.match_cdata.count + len);
+	tokeniser->context.chars.buffered = false;
+	tokeniser->context.chars.copied = 0;
+	tokeniser->context.chars.dashes = 0;
+	tokeniser->context.chars.space = 0;
+
+	HUBBUB_STATS_ADD(tokeniser->stats, tokens[token->type], 1);
+
+	/* Pause once this call's budget is spent. The token is complete, so
+	 * the tokeniser stops at the next change of state */
+	if ((tokeniser->budget.tokens != 0 || tokeniser->budget.bytes != 0) &&
+			token->type != HUBBUB_TOKEN_EOF) {
+		tokeniser->budget.spent_tokens++;
+		tokeniser->budget.spent_bytes += tokeniser->context.pending;
+
+		if ((tokeniser->budget.tokens != 0 &&
+				tokeniser->budget.spent_tokens >=
+						tokeniser->budget.tokens) ||
+				(tokeniser->budget.bytes != 0 &&
+				tokeniser->budget.spent_bytes >=
+						tokeniser->budget.bytes))
+			tokeniser->paused = true;
+	}
+
+	/* Advance the pointer */
+	if (tokeniser->context.pending) {
+		hubbub_tokeniser_advance(tokeniser,
+				tokeniser->context.pending);
 		tokeniser->context.pending = 0;
-		tokeniser->context.match_cdata.end = 0;
-		tokeniser->state = STATE_CDATA_BLOCK;
 	}
 
-	tokeniser->context.match_cdata.count += len;
+	if (tokeniser->track_position)
+		hubbub_tokeniser_mark(tokeniser);
 
-	return HUBBUB_OK;
+	if (tokeniser->insert_buf->length > 0) {
+		hubbub_error error = hubbub_tokeniser_insert(tokeniser);
+		if (err == HUBBUB_OK)
+			err = error;
+		parserutils_buffer_discard(tokeniser->insert_buf, 0,
+				tokeniser->insert_buf->length);
+	}
+
+	/* Ensure callback can pause or stop the tokeniser */
+	if (err == HUBBUB_PAUSED) {
+		tokeniser->paused = true;
+	} else if (err == HUBBUB_STOPPED) {
+		tokeniser->stopped = true;
+	}
+
+	return err;
 }
 
-#undef CDATA
-#undef CDATA_LEN
 
+/**
+ * Speculative tokenisation
+ *
+ * Large borrowed input may be tokenised on several threads at once. The
+ * input is split into chunks, each beginning with a '<' at the start of
+ * a line, which is most likely to be a tag outside of any raw text. The
+ * first chunk is tokenised as usual, while the chunks after it are each
+ * tokenised on a thread of their own, from the data state, by a tokeniser
+ * which records the tokens it finds. It keeps track of the content model
+ * as the treebuilder would, by looking at the start tags it finds.
+ *
+ * Once the tokeniser has reached the start of a chunk, the tokens recorded
+ * for it are correct if the tokeniser is in the data state, in PCDATA,
+ * with nothing pending but characters. In that case, the characters are
+ * emitted, and the recorded tokens with them, in order, moving over the
+ * input as each would have been found. Should the treebuilder choose a
+ * different content model, or insert data, the rest of the recorded
+ * tokens are thrown away. Whatever is left of each chunk, including the
+ * whole of one whose tokens cannot be used, is then tokenised as usual.
+ *
+ * The treebuilder thus sees exactly the tokens it would otherwise have
+ * seen. As this relies on it setting the content model as each token is
+ * passed on, batched delivery is not speculated on, nor is a token limit,
+ * as token data may be split at any point.
+ */
 
-hubbub_error hubbub_tokeniser_handle_cdata_block(hubbub_tokeniser *tokeniser)
+/** Number of bytes of input in each chunk tokenised speculatively */
+#define SPECULATE_CHUNK (128 * 1024)
+
+/** Number of tokens by which a chunk's record grows */
+#define SPECULATE_RECORD_CHUNK 256
+
+/** A token found by speculative tokenisation */
+typedef struct hubbub_tokeniser_record {
+	hubbub_token token;		/**< The token */
+	size_t start;			/**< Offset of start of token */
+	size_t end;			/**< Offset of end of token */
+	hubbub_content_model model;	/**< Content model after token */
+} hubbub_tokeniser_record;
+
+/** A chunk of input, tokenised speculatively */
+typedef struct hubbub_tokeniser_chunk {
+	hubbub_tokeniser *tok;		/**< Tokeniser for chunk */
+	hubbub_thread thread;		/**< Thread tokenising chunk */
+	bool active;			/**< Whether the chunk is in use */
+	size_t start;			/**< Offset of chunk in input */
+	size_t end;			/**< Offset of end of chunk */
+	hubbub_arena *arena;		/**< Token data not in the input */
+	hubbub_tokeniser_record *records;	/**< Tokens found */
+	size_t n_records;		/**< Number of tokens found */
+	size_t alloc_records;		/**< Number of records allocated */
+	hubbub_error error;		/**< Result of tokenising chunk */
+} hubbub_tokeniser_chunk;
+
+/**
+ * Determine whether tokens may be recorded on other threads, to be replayed
+ *
+ * \param tokeniser  Tokeniser instance
+ * \return true if the input is yet to be tokenised, and may be tokenised
+ *         on other threads
+ */
+static bool hubbub_tokeniser_can_record(hubbub_tokeniser *tokeniser)
 {
-	size_t len;
-	const uint8_t *cptr;
-	parserutils_error error;
+	return tokeniser->speculating == false &&
+			tokeniser->borrowing &&
+			tokeniser->borrowed.passing == false &&
+			tokeniser->borrowed.in_side == false &&
+			tokeniser->input->cursor == 0 &&
+			tokeniser->token_limit == (size_t) -1 &&
+			tokeniser->budget.tokens == 0 &&
+			tokeniser->budget.bytes == 0 &&
+			tokeniser->batch.handler == NULL;
+}
+
+/**
+ * Determine whether to tokenise the input on several threads
+ *
+ * \param tokeniser  Tokeniser instance
+ * \return true if the input is to be tokenised speculatively
+ */
+bool hubbub_tokeniser_can_speculate(hubbub_tokeniser *tokeniser)
+{
+	return tokeniser->threads > 1 &&
+			hubbub_tokeniser_can_record(tokeniser) &&
+			tokeniser->borrowed.len >= 2 * SPECULATE_CHUNK;
+}
+
+/**
+ * Find where the next chunk of input begins
+ *
+ * \param data  The input
+ * \param len   Length, in bytes, of data
+ * \param from  Offset at which to start looking
+ * \return Offset of start of chunk, or len if there is none
+ *
+ * A chunk begins with the first tag (or markup declaration) at the start
+ * of a line, after any indentation.
+ */
+static size_t hubbub_tokeniser_find_chunk(const uint8_t *data, size_t len,
+		size_t from)
+{
+	const uint8_t *nl;
+	size_t i;
 	uint8_t c;
 
-	error = parserutils_inputstream_peek(tokeniser->input,
-			tokeniser->context.pending, &cptr, &len);
+	while (from < len) {
+		nl = memchr(data + from, '\n', len - from);
+		if (nl == NULL)
+			break;
 
-	if (error != PARSERUTILS_OK) {
-		if (error == PARSERUTILS_EOF) {
-			tokeniser->state = STATE_DATA;
-			return emit_current_chars(tokeniser);
-		} else {
-			return hubbub_error_from_parserutils_error(error);
-		}
+		for (i = nl - data + 1; i < len &&
+				(data[i] == ' ' || data[i] == '\t'); i++)
+			;
+		from = i;
+
+		if (i + 1 >= len || data[i] != '<')
+			continue;
+
+		c = data[i + 1] | 0x20;
+		if ((c >= 'a' && c <= 'z') || data[i + 1] == '!' ||
+				data[i + 1] == '/')
+			return i;
+	}
+
+	return len;
+}
+
+/**
+ * Limit the data a borrowing tokeniser may read
+ *
+ * \param tokeniser  Tokeniser instance
+ * \param len        Length, in bytes, of the data which may be read
+ * \param eof        Whether this is the end of the input
+ */
+static void hubbub_tokeniser_bound(hubbub_tokeniser *tokeniser, size_t len,
+		bool eof)
+{
+	tokeniser->borrowed.len = len;
+	if (tokeniser->borrowed.in_side == false) {
+		tokeniser->borrowed.view.length = len;
+		tokeniser->borrowed.view.allocated = len;
 	}
+	tokeniser->borrowed.stream.had_eof = eof;
+}
+
+/**
+ * Keep a string of a recorded token, if it is not in the input
+ *
+ * \param chunk  Chunk being tokenised
+ * \param str    String to keep, updated to point at the copy
+ * \return HUBBUB_OK on success, HUBBUB_NOMEM on memory exhaustion
+ */
+static hubbub_error hubbub_tokeniser_keep_string(
+		hubbub_tokeniser_chunk *chunk, hubbub_string *str)
+{
+	const uint8_t *data = chunk->tok->borrowed.data;
+	uint8_t *copy;
 
-	c = *cptr;
+	if (str->len == 0 || (str->ptr >= data &&
+			str->ptr + str->len <= data + chunk->tok->borrowed.len))
+		return HUBBUB_OK;
 
-	if (c == ']' && (tokeniser->context.match_cdata.end == 0 ||
-			tokeniser->context.match_cdata.end == 1)) {
-		tokeniser->context.pending += len;
-		tokeniser->context.match_cdata.end += len;
-	} else if (c == '>' && tokeniser->context.match_cdata.end == 2) {
-		/* Remove the previous two "]]" */
-		tokeniser->context.pending -= 2;
+	copy = hubbub_arena_alloc(NULL, str->len, chunk->arena);
+	if (copy == NULL)
+		return HUBBUB_NOMEM;
 
-		/* Emit any pending characters */
-		emit_current_chars(tokeniser);
+	memcpy(copy, str->ptr, str->len);
+	str->ptr = copy;
 
-		/* Now move past the "]]>" bit */
-		parserutils_inputstream_advance(tokeniser->input, SLEN("]]>"));
+	return HUBBUB_OK;
+}
 
-		tokeniser->state = STATE_DATA;
-	} else if (c == '\0') {
-		if (tokeniser->context.pending > 0) {
-			/* Emit any pending characters */
-			emit_current_chars(tokeniser);
-		}
+/**
+ * Record a token found by speculative tokenisation
+ *
+ * \param token  The token
+ * \param pw     Chunk being tokenised
+ * \return HUBBUB_OK on success, HUBBUB_NOMEM on memory exhaustion
+ */
+static hubbub_error hubbub_tokeniser_record_token(const hubbub_token *token,
+		void *pw)
+{
+	hubbub_tokeniser_chunk *chunk = pw;
+	hubbub_tokeniser *tok = chunk->tok;
+	hubbub_tokeniser_record *record;
+	hubbub_error err = HUBBUB_OK;
+	hubbub_attribute *attrs;
+	uint32_t i;
 
-		/* Perform NUL-byte replacement */
-		emit_character_token(tokeniser, &u_fffd_str);
+	if (chunk->n_records == chunk->alloc_records) {
+		size_t n = chunk->alloc_records + SPECULATE_RECORD_CHUNK;
 
-		parserutils_inputstream_advance(tokeniser->input, len);
-		tokeniser->context.match_cdata.end = 0;
-	} else if (c == '\r') {
-		error = parserutils_inputstream_peek(
-				tokeniser->input,
-				tokeniser->context.pending + len,
-				&cptr,
-				&len);
+		record = tok->alloc(chunk->records,
+				n * sizeof(hubbub_tokeniser_record),
+				tok->alloc_pw);
+		if (record == NULL)
+			return HUBBUB_NOMEM;
 
-		if (error != PARSERUTILS_OK && error != PARSERUTILS_EOF) {
-			return hubbub_error_from_parserutils_error(error);
-		}
+		chunk->records = record;
+		chunk->alloc_records = n;
+	}
 
-		if (tokeniser->context.pending > 0) {
-			/* Emit any pending characters */
-			emit_current_chars(tokeniser);
-		}
+	record = &chunk->records[chunk->n_records];
+	record->token = *token;
+	record->start = token->location.start;
+	record->end = token->location.end;
+
+	switch (token->type) {
+	case HUBBUB_TOKEN_DOCTYPE:
+		err = hubbub_tokeniser_keep_string(chunk,
+				&record->token.data.doctype.name);
+		if (err == HUBBUB_OK &&
+				token->data.doctype.public_missing == false)
+			err = hubbub_tokeniser_keep_string(chunk,
+					&record->token.data.doctype.public_id);
+		if (err == HUBBUB_OK &&
+				token->data.doctype.system_missing == false)
+			err = hubbub_tokeniser_keep_string(chunk,
+					&record->token.data.doctype.system_id);
+		break;
+	case HUBBUB_TOKEN_START_TAG:
+	case HUBBUB_TOKEN_END_TAG:
+		err = hubbub_tokeniser_keep_string(chunk,
+				&record->token.data.tag.name);
+		if (err != HUBBUB_OK || token->data.tag.n_attributes == 0)
+			break;
 
-		if (error == PARSERUTILS_EOF || *cptr != '\n') {
-			/* Emit newline */
-			emit_character_token(tokeniser, &lf_str);
+		attrs = hubbub_arena_alloc(NULL, token->data.tag.n_attributes *
+				sizeof(hubbub_attribute), chunk->arena);
+		if (attrs == NULL)
+			return HUBBUB_NOMEM;
+
+		memcpy(attrs, token->data.tag.attributes,
+				token->data.tag.n_attributes *
+				sizeof(hubbub_attribute));
+		record->token.data.tag.attributes = attrs;
+
+		for (i = 0; err == HUBBUB_OK &&
+				i < token->data.tag.n_attributes; i++) {
+			err = hubbub_tokeniser_keep_string(chunk,
+					&attrs[i].name);
+			if (err == HUBBUB_OK)
+				err = hubbub_tokeniser_keep_string(chunk,
+						&attrs[i].value);
 		}
+		break;
+	case HUBBUB_TOKEN_COMMENT:
+		err = hubbub_tokeniser_keep_string(chunk,
+				&record->token.data.comment);
+		break;
+	case HUBBUB_TOKEN_CHARACTER:
+		err = hubbub_tokeniser_keep_string(chunk,
+				&record->token.data.character);
+		break;
+	case HUBBUB_TOKEN_EOF:
+		break;
+	}
 
-		/* Advance over \r */
-		parserutils_inputstream_advance(tokeniser->input, 1);
-		tokeniser->context.match_cdata.end = 0;
-	} else {
-		tokeniser->context.pending += len;
-		tokeniser->context.match_cdata.end = 0;
+	if (err != HUBBUB_OK)
+		return err;
+
+	/* Switch content model as the treebuilder would */
+	if (token->type == HUBBUB_TOKEN_START_TAG) {
+		switch (token->data.tag.atom) {
+		case HUBBUB_ATOM_TITLE:
+		case HUBBUB_ATOM_TEXTAREA:
+			tok->content_model = HUBBUB_CONTENT_MODEL_RCDATA;
+			break;
+		case HUBBUB_ATOM_STYLE:
+		case HUBBUB_ATOM_SCRIPT:
+		case HUBBUB_ATOM_XMP:
+		case HUBBUB_ATOM_IFRAME:
+		case HUBBUB_ATOM_NOEMBED:
+		case HUBBUB_ATOM_NOFRAMES:
+			tok->content_model = HUBBUB_CONTENT_MODEL_CDATA;
+			break;
+		case HUBBUB_ATOM_PLAINTEXT:
+			tok->content_model = HUBBUB_CONTENT_MODEL_PLAINTEXT;
+			break;
+		default:
+			break;
+		}
 	}
 
+	record->model = token->type == HUBBUB_TOKEN_END_TAG ?
+			HUBBUB_CONTENT_MODEL_PCDATA : tok->content_model;
+
+	chunk->n_records++;
+
 	return HUBBUB_OK;
 }
 
-
-hubbub_error hubbub_tokeniser_consume_character_reference(
-		hubbub_tokeniser *tokeniser, size_t pos)
+/**
+ * Tokenise a chunk of input speculatively
+ *
+ * \param arg  The chunk
+ */
+static void hubbub_tokeniser_tokenise_chunk(void *arg)
 {
-	uint32_t allowed_char = tokeniser->context.allowed_char;
+	hubbub_tokeniser_chunk *chunk = arg;
 
-	size_t len;
-	const uint8_t *cptr;
-	parserutils_error error;
-	uint8_t c;
-	size_t off;
+	chunk->error = hubbub_tokeniser_tokenise(chunk->tok);
+}
 
-	error = parserutils_inputstream_peek(tokeniser->input, pos, 
-			&cptr, &len);
+/**
+ * Start tokenising a chunk of input speculatively
+ *
+ * \param tokeniser  Tokeniser instance
+ * \param chunk      Chunk to tokenise
+ * \param start      Offset of start of chunk in input
+ * \param end        Offset of end of chunk in input
+ */
+static void hubbub_tokeniser_start_chunk(hubbub_tokeniser *tokeniser,
+		hubbub_tokeniser_chunk *chunk, size_t start, size_t end)
+{
+	hubbub_tokeniser_optparams params;
+	hubbub_error err;
 
-	/* We should always start on an ampersand */
-	assert(error == PARSERUTILS_OK);
-	assert(len == 1 && *cptr == '&');
+	chunk->active = true;
+	chunk->start = start;
+	chunk->end = end;
+	chunk->n_records = 0;
+	chunk->error = HUBBUB_OK;
+
+	if (chunk->tok == NULL) {
+		err = hubbub_tokeniser_create(tokeniser->input,
+				tokeniser->alloc, tokeniser->alloc_pw,
+				&chunk->tok);
+		if (err != HUBBUB_OK) {
+			chunk->error = err;
+			return;
+		}
 
-	off = pos + len;
+		params.token_handler.handler = hubbub_tokeniser_record_token;
+		params.token_handler.pw = chunk;
+		hubbub_tokeniser_setopt(chunk->tok,
+				HUBBUB_TOKENISER_TOKEN_HANDLER, &params);
 
-	/* Look at the character after the ampersand */
-	error = parserutils_inputstream_peek(tokeniser->input, off, 
-			&cptr, &len);
+		/* Token locations give the extent of each token */
+		chunk->tok->track_position = true;
+		chunk->tok->drop_comments = tokeniser->drop_comments;
+		chunk->tok->raw_values = tokeniser->raw_values;
+	} else {
+		hubbub_tokeniser_reset(chunk->tok, tokeniser->input);
+	}
 
-	if (error != PARSERUTILS_OK) {
-		if (error == PARSERUTILS_EOF) {
-			tokeniser->context.match_entity.complete = true;
-			tokeniser->context.match_entity.codepoint = 0;
-			return HUBBUB_OK;
-		} else {
-			return hubbub_error_from_parserutils_error(error);
-		}
+	chunk->tok->process_cdata_section = tokeniser->process_cdata_section;
+
+	err = hubbub_arena_create(tokeniser->alloc, tokeniser->alloc_pw,
+			&chunk->arena);
+	if (err != HUBBUB_OK) {
+		chunk->error = err;
+		return;
 	}
 
-	c = *cptr;
+	hubbub_tokeniser_borrow(chunk->tok, tokeniser->borrowed.data + start,
+			end - start);
+	/* Tokens cut short by the end of the chunk are left to us */
+	hubbub_tokeniser_bound(chunk->tok, end - start, false);
 
-	/* Set things up */
-	tokeniser->context.match_entity.offset = off;
-	tokeniser->context.match_entity.poss_length = 0;
-	tokeniser->context.match_entity.length = 0;
-	tokeniser->context.match_entity.base = 0;
-	tokeniser->context.match_entity.codepoint = 0;
-	tokeniser->context.match_entity.had_data = false;
-	tokeniser->context.match_entity.return_state = tokeniser->state;
-	tokeniser->context.match_entity.complete = false;
-	tokeniser->context.match_entity.overflow = false;
-	tokeniser->context.match_entity.context = -1;
-	tokeniser->context.match_entity.prev_len = len;
+	hubbub_thread_start(&chunk->thread, hubbub_tokeniser_tokenise_chunk,
+			chunk);
+}
 
-	/* Reset allowed character for future calls */
-	tokeniser->context.allowed_char = '\0';
+/**
+ * Wait for a chunk to be tokenised, and release what it recorded
+ *
+ * \param chunk  Chunk to finish with
+ */
+static void hubbub_tokeniser_end_chunk(hubbub_tokeniser_chunk *chunk)
+{
+	hubbub_thread_join(&chunk->thread);
 
-	if (c == '\t' || c == '\n' || c == '\f' || c == ' ' ||
-			c == '<' || c == '&' ||
-			(allowed_char && c == allowed_char)) {
-		tokeniser->context.match_entity.complete = true;
-		tokeniser->context.match_entity.codepoint = 0;
-	} else if (c == '#') {
-		tokeniser->context.match_entity.length += len;
-		tokeniser->state = STATE_NUMBERED_ENTITY;
-	} else {
-		tokeniser->state = STATE_NAMED_ENTITY;
+	if (chunk->arena != NULL) {
+		hubbub_arena_destroy(chunk->arena);
+		chunk->arena = NULL;
 	}
 
-	return HUBBUB_OK;
+	chunk->active = false;
 }
 
-
-hubbub_error hubbub_tokeniser_handle_numbered_entity(
-		hubbub_tokeniser *tokeniser)
+/**
+ * Determine whether the tokeniser is in the state recorded tokens were
+ * found from, at the offset they start at
+ *
+ * \param tokeniser  Tokeniser instance
+ * \param start      Offset in the input at which recording started
+ * \return true if so, once any pending characters have been emitted
+ */
+static bool hubbub_tokeniser_at_chunk(hubbub_tokeniser *tokeniser,
+		size_t start)
 {
-	hubbub_tokeniser_context *ctx = &tokeniser->context;
+	return tokeniser->state == STATE_DATA &&
+			tokeniser->content_model ==
+					HUBBUB_CONTENT_MODEL_PCDATA &&
+			tokeniser->escape_flag == false &&
+			tokeniser->borrowed.in_side == false &&
+			tokeniser->insert_buf->length == 0 &&
+			tokeniser->input->cursor + tokeniser->context.pending ==
+					start;
+}
 
-	size_t len;
-	const uint8_t *cptr;
-	parserutils_error error;
+/**
+ * Ready the tokeniser to replay tokens recorded from an offset
+ *
+ * \param tokeniser  Tokeniser instance
+ * \param start      Offset in the input at which recording started
+ * \param synced     Pointer to location to receive whether the recorded
+ *                   tokens may be replayed
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ */
+static hubbub_error hubbub_tokeniser_catch_up(hubbub_tokeniser *tokeniser,
+		size_t start, bool *synced)
+{
+	hubbub_error err;
 
-	error = parserutils_inputstream_peek(tokeniser->input,
-			ctx->match_entity.offset + ctx->match_entity.length,
-			&cptr, &len);
+	*synced = hubbub_tokeniser_at_chunk(tokeniser, start);
 
-	if (error != PARSERUTILS_OK && error != PARSERUTILS_EOF) {
-		return hubbub_error_from_parserutils_error(error);
-	}
+	if (*synced && tokeniser->context.pending > 0) {
+		err = emit_current_chars(tokeniser);
+		if (err != HUBBUB_OK)
+			return err;
 
-	if (error != PARSERUTILS_EOF && ctx->match_entity.base == 0) {
-		uint8_t c = *cptr;
-		if ((c & ~0x20) == 'X') {
-			ctx->match_entity.base = 16;
-			ctx->match_entity.length += len;
-		} else {
-			ctx->match_entity.base = 10;
-		}
+		*synced = hubbub_tokeniser_at_chunk(tokeniser, start);
 	}
 
-	while ((error = parserutils_inputstream_peek(tokeniser->input,
-			ctx->match_entity.offset + ctx->match_entity.length,
-			&cptr, &len)) == PARSERUTILS_OK) {
-		uint8_t c = *cptr;
+	return HUBBUB_OK;
+}
 
-		if (ctx->match_entity.base == 10 &&
-				('0' <= c && c <= '9')) {
-			ctx->match_entity.had_data = true;
-			ctx->match_entity.codepoint =
-				ctx->match_entity.codepoint * 10 + (c - '0');
+/**
+ * Emit tokens recorded for a chunk, while they are correct
+ *
+ * \param tokeniser  Tokeniser instance, where the tokens start
+ * \param chunk      The chunk, whose recorded tokens are complete
+ * \param matched    Pointer to location to receive whether every token
+ *                   was correct, so was emitted
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ */
+static hubbub_error hubbub_tokeniser_replay_records(
+		hubbub_tokeniser *tokeniser,
+		const hubbub_tokeniser_chunk *chunk, bool *matched)
+{
+	hubbub_tokeniser_record *record;
+	hubbub_token token;
+	hubbub_error err;
+	size_t i, start;
 
-			ctx->match_entity.length += len;
-		} else if (ctx->match_entity.base == 16 &&
-				(('0' <= c && c <= '9') ||
-				('A' <= (c & ~0x20) &&
-						(c & ~0x20) <= 'F'))) {
-			ctx->match_entity.had_data = true;
-			ctx->match_entity.codepoint *= 16;
+	*matched = false;
 
-			if ('0' <= c && c <= '9') {
-				ctx->match_entity.codepoint += (c - '0');
-			} else {
-				ctx->match_entity.codepoint +=
-						((c & ~0x20) - 'A' + 10);
-			}
+	for (i = 0; i < chunk->n_records; i++) {
+		record = &chunk->records[i];
+		start = chunk->start + record->start;
 
-			ctx->match_entity.length += len;
-		} else {
-			break;
+		/* Move over anything skipped, such as dropped comments */
+		if (start > tokeniser->input->cursor) {
+			hubbub_tokeniser_advance(tokeniser,
+					start - tokeniser->input->cursor);
+			if (tokeniser->track_position)
+				hubbub_tokeniser_mark(tokeniser);
 		}
 
-		if (ctx->match_entity.codepoint >= 0x10FFFF) {
-			ctx->match_entity.overflow = true;
-		}
-	}
+		token = record->token;
+		if (token.type == HUBBUB_TOKEN_START_TAG)
+			hubbub_tokeniser_save_start_tag_name(tokeniser,
+					&token.data.tag.name);
 
-	if (error != PARSERUTILS_OK && error != PARSERUTILS_EOF) {
-		return hubbub_error_from_parserutils_error(error);
-	}
+		tokeniser->context.pending = record->end - record->start;
 
-	/* Eat trailing semicolon, if any */
-	if (error != PARSERUTILS_EOF && *cptr == ';') {
-		ctx->match_entity.length += len;
-	}
+		err = hubbub_tokeniser_emit_token(tokeniser, &token);
 
-	/* Had data, so calculate final codepoint */
-	if (ctx->match_entity.had_data) {
-		uint32_t cp = ctx->match_entity.codepoint;
+		if (token.type == HUBBUB_TOKEN_END_TAG)
+			tokeniser->content_model = HUBBUB_CONTENT_MODEL_PCDATA;
 
-		if (0x80 <= cp && cp <= 0x9F) {
-			cp = cp1252Table[cp - 0x80];
-		} else if (cp == 0x0D) {
-			cp = 0x000A;
-		} else if (ctx->match_entity.overflow || 
-				cp <= 0x0008 || cp == 0x000B ||
-				(0x000E <= cp && cp <= 0x001F) ||
-				(0x007F <= cp && cp <= 0x009F) ||
-				(0xD800 <= cp && cp <= 0xDFFF) ||
-				(0xFDD0 <= cp && cp <= 0xFDEF) ||
-				(cp & 0xFFFE) == 0xFFFE) {
-			/* the check for cp > 0x10FFFF per spec is performed
-			 * in the loop above to avoid overflow */
-			cp = 0xFFFD;
-		}
+		if (err != HUBBUB_OK)
+			return err;
 
-		ctx->match_entity.codepoint = cp;
+		/* The rest is wrong if the treebuilder did other than
+		 * expected */
+		if (tokeniser->content_model != record->model ||
+				tokeniser->borrowed.in_side)
+			return HUBBUB_OK;
 	}
 
-	/* Flag completion */
-	ctx->match_entity.complete = true;
-
-	/* And back to the state we were entered in */
-	tokeniser->state = ctx->match_entity.return_state;
+	*matched = true;
 
 	return HUBBUB_OK;
 }
 
-hubbub_error hubbub_tokeniser_handle_named_entity(hubbub_tokeniser *tokeniser)
+/**
+ * Emit the tokens recorded for a chunk, where they are correct
+ *
+ * \param tokeniser  Tokeniser instance, at the start of the chunk
+ * \param chunk      The chunk, whose tokenisation is complete
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ */
+static hubbub_error hubbub_tokeniser_replay_chunk(hubbub_tokeniser *tokeniser,
+		hubbub_tokeniser_chunk *chunk)
 {
-	hubbub_tokeniser_context *ctx = &tokeniser->context;
+	hubbub_error err;
+	bool synced;
 
-	size_t len;
-	const uint8_t *cptr;
-	parserutils_error error;
+	if (chunk->error != HUBBUB_OK)
+		return HUBBUB_OK;
 
-	while ((error = parserutils_inputstream_peek(tokeniser->input,
-			ctx->match_entity.offset +
-					ctx->match_entity.poss_length,
-			&cptr, &len)) == PARSERUTILS_OK) {
-		uint32_t cp;
+	err = hubbub_tokeniser_catch_up(tokeniser, chunk->start, &synced);
+	if (err != HUBBUB_OK || synced == false)
+		return err;
 
-		uint8_t c = *cptr;
-		hubbub_error error;
+	return hubbub_tokeniser_replay_records(tokeniser, chunk, &synced);
+}
 
-		if (c > 0x7F) {
-			/* Entity names are ASCII only */
-			break;
-		}
+/**
+ * Tokenise borrowed input on several threads
+ *
+ * \param tokeniser  Tokeniser instance
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ */
+hubbub_error hubbub_tokeniser_speculate(hubbub_tokeniser *tokeniser)
+{
+	const uint8_t *data = tokeniser->borrowed.data;
+	size_t len = tokeniser->borrowed.len;
+	size_t n_chunks = tokeniser->threads - 1;
+	hubbub_tokeniser_chunk *chunks, *chunk;
+	size_t end, next, i;
+	hubbub_error err;
 
-		error = hubbub_entities_search_step(c, &cp,
-				&ctx->match_entity.context);
-		if (error == HUBBUB_OK) {
-			/* Had a match - store it for later */
-			ctx->match_entity.codepoint = cp;
+	chunks = tokeniser->alloc(NULL, n_chunks *
+			sizeof(hubbub_tokeniser_chunk), tokeniser->alloc_pw);
+	if (chunks == NULL)
+		return hubbub_tokeniser_tokenise(tokeniser);
+
+	memset(chunks, 0, n_chunks * sizeof(hubbub_tokeniser_chunk));
+
+	tokeniser->speculating = true;
+
+	/* The first chunk is ours; start on those after it */
+	end = hubbub_tokeniser_find_chunk(data, len, SPECULATE_CHUNK);
+	for (i = 0, next = end; i < n_chunks && next < len; i++) {
+		size_t start = next;
 
-			ctx->match_entity.length =
-					ctx->match_entity.poss_length + len;
-			ctx->match_entity.poss_length =
-					ctx->match_entity.length;
-		} else if (error == HUBBUB_INVALID) {
-			/* No further matches - use last found */
-			break;
-		} else {
-			/* Need more data */
-			ctx->match_entity.poss_length += len;
-		}
+		next = hubbub_tokeniser_find_chunk(data, len,
+				start + SPECULATE_CHUNK);
+		hubbub_tokeniser_start_chunk(tokeniser, &chunks[i], start,
+				next);
 	}
 
-	if (error != PARSERUTILS_OK && error != PARSERUTILS_EOF) {
-		return hubbub_error_from_parserutils_error(error);
-	}
+	hubbub_tokeniser_bound(tokeniser, end, end == len);
+	err = hubbub_tokeniser_tokenise(tokeniser);
 
-	if (ctx->match_entity.length > 0) {
-		uint8_t c;
-		error = parserutils_inputstream_peek(tokeniser->input,
-				ctx->match_entity.offset + 
-					ctx->match_entity.length - 1,
-				&cptr, &len);
-		/* We're re-reading a character we've already read after. 
-		 * Therefore, there's no way that an error may occur as 
-		 * a result. */
-		assert(error == PARSERUTILS_OK);
+	for (i = 0; err == HUBBUB_OK && end < len; i = (i + 1) % n_chunks) {
+		chunk = &chunks[i];
+		assert(chunk->active && chunk->start == end);
 
-		c = *cptr;
+		end = chunk->end;
+		hubbub_tokeniser_bound(tokeniser, end, end == len);
 
-		if ((tokeniser->context.match_entity.return_state ==
-				STATE_CHARACTER_REFERENCE_IN_ATTRIBUTE_VALUE) &&
-				c != ';') {
-			error = parserutils_inputstream_peek(tokeniser->input,
-					ctx->match_entity.offset +
-						ctx->match_entity.length,
-					&cptr, &len);
-			/* We must have attempted to read one more character 
-			 * than was present in the entity name, as that is the 
-			 * only way to break out of the loop above. If that 
-			 * failed, then any non-EOF case will have been handled
-			 * by the if statement after the loop thus it cannot 
-			 * occur here. */
-			assert(error == PARSERUTILS_OK || 
-					error == PARSERUTILS_EOF);
+		hubbub_thread_join(&chunk->thread);
+		err = hubbub_tokeniser_replay_chunk(tokeniser, chunk);
+		hubbub_tokeniser_end_chunk(chunk);
 
-			if (error == PARSERUTILS_EOF) {
-				ctx->match_entity.codepoint = 0;
-			}
+		if (next < len) {
+			size_t start = next;
 
-			c = *cptr;
-			if ((0x0030 <= c && c <= 0x0039) ||
-					(0x0041 <= c && c <= 0x005A) ||
-					(0x0061 <= c && c <= 0x007A)) {
-				ctx->match_entity.codepoint = 0;
-			}
+			next = hubbub_tokeniser_find_chunk(data, len,
+					start + SPECULATE_CHUNK);
+			hubbub_tokeniser_start_chunk(tokeniser, chunk, start,
+					next);
 		}
+
+		if (err == HUBBUB_OK)
+			err = hubbub_tokeniser_tokenise(tokeniser);
 	}
 
-	/* Flag completion */
-	ctx->match_entity.complete = true;
+	/* Whatever remains, after a pause, is tokenised as usual */
+	hubbub_tokeniser_bound(tokeniser, len, true);
+
+	for (i = 0; i < n_chunks; i++) {
+		if (chunks[i].active)
+			hubbub_tokeniser_end_chunk(&chunks[i]);
+		if (chunks[i].records != NULL)
+			tokeniser->alloc(chunks[i].records, 0,
+					tokeniser->alloc_pw);
+		if (chunks[i].tok != NULL)
+			hubbub_tokeniser_destroy(chunks[i].tok);
+	}
 
-	/* And back to the state from whence we came */
-	tokeniser->state = ctx->match_entity.return_state;
+	tokeniser->alloc(chunks, 0, tokeniser->alloc_pw);
 
-	return HUBBUB_OK;
+	tokeniser->speculating = false;
+
+	return err;
 }
 
 
+/**
+ * Pipelined tokenisation
+ *
+ * Borrowed input may instead be tokenised on a thread of its own, running
+ * ahead of the token handler, which is left the caller's thread. Tokens
+ * are recorded just as for a chunk, from the start of the input, in blocks
+ * which are passed to the caller through a ring of a few blocks. Each is
+ * replayed once full, just as a chunk is, and the block is then free to
+ * record more tokens into.
+ *
+ * Should the treebuilder choose a different content model, or insert
+ * data, the rest of the recorded tokens are thrown away, and the pipeline
+ * is started again at the next chunk boundary a little way on, which the
+ * caller tokenises up to as usual in the meantime.
+ *
+ * The ring is guarded by a lock, which is taken once per block, rather
+ * than once per token.
+ */
 
-/*** Token emitting bits ***/
+/** Number of tokens in each block passed through the pipeline */
+#define PIPELINE_BLOCK SPECULATE_RECORD_CHUNK
+
+/** Number of blocks by which the pipeline may run ahead */
+#define PIPELINE_BLOCKS 8
+
+/** Least input, in bytes, worth tokenising in a pipeline */
+#define PIPELINE_MIN_INPUT (32 * 1024)
+
+/** Distance, in bytes, after which the pipeline starts again on mismatch */
+#define PIPELINE_RESYNC (16 * 1024)
+
+/** Input tokenised ahead of the token handler */
+typedef struct hubbub_tokeniser_pipe {
+	hubbub_tokeniser *tok;		/**< Tokeniser running ahead */
+	hubbub_thread thread;		/**< Thread it runs on */
+	size_t start;			/**< Offset in input it started at */
+
+	hubbub_tokeniser_chunk blocks[PIPELINE_BLOCKS];	/**< Ring of blocks */
+	size_t head;			/**< Count of blocks replayed */
+	size_t tail;			/**< Count of blocks recorded */
+
+	hubbub_mutex lock;		/**< Lock on the members below */
+	hubbub_cond cond;		/**< Signalled when they change */
+	size_t filled;			/**< Number of blocks to replay */
+	bool done;			/**< Whether tokenising has stopped */
+	bool cancelled;			/**< Whether tokenising is to stop */
+	hubbub_error error;		/**< Result of tokenising */
+} hubbub_tokeniser_pipe;
 
 /**
- * Emit a character token.
+ * Determine whether to tokenise the input on a thread of its own
  *
- * \param tokeniser	Tokeniser instance
- * \param chars		Pointer to hubbub_string to emit
- * \return	true
+ * \param tokeniser  Tokeniser instance
+ * \return true if the input is to be tokenised in a pipeline
  */
-hubbub_error emit_character_token(hubbub_tokeniser *tokeniser,
-		const hubbub_string *chars)
+bool hubbub_tokeniser_can_pipeline(hubbub_tokeniser *tokeniser)
 {
-	hubbub_token token;
-
-	token.type = HUBBUB_TOKEN_CHARACTER;
-	token.data.character = *chars;
-
-	return hubbub_tokeniser_emit_token(tokeniser, &token);
+	return tokeniser->pipeline &&
+			hubbub_tokeniser_can_record(tokeniser) &&
+			tokeniser->borrowed.len >= PIPELINE_MIN_INPUT;
 }
 
 /**
- * Emit the current pending characters being stored in the tokeniser context.
+ * Ready a block of the pipeline to record tokens into
  *
- * \param tokeniser	Tokeniser instance
- * \return	true
+ * \param pipe   The pipeline
+ * \param block  Block to ready, which has been replayed, if ever filled
+ * \return HUBBUB_OK on success, HUBBUB_NOMEM on memory exhaustion
  */
-hubbub_error emit_current_chars(hubbub_tokeniser *tokeniser)
+static hubbub_error hubbub_tokeniser_ready_block(hubbub_tokeniser_pipe *pipe,
+		hubbub_tokeniser_chunk *block)
 {
-	hubbub_token token;
-	size_t len;
-	const uint8_t *cptr = NULL;
-	parserutils_error error;
-
-	/* Calling this with nothing to output is a probable bug */
-	assert(tokeniser->context.pending > 0);
+	block->tok = pipe->tok;
+	block->start = pipe->start;
+	block->n_records = 0;
 
-	error = parserutils_inputstream_peek(tokeniser->input, 0, &cptr, &len);
-	if (error != PARSERUTILS_OK)
-		return hubbub_error_from_parserutils_error(error);
-
-	token.type = HUBBUB_TOKEN_CHARACTER;
-	token.data.character.ptr = cptr;
-	token.data.character.len = tokeniser->context.pending;
+	if (block->arena != NULL) {
+		hubbub_arena_destroy(block->arena);
+		block->arena = NULL;
+	}
 
-	return hubbub_tokeniser_emit_token(tokeniser, &token);
+	return hubbub_arena_create(pipe->tok->alloc, pipe->tok->alloc_pw,
+			&block->arena);
 }
 
 /**
- * Emit the current tag token being stored in the tokeniser context.
+ * Record a token found by the pipeline, passing on each full block
  *
- * \param tokeniser	Tokeniser instance
- * \return	true
+ * \param token  The token
+ * \param pw     The pipeline
+ * \return HUBBUB_OK on success, HUBBUB_STOPPED once the pipeline is to stop,
+ *         HUBBUB_NOMEM on memory exhaustion
  */
-hubbub_error emit_current_tag(hubbub_tokeniser *tokeniser)
+static hubbub_error hubbub_tokeniser_pipe_token(const hubbub_token *token,
+		void *pw)
 {
+	hubbub_tokeniser_pipe *pipe = pw;
+	hubbub_tokeniser_chunk *block;
 	hubbub_error err;
-	hubbub_token token;
-	uint32_t n_attributes;
-	hubbub_attribute *attrs;
-	uint8_t *ptr;
-	uint32_t i, j;
-
-	/* Emit current tag */
-	token.type = tokeniser->context.current_tag_type;
-	token.data.tag = tokeniser->context.current_tag;
- 	token.data.tag.ns = HUBBUB_NS_HTML;
+	bool cancelled;
 
+	block = &pipe->blocks[pipe->tail % PIPELINE_BLOCKS];
 
-	n_attributes = token.data.tag.n_attributes;
-	attrs = token.data.tag.attributes;
-
-	/* Set pointers correctly... */
-	ptr = tokeniser->buffer->data;
-	token.data.tag.name.ptr = tokeniser->buffer->data;
-	ptr += token.data.tag.name.len;
+	if (block->n_records == PIPELINE_BLOCK) {
+		/* Pass the block on, and wait for another to be free */
+		hubbub_mutex_lock(&pipe->lock);
 
-	for (i = 0; i < n_attributes; i++) {
-		attrs[i].name.ptr = ptr;
-		ptr += attrs[i].name.len;
-		attrs[i].value.ptr = ptr;
-		ptr += attrs[i].value.len;
-	}
+		pipe->filled++;
+		hubbub_cond_broadcast(&pipe->cond);
 
+		while (pipe->filled == PIPELINE_BLOCKS &&
+				pipe->cancelled == false)
+			hubbub_cond_wait(&pipe->cond, &pipe->lock);
+		cancelled = pipe->cancelled;
 
-	/* Discard duplicate attributes */
-	for (i = 0; i < n_attributes; i++) {
-		for (j = 0; j < n_attributes; j++) {
-			uint32_t move;
-
-			if (j == i ||
-				attrs[i].name.len !=
-						attrs[j].name.len ||
-				strncmp((char *) attrs[i].name.ptr,
-					(char *) attrs[j].name.ptr,
-					attrs[i].name.len) != 0) {
-				/* Attributes don't match */
-				continue;
-			}
+		hubbub_mutex_unlock(&pipe->lock);
 
-			assert(i < j);
+		if (cancelled)
+			return HUBBUB_STOPPED;
 
-			/* Calculate amount to move */
-			move = (n_attributes - 1 - j) *
-					sizeof(hubbub_attribute);
+		pipe->tail++;
+		block = &pipe->blocks[pipe->tail % PIPELINE_BLOCKS];
 
-			if (move > 0) {
-				memmove(&attrs[j],&attrs[j+1], move);
-			}
+		err = hubbub_tokeniser_ready_block(pipe, block);
+		if (err != HUBBUB_OK)
+			return err;
+	}
 
-			/* We've deleted an item, so we need to 
-			 * reprocess this index */
-			j--;
+	return hubbub_tokeniser_record_token(token, block);
+}
 
-			/* And reduce the number of attributes */
-			n_attributes--;
-		}
-	}
+/**
+ * Tokenise input ahead of the token handler
+ *
+ * \param arg  The pipeline
+ */
+static void hubbub_tokeniser_run_pipe(void *arg)
+{
+	hubbub_tokeniser_pipe *pipe = arg;
+	hubbub_error err;
 
-	token.data.tag.n_attributes = n_attributes;
+	err = hubbub_tokeniser_tokenise(pipe->tok);
 
-	err = hubbub_tokeniser_emit_token(tokeniser, &token);
+	/* Pass on the last block, however full */
+	hubbub_mutex_lock(&pipe->lock);
 
-	if (token.type == HUBBUB_TOKEN_START_TAG) {
-		/* Save start tag name for R?CDATA */
-		if (token.data.tag.name.len <
-			sizeof(tokeniser->context.last_start_tag_name)) {
-			strncpy((char *) tokeniser->context.last_start_tag_name,
-				(const char *) token.data.tag.name.ptr,
-				token.data.tag.name.len);
-			tokeniser->context.last_start_tag_len =
-					token.data.tag.name.len;
-		} else {
-			tokeniser->context.last_start_tag_name[0] = '\0';
-			tokeniser->context.last_start_tag_len = 0;
-		}
-	} else /* if (token->type == HUBBUB_TOKEN_END_TAG) */ {
-		/* Reset content model after R?CDATA elements */
-		tokeniser->content_model = HUBBUB_CONTENT_MODEL_PCDATA;
-	}
+	pipe->filled++;
+	pipe->done = true;
+	pipe->error = err;
+	hubbub_cond_broadcast(&pipe->cond);
 
-	/* Reset the self-closing flag */
-	tokeniser->context.current_tag.self_closing = false;
+	hubbub_mutex_unlock(&pipe->lock);
+}
 
-	return err;
+/**
+ * Start the pipeline tokenising
+ *
+ * \param tokeniser  Tokeniser instance
+ * \param pipe       The pipeline, which is not running
+ * \param start      Offset in the input to start at
+ * \return true on success, false if the pipeline could not be started
+ */
+static bool hubbub_tokeniser_start_pipe(hubbub_tokeniser *tokeniser,
+		hubbub_tokeniser_pipe *pipe, size_t start)
+{
+	hubbub_tokeniser_reset(pipe->tok, tokeniser->input);
+	pipe->tok->process_cdata_section = tokeniser->process_cdata_section;
+
+	pipe->start = start;
+	pipe->head = 0;
+	pipe->tail = 0;
+	pipe->filled = 0;
+	pipe->done = false;
+	pipe->cancelled = false;
+	pipe->error = HUBBUB_OK;
+
+	if (hubbub_tokeniser_ready_block(pipe, &pipe->blocks[0]) != HUBBUB_OK)
+		return false;
+
+	hubbub_tokeniser_borrow(pipe->tok, tokeniser->borrowed.data + start,
+			tokeniser->borrowed.len - start);
+	/* A token cut short by the end of the input is left to us */
+	hubbub_tokeniser_bound(pipe->tok, tokeniser->borrowed.len - start,
+			false);
+
+	return hubbub_thread_create(&pipe->thread, hubbub_tokeniser_run_pipe,
+			pipe);
 }
 
 /**
- * Emit the current comment token being stored in the tokeniser context.
+ * Stop the pipeline tokenising, and wait for it to do so
  *
- * \param tokeniser	Tokeniser instance
- * \return	true
+ * \param pipe  The pipeline, which is running
  */
-hubbub_error emit_current_comment(hubbub_tokeniser *tokeniser)
+static void hubbub_tokeniser_stop_pipe(hubbub_tokeniser_pipe *pipe)
 {
-	hubbub_token token;
+	hubbub_mutex_lock(&pipe->lock);
 
-	token.type = HUBBUB_TOKEN_COMMENT;
-	token.data.comment.ptr = tokeniser->buffer->data;
-	token.data.comment.len = tokeniser->buffer->length;
+	pipe->cancelled = true;
+	hubbub_cond_broadcast(&pipe->cond);
 
-	return hubbub_tokeniser_emit_token(tokeniser, &token);
+	hubbub_mutex_unlock(&pipe->lock);
+
+	hubbub_thread_join(&pipe->thread);
 }
 
 /**
- * Emit the current doctype token being stored in the tokeniser context.
+ * Emit the tokens recorded by the pipeline as they come, while correct
  *
- * \param tokeniser	Tokeniser instance
- * \param force_quirks	Force quirks mode on this document
- * \return	true
+ * \param tokeniser  Tokeniser instance, at the pipeline's start
+ * \param pipe       The pipeline, which is running
+ * \param finished   Pointer to location to receive whether every token
+ *                   the pipeline found was correct, so was emitted
+ * \return HUBBUB_OK on success, appropriate error otherwise
  */
-hubbub_error emit_current_doctype(hubbub_tokeniser *tokeniser,
-		bool force_quirks)
+static hubbub_error hubbub_tokeniser_replay_pipe(hubbub_tokeniser *tokeniser,
+		hubbub_tokeniser_pipe *pipe, bool *finished)
 {
-	hubbub_token token;
+	hubbub_tokeniser_chunk *block;
+	hubbub_error err, error;
+	bool synced, ready;
 
-	/* Emit doctype */
-	token.type = HUBBUB_TOKEN_DOCTYPE;
-	token.data.doctype = tokeniser->context.current_doctype;
-	if (force_quirks == true)
-		token.data.doctype.force_quirks = true;
+	*finished = false;
 
-	/* Set pointers correctly */
-	token.data.doctype.name.ptr = tokeniser->buffer->data;
+	err = hubbub_tokeniser_catch_up(tokeniser, pipe->start, &synced);
+	if (err != HUBBUB_OK || synced == false)
+		return err;
 
-	if (token.data.doctype.public_missing == false) {
-		token.data.doctype.public_id.ptr = tokeniser->buffer->data + 
-				token.data.doctype.name.len;
-	}
+	while (true) {
+		hubbub_mutex_lock(&pipe->lock);
 
-	if (token.data.doctype.system_missing == false) {
-		token.data.doctype.system_id.ptr = tokeniser->buffer->data +
-				token.data.doctype.name.len +
-				token.data.doctype.public_id.len;
-	}
+		while (pipe->filled == 0 && pipe->done == false)
+			hubbub_cond_wait(&pipe->cond, &pipe->lock);
+		ready = pipe->filled > 0;
+		error = pipe->error;
 
-	return hubbub_tokeniser_emit_token(tokeniser, &token);
+		hubbub_mutex_unlock(&pipe->lock);
+
+		if (ready == false) {
+			/* Any tokens it could not find are left to us */
+			*finished = (error == HUBBUB_OK);
+			return HUBBUB_OK;
+		}
+
+		block = &pipe->blocks[pipe->head % PIPELINE_BLOCKS];
+
+		err = hubbub_tokeniser_replay_records(tokeniser, block,
+				&synced);
+		if (err != HUBBUB_OK || synced == false)
+			return err;
+
+		/* The block is free to record into again */
+		hubbub_mutex_lock(&pipe->lock);
+
+		pipe->filled--;
+		hubbub_cond_broadcast(&pipe->cond);
+
+		hubbub_mutex_unlock(&pipe->lock);
+
+		pipe->head++;
+	}
 }
 
 /**
- * Emit a token, performing sanity checks if necessary
+ * Tokenise borrowed input on a thread of its own, ahead of the token
+ * handler
  *
  * \param tokeniser  Tokeniser instance
- * \param token      Token to emit
+ * \return HUBBUB_OK on success, appropriate error otherwise
  */
-hubbub_error hubbub_tokeniser_emit_token(hubbub_tokeniser *tokeniser,
-		hubbub_token *token)
+hubbub_error hubbub_tokeniser_pipeline(hubbub_tokeniser *tokeniser)
 {
+	const uint8_t *data = tokeniser->borrowed.data;
+	size_t len = tokeniser->borrowed.len;
+	hubbub_tokeniser_optparams params;
+	hubbub_tokeniser_pipe *pipe;
 	hubbub_error err = HUBBUB_OK;
+	bool finished = false;
+	size_t start, at, i;
 
-	assert(tokeniser != NULL);
-	assert(token != NULL);
-	assert(tokeniser->insert_buf->length == 0);
+	pipe = tokeniser->alloc(NULL, sizeof(hubbub_tokeniser_pipe),
+			tokeniser->alloc_pw);
+	if (pipe == NULL)
+		return hubbub_tokeniser_tokenise(tokeniser);
 
-#ifndef NDEBUG
-	/* Sanity checks */
-	switch (token->type) {
-	case HUBBUB_TOKEN_DOCTYPE:
-		assert(memchr(token->data.doctype.name.ptr, 0xff, 
-				token->data.doctype.name.len) == NULL);
-		if (token->data.doctype.public_missing == false)
-			assert(memchr(token->data.doctype.public_id.ptr, 0xff,
-				token->data.doctype.public_id.len) == NULL);
-		if (token->data.doctype.system_missing == false)
-			assert(memchr(token->data.doctype.system_id.ptr, 0xff,
-				token->data.doctype.system_id.len) == NULL);
-		break;
-	case HUBBUB_TOKEN_START_TAG:
-	case HUBBUB_TOKEN_END_TAG:
-	{
-		uint32_t i;
-		assert(memchr(token->data.tag.name.ptr, 0xff, 
-				token->data.tag.name.len) == NULL);
-		for (i = 0; i < token->data.tag.n_attributes; i++) {
-			hubbub_attribute *attr = &token->data.tag.attributes[i];
+	memset(pipe, 0, sizeof(hubbub_tokeniser_pipe));
 
-			assert(memchr(attr->name.ptr, 0xff, attr->name.len) == 
-					NULL);
-			assert(memchr(attr->value.ptr, 0xff, attr->value.len) ==
-					NULL);
-		}
-	}
-		break;
-	case HUBBUB_TOKEN_COMMENT:
-		assert(memchr(token->data.comment.ptr, 0xff, 
-				token->data.comment.len) == NULL);
-		break;
-	case HUBBUB_TOKEN_CHARACTER:
-		assert(memchr(token->data.character.ptr, 0xff,
-				token->data.character.len) == NULL);
-		break;
-	case HUBBUB_TOKEN_EOF:
-		break;
+	if (hubbub_mutex_init(&pipe->lock) == false) {
+		tokeniser->alloc(pipe, 0, tokeniser->alloc_pw);
+		return hubbub_tokeniser_tokenise(tokeniser);
 	}
-#endif
 
-	/* Emit the token */
-	if (tokeniser->token_handler) {
-		err = tokeniser->token_handler(token, tokeniser->token_pw);
+	if (hubbub_cond_init(&pipe->cond) == false) {
+		hubbub_mutex_destroy(&pipe->lock);
+		tokeniser->alloc(pipe, 0, tokeniser->alloc_pw);
+		return hubbub_tokeniser_tokenise(tokeniser);
 	}
 
-	/* Discard current buffer */
-	if (tokeniser->buffer->length) {
-		parserutils_buffer_discard(tokeniser->buffer, 0,
-				tokeniser->buffer->length);
+	if (hubbub_tokeniser_create(tokeniser->input, tokeniser->alloc,
+			tokeniser->alloc_pw, &pipe->tok) == HUBBUB_OK) {
+		params.token_handler.handler = hubbub_tokeniser_pipe_token;
+		params.token_handler.pw = pipe;
+		hubbub_tokeniser_setopt(pipe->tok,
+				HUBBUB_TOKENISER_TOKEN_HANDLER, &params);
+
+		/* Token locations give the extent of each token */
+		pipe->tok->track_position = true;
+		pipe->tok->drop_comments = tokeniser->drop_comments;
+		pipe->tok->raw_values = tokeniser->raw_values;
 	}
 
-	/* Advance the pointer */
-	if (tokeniser->context.pending) {
-		parserutils_inputstream_advance(tokeniser->input,
-				tokeniser->context.pending);
-		tokeniser->context.pending = 0;
-	}
+	tokeniser->speculating = true;
 
-	if (tokeniser->insert_buf->length > 0) {
-		parserutils_inputstream_insert(tokeniser->input,
-				tokeniser->insert_buf->data,
-				tokeniser->insert_buf->length);
-		parserutils_buffer_discard(tokeniser->insert_buf, 0,
-				tokeniser->insert_buf->length);
+	for (start = 0; pipe->tok != NULL && err == HUBBUB_OK; ) {
+		if (hubbub_tokeniser_start_pipe(tokeniser, pipe,
+				start) == false)
+			break;
+
+		/* Catch up with the pipeline, while it starts */
+		hubbub_tokeniser_bound(tokeniser, start, false);
+		err = hubbub_tokeniser_tokenise(tokeniser);
+
+		hubbub_tokeniser_bound(tokeniser, len, false);
+		if (err == HUBBUB_OK)
+			err = hubbub_tokeniser_replay_pipe(tokeniser, pipe,
+					&finished);
+
+		hubbub_tokeniser_stop_pipe(pipe);
+
+		if (finished || (pipe->error != HUBBUB_OK &&
+				pipe->error != HUBBUB_STOPPED))
+			break;
+
+		/* Start again a little way on */
+		at = tokeniser->borrowed.in_side ? tokeniser->borrowed.resume :
+				tokeniser->input->cursor;
+		start = hubbub_tokeniser_find_chunk(data, len,
+				at + PIPELINE_RESYNC);
+		if (start == len)
+			break;
 	}
 
-	/* Ensure callback can pause the tokenise */
-	if (err == HUBBUB_PAUSED) {
-		tokeniser->paused = true;
+	/* Whatever remains is tokenised as usual */
+	hubbub_tokeniser_bound(tokeniser, len, true);
+	if (err == HUBBUB_OK)
+		err = hubbub_tokeniser_tokenise(tokeniser);
+
+	for (i = 0; i < PIPELINE_BLOCKS; i++) {
+		if (pipe->blocks[i].arena != NULL)
+			hubbub_arena_destroy(pipe->blocks[i].arena);
+		if (pipe->blocks[i].records != NULL)
+			tokeniser->alloc(pipe->blocks[i].records, 0,
+					tokeniser->alloc_pw);
 	}
 
+	if (pipe->tok != NULL)
+		hubbub_tokeniser_destroy(pipe->tok);
+	hubbub_cond_destroy(&pipe->cond);
+	hubbub_mutex_destroy(&pipe->lock);
+	tokeniser->alloc(pipe, 0, tokeniser->alloc_pw);
+
+	tokeniser->speculating = false;
+
 	return err;
 }
@@ -13,12 +13,38 @@
 
 #include <hubbub/errors.h>
 #include <hubbub/functypes.h>
+#include <hubbub/stats.h>
 #include <hubbub/types.h>
 
 #include <parserutils/input/inputstream.h>
 
 typedef struct hubbub_tokeniser hubbub_tokeniser;
 
+/**
+ * Tokeniser state between tokens, from which tokenising may resume
+ */
+typedef struct hubbub_tokeniser_checkpoint {
+	size_t offset;			/**< Offset in the borrowed input */
+
+	hubbub_content_model content_model;	/**< Content model flag */
+	bool escape_flag;		/**< Escape flag */
+	bool process_cdata_section;	/**< Whether to process CDATA sections*/
+
+	uint8_t last_start_tag_name[10];	/**< Name of the last start tag
+						 * emitted */
+	size_t last_start_tag_len;	/**< Length of last start tag */
+	uint32_t dashes;		/**< Dashes ending the last piece of
+					 * raw text split off */
+
+	struct {
+		size_t offset;		/**< Offset of cursor */
+		uint32_t line;		/**< Line of cursor */
+		size_t line_start;	/**< Offset of start of line */
+		bool after_cr;		/**< Whether the byte before the
+					 * cursor is CR */
+	} position;			/**< Position in source data */
+} hubbub_tokeniser_checkpoint;
+
 /**
  * Hubbub tokeniser option types
  */
@@ -27,7 +53,18 @@ typedef enum hubbub_tokeniser_opttype {
 	HUBBUB_TOKENISER_ERROR_HANDLER,
 	HUBBUB_TOKENISER_CONTENT_MODEL,
 	HUBBUB_TOKENISER_PROCESS_CDATA,
-	HUBBUB_TOKENISER_PAUSE
+	HUBBUB_TOKENISER_PAUSE,
+	HUBBUB_TOKENISER_TRACK_POSITION,
+	HUBBUB_TOKENISER_TOKEN_BATCH_HANDLER,
+	HUBBUB_TOKENISER_DROP_COMMENTS,
+	HUBBUB_TOKENISER_TOKEN_LIMIT,
+	HUBBUB_TOKENISER_THREADS,
+	HUBBUB_TOKENISER_PIPELINE,
+	HUBBUB_TOKENISER_BUDGET,
+	HUBBUB_TOKENISER_STATS,
+	HUBBUB_TOKENISER_COMPACT_TOKEN_HANDLER,
+	HUBBUB_TOKENISER_KEEP_SOURCE,
+	HUBBUB_TOKENISER_RAW_ATTRIBUTE_VALUES
 } hubbub_tokeniser_opttype;
 
 /**
@@ -51,6 +88,53 @@ typedef union hubbub_tokeniser_optparams {
 	bool process_cdata;		/**< Whether to process CDATA sections*/
 
 	bool pause_parse;		/**< Pause parsing */
+
+	bool track_position;		/**< Whether to set token locations */
+
+	bool drop_comments;		/**< Whether to discard comments */
+
+	bool keep_source;		/**< Whether to keep the source of
+					 * each token, passed through, until
+					 * it has been emitted */
+
+	bool raw_attribute_values;	/**< Whether to leave attribute
+					 * values which need decoding as
+					 * written, and flag them */
+
+	size_t token_limit;		/**< Maximum size of token data, in
+					 * bytes, or 0 for no limit */
+
+	unsigned int threads;		/**< Number of threads on which to
+					 * tokenise large borrowed input, or
+					 * 0 or 1 for just the caller's. The
+					 * allocator must then be safe to
+					 * call from any thread */
+
+	bool pipeline;			/**< Whether to tokenise borrowed
+					 * input on a thread of its own,
+					 * ahead of the token handler. The
+					 * allocator must then be safe to
+					 * call from any thread */
+
+	struct {
+		size_t tokens;		/**< Tokens, or 0 for no limit */
+		size_t bytes;		/**< Bytes of input, or 0 for none */
+	} budget;			/**< Work to do in each call which
+					 * tokenises, before pausing */
+
+	hubbub_parser_stats *stats;	/**< Counters to count into, or NULL.
+					 * Only kept with HUBBUB_WITH_STATS */
+
+	struct {
+		hubbub_token_batch_handler handler;
+		void *pw;
+		size_t size;		/**< Maximum tokens per batch */
+	} token_batch_handler;		/**< Batched token handling callback */
+
+	struct {
+		hubbub_compact_token_handler handler;
+		void *pw;
+	} compact_token_handler;	/**< Compact token handling callback */
 } hubbub_tokeniser_optparams;
 
 /* Create a hubbub tokeniser */
@@ -60,6 +144,10 @@ hubbub_error hubbub_tokeniser_create(parserutils_inputstream *input,
 /* Destroy a hubbub tokeniser */
 hubbub_error hubbub_tokeniser_destroy(hubbub_tokeniser *tokeniser);
 
+/* Return a hubbub tokeniser to its initial state */
+hubbub_error hubbub_tokeniser_reset(hubbub_tokeniser *tokeniser,
+		parserutils_inputstream *input);
+
 /* Configure a hubbub tokeniser */
 hubbub_error hubbub_tokeniser_setopt(hubbub_tokeniser *tokeniser,
 		hubbub_tokeniser_opttype type,
@@ -69,6 +157,39 @@ hubbub_error hubbub_tokeniser_setopt(hubbub_tokeniser *tokeniser,
 hubbub_error hubbub_tokeniser_insert_chunk(hubbub_tokeniser *tokeniser,
 		const uint8_t *data, size_t len);
 
+/* Read the whole of the input from data owned by the client */
+hubbub_error hubbub_tokeniser_borrow(hubbub_tokeniser *tokeniser,
+		const uint8_t *data, size_t len);
+
+/* Append UTF-8 to the input, bypassing the input stream */
+hubbub_error hubbub_tokeniser_append(hubbub_tokeniser *tokeniser,
+		const uint8_t *data, size_t len);
+
+/* Move on from the input stream to another, part way through the input */
+hubbub_error hubbub_tokeniser_switch_input(hubbub_tokeniser *tokeniser,
+		parserutils_inputstream *input);
+
+/* Save the tokeniser's state, where it is between tokens */
+hubbub_error hubbub_tokeniser_save(hubbub_tokeniser *tokeniser,
+		hubbub_tokeniser_checkpoint *checkpoint);
+
+/* Resume tokenising borrowed input from a saved state */
+hubbub_error hubbub_tokeniser_restore(hubbub_tokeniser *tokeniser,
+		const hubbub_tokeniser_checkpoint *checkpoint);
+
+/* Determine whether two saved states tokenise what follows alike */
+bool hubbub_tokeniser_same_state(const hubbub_tokeniser_checkpoint *a,
+		const hubbub_tokeniser_checkpoint *b);
+
+/* Find the input buffered but not yet read */
+hubbub_error hubbub_tokeniser_remainder(hubbub_tokeniser *tokeniser,
+		const uint8_t **data, size_t *len,
+		const uint8_t **more, size_t *more_len);
+
+/* Find the source of part of the input passed through */
+hubbub_error hubbub_tokeniser_source(hubbub_tokeniser *tokeniser,
+		size_t start, size_t end, const uint8_t **data);
+
 /* Process remaining data in the input stream */
 hubbub_error hubbub_tokeniser_run(hubbub_tokeniser *tokeniser);
 
@@ -11,6 +11,7 @@
 #include "treebuilder/modes.h"
 #include "treebuilder/internal.h"
 #include "treebuilder/treebuilder.h"
+#include "utils/scan.h"
 #include "utils/utils.h"
 
 
@@ -34,12 +35,8 @@ hubbub_error handle_after_body(hubbub_treebuilder *treebuilder,
 		size_t len = token->data.character.len;
 		size_t c;
 
-		/* Scan for whitespace */
-		for (c = 0; c < len; c++) {
-			if (data[c] != 0x09 && data[c] != 0x0A &&
-					data[c] != 0x0C && data[c] != 0x20)
-				break;
-		}
+		/* Scan for whitespace, unless the tokeniser knows */
+		c = token->whitespace ? len : hubbub_scan_whitespace(data, len);
 
 		/* Whitespace characters in token, so handle as in body */
 		if (c > 0) {
@@ -72,8 +69,7 @@ hubbub_error handle_after_body(hubbub_treebuilder *treebuilder,
 		break;
 	case HUBBUB_TOKEN_START_TAG:
 	{
-		element_type type = element_type_from_name(treebuilder,
-				&token->data.tag.name);
+		element_type type = element_type_from_tag(&token->data.tag);
 
 		if (type == HTML) {
 			/* Process as if "in body" */
@@ -87,13 +83,14 @@ hubbub_error handle_after_body(hubbub_treebuilder *treebuilder,
 		break;
 	case HUBBUB_TOKEN_END_TAG:
 	{
-		element_type type = element_type_from_name(treebuilder,
-				&token->data.tag.name);
+		element_type type = element_type_from_tag(&token->data.tag);
 
 		if (type == HTML) {
-			/** \todo fragment case */
 			/** \todo parse error */
-			treebuilder->context.mode = AFTER_AFTER_BODY;
+
+			/* fragment case: ignore the token */
+			if (treebuilder->context.fragment.active == false)
+				treebuilder->context.mode = AFTER_AFTER_BODY;
 		} else {
 			/** \todo parse error */
 			treebuilder->context.mode = IN_BODY;
@@ -47,8 +47,7 @@ hubbub_error handle_after_frameset(hubbub_treebuilder *treebuilder,
 		break;
 	case HUBBUB_TOKEN_START_TAG:
 	{
-		element_type type = element_type_from_name(treebuilder,
-				&token->data.tag.name);
+		element_type type = element_type_from_tag(&token->data.tag);
 
 		if (type == HTML) {
 			err = handle_in_body(treebuilder, token);
@@ -61,13 +60,17 @@ hubbub_error handle_after_frameset(hubbub_treebuilder *treebuilder,
 		break;
 	case HUBBUB_TOKEN_END_TAG:
 	{
-		element_type type = element_type_from_name(treebuilder,
-				&token->data.tag.name);
+		element_type type = element_type_from_tag(&token->data.tag);
 
 		if (type == HTML) {
-			/** \todo fragment case */
 			/** \todo parse error */
-			treebuilder->context.mode = AFTER_AFTER_FRAMESET;
+
+			/* fragment case: there is no document to hang
+			 * anything after the root from, so stay here */
+			if (treebuilder->context.fragment.active == false) {
+				treebuilder->context.mode =
+						AFTER_AFTER_FRAMESET;
+			}
 		} else {
 			/** \todo parse error */
 		}
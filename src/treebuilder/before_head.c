@@ -42,8 +42,7 @@ hubbub_error handle_before_head(hubbub_treebuilder *treebuilder,
 		break;
 	case HUBBUB_TOKEN_START_TAG:
 	{
-		element_type type = element_type_from_name(treebuilder,
-				&token->data.tag.name);
+		element_type type = element_type_from_tag(&token->data.tag);
 
 		if (type == HTML) {
 			/* Process as if "in body" */
@@ -57,8 +56,7 @@ hubbub_error handle_before_head(hubbub_treebuilder *treebuilder,
 		break;
 	case HUBBUB_TOKEN_END_TAG:
 	{
-		element_type type = element_type_from_name(treebuilder,
-				&token->data.tag.name);
+		element_type type = element_type_from_tag(&token->data.tag);
 
 		if (type == HTML || type == BODY ||
 				type == HEAD || type == BR) {
@@ -82,6 +80,7 @@ hubbub_error handle_before_head(hubbub_treebuilder *treebuilder,
 			tag.ns = HUBBUB_NS_HTML;
 			tag.name.ptr = (const uint8_t *) "head";
 			tag.name.len = SLEN("head");
+			tag.atom = HUBBUB_ATOM_HEAD;
 
 			tag.n_attributes = 0;
 			tag.attributes = NULL;
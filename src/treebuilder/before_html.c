@@ -41,8 +41,7 @@ hubbub_error handle_before_html(hubbub_treebuilder *treebuilder,
 		break;
 	case HUBBUB_TOKEN_START_TAG:
 	{
-		element_type type = element_type_from_name(treebuilder,
-				&token->data.tag.name);
+		element_type type = element_type_from_tag(&token->data.tag);
 
 		if (type == HTML) {
 			handled = true;
@@ -60,6 +59,8 @@ hubbub_error handle_before_html(hubbub_treebuilder *treebuilder,
 
 	if (handled || err == HUBBUB_REPROCESS) {
 		hubbub_error e;
+		hubbub_tag tag;
+		const hubbub_tag *html_tag = &token->data.tag;
 		void *html, *appended;
 
 		/* We can't use insert_element() here, as it assumes
@@ -69,24 +70,21 @@ hubbub_error handle_before_html(hubbub_treebuilder *treebuilder,
 
 		if (err == HUBBUB_REPROCESS) {
 			/* Need to manufacture html element */
-			hubbub_tag tag;
-
 			tag.ns = HUBBUB_NS_HTML;
 			tag.name.ptr = (const uint8_t *) "html";
 			tag.name.len = SLEN("html");
+			tag.atom = HUBBUB_ATOM_HTML;
 
 			tag.n_attributes = 0;
 			tag.attributes = NULL;
 
-			e = treebuilder->tree_handler->create_element(
-					treebuilder->tree_handler->ctx,
-					&tag, &html);
-		} else {
-			e = treebuilder->tree_handler->create_element(
-					treebuilder->tree_handler->ctx,
-					&token->data.tag, &html);
+			html_tag = &tag;
 		}
 
+		e = treebuilder->tree_handler->create_element(
+				treebuilder->tree_handler->ctx,
+				html_tag, &html);
+
 		if (e != HUBBUB_OK)
 			return e;
 
@@ -109,11 +107,19 @@ hubbub_error handle_before_html(hubbub_treebuilder *treebuilder,
 		 * manually. */
 		treebuilder->context.element_stack[0].type = HTML;
 		treebuilder->context.element_stack[0].node = appended;
+		element_stack_set_parent(treebuilder, 0,
+				treebuilder->context.document);
 		treebuilder->context.current_node = 0;
 
 		/** \todo cache selection algorithm */
 
 		treebuilder->context.mode = BEFORE_HEAD;
+
+		if (treebuilder->event_handler != NULL) {
+			e = event_sync(treebuilder, html_tag);
+			if (e != HUBBUB_OK)
+				return e;
+		}
 	}
 
 	return err;
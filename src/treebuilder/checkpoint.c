@@ -0,0 +1,471 @@
+/*
+ * This file is part of Hubbub.
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license.php
+ * Copyright 2026 agent <agent@local>
+ */
+
+#include <assert.h>
+#include <string.h>
+
+#include "treebuilder/modes.h"
+#include "treebuilder/internal.h"
+#include "treebuilder/treebuilder.h"
+#include "utils/utils.h"
+
+/*
+ * Checkpoints
+ *
+ * A checkpoint is a copy of the treebuilder's context, taken between
+ * tokens, whose arrays (the stack of open elements, the list of active
+ * formatting elements, and the elements reported open) are the
+ * checkpoint's own. It holds a reference to each node the context does,
+ * so the nodes outlive the parse they were made in, for as long as the
+ * checkpoint is kept.
+ */
+
+/**
+ * Treebuilder checkpoint
+ */
+struct hubbub_treebuilder_checkpoint {
+	hubbub_treebuilder_context context;	/**< Copy of context */
+	uintptr_t stub_nodes;			/**< Number of stub nodes
+						 * made */
+};
+
+static void count_nodes(hubbub_tree_handler *tree_handler,
+		const hubbub_treebuilder_context *ctx, bool ref);
+static void free_arrays(hubbub_treebuilder *treebuilder,
+		hubbub_treebuilder_context *ctx);
+static void *copy_array(hubbub_treebuilder *treebuilder, void *dst,
+		size_t dst_len, const void *src, size_t len);
+
+/**
+ * Save the treebuilder's state, between tokens
+ *
+ * \param treebuilder  The treebuilder instance
+ * \param checkpoint   Pointer to location to receive checkpoint
+ * \return HUBBUB_OK on success,
+ *         HUBBUB_BADPARM on bad parameters,
+ *         HUBBUB_NOMEM on memory exhaustion,
+ *         HUBBUB_INVALID if there is pending text, or an error yet to be
+ *                        reported
+ */
+hubbub_error hubbub_treebuilder_save(hubbub_treebuilder *treebuilder,
+		hubbub_treebuilder_checkpoint **checkpoint)
+{
+	const hubbub_treebuilder_context *ctx;
+	hubbub_treebuilder_checkpoint *cp;
+	hubbub_treebuilder_context *copy;
+
+	if (treebuilder == NULL || checkpoint == NULL)
+		return HUBBUB_BADPARM;
+
+	ctx = &treebuilder->context;
+
+	/* Text is only pending after character tokens, which the client
+	 * has no reason to stop at */
+	if (ctx->text_parent != NULL || ctx->complete_error != HUBBUB_OK)
+		return HUBBUB_INVALID;
+
+	cp = treebuilder->alloc(NULL, sizeof(hubbub_treebuilder_checkpoint),
+			treebuilder->alloc_pw);
+	if (cp == NULL)
+		return HUBBUB_NOMEM;
+
+	copy = &cp->context;
+	*copy = *ctx;
+	cp->stub_nodes = treebuilder->stub_nodes;
+
+	copy->text = NULL;
+	copy->text_len = 0;
+	copy->text_alloc = 0;
+
+	copy->stack_alloc = ctx->current_node + 1;
+	copy->element_stack = copy_array(treebuilder, NULL, 0,
+			ctx->element_stack,
+			copy->stack_alloc * sizeof(element_context));
+
+	copy->formatting_list_alloc = ctx->formatting_list_len;
+	copy->formatting_list = copy_array(treebuilder, NULL, 0,
+			ctx->formatting_list,
+			ctx->formatting_list_len *
+					sizeof(formatting_list_entry));
+
+	copy->formatting_attrs_alloc = ctx->formatting_attrs_len;
+	copy->formatting_attrs = copy_array(treebuilder, NULL, 0,
+			ctx->formatting_attrs, ctx->formatting_attrs_len);
+
+	copy->events.alloc = ctx->events.depth;
+	copy->events.stack = copy_array(treebuilder, NULL, 0,
+			ctx->events.stack,
+			ctx->events.depth * sizeof(event_entry));
+
+	copy->events.names_alloc = ctx->events.names_len;
+	copy->events.names = copy_array(treebuilder, NULL, 0,
+			ctx->events.names, ctx->events.names_len);
+
+	if (copy->element_stack == NULL ||
+			(copy->formatting_list == NULL &&
+				copy->formatting_list_alloc > 0) ||
+			(copy->formatting_attrs == NULL &&
+				copy->formatting_attrs_alloc > 0) ||
+			(copy->events.stack == NULL &&
+				copy->events.alloc > 0) ||
+			(copy->events.names == NULL &&
+				copy->events.names_alloc > 0)) {
+		free_arrays(treebuilder, copy);
+		treebuilder->alloc(cp, 0, treebuilder->alloc_pw);
+		return HUBBUB_NOMEM;
+	}
+
+	if (treebuilder->tree_handler != NULL)
+		count_nodes(treebuilder->tree_handler, copy, true);
+
+	*checkpoint = cp;
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Return the treebuilder to a saved state
+ *
+ * \param treebuilder  The treebuilder instance, which has just been reset
+ * \param checkpoint   Checkpoint to return to
+ * \return HUBBUB_OK on success,
+ *         HUBBUB_BADPARM on bad parameters,
+ *         HUBBUB_NOMEM on memory exhaustion
+ *
+ * The checkpoint must have been saved by a treebuilder with the same tree
+ * handler, and the client's tree brought back to the way it was then.
+ * Options are kept, as are the treebuilder's own arrays, into which the
+ * checkpoint's are copied. The checkpoint is unchanged, so may be returned
+ * to again.
+ */
+hubbub_error hubbub_treebuilder_restore(hubbub_treebuilder *treebuilder,
+		const hubbub_treebuilder_checkpoint *checkpoint)
+{
+	const hubbub_treebuilder_context *saved;
+	hubbub_treebuilder_context *ctx;
+	hubbub_treebuilder_context old;
+	void *temp;
+
+	if (treebuilder == NULL || checkpoint == NULL)
+		return HUBBUB_BADPARM;
+
+	ctx = &treebuilder->context;
+	saved = &checkpoint->context;
+
+	/* Nothing may have been parsed since the reset */
+	if (ctx->mode != INITIAL || ctx->current_node != 0 ||
+			ctx->element_stack[0].type != (element_type) 0)
+		return HUBBUB_BADPARM;
+
+	/* Make room for the saved arrays, before anything is changed */
+	if (saved->stack_alloc > ctx->stack_alloc) {
+		temp = copy_array(treebuilder, ctx->element_stack,
+				ctx->stack_alloc * sizeof(element_context),
+				NULL, saved->stack_alloc *
+						sizeof(element_context));
+		if (temp == NULL)
+			return HUBBUB_NOMEM;
+		ctx->element_stack = temp;
+		ctx->stack_alloc = saved->stack_alloc;
+	}
+
+	if (saved->formatting_list_len > ctx->formatting_list_alloc) {
+		temp = copy_array(treebuilder, ctx->formatting_list,
+				ctx->formatting_list_alloc *
+					sizeof(formatting_list_entry),
+				NULL, saved->formatting_list_len *
+					sizeof(formatting_list_entry));
+		if (temp == NULL)
+			return HUBBUB_NOMEM;
+		ctx->formatting_list = temp;
+		ctx->formatting_list_alloc = saved->formatting_list_len;
+	}
+
+	if (saved->formatting_attrs_len > ctx->formatting_attrs_alloc) {
+		temp = copy_array(treebuilder, ctx->formatting_attrs,
+				ctx->formatting_attrs_alloc, NULL,
+				saved->formatting_attrs_len);
+		if (temp == NULL)
+			return HUBBUB_NOMEM;
+		ctx->formatting_attrs = temp;
+		ctx->formatting_attrs_alloc = saved->formatting_attrs_len;
+	}
+
+	if (saved->events.depth > ctx->events.alloc) {
+		temp = copy_array(treebuilder, ctx->events.stack,
+				ctx->events.alloc * sizeof(event_entry),
+				NULL, saved->events.depth *
+						sizeof(event_entry));
+		if (temp == NULL)
+			return HUBBUB_NOMEM;
+		ctx->events.stack = temp;
+		ctx->events.alloc = saved->events.depth;
+	}
+
+	if (saved->events.names_len > ctx->events.names_alloc) {
+		temp = copy_array(treebuilder, ctx->events.names,
+				ctx->events.names_alloc, NULL,
+				saved->events.names_len);
+		if (temp == NULL)
+			return HUBBUB_NOMEM;
+		ctx->events.names = temp;
+		ctx->events.names_alloc = saved->events.names_len;
+	}
+
+	/* The checkpoint has a document node of its own */
+	if (ctx->document != NULL && treebuilder->tree_handler != NULL) {
+		treebuilder->tree_handler->unref_node(
+				treebuilder->tree_handler->ctx, ctx->document);
+	}
+
+	old = *ctx;
+	*ctx = *saved;
+
+	ctx->element_stack = old.element_stack;
+	ctx->stack_alloc = old.stack_alloc;
+	memcpy(ctx->element_stack, saved->element_stack,
+			(saved->current_node + 1) * sizeof(element_context));
+
+	ctx->formatting_list = old.formatting_list;
+	ctx->formatting_list_alloc = old.formatting_list_alloc;
+	if (saved->formatting_list_len > 0) {
+		memcpy(ctx->formatting_list, saved->formatting_list,
+				saved->formatting_list_len *
+					sizeof(formatting_list_entry));
+	}
+
+	ctx->formatting_attrs = old.formatting_attrs;
+	ctx->formatting_attrs_alloc = old.formatting_attrs_alloc;
+	if (saved->formatting_attrs_len > 0) {
+		memcpy(ctx->formatting_attrs, saved->formatting_attrs,
+				saved->formatting_attrs_len);
+	}
+
+	ctx->events.stack = old.events.stack;
+	ctx->events.alloc = old.events.alloc;
+	if (saved->events.depth > 0) {
+		memcpy(ctx->events.stack, saved->events.stack,
+				saved->events.depth * sizeof(event_entry));
+	}
+
+	ctx->events.names = old.events.names;
+	ctx->events.names_alloc = old.events.names_alloc;
+	if (saved->events.names_len > 0) {
+		memcpy(ctx->events.names, saved->events.names,
+				saved->events.names_len);
+	}
+
+	ctx->text = old.text;
+	ctx->text_alloc = old.text_alloc;
+
+	ctx->enable_scripting = old.enable_scripting;
+	ctx->enable_styling = old.enable_styling;
+	ctx->head_only = old.head_only;
+
+	treebuilder->stub_nodes = checkpoint->stub_nodes;
+
+	if (treebuilder->tree_handler != NULL)
+		count_nodes(treebuilder->tree_handler, ctx, true);
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Destroy a treebuilder checkpoint
+ *
+ * \param treebuilder  The treebuilder instance which saved it
+ * \param checkpoint   Checkpoint to destroy
+ *
+ * The references the checkpoint holds are released with the treebuilder's
+ * tree handler, which must be the one in use when it was saved.
+ */
+void hubbub_treebuilder_release(hubbub_treebuilder *treebuilder,
+		hubbub_treebuilder_checkpoint *checkpoint)
+{
+	if (treebuilder == NULL || checkpoint == NULL)
+		return;
+
+	if (treebuilder->tree_handler != NULL)
+		count_nodes(treebuilder->tree_handler, &checkpoint->context,
+				false);
+
+	free_arrays(treebuilder, &checkpoint->context);
+
+	treebuilder->alloc(checkpoint, 0, treebuilder->alloc_pw);
+}
+
+/**
+ * Determine whether two checkpoints build the tree alike from here on
+ *
+ * \param a  A checkpoint
+ * \param b  Another checkpoint
+ * \return true if the same tokens, following either, build the same tree
+ *
+ * Nodes are not compared, only the types of the elements held: the client
+ * is to treat the nodes held at one checkpoint as standing for those held
+ * at the other, in the same places.
+ */
+bool hubbub_treebuilder_same_state(const hubbub_treebuilder_checkpoint *a,
+		const hubbub_treebuilder_checkpoint *b)
+{
+	const hubbub_treebuilder_context *x = &a->context;
+	const hubbub_treebuilder_context *y = &b->context;
+	uint32_t n;
+
+	if (x->mode != y->mode || x->second_mode != y->second_mode ||
+			x->current_node != y->current_node ||
+			x->formatting_list_len != y->formatting_list_len ||
+			(x->head_element == NULL) !=
+					(y->head_element == NULL) ||
+			(x->form_element == NULL) !=
+					(y->form_element == NULL) ||
+			(x->document == NULL) != (y->document == NULL) ||
+			x->fragment.active != y->fragment.active ||
+			x->fragment.ns != y->fragment.ns ||
+			x->fragment.type != y->fragment.type ||
+			x->stopped != y->stopped ||
+			x->collect.mode != y->collect.mode ||
+			x->collect.type != y->collect.type ||
+			x->strip_leading_lr != y->strip_leading_lr ||
+			x->in_table_foster != y->in_table_foster ||
+			x->frameset_ok != y->frameset_ok ||
+			x->in_split_comment != y->in_split_comment ||
+			x->events.depth != y->events.depth ||
+			x->events.names_len != y->events.names_len)
+		return false;
+
+	for (n = 0; n <= x->current_node; n++) {
+		const element_context *e = &x->element_stack[n];
+		const element_context *f = &y->element_stack[n];
+
+		/* Only tables are ever tainted */
+		if (e->ns != f->ns || e->type != f->type ||
+				(e->type == TABLE && e->tainted != f->tainted))
+			return false;
+	}
+
+	for (n = 0; n < x->formatting_list_len; n++) {
+		const formatting_list_entry *e = &x->formatting_list[n];
+		const formatting_list_entry *f = &y->formatting_list[n];
+
+		if (e->details.ns != f->details.ns ||
+				e->details.type != f->details.type ||
+				e->stack_index != f->stack_index ||
+				e->attributes.signature !=
+					f->attributes.signature ||
+				e->attributes.count != f->attributes.count ||
+				e->attributes.len != f->attributes.len)
+			return false;
+
+		if (e->attributes.len > 0 && memcmp(
+				x->formatting_attrs + e->attributes.data,
+				y->formatting_attrs + f->attributes.data,
+				e->attributes.len) != 0)
+			return false;
+	}
+
+	for (n = 0; n < x->events.depth; n++) {
+		if (x->events.stack[n].ns != y->events.stack[n].ns ||
+				x->events.stack[n].name_len !=
+					y->events.stack[n].name_len)
+			return false;
+	}
+
+	return x->events.names_len == 0 || memcmp(x->events.names,
+			y->events.names, x->events.names_len) == 0;
+}
+
+/**
+ * Reference, or release, the nodes held by a context
+ *
+ * \param tree_handler  Tree handler to count references with
+ * \param ctx           Context whose nodes to count
+ * \param ref           Whether to reference the nodes, else release them
+ *
+ * These are the nodes reset releases: any pending text must be flushed.
+ */
+void count_nodes(hubbub_tree_handler *tree_handler,
+		const hubbub_treebuilder_context *ctx, bool ref)
+{
+	hubbub_tree_ref_node count = ref ? tree_handler->ref_node :
+			tree_handler->unref_node;
+	uint32_t n;
+
+	assert(ctx->text_parent == NULL);
+
+	if (ctx->head_element != NULL)
+		count(tree_handler->ctx, ctx->head_element);
+
+	if (ctx->form_element != NULL)
+		count(tree_handler->ctx, ctx->form_element);
+
+	if (ctx->document != NULL)
+		count(tree_handler->ctx, ctx->document);
+
+	for (n = ctx->current_node; n > 0; n--)
+		count(tree_handler->ctx, ctx->element_stack[n].node);
+	if (ctx->element_stack[0].type == HTML)
+		count(tree_handler->ctx, ctx->element_stack[0].node);
+
+	for (n = 0; n < ctx->formatting_list_len; n++)
+		count(tree_handler->ctx, ctx->formatting_list[n].details.node);
+}
+
+/**
+ * Free the arrays of a checkpoint's context
+ *
+ * \param treebuilder  The treebuilder instance
+ * \param ctx          Context whose arrays to free
+ */
+void free_arrays(hubbub_treebuilder *treebuilder,
+		hubbub_treebuilder_context *ctx)
+{
+	if (ctx->element_stack != NULL)
+		treebuilder->alloc(ctx->element_stack, 0,
+				treebuilder->alloc_pw);
+	if (ctx->formatting_list != NULL)
+		treebuilder->alloc(ctx->formatting_list, 0,
+				treebuilder->alloc_pw);
+	if (ctx->formatting_attrs != NULL)
+		treebuilder->alloc(ctx->formatting_attrs, 0,
+				treebuilder->alloc_pw);
+	if (ctx->events.stack != NULL)
+		treebuilder->alloc(ctx->events.stack, 0,
+				treebuilder->alloc_pw);
+	if (ctx->events.names != NULL)
+		treebuilder->alloc(ctx->events.names, 0,
+				treebuilder->alloc_pw);
+}
+
+/**
+ * Copy an array into a block of at least its size
+ *
+ * \param treebuilder  The treebuilder instance
+ * \param dst          Block to copy into, grown if need be, or NULL
+ * \param dst_len      Length, in bytes, of dst
+ * \param src          Array to copy, or NULL to copy nothing
+ * \param len          Length, in bytes, of the array
+ * \return Pointer to block, or NULL on memory exhaustion (dst is then
+ *         unchanged) or if dst is NULL and len is 0
+ */
+void *copy_array(hubbub_treebuilder *treebuilder, void *dst,
+		size_t dst_len, const void *src, size_t len)
+{
+	if (len > dst_len) {
+		void *temp = treebuilder->alloc(dst, len,
+				treebuilder->alloc_pw);
+		if (temp == NULL)
+			return NULL;
+		dst = temp;
+	}
+
+	if (src != NULL && len > 0)
+		memcpy(dst, src, len);
+
+	return dst;
+}
+
@@ -0,0 +1,578 @@
+/*
+ * This file is part of Hubbub.
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license.php
+ * Copyright 2026 agent <agent@local>
+ */
+
+#include <assert.h>
+#include <string.h>
+
+#include "treebuilder/modes.h"
+#include "treebuilder/internal.h"
+#include "treebuilder/treebuilder.h"
+#include "utils/utils.h"
+
+/*
+ * Structural events
+ *
+ * The elements reported open are kept in a stack of their own, which is
+ * brought into line with the stack of open elements before anything is
+ * reported. Elements which are no longer open, or have moved, are closed,
+ * and whatever is open above them is then opened (again, if need be).
+ *
+ * When there is no client tree, the treebuilder is given stubs in place
+ * of the tree handler's callbacks. These make nodes which are no more than
+ * unique numbers, so that the treebuilder can still tell nodes apart.
+ */
+
+/**
+ * Make a stub node
+ *
+ * \param treebuilder  The treebuilder instance
+ * \return The new node
+ */
+static inline void *stub_node(hubbub_treebuilder *treebuilder)
+{
+	return (void *) ++treebuilder->stub_nodes;
+}
+
+static hubbub_error stub_create_comment(void *ctx, const hubbub_string *data,
+		void **result)
+{
+	UNUSED(data);
+
+	*result = stub_node((hubbub_treebuilder *) ctx);
+
+	return HUBBUB_OK;
+}
+
+static hubbub_error stub_create_doctype(void *ctx,
+		const hubbub_doctype *doctype, void **result)
+{
+	UNUSED(doctype);
+
+	*result = stub_node((hubbub_treebuilder *) ctx);
+
+	return HUBBUB_OK;
+}
+
+static hubbub_error stub_create_element(void *ctx, const hubbub_tag *tag,
+		void **result)
+{
+	UNUSED(tag);
+
+	*result = stub_node((hubbub_treebuilder *) ctx);
+
+	return HUBBUB_OK;
+}
+
+static hubbub_error stub_create_text(void *ctx, const hubbub_string *data,
+		void **result)
+{
+	UNUSED(data);
+
+	*result = stub_node((hubbub_treebuilder *) ctx);
+
+	return HUBBUB_OK;
+}
+
+static hubbub_error stub_ref_node(void *ctx, void *node)
+{
+	UNUSED(ctx);
+	UNUSED(node);
+
+	return HUBBUB_OK;
+}
+
+static hubbub_error stub_append_child(void *ctx, void *parent, void *child,
+		void **result)
+{
+	UNUSED(ctx);
+	UNUSED(parent);
+
+	*result = child;
+
+	return HUBBUB_OK;
+}
+
+static hubbub_error stub_insert_before(void *ctx, void *parent, void *child,
+		void *ref_child, void **result)
+{
+	UNUSED(ctx);
+	UNUSED(parent);
+	UNUSED(ref_child);
+
+	*result = child;
+
+	return HUBBUB_OK;
+}
+
+static hubbub_error stub_remove_child(void *ctx, void *parent, void *child,
+		void **result)
+{
+	UNUSED(ctx);
+	UNUSED(parent);
+
+	*result = child;
+
+	return HUBBUB_OK;
+}
+
+static hubbub_error stub_clone_node(void *ctx, void *node, bool deep,
+		void **result)
+{
+	UNUSED(node);
+	UNUSED(deep);
+
+	*result = stub_node((hubbub_treebuilder *) ctx);
+
+	return HUBBUB_OK;
+}
+
+static hubbub_error stub_reparent_children(void *ctx, void *node,
+		void *new_parent)
+{
+	UNUSED(ctx);
+	UNUSED(node);
+	UNUSED(new_parent);
+
+	return HUBBUB_OK;
+}
+
+static hubbub_error stub_get_parent(void *ctx, void *node, bool element_only,
+		void **result)
+{
+	UNUSED(ctx);
+	UNUSED(node);
+	UNUSED(element_only);
+
+	/* Nothing is in a tree, so the treebuilder uses the stack */
+	*result = NULL;
+
+	return HUBBUB_OK;
+}
+
+static hubbub_error stub_has_children(void *ctx, void *node, bool *result)
+{
+	UNUSED(ctx);
+	UNUSED(node);
+
+	*result = false;
+
+	return HUBBUB_OK;
+}
+
+static hubbub_error stub_form_associate(void *ctx, void *form, void *node)
+{
+	UNUSED(ctx);
+	UNUSED(form);
+	UNUSED(node);
+
+	return HUBBUB_OK;
+}
+
+static hubbub_error stub_add_attributes(void *ctx, void *node,
+		const hubbub_attribute *attributes, uint32_t n_attributes)
+{
+	UNUSED(ctx);
+	UNUSED(node);
+	UNUSED(attributes);
+	UNUSED(n_attributes);
+
+	return HUBBUB_OK;
+}
+
+static hubbub_error stub_set_quirks_mode(void *ctx, hubbub_quirks_mode mode)
+{
+	UNUSED(ctx);
+	UNUSED(mode);
+
+	return HUBBUB_OK;
+}
+
+static hubbub_error stub_encoding_change(void *ctx, const char *encname)
+{
+	UNUSED(ctx);
+	UNUSED(encname);
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Fill in the stub callbacks used when there is no client tree
+ *
+ * \param treebuilder  The treebuilder instance
+ */
+void event_stubs_init(hubbub_treebuilder *treebuilder)
+{
+	hubbub_tree_handler *stubs = &treebuilder->event_stubs;
+
+	stubs->create_comment = stub_create_comment;
+	stubs->create_doctype = stub_create_doctype;
+	stubs->create_element = stub_create_element;
+	stubs->create_text = stub_create_text;
+	stubs->ref_node = stub_ref_node;
+	stubs->unref_node = stub_ref_node;
+	stubs->append_child = stub_append_child;
+	stubs->insert_before = stub_insert_before;
+	stubs->remove_child = stub_remove_child;
+	stubs->clone_node = stub_clone_node;
+	stubs->reparent_children = stub_reparent_children;
+	stubs->get_parent = stub_get_parent;
+	stubs->has_children = stub_has_children;
+	stubs->form_associate = stub_form_associate;
+	stubs->add_attributes = stub_add_attributes;
+	stubs->set_quirks_mode = stub_set_quirks_mode;
+	stubs->encoding_change = stub_encoding_change;
+	stubs->complete_script = stub_ref_node;
+	stubs->complete_style = stub_ref_node;
+	stubs->ctx = treebuilder;
+}
+
+/**
+ * Find the index in the stack of open elements of the lowest element which
+ * is reported by events
+ *
+ * \param treebuilder  The treebuilder instance
+ * \param count        Pointer to location to receive number of elements
+ *                     from there to the current node, inclusive
+ * \return Index of lowest element
+ *
+ * The root of a fragment is the client's, so is not reported.
+ */
+static uint32_t event_base(hubbub_treebuilder *treebuilder, uint32_t *count)
+{
+	element_context *stack = treebuilder->context.element_stack;
+	uint32_t base = treebuilder->context.fragment.active ? 1 : 0;
+
+	if (stack[0].type != HTML)
+		*count = 0;
+	else
+		*count = treebuilder->context.current_node + 1 - base;
+
+	return base;
+}
+
+/**
+ * Pass an event to the client
+ *
+ * \param treebuilder  The treebuilder instance
+ * \param type         Type of event
+ * \param depth        Depth of event
+ * \param ns           Namespace of element
+ * \param name         Name of element, or the text
+ * \param len          Length of name, in bytes
+ * \param tag          Start tag of element, or NULL if not being opened by
+ *                     its start tag
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ */
+static hubbub_error event_emit(hubbub_treebuilder *treebuilder,
+		hubbub_event_type type, uint32_t depth, hubbub_ns ns,
+		const uint8_t *name, size_t len, const hubbub_tag *tag)
+{
+	hubbub_event event;
+
+	event.type = type;
+	event.depth = depth;
+	event.ns = ns;
+	event.name.ptr = name;
+	event.name.len = len;
+	event.n_attributes = tag != NULL ? tag->n_attributes : 0;
+	event.attributes = tag != NULL ? tag->attributes : NULL;
+	event.continued = (type == HUBBUB_EVENT_OPEN && tag == NULL);
+
+	return treebuilder->event_handler(&event, treebuilder->event_pw);
+}
+
+/**
+ * Ensure there is room for elements, and their names, to be reported open
+ *
+ * \param treebuilder  The treebuilder instance
+ * \param entries      Number of entries required, in all
+ * \param names        Bytes of names required, in all
+ * \return HUBBUB_OK on success, HUBBUB_NOMEM on memory exhaustion
+ */
+static hubbub_error event_reserve(hubbub_treebuilder *treebuilder,
+		uint32_t entries, size_t names)
+{
+	hubbub_treebuilder_context *ctx = &treebuilder->context;
+
+	if (entries > ctx->events.alloc) {
+		uint32_t alloc = ctx->events.alloc;
+		event_entry *temp;
+
+		if (alloc == 0)
+			alloc = ELEMENT_STACK_CHUNK;
+		while (alloc < entries)
+			alloc *= 2;
+
+		temp = treebuilder->alloc(ctx->events.stack,
+				alloc * sizeof(event_entry),
+				treebuilder->alloc_pw);
+		if (temp == NULL)
+			return HUBBUB_NOMEM;
+
+		ctx->events.stack = temp;
+		ctx->events.alloc = alloc;
+	}
+
+	if (names > ctx->events.names_alloc) {
+		size_t alloc = ctx->events.names_alloc;
+		uint8_t *temp;
+
+		if (alloc == 0)
+			alloc = TEXT_BUFFER_CHUNK;
+		while (alloc < names)
+			alloc *= 2;
+
+		temp = treebuilder->alloc(ctx->events.names, alloc,
+				treebuilder->alloc_pw);
+		if (temp == NULL)
+			return HUBBUB_NOMEM;
+
+		ctx->events.names = temp;
+		ctx->events.names_alloc = alloc;
+	}
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Report as closed the elements reported open above a depth
+ *
+ * \param treebuilder  The treebuilder instance
+ * \param depth        Number of elements to leave open
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ *
+ * The entries of the closed elements are left in place, beyond the end of
+ * the stack, so that their names may yet be found.
+ */
+static hubbub_error event_close_to(hubbub_treebuilder *treebuilder,
+		uint32_t depth)
+{
+	hubbub_treebuilder_context *ctx = &treebuilder->context;
+	hubbub_error error;
+
+	while (ctx->events.depth > depth) {
+		event_entry *entry = &ctx->events.stack[--ctx->events.depth];
+
+		error = event_emit(treebuilder, HUBBUB_EVENT_CLOSE,
+				ctx->events.depth, entry->ns,
+				ctx->events.names + entry->name,
+				entry->name_len, NULL);
+		if (error != HUBBUB_OK)
+			return error;
+	}
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Report the structure of the stack of open elements, if it has changed
+ *
+ * \param treebuilder  The treebuilder instance
+ * \param tag          Start tag of the current node, if it has just been
+ *                     inserted, or NULL
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ */
+hubbub_error event_sync(hubbub_treebuilder *treebuilder,
+		const hubbub_tag *tag)
+{
+	hubbub_treebuilder_context *ctx = &treebuilder->context;
+	element_context *stack = ctx->element_stack;
+	uint32_t count, base, same, old, k;
+	size_t names_kept, names_end;
+	hubbub_error error;
+
+	base = event_base(treebuilder, &count);
+
+	/* Find how much of what was reported is still open */
+	for (same = 0; same < count && same < ctx->events.depth; same++) {
+		if (ctx->events.stack[same].node != stack[base + same].node)
+			break;
+	}
+
+	if (same == count && same == ctx->events.depth)
+		return HUBBUB_OK;
+
+	old = ctx->events.depth;
+
+	error = event_close_to(treebuilder, same);
+	if (error != HUBBUB_OK)
+		return error;
+
+	names_kept = same > 0 ? ctx->events.stack[same - 1].name +
+			ctx->events.stack[same - 1].name_len : 0;
+	names_end = ctx->events.names_len;
+
+	/* Build the entries of the elements to open after those of the
+	 * elements just closed, so the names of the latter are to hand */
+	for (k = same; k < count; k++) {
+		element_context *element = &stack[base + k];
+		const hubbub_tag *opener = NULL;
+		event_entry *entry;
+		const uint8_t *name = NULL;
+		size_t len = 0, offset = 0;
+		uint32_t j;
+
+		for (j = same; j < old; j++) {
+			if (ctx->events.stack[j].node == element->node) {
+				offset = ctx->events.stack[j].name;
+				len = ctx->events.stack[j].name_len;
+				break;
+			}
+		}
+
+		if (j == old && k + 1 == count && tag != NULL) {
+			opener = tag;
+			name = tag->name.ptr;
+			len = tag->name.len;
+		} else if (j == old) {
+			name = (const uint8_t *) hubbub_element_type_to_name(
+					element->type);
+			len = strlen((const char *) name);
+		}
+
+		error = event_reserve(treebuilder, old + (k - same) + 1,
+				ctx->events.names_len + len);
+		if (error != HUBBUB_OK)
+			return error;
+
+		if (name == NULL)
+			name = ctx->events.names + offset;
+
+		entry = &ctx->events.stack[old + (k - same)];
+		entry->node = element->node;
+		entry->ns = element->ns;
+		entry->name = ctx->events.names_len - names_end + names_kept;
+		entry->name_len = len;
+
+		memmove(ctx->events.names + ctx->events.names_len, name, len);
+		ctx->events.names_len += len;
+
+		error = event_emit(treebuilder, HUBBUB_EVENT_OPEN, k,
+				element->ns, ctx->events.names +
+				ctx->events.names_len - len, len, opener);
+		if (error != HUBBUB_OK)
+			return error;
+	}
+
+	/* Then move them down, over the closed ones */
+	if (old > same) {
+		memmove(&ctx->events.stack[same], &ctx->events.stack[old],
+				(count - same) * sizeof(event_entry));
+	}
+	memmove(ctx->events.names + names_kept, ctx->events.names + names_end,
+			ctx->events.names_len - names_end);
+	ctx->events.names_len = names_kept + ctx->events.names_len -
+			names_end;
+	ctx->events.depth = count;
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Report an element which is opened and closed at once, as it never
+ * enters the stack of open elements
+ *
+ * \param treebuilder  The treebuilder instance
+ * \param tag          The element's start tag
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ */
+hubbub_error event_element(hubbub_treebuilder *treebuilder,
+		const hubbub_tag *tag)
+{
+	hubbub_error error;
+
+	error = event_sync(treebuilder, NULL);
+	if (error != HUBBUB_OK)
+		return error;
+
+	error = event_emit(treebuilder, HUBBUB_EVENT_OPEN,
+			treebuilder->context.events.depth, tag->ns,
+			tag->name.ptr, tag->name.len, tag);
+	if (error != HUBBUB_OK)
+		return error;
+
+	return event_emit(treebuilder, HUBBUB_EVENT_CLOSE,
+			treebuilder->context.events.depth, tag->ns,
+			tag->name.ptr, tag->name.len, NULL);
+}
+
+/**
+ * Report text
+ *
+ * \param treebuilder  The treebuilder instance
+ * \param parent       The node the text is to be appended to, or NULL if
+ *                     it is to be foster parented
+ * \param string       The text
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ */
+hubbub_error event_text(hubbub_treebuilder *treebuilder, void *parent,
+		const hubbub_string *string)
+{
+	hubbub_treebuilder_context *ctx = &treebuilder->context;
+	uint32_t depth;
+	hubbub_error error;
+
+	error = event_sync(treebuilder, NULL);
+	if (error != HUBBUB_OK)
+		return error;
+
+	/* Text goes in the innermost open element it was appended to. If
+	 * that isn't open (as when foster parenting), it goes where it was
+	 * found, in the current node. */
+	for (depth = ctx->events.depth; depth > 0; depth--) {
+		if (ctx->events.stack[depth - 1].node == parent)
+			break;
+	}
+	if (depth == 0)
+		depth = ctx->events.depth;
+
+	return event_emit(treebuilder, HUBBUB_EVENT_TEXT, depth,
+			HUBBUB_NS_HTML, string->ptr, string->len, NULL);
+}
+
+/**
+ * Report every open element as closed, at the end of the document
+ *
+ * \param treebuilder  The treebuilder instance
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ */
+hubbub_error event_close_all(hubbub_treebuilder *treebuilder)
+{
+	hubbub_error error;
+
+	error = event_sync(treebuilder, NULL);
+	if (error != HUBBUB_OK)
+		return error;
+
+	error = event_close_to(treebuilder, 0);
+
+	treebuilder->context.events.names_len = 0;
+
+	return error;
+}
+
+/**
+ * Release the structural event state
+ *
+ * \param treebuilder  The treebuilder instance
+ */
+void event_destroy(hubbub_treebuilder *treebuilder)
+{
+	hubbub_treebuilder_context *ctx = &treebuilder->context;
+
+	if (ctx->events.stack != NULL) {
+		treebuilder->alloc(ctx->events.stack, 0,
+				treebuilder->alloc_pw);
+		ctx->events.stack = NULL;
+	}
+
+	if (ctx->events.names != NULL) {
+		treebuilder->alloc(ctx->events.names, 0,
+				treebuilder->alloc_pw);
+		ctx->events.names = NULL;
+	}
+}
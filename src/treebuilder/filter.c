@@ -0,0 +1,444 @@
+/*
+ * This file is part of Hubbub.
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license.php
+ * Copyright 2026 agent <agent@local>
+ */
+
+#include <assert.h>
+#include <string.h>
+
+#include "treebuilder/modes.h"
+#include "treebuilder/internal.h"
+#include "treebuilder/treebuilder.h"
+#include "utils/utils.h"
+
+/*
+ * Element filtering
+ *
+ * An element the client asks to skip, and everything inserted into it, is
+ * represented by a node of our own. These take part in error recovery just
+ * like the client's nodes, but must never reach the client, so when the
+ * client's tree handler has a filter, the treebuilder is given a table of
+ * callbacks which pass on operations on the client's nodes, and perform
+ * those on our nodes here.
+ *
+ * Our nodes live in slabs, so can be told from the client's by address.
+ * They are reference counted, and reused once released.
+ */
+
+/** Number of nodes in a slab */
+#define SKIP_SLAB_SIZE 64
+
+/**
+ * A node standing in for a skipped element
+ */
+typedef struct skip_node {
+	uint32_t refs;			/**< Reference count */
+	struct skip_node *next;		/**< Next free node */
+} skip_node;
+
+/**
+ * Storage for skipped nodes
+ */
+typedef struct skip_slab {
+	struct skip_slab *next;		/**< Next slab */
+	skip_node nodes[SKIP_SLAB_SIZE];	/**< Nodes in this slab */
+} skip_slab;
+
+/**
+ * Determine if a node stands in for a skipped element
+ *
+ * \param treebuilder  The treebuilder instance
+ * \param node         The node to consider
+ * \return True if the node is ours, false if it is the client's
+ */
+bool filter_skipped(hubbub_treebuilder *treebuilder, const void *node)
+{
+	uintptr_t p = (uintptr_t) node;
+	skip_slab *slab;
+
+	if (treebuilder->tree_handler != &treebuilder->filter_handler)
+		return false;
+
+	for (slab = treebuilder->skip_slabs; slab != NULL; slab = slab->next) {
+		if (p >= (uintptr_t) &slab->nodes[0] &&
+				p < (uintptr_t) &slab->nodes[SKIP_SLAB_SIZE])
+			return true;
+	}
+
+	return false;
+}
+
+/**
+ * Make a node to stand in for a skipped element
+ *
+ * \param treebuilder  The treebuilder instance
+ * \param result       Pointer to location to receive node
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ *
+ * Postcondition: if successful, result's reference count is 1.
+ */
+hubbub_error filter_skip_node(hubbub_treebuilder *treebuilder, void **result)
+{
+	skip_node *node;
+
+	if (treebuilder->skip_free == NULL) {
+		skip_slab *slab;
+		uint32_t i;
+
+		slab = treebuilder->alloc(NULL, sizeof(skip_slab),
+				treebuilder->alloc_pw);
+		if (slab == NULL)
+			return HUBBUB_NOMEM;
+
+		for (i = 0; i < SKIP_SLAB_SIZE; i++) {
+			slab->nodes[i].refs = 0;
+			slab->nodes[i].next = i + 1 < SKIP_SLAB_SIZE
+					? &slab->nodes[i + 1] : NULL;
+		}
+
+		slab->next = treebuilder->skip_slabs;
+		treebuilder->skip_slabs = slab;
+		treebuilder->skip_free = &slab->nodes[0];
+	}
+
+	node = treebuilder->skip_free;
+	treebuilder->skip_free = node->next;
+
+	node->refs = 1;
+	node->next = NULL;
+
+	*result = node;
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Determine whether an element is to be skipped
+ *
+ * \param treebuilder  The treebuilder instance
+ * \param parent       The node the element is to be inserted into
+ * \param tag          The element's tag
+ * \param skip         Pointer to location to receive result
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ */
+hubbub_error filter_element(hubbub_treebuilder *treebuilder, void *parent,
+		const hubbub_tag *tag, bool *skip)
+{
+	element_type type = element_type_from_tag(tag);
+
+	/* Everything inside a skipped element is skipped */
+	if (filter_skipped(treebuilder, parent)) {
+		*skip = true;
+		return HUBBUB_OK;
+	}
+
+	*skip = false;
+
+	/* The structure of the document is always built */
+	if (tag->ns == HUBBUB_NS_HTML && (type == HTML || type == HEAD ||
+			type == BODY || type == FRAMESET))
+		return HUBBUB_OK;
+
+	return treebuilder->ext->skip_element(treebuilder->filter_inner->ctx,
+			tag, skip);
+}
+
+static hubbub_error filter_create_comment(void *ctx,
+		const hubbub_string *data, void **result)
+{
+	hubbub_tree_handler *inner =
+			((hubbub_treebuilder *) ctx)->filter_inner;
+
+	return inner->create_comment(inner->ctx, data, result);
+}
+
+static hubbub_error filter_create_doctype(void *ctx,
+		const hubbub_doctype *doctype, void **result)
+{
+	hubbub_tree_handler *inner =
+			((hubbub_treebuilder *) ctx)->filter_inner;
+
+	return inner->create_doctype(inner->ctx, doctype, result);
+}
+
+static hubbub_error filter_create_element(void *ctx, const hubbub_tag *tag,
+		void **result)
+{
+	hubbub_tree_handler *inner =
+			((hubbub_treebuilder *) ctx)->filter_inner;
+
+	return inner->create_element(inner->ctx, tag, result);
+}
+
+static hubbub_error filter_create_text(void *ctx, const hubbub_string *data,
+		void **result)
+{
+	hubbub_tree_handler *inner =
+			((hubbub_treebuilder *) ctx)->filter_inner;
+
+	return inner->create_text(inner->ctx, data, result);
+}
+
+static hubbub_error filter_ref_node(void *ctx, void *node)
+{
+	hubbub_treebuilder *treebuilder = (hubbub_treebuilder *) ctx;
+
+	if (filter_skipped(treebuilder, node)) {
+		((skip_node *) node)->refs++;
+		return HUBBUB_OK;
+	}
+
+	return treebuilder->filter_inner->ref_node(
+			treebuilder->filter_inner->ctx, node);
+}
+
+static hubbub_error filter_unref_node(void *ctx, void *node)
+{
+	hubbub_treebuilder *treebuilder = (hubbub_treebuilder *) ctx;
+
+	if (filter_skipped(treebuilder, node)) {
+		skip_node *skipped = (skip_node *) node;
+
+		assert(skipped->refs > 0);
+
+		if (--skipped->refs == 0) {
+			skipped->next = treebuilder->skip_free;
+			treebuilder->skip_free = skipped;
+		}
+
+		return HUBBUB_OK;
+	}
+
+	return treebuilder->filter_inner->unref_node(
+			treebuilder->filter_inner->ctx, node);
+}
+
+static hubbub_error filter_append_child(void *ctx, void *parent, void *child,
+		void **result)
+{
+	hubbub_treebuilder *treebuilder = (hubbub_treebuilder *) ctx;
+
+	if (filter_skipped(treebuilder, child)) {
+		*result = child;
+		return filter_ref_node(ctx, child);
+	}
+
+	/* A node put into a skipped element is skipped in its turn,
+	 * leaving the client's node untouched */
+	if (filter_skipped(treebuilder, parent))
+		return filter_skip_node(treebuilder, result);
+
+	return treebuilder->filter_inner->append_child(
+			treebuilder->filter_inner->ctx, parent, child, result);
+}
+
+static hubbub_error filter_insert_before(void *ctx, void *parent, void *child,
+		void *ref_child, void **result)
+{
+	hubbub_treebuilder *treebuilder = (hubbub_treebuilder *) ctx;
+
+	if (filter_skipped(treebuilder, child)) {
+		*result = child;
+		return filter_ref_node(ctx, child);
+	}
+
+	if (filter_skipped(treebuilder, parent) ||
+			filter_skipped(treebuilder, ref_child))
+		return filter_skip_node(treebuilder, result);
+
+	return treebuilder->filter_inner->insert_before(
+			treebuilder->filter_inner->ctx, parent, child,
+			ref_child, result);
+}
+
+static hubbub_error filter_remove_child(void *ctx, void *parent, void *child,
+		void **result)
+{
+	hubbub_treebuilder *treebuilder = (hubbub_treebuilder *) ctx;
+
+	if (filter_skipped(treebuilder, parent) ||
+			filter_skipped(treebuilder, child)) {
+		*result = child;
+		return filter_ref_node(ctx, child);
+	}
+
+	return treebuilder->filter_inner->remove_child(
+			treebuilder->filter_inner->ctx, parent, child, result);
+}
+
+static hubbub_error filter_clone_node(void *ctx, void *node, bool deep,
+		void **result)
+{
+	hubbub_treebuilder *treebuilder = (hubbub_treebuilder *) ctx;
+
+	if (filter_skipped(treebuilder, node))
+		return filter_skip_node(treebuilder, result);
+
+	return treebuilder->filter_inner->clone_node(
+			treebuilder->filter_inner->ctx, node, deep, result);
+}
+
+static hubbub_error filter_reparent_children(void *ctx, void *node,
+		void *new_parent)
+{
+	hubbub_treebuilder *treebuilder = (hubbub_treebuilder *) ctx;
+
+	if (filter_skipped(treebuilder, node) ||
+			filter_skipped(treebuilder, new_parent))
+		return HUBBUB_OK;
+
+	return treebuilder->filter_inner->reparent_children(
+			treebuilder->filter_inner->ctx, node, new_parent);
+}
+
+static hubbub_error filter_get_parent(void *ctx, void *node,
+		bool element_only, void **result)
+{
+	hubbub_treebuilder *treebuilder = (hubbub_treebuilder *) ctx;
+
+	if (filter_skipped(treebuilder, node)) {
+		*result = NULL;
+		return HUBBUB_OK;
+	}
+
+	return treebuilder->filter_inner->get_parent(
+			treebuilder->filter_inner->ctx, node,
+			element_only, result);
+}
+
+static hubbub_error filter_has_children(void *ctx, void *node, bool *result)
+{
+	hubbub_treebuilder *treebuilder = (hubbub_treebuilder *) ctx;
+
+	if (filter_skipped(treebuilder, node)) {
+		*result = false;
+		return HUBBUB_OK;
+	}
+
+	return treebuilder->filter_inner->has_children(
+			treebuilder->filter_inner->ctx, node, result);
+}
+
+static hubbub_error filter_form_associate(void *ctx, void *form, void *node)
+{
+	hubbub_treebuilder *treebuilder = (hubbub_treebuilder *) ctx;
+
+	if (filter_skipped(treebuilder, form) ||
+			filter_skipped(treebuilder, node))
+		return HUBBUB_OK;
+
+	return treebuilder->filter_inner->form_associate(
+			treebuilder->filter_inner->ctx, form, node);
+}
+
+static hubbub_error filter_add_attributes(void *ctx, void *node,
+		const hubbub_attribute *attributes, uint32_t n_attributes)
+{
+	hubbub_treebuilder *treebuilder = (hubbub_treebuilder *) ctx;
+
+	if (filter_skipped(treebuilder, node))
+		return HUBBUB_OK;
+
+	return treebuilder->filter_inner->add_attributes(
+			treebuilder->filter_inner->ctx, node,
+			attributes, n_attributes);
+}
+
+static hubbub_error filter_set_quirks_mode(void *ctx, hubbub_quirks_mode mode)
+{
+	hubbub_tree_handler *inner =
+			((hubbub_treebuilder *) ctx)->filter_inner;
+
+	return inner->set_quirks_mode(inner->ctx, mode);
+}
+
+static hubbub_error filter_encoding_change(void *ctx, const char *encname)
+{
+	hubbub_tree_handler *inner =
+			((hubbub_treebuilder *) ctx)->filter_inner;
+
+	return inner->encoding_change(inner->ctx, encname);
+}
+
+static hubbub_error filter_complete_script(void *ctx, void *script)
+{
+	hubbub_treebuilder *treebuilder = (hubbub_treebuilder *) ctx;
+
+	if (filter_skipped(treebuilder, script))
+		return HUBBUB_OK;
+
+	return treebuilder->filter_inner->complete_script(
+			treebuilder->filter_inner->ctx, script);
+}
+
+static hubbub_error filter_complete_style(void *ctx, void *style)
+{
+	hubbub_treebuilder *treebuilder = (hubbub_treebuilder *) ctx;
+
+	if (filter_skipped(treebuilder, style))
+		return HUBBUB_OK;
+
+	return treebuilder->filter_inner->complete_style(
+			treebuilder->filter_inner->ctx, style);
+}
+
+/**
+ * Interpose the filter between the treebuilder and the tree handler in use,
+ * if the client's extended callbacks have a filter
+ *
+ * \param treebuilder  The treebuilder instance
+ */
+void filter_select(hubbub_treebuilder *treebuilder)
+{
+	hubbub_tree_handler *filter = &treebuilder->filter_handler;
+	hubbub_tree_handler *inner = treebuilder->tree_handler;
+
+	if (inner == NULL || treebuilder->ext == NULL ||
+			treebuilder->ext->skip_element == NULL)
+		return;
+
+	filter->create_comment = filter_create_comment;
+	filter->create_doctype = filter_create_doctype;
+	filter->create_element = filter_create_element;
+	filter->create_text = filter_create_text;
+	filter->ref_node = filter_ref_node;
+	filter->unref_node = filter_unref_node;
+	filter->append_child = filter_append_child;
+	filter->insert_before = filter_insert_before;
+	filter->remove_child = filter_remove_child;
+	filter->clone_node = filter_clone_node;
+	filter->reparent_children = filter_reparent_children;
+	filter->get_parent = filter_get_parent;
+	filter->has_children = filter_has_children;
+	filter->form_associate = filter_form_associate;
+	filter->add_attributes = filter_add_attributes;
+	filter->set_quirks_mode = filter_set_quirks_mode;
+	filter->encoding_change = inner->encoding_change != NULL
+			? filter_encoding_change : NULL;
+	filter->complete_script = filter_complete_script;
+	filter->complete_style = filter_complete_style;
+	filter->ctx = treebuilder;
+
+	treebuilder->filter_inner = inner;
+	treebuilder->tree_handler = filter;
+}
+
+/**
+ * Release the storage for skipped nodes
+ *
+ * \param treebuilder  The treebuilder instance
+ */
+void filter_destroy(hubbub_treebuilder *treebuilder)
+{
+	skip_slab *slab, *next;
+
+	for (slab = treebuilder->skip_slabs; slab != NULL; slab = next) {
+		next = slab->next;
+		treebuilder->alloc(slab, 0, treebuilder->alloc_pw);
+	}
+
+	treebuilder->skip_slabs = NULL;
+	treebuilder->skip_free = NULL;
+}
@@ -55,8 +55,7 @@ hubbub_error handle_generic_rcdata(hubbub_treebuilder *treebuilder,
 		break;
 	case HUBBUB_TOKEN_END_TAG:
 	{
-		element_type type = element_type_from_name(treebuilder,
-				&token->data.tag.name);
+		element_type type = element_type_from_tag(&token->data.tag);
 
 		if (type != treebuilder->context.collect.type) {
 			/** \todo parse error */
@@ -11,17 +11,24 @@
 #include "treebuilder/modes.h"
 #include "treebuilder/internal.h"
 #include "treebuilder/treebuilder.h"
+#include "utils/scan.h"
 #include "utils/utils.h"
 
 #undef DEBUG_IN_BODY
 
+/** Maximum number of iterations of the adoption agency's outer loop */
+#define AA_OUTER_LIMIT 8
+/** Number of inner loop iterations for which formatting elements are
+ * cloned by the adoption agency */
+#define AA_INNER_LIMIT 3
+
 /**
  * Bookmark for formatting list. Used in adoption agency
+ *
+ * This is the index in the list at which an entry would be inserted
+ * while the formatting element's entry is still present.
  */
-typedef struct bookmark {
-	formatting_list_entry *prev;	/**< Previous entry */
-	formatting_list_entry *next;	/**< Next entry */
-} bookmark;
+typedef uint32_t bookmark;
 
 static hubbub_error process_character(hubbub_treebuilder *treebuilder,
 		const hubbub_token *token);
@@ -195,7 +202,6 @@ hubbub_error process_character(hubbub_treebuilder *treebuilder,
 	hubbub_error err = HUBBUB_OK;
 	hubbub_string dummy = token->data.character;
 	bool lr_flag = treebuilder->context.strip_leading_lr;
-	const uint8_t *p;
 
 	err = reconstruct_active_formatting_list(treebuilder);
 	if (err != HUBBUB_OK)
@@ -222,15 +228,10 @@ hubbub_error process_character(hubbub_treebuilder *treebuilder,
 		}
 	}
 
-	if (treebuilder->context.frameset_ok) {
-		for (p = dummy.ptr; p < dummy.ptr + dummy.len; p++) {
-			if (*p != 0x0009 && *p != 0x000a &&
-					*p != 0x000c && *p != 0x0020) {
-				treebuilder->context.frameset_ok = false;
-				break;
-			}
-		}
-	}
+	if (treebuilder->context.frameset_ok && token->whitespace == false &&
+			hubbub_scan_whitespace(dummy.ptr, dummy.len) !=
+					dummy.len)
+		treebuilder->context.frameset_ok = false;
 
 	return HUBBUB_OK;
 }
@@ -248,8 +249,7 @@ hubbub_error process_start_tag(hubbub_treebuilder *treebuilder,
 		const hubbub_token *token)
 {
 	hubbub_error err = HUBBUB_OK;
-	element_type type = element_type_from_name(treebuilder,
-			&token->data.tag.name);
+	element_type type = element_type_from_tag(&token->data.tag);
 
 	if (type == HTML) {
 		err = process_html_in_body(treebuilder, token);
@@ -417,8 +417,7 @@ hubbub_error process_end_tag(hubbub_treebuilder *treebuilder,
 		const hubbub_token *token)
 {
 	hubbub_error err = HUBBUB_OK;
-	element_type type = element_type_from_name(treebuilder,
-			&token->data.tag.name);
+	element_type type = element_type_from_tag(&token->data.tag);
 
 	if (type == BODY) {
 		err = process_0body_in_body(treebuilder);
@@ -488,6 +487,11 @@ hubbub_error process_html_in_body(hubbub_treebuilder *treebuilder,
 {
 	/** \todo parse error */
 
+	/* fragment case: the root is the client's node, rather than an
+	 * html element of the parser's making, so leave it alone */
+	if (treebuilder->context.fragment.active)
+		return HUBBUB_OK;
+
 	return treebuilder->tree_handler->add_attributes(
 			treebuilder->tree_handler->ctx,
 			treebuilder->context.element_stack[0].node,
@@ -778,13 +782,13 @@ hubbub_error process_a_in_body(hubbub_treebuilder *treebuilder,
 		entry2 = aa_find_formatting_element(treebuilder, A);
 
 		/* Remove from formatting list, if it's still there */
-		if (entry2 == entry && entry2->details.node == node) {
+		if (entry2 != NULL && entry2->details.node == node) {
 			hubbub_ns ons;
 			element_type otype;
 			void *onode;
 			uint32_t oindex;
 
-			err = formatting_list_remove(treebuilder, entry,
+			err = formatting_list_remove(treebuilder, entry2,
 					&ons, &otype, &onode, &oindex);
 			assert(err == HUBBUB_OK);
 
@@ -822,7 +826,7 @@ hubbub_error process_a_in_body(hubbub_treebuilder *treebuilder,
 		treebuilder->context.element_stack[
 		treebuilder->context.current_node].node);
 
-	err = formatting_list_append(treebuilder, token->data.tag.ns, A, 
+	err = formatting_list_append(treebuilder, &token->data.tag, A, 
 		treebuilder->context.element_stack[
 			treebuilder->context.current_node].node, 
 		treebuilder->context.current_node);
@@ -875,7 +879,7 @@ hubbub_error process_presentational_in_body(hubbub_treebuilder *treebuilder,
 		treebuilder->context.element_stack[
 		treebuilder->context.current_node].node);
 
-	err = formatting_list_append(treebuilder, token->data.tag.ns, type, 
+	err = formatting_list_append(treebuilder, &token->data.tag, type, 
 		treebuilder->context.element_stack[
 		treebuilder->context.current_node].node, 
 		treebuilder->context.current_node);
@@ -941,7 +945,7 @@ hubbub_error process_nobr_in_body(hubbub_treebuilder *treebuilder,
 		treebuilder->context.element_stack[
 		treebuilder->context.current_node].node);
 
-	err = formatting_list_append(treebuilder, token->data.tag.ns, NOBR, 
+	err = formatting_list_append(treebuilder, &token->data.tag, NOBR, 
 		treebuilder->context.element_stack[
 		treebuilder->context.current_node].node, 
 		treebuilder->context.current_node);
@@ -1002,7 +1006,7 @@ hubbub_error process_button_in_body(hubbub_treebuilder *treebuilder,
 		treebuilder->context.element_stack[
 		treebuilder->context.current_node].node);
 
-	err = formatting_list_append(treebuilder, token->data.tag.ns, BUTTON, 
+	err = formatting_list_append(treebuilder, &token->data.tag, BUTTON, 
 		treebuilder->context.element_stack[
 		treebuilder->context.current_node].node,
 		treebuilder->context.current_node);
@@ -1058,7 +1062,7 @@ hubbub_error process_applet_marquee_object_in_body(
 		treebuilder->context.element_stack[
 		treebuilder->context.current_node].node);
 
-	err = formatting_list_append(treebuilder, token->data.tag.ns, type, 
+	err = formatting_list_append(treebuilder, &token->data.tag, type, 
 		treebuilder->context.element_stack[
 		treebuilder->context.current_node].node, 
 		treebuilder->context.current_node);
@@ -1127,6 +1131,7 @@ hubbub_error process_image_in_body(hubbub_treebuilder *treebuilder,
 	tag.ns = HUBBUB_NS_HTML;
 	tag.name.ptr = (const uint8_t *) "img";
 	tag.name.len = SLEN("img");
+	tag.atom = HUBBUB_ATOM_IMG;
 
 	tag.n_attributes = token->data.tag.n_attributes;
 	tag.attributes = token->data.tag.attributes;
@@ -1187,10 +1192,12 @@ hubbub_error process_isindex_in_body(hubbub_treebuilder *treebuilder,
 		}
 
 		attrs[n_attrs].ns = HUBBUB_NS_HTML;
+		attrs[n_attrs].atom = HUBBUB_ATOM_NAME;
 		attrs[n_attrs].name.ptr = (const uint8_t *) "name";
 		attrs[n_attrs].name.len = SLEN("name");
 		attrs[n_attrs].value.ptr = (const uint8_t *) "isindex";
 		attrs[n_attrs].value.len = SLEN("isindex");
+		attrs[n_attrs].raw = false;
 		n_attrs++;
 	}
 
@@ -1203,6 +1210,7 @@ hubbub_error process_isindex_in_body(hubbub_treebuilder *treebuilder,
 	/* Act as if <form> were seen */
 	dummy.data.tag.name.ptr = (const uint8_t *) "form";
 	dummy.data.tag.name.len = SLEN("form");
+	dummy.data.tag.atom = HUBBUB_ATOM_FORM;
 
 	dummy.data.tag.n_attributes = action != NULL ? 1 : 0;
 	dummy.data.tag.attributes = action;
@@ -1216,6 +1224,7 @@ hubbub_error process_isindex_in_body(hubbub_treebuilder *treebuilder,
 	/* Act as if <hr> were seen */
 	dummy.data.tag.name.ptr = (const uint8_t *) "hr";
 	dummy.data.tag.name.len = SLEN("hr");
+	dummy.data.tag.atom = HUBBUB_ATOM_HR;
 	dummy.data.tag.n_attributes = 0;
 	dummy.data.tag.attributes = NULL;
 
@@ -1228,6 +1237,7 @@ hubbub_error process_isindex_in_body(hubbub_treebuilder *treebuilder,
 	/* Act as if <p> were seen */
 	dummy.data.tag.name.ptr = (const uint8_t *) "p";
 	dummy.data.tag.name.len = SLEN("p");
+	dummy.data.tag.atom = HUBBUB_ATOM_P;
 	dummy.data.tag.n_attributes = 0;
 	dummy.data.tag.attributes = NULL;
 
@@ -1240,6 +1250,7 @@ hubbub_error process_isindex_in_body(hubbub_treebuilder *treebuilder,
 	/* Act as if <label> were seen */
 	dummy.data.tag.name.ptr = (const uint8_t *) "label";
 	dummy.data.tag.name.len = SLEN("label");
+	dummy.data.tag.atom = HUBBUB_ATOM_LABEL;
 	dummy.data.tag.n_attributes = 0;
 	dummy.data.tag.attributes = NULL;
 
@@ -1251,6 +1262,7 @@ hubbub_error process_isindex_in_body(hubbub_treebuilder *treebuilder,
 
 	/* Act as if a stream of characters were seen */
 	dummy.type = HUBBUB_TOKEN_CHARACTER;
+	dummy.whitespace = false;
 	if (prompt != NULL) {
 		dummy.data.character = prompt->value;
 	} else {
@@ -1272,6 +1284,7 @@ hubbub_error process_isindex_in_body(hubbub_treebuilder *treebuilder,
 	dummy.data.tag.ns = HUBBUB_NS_HTML;
 	dummy.data.tag.name.ptr = (const uint8_t *) "input";
 	dummy.data.tag.name.len = SLEN("input");
+	dummy.data.tag.atom = HUBBUB_ATOM_INPUT;
 
 	dummy.data.tag.n_attributes = n_attrs;
 	dummy.data.tag.attributes = attrs;
@@ -1305,6 +1318,7 @@ hubbub_error process_isindex_in_body(hubbub_treebuilder *treebuilder,
 	/* Act as if <hr> was seen */
 	dummy.data.tag.name.ptr = (const uint8_t *) "hr";
 	dummy.data.tag.name.len = SLEN("hr");
+	dummy.data.tag.atom = HUBBUB_ATOM_HR;
 	dummy.data.tag.n_attributes = 0;
 	dummy.data.tag.attributes = NULL;
 
@@ -1554,6 +1568,7 @@ hubbub_error process_0p_in_body(hubbub_treebuilder *treebuilder)
 		dummy.data.tag.ns = HUBBUB_NS_HTML;
 		dummy.data.tag.name.ptr = (const uint8_t *) "p";
 		dummy.data.tag.name.len = SLEN("p");
+		dummy.data.tag.atom = HUBBUB_ATOM_P;
 		dummy.data.tag.n_attributes = 0;
 		dummy.data.tag.attributes = NULL;
 
@@ -1668,10 +1683,14 @@ hubbub_error process_0presentational_in_body(hubbub_treebuilder *treebuilder,
 		element_type type)
 {
 	hubbub_error err;
+	uint32_t outer;
 
 	/* Welcome to the adoption agency */
+	HUBBUB_STATS_ADD(treebuilder->stats, adoptions, 1);
 
-	while (true) {
+	/* Browsers give up after a fixed number of iterations, which bounds
+	 * the work done for a single end tag however the input is nested */
+	for (outer = 0; outer < AA_OUTER_LIMIT; outer++) {
 		element_context *stack = treebuilder->context.element_stack;
 
 		formatting_list_entry *entry;
@@ -1680,13 +1699,16 @@ hubbub_error process_0presentational_in_body(hubbub_treebuilder *treebuilder,
 		uint32_t furthest_block;
 		bookmark bookmark;
 		uint32_t last_node;
+		uint32_t child;
 		void *reparented;
+		void *parent;
 		void *fe_clone = NULL;
 		void *clone_appended = NULL;
 		hubbub_ns ons;
 		element_type otype;
 		void *onode;
 		uint32_t oindex;
+		formatting_attributes attributes;
 
 		/* 1 */
 		err = aa_find_and_validate_formatting_element(treebuilder,
@@ -1712,8 +1734,7 @@ hubbub_error process_0presentational_in_body(hubbub_treebuilder *treebuilder,
 		common_ancestor = formatting_element - 1;
 
 		/* 5 */
-		bookmark.prev = entry->prev;
-		bookmark.next = entry->next;
+		bookmark = entry - treebuilder->context.formatting_list + 1;
 
 		/* 6 */
 		err = aa_find_bookmark_location_reparenting_misnested(
@@ -1722,23 +1743,39 @@ hubbub_error process_0presentational_in_body(hubbub_treebuilder *treebuilder,
 		if (err != HUBBUB_OK)
 			return err;
 
+		/* Step 6 may have removed entries from the formatting list,
+		 * so find the formatting element's entry afresh */
+		entry = treebuilder->context.formatting_list;
+		while (entry->details.node != stack[formatting_element].node)
+			entry++;
+		assert(entry->details.type == type);
+
 		/* 7 */
 		if (stack[common_ancestor].type == TABLE ||
 				stack[common_ancestor].type == TBODY ||
 				stack[common_ancestor].type == TFOOT ||
 				stack[common_ancestor].type == THEAD ||
 				stack[common_ancestor].type == TR) {
+			err = remove_node_from_dom(treebuilder,
+					stack[last_node].node);
+			if (err != HUBBUB_OK)
+				return err;
+
 			err = aa_insert_into_foster_parent(treebuilder,
-					stack[last_node].node, &reparented);
+					stack[last_node].node, &reparented,
+					&parent);
 		} else {
+			parent = stack[common_ancestor].node;
+
 			err = aa_reparent_node(treebuilder, 
-					stack[last_node].node,
-					stack[common_ancestor].node,
+					stack[last_node].node, parent,
 					&reparented);
 		}
 		if (err != HUBBUB_OK)
 			return err;
 
+		element_stack_set_parent(treebuilder, last_node, parent);
+
 		treebuilder->tree_handler->unref_node(
 				treebuilder->tree_handler->ctx,
 				stack[last_node].node);
@@ -1747,10 +1784,15 @@ hubbub_error process_0presentational_in_body(hubbub_treebuilder *treebuilder,
 		 * previously using, then have it take the place of the other
 		 * one in the formatting list and stack. */
 		if (reparented != stack[last_node].node) {
-			struct formatting_list_entry *node_entry;
-			for (node_entry = treebuilder->context.formatting_list_end;
-					node_entry != NULL; 
-					node_entry = node_entry->prev) {
+			formatting_list_entry *list =
+					treebuilder->context.formatting_list;
+			uint32_t n;
+
+			for (n = treebuilder->context.formatting_list_len;
+					n > 0; n--) {
+				formatting_list_entry *node_entry =
+						&list[n - 1];
+
 				if (node_entry->stack_index == last_node) {
 					treebuilder->tree_handler->ref_node(
 						treebuilder->tree_handler->ctx,
@@ -1824,8 +1866,29 @@ hubbub_error process_0presentational_in_body(hubbub_treebuilder *treebuilder,
 		 * we insert an entry for clone */
 		stack[furthest_block + 1].type = entry->details.type;
 		stack[furthest_block + 1].node = clone_appended;
+		element_stack_set_parent(treebuilder, furthest_block + 1,
+				stack[furthest_block].node);
+
+		/* Children of furthest block now belong to the clone */
+		for (child = furthest_block + 2;
+				child <= treebuilder->context.current_node;
+				child++) {
+			if (element_stack_parent(treebuilder, child) ==
+					stack[furthest_block].node) {
+				element_stack_set_parent(treebuilder, child,
+						clone_appended);
+			}
+		}
+
+		element_stack_link(treebuilder, formatting_element);
 
 		/* 11 */
+		if (bookmark > (uint32_t) (entry -
+				treebuilder->context.formatting_list))
+			bookmark--;
+
+		attributes = entry->attributes;
+
 		err = formatting_list_remove(treebuilder, entry,
 				&ons, &otype, &onode, &oindex);
 		assert(err == HUBBUB_OK);
@@ -1833,9 +1896,9 @@ hubbub_error process_0presentational_in_body(hubbub_treebuilder *treebuilder,
 		treebuilder->tree_handler->unref_node(
 				treebuilder->tree_handler->ctx,	onode);
 
-		err = formatting_list_insert(treebuilder,
-				bookmark.prev, bookmark.next,
-				ons, otype, clone_appended, furthest_block + 1);
+		err = formatting_list_insert(treebuilder, bookmark,
+				ons, otype, clone_appended, furthest_block + 1,
+				&attributes);
 		if (err != HUBBUB_OK) {
 			treebuilder->tree_handler->unref_node(
 					treebuilder->tree_handler->ctx,
@@ -1845,6 +1908,8 @@ hubbub_error process_0presentational_in_body(hubbub_treebuilder *treebuilder,
 
 		/* 13 */
 	}
+
+	return HUBBUB_OK;
 }
 
 /**
@@ -1909,21 +1974,21 @@ formatting_list_entry *aa_find_formatting_element(
 		hubbub_treebuilder *treebuilder, element_type type)
 {
 	formatting_list_entry *entry;
+	uint32_t n;
 
-	for (entry = treebuilder->context.formatting_list_end;
-			entry != NULL; entry = entry->prev) {
+	for (n = treebuilder->context.formatting_list_len; n > 0; n--) {
+		entry = &treebuilder->context.formatting_list[n - 1];
 
 		/* Assumption: HTML and TABLE elements are not in the list */
-		if (is_scoping_element(entry->details.type) ||
-				entry->details.type == type)
+		if (is_scoping_element(entry->details.type))
 			break;
-	}
 
-	/* Check if we stopped on a marker, rather than a formatting element */
-	if (entry != NULL && is_scoping_element(entry->details.type))
-		entry = NULL;
+		if (entry->details.type == type)
+			return entry;
+	}
 
-	return entry;
+	/* Stopped on a marker, or ran out of list */
+	return NULL;
 }
 
 /**
@@ -2020,23 +2085,50 @@ hubbub_error aa_find_bookmark_location_reparenting_misnested(
 {
 	hubbub_error err;
 	element_context *stack = treebuilder->context.element_stack;
+	formatting_list_entry *list = treebuilder->context.formatting_list;
 	uint32_t node, last, fb;
 	formatting_list_entry *node_entry;
+	uint32_t n, inner = 0;
 
 	node = last = fb = *furthest_block;
 
 	while (true) {
 		void *reparented;
 
+		inner++;
+
 		/* i */
 		node--;
 
 		/* ii */
-		for (node_entry = treebuilder->context.formatting_list_end;
-				node_entry != NULL;
-				node_entry = node_entry->prev) {
-			if (node_entry->stack_index == node)
+		node_entry = NULL;
+		for (n = treebuilder->context.formatting_list_len; n > 0; n--) {
+			if (list[n - 1].stack_index == node) {
+				node_entry = &list[n - 1];
 				break;
+			}
+		}
+
+		/* Past the inner limit, formatting elements are no longer
+		 * cloned: they are dropped from the list, and so from the
+		 * stack below */
+		if (inner > AA_INNER_LIMIT && node_entry != NULL &&
+				node != formatting_element) {
+			hubbub_ns ns;
+			element_type type;
+			void *onode;
+			uint32_t index;
+
+			if ((uint32_t) (node_entry - list) < *bookmark)
+				(*bookmark)--;
+
+			formatting_list_remove(treebuilder, node_entry,
+					&ns, &type, &onode, &index);
+
+			treebuilder->tree_handler->unref_node(
+					treebuilder->tree_handler->ctx, onode);
+
+			node_entry = NULL;
 		}
 
 		/* Node is not in list of active formatting elements */
@@ -2053,6 +2145,8 @@ hubbub_error aa_find_bookmark_location_reparenting_misnested(
 			/* Fixup the current_node index */
 			treebuilder->context.current_node--;
 
+			element_stack_link(treebuilder, node);
+
 			/* Back to i */
 			continue;
 		}
@@ -2062,10 +2156,8 @@ hubbub_error aa_find_bookmark_location_reparenting_misnested(
 			break;
 
 		/* iv */
-		if (last == fb) {
-			bookmark->prev = node_entry;
-			bookmark->next = node_entry->next;
-		}
+		if (last == fb)
+			*bookmark = node_entry - list + 1;
 
 		/* v */
 		err = aa_clone_and_replace_entries(treebuilder, node_entry);
@@ -2078,6 +2170,8 @@ hubbub_error aa_find_bookmark_location_reparenting_misnested(
 		if (err != HUBBUB_OK)
 			return err;
 
+		element_stack_set_parent(treebuilder, last, stack[node].node);
+
 		treebuilder->tree_handler->unref_node(
 				treebuilder->tree_handler->ctx,
 				stack[last].node);
@@ -2086,10 +2180,10 @@ hubbub_error aa_find_bookmark_location_reparenting_misnested(
 		 * previously using, then have it take the place of the other
 		 * one in the formatting list and stack. */
 		if (reparented != stack[last].node) {
-			for (node_entry = 
-				treebuilder->context.formatting_list_end;
-					node_entry != NULL; 
-					node_entry = node_entry->prev) {
+			for (n = treebuilder->context.formatting_list_len;
+					n > 0; n--) {
+				node_entry = &list[n - 1];
+
 				if (node_entry->stack_index == last) {
 					treebuilder->tree_handler->ref_node(
 						treebuilder->tree_handler->ctx,
@@ -2137,30 +2231,23 @@ hubbub_error aa_remove_element_stack_item(hubbub_treebuilder *treebuilder,
 	assert(index < limit);
 	assert(limit <= treebuilder->context.current_node);
 
-	/* First, scan over subsequent entries in the stack,
-	 * searching for them in the list of active formatting
-	 * entries. If found, update the corresponding
-	 * formatting list entry's stack index to match the
-	 * new stack location */
-	for (n = index + 1; n <= limit; n++) {
-		if (is_formatting_element(stack[n].type) ||
-				(is_scoping_element(stack[n].type) &&
-				stack[n].type != HTML &&
-				stack[n].type != TABLE)) {
-			formatting_list_entry *e;
-
-			for (e = treebuilder->context.formatting_list_end;
-					e != NULL; e = e->prev) {
-				if (e->stack_index == n)
-					e->stack_index--;
-			}
-		}
+	/* First, update the stack index of any formatting list entry
+	 * for a subsequent entry in the stack to match its new location */
+	for (n = 0; n < treebuilder->context.formatting_list_len; n++) {
+		formatting_list_entry *entry =
+				&treebuilder->context.formatting_list[n];
+
+		if (entry->stack_index > index && entry->stack_index <= limit)
+			entry->stack_index--;
 	}
 
 	/* Reduce node's reference count */
 	treebuilder->tree_handler->unref_node(treebuilder->tree_handler->ctx,
 					stack[index].node);
 
+	/* The caller relinks the stack once it has finished with it */
+	element_stack_unlink(treebuilder, index);
+
 	/* Now, shuffle the stack up one, removing node in the process */
 	memmove(&stack[index], &stack[index + 1],
 			(limit - index) * sizeof(element_context));
@@ -2204,8 +2291,9 @@ hubbub_error aa_clone_and_replace_entries(hubbub_treebuilder *treebuilder,
 	treebuilder->tree_handler->ref_node(treebuilder->tree_handler->ctx,
 			clone);
 
-	/* Replace node's stack entry with clone */
+	/* Replace node's stack entry with clone, which has no parent yet */
 	treebuilder->context.element_stack[element->stack_index].node = clone;
+	treebuilder->context.element_stack[element->stack_index].parent = NULL;
 
 	treebuilder->tree_handler->unref_node(treebuilder->tree_handler->ctx,
 			onode);
@@ -2217,55 +2305,54 @@ hubbub_error aa_clone_and_replace_entries(hubbub_treebuilder *treebuilder,
  * Adoption agency: locate foster parent and insert node into it
  *
  * \param treebuilder  The treebuilder instance
- * \param node         The node to insert
+ * \param node         The node to insert, which must not be in the DOM
  * \param inserted     Pointer to location to receive inserted node
+ * \param parent       Pointer to location to receive foster parent, or NULL
  * \return HUBBUB_OK on success, appropriate error otherwise
  */
 hubbub_error aa_insert_into_foster_parent(hubbub_treebuilder *treebuilder, 
-		void *node, void **inserted)
+		void *node, void **inserted, void **parent)
 {
 	hubbub_error err;
 	element_context *stack = treebuilder->context.element_stack;
 	void *foster_parent = NULL;
 	bool insert = false;
+	bool referenced = false;
 
 	uint32_t cur_table = current_table(treebuilder);
 
+	err = flush_text(treebuilder);
+	if (err != HUBBUB_OK)
+		return err;
+
 	stack[cur_table].tainted = true;
 
 	if (cur_table == 0) {
-		treebuilder->tree_handler->ref_node(
-				treebuilder->tree_handler->ctx,
-				stack[0].node);
-
 		foster_parent = stack[0].node;
 	} else {
-		void *t_parent = NULL;
+		void *t_parent = element_stack_parent(treebuilder, cur_table);
 
-		treebuilder->tree_handler->get_parent(
-			treebuilder->tree_handler->ctx,
-			stack[cur_table].node,
-			true, &t_parent);
+		/* Ask the client, and remember the answer until the table
+		 * is popped or moved, or the client has changed the tree */
+		if (t_parent == NULL) {
+			treebuilder->tree_handler->get_parent(
+				treebuilder->tree_handler->ctx,
+				stack[cur_table].node,
+				true, &t_parent);
+
+			element_stack_set_parent(treebuilder, cur_table,
+					t_parent);
+			referenced = (t_parent != NULL);
+		}
 
 		if (t_parent != NULL) {
 			foster_parent = t_parent;
 			insert = true;
 		} else {
-			treebuilder->tree_handler->ref_node(
-					treebuilder->tree_handler->ctx,
-					stack[cur_table - 1].node);
 			foster_parent = stack[cur_table - 1].node;
 		}
 	}
 
-	err = remove_node_from_dom(treebuilder, node);
-	if (err != HUBBUB_OK) {
-		treebuilder->tree_handler->unref_node(
-				treebuilder->tree_handler->ctx,
-				foster_parent);
-		return err;
-	}
-
 	if (insert) {
 		err = treebuilder->tree_handler->insert_before(
 				treebuilder->tree_handler->ctx,
@@ -2278,15 +2365,20 @@ hubbub_error aa_insert_into_foster_parent(hubbub_treebuilder *treebuilder,
 				foster_parent, node,
 				inserted);
 	}
-	if (err != HUBBUB_OK) {
+
+	if (referenced) {
 		treebuilder->tree_handler->unref_node(
 				treebuilder->tree_handler->ctx,
 				foster_parent);
-		return err;
 	}
 
-	treebuilder->tree_handler->unref_node(treebuilder->tree_handler->ctx,
-			foster_parent);
+	if (err != HUBBUB_OK)
+		return err;
+
+	HUBBUB_STATS_ADD(treebuilder->stats, foster_parented, 1);
+
+	if (parent != NULL)
+		*parent = foster_parent;
 
 	return HUBBUB_OK;
 }
@@ -2349,6 +2441,7 @@ hubbub_error process_0br_in_body(hubbub_treebuilder *treebuilder)
 	tag.ns = HUBBUB_NS_HTML;
 	tag.name.ptr = (const uint8_t *) "br";
 	tag.name.len = SLEN("br");
+	tag.atom = HUBBUB_ATOM_BR;
 
 	tag.n_attributes = 0;
 	tag.attributes = NULL;
@@ -30,8 +30,7 @@ hubbub_error handle_in_caption(hubbub_treebuilder *treebuilder,
 	switch (token->type) {
 	case HUBBUB_TOKEN_START_TAG:
 	{
-		element_type type = element_type_from_name(treebuilder,
-				&token->data.tag.name);
+		element_type type = element_type_from_tag(&token->data.tag);
 
 		if (type == CAPTION || type == COL || type == COLGROUP ||
 				type == TBODY || type == TD || type == TFOOT ||
@@ -46,8 +45,7 @@ hubbub_error handle_in_caption(hubbub_treebuilder *treebuilder,
 		break;
 	case HUBBUB_TOKEN_END_TAG:
 	{
-		element_type type = element_type_from_name(treebuilder,
-				&token->data.tag.name);
+		element_type type = element_type_from_tag(&token->data.tag);
 
 		if (type == CAPTION) {
 			handled = true;
@@ -80,7 +78,11 @@ hubbub_error handle_in_caption(hubbub_treebuilder *treebuilder,
 		element_type otype = UNKNOWN;
 		void *node;
 
-		/** \todo fragment case */
+		/* fragment case */
+		if (element_in_scope(treebuilder, CAPTION, true) == 0) {
+			/** \todo parse error */
+			return HUBBUB_OK;
+		}
 
 		close_implied_end_tags(treebuilder, UNKNOWN);
 
@@ -68,16 +68,21 @@ hubbub_error handle_in_cell(hubbub_treebuilder *treebuilder,
 	switch (token->type) {
 	case HUBBUB_TOKEN_START_TAG:
 	{
-		element_type type = element_type_from_name(treebuilder,
-				&token->data.tag.name);
+		element_type type = element_type_from_tag(&token->data.tag);
 
 		if (type == CAPTION || type == COL ||
 				type == COLGROUP || type == TBODY || 
 				type == TD || type == TFOOT || type == TH || 
 				type == THEAD || type == TR) {
-			/** \todo fragment case */
-			close_cell(treebuilder);
-			err = HUBBUB_REPROCESS;
+			if (element_in_scope(treebuilder, TD, true) ||
+					element_in_scope(treebuilder,
+							TH, true)) {
+				close_cell(treebuilder);
+				err = HUBBUB_REPROCESS;
+			} else {
+				/** \todo parse error */
+				/* fragment case: ignore the token */
+			}
 		} else {
 			err = handle_in_body(treebuilder, token);
 		}
@@ -85,8 +90,7 @@ hubbub_error handle_in_cell(hubbub_treebuilder *treebuilder,
 		break;
 	case HUBBUB_TOKEN_END_TAG:
 	{
-		element_type type = element_type_from_name(treebuilder,
-				&token->data.tag.name);
+		element_type type = element_type_from_tag(&token->data.tag);
 
 		if (type == TH || type == TD) {
 			if (element_in_scope(treebuilder, type, true)) {
@@ -42,8 +42,7 @@ hubbub_error handle_in_column_group(hubbub_treebuilder *treebuilder,
 		break;
 	case HUBBUB_TOKEN_START_TAG:
 	{
-		element_type type = element_type_from_name(treebuilder,
-				&token->data.tag.name);
+		element_type type = element_type_from_tag(&token->data.tag);
 
 		if (type == HTML) {
 			/* Process as if "in body" */
@@ -60,11 +59,9 @@ hubbub_error handle_in_column_group(hubbub_treebuilder *treebuilder,
 		break;
 	case HUBBUB_TOKEN_END_TAG:
 	{
-		element_type type = element_type_from_name(treebuilder,
-				&token->data.tag.name);
+		element_type type = element_type_from_tag(&token->data.tag);
 
 		if (type == COLGROUP) {
-			/** \todo fragment case */
 			handled = true;
 		} else if (type == COL) {
 			/** \todo parse error */
@@ -74,7 +71,6 @@ hubbub_error handle_in_column_group(hubbub_treebuilder *treebuilder,
 	}
 		break;
 	case HUBBUB_TOKEN_EOF:
-		/** \todo fragment case */
 		err = HUBBUB_REPROCESS;
 		break;
 	}
@@ -84,6 +80,13 @@ hubbub_error handle_in_column_group(hubbub_treebuilder *treebuilder,
 		element_type otype;
 		void *node;
 
+		/* fragment case: the current node is the root, which is
+		 * never popped, so ignore the token (or, at EOF, stop) */
+		if (treebuilder->context.current_node == 0) {
+			/** \todo parse error, unless at EOF */
+			return HUBBUB_OK;
+		}
+
 		/* Pop the current node (which will be a colgroup) */
 		element_stack_pop(treebuilder, &ns, &otype, &node);
 
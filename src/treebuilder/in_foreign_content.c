@@ -17,124 +17,6 @@
 
 /*** Attribute-correction stuff ***/
 
-#define S(s)		s, SLEN(s)
-
-/**
- * Mapping table for case changes
- */
-typedef struct
-{
-	const char *attr;	/**< Lower case attribute name */
-	size_t len;		/**< Length of name in bytes */
-	const char *proper;	/**< Correctly cased version */
-} case_changes;
-
-static const case_changes svg_attributes[] = {
-	{ S("attributename"),		"attributeName" },
-	{ S("attributetype"),		"attributeType" },
-	{ S("basefrequency"),		"baseFrequency" },
-	{ S("baseprofile"),		"baseProfile" },
-	{ S("calcmode"),		"calcMode" },
-	{ S("clippathunits"),		"clipPathUnits" },
-	{ S("contentscripttype"),	"contentScriptType" },
-	{ S("contentstyletype"),	"contentStyleType" },
-	{ S("diffuseconstant"),		"diffuseConstant" },
-	{ S("edgemode"),		"edgeMode" },
-	{ S("externalresourcesrequired"),	"externalResourcesRequired" },
-	{ S("filterres"),		"filterRes" },
-	{ S("filterunits"),		"filterUnits" },
-	{ S("glyphref"),		"glyphRef" },
-	{ S("gradienttransform"),	"gradientTransform" },
-	{ S("gradientunits"),		"gradientUnits" },
-	{ S("kernelmatrix"),		"kernelMatrix" },
-	{ S("kernelunitlength"),	"kernelUnitLength" },
-	{ S("keypoints"),		"keyPoints" },
-	{ S("keysplines"),		"keySplines" },
-	{ S("keytimes"),		"keyTimes" },
-	{ S("lengthadjust"),		"lengthAdjust" },
-	{ S("limitingconeangle"),	"limitingConeAngle" },
-	{ S("markerheight"),		"markerHeight" },
-	{ S("markerunits"),		"markerUnits" },
-	{ S("markerwidth"),		"markerWidth" },
-	{ S("maskcontentunits"),	"maskContentUnits" },
-	{ S("maskunits"),		"maskUnits" },
-	{ S("numoctaves"),		"numOctaves" },
-	{ S("pathlength"),		"pathLength" },
-	{ S("patterncontentunits"),	"patternContentUnits" },
-	{ S("patterntransform"),	"patternTransform" },
-	{ S("patternunits"),		"patternUnits" },
-	{ S("pointsatx"),		"pointsAtX" },
-	{ S("pointsaty"),		"pointsAtY" },
-	{ S("pointsatz"),		"pointsAtZ" },
-	{ S("preservealpha"),		"preserveAlpha" },
-	{ S("preserveaspectratio"),	"preserveAspectRatio" },
-	{ S("primitiveunits"),		"primitiveUnits" },
-	{ S("refx"),			"refX" },
-	{ S("refy"),			"refY" },
-	{ S("repeatcount"),		"repeatCount" },
-	{ S("repeatdur"),		"repeatDur" },
-	{ S("requiredextensions"),	"requiredExtensions" },
-	{ S("requiredfeatures"),	"requiredFeatures" },
-	{ S("specularconstant"),	"specularConstant" },
-	{ S("specularexponent"),	"specularExponent" },
-	{ S("spreadmethod"),		"spreadMethod" },
-	{ S("startoffset"),		"startOffset" },
-	{ S("stddeviation"),		"stdDeviation" },
-	{ S("stitchtiles"),		"stitchTiles" },
-	{ S("surfacescale"),		"surfaceScale" },
-	{ S("systemlanguage"),		"systemLanguage" },
-	{ S("tablevalues"),		"tableValues" },
-	{ S("targetx"),			"targetX" },
-	{ S("targety"),			"targetY" },
-	{ S("textlength"),		"textLength" },
-	{ S("viewbox"),			"viewBox" },
-	{ S("viewtarget"),		"viewTarget" },
-	{ S("xchannelselector"),	"xChannelSelector" },
-	{ S("ychannelselector"),	"yChannelSelector" },
-	{ S("zoomandpan"),		"zoomAndPan" },
-};
-
-static const case_changes svg_tagnames[] = {
-	{ S("altglyph"),		"altGlyph" },
-	{ S("altglyphdef"),		"altGlyphDef" },
-	{ S("altglyphitem"),		"altGlyphItem" },
-	{ S("animatecolor"),		"animateColor" },
-	{ S("animatemotion"),		"animateMotion" },
-	{ S("animatetransform"),	"animateTransform" },
-	{ S("clippath"),		"clipPath" },
-	{ S("feblend"),			"feBlend" },
-	{ S("fecolormatrix"),		"feColorMatrix" },
-	{ S("fecomponenttransfer"),	"feComponentTransfer" },
-	{ S("fecomposite"),		"feComposite" },
-	{ S("feconvolvematrix"),	"feConvolveMatrix" },
-	{ S("fediffuselighting"),	"feDiffuseLighting" },
-	{ S("fedisplacementmap"),	"feDisplacementMap" },
-	{ S("fedistantlight"),		"feDistantLight" },
-	{ S("feflood"),			"feFlood" },
-	{ S("fefunca"),			"feFuncA" },
-	{ S("fefuncb"),			"feFuncB" },
-	{ S("fefuncg"),			"feFuncG" },
-	{ S("fefuncr"),			"feFuncR" },
-	{ S("fegaussianblur"),		"feGaussianBlur" },
-	{ S("feimage"),			"feImage" },
-	{ S("femerge"),			"feMerge" },
-	{ S("femergenode"),		"feMergeNode" },
-	{ S("femorphology"),		"feMorphology" },
-	{ S("feoffset"),		"feOffset" },
-	{ S("fepointlight"),		"fePointLight" },
-	{ S("fespecularlighting"),	"feSpecularLighting" },
-	{ S("fespotlight"),		"feSpotLight" },
-	{ S("fetile"),			"feTile" },
-	{ S("feturbulence"),		"feTurbulence" },
-	{ S("foreignobject"),		"foreignObject" },
-	{ S("glyphref"),		"glyphRef" },
-	{ S("lineargradient"),		"linearGradient" },
-	{ S("radialgradient"),		"radialGradient" },
-	{ S("textpath"),		"textPath" },
-};
-
-#undef S
-
 /**
  * Adjust MathML attributes
  *
@@ -156,6 +38,7 @@ void adjust_mathml_attributes(hubbub_treebuilder *treebuilder,
 				(const uint8_t *) "definitionurl", 
 				SLEN("definitionurl"))) {
 			attr->name.ptr = (uint8_t *) "definitionURL";
+			attr->atom = HUBBUB_ATOM_NONE;
 		}
 	}
 }
@@ -175,17 +58,13 @@ void adjust_svg_attributes(hubbub_treebuilder *treebuilder,
 	for (i = 0; i < tag->n_attributes; i++) {
 		hubbub_attribute *attr = &tag->attributes[i];
 
-		const uint8_t *name = attr->name.ptr;
-		size_t len = attr->name.len;
-		size_t j;
-
-		for (j = 0; j < N_ELEMENTS(svg_attributes); j++) {
-			if (hubbub_string_match(name, len,
-					(uint8_t *) svg_attributes[j].attr,
-					svg_attributes[j].len)) {
-				attr->name.ptr =
-					(uint8_t *) svg_attributes[j].proper;
-			}
+		const char *proper = svg_attribute_lookup(attr->name.ptr,
+				attr->name.len);
+
+		/* The proper names are in mixed case, so have no atoms */
+		if (proper != NULL) {
+			attr->name.ptr = (const uint8_t *) proper;
+			attr->atom = HUBBUB_ATOM_NONE;
 		}
 	}
 }
@@ -199,18 +78,14 @@ void adjust_svg_attributes(hubbub_treebuilder *treebuilder,
 void adjust_svg_tagname(hubbub_treebuilder *treebuilder,
 		hubbub_tag *tag)
 {
-	const uint8_t *name = tag->name.ptr;
-	size_t len = tag->name.len;
-	size_t i;
+	const char *proper = svg_tagname_lookup(tag->name.ptr,
+			tag->name.len);
 
 	UNUSED(treebuilder);
 
-	for (i = 0; i < N_ELEMENTS(svg_tagnames); i++) {
-		if (hubbub_string_match(name, len,
-				(uint8_t *) svg_tagnames[i].attr,
-				svg_tagnames[i].len)) {
-			tag->name.ptr =	(uint8_t *) svg_tagnames[i].proper;
-		}
+	if (proper != NULL) {
+		tag->name.ptr = (const uint8_t *) proper;
+		tag->atom = HUBBUB_ATOM_NONE;
 	}
 }
 
@@ -257,6 +132,8 @@ void adjust_foreign_attributes(hubbub_treebuilder *treebuilder,
 				attr->ns = HUBBUB_NS_XLINK;
 				attr->name.ptr += 6;
 				attr->name.len -= 6;
+				attr->atom = hubbub_atom_find(attr->name.ptr,
+						attr->name.len);
 			}
 		/* 8 == strlen("xml:base") */
 		} else if (attr->name.len >= 8 &&
@@ -273,6 +150,8 @@ void adjust_foreign_attributes(hubbub_treebuilder *treebuilder,
 				attr->ns = HUBBUB_NS_XML;
 				attr->name.ptr += 4;
 				attr->name.len -= 4;
+				attr->atom = hubbub_atom_find(attr->name.ptr,
+						attr->name.len);
 			}
 		} else if (hubbub_string_match(name, attr->name.len,
 						S("xmlns"))) {
@@ -282,6 +161,8 @@ void adjust_foreign_attributes(hubbub_treebuilder *treebuilder,
 			attr->ns = HUBBUB_NS_XMLNS;
 			attr->name.ptr += 6;
 			attr->name.len -= 6;
+			attr->atom = hubbub_atom_find(attr->name.ptr,
+					attr->name.len);
 		}
 
 	}
@@ -410,8 +291,7 @@ hubbub_error handle_in_foreign_content(hubbub_treebuilder *treebuilder,
 				treebuilder->context.current_node].ns;
 
 		element_type cur_node = current_node(treebuilder);
-		element_type type = element_type_from_name(treebuilder,
-				&token->data.tag.name);
+		element_type type = element_type_from_tag(&token->data.tag);
 
 		if (cur_node_ns == HUBBUB_NS_HTML ||
 			(cur_node_ns == HUBBUB_NS_MATHML &&
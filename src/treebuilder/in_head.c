@@ -29,7 +29,6 @@
 static hubbub_error process_meta_in_head(hubbub_treebuilder *treebuilder,
 		const hubbub_token *token)
 {
-	static uint16_t utf16, utf16be, utf16le;
 	uint16_t charset_enc = 0;
 	uint16_t content_type_enc = 0;
 	size_t i;
@@ -41,20 +40,10 @@ static hubbub_error process_meta_in_head(hubbub_treebuilder *treebuilder,
 
 	/** \todo ack sc flag */
 
-	if (treebuilder->tree_handler->encoding_change == NULL)
+	if (treebuilder->tree_handler->encoding_change == NULL &&
+			treebuilder->charset_handler == NULL)
 		return err;
 
-	/* Grab UTF-16 MIBenums */
-	if (utf16 == 0) {
-		utf16 = parserutils_charset_mibenum_from_name(
-				"utf-16", SLEN("utf-16"));
-		utf16be = parserutils_charset_mibenum_from_name(
-				"utf-16be", SLEN("utf-16be"));
-		utf16le = parserutils_charset_mibenum_from_name(
-				"utf-16le", SLEN("utf-16le"));
-		assert(utf16 != 0 && utf16be != 0 && utf16le != 0);
-	}
-
 	for (i = 0; i < token->data.tag.n_attributes; i++) {
 		hubbub_attribute *attr = &token->data.tag.attributes[i];
 
@@ -79,10 +68,20 @@ static hubbub_error process_meta_in_head(hubbub_treebuilder *treebuilder,
 		charset_enc = content_type_enc;
 
 	if (charset_enc != 0) {
+		uint16_t utf16, utf16be, utf16le;
 		const char *name;
 
 		hubbub_charset_fix_charset(&charset_enc);
 
+		/* Looked up each time, as parsers may be on many threads */
+		utf16 = parserutils_charset_mibenum_from_name(
+				"utf-16", SLEN("utf-16"));
+		utf16be = parserutils_charset_mibenum_from_name(
+				"utf-16be", SLEN("utf-16be"));
+		utf16le = parserutils_charset_mibenum_from_name(
+				"utf-16le", SLEN("utf-16le"));
+		assert(utf16 != 0 && utf16be != 0 && utf16le != 0);
+
 		/* Change UTF-16 to UTF-8 */
 		if (charset_enc == utf16le || charset_enc == utf16be ||
 				charset_enc == utf16) {
@@ -92,8 +91,16 @@ static hubbub_error process_meta_in_head(hubbub_treebuilder *treebuilder,
 
 		name = parserutils_charset_mibenum_to_name(charset_enc);
 
-		err = treebuilder->tree_handler->encoding_change(
-				treebuilder->tree_handler->ctx,	name);
+		/* The change may be made without the client's help */
+		if (treebuilder->charset_handler != NULL &&
+				treebuilder->charset_handler(name,
+				treebuilder->charset_pw))
+			return HUBBUB_OK;
+
+		if (treebuilder->tree_handler->encoding_change != NULL) {
+			err = treebuilder->tree_handler->encoding_change(
+					treebuilder->tree_handler->ctx, name);
+		}
 	}
 
 	return err;
@@ -127,8 +134,7 @@ hubbub_error handle_in_head(hubbub_treebuilder *treebuilder,
 		break;
 	case HUBBUB_TOKEN_START_TAG:
 	{
-		element_type type = element_type_from_name(treebuilder,
-				&token->data.tag.name);
+		element_type type = element_type_from_tag(&token->data.tag);
 
 		if (type == HTML) {
 			/* Process as if "in body" */
@@ -170,8 +176,7 @@ hubbub_error handle_in_head(hubbub_treebuilder *treebuilder,
 		break;
 	case HUBBUB_TOKEN_END_TAG:
 	{
-		element_type type = element_type_from_name(treebuilder,
-				&token->data.tag.name);
+		element_type type = element_type_from_tag(&token->data.tag);
 
 		if (type == HEAD) {
 			handled = true;
@@ -53,7 +53,11 @@ static hubbub_error act_as_if_end_tag_tr(hubbub_treebuilder *treebuilder)
 	element_type otype;
 	void *node;
 
-	/** \todo fragment case */
+	/* fragment case: ignore the token */
+	if (element_in_scope(treebuilder, TR, true) == 0) {
+		/** \todo parse error */
+		return HUBBUB_OK;
+	}
 
 	table_clear_stack(treebuilder);
 
@@ -83,8 +87,7 @@ hubbub_error handle_in_row(hubbub_treebuilder *treebuilder,
 	switch (token->type) {
 	case HUBBUB_TOKEN_START_TAG:
 	{
-		element_type type = element_type_from_name(treebuilder,
-				&token->data.tag.name);
+		element_type type = element_type_from_tag(&token->data.tag);
 
 		if (type == TH || type == TD) {
 			table_clear_stack(treebuilder);
@@ -103,7 +106,7 @@ hubbub_error handle_in_row(hubbub_treebuilder *treebuilder,
 				treebuilder->context.current_node].node);
 
 			err = formatting_list_append(treebuilder, 
-					token->data.tag.ns, type,
+					&token->data.tag, type,
 					treebuilder->context.element_stack[
 					treebuilder->context.current_node].node,
 					treebuilder->context.current_node);
@@ -133,8 +136,7 @@ hubbub_error handle_in_row(hubbub_treebuilder *treebuilder,
 		break;
 	case HUBBUB_TOKEN_END_TAG:
 	{
-		element_type type = element_type_from_name(treebuilder,
-				&token->data.tag.name);
+		element_type type = element_type_from_tag(&token->data.tag);
 
 		if (type == TR) {
 			/* We're done with this token, but act_as_if_end_tag_tr 
@@ -44,8 +44,7 @@ hubbub_error handle_in_select(hubbub_treebuilder *treebuilder,
 		break;
 	case HUBBUB_TOKEN_START_TAG:
 	{
-		element_type type = element_type_from_name(treebuilder,
-				&token->data.tag.name);
+		element_type type = element_type_from_tag(&token->data.tag);
 
 		if (type == HTML) {
 			/* Process as if "in body" */
@@ -90,13 +89,13 @@ hubbub_error handle_in_select(hubbub_treebuilder *treebuilder,
 				element_stack_pop_until(treebuilder, 
 						SELECT);
 				reset_insertion_mode(treebuilder);
+
+				if (type != SELECT)
+					err = HUBBUB_REPROCESS;
 			} else {
-				/* fragment case */
+				/* fragment case: ignore the token */
 				/** \todo parse error */
 			}
-
-			if (type != SELECT)
-				err = HUBBUB_REPROCESS;
 		} else if (type == SCRIPT) {
 			err = handle_in_head(treebuilder, token);
 		} else {
@@ -106,8 +105,7 @@ hubbub_error handle_in_select(hubbub_treebuilder *treebuilder,
 		break;
 	case HUBBUB_TOKEN_END_TAG:
 	{
-		element_type type = element_type_from_name(treebuilder,
-				&token->data.tag.name);
+		element_type type = element_type_from_tag(&token->data.tag);
 
 		if (type == OPTGROUP) {
 			if (current_node(treebuilder) == OPTION &&
@@ -29,8 +29,7 @@ hubbub_error handle_in_select_in_table(hubbub_treebuilder *treebuilder,
 
 	if (token->type == HUBBUB_TOKEN_END_TAG ||
 			token->type == HUBBUB_TOKEN_START_TAG) {
-		element_type type = element_type_from_name(treebuilder,
-				&token->data.tag.name);
+		element_type type = element_type_from_tag(&token->data.tag);
 
 		if (type == CAPTION || type == TABLE || type == TBODY ||
 				type == TFOOT || type == THEAD || type == TR ||
@@ -43,8 +42,9 @@ hubbub_error handle_in_select_in_table(hubbub_treebuilder *treebuilder,
 					element_in_scope(treebuilder, type,
 							true)) ||
 					token->type == HUBBUB_TOKEN_START_TAG) {
-				/** \todo fragment case */
-
+				/* The select is always in scope here: in
+				 * the fragment case, a select context means
+				 * "in select", not "in select in table" */
 				element_stack_pop_until(treebuilder, 
 						SELECT);
 				reset_insertion_mode(treebuilder);
@@ -99,8 +99,7 @@ hubbub_error handle_in_table(hubbub_treebuilder *treebuilder,
 		break;
 	case HUBBUB_TOKEN_START_TAG:
 	{
-		element_type type = element_type_from_name(treebuilder,
-				&token->data.tag.name);
+		element_type type = element_type_from_tag(&token->data.tag);
 		bool tainted = treebuilder->context.element_stack[
 					current_table(treebuilder)
 					].tainted;
@@ -114,7 +113,7 @@ hubbub_error handle_in_table(hubbub_treebuilder *treebuilder,
 				treebuilder->context.current_node].node);
 
 			err = formatting_list_append(treebuilder,
-					token->data.tag.ns, type,
+					&token->data.tag, type,
 					treebuilder->context.element_stack[
 					treebuilder->context.current_node].node,
 					treebuilder->context.current_node);
@@ -136,7 +135,9 @@ hubbub_error handle_in_table(hubbub_treebuilder *treebuilder,
 				uint32_t index;
 
 				formatting_list_remove(treebuilder,
-					treebuilder->context.formatting_list_end,
+					&treebuilder->context.formatting_list[
+					treebuilder->context.
+						formatting_list_len - 1],
 					&ns, &type, &node, &index);
 
 				treebuilder->tree_handler->unref_node(
@@ -155,6 +156,7 @@ hubbub_error handle_in_table(hubbub_treebuilder *treebuilder,
 				/* Insert colgroup and reprocess */
 				tag.name.ptr = (const uint8_t *) "colgroup";
 				tag.name.len = SLEN("colgroup");
+				tag.atom = HUBBUB_ATOM_COLGROUP;
 				tag.n_attributes = 0;
 				tag.attributes = NULL;
 
@@ -177,6 +179,7 @@ hubbub_error handle_in_table(hubbub_treebuilder *treebuilder,
 				/* Insert tbody and reprocess */
 				tag.name.ptr = (const uint8_t *) "tbody";
 				tag.name.len = SLEN("tbody");
+				tag.atom = HUBBUB_ATOM_TBODY;
 				tag.n_attributes = 0;
 				tag.attributes = NULL;
 
@@ -194,11 +197,15 @@ hubbub_error handle_in_table(hubbub_treebuilder *treebuilder,
 			/** \todo parse error */
 
 			/* This should match "</table>" handling */
-			element_stack_pop_until(treebuilder, TABLE);
+			if (element_in_scope(treebuilder, TABLE, true)) {
+				element_stack_pop_until(treebuilder, TABLE);
 
-			reset_insertion_mode(treebuilder);
+				reset_insertion_mode(treebuilder);
 
-			err = HUBBUB_REPROCESS;
+				err = HUBBUB_REPROCESS;
+			} else {
+				/* fragment case: ignore the token */
+			}
 		} else if (!tainted && (type == STYLE || type == SCRIPT)) {
 			err = handle_in_head(treebuilder, token);
 		} else if (!tainted && type == INPUT) {
@@ -211,15 +218,17 @@ hubbub_error handle_in_table(hubbub_treebuilder *treebuilder,
 		break;
 	case HUBBUB_TOKEN_END_TAG:
 	{
-		element_type type = element_type_from_name(treebuilder,
-				&token->data.tag.name);
+		element_type type = element_type_from_tag(&token->data.tag);
 
 		if (type == TABLE) {
-			/** \todo fragment case */
+			if (element_in_scope(treebuilder, TABLE, true)) {
+				element_stack_pop_until(treebuilder, TABLE);
 
-			element_stack_pop_until(treebuilder, TABLE);
-
-			reset_insertion_mode(treebuilder);
+				reset_insertion_mode(treebuilder);
+			} else {
+				/** \todo parse error */
+				/* fragment case: ignore the token */
+			}
 		} else if (type == BODY || type == CAPTION || type == COL ||
 				type == COLGROUP || type == HTML ||
 				type == TBODY || type == TD || type == TFOOT ||
@@ -94,8 +94,7 @@ hubbub_error handle_in_table_body(hubbub_treebuilder *treebuilder,
 	switch (token->type) {
 	case HUBBUB_TOKEN_START_TAG:
 	{
-		element_type type = element_type_from_name(treebuilder,
-				&token->data.tag.name);
+		element_type type = element_type_from_tag(&token->data.tag);
 
 		if (type == TR) {
 			table_clear_stack(treebuilder);
@@ -113,6 +112,7 @@ hubbub_error handle_in_table_body(hubbub_treebuilder *treebuilder,
 			tag.ns = HUBBUB_NS_HTML;
 			tag.name.ptr = (const uint8_t *) "tr";
 			tag.name.len = SLEN("tr");
+			tag.atom = HUBBUB_ATOM_TR;
 
 			tag.n_attributes = 0;
 			tag.attributes = NULL;
@@ -136,8 +136,7 @@ hubbub_error handle_in_table_body(hubbub_treebuilder *treebuilder,
 		break;
 	case HUBBUB_TOKEN_END_TAG:
 	{
-		element_type type = element_type_from_name(treebuilder,
-				&token->data.tag.name);
+		element_type type = element_type_from_tag(&token->data.tag);
 
 		if (type == TBODY || type == TFOOT || type == THEAD) {
 			if (!element_in_scope(treebuilder, type, true)) {
@@ -16,70 +16,6 @@
 #include "utils/string.h"
 
 
-#define S(s)	{ s, sizeof s - 1 }
-
-struct {
-	const char *name;
-	size_t len;
-} public_doctypes[] = {
-	S("+//Silmaril//dtd html Pro v0r11 19970101//"),
-	S("-//AdvaSoft Ltd//DTD HTML 3.0 asWedit + extensions//"),
-	S("-//AS//DTD HTML 3.0 asWedit + extensions//"),
-	S("-//IETF//DTD HTML 2.0 Level 1//"),
-	S("-//IETF//DTD HTML 2.0 Level 2//"),
-	S("-//IETF//DTD HTML 2.0 Strict Level 1//"),
-	S("-//IETF//DTD HTML 2.0 Strict Level 2//"),
-	S("-//IETF//DTD HTML 2.0 Strict//"),
-	S("-//IETF//DTD HTML 2.0//"),
-	S("-//IETF//DTD HTML 2.1E//"),
-	S("-//IETF//DTD HTML 3.0//"),
-	S("-//IETF//DTD HTML 3.2 Final//"),
-	S("-//IETF//DTD HTML 3.2//"),
-	S("-//IETF//DTD HTML 3//"),
-	S("-//IETF//DTD HTML Level 0//"),
-	S("-//IETF//DTD HTML Level 1//"),
-	S("-//IETF//DTD HTML Level 2//"),
-	S("-//IETF//DTD HTML Level 3//"),
-	S("-//IETF//DTD HTML Strict Level 0//"),
-	S("-//IETF//DTD HTML Strict Level 1//"),
-	S("-//IETF//DTD HTML Strict Level 2//"),
-	S("-//IETF//DTD HTML Strict Level 3//"),
-	S("-//IETF//DTD HTML Strict//"),
-	S("-//IETF//DTD HTML//"),
-	S("-//Metrius//DTD Metrius Presentational//"),
-	S("-//Microsoft//DTD Internet Explorer 2.0 HTML Strict//"),
-	S("-//Microsoft//DTD Internet Explorer 2.0 HTML//"),
-	S("-//Microsoft//DTD Internet Explorer 2.0 Tables//"),
-	S("-//Microsoft//DTD Internet Explorer 3.0 HTML Strict//"),
-	S("-//Microsoft//DTD Internet Explorer 3.0 HTML//"),
-	S("-//Microsoft//DTD Internet Explorer 3.0 Tables//"),
-	S("-//Netscape Comm. Corp.//DTD HTML//"),
-	S("-//Netscape Comm. Corp.//DTD Strict HTML//"),
-	S("-//O'Reilly and Associates//DTD HTML 2.0//"),
-	S("-//O'Reilly and Associates//DTD HTML Extended 1.0//"),
-	S("-//O'Reilly and Associates//DTD HTML Extended Relaxed 1.0//"),
-	S("-//SoftQuad Software//DTD HoTMetaL PRO 6.0::19990601::extensions to HTML 4.0//"),
-	S("-//SoftQuad//DTD HoTMetaL PRO 4.0::19971010::extensions to HTML 4.0//"),
-	S("-//Spyglass//DTD HTML 2.0 Extended//"),
-	S("-//SQ//DTD HTML 2.0 HoTMetaL + extensions//"),
-	S("-//Sun Microsystems Corp.//DTD HotJava HTML//"),
-	S("-//Sun Microsystems Corp.//DTD HotJava Strict HTML//"),
-	S("-//W3C//DTD HTML 3 1995-03-24//"),
-	S("-//W3C//DTD HTML 3.2 Draft//"),
-	S("-//W3C//DTD HTML 3.2 Final//"),
-	S("-//W3C//DTD HTML 3.2//"),
-	S("-//W3C//DTD HTML 3.2S Draft//"),
-	S("-//W3C//DTD HTML 4.0 Frameset//"),
-	S("-//W3C//DTD HTML 4.0 Transitional//"),
-	S("-//W3C//DTD HTML Experimental 19960712//"),
-	S("-//W3C//DTD HTML Experimental 970421//"),
-	S("-//W3C//DTD W3 HTML//"),
-	S("-//W3O//DTD W3 HTML 3.0//"),
-};
-
-#undef S
-
-
 /**
  * Check if one string starts with another.
  *
@@ -109,8 +45,6 @@ static bool starts_with(const uint8_t *a, size_t a_len, const uint8_t *b,
 static bool lookup_full_quirks(hubbub_treebuilder *treebuilder,
 		const hubbub_doctype *cdoc)
 {
-	size_t i;
-
 	const uint8_t *name = cdoc->name.ptr;
 	size_t name_len = cdoc->name.len;
 
@@ -132,14 +66,8 @@ static bool lookup_full_quirks(hubbub_treebuilder *treebuilder,
 	if (cdoc->public_missing)
 		return false;
 
-	for (i = 0; i < sizeof public_doctypes / sizeof public_doctypes[0]; i++)
-	{
-		if (starts_with(public_id, public_id_len,
-				(uint8_t *) public_doctypes[i].name,
-				public_doctypes[i].len)) {
-			return true;
-		}
-	}
+	if (quirks_public_id_lookup(public_id, public_id_len))
+		return true;
 
 	if (hubbub_string_match_ci(public_id, public_id_len,
 				S("-//W3O//DTD W3 HTML Strict 3.0//EN//")) ||
@@ -9,32 +9,10 @@
 #define hubbub_treebuilder_internal_h_
 
 #include "treebuilder/treebuilder.h"
+#include "utils/atoms.h"
+#include "utils/elements.h"
+#include "utils/stats.h"
 
-typedef enum
-{
-/* Special */
-	ADDRESS, AREA, ARTICLE, ASIDE, BASE, BASEFONT, BGSOUND, BLOCKQUOTE,
-	BODY, BR, CENTER, COL, COLGROUP, COMMAND, DATAGRID, DD, DETAILS,
-	DIALOG, DIR, DIV, DL, DT, EMBED, FIELDSET, FIGURE, FOOTER, FORM, FRAME,
-	FRAMESET, H1, H2, H3, H4, H5, H6, HEAD, HEADER, HR, IFRAME, IMAGE, IMG,
-	INPUT, ISINDEX, LI, LINK, LISTING, MENU, META, NAV, NOEMBED, NOFRAMES, 
-	NOSCRIPT, OL, OPTGROUP, OPTION, P, PARAM, PLAINTEXT, PRE, SCRIPT, 
-	SECTION, SELECT, SPACER, STYLE, TBODY, TEXTAREA, TFOOT, THEAD, TITLE, 
-	TR, UL, WBR,
-/* Scoping */
-	APPLET, BUTTON, CAPTION, HTML, MARQUEE, OBJECT, TABLE, TD, TH,
-/* Formatting */
-	A, B, BIG, CODE, EM, FONT, I, NOBR, S, SMALL, STRIKE, STRONG, TT, U,
-/* Phrasing */
-	/**< \todo Enumerate phrasing elements */
-	LABEL, OUTPUT, RP, RT, RUBY, SPAN, SUB, SUP, VAR, XMP,
-/* MathML */
-	MATH, MGLYPH, MALIGNMARK, MI, MO, MN, MS, MTEXT, ANNOTATION_XML,
-/* SVG */
-	SVG, FOREIGNOBJECT, /* foreignobject is scoping, but only in SVG ns */
-	DESC,
-	UNKNOWN
-} element_type;
 
 /**
  * Item on the element stack
@@ -52,8 +30,36 @@ typedef struct element_context
 					 * instead of the current node." */
 
 	void *node;			/**< Node pointer */
+	void *parent;			/**< Node into which the treebuilder
+					 * last inserted node, or NULL if
+					 * this is not known */
+	uint32_t parent_epoch;		/**< Treebuilder's parent epoch when
+					 * parent was recorded; parent is not
+					 * known once they differ */
+
+	uint32_t prev_same;		/**< Stack index of the next element
+					 * of the same type further down the
+					 * stack, or 0 if there is none */
+	uint32_t scope;			/**< Stack index of the nearest
+					 * element at or below this one which
+					 * bounds scope, or 0 if none does */
+	uint32_t table_scope;		/**< As scope, but for table scope */
 } element_context;
 
+/**
+ * Attributes of an element in a formatting list
+ */
+typedef struct formatting_attributes
+{
+	uint32_t signature;		/**< Signature of the attributes, as
+					 * a quick test for identical
+					 * entries */
+	uint32_t count;			/**< Number of attributes */
+	size_t data;			/**< Offset of the attributes in the
+					 * list's attribute data */
+	size_t len;			/**< Length of the attributes */
+} formatting_attributes;
+
 /**
  * Entry in a formatting list
  */
@@ -63,10 +69,22 @@ typedef struct formatting_list_entry
 
 	uint32_t stack_index;		/**< Index into element stack */
 
-	struct formatting_list_entry *prev;	/**< Previous in list */
-	struct formatting_list_entry *next;	/**< Next in list */
+	formatting_attributes attributes;	/**< The element's
+						 * attributes, for finding
+						 * identical entries */
 } formatting_list_entry;
 
+/**
+ * An element reported open by a structural event
+ */
+typedef struct event_entry
+{
+	void *node;			/**< Node pointer */
+	hubbub_ns ns;			/**< Element namespace */
+	size_t name;			/**< Offset of element name */
+	size_t name_len;		/**< Length of element name */
+} event_entry;
+
 /**
  * Context for a tree builder
  */
@@ -79,11 +97,22 @@ typedef struct hubbub_treebuilder_context
 	element_context *element_stack;	/**< Stack of open elements */
 	uint32_t stack_alloc;		/**< Number of stack slots allocated */
 	uint32_t current_node;		/**< Index of current node in stack */
-
+	uint32_t parent_epoch;		/**< Advanced to forget the parents
+					 * recorded in the stack */
+	uint32_t element_top[UNKNOWN + 1];	/**< Stack index of the
+						 * topmost element of each
+						 * type, or 0 if none is
+						 * open */
+
+#define FORMATTING_LIST_CHUNK 16
 	formatting_list_entry *formatting_list;	/**< List of active formatting 
 						 * elements */
-	formatting_list_entry *formatting_list_end;	/**< End of active 
-							 * formatting list */
+	uint32_t formatting_list_len;	/**< Number of entries in list */
+	uint32_t formatting_list_alloc;	/**< Number of list slots allocated */
+#define FORMATTING_ATTRS_CHUNK 256
+	uint8_t *formatting_attrs;	/**< Attributes of the entries */
+	size_t formatting_attrs_len;	/**< Bytes of attributes used */
+	size_t formatting_attrs_alloc;	/**< Bytes of attributes allocated */
 
 	void *head_element;		/**< Pointer to HEAD element */
 
@@ -92,9 +121,24 @@ typedef struct hubbub_treebuilder_context
 
 	void *document;			/**< Pointer to the document node */
 
+	struct {
+		bool active;		/**< Whether parsing a fragment */
+		hubbub_ns ns;		/**< Namespace of context element */
+		element_type type;	/**< Type of context element */
+	} fragment;			/**< Context of fragment, if any */
+
 	bool enable_scripting;		/**< Whether scripting is enabled */
 	bool enable_styling;            /**< Whether styling is enabled */
 
+	bool head_only;			/**< Whether to stop at the body */
+	uint32_t max_depth;		/**< Most open elements to nest in
+					 * the tree, or 0 for no limit */
+	bool stopped;			/**< Whether parsing has stopped */
+
+	hubbub_error complete_error;	/**< First error from the element
+					 * complete callback, as yet
+					 * unreported */
+
 	struct {
 		insertion_mode mode;	/**< Insertion mode to return to */
 		element_type type;	/**< Type of node */
@@ -109,6 +153,27 @@ typedef struct hubbub_treebuilder_context
 					* be foster parented */
 
 	bool frameset_ok;		/**< Whether to process a frameset */
+
+	bool in_split_comment;		/**< Whether the next comment token
+					 * continues the last one */
+
+#define TEXT_BUFFER_CHUNK 256
+	void *text_parent;		/**< Node to which pending text is to
+					 * be appended, or NULL if none */
+	uint8_t *text;			/**< Pending text */
+	size_t text_len;		/**< Length of pending text, in bytes */
+	size_t text_alloc;		/**< Bytes allocated for pending text */
+
+	struct {
+		event_entry *stack;	/**< Elements reported open, which
+					 * mirror the stack of open elements
+					 * as it was when last reported */
+		uint32_t depth;		/**< Number of elements reported */
+		uint32_t alloc;		/**< Number of slots allocated */
+		uint8_t *names;		/**< Names of elements reported */
+		size_t names_len;	/**< Length of names, in bytes */
+		size_t names_alloc;	/**< Bytes allocated for names */
+	} events;			/**< Structural event state */
 } hubbub_treebuilder_context;
 
 /**
@@ -120,13 +185,43 @@ struct hubbub_treebuilder
 
 	hubbub_treebuilder_context context;	/**< Our context */
 
-	hubbub_tree_handler *tree_handler;	/**< Callback table */
+	hubbub_tree_handler *tree_handler;	/**< Callback table in use */
+
+	hubbub_tree_handler *client_handler;	/**< Client's callbacks */
+	hubbub_tree_handler_ext *tree_handler_ext;
+					/**< Client's extended callbacks */
+	hubbub_tree_handler no_refcount_handler;
+					/**< Client's callbacks, without
+					 * reference counting */
+	const hubbub_tree_handler_ext *ext;
+					/**< Extended callbacks in use */
+
+	hubbub_event_handler event_handler;	/**< Structural event handler */
+	void *event_pw;				/**< Event handler data */
+	hubbub_tree_handler event_stubs;	/**< Callbacks used when only
+						 * events are wanted */
+	uintptr_t stub_nodes;		/**< Number of stub nodes made */
+
+	hubbub_tree_handler filter_handler;	/**< Callbacks used when
+						 * elements are filtered */
+	hubbub_tree_handler *filter_inner;	/**< Callbacks the filter
+						 * passes operations to */
+	struct skip_slab *skip_slabs;	/**< Storage for skipped nodes */
+	struct skip_node *skip_free;	/**< Free skipped nodes */
 
 	hubbub_error_handler error_handler;	/**< Error handler */
 	void *error_pw;				/**< Error handler data */
 
+	hubbub_treebuilder_charset_handler charset_handler;
+					/**< Meta charset handler */
+	void *charset_pw;		/**< Meta charset handler data */
+
 	hubbub_allocator_fn alloc;	/**< Memory (de)allocation function */
 	void *alloc_pw;			/**< Client private data */
+
+#ifdef HUBBUB_WITH_STATS
+	hubbub_parser_stats *stats;	/**< Counters, or NULL */
+#endif
 };
 
 hubbub_error hubbub_treebuilder_token_handler(
@@ -155,12 +250,10 @@ void close_implied_end_tags(hubbub_treebuilder *treebuilder,
 void reset_insertion_mode(hubbub_treebuilder *treebuilder);
 hubbub_error append_text(hubbub_treebuilder *treebuilder,
 		const hubbub_string *string);
+hubbub_error flush_text(hubbub_treebuilder *treebuilder);
 hubbub_error complete_script(hubbub_treebuilder *treebuilder);
 hubbub_error complete_style(hubbub_treebuilder *treebuilder);
 
-element_type element_type_from_name(hubbub_treebuilder *treebuilder,
-		const hubbub_string *tag_name);
-
 bool is_special_element(element_type type);
 bool is_scoping_element(element_type type);
 bool is_formatting_element(element_type type);
@@ -175,17 +268,22 @@ hubbub_error element_stack_pop_until(hubbub_treebuilder *treebuilder,
 hubbub_error element_stack_remove(hubbub_treebuilder *treebuilder, 
 		uint32_t index, hubbub_ns *ns, element_type *type, 
 		void **removed);
+void element_stack_unlink(hubbub_treebuilder *treebuilder, uint32_t index);
+void element_stack_link(hubbub_treebuilder *treebuilder, uint32_t index);
+void *element_stack_parent(hubbub_treebuilder *treebuilder, uint32_t index);
+void element_stack_set_parent(hubbub_treebuilder *treebuilder,
+		uint32_t index, void *parent);
 uint32_t current_table(hubbub_treebuilder *treebuilder);
+element_type element_type_from_tag(const hubbub_tag *tag);
 element_type current_node(hubbub_treebuilder *treebuilder);
 element_type prev_node(hubbub_treebuilder *treebuilder);
 
 hubbub_error formatting_list_append(hubbub_treebuilder *treebuilder,
-		hubbub_ns ns, element_type type, void *node, 
+		const hubbub_tag *tag, element_type type, void *node, 
 		uint32_t stack_index);
 hubbub_error formatting_list_insert(hubbub_treebuilder *treebuilder,
-		formatting_list_entry *prev, formatting_list_entry *next,
-		hubbub_ns ns, element_type type, void *node, 
-		uint32_t stack_index);
+		uint32_t index, hubbub_ns ns, element_type type, void *node,
+		uint32_t stack_index, const formatting_attributes *attributes);
 hubbub_error formatting_list_remove(hubbub_treebuilder *treebuilder,
 		formatting_list_entry *entry,
 		hubbub_ns *ns, element_type *type, void **node, 
@@ -206,9 +304,33 @@ void adjust_svg_tagname(hubbub_treebuilder *treebuilder,
 void adjust_foreign_attributes(hubbub_treebuilder *treebuilder,
 		hubbub_tag *tag);
 
+/* tables.c */
+const char *svg_tagname_lookup(const uint8_t *name, size_t len);
+const char *svg_attribute_lookup(const uint8_t *name, size_t len);
+bool quirks_public_id_lookup(const uint8_t *id, size_t len);
+
 /* in_body.c */
 hubbub_error aa_insert_into_foster_parent(hubbub_treebuilder *treebuilder, 
-		void *node, void **inserted);
+		void *node, void **inserted, void **parent);
+
+/* events.c */
+void event_stubs_init(hubbub_treebuilder *treebuilder);
+hubbub_error event_sync(hubbub_treebuilder *treebuilder,
+		const hubbub_tag *tag);
+hubbub_error event_element(hubbub_treebuilder *treebuilder,
+		const hubbub_tag *tag);
+hubbub_error event_text(hubbub_treebuilder *treebuilder, void *parent,
+		const hubbub_string *string);
+hubbub_error event_close_all(hubbub_treebuilder *treebuilder);
+void event_destroy(hubbub_treebuilder *treebuilder);
+
+/* filter.c */
+bool filter_skipped(hubbub_treebuilder *treebuilder, const void *node);
+hubbub_error filter_skip_node(hubbub_treebuilder *treebuilder, void **result);
+hubbub_error filter_element(hubbub_treebuilder *treebuilder, void *parent,
+		const hubbub_tag *tag, bool *skip);
+void filter_select(hubbub_treebuilder *treebuilder);
+void filter_destroy(hubbub_treebuilder *treebuilder);
 
 #ifndef NDEBUG
 #include <stdio.h>
@@ -0,0 +1,135 @@
+/*
+ * This file is part of Hubbub.
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license.php
+ * Copyright 2026 agent <agent@local>
+ */
+
+#include <stddef.h>
+
+#include "treebuilder/modes.h"
+#include "treebuilder/internal.h"
+#include "utils/charclass.h"
+#include "utils/elements.h"
+#include "utils/string.h"
+
+/**
+ * Mapping table for case changes
+ */
+typedef struct case_change {
+	const char *name;	/**< Lower case name */
+	size_t len;		/**< Length of name in bytes */
+	const char *proper;	/**< Correctly cased version */
+} case_change;
+
+/**
+ * Edge in a prefix trie
+ */
+typedef struct prefix_edge {
+	uint8_t c;		/**< Lower case character on edge */
+	uint8_t flags;		/**< PREFIX_* flags */
+	uint16_t next;		/**< Index of first edge of child node */
+} prefix_edge;
+
+/** Edge is the last in its node */
+#define PREFIX_LAST	0x01
+/** Edge completes a prefix */
+#define PREFIX_FINAL	0x02
+
+#include "tables.inc"
+
+/**
+ * Look a name up in a case change table
+ *
+ * \param table       Table to search
+ * \param slots       Slots of the table's perfect hash
+ * \param multiplier  Multiplier of the table's perfect hash
+ * \param slot_bits   Number of bits in a slot index
+ * \param name        Name to look for
+ * \param len         Length of name, in bytes
+ * \return Correctly cased name, or NULL if name is not in the table
+ */
+static const char *case_change_lookup(const case_change *table,
+		const uint8_t *slots, uint32_t multiplier, uint32_t slot_bits,
+		const uint8_t *name, size_t len)
+{
+	uint32_t hash = HUBBUB_ELEMENT_HASH_INIT;
+	const case_change *entry;
+	uint8_t slot;
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		hash = hubbub_element_hash_step(hash, name[i]);
+
+	slot = slots[(uint32_t) (hash * multiplier) >> (32 - slot_bits)];
+	if (slot == 0)
+		return NULL;
+
+	entry = &table[slot - 1];
+
+	if (hubbub_string_match(name, len,
+			(const uint8_t *) entry->name, entry->len) == false)
+		return NULL;
+
+	return entry->proper;
+}
+
+/**
+ * Find the correctly cased version of an SVG element name
+ *
+ * \param name  Lower case element name
+ * \param len   Length of name, in bytes
+ * \return Correctly cased name, or NULL if name needs no adjustment
+ */
+const char *svg_tagname_lookup(const uint8_t *name, size_t len)
+{
+	return case_change_lookup(svg_tagnames, svg_tagnames_slots,
+			SVG_TAGNAME_MULTIPLIER, SVG_TAGNAME_SLOT_BITS,
+			name, len);
+}
+
+/**
+ * Find the correctly cased version of an SVG attribute name
+ *
+ * \param name  Lower case attribute name
+ * \param len   Length of name, in bytes
+ * \return Correctly cased name, or NULL if name needs no adjustment
+ */
+const char *svg_attribute_lookup(const uint8_t *name, size_t len)
+{
+	return case_change_lookup(svg_attributes, svg_attributes_slots,
+			SVG_ATTRIBUTE_MULTIPLIER, SVG_ATTRIBUTE_SLOT_BITS,
+			name, len);
+}
+
+/**
+ * Determine if a public identifier starts with one which triggers quirks
+ *
+ * \param id   Public identifier to examine
+ * \param len  Length of id, in bytes
+ * \return True if id has one of the quirky prefixes, false otherwise
+ */
+bool quirks_public_id_lookup(const uint8_t *id, size_t len)
+{
+	uint16_t node = 0;
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		uint8_t c = hubbub_char_tolower(id[i]);
+		const prefix_edge *edge = &quirks_public_ids[node];
+
+		while (edge->c != c) {
+			if (edge->c > c || (edge->flags & PREFIX_LAST))
+				return false;
+			edge++;
+		}
+
+		if (edge->flags & PREFIX_FINAL)
+			return true;
+
+		node = edge->next;
+	}
+
+	return false;
+}
+
@@ -13,73 +13,17 @@
 #include "treebuilder/modes.h"
 #include "treebuilder/internal.h"
 #include "treebuilder/treebuilder.h"
+#include "utils/charclass.h"
+#include "utils/scan.h"
 #include "utils/utils.h"
 #include "utils/string.h"
+#include "utils/trace.h"
 
 
-#define S(x)   x, SLEN(x)
-
-static const struct {
-	const char *name;
-	size_t len;
-	element_type type;
-} name_type_map[] = {
-	{ S("address"), ADDRESS },	{ S("area"), AREA },
-	{ S("base"), BASE },		{ S("basefont"), BASEFONT },
-	{ S("bgsound"), BGSOUND },	{ S("blockquote"), BLOCKQUOTE },
-	{ S("body"), BODY },		{ S("br"), BR },
-	{ S("center"), CENTER },	{ S("col"), COL },
-	{ S("colgroup"), COLGROUP },	{ S("dd"), DD },
-	{ S("dir"), DIR },		{ S("div"), DIV },
-	{ S("dl"), DL },		{ S("dt"), DT },
-	{ S("embed"), EMBED },		{ S("fieldset"), FIELDSET },
-	{ S("form"), FORM },		{ S("frame"), FRAME },
-	{ S("frameset"), FRAMESET },	{ S("h1"), H1 },
-	{ S("h2"), H2 },		{ S("h3"), H3 },
-	{ S("h4"), H4 },		{ S("h5"), H5 },
-	{ S("h6"), H6 },		{ S("head"), HEAD },
-	{ S("hr"), HR },		{ S("iframe"), IFRAME },
-	{ S("image"), IMAGE },		{ S("img"), IMG },
-	{ S("input"), INPUT },		{ S("isindex"), ISINDEX },
-	{ S("li"), LI },		{ S("link"), LINK },
-	{ S("listing"), LISTING },
-	{ S("menu"), MENU },
-	{ S("meta"), META },		{ S("noembed"), NOEMBED },
-	{ S("noframes"), NOFRAMES },	{ S("noscript"), NOSCRIPT },
-	{ S("ol"), OL },		{ S("optgroup"), OPTGROUP },
-	{ S("option"), OPTION },	{ S("output"), OUTPUT },
-	{ S("p"), P },			{ S("param"), PARAM },
-	{ S("plaintext"), PLAINTEXT },	{ S("pre"), PRE },
-	{ S("script"), SCRIPT },	{ S("select"), SELECT },
-	{ S("spacer"), SPACER },	{ S("style"), STYLE },
- 	{ S("tbody"), TBODY },		{ S("textarea"), TEXTAREA },
-	{ S("tfoot"), TFOOT },		{ S("thead"), THEAD },
-	{ S("title"), TITLE },		{ S("tr"), TR },
-	{ S("ul"), UL },		{ S("wbr"), WBR },
-	{ S("applet"), APPLET },	{ S("button"), BUTTON },
-	{ S("caption"), CAPTION },	{ S("html"), HTML },
-	{ S("marquee"), MARQUEE },	{ S("object"), OBJECT },
-	{ S("table"), TABLE },		{ S("td"), TD },
-	{ S("th"), TH },
-	{ S("a"), A },			{ S("b"), B },
-	{ S("big"), BIG },		{ S("em"), EM },
-	{ S("font"), FONT },		{ S("i"), I },
-	{ S("nobr"), NOBR },		{ S("s"), S },
-	{ S("small"), SMALL },		{ S("strike"), STRIKE },
-	{ S("strong"), STRONG },	{ S("tt"), TT },
-	{ S("u"), U },			{ S("xmp"), XMP },
-
-	{ S("math"), MATH },		{ S("mglyph"), MGLYPH },
-	{ S("malignmark"), MALIGNMARK },
-	{ S("mi"), MI },		{ S("mo"), MO },
-	{ S("mn"), MN },		{ S("ms"), MS },
-	{ S("mtext"), MTEXT },		{ S("annotation-xml"), ANNOTATION_XML },
-
-	{ S("svg"), SVG },		{ S("desc"), DESC },
-	{ S("foreignobject"), FOREIGNOBJECT },
-};
-
 static bool is_form_associated(element_type type);
+static hubbub_error set_fragment(hubbub_treebuilder *treebuilder,
+		const hubbub_fragment *fragment);
+static void *insertion_parent(hubbub_treebuilder *treebuilder);
 
 /**
  * Create a hubbub treebuilder
@@ -110,6 +54,18 @@ hubbub_error hubbub_treebuilder_create(hubbub_tokeniser *tokeniser,
 	tb->tokeniser = tokeniser;
 
 	tb->tree_handler = NULL;
+	tb->client_handler = NULL;
+	tb->tree_handler_ext = NULL;
+	tb->ext = NULL;
+
+	tb->event_handler = NULL;
+	tb->event_pw = NULL;
+	tb->stub_nodes = 0;
+	event_stubs_init(tb);
+
+	tb->filter_inner = NULL;
+	tb->skip_slabs = NULL;
+	tb->skip_free = NULL;
 
 	memset(&tb->context, 0, sizeof(hubbub_treebuilder_context));
 	tb->context.mode = INITIAL;
@@ -126,6 +82,9 @@ hubbub_error hubbub_treebuilder_create(hubbub_tokeniser *tokeniser,
 	 * if the first item in the stack is in use. Assert this here. */
 	assert(HTML != 0);
 	tb->context.element_stack[0].type = (element_type) 0;
+	/* The root never bounds scope, as it is never examined */
+	tb->context.element_stack[0].scope = 0;
+	tb->context.element_stack[0].table_scope = 0;
 
 	tb->context.strip_leading_lr = false;
 	tb->context.frameset_ok = true;
@@ -133,6 +92,13 @@ hubbub_error hubbub_treebuilder_create(hubbub_tokeniser *tokeniser,
 	tb->error_handler = NULL;
 	tb->error_pw = NULL;
 
+	tb->charset_handler = NULL;
+	tb->charset_pw = NULL;
+
+#ifdef HUBBUB_WITH_STATS
+	tb->stats = NULL;
+#endif
+
 	tb->alloc = alloc;
 	tb->alloc_pw = pw;
 
@@ -152,6 +118,46 @@ hubbub_error hubbub_treebuilder_create(hubbub_tokeniser *tokeniser,
 	return HUBBUB_OK;
 }
 
+/**
+ * Release the nodes referenced by a treebuilder's context
+ *
+ * \param treebuilder  The treebuilder instance
+ */
+static void release_nodes(hubbub_treebuilder *treebuilder)
+{
+	hubbub_treebuilder_context *ctx = &treebuilder->context;
+	hubbub_tree_handler *tree_handler = treebuilder->tree_handler;
+	uint32_t n;
+
+	if (tree_handler == NULL)
+		return;
+
+	flush_text(treebuilder);
+
+	if (ctx->head_element != NULL)
+		tree_handler->unref_node(tree_handler->ctx, ctx->head_element);
+
+	if (ctx->form_element != NULL)
+		tree_handler->unref_node(tree_handler->ctx, ctx->form_element);
+
+	if (ctx->document != NULL)
+		tree_handler->unref_node(tree_handler->ctx, ctx->document);
+
+	for (n = ctx->current_node; n > 0; n--) {
+		tree_handler->unref_node(tree_handler->ctx,
+				ctx->element_stack[n].node);
+	}
+	if (ctx->element_stack[0].type == HTML) {
+		tree_handler->unref_node(tree_handler->ctx,
+				ctx->element_stack[0].node);
+	}
+
+	for (n = 0; n < ctx->formatting_list_len; n++) {
+		tree_handler->unref_node(tree_handler->ctx,
+				ctx->formatting_list[n].details.node);
+	}
+}
+
 /**
  * Destroy a hubbub treebuilder
  *
@@ -160,7 +166,6 @@ hubbub_error hubbub_treebuilder_create(hubbub_tokeniser *tokeniser,
  */
 hubbub_error hubbub_treebuilder_destroy(hubbub_treebuilder *treebuilder)
 {
-	formatting_list_entry *entry, *next;
 	hubbub_tokeniser_optparams tokparams;
 
 	if (treebuilder == NULL)
@@ -173,61 +178,149 @@ hubbub_error hubbub_treebuilder_destroy(hubbub_treebuilder *treebuilder)
 			HUBBUB_TOKENISER_TOKEN_HANDLER, &tokparams);
 
 	/* Clean up context */
-	if (treebuilder->tree_handler != NULL) {
-		uint32_t n;
-
-		if (treebuilder->context.head_element != NULL) {
-			treebuilder->tree_handler->unref_node(
-					treebuilder->tree_handler->ctx,
-					treebuilder->context.head_element);
-		}
-
-		if (treebuilder->context.form_element != NULL) {
-			treebuilder->tree_handler->unref_node(
-					treebuilder->tree_handler->ctx,
-					treebuilder->context.form_element);
-		}
-
-		if (treebuilder->context.document != NULL) {
-			treebuilder->tree_handler->unref_node(
-					treebuilder->tree_handler->ctx,
-					treebuilder->context.document);
-		}
+	release_nodes(treebuilder);
 
-		for (n = treebuilder->context.current_node;
-				n > 0; n--) {
-			treebuilder->tree_handler->unref_node(
-				treebuilder->tree_handler->ctx,
-				treebuilder->context.element_stack[n].node);
-		}
-		if (treebuilder->context.element_stack[0].type == HTML) {
-			treebuilder->tree_handler->unref_node(
-				treebuilder->tree_handler->ctx,
-				treebuilder->context.element_stack[0].node);
-		}
-	}
 	treebuilder->alloc(treebuilder->context.element_stack, 0,
 			treebuilder->alloc_pw);
 	treebuilder->context.element_stack = NULL;
 
-	for (entry = treebuilder->context.formatting_list; entry != NULL;
-			entry = next) {
-		next = entry->next;
+	/* The list is only allocated once a formatting element is seen */
+	if (treebuilder->context.formatting_list != NULL) {
+		treebuilder->alloc(treebuilder->context.formatting_list, 0,
+				treebuilder->alloc_pw);
+		treebuilder->context.formatting_list = NULL;
+	}
 
-		if (treebuilder->tree_handler != NULL) {
-			treebuilder->tree_handler->unref_node(
-					treebuilder->tree_handler->ctx,
-					entry->details.node);
-		}
+	if (treebuilder->context.formatting_attrs != NULL) {
+		treebuilder->alloc(treebuilder->context.formatting_attrs, 0,
+				treebuilder->alloc_pw);
+		treebuilder->context.formatting_attrs = NULL;
+	}
 
-		treebuilder->alloc(entry, 0, treebuilder->alloc_pw);
+	if (treebuilder->context.text != NULL) {
+		treebuilder->alloc(treebuilder->context.text, 0,
+				treebuilder->alloc_pw);
 	}
 
+	event_destroy(treebuilder);
+	filter_destroy(treebuilder);
+
 	treebuilder->alloc(treebuilder, 0, treebuilder->alloc_pw);
 
 	return HUBBUB_OK;
 }
 
+/**
+ * Return a hubbub treebuilder to its initial state
+ *
+ * \param treebuilder  The treebuilder instance to reset
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ *
+ * The references held to nodes of the last document are released, and the
+ * client must supply a new document node before parsing again. Handlers
+ * and options are kept, as is the memory allocated for the stack of open
+ * elements, the list of active formatting elements and pending text.
+ */
+hubbub_error hubbub_treebuilder_reset(hubbub_treebuilder *treebuilder)
+{
+	hubbub_treebuilder_context *ctx;
+	hubbub_treebuilder_context old;
+
+	if (treebuilder == NULL)
+		return HUBBUB_BADPARM;
+
+	ctx = &treebuilder->context;
+
+	release_nodes(treebuilder);
+
+	old = *ctx;
+
+	memset(ctx, 0, sizeof(hubbub_treebuilder_context));
+	ctx->mode = INITIAL;
+
+	ctx->element_stack = old.element_stack;
+	ctx->stack_alloc = old.stack_alloc;
+	ctx->element_stack[0].type = (element_type) 0;
+	ctx->element_stack[0].scope = 0;
+	ctx->element_stack[0].table_scope = 0;
+
+	ctx->formatting_list = old.formatting_list;
+	ctx->formatting_list_alloc = old.formatting_list_alloc;
+	ctx->formatting_attrs = old.formatting_attrs;
+	ctx->formatting_attrs_alloc = old.formatting_attrs_alloc;
+
+	ctx->enable_scripting = old.enable_scripting;
+	ctx->enable_styling = old.enable_styling;
+	ctx->head_only = old.head_only;
+	ctx->max_depth = old.max_depth;
+
+	ctx->strip_leading_lr = false;
+	ctx->frameset_ok = true;
+
+	ctx->text = old.text;
+	ctx->text_alloc = old.text_alloc;
+
+	ctx->events.stack = old.events.stack;
+	ctx->events.alloc = old.events.alloc;
+	ctx->events.names = old.events.names;
+	ctx->events.names_alloc = old.events.names_alloc;
+
+	treebuilder->stub_nodes = 0;
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Reference counting callback for clients which don't count references
+ *
+ * \param ctx   Client's context
+ * \param node  Node to reference
+ * \return HUBBUB_OK.
+ */
+static hubbub_error no_refcount(void *ctx, void *node)
+{
+	UNUSED(ctx);
+	UNUSED(node);
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Select the callback table to use, given the client's tree handlers
+ *
+ * \param treebuilder  The treebuilder instance
+ */
+static void select_tree_handler(hubbub_treebuilder *treebuilder)
+{
+	const hubbub_tree_handler_ext *ext = treebuilder->tree_handler_ext;
+
+	treebuilder->ext = ext;
+
+	/* Clients which only want events have no tree to build */
+	if (treebuilder->client_handler == NULL &&
+			treebuilder->event_handler != NULL) {
+		treebuilder->tree_handler = &treebuilder->event_stubs;
+		treebuilder->ext = NULL;
+		return;
+	}
+
+	/* Rather than test the flag around every ref_node and unref_node
+	 * call, use a copy of the client's table with those stubbed out */
+	if (treebuilder->client_handler != NULL && ext != NULL &&
+			(ext->flags & HUBBUB_TREE_NO_REFCOUNT)) {
+		treebuilder->no_refcount_handler =
+				*treebuilder->client_handler;
+		treebuilder->no_refcount_handler.ref_node = no_refcount;
+		treebuilder->no_refcount_handler.unref_node = no_refcount;
+
+		treebuilder->tree_handler = &treebuilder->no_refcount_handler;
+	} else {
+		treebuilder->tree_handler = treebuilder->client_handler;
+	}
+
+	filter_select(treebuilder);
+}
+
 /**
  * Configure a hubbub treebuilder
  *
@@ -249,7 +342,12 @@ hubbub_error hubbub_treebuilder_setopt(hubbub_treebuilder *treebuilder,
 		treebuilder->error_pw = params->error_handler.pw;
 		break;
 	case HUBBUB_TREEBUILDER_TREE_HANDLER:
-		treebuilder->tree_handler = params->tree_handler;
+		treebuilder->client_handler = params->tree_handler;
+		select_tree_handler(treebuilder);
+		break;
+	case HUBBUB_TREEBUILDER_TREE_HANDLER_EXT:
+		treebuilder->tree_handler_ext = params->tree_handler_ext;
+		select_tree_handler(treebuilder);
 		break;
 	case HUBBUB_TREEBUILDER_DOCUMENT_NODE:
 		treebuilder->context.document = params->document_node;
@@ -262,11 +360,271 @@ hubbub_error hubbub_treebuilder_setopt(hubbub_treebuilder *treebuilder,
 		treebuilder->context.enable_styling =
 				params->enable_styling;
 		break;
+	case HUBBUB_TREEBUILDER_FRAGMENT:
+		return set_fragment(treebuilder, &params->fragment);
+	case HUBBUB_TREEBUILDER_HEAD_ONLY:
+		treebuilder->context.head_only = params->head_only;
+		break;
+	case HUBBUB_TREEBUILDER_MAX_DEPTH:
+		/* The html element must hold whatever else there is */
+		if (params->max_depth == 1)
+			return HUBBUB_BADPARM;
+		treebuilder->context.max_depth = params->max_depth;
+		break;
+	case HUBBUB_TREEBUILDER_EVENT_HANDLER:
+		treebuilder->event_handler = params->event_handler.handler;
+		treebuilder->event_pw = params->event_handler.pw;
+		select_tree_handler(treebuilder);
+		break;
+	case HUBBUB_TREEBUILDER_CHARSET_HANDLER:
+		treebuilder->charset_handler = params->charset_handler.handler;
+		treebuilder->charset_pw = params->charset_handler.pw;
+		break;
+	case HUBBUB_TREEBUILDER_STATS:
+#ifdef HUBBUB_WITH_STATS
+		treebuilder->stats = params->stats;
+#endif
+		break;
+	}
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Prepare to parse a fragment, in the context of an element
+ *
+ * \param treebuilder  The treebuilder instance
+ * \param fragment     The context in which to parse
+ * \return HUBBUB_OK on success,
+ *         HUBBUB_BADPARM if parsing has begun, or there is no tree handler
+ */
+static hubbub_error set_fragment(hubbub_treebuilder *treebuilder,
+		const hubbub_fragment *fragment)
+{
+	hubbub_tokeniser_optparams params;
+	element_context *root = &treebuilder->context.element_stack[0];
+	uint32_t hash = HUBBUB_ELEMENT_HASH_INIT;
+	void *node = fragment->root;
+	element_type type;
+	size_t i;
+	hubbub_error error;
+
+	/* There's no tree to append to if only events are wanted */
+	if (node == NULL &&
+			treebuilder->tree_handler == &treebuilder->event_stubs)
+		node = (void *) ++treebuilder->stub_nodes;
+
+	if (treebuilder->tree_handler == NULL || node == NULL ||
+			treebuilder->context.mode != INITIAL ||
+			root->type == HTML)
+		return HUBBUB_BADPARM;
+
+	for (i = 0; i < fragment->name.len; i++) {
+		hash = hubbub_element_hash_step(hash,
+				hubbub_char_tolower(fragment->name.ptr[i]));
+	}
+	type = hubbub_element_type_lookup(hash,
+			fragment->name.ptr, fragment->name.len);
+
+	/* Set the tokeniser's content model as the context would have.
+	 * Elements outside the HTML namespace have no special content. */
+	params.content_model.model = HUBBUB_CONTENT_MODEL_PCDATA;
+	if (fragment->ns == HUBBUB_NS_HTML) {
+		switch (type) {
+		case TITLE:
+		case TEXTAREA:
+			params.content_model.model =
+					HUBBUB_CONTENT_MODEL_RCDATA;
+			break;
+		case STYLE:
+		case SCRIPT:
+		case XMP:
+		case IFRAME:
+		case NOEMBED:
+		case NOFRAMES:
+			params.content_model.model =
+					HUBBUB_CONTENT_MODEL_CDATA;
+			break;
+		case NOSCRIPT:
+			if (treebuilder->context.enable_scripting) {
+				params.content_model.model =
+						HUBBUB_CONTENT_MODEL_CDATA;
+			}
+			break;
+		case PLAINTEXT:
+			params.content_model.model =
+					HUBBUB_CONTENT_MODEL_PLAINTEXT;
+			break;
+		default:
+			break;
+		}
 	}
 
+	error = hubbub_tokeniser_setopt(treebuilder->tokeniser,
+			HUBBUB_TOKENISER_CONTENT_MODEL, &params);
+	if (error != HUBBUB_OK)
+		return error;
+
+	/* The client's node stands in for the root html element, so
+	 * nodes are appended to it, and nothing is built above it. */
+	treebuilder->tree_handler->ref_node(treebuilder->tree_handler->ctx,
+			node);
+
+	root->ns = HUBBUB_NS_HTML;
+	root->type = HTML;
+	root->tainted = false;
+	root->node = node;
+	root->parent = NULL;
+	treebuilder->context.current_node = 0;
+
+	treebuilder->context.fragment.active = true;
+	treebuilder->context.fragment.ns = fragment->ns;
+	treebuilder->context.fragment.type = type;
+
+	reset_insertion_mode(treebuilder);
+
 	return HUBBUB_OK;
 }
 
+/**
+ * Forget the parents recorded for open elements
+ *
+ * \param treebuilder  The treebuilder instance
+ *
+ * This must be called whenever the client may have changed the tree, which
+ * is as often as every chunk of input, so rather than visit every open
+ * element, it moves on to a new epoch, in which none of the parents
+ * recorded so far are known.
+ */
+void hubbub_treebuilder_forget_parents(hubbub_treebuilder *treebuilder)
+{
+	uint32_t n;
+
+	if (++treebuilder->context.parent_epoch != 0)
+		return;
+
+	/* Parents recorded so long ago would look current once again */
+	for (n = 0; n <= treebuilder->context.current_node; n++)
+		treebuilder->context.element_stack[n].parent = NULL;
+}
+
+/**
+ * Retrieve the parent recorded for an open element
+ *
+ * \param treebuilder  The treebuilder instance
+ * \param index        Stack index of the element
+ * \return The node into which the element was last inserted, or NULL if
+ *         this is not known
+ */
+void *element_stack_parent(hubbub_treebuilder *treebuilder, uint32_t index)
+{
+	element_context *entry = &treebuilder->context.element_stack[index];
+
+	if (entry->parent_epoch != treebuilder->context.parent_epoch)
+		return NULL;
+
+	return entry->parent;
+}
+
+/**
+ * Record the parent of an open element
+ *
+ * \param treebuilder  The treebuilder instance
+ * \param index        Stack index of the element
+ * \param parent       The node into which the element was inserted, or
+ *                     NULL if this is not known
+ */
+void element_stack_set_parent(hubbub_treebuilder *treebuilder,
+		uint32_t index, void *parent)
+{
+	element_context *entry = &treebuilder->context.element_stack[index];
+
+	entry->parent = parent;
+	entry->parent_epoch = treebuilder->context.parent_epoch;
+}
+
+/**
+ * Tell the client that an element is complete
+ *
+ * \param treebuilder  The treebuilder instance
+ * \param node         The element, which is no longer open
+ *
+ * Errors are remembered, to be returned once the current token has been
+ * processed, as the many callers which pop elements cannot fail.
+ */
+static void element_completed(hubbub_treebuilder *treebuilder, void *node)
+{
+	const hubbub_tree_handler_ext *ext = treebuilder->ext;
+	hubbub_error error = HUBBUB_OK;
+
+	if (ext == NULL || ext->element_complete == NULL ||
+			filter_skipped(treebuilder, node))
+		return;
+
+	/* Any text for the element goes in first */
+	if (treebuilder->context.text_parent == node)
+		error = flush_text(treebuilder);
+
+	if (error == HUBBUB_OK) {
+		error = ext->element_complete(
+				treebuilder->client_handler->ctx, node);
+	}
+
+	if (error != HUBBUB_OK &&
+			treebuilder->context.complete_error == HUBBUB_OK)
+		treebuilder->context.complete_error = error;
+}
+
+/**
+ * Tell the client that the elements which are still open are complete
+ *
+ * \param treebuilder  The treebuilder instance
+ *
+ * The root of a fragment is the client's, so is not reported.
+ */
+static void complete_open_elements(hubbub_treebuilder *treebuilder)
+{
+	element_context *stack = treebuilder->context.element_stack;
+	uint32_t base = treebuilder->context.fragment.active ? 1 : 0;
+	uint32_t n;
+
+	if (treebuilder->ext == NULL ||
+			treebuilder->ext->element_complete == NULL)
+		return;
+
+	for (n = treebuilder->context.current_node + 1; n > base; n--)
+		element_completed(treebuilder, stack[n - 1].node);
+}
+
+/**
+ * Stop parsing, leaving what has been built complete
+ *
+ * \param treebuilder  The treebuilder instance
+ * \return HUBBUB_STOPPED on success, appropriate error otherwise
+ */
+static hubbub_error stop_parsing(hubbub_treebuilder *treebuilder)
+{
+	hubbub_error err;
+
+	treebuilder->context.stopped = true;
+
+	err = flush_text(treebuilder);
+	if (err != HUBBUB_OK)
+		return err;
+
+	if (treebuilder->event_handler != NULL) {
+		err = event_close_all(treebuilder);
+		if (err != HUBBUB_OK)
+			return err;
+	}
+
+	complete_open_elements(treebuilder);
+	if (treebuilder->context.complete_error != HUBBUB_OK)
+		return treebuilder->context.complete_error;
+
+	return HUBBUB_STOPPED;
+}
+
 /**
  * Handle tokeniser emitting a token
  *
@@ -279,24 +637,56 @@ hubbub_error hubbub_treebuilder_token_handler(const hubbub_token *token,
 	hubbub_treebuilder *treebuilder = (hubbub_treebuilder *) pw;
 	hubbub_error err = HUBBUB_REPROCESS;
 
-	/* Do nothing if we have no document node or there's no tree handler */
-	if (treebuilder->context.document == NULL ||
+	/* Do nothing if we have no document node or there's no tree handler.
+	 * Fragments are built under their root, and need no document; nor
+	 * is there one if only events are wanted. */
+	if ((treebuilder->context.document == NULL &&
+			treebuilder->context.fragment.active == false &&
+			treebuilder->tree_handler !=
+					&treebuilder->event_stubs) ||
 			treebuilder->tree_handler == NULL)
 		return HUBBUB_OK;
 
 	assert((signed) treebuilder->context.current_node >= 0);
 
-/* A slightly nasty debugging hook, but very useful */
-#ifdef NDEBUG
-# define mode(x) \
-		case x:
-#else
-# define mode(x) \
+	if (treebuilder->context.stopped)
+		return HUBBUB_STOPPED;
+
+	/* Character tokens may continue the pending text; anything else
+	 * ends it */
+	if (token->type != HUBBUB_TOKEN_CHARACTER) {
+		err = flush_text(treebuilder);
+		if (err != HUBBUB_OK)
+			return err;
+
+		err = HUBBUB_REPROCESS;
+	}
+
+	if (token->type == HUBBUB_TOKEN_COMMENT) {
+		/* Only the first piece of a comment which was split at the
+		 * token limit goes into the tree */
+		bool skip = treebuilder->context.in_split_comment;
+
+		treebuilder->context.in_split_comment = token->incomplete;
+
+		if (skip)
+			return HUBBUB_OK;
+	}
+
+#define mode(x) \
 		case x: \
-			printf( #x "\n");
-#endif
+			HUBBUB_TRACE3(treebuilder__mode, treebuilder, x, \
+					token->type);
 
 	while (err == HUBBUB_REPROCESS) {
+		/* Stop on reaching the body, if only the head is wanted */
+		if (treebuilder->context.head_only &&
+				treebuilder->context.mode >= IN_BODY &&
+				treebuilder->context.mode != GENERIC_RCDATA) {
+			err = stop_parsing(treebuilder);
+			break;
+		}
+
 		switch (treebuilder->context.mode) {
 		mode(INITIAL)
 			err = handle_initial(treebuilder, token);
@@ -367,6 +757,21 @@ hubbub_error hubbub_treebuilder_token_handler(const hubbub_token *token,
 		}
 	}
 
+	/* Nothing more will be opened, so close everything */
+	if (err == HUBBUB_OK && token->type == HUBBUB_TOKEN_EOF) {
+		if (treebuilder->event_handler != NULL)
+			err = event_close_all(treebuilder);
+
+		complete_open_elements(treebuilder);
+	}
+
+	/* Report the first failure to complete an element */
+	if (err == HUBBUB_OK &&
+			treebuilder->context.complete_error != HUBBUB_OK) {
+		err = treebuilder->context.complete_error;
+		treebuilder->context.complete_error = HUBBUB_OK;
+	}
+
 	return err;
 }
 
@@ -391,11 +796,8 @@ hubbub_error process_characters_expect_whitespace(
 	size_t len = token->data.character.len;
 	size_t c;
 
-	for (c = 0; c < len; c++) {
-		if (data[c] != 0x09 && data[c] != 0x0A &&
-				data[c] != 0x0C && data[c] != 0x20)
-			break;
-	}
+	/* The tokeniser may know already */
+	c = token->whitespace ? len : hubbub_scan_whitespace(data, len);
 
 	if (c > 0 && insert_into_current_node) {
 		hubbub_error error;
@@ -436,6 +838,9 @@ hubbub_error process_comment_append(hubbub_treebuilder *treebuilder,
 	element_type type = current_node(treebuilder);
 	void *comment, *appended;
 
+	if (filter_skipped(treebuilder, parent))
+		return HUBBUB_OK;
+
 	error = treebuilder->tree_handler->create_comment(
 			treebuilder->tree_handler->ctx,
 			&token->data.comment, &comment);
@@ -446,7 +851,7 @@ hubbub_error process_comment_append(hubbub_treebuilder *treebuilder,
 			(type == TABLE || type == TBODY || type == TFOOT ||
 			type == THEAD || type == TR)) {
 		error = aa_insert_into_foster_parent(treebuilder, comment,
-				&appended);
+				&appended, NULL);
 	} else {
 		error = treebuilder->tree_handler->append_child(
 				treebuilder->tree_handler->ctx,
@@ -479,7 +884,7 @@ hubbub_error parse_generic_rcdata(hubbub_treebuilder *treebuilder,
 	element_type type;
 	hubbub_tokeniser_optparams params;
 
-	type = element_type_from_name(treebuilder, &token->data.tag.name);
+	type = element_type_from_tag(&token->data.tag);
 
 	error = insert_element(treebuilder, &token->data.tag, true);
 	if (error != HUBBUB_OK)
@@ -511,38 +916,28 @@ hubbub_error parse_generic_rcdata(hubbub_treebuilder *treebuilder,
 uint32_t element_in_scope(hubbub_treebuilder *treebuilder,
 		element_type type, bool in_table)
 {
-	uint32_t node;
+	element_context *stack = treebuilder->context.element_stack;
+	uint32_t node, bound;
 
-	if (treebuilder->context.element_stack == NULL)
+	if (stack == NULL)
 		return 0;
 
 	assert((signed) treebuilder->context.current_node >= 0);
 
-	for (node = treebuilder->context.current_node; node > 0; node--) {
-		hubbub_ns node_ns =
-				treebuilder->context.element_stack[node].ns;
-		element_type node_type =
-				treebuilder->context.element_stack[node].type;
-
-		if (node_type == type)
-			return node;
-
-		if (node_type == TABLE)
-			break;
+	/* The topmost element of the type is in scope if nothing between
+	 * it and the current node bounds scope. As it is the topmost, it
+	 * is never above the current node. */
+	node = treebuilder->context.element_top[type];
+	if (node == 0)
+		return 0;
 
-		/* The list of element types given in the spec here are the
-		 * scoping elements excluding TABLE and HTML. TABLE is handled
-		 * in the previous conditional and HTML should only occur
-		 * as the first node in the stack, which is never processed
-		 * in this loop. */
-		if (!in_table && (is_scoping_element(node_type) ||
-				(node_type == FOREIGNOBJECT &&
-						node_ns == HUBBUB_NS_SVG))) {
-			break;
-		}
+	if (in_table) {
+		bound = stack[treebuilder->context.current_node].table_scope;
+	} else {
+		bound = stack[treebuilder->context.current_node].scope;
 	}
 
-	return 0;
+	return node >= bound ? node : 0;
 }
 
 /**
@@ -554,35 +949,44 @@ uint32_t element_in_scope(hubbub_treebuilder *treebuilder,
 hubbub_error reconstruct_active_formatting_list(hubbub_treebuilder *treebuilder)
 {
 	hubbub_error error = HUBBUB_OK;
-	formatting_list_entry *entry, *initial_entry;
+	formatting_list_entry *list = treebuilder->context.formatting_list;
+	uint32_t len = treebuilder->context.formatting_list_len;
+	uint32_t index, initial_index;
 	uint32_t sp = treebuilder->context.current_node;
 
-	if (treebuilder->context.formatting_list == NULL)
+	if (len == 0)
 		return HUBBUB_OK;
 
-	entry = treebuilder->context.formatting_list_end;
+	index = len - 1;
 
 	/* Assumption: HTML and TABLE elements are not inserted into the list */
-	if (is_scoping_element(entry->details.type) || entry->stack_index != 0)
+	if (is_scoping_element(list[index].details.type) ||
+			list[index].stack_index != 0)
 		return HUBBUB_OK;
 
-	while (entry->prev != NULL) {
-		entry = entry->prev;
+	while (index > 0) {
+		index--;
 
-		if (is_scoping_element(entry->details.type) ||
-				entry->stack_index != 0) {
-			entry = entry->next;
+		if (is_scoping_element(list[index].details.type) ||
+				list[index].stack_index != 0) {
+			index++;
 			break;
 		}
 	}
 
 	/* Save initial entry for later */
-	initial_entry = entry;
+	initial_index = index;
+
+	error = flush_text(treebuilder);
+	if (error != HUBBUB_OK)
+		return error;
 
 	/* Process formatting list entries, cloning nodes and
 	 * inserting them into the DOM and element stack */
-	while (entry != NULL) {
+	for (; index < len; index++) {
+		formatting_list_entry *entry = &list[index];
 		void *clone, *appended;
+		void *parent;
 		bool foster;
 		element_type type = current_node(treebuilder);
 
@@ -601,14 +1005,12 @@ hubbub_error reconstruct_active_formatting_list(hubbub_treebuilder *treebuilder)
 
 		if (foster) {
 			error = aa_insert_into_foster_parent(treebuilder,
-					clone, &appended);
+					clone, &appended, &parent);
 		} else {
+			parent = insertion_parent(treebuilder);
 			error = treebuilder->tree_handler->append_child(
 					treebuilder->tree_handler->ctx,
-					treebuilder->context.element_stack[
-					treebuilder->context.current_node].node,
-					clone,
-					&appended);
+					parent, clone, &appended);
 		}
 
 		/* No longer interested in clone */
@@ -631,11 +1033,13 @@ hubbub_error reconstruct_active_formatting_list(hubbub_treebuilder *treebuilder)
 			goto cleanup;
 		}
 
-		entry = entry->next;
+		element_stack_set_parent(treebuilder,
+				treebuilder->context.current_node, parent);
 	}
 
 	/* Now, replace the formatting list entries */
-	for (entry = initial_entry; entry != NULL; entry = entry->next) {
+	for (index = initial_index; index < len; index++) {
+		formatting_list_entry *entry = &list[index];
 		void *node;
 		hubbub_ns prev_ns;
 		element_type prev_type;
@@ -691,11 +1095,37 @@ cleanup:
  */
 hubbub_error remove_node_from_dom(hubbub_treebuilder *treebuilder, void *node)
 {
+	element_context *stack = treebuilder->context.element_stack;
 	hubbub_error err;
 	void *parent = NULL;
 	void *removed;
+	uint32_t n;
 
-	err = treebuilder->tree_handler->get_parent(
+	/* Nodes on the stack usually have a known parent */
+	for (n = treebuilder->context.current_node + 1; n > 0; n--) {
+		if (stack[n - 1].node == node) {
+			parent = element_stack_parent(treebuilder, n - 1);
+			break;
+		}
+	}
+
+	if (parent != NULL) {
+		err = treebuilder->tree_handler->remove_child(
+				treebuilder->tree_handler->ctx,
+				parent, node, &removed);
+		if (err != HUBBUB_OK)
+			return err;
+
+		treebuilder->tree_handler->unref_node(
+				treebuilder->tree_handler->ctx,
+				removed);
+
+		stack[n - 1].parent = NULL;
+
+		return HUBBUB_OK;
+	}
+
+	err = treebuilder->tree_handler->get_parent(
 			treebuilder->tree_handler->ctx,
 			node, false, &parent);
 	if (err != HUBBUB_OK)
@@ -730,12 +1160,15 @@ void clear_active_formatting_list_to_marker(hubbub_treebuilder *treebuilder)
 	formatting_list_entry *entry;
 	bool done = false;
 
-	while ((entry = treebuilder->context.formatting_list_end) != NULL) {
+	while (treebuilder->context.formatting_list_len > 0) {
 		hubbub_ns ns;
 		element_type type;
 		void *node;
 		uint32_t stack_index;
 
+		entry = &treebuilder->context.formatting_list[
+				treebuilder->context.formatting_list_len - 1];
+
 		if (is_scoping_element(entry->details.type))
 			done = true;
 
@@ -751,6 +1184,45 @@ void clear_active_formatting_list_to_marker(hubbub_treebuilder *treebuilder)
 	}
 }
 
+/**
+ * Find the node into which an element is to be inserted, unless it is
+ * foster parented
+ *
+ * \param treebuilder  The treebuilder instance
+ * \return The current node or, where the stack of open elements is already
+ *         as deep as the tree may be, the current node's parent, so that
+ *         the element becomes its sibling
+ */
+void *insertion_parent(hubbub_treebuilder *treebuilder)
+{
+	uint32_t current = treebuilder->context.current_node;
+	void *node = treebuilder->context.element_stack[current].node;
+	void *parent;
+
+	if (treebuilder->context.max_depth == 0 ||
+			current + 1 < treebuilder->context.max_depth)
+		return node;
+
+	parent = element_stack_parent(treebuilder, current);
+	if (parent == NULL) {
+		if (treebuilder->tree_handler->get_parent(
+				treebuilder->tree_handler->ctx, node, true,
+				&parent) != HUBBUB_OK || parent == NULL)
+			return node;
+
+		element_stack_set_parent(treebuilder, current, parent);
+
+		/* The parent is held by the tree, for as long as the
+		 * current node is in it */
+		treebuilder->tree_handler->unref_node(
+				treebuilder->tree_handler->ctx, parent);
+	}
+
+	HUBBUB_STATS_ADD(treebuilder->stats, depth_limited, 1);
+
+	return parent;
+}
+
 /**
  * Create element and insert it into the DOM,
  * potentially pushing it on the stack
@@ -764,35 +1236,62 @@ hubbub_error insert_element(hubbub_treebuilder *treebuilder,
 		const hubbub_tag *tag, bool push)
 {
 	element_type type = current_node(treebuilder);
+	const hubbub_tree_handler_ext *ext = treebuilder->ext;
+	bool foster = treebuilder->context.in_table_foster &&
+			(type == TABLE || type == TBODY || type == TFOOT ||
+			type == THEAD || type == TR);
+	void *parent = foster ? treebuilder->context.element_stack[
+			treebuilder->context.current_node].node
+			: insertion_parent(treebuilder);
 	hubbub_error error;
 	void *node, *appended;
+	bool skip = false;
 
-	error = treebuilder->tree_handler->create_element(
-			treebuilder->tree_handler->ctx, tag, &node);
+	error = flush_text(treebuilder);
 	if (error != HUBBUB_OK)
 		return error;
 
-	if (treebuilder->context.in_table_foster &&
-			(type == TABLE || type == TBODY || type == TFOOT ||
-			type == THEAD || type == TR)) {
-		error = aa_insert_into_foster_parent(treebuilder, node,
-				&appended);
-	} else {
-		error = treebuilder->tree_handler->append_child(
-				treebuilder->tree_handler->ctx,
-				treebuilder->context.element_stack[
-					treebuilder->context.current_node].node,
-				node, &appended);
+	if (treebuilder->tree_handler == &treebuilder->filter_handler) {
+		error = filter_element(treebuilder, parent, tag, &skip);
+		if (error != HUBBUB_OK)
+			return error;
 	}
 
-	/* No longer interested in node */
-	treebuilder->tree_handler->unref_node(
-			treebuilder->tree_handler->ctx, node);
+	if (skip) {
+		error = filter_skip_node(treebuilder, &appended);
+		if (error != HUBBUB_OK)
+			return error;
+	} else if (foster == false && ext != NULL &&
+			ext->create_and_append_element != NULL) {
+		error = ext->create_and_append_element(
+				treebuilder->client_handler->ctx,
+				parent, tag, &appended);
+		if (error != HUBBUB_OK)
+			return error;
+	} else {
+		error = treebuilder->tree_handler->create_element(
+				treebuilder->tree_handler->ctx, tag, &node);
+		if (error != HUBBUB_OK)
+			return error;
 
-	if (error != HUBBUB_OK)
-		return error;
+		if (foster) {
+			error = aa_insert_into_foster_parent(treebuilder, node,
+					&appended, &parent);
+		} else {
+			error = treebuilder->tree_handler->append_child(
+					treebuilder->tree_handler->ctx,
+					parent, node, &appended);
+		}
 
-	type = element_type_from_name(treebuilder, &tag->name);
+		/* No longer interested in node */
+		treebuilder->tree_handler->unref_node(
+				treebuilder->tree_handler->ctx, node);
+
+		if (error != HUBBUB_OK)
+			return error;
+	}
+
+	type = element_type_from_tag(tag);
 	if (treebuilder->context.form_element != NULL &&
 			is_form_associated(type)) {
 		/* Consideration of @form is left to the client */
@@ -822,9 +1321,18 @@ hubbub_error insert_element(hubbub_treebuilder *treebuilder,
 					appended);
 			return error;
 		}
+
+		element_stack_set_parent(treebuilder,
+				treebuilder->context.current_node, parent);
+
+		if (treebuilder->event_handler != NULL)
+			return event_sync(treebuilder, tag);
 	} else {
 		treebuilder->tree_handler->unref_node(
 				treebuilder->tree_handler->ctx, appended);
+
+		if (treebuilder->event_handler != NULL)
+			return event_element(treebuilder, tag);
 	}
 
 	return HUBBUB_OK;
@@ -875,24 +1383,47 @@ void reset_insertion_mode(hubbub_treebuilder *treebuilder)
 {
 	uint32_t node;
 	element_context *stack = treebuilder->context.element_stack;
+	bool fragment = treebuilder->context.fragment.active;
+	bool last = false;
+	hubbub_ns ns;
+	element_type type;
+
+	for (node = treebuilder->context.current_node; ; node--) {
+		ns = stack[node].ns;
+		type = stack[node].type;
+
+		/* The root decides nothing, unless it stands in for the
+		 * context element of a fragment */
+		if (node == 0) {
+			if (fragment == false)
+				return;
 
-	/** \todo fragment parsing algorithm */
+			last = true;
+			ns = treebuilder->context.fragment.ns;
+			type = treebuilder->context.fragment.type;
+		}
 
-	for (node = treebuilder->context.current_node; node > 0; node--) {
-		if (stack[node].ns != HUBBUB_NS_HTML) {
+		if (ns != HUBBUB_NS_HTML) {
 			treebuilder->context.mode = IN_FOREIGN_CONTENT;
 			treebuilder->context.second_mode = IN_BODY;
-			break;
+			return;
 		}
 
-		switch (stack[node].type) {
+		switch (type) {
 		case SELECT:
 			/* fragment case */
+			if (fragment) {
+				treebuilder->context.mode = IN_SELECT;
+				return;
+			}
 			break;
 		case TD:
 		case TH:
-			treebuilder->context.mode = IN_CELL;
-			return;
+			if (last == false) {
+				treebuilder->context.mode = IN_CELL;
+				return;
+			}
+			break;
 		case TR:
 			treebuilder->context.mode = IN_ROW;
 			return;
@@ -906,25 +1437,47 @@ void reset_insertion_mode(hubbub_treebuilder *treebuilder)
 			return;
 		case COLGROUP:
 			/* fragment case */
+			if (fragment) {
+				treebuilder->context.mode = IN_COLUMN_GROUP;
+				return;
+			}
 			break;
 		case TABLE:
 			treebuilder->context.mode = IN_TABLE;
 			return;
 		case HEAD:
 			/* fragment case */
+			if (fragment) {
+				treebuilder->context.mode = IN_BODY;
+				return;
+			}
 			break;
 		case BODY:
 			treebuilder->context.mode = IN_BODY;
 			return;
 		case FRAMESET:
 			/* fragment case */
+			if (fragment) {
+				treebuilder->context.mode = IN_FRAMESET;
+				return;
+			}
 			break;
 		case HTML:
 			/* fragment case */
+			if (fragment) {
+				treebuilder->context.mode = BEFORE_HEAD;
+				return;
+			}
 			break;
 		default:
 			break;
 		}
+
+		if (last) {
+			/* fragment case */
+			treebuilder->context.mode = IN_BODY;
+			return;
+		}
 	}
 }
 
@@ -941,6 +1494,10 @@ hubbub_error complete_script(hubbub_treebuilder *treebuilder)
 		treebuilder->tree_handler->ctx,
 		treebuilder->context.element_stack[
 			treebuilder->context.current_node].node);
+
+	/* The script may have rearranged the tree */
+	hubbub_treebuilder_forget_parents(treebuilder);
+
 	return error;
 }
 
@@ -961,36 +1518,45 @@ hubbub_error complete_style(hubbub_treebuilder *treebuilder)
 }
 
 /**
- * Append text to the current node, inserting into the last child of the
- * current node, iff it's a Text node.
+ * Insert a text node into the DOM
  *
  * \param treebuilder  The treebuilder instance
- * \param string       The string to append
+ * \param parent       The node to append to, or NULL to foster parent
+ * \param string       The content of the text node
  * \return HUBBUB_OK on success, appropriate error otherwise
  */
-hubbub_error append_text(hubbub_treebuilder *treebuilder,
-		const hubbub_string *string)
+static hubbub_error insert_text(hubbub_treebuilder *treebuilder,
+		void *parent, const hubbub_string *string)
 {
-	element_type type = current_node(treebuilder);
+	const hubbub_tree_handler_ext *ext = treebuilder->ext;
 	hubbub_error error = HUBBUB_OK;
 	void *text, *appended;
 
+	if (treebuilder->event_handler != NULL) {
+		error = event_text(treebuilder, parent, string);
+
+		if (error != HUBBUB_OK || treebuilder->tree_handler ==
+				&treebuilder->event_stubs)
+			return error;
+	}
+
+	if (parent != NULL && ext != NULL && ext->append_text != NULL) {
+		return ext->append_text(treebuilder->client_handler->ctx,
+				parent, string);
+	}
+
 	error = treebuilder->tree_handler->create_text(
 			treebuilder->tree_handler->ctx, string, &text);
 	if (error != HUBBUB_OK)
 		return error;
 
-	if (treebuilder->context.in_table_foster &&
-			(type == TABLE || type == TBODY || type == TFOOT ||
-			type == THEAD || type == TR)) {
+	if (parent == NULL) {
 		error = aa_insert_into_foster_parent(treebuilder, text,
-				&appended);
+				&appended, NULL);
 	} else {
 		error = treebuilder->tree_handler->append_child(
 				treebuilder->tree_handler->ctx,
-				treebuilder->context.element_stack[
-					treebuilder->context.current_node].node,
-						text, &appended);
+				parent, text, &appended);
 	}
 
 	if (error == HUBBUB_OK) {
@@ -1005,33 +1571,108 @@ hubbub_error append_text(hubbub_treebuilder *treebuilder,
 }
 
 /**
- * Convert an element name into an element type
+ * Insert any pending text into the DOM
  *
  * \param treebuilder  The treebuilder instance
- * \param tag_name     The tag name to consider
- * \return The corresponding element type
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ *
+ * This must be called before anything else is inserted into the DOM, so
+ * that the text keeps its place in document order.
  */
-element_type element_type_from_name(hubbub_treebuilder *treebuilder,
-		const hubbub_string *tag_name)
+hubbub_error flush_text(hubbub_treebuilder *treebuilder)
 {
-	const uint8_t *name = tag_name->ptr;
-	size_t len = tag_name->len;
-	uint32_t i;
+	void *parent = treebuilder->context.text_parent;
+	hubbub_string string;
+	hubbub_error error;
 
-	UNUSED(treebuilder);
+	if (parent == NULL)
+		return HUBBUB_OK;
+
+	string.ptr = treebuilder->context.text;
+	string.len = treebuilder->context.text_len;
+
+	treebuilder->context.text_parent = NULL;
+	treebuilder->context.text_len = 0;
+
+	error = insert_text(treebuilder, parent, &string);
+
+	treebuilder->tree_handler->unref_node(
+			treebuilder->tree_handler->ctx, parent);
+
+	return error;
+}
+
+/**
+ * Append text to the current node, inserting into the last child of the
+ * current node, iff it's a Text node.
+ *
+ * \param treebuilder  The treebuilder instance
+ * \param string       The string to append
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ *
+ * Consecutive text for the same node is buffered, and passed to the client
+ * as a single node by flush_text().
+ */
+hubbub_error append_text(hubbub_treebuilder *treebuilder,
+		const hubbub_string *string)
+{
+	element_type type = current_node(treebuilder);
+	void *parent = treebuilder->context.element_stack[
+			treebuilder->context.current_node].node;
+	size_t len = treebuilder->context.text_len + string->len;
+	hubbub_error error;
+
+	/* Text inside a skipped element is not even buffered */
+	if (string->len == 0 || filter_skipped(treebuilder, parent))
+		return HUBBUB_OK;
+
+	if (treebuilder->context.in_table_foster &&
+			(type == TABLE || type == TBODY || type == TFOOT ||
+			type == THEAD || type == TR)) {
+		error = flush_text(treebuilder);
+		if (error != HUBBUB_OK)
+			return error;
 
-	/** \todo optimise this */
+		return insert_text(treebuilder, NULL, string);
+	}
 
-	for (i = 0; i < N_ELEMENTS(name_type_map); i++) {
-		if (name_type_map[i].len != len)
-			continue;
+	if (treebuilder->context.text_parent != parent) {
+		error = flush_text(treebuilder);
+		if (error != HUBBUB_OK)
+			return error;
 
-		if (strncasecmp(name_type_map[i].name,
-				(const char *) name, len) == 0)
-			return name_type_map[i].type;
+		len = string->len;
 	}
 
-	return UNKNOWN;
+	if (len > treebuilder->context.text_alloc) {
+		size_t alloc = treebuilder->context.text_alloc;
+		uint8_t *temp;
+
+		if (alloc == 0)
+			alloc = TEXT_BUFFER_CHUNK;
+		while (alloc < len)
+			alloc *= 2;
+
+		temp = treebuilder->alloc(treebuilder->context.text, alloc,
+				treebuilder->alloc_pw);
+		if (temp == NULL)
+			return HUBBUB_NOMEM;
+
+		treebuilder->context.text = temp;
+		treebuilder->context.text_alloc = alloc;
+	}
+
+	memcpy(treebuilder->context.text + treebuilder->context.text_len,
+			string->ptr, string->len);
+	treebuilder->context.text_len = len;
+
+	if (treebuilder->context.text_parent == NULL) {
+		treebuilder->tree_handler->ref_node(
+				treebuilder->tree_handler->ctx, parent);
+		treebuilder->context.text_parent = parent;
+	}
+
+	return HUBBUB_OK;
 }
 
 /**
@@ -1106,26 +1747,35 @@ hubbub_error element_stack_push(hubbub_treebuilder *treebuilder,
 	uint32_t slot = treebuilder->context.current_node + 1;
 
 	if (slot >= treebuilder->context.stack_alloc) {
-		element_context *temp = treebuilder->alloc(
-				treebuilder->context.element_stack,
-				(treebuilder->context.stack_alloc +
-					ELEMENT_STACK_CHUNK) *
-					sizeof(element_context),
-				treebuilder->alloc_pw);
+		/* Double the stack, so deep nesting is copied O(log n) times */
+		uint32_t alloc = treebuilder->context.stack_alloc * 2;
+		element_context *temp;
 
+		if (alloc < ELEMENT_STACK_CHUNK)
+			alloc = ELEMENT_STACK_CHUNK;
+
+		temp = treebuilder->alloc(treebuilder->context.element_stack,
+				alloc * sizeof(element_context),
+				treebuilder->alloc_pw);
 		if (temp == NULL)
 			return HUBBUB_NOMEM;
 
 		treebuilder->context.element_stack = temp;
-		treebuilder->context.stack_alloc += ELEMENT_STACK_CHUNK;
+		treebuilder->context.stack_alloc = alloc;
 	}
 
 	treebuilder->context.element_stack[slot].ns = ns;
 	treebuilder->context.element_stack[slot].type = type;
 	treebuilder->context.element_stack[slot].node = node;
+	treebuilder->context.element_stack[slot].parent = NULL;
 
 	treebuilder->context.current_node = slot;
 
+	/* The html element is in slot 0 */
+	HUBBUB_STATS_MAX(treebuilder->stats, max_depth, slot + 1);
+
+	element_stack_link(treebuilder, slot);
+
 	return HUBBUB_OK;
 }
 
@@ -1143,7 +1793,7 @@ hubbub_error element_stack_pop(hubbub_treebuilder *treebuilder,
 {
 	element_context *stack = treebuilder->context.element_stack;
 	uint32_t slot = treebuilder->context.current_node;
-	formatting_list_entry *entry;
+	uint32_t n;
 
 	/* We're popping a table, find previous */
 	if (stack[slot].type == TABLE) {
@@ -1161,8 +1811,10 @@ hubbub_error element_stack_pop(hubbub_treebuilder *treebuilder,
 		/* Find occurrences of the node we're about to pop in the list
 		 * of active formatting elements. We need to invalidate their
 		 * stack index information. */
-		for (entry = treebuilder->context.formatting_list_end;
-				entry != NULL; entry = entry->prev) {
+		for (n = treebuilder->context.formatting_list_len; n > 0; n--) {
+			formatting_list_entry *entry =
+				&treebuilder->context.formatting_list[n - 1];
+
 			/** \todo Can we optimise this?
 			 * (i.e. by not traversing the entire list) */
 			if (entry->stack_index == slot)
@@ -1174,11 +1826,16 @@ hubbub_error element_stack_pop(hubbub_treebuilder *treebuilder,
 	*type = stack[slot].type;
 	*node = stack[slot].node;
 
+	treebuilder->context.element_top[stack[slot].type] =
+			stack[slot].prev_same;
+
 	/** \todo reduce allocated stack size once there's enough free */
 
 	treebuilder->context.current_node = slot - 1;
 	assert((signed) treebuilder->context.current_node >= 0);
 
+	element_completed(treebuilder, *node);
+
 	return HUBBUB_OK;
 }
 
@@ -1225,30 +1882,22 @@ hubbub_error element_stack_remove(hubbub_treebuilder *treebuilder,
 
 	assert(index <= treebuilder->context.current_node);
 
-	/* Scan over subsequent entries in the stack,
-	 * searching for them in the list of active formatting
-	 * entries. If found, update the corresponding
-	 * formatting list entry's stack index to match the
-	 * new stack location */
-	for (n = index + 1; n <= treebuilder->context.current_node; n++) {
-		if (is_formatting_element(stack[n].type) ||
-				(is_scoping_element(stack[n].type) &&
-				stack[n].type != HTML &&
-				stack[n].type != TABLE)) {
-			formatting_list_entry *e;
-
-			for (e = treebuilder->context.formatting_list_end;
-					e != NULL; e = e->prev) {
-				if (e->stack_index == n)
-					e->stack_index--;
-			}
-		}
+	/* Update the stack index of any formatting list entry for
+	 * a subsequent entry in the stack to match its new location */
+	for (n = 0; n < treebuilder->context.formatting_list_len; n++) {
+		formatting_list_entry *entry =
+				&treebuilder->context.formatting_list[n];
+
+		if (entry->stack_index > index)
+			entry->stack_index--;
 	}
 
 	*ns = stack[index].ns;
 	*type = stack[index].type;
 	*removed = stack[index].node;
 
+	element_stack_unlink(treebuilder, index);
+
 	/* Now, shuffle the stack up one, removing node in the process */
 	if (index < treebuilder->context.current_node) {
 		memmove(&stack[index], &stack[index + 1],
@@ -1258,24 +1907,115 @@ hubbub_error element_stack_remove(hubbub_treebuilder *treebuilder,
 
 	treebuilder->context.current_node--;
 
+	element_stack_link(treebuilder, index);
+
 	return HUBBUB_OK;
 }
 
+/**
+ * Forget the scope information of the elements at and above an index in
+ * the stack of open elements, before they are moved or replaced
+ *
+ * \param treebuilder  The treebuilder instance
+ * \param index        Index of the lowest element to forget
+ */
+void element_stack_unlink(hubbub_treebuilder *treebuilder, uint32_t index)
+{
+	element_context *stack = treebuilder->context.element_stack;
+	uint32_t n;
+
+	if (index == 0)
+		index = 1;
+
+	for (n = treebuilder->context.current_node; n >= index; n--) {
+		treebuilder->context.element_top[stack[n].type] =
+				stack[n].prev_same;
+	}
+}
+
+/**
+ * Compute the scope information of the elements at and above an index in
+ * the stack of open elements
+ *
+ * Everything in the stack below index must already have been linked, and
+ * nothing at or above it.
+ *
+ * \param treebuilder  The treebuilder instance
+ * \param index        Index of the lowest element to link
+ */
+void element_stack_link(hubbub_treebuilder *treebuilder, uint32_t index)
+{
+	element_context *stack = treebuilder->context.element_stack;
+	uint32_t n;
+
+	if (index == 0)
+		index = 1;
+
+	for (n = index; n <= treebuilder->context.current_node; n++) {
+		element_type type = stack[n].type;
+
+		stack[n].prev_same = treebuilder->context.element_top[type];
+		treebuilder->context.element_top[type] = n;
+
+		/* The scoping elements, less HTML (which only occurs at
+		 * the bottom of the stack, so is never examined), and
+		 * SVG's foreignObject bound scope; only TABLE bounds
+		 * table scope */
+		if (type == TABLE) {
+			stack[n].scope = stack[n].table_scope = n;
+		} else {
+			stack[n].table_scope = stack[n - 1].table_scope;
+
+			if (is_scoping_element(type) ||
+					(type == FOREIGNOBJECT &&
+					stack[n].ns == HUBBUB_NS_SVG))
+				stack[n].scope = n;
+			else
+				stack[n].scope = stack[n - 1].scope;
+		}
+	}
+}
+
 /**
  * Find the stack index of the current table.
+ *
+ * \param treebuilder  The treebuilder
+ * \return Stack index of the current table, or 0 if there is none
  */
 uint32_t current_table(hubbub_treebuilder *treebuilder)
 {
-	element_context *stack = treebuilder->context.element_stack;
-	size_t t;
+	/* 0 is also the fragment case */
+	return treebuilder->context.element_top[TABLE];
+}
 
-	for (t = treebuilder->context.current_node; t != 0; t--) {
-		if (stack[t].type == TABLE)
-			return t;
+/**
+ * Find the element type of a tag
+ *
+ * \param tag  The tag to consider
+ * \return The tag's element type, or UNKNOWN if it has none
+ *
+ * Every element name has an atom, so the type is found from the tag's
+ * atom. The SVG names which the treebuilder adjusts to mixed case have
+ * none, so are looked up by name instead.
+ */
+element_type element_type_from_tag(const hubbub_tag *tag)
+{
+	uint32_t hash = HUBBUB_ELEMENT_HASH_INIT;
+	size_t i;
+
+	if (tag->atom != HUBBUB_ATOM_NONE || tag->ns != HUBBUB_NS_SVG)
+		return hubbub_element_type_from_atom(tag->atom);
+
+	for (i = 0; i < tag->name.len; i++) {
+		uint8_t c = tag->name.ptr[i];
+
+		if ('A' <= c && c <= 'Z')
+			c += 'a' - 'A';
+
+		hash = hubbub_element_hash_step(hash, c);
 	}
 
-	/* fragment case */
-	return 0;
+	return hubbub_element_type_lookup(hash, tag->name.ptr, tag->name.len);
 }
 
 /**
@@ -1307,94 +2047,380 @@ element_type prev_node(hubbub_treebuilder *treebuilder)
 
 
 
+/**
+ * Make room for another entry in the list of active formatting elements
+ *
+ * \param treebuilder  Treebuilder instance containing list
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ */
+static hubbub_error formatting_list_grow(hubbub_treebuilder *treebuilder)
+{
+	formatting_list_entry *temp;
+	uint32_t alloc = treebuilder->context.formatting_list_alloc;
+
+	if (treebuilder->context.formatting_list_len < alloc)
+		return HUBBUB_OK;
+
+	/* The list is reused for the whole parse, so grow it geometrically
+	 * and never shrink it */
+	alloc = (alloc == 0) ? FORMATTING_LIST_CHUNK : alloc * 2;
+
+	temp = treebuilder->alloc(treebuilder->context.formatting_list,
+			alloc * sizeof(formatting_list_entry),
+			treebuilder->alloc_pw);
+	if (temp == NULL)
+		return HUBBUB_NOMEM;
+
+	treebuilder->context.formatting_list = temp;
+	treebuilder->context.formatting_list_alloc = alloc;
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Compute the signature of a tag's attributes
+ *
+ * Tags with the same attributes, in any order, have the same signature.
+ *
+ * \param tag  Tag to consider
+ * \return Signature of tag's attributes
+ */
+static uint32_t formatting_list_signature(const hubbub_tag *tag)
+{
+	uint32_t signature = tag->n_attributes;
+	uint32_t i;
+	size_t c;
+
+	for (i = 0; i < tag->n_attributes; i++) {
+		const hubbub_attribute *attr = &tag->attributes[i];
+		uint32_t hash = HUBBUB_ELEMENT_HASH_INIT;
+
+		hash = hubbub_element_hash_step(hash, (uint8_t) attr->ns);
+
+		for (c = 0; c < attr->name.len; c++)
+			hash = hubbub_element_hash_step(hash,
+					attr->name.ptr[c]);
+
+		/* Separate the name from the value */
+		hash = hubbub_element_hash_step(hash, '\0');
+
+		for (c = 0; c < attr->value.len; c++)
+			hash = hubbub_element_hash_step(hash,
+					attr->value.ptr[c]);
+
+		signature += hash;
+	}
+
+	return signature;
+}
+
+/**
+ * Make room in the attribute data of the list of active formatting elements
+ *
+ * Entries removed from the list leave their attributes behind, so when the
+ * data is full, the attributes of the remaining entries are copied to a
+ * fresh block, at least twice the size of what is kept.
+ *
+ * \param treebuilder  Treebuilder instance containing list
+ * \param len          Number of bytes needed
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ */
+static hubbub_error formatting_attrs_reserve(hubbub_treebuilder *treebuilder,
+		size_t len)
+{
+	hubbub_treebuilder_context *ctx = &treebuilder->context;
+	size_t alloc = ctx->formatting_attrs_alloc;
+	size_t used = len;
+	uint8_t *temp;
+	uint32_t n;
+
+	/* Nothing refers to the data once the list is empty */
+	if (ctx->formatting_list_len == 0)
+		ctx->formatting_attrs_len = 0;
+
+	if (len <= alloc - ctx->formatting_attrs_len)
+		return HUBBUB_OK;
+
+	for (n = 0; n < ctx->formatting_list_len; n++)
+		used += ctx->formatting_list[n].attributes.len;
+
+	if (alloc == 0)
+		alloc = FORMATTING_ATTRS_CHUNK;
+	while (alloc < used * 2)
+		alloc *= 2;
+
+	temp = treebuilder->alloc(NULL, alloc, treebuilder->alloc_pw);
+	if (temp == NULL)
+		return HUBBUB_NOMEM;
+
+	used = 0;
+	for (n = 0; n < ctx->formatting_list_len; n++) {
+		formatting_attributes *attributes =
+				&ctx->formatting_list[n].attributes;
+
+		if (attributes->len > 0) {
+			memcpy(temp + used,
+					ctx->formatting_attrs +
+							attributes->data,
+					attributes->len);
+		}
+		attributes->data = used;
+		used += attributes->len;
+	}
+
+	if (ctx->formatting_attrs != NULL) {
+		treebuilder->alloc(ctx->formatting_attrs, 0,
+				treebuilder->alloc_pw);
+	}
+
+	ctx->formatting_attrs = temp;
+	ctx->formatting_attrs_len = used;
+	ctx->formatting_attrs_alloc = alloc;
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Keep a copy of a tag's attributes, for the list of active formatting
+ * elements
+ *
+ * Each attribute is kept as its namespace, in a byte, then the length and
+ * bytes of its name, then those of its value.
+ *
+ * \param treebuilder  Treebuilder instance containing list
+ * \param tag          Tag whose attributes to keep
+ * \param signature    Signature of tag's attributes
+ * \param attributes   Pointer to location to receive kept attributes
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ */
+static hubbub_error formatting_attrs_store(hubbub_treebuilder *treebuilder,
+		const hubbub_tag *tag, uint32_t signature,
+		formatting_attributes *attributes)
+{
+	hubbub_treebuilder_context *ctx = &treebuilder->context;
+	size_t len = 0;
+	uint8_t *data;
+	hubbub_error err;
+	uint32_t i;
+
+	for (i = 0; i < tag->n_attributes; i++) {
+		len += 1 + 2 * sizeof(size_t) +
+				tag->attributes[i].name.len +
+				tag->attributes[i].value.len;
+	}
+
+	attributes->signature = signature;
+	attributes->count = tag->n_attributes;
+	attributes->data = 0;
+	attributes->len = len;
+
+	if (len == 0)
+		return HUBBUB_OK;
+
+	err = formatting_attrs_reserve(treebuilder, len);
+	if (err != HUBBUB_OK)
+		return err;
+
+	attributes->data = ctx->formatting_attrs_len;
+	data = ctx->formatting_attrs + ctx->formatting_attrs_len;
+
+	for (i = 0; i < tag->n_attributes; i++) {
+		const hubbub_attribute *attr = &tag->attributes[i];
+
+		*data++ = (uint8_t) attr->ns;
+
+		memcpy(data, &attr->name.len, sizeof(size_t));
+		data += sizeof(size_t);
+		if (attr->name.len > 0)
+			memcpy(data, attr->name.ptr, attr->name.len);
+		data += attr->name.len;
+
+		memcpy(data, &attr->value.len, sizeof(size_t));
+		data += sizeof(size_t);
+		if (attr->value.len > 0)
+			memcpy(data, attr->value.ptr, attr->value.len);
+		data += attr->value.len;
+	}
+
+	ctx->formatting_attrs_len += len;
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Determine if an entry in the list of active formatting elements has the
+ * same attributes as a tag, in any order
+ *
+ * \param treebuilder  Treebuilder instance containing list
+ * \param attributes   Attributes of the entry
+ * \param tag          Tag to compare with
+ * \param signature    Signature of tag's attributes
+ * \return True if the attributes are the same, false otherwise
+ */
+static bool formatting_attrs_match(hubbub_treebuilder *treebuilder,
+		const formatting_attributes *attributes,
+		const hubbub_tag *tag, uint32_t signature)
+{
+	const uint8_t *start, *end;
+	uint32_t i;
+
+	/* The signature rules out all but the identical, and collisions */
+	if (attributes->signature != signature ||
+			attributes->count != tag->n_attributes)
+		return false;
+
+	if (attributes->count == 0)
+		return true;
+
+	start = treebuilder->context.formatting_attrs + attributes->data;
+	end = start + attributes->len;
+
+	/* A tag's attribute names are distinct, so each of the tag's
+	 * attributes must be found among the entry's */
+	for (i = 0; i < tag->n_attributes; i++) {
+		const hubbub_attribute *attr = &tag->attributes[i];
+		const uint8_t *data;
+		bool found = false;
+
+		for (data = start; data < end && found == false; ) {
+			size_t name_len, value_len;
+			const uint8_t *name, *value;
+			uint8_t ns = *data++;
+
+			memcpy(&name_len, data, sizeof(size_t));
+			name = data + sizeof(size_t);
+			data = name + name_len;
+
+			memcpy(&value_len, data, sizeof(size_t));
+			value = data + sizeof(size_t);
+			data = value + value_len;
+
+			found = ns == (uint8_t) attr->ns &&
+					name_len == attr->name.len &&
+					value_len == attr->value.len &&
+					memcmp(name, attr->name.ptr,
+							name_len) == 0 &&
+					memcmp(value, attr->value.ptr,
+							value_len) == 0;
+		}
+
+		if (found == false)
+			return false;
+	}
+
+	return true;
+}
+
 /**
  * Append an element to the end of the list of active formatting elements
  *
+ * If there are already three identical elements after the last marker,
+ * the earliest of them is removed from the list, so a run of unclosed
+ * formatting elements can't make the list grow without limit.
+ *
  * \param treebuilder  Treebuilder instance containing list
- * \param ns           Namespace of node being inserted
+ * \param tag          Tag of node being inserted
  * \param type         Type of node being inserted
  * \param node         Node being inserted
  * \param stack_index  Index into stack of open elements
  * \return HUBBUB_OK on success, appropriate error otherwise
  */
 hubbub_error formatting_list_append(hubbub_treebuilder *treebuilder,
-		hubbub_ns ns, element_type type, void *node,
+		const hubbub_tag *tag, element_type type, void *node,
 		uint32_t stack_index)
 {
-	formatting_list_entry *entry;
+	formatting_list_entry *list = treebuilder->context.formatting_list;
+	uint32_t signature = formatting_list_signature(tag);
+	formatting_attributes attributes;
+	uint32_t n, count = 0, earliest = 0;
+	hubbub_error err;
 
-	entry = treebuilder->alloc(NULL, sizeof(formatting_list_entry),
-			treebuilder->alloc_pw);
-	if (entry == NULL)
-		return HUBBUB_NOMEM;
+	/* Markers are exempt. Assumption: they are the scoping elements */
+	if (is_scoping_element(type))
+		n = 0;
+	else
+		n = treebuilder->context.formatting_list_len;
 
-	entry->details.ns = ns;
-	entry->details.type = type;
-	entry->details.node = node;
-	entry->stack_index = stack_index;
+	for (; n > 0; n--) {
+		formatting_list_entry *entry = &list[n - 1];
 
-	entry->prev = treebuilder->context.formatting_list_end;
-	entry->next = NULL;
+		if (is_scoping_element(entry->details.type))
+			break;
 
-	if (entry->prev != NULL)
-		entry->prev->next = entry;
-	else
-		treebuilder->context.formatting_list = entry;
+		if (entry->details.type == type &&
+				entry->details.ns == tag->ns &&
+				formatting_attrs_match(treebuilder,
+					&entry->attributes, tag, signature)) {
+			count++;
+			earliest = n - 1;
+		}
+	}
 
-	treebuilder->context.formatting_list_end = entry;
+	if (count >= 3) {
+		hubbub_ns ons;
+		element_type otype;
+		void *onode;
+		uint32_t oindex;
 
-	return HUBBUB_OK;
+		formatting_list_remove(treebuilder, &list[earliest],
+				&ons, &otype, &onode, &oindex);
+
+		treebuilder->tree_handler->unref_node(
+				treebuilder->tree_handler->ctx, onode);
+	}
+
+	err = formatting_attrs_store(treebuilder, tag, signature, &attributes);
+	if (err != HUBBUB_OK)
+		return err;
+
+	return formatting_list_insert(treebuilder,
+			treebuilder->context.formatting_list_len,
+			tag->ns, type, node, stack_index, &attributes);
 }
 
 /**
  * Insert an element into the list of active formatting elements
  *
  * \param treebuilder  Treebuilder instance containing list
- * \param prev         Previous entry
- * \param next         Next entry
+ * \param index        Index in list to insert at
  * \param ns           Namespace of node being inserted
  * \param type         Type of node being inserted
  * \param node         Node being inserted
  * \param stack_index  Index into stack of open elements
+ * \param attributes   Node's attributes, kept by the list
  * \return HUBBUB_OK on success, appropriate error otherwise
  */
 hubbub_error formatting_list_insert(hubbub_treebuilder *treebuilder,
-		formatting_list_entry *prev, formatting_list_entry *next,
-		hubbub_ns ns, element_type type, void *node,
-		uint32_t stack_index)
+		uint32_t index, hubbub_ns ns, element_type type, void *node,
+		uint32_t stack_index, const formatting_attributes *attributes)
 {
 	formatting_list_entry *entry;
+	hubbub_error err;
 
-	if (prev != NULL) {
-		assert(prev->next == next);
-	}
+	assert(index <= treebuilder->context.formatting_list_len);
 
-	if (next != NULL) {
-		assert(next->prev == prev);
-	}
+	err = formatting_list_grow(treebuilder);
+	if (err != HUBBUB_OK)
+		return err;
 
-	entry = treebuilder->alloc(NULL, sizeof(formatting_list_entry),
-			treebuilder->alloc_pw);
-	if (entry == NULL)
-		return HUBBUB_NOMEM;
+	entry = &treebuilder->context.formatting_list[index];
+
+	if (index < treebuilder->context.formatting_list_len) {
+		memmove(entry + 1, entry,
+				(treebuilder->context.formatting_list_len -
+				index) * sizeof(formatting_list_entry));
+	}
 
 	entry->details.ns = ns;
 	entry->details.type = type;
 	entry->details.node = node;
 	entry->stack_index = stack_index;
+	entry->attributes = *attributes;
 
-	entry->prev = prev;
-	entry->next = next;
-
-	if (entry->prev != NULL)
-		entry->prev->next = entry;
-	else
-		treebuilder->context.formatting_list = entry;
+	treebuilder->context.formatting_list_len++;
 
-	if (entry->next != NULL)
-		entry->next->prev = entry;
-	else
-		treebuilder->context.formatting_list_end = entry;
+	HUBBUB_STATS_MAX(treebuilder->stats, max_formatting,
+			treebuilder->context.formatting_list_len);
 
 	return HUBBUB_OK;
 }
@@ -1416,22 +2442,23 @@ hubbub_error formatting_list_remove(hubbub_treebuilder *treebuilder,
 		hubbub_ns *ns, element_type *type, void **node,
 		uint32_t *stack_index)
 {
+	formatting_list_entry *end = treebuilder->context.formatting_list +
+			treebuilder->context.formatting_list_len;
+
+	assert(entry >= treebuilder->context.formatting_list && entry < end);
+
 	*ns = entry->details.ns;
 	*type = entry->details.type;
 	*node = entry->details.node;
 	*stack_index = entry->stack_index;
 
-	if (entry->prev == NULL)
-		treebuilder->context.formatting_list = entry->next;
-	else
-		entry->prev->next = entry->next;
-
-	if (entry->next == NULL)
-		treebuilder->context.formatting_list_end = entry->prev;
-	else
-		entry->next->prev = entry->prev;
+	if (entry + 1 < end) {
+		memmove(entry, entry + 1,
+				(end - entry - 1) *
+				sizeof(formatting_list_entry));
+	}
 
-	treebuilder->alloc(entry, 0, treebuilder->alloc_pw);
+	treebuilder->context.formatting_list_len--;
 
 	return HUBBUB_OK;
 }
@@ -1505,9 +2532,11 @@ void element_stack_dump(hubbub_treebuilder *treebuilder, FILE *fp)
 void formatting_list_dump(hubbub_treebuilder *treebuilder, FILE *fp)
 {
 	formatting_list_entry *entry;
+	uint32_t n;
+
+	for (n = 0; n < treebuilder->context.formatting_list_len; n++) {
+		entry = &treebuilder->context.formatting_list[n];
 
-	for (entry = treebuilder->context.formatting_list; entry != NULL;
-			entry = entry->next) {
 		fprintf(fp, "%s %p %u\n",
 				element_type_to_name(entry->details.type),
 				entry->details.node, entry->stack_index);
@@ -1522,16 +2551,7 @@ void formatting_list_dump(hubbub_treebuilder *treebuilder, FILE *fp)
  */
 const char *element_type_to_name(element_type type)
 {
-	size_t i;
-
-	for (i = 0;
-			i < sizeof(name_type_map) / sizeof(name_type_map[0]);
-			i++) {
-		if (name_type_map[i].type == type)
-			return name_type_map[i].name;
-	}
-
-	return "UNKNOWN";
+	return hubbub_element_type_to_name(type);
 }
 #endif
 
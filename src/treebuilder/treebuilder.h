@@ -20,6 +20,19 @@
 
 typedef struct hubbub_treebuilder hubbub_treebuilder;
 
+typedef struct hubbub_treebuilder_checkpoint hubbub_treebuilder_checkpoint;
+
+/**
+ * Callback on finding the document's charset in a meta element
+ *
+ * \param charset  Name of the charset
+ * \param pw       Client data
+ * \return true if the charset has been dealt with, false to leave it to the
+ *         tree handler's encoding_change callback
+ */
+typedef bool (*hubbub_treebuilder_charset_handler)(const char *charset,
+		void *pw);
+
 /**
  * Hubbub treebuilder option types
  */
@@ -28,7 +41,14 @@ typedef enum hubbub_treebuilder_opttype {
 	HUBBUB_TREEBUILDER_TREE_HANDLER,
 	HUBBUB_TREEBUILDER_DOCUMENT_NODE,
 	HUBBUB_TREEBUILDER_ENABLE_SCRIPTING,
-	HUBBUB_TREEBUILDER_ENABLE_STYLING
+	HUBBUB_TREEBUILDER_ENABLE_STYLING,
+	HUBBUB_TREEBUILDER_TREE_HANDLER_EXT,
+	HUBBUB_TREEBUILDER_FRAGMENT,
+	HUBBUB_TREEBUILDER_EVENT_HANDLER,
+	HUBBUB_TREEBUILDER_HEAD_ONLY,
+	HUBBUB_TREEBUILDER_CHARSET_HANDLER,
+	HUBBUB_TREEBUILDER_STATS,
+	HUBBUB_TREEBUILDER_MAX_DEPTH
 } hubbub_treebuilder_opttype;
 
 /**
@@ -46,6 +66,27 @@ typedef union hubbub_treebuilder_optparams {
 
 	bool enable_scripting;			/**< Enable scripting */
 	bool enable_styling;			/**< Enable styling */
+	bool head_only;				/**< Stop at the body */
+	uint32_t max_depth;			/**< Most open elements to nest,
+						 * or 0 for no limit */
+
+	hubbub_tree_handler_ext *tree_handler_ext;
+					/**< Extended tree handling callbacks */
+
+	hubbub_fragment fragment;		/**< Fragment parsing context */
+
+	struct {
+		hubbub_event_handler handler;
+		void *pw;
+	} event_handler;			/**< Event handling callback */
+
+	struct {
+		hubbub_treebuilder_charset_handler handler;
+		void *pw;
+	} charset_handler;			/**< Meta charset callback */
+
+	hubbub_parser_stats *stats;	/**< Counters to count into, or NULL.
+					 * Only kept with HUBBUB_WITH_STATS */
 } hubbub_treebuilder_optparams;
 
 /* Create a hubbub treebuilder */
@@ -56,10 +97,32 @@ hubbub_error hubbub_treebuilder_create(hubbub_tokeniser *tokeniser,
 /* Destroy a hubbub treebuilder */
 hubbub_error hubbub_treebuilder_destroy(hubbub_treebuilder *treebuilder);
 
+/* Return a hubbub treebuilder to its initial state */
+hubbub_error hubbub_treebuilder_reset(hubbub_treebuilder *treebuilder);
+
 /* Configure a hubbub treebuilder */
 hubbub_error hubbub_treebuilder_setopt(hubbub_treebuilder *treebuilder,
 		hubbub_treebuilder_opttype type,
 		hubbub_treebuilder_optparams *params);
 
+/* Save the treebuilder's state, between tokens */
+hubbub_error hubbub_treebuilder_save(hubbub_treebuilder *treebuilder,
+		hubbub_treebuilder_checkpoint **checkpoint);
+
+/* Return the treebuilder to a saved state */
+hubbub_error hubbub_treebuilder_restore(hubbub_treebuilder *treebuilder,
+		const hubbub_treebuilder_checkpoint *checkpoint);
+
+/* Destroy a treebuilder checkpoint */
+void hubbub_treebuilder_release(hubbub_treebuilder *treebuilder,
+		hubbub_treebuilder_checkpoint *checkpoint);
+
+/* Determine whether two checkpoints build the tree alike from here on */
+bool hubbub_treebuilder_same_state(const hubbub_treebuilder_checkpoint *a,
+		const hubbub_treebuilder_checkpoint *b);
+
+/* Tell a hubbub treebuilder that the client may have changed the tree */
+void hubbub_treebuilder_forget_parents(hubbub_treebuilder *treebuilder);
+
 #endif
 
@@ -0,0 +1,302 @@
+/*
+ * This file is part of Hubbub.
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license.php
+ * Copyright 2026 agent <agent@local>
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <hubbub/arena.h>
+
+/** Size of the chunks from which small objects are carved */
+#define ARENA_CHUNK_SIZE (64 * 1024)
+
+/** Size of the smallest size class is 1 << ARENA_MIN_SHIFT */
+#define ARENA_MIN_SHIFT 4
+/** Number of size classes; larger objects are allocated individually */
+#define ARENA_CLASSES 8
+/** Size of the largest size class */
+#define ARENA_MAX_SMALL ((size_t) 1 << (ARENA_MIN_SHIFT + ARENA_CLASSES - 1))
+
+/**
+ * Header preceding every object, padded to suit any type
+ */
+typedef union arena_header {
+	size_t size;		/**< Usable size of object */
+
+	void *align_ptr;	/**< Alignment padding */
+	long double align_ld;	/**< Alignment padding */
+	long long align_ll;	/**< Alignment padding */
+} arena_header;
+
+/**
+ * A chunk from which small objects are carved
+ */
+typedef union arena_chunk {
+	union arena_chunk *next;	/**< Next chunk in arena */
+
+	arena_header align;		/**< Alignment padding */
+} arena_chunk;
+
+/**
+ * An object too big for any size class
+ */
+typedef struct arena_large {
+	struct arena_large *prev;	/**< Previous large object */
+	struct arena_large *next;	/**< Next large object */
+
+	arena_header header;		/**< Object header */
+} arena_large;
+
+/**
+ * A free small object
+ */
+typedef struct arena_free {
+	struct arena_free *next;	/**< Next free object of this size */
+} arena_free;
+
+/**
+ * Memory arena
+ */
+struct hubbub_arena {
+	hubbub_allocator_fn alloc;	/**< Backing allocator */
+	void *pw;			/**< Backing allocator's data */
+
+	arena_chunk *chunks;		/**< Chunks, most recent first */
+	uint8_t *next;			/**< Next free byte in current chunk */
+	uint8_t *end;			/**< End of current chunk */
+
+	arena_free *free[ARENA_CLASSES];	/**< Free objects, by class */
+
+	arena_large *large;		/**< Large objects */
+};
+
+/**
+ * Create a memory arena
+ *
+ * \param alloc  Memory (de)allocation function backing the arena
+ * \param pw     Pointer to client-specific private data (may be NULL)
+ * \param arena  Pointer to location to receive arena instance
+ * \return HUBBUB_OK on success,
+ *         HUBBUB_BADPARM on bad parameters,
+ *         HUBBUB_NOMEM on memory exhaustion
+ */
+hubbub_error hubbub_arena_create(hubbub_allocator_fn alloc, void *pw,
+		hubbub_arena **arena)
+{
+	hubbub_arena *a;
+
+	if (alloc == NULL || arena == NULL)
+		return HUBBUB_BADPARM;
+
+	a = alloc(NULL, sizeof(hubbub_arena), pw);
+	if (a == NULL)
+		return HUBBUB_NOMEM;
+
+	memset(a, 0, sizeof(hubbub_arena));
+	a->alloc = alloc;
+	a->pw = pw;
+
+	*arena = a;
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Destroy a memory arena, and release everything allocated from it
+ *
+ * \param arena  The arena to destroy
+ * \return HUBBUB_OK on success, appropriate error otherwise
+ */
+hubbub_error hubbub_arena_destroy(hubbub_arena *arena)
+{
+	if (arena == NULL)
+		return HUBBUB_BADPARM;
+
+	while (arena->large != NULL) {
+		arena_large *next = arena->large->next;
+
+		arena->alloc(arena->large, 0, arena->pw);
+		arena->large = next;
+	}
+
+	while (arena->chunks != NULL) {
+		arena_chunk *next = arena->chunks->next;
+
+		arena->alloc(arena->chunks, 0, arena->pw);
+		arena->chunks = next;
+	}
+
+	arena->alloc(arena, 0, arena->pw);
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Find the size class for an object
+ *
+ * \param size  Size of object, which must be at most ARENA_MAX_SMALL
+ * \return Index of the smallest class which will hold the object
+ */
+static inline uint32_t arena_class(size_t size)
+{
+	uint32_t c = 0;
+
+	while (((size_t) 1 << (ARENA_MIN_SHIFT + c)) < size)
+		c++;
+
+	return c;
+}
+
+/**
+ * Allocate a new object from an arena
+ *
+ * \param arena  The arena
+ * \param size   Required length of object, in bytes
+ * \return Pointer to object, or NULL on memory exhaustion
+ */
+static void *arena_new(hubbub_arena *arena, size_t size)
+{
+	arena_header *header;
+
+	if (size > ARENA_MAX_SMALL) {
+		arena_large *l = arena->alloc(NULL,
+				sizeof(arena_large) + size, arena->pw);
+		if (l == NULL)
+			return NULL;
+
+		l->prev = NULL;
+		l->next = arena->large;
+		if (arena->large != NULL)
+			arena->large->prev = l;
+		arena->large = l;
+
+		l->header.size = size;
+
+		return &l->header + 1;
+	} else {
+		uint32_t c = arena_class(size);
+		size_t need = sizeof(arena_header) +
+				((size_t) 1 << (ARENA_MIN_SHIFT + c));
+
+		if (arena->free[c] != NULL) {
+			arena_free *f = arena->free[c];
+
+			arena->free[c] = f->next;
+
+			return f;
+		}
+
+		if ((size_t) (arena->end - arena->next) < need) {
+			arena_chunk *chunk = arena->alloc(NULL,
+					ARENA_CHUNK_SIZE, arena->pw);
+			if (chunk == NULL)
+				return NULL;
+
+			chunk->next = arena->chunks;
+			arena->chunks = chunk;
+
+			arena->next = (uint8_t *) (chunk + 1);
+			arena->end = (uint8_t *) chunk + ARENA_CHUNK_SIZE;
+		}
+
+		header = (arena_header *) arena->next;
+		header->size = need - sizeof(arena_header);
+		arena->next += need;
+
+		return header + 1;
+	}
+}
+
+/**
+ * Release an object to its arena
+ *
+ * \param arena   The arena
+ * \param header  Header of object to release
+ */
+static void arena_release(hubbub_arena *arena, arena_header *header)
+{
+	if (header->size > ARENA_MAX_SMALL) {
+		arena_large *l = (arena_large *) ((uint8_t *) header -
+				offsetof(arena_large, header));
+
+		if (l->prev != NULL)
+			l->prev->next = l->next;
+		else
+			arena->large = l->next;
+		if (l->next != NULL)
+			l->next->prev = l->prev;
+
+		arena->alloc(l, 0, arena->pw);
+	} else {
+		uint32_t c = arena_class(header->size);
+		arena_free *f = (arena_free *) (header + 1);
+
+		f->next = arena->free[c];
+		arena->free[c] = f;
+	}
+}
+
+/**
+ * Allocate memory from an arena
+ *
+ * \param ptr   Pointer to object to reallocate, or NULL for a new allocation
+ * \param size  Required length in bytes, or zero to free ::ptr
+ * \param pw    The arena
+ * \return Pointer to allocated object, or NULL on failure
+ */
+void *hubbub_arena_alloc(void *ptr, size_t size, void *pw)
+{
+	hubbub_arena *arena = (hubbub_arena *) pw;
+	arena_header *header;
+	void *result;
+
+	if (ptr == NULL)
+		return size == 0 ? NULL : arena_new(arena, size);
+
+	header = (arena_header *) ptr - 1;
+
+	if (size == 0) {
+		arena_release(arena, header);
+		return NULL;
+	}
+
+	/* Small objects which still fit stay where they are */
+	if (header->size <= ARENA_MAX_SMALL && size <= header->size)
+		return ptr;
+
+	/* Large objects stay large, and are moved by the backing allocator */
+	if (header->size > ARENA_MAX_SMALL && size > ARENA_MAX_SMALL) {
+		arena_large *l = (arena_large *) ((uint8_t *) header -
+				offsetof(arena_large, header));
+		arena_large *temp = arena->alloc(l,
+				sizeof(arena_large) + size, arena->pw);
+		if (temp == NULL)
+			return NULL;
+
+		if (temp->prev != NULL)
+			temp->prev->next = temp;
+		else
+			arena->large = temp;
+		if (temp->next != NULL)
+			temp->next->prev = temp;
+
+		temp->header.size = size;
+
+		return &temp->header + 1;
+	}
+
+	result = arena_new(arena, size);
+	if (result == NULL)
+		return NULL;
+
+	memcpy(result, ptr, size < header->size ? size : header->size);
+
+	arena_release(arena, header);
+
+	return result;
+}
+
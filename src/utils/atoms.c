@@ -0,0 +1,125 @@
+/*
+ * This file is part of Hubbub.
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license.php
+ * Copyright 2026 agent <agent@local>
+ */
+
+#include <string.h>
+
+#include "utils/atoms.h"
+#include "utils/elements.h"
+#include "utils/utils.h"
+
+/** Name of an atom */
+typedef struct atom_name {
+	/* Do not reorder this without fixing make-atoms.pl */
+	const char *name;	/**< Name, in lowercase */
+	size_t len;		/**< Length of name */
+} atom_name;
+
+#include "atoms.inc"
+
+/** URIs of the namespaces, by hubbub_ns */
+#define NS_URI(uri) { (uri), SLEN(uri) }
+static const atom_name ns_uris[] = {
+	NS_URI(""),
+	NS_URI("http://www.w3.org/1999/xhtml"),
+	NS_URI("http://www.w3.org/1998/Math/MathML"),
+	NS_URI("http://www.w3.org/2000/svg"),
+	NS_URI("http://www.w3.org/1999/xlink"),
+	NS_URI("http://www.w3.org/XML/1998/namespace"),
+	NS_URI("http://www.w3.org/2000/xmlns/")
+};
+#undef NS_URI
+
+/**
+ * Find the atom of a name, given its hash
+ *
+ * \param hash  Hash of the name, from hubbub_element_hash_step
+ * \param name  The name to consider
+ * \param len   Length of name, in bytes
+ * \return The name's atom, or HUBBUB_ATOM_NONE if it has none
+ *
+ * The names are held in an open addressed hash table, at most half full,
+ * so few are compared against.
+ */
+hubbub_atom hubbub_atom_lookup(uint32_t hash,
+		const uint8_t *name, size_t len)
+{
+	uint32_t slot;
+
+	slot = (hash * ATOM_HASH_MULTIPLIER) >> (32 - ATOM_SLOT_BITS);
+
+	while (atom_slots[slot] != HUBBUB_ATOM_NONE) {
+		const atom_name *entry = &atom_names[atom_slots[slot]];
+
+		if (entry->len == len && memcmp(entry->name, name, len) == 0)
+			return atom_slots[slot];
+
+		slot = (slot + 1) & (N_ELEMENTS(atom_slots) - 1);
+	}
+
+	return HUBBUB_ATOM_NONE;
+}
+
+/**
+ * Find the atom of a name
+ *
+ * \param name  The name to consider
+ * \param len   Length of name, in bytes
+ * \return The name's atom, or HUBBUB_ATOM_NONE if it has none
+ *
+ * Names are matched exactly, so "DIV" has no atom, though "div" has.
+ */
+hubbub_atom hubbub_atom_find(const uint8_t *name, size_t len)
+{
+	uint32_t hash = HUBBUB_ELEMENT_HASH_INIT;
+	size_t i;
+
+	if (name == NULL)
+		return HUBBUB_ATOM_NONE;
+
+	for (i = 0; i < len; i++)
+		hash = hubbub_element_hash_step(hash, name[i]);
+
+	return hubbub_atom_lookup(hash, name, len);
+}
+
+/**
+ * Retrieve the name of an atom
+ *
+ * \param atom  The atom
+ * \return The atom's name, which is constant, or an empty string for
+ *         HUBBUB_ATOM_NONE and anything not an atom
+ */
+hubbub_string hubbub_atom_string(hubbub_atom atom)
+{
+	hubbub_string str = { NULL, 0 };
+
+	if (atom != HUBBUB_ATOM_NONE && atom < HUBBUB_ATOM_COUNT) {
+		str.ptr = (const uint8_t *) atom_names[atom].name;
+		str.len = atom_names[atom].len;
+	}
+
+	return str;
+}
+
+/**
+ * Retrieve the URI of a namespace
+ *
+ * \param ns  The namespace
+ * \return The namespace's URI, which is constant, or an empty string for
+ *         HUBBUB_NS_NULL and anything not a namespace
+ */
+hubbub_string hubbub_ns_uri(hubbub_ns ns)
+{
+	hubbub_string str = { NULL, 0 };
+
+	if ((size_t) ns < N_ELEMENTS(ns_uris)) {
+		str.ptr = (const uint8_t *) ns_uris[ns].name;
+		str.len = ns_uris[ns].len;
+	}
+
+	return str;
+}
@@ -0,0 +1,20 @@
+/*
+ * This file is part of Hubbub.
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license.php
+ * Copyright 2026 agent <agent@local>
+ */
+
+#ifndef hubbub_utils_atoms_h_
+#define hubbub_utils_atoms_h_
+
+#include <stddef.h>
+#include <inttypes.h>
+
+#include <hubbub/atoms.h>
+
+hubbub_atom hubbub_atom_lookup(uint32_t hash,
+		const uint8_t *name, size_t len);
+
+#endif
+
@@ -0,0 +1,72 @@
+/*
+ * This file is part of Hubbub.
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license.php
+ * Copyright 2026 agent <agent@local>
+ */
+
+#ifndef hubbub_utils_charclass_h_
+#define hubbub_utils_charclass_h_
+
+#include <stdbool.h>
+#include <inttypes.h>
+
+/**
+ * Character class bits
+ *
+ * These must match the values used by build/make-charclass.pl
+ */
+#define HUBBUB_CC_SPACE		0x01	/**< Tab, LF, FF, CR and space */
+#define HUBBUB_CC_UPPER		0x02	/**< A-Z */
+#define HUBBUB_CC_LOWER		0x04	/**< a-z */
+#define HUBBUB_CC_DIGIT		0x08	/**< 0-9 */
+#define HUBBUB_CC_HEX		0x10	/**< 0-9, A-F and a-f */
+#define HUBBUB_CC_QUOTE		0x20	/**< " and ' */
+#define HUBBUB_CC_TAG_NAME_END	0x40	/**< Ends a run in the tag name state */
+#define HUBBUB_CC_ATTR_NAME_END	0x80	/**< Ends a run in the attribute
+					 * name state */
+
+#define HUBBUB_CC_ALPHA		(HUBBUB_CC_UPPER | HUBBUB_CC_LOWER)
+
+/** Class bits for each byte value */
+extern const uint8_t hubbub_char_class[256];
+
+/** ASCII lowercase equivalent of each byte value */
+extern const uint8_t hubbub_char_lower[256];
+
+/**
+ * Determine if a byte is a member of any of the given character classes
+ *
+ * \param c    Byte to test
+ * \param cls  Class bits to test for
+ * \return true if c is in one of the classes, false otherwise
+ */
+static inline bool hubbub_char_is(uint8_t c, uint8_t cls)
+{
+	return (hubbub_char_class[c] & cls) != 0;
+}
+
+/**
+ * Determine if a byte is HTML whitespace
+ *
+ * \param c  Byte to test
+ * \return true if c is whitespace, false otherwise
+ */
+static inline bool hubbub_char_is_space(uint8_t c)
+{
+	return hubbub_char_is(c, HUBBUB_CC_SPACE);
+}
+
+/**
+ * Convert a byte to ASCII lowercase
+ *
+ * \param c  Byte to convert
+ * \return Lowercase equivalent of c, or c if it is not an uppercase letter
+ */
+static inline uint8_t hubbub_char_tolower(uint8_t c)
+{
+	return hubbub_char_lower[c];
+}
+
+#endif
+
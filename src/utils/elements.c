@@ -0,0 +1,89 @@
+/*
+ * This file is part of Hubbub.
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license.php
+ * Copyright 2026 agent <agent@local>
+ */
+
+#include <string.h>
+
+#include "utils/elements.h"
+#include "utils/utils.h"
+
+/** Known element name */
+typedef struct element_name {
+	/* Do not reorder this without fixing make-elements.pl */
+	const char *name;	/**< Name, in lowercase */
+	size_t len;		/**< Length of name */
+	element_type type;	/**< Corresponding type */
+} element_name;
+
+#include "elements.inc"
+
+/**
+ * Find the type of an element from its name
+ *
+ * \param hash  Hash of the name, in lowercase, from hubbub_element_hash_step
+ * \param name  The name to consider
+ * \param len   Length of name, in bytes
+ * \return The corresponding element type, or UNKNOWN if there is none
+ *
+ * The names of the elements are looked up in a perfect hash table, so at
+ * most one name is compared against.
+ */
+element_type hubbub_element_type_lookup(uint32_t hash,
+		const uint8_t *name, size_t len)
+{
+	const element_name *entry;
+	uint32_t slot;
+
+	slot = (hash * ELEMENT_HASH_MULTIPLIER) >> (32 - ELEMENT_SLOT_BITS);
+
+	if (element_slots[slot] == 0)
+		return UNKNOWN;
+
+	entry = &element_names[element_slots[slot] - 1];
+
+	if (entry->len != len ||
+			strncasecmp(entry->name, (const char *) name, len) != 0)
+		return UNKNOWN;
+
+	return entry->type;
+}
+
+/**
+ * Find the type of an element from the atom of its name
+ *
+ * \param atom  The atom to consider
+ * \return The corresponding element type, or UNKNOWN if there is none
+ *
+ * Every element name has an atom (make-elements.pl checks this), so this
+ * finds the same type as hubbub_element_type_lookup() for a lowercase
+ * name, but with only a table lookup.
+ */
+element_type hubbub_element_type_from_atom(hubbub_atom atom)
+{
+	if (atom >= HUBBUB_ATOM_COUNT || atom_element_types[atom] == 0)
+		return UNKNOWN;
+
+	return (element_type) (atom_element_types[atom] - 1);
+}
+
+/**
+ * Convert an element type to a name
+ *
+ * \param type  The element type
+ * \return Pointer to name, or "UNKNOWN" if the type has no known name
+ */
+const char *hubbub_element_type_to_name(element_type type)
+{
+	size_t i;
+
+	for (i = 0; i < N_ELEMENTS(element_names); i++) {
+		if (element_names[i].type == type)
+			return element_names[i].name;
+	}
+
+	return "UNKNOWN";
+}
+
@@ -0,0 +1,72 @@
+/*
+ * This file is part of Hubbub.
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license.php
+ * Copyright 2026 agent <agent@local>
+ */
+
+#ifndef hubbub_utils_elements_h_
+#define hubbub_utils_elements_h_
+
+#include <stddef.h>
+#include <inttypes.h>
+
+#include <hubbub/atoms.h>
+
+/**
+ * Element types
+ *
+ * The names of these are listed in build/Elements.
+ */
+typedef enum
+{
+/* Special */
+	ADDRESS, AREA, ARTICLE, ASIDE, BASE, BASEFONT, BGSOUND, BLOCKQUOTE,
+	BODY, BR, CENTER, COL, COLGROUP, COMMAND, DATAGRID, DD, DETAILS,
+	DIALOG, DIR, DIV, DL, DT, EMBED, FIELDSET, FIGURE, FOOTER, FORM, FRAME,
+	FRAMESET, H1, H2, H3, H4, H5, H6, HEAD, HEADER, HR, IFRAME, IMAGE, IMG,
+	INPUT, ISINDEX, LI, LINK, LISTING, MENU, META, NAV, NOEMBED, NOFRAMES, 
+	NOSCRIPT, OL, OPTGROUP, OPTION, P, PARAM, PLAINTEXT, PRE, SCRIPT, 
+	SECTION, SELECT, SPACER, STYLE, TBODY, TEXTAREA, TFOOT, THEAD, TITLE, 
+	TR, UL, WBR,
+/* Scoping */
+	APPLET, BUTTON, CAPTION, HTML, MARQUEE, OBJECT, TABLE, TD, TH,
+/* Formatting */
+	A, B, BIG, CODE, EM, FONT, I, NOBR, S, SMALL, STRIKE, STRONG, TT, U,
+/* Phrasing */
+	/**< \todo Enumerate phrasing elements */
+	LABEL, OUTPUT, RP, RT, RUBY, SPAN, SUB, SUP, VAR, XMP,
+/* MathML */
+	MATH, MGLYPH, MALIGNMARK, MI, MO, MN, MS, MTEXT, ANNOTATION_XML,
+/* SVG */
+	SVG, FOREIGNOBJECT, /* foreignobject is scoping, but only in SVG ns */
+	DESC,
+	UNKNOWN
+} element_type;
+
+/** Initial value of an element name hash */
+#define HUBBUB_ELEMENT_HASH_INIT 0x811C9DC5u
+
+/**
+ * Add a character to an element name hash
+ *
+ * This must match hash() in build/make-elements.pl
+ *
+ * \param hash  Hash of the preceding characters, or HUBBUB_ELEMENT_HASH_INIT
+ * \param c     Character to add, in lowercase
+ * \return Hash including c
+ */
+static inline uint32_t hubbub_element_hash_step(uint32_t hash, uint8_t c)
+{
+	return (hash ^ c) * 0x01000193u;
+}
+
+element_type hubbub_element_type_lookup(uint32_t hash,
+		const uint8_t *name, size_t len);
+
+element_type hubbub_element_type_from_atom(hubbub_atom atom);
+
+const char *hubbub_element_type_to_name(element_type type);
+
+#endif
+
@@ -32,6 +32,9 @@ const char *hubbub_error_to_string(hubbub_error error)
 	case HUBBUB_PAUSED:
 		result = "Parser is paused";
 		break;
+	case HUBBUB_STOPPED:
+		result = "Parser has stopped";
+		break;
 	case HUBBUB_NOMEM:
 		result = "Insufficient memory";
 		break;
@@ -0,0 +1,803 @@
+/*
+ * This file is part of Hubbub.
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license.php
+ * Copyright 2026 agent <agent@local>
+ */
+
+#include <assert.h>
+#include <stddef.h>
+#include <inttypes.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSSE3__)
+#include <tmmintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+#include "utils/scan.h"
+
+
+/**
+ * Find the first byte in a string which is one of a set of stop bytes
+ *
+ * This is the bulk equivalent of examining each byte in turn, and is
+ * intended for skipping over long runs of uninteresting input. Where the
+ * target supports it, 16 or 32 bytes are examined at a time.
+ *
+ * \param s        String to scan
+ * \param len      Length of string, in bytes
+ * \param stops    Array of stop bytes
+ * \param n_stops  Number of stop bytes (1 to HUBBUB_SCAN_MAX_STOPS)
+ * \return Offset of the first stop byte in s, or len if there are none
+ */
+size_t hubbub_scan_until_any(const uint8_t *s, size_t len,
+		const uint8_t *stops, size_t n_stops)
+{
+	size_t i = 0, j;
+
+	assert(n_stops > 0 && n_stops <= HUBBUB_SCAN_MAX_STOPS);
+
+#if defined(__AVX2__)
+	{
+		__m256i set[HUBBUB_SCAN_MAX_STOPS];
+
+		for (j = 0; j < n_stops; j++)
+			set[j] = _mm256_set1_epi8((char) stops[j]);
+
+		for (; i + 32 <= len; i += 32) {
+			__m256i v = _mm256_loadu_si256(
+					(const __m256i *) (const void *) (s + i));
+			__m256i m = _mm256_cmpeq_epi8(v, set[0]);
+			uint32_t mask;
+
+			for (j = 1; j < n_stops; j++) {
+				m = _mm256_or_si256(m,
+						_mm256_cmpeq_epi8(v, set[j]));
+			}
+
+			mask = (uint32_t) _mm256_movemask_epi8(m);
+			if (mask != 0)
+				return i + __builtin_ctz(mask);
+		}
+	}
+#elif defined(__SSE2__)
+	{
+		__m128i set[HUBBUB_SCAN_MAX_STOPS];
+
+		for (j = 0; j < n_stops; j++)
+			set[j] = _mm_set1_epi8((char) stops[j]);
+
+		for (; i + 16 <= len; i += 16) {
+			__m128i v = _mm_loadu_si128(
+					(const __m128i *) (const void *) (s + i));
+			__m128i m = _mm_cmpeq_epi8(v, set[0]);
+			uint32_t mask;
+
+			for (j = 1; j < n_stops; j++)
+				m = _mm_or_si128(m, _mm_cmpeq_epi8(v, set[j]));
+
+			mask = (uint32_t) _mm_movemask_epi8(m);
+			if (mask != 0)
+				return i + __builtin_ctz(mask);
+		}
+	}
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+	{
+		uint8x16_t set[HUBBUB_SCAN_MAX_STOPS];
+
+		for (j = 0; j < n_stops; j++)
+			set[j] = vdupq_n_u8(stops[j]);
+
+		for (; i + 16 <= len; i += 16) {
+			uint8x16_t v = vld1q_u8(s + i);
+			uint8x16_t m = vceqq_u8(v, set[0]);
+
+			for (j = 1; j < n_stops; j++)
+				m = vorrq_u8(m, vceqq_u8(v, set[j]));
+
+			/* There's no movemask; leave locating the stop byte
+			 * within this block to the scalar loop below */
+			if (vmaxvq_u8(m) != 0)
+				break;
+		}
+	}
+#endif
+
+	for (; i < len; i++) {
+		for (j = 0; j < n_stops; j++) {
+			if (s[i] == stops[j])
+				return i;
+		}
+	}
+
+	return len;
+}
+
+/**
+ * Count the line breaks in part of a string, a byte at a time
+ *
+ * \param s           String to scan
+ * \param i           Offset of first byte to examine
+ * \param end         Offset just past the last byte to examine
+ * \param cr          Pointer to whether the byte before offset i is CR,
+ *                    updated on exit
+ * \param line_start  Pointer to location to receive the offset just past
+ *                    the last line break, left unchanged if there is none
+ * \return Number of line breaks found
+ */
+static inline size_t count_lines_bytewise(const uint8_t *s, size_t i,
+		size_t end, bool *cr, size_t *line_start)
+{
+	size_t lines = 0;
+
+	for (; i < end; i++) {
+		if (s[i] == '\n') {
+			/* The LF of a CRLF was counted with its CR */
+			if (*cr == false)
+				lines++;
+			*line_start = i + 1;
+			*cr = false;
+		} else if (s[i] == '\r') {
+			lines++;
+			*line_start = i + 1;
+			*cr = true;
+		} else {
+			*cr = false;
+		}
+	}
+
+	return lines;
+}
+
+/**
+ * Count the line breaks in a string
+ *
+ * CR, LF and CRLF each count as a single line break, including a CRLF
+ * which is split between this string and the one before it. Where the
+ * target supports it, 16 or 32 bytes are examined at a time.
+ *
+ * \param s           String to scan
+ * \param len         Length of string, in bytes
+ * \param cr          Pointer to whether the byte before s is CR, updated
+ *                    on exit to whether the last byte of s is CR
+ * \param line_start  Pointer to location to receive the offset just past
+ *                    the last line break in s, left unchanged if there is
+ *                    none
+ * \return Number of line breaks in s
+ */
+size_t hubbub_scan_count_lines(const uint8_t *s, size_t len, bool *cr,
+		size_t *line_start)
+{
+	size_t i = 0, lines = 0;
+
+#if defined(__AVX2__)
+	{
+		const __m256i lf = _mm256_set1_epi8('\n');
+		const __m256i ret = _mm256_set1_epi8('\r');
+
+		for (; i + 32 <= len; i += 32) {
+			__m256i v = _mm256_loadu_si256(
+					(const __m256i *) (const void *) (s + i));
+			uint32_t lfs = (uint32_t) _mm256_movemask_epi8(
+					_mm256_cmpeq_epi8(v, lf));
+			uint32_t crs = (uint32_t) _mm256_movemask_epi8(
+					_mm256_cmpeq_epi8(v, ret));
+			uint32_t crlfs;
+
+			if ((lfs | crs) == 0) {
+				*cr = false;
+				continue;
+			}
+
+			/* LFs which directly follow a CR */
+			crlfs = lfs & ((crs << 1) | (*cr ? 1 : 0));
+
+			lines += __builtin_popcount(lfs) +
+					__builtin_popcount(crs) -
+					__builtin_popcount(crlfs);
+			*line_start = i + 32 - __builtin_clz(lfs | crs);
+			*cr = (crs >> 31) != 0;
+		}
+	}
+#elif defined(__SSE2__)
+	{
+		const __m128i lf = _mm_set1_epi8('\n');
+		const __m128i ret = _mm_set1_epi8('\r');
+
+		for (; i + 16 <= len; i += 16) {
+			__m128i v = _mm_loadu_si128(
+					(const __m128i *) (const void *) (s + i));
+			uint32_t lfs = (uint32_t) _mm_movemask_epi8(
+					_mm_cmpeq_epi8(v, lf));
+			uint32_t crs = (uint32_t) _mm_movemask_epi8(
+					_mm_cmpeq_epi8(v, ret));
+			uint32_t crlfs;
+
+			if ((lfs | crs) == 0) {
+				*cr = false;
+				continue;
+			}
+
+			/* LFs which directly follow a CR */
+			crlfs = lfs & ((crs << 1) | (*cr ? 1 : 0));
+
+			lines += __builtin_popcount(lfs) +
+					__builtin_popcount(crs) -
+					__builtin_popcount(crlfs);
+			*line_start = i + 32 - __builtin_clz(lfs | crs);
+			*cr = (crs >> 15) != 0;
+		}
+	}
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+	{
+		const uint8x16_t lf = vdupq_n_u8('\n');
+		const uint8x16_t ret = vdupq_n_u8('\r');
+
+		for (; i + 16 <= len; i += 16) {
+			uint8x16_t v = vld1q_u8(s + i);
+			uint8x16_t m = vorrq_u8(vceqq_u8(v, lf),
+					vceqq_u8(v, ret));
+
+			if (vmaxvq_u8(m) == 0) {
+				*cr = false;
+				continue;
+			}
+
+			/* There's no movemask; count this block's line
+			 * breaks a byte at a time */
+			lines += count_lines_bytewise(s, i, i + 16,
+					cr, line_start);
+		}
+	}
+#endif
+
+	return lines + count_lines_bytewise(s, i, len, cr, line_start);
+}
+
+/**
+ * Trim a trailing incomplete UTF-8 sequence from a string
+ *
+ * \param s    String to examine
+ * \param len  Length of string, in bytes
+ * \return Length of the longest prefix of s which does not end part way
+ *         through a UTF-8 sequence
+ */
+size_t hubbub_scan_utf8_complete(const uint8_t *s, size_t len)
+{
+	size_t lead = len;
+	size_t need;
+	uint8_t c;
+
+	/* Step back over up to three continuation bytes */
+	while (lead > 0 && len - lead < 3 && (s[lead - 1] & 0xC0) == 0x80)
+		lead--;
+
+	if (lead == 0)
+		return len;
+
+	c = s[--lead];
+
+	if (c < 0xC0) {
+		/* ASCII or a stray continuation byte; nothing to trim */
+		return len;
+	}
+
+	need = (c >= 0xF0) ? 4 : (c >= 0xE0) ? 3 : 2;
+
+	return (len - lead < need) ? lead : len;
+}
+
+
+/**
+ * Find the length of the whitespace at the start of a string
+ *
+ * Whitespace is tab, LF, FF and space, as in character tokens, whose CRs
+ * have been replaced already. Where the target supports it, 16 or 32 bytes
+ * are examined at a time; otherwise, eight.
+ *
+ * \param s    String to examine
+ * \param len  Length of string, in bytes
+ * \return Length of the longest prefix of s which contains only whitespace
+ */
+size_t hubbub_scan_whitespace(const uint8_t *s, size_t len)
+{
+	size_t i = 0;
+
+#if defined(__AVX2__)
+	const __m256i tab = _mm256_set1_epi8(0x09), lf = _mm256_set1_epi8(0x0A);
+	const __m256i ff = _mm256_set1_epi8(0x0C), sp = _mm256_set1_epi8(0x20);
+
+	for (; i + 32 <= len; i += 32) {
+		__m256i v = _mm256_loadu_si256(
+				(const __m256i *) (const void *) (s + i));
+		__m256i m = _mm256_or_si256(
+				_mm256_or_si256(_mm256_cmpeq_epi8(v, tab),
+						_mm256_cmpeq_epi8(v, lf)),
+				_mm256_or_si256(_mm256_cmpeq_epi8(v, ff),
+						_mm256_cmpeq_epi8(v, sp)));
+		uint32_t mask = ~(uint32_t) _mm256_movemask_epi8(m);
+
+		if (mask != 0)
+			return i + __builtin_ctz(mask);
+	}
+#elif defined(__SSE2__)
+	const __m128i tab = _mm_set1_epi8(0x09), lf = _mm_set1_epi8(0x0A);
+	const __m128i ff = _mm_set1_epi8(0x0C), sp = _mm_set1_epi8(0x20);
+
+	for (; i + 16 <= len; i += 16) {
+		__m128i v = _mm_loadu_si128(
+				(const __m128i *) (const void *) (s + i));
+		__m128i m = _mm_or_si128(
+				_mm_or_si128(_mm_cmpeq_epi8(v, tab),
+						_mm_cmpeq_epi8(v, lf)),
+				_mm_or_si128(_mm_cmpeq_epi8(v, ff),
+						_mm_cmpeq_epi8(v, sp)));
+		uint32_t mask = ~(uint32_t) _mm_movemask_epi8(m) & 0xFFFF;
+
+		if (mask != 0)
+			return i + __builtin_ctz(mask);
+	}
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+	const uint8x16_t tab = vdupq_n_u8(0x09), lf = vdupq_n_u8(0x0A);
+	const uint8x16_t ff = vdupq_n_u8(0x0C), sp = vdupq_n_u8(0x20);
+
+	for (; i + 16 <= len; i += 16) {
+		uint8x16_t v = vld1q_u8(s + i);
+		uint8x16_t m = vorrq_u8(
+				vorrq_u8(vceqq_u8(v, tab), vceqq_u8(v, lf)),
+				vorrq_u8(vceqq_u8(v, ff), vceqq_u8(v, sp)));
+
+		/* Leave locating the first other byte to the loop below */
+		if (vminvq_u8(m) != 0xFF)
+			break;
+	}
+#else
+#define ONES UINT64_C(0x0101010101010101)
+#define HIGH UINT64_C(0x8080808080808080)
+/* The high bit of each byte of w which is c, and no others */
+#define EQ(w, c) (~((((w) ^ (c) * ONES) & ~HIGH) + ~HIGH | \
+		((w) ^ (c) * ONES)) & HIGH)
+
+	/* Step up to alignment, then examine eight bytes at a time */
+	for (; i < len && ((uintptr_t) (s + i) & 7) != 0; i++) {
+		if (s[i] != 0x09 && s[i] != 0x0A && s[i] != 0x0C &&
+				s[i] != 0x20)
+			return i;
+	}
+
+	for (; i + 8 <= len; i += 8) {
+		uint64_t w = *(const uint64_t *) (const void *) (s + i);
+
+		if ((EQ(w, 0x09) | EQ(w, 0x0A) | EQ(w, 0x0C) |
+				EQ(w, 0x20)) != HIGH)
+			break;
+	}
+
+#undef EQ
+#undef HIGH
+#undef ONES
+#endif
+
+	for (; i < len; i++) {
+		if (s[i] != 0x09 && s[i] != 0x0A && s[i] != 0x0C &&
+				s[i] != 0x20)
+			return i;
+	}
+
+	return len;
+}
+
+/**
+ * Find the length of the ASCII at the start of a string
+ *
+ * Where the target supports it, 16 or 32 bytes are examined at a time;
+ * otherwise, eight.
+ *
+ * \param s    String to examine
+ * \param len  Length of string, in bytes
+ * \return Length of the longest prefix of s which contains only ASCII
+ */
+size_t hubbub_scan_ascii(const uint8_t *s, size_t len)
+{
+	size_t i = 0;
+
+#if defined(__AVX2__)
+	for (; i + 32 <= len; i += 32) {
+		uint32_t mask = (uint32_t) _mm256_movemask_epi8(
+				_mm256_loadu_si256(
+				(const __m256i *) (const void *) (s + i)));
+
+		if (mask != 0)
+			return i + __builtin_ctz(mask);
+	}
+#elif defined(__SSE2__)
+	for (; i + 16 <= len; i += 16) {
+		uint32_t mask = (uint32_t) _mm_movemask_epi8(_mm_loadu_si128(
+				(const __m128i *) (const void *) (s + i)));
+
+		if (mask != 0)
+			return i + __builtin_ctz(mask);
+	}
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+	for (; i + 16 <= len; i += 16) {
+		if (vmaxvq_u8(vld1q_u8(s + i)) >= 0x80)
+			break;
+	}
+#else
+	/* Step up to alignment, then examine eight bytes at a time */
+	for (; i < len && ((uintptr_t) (s + i) & 7) != 0; i++) {
+		if (s[i] >= 0x80)
+			return i;
+	}
+
+	for (; i + 8 <= len; i += 8) {
+		if ((*(const uint64_t *) (const void *) (s + i) &
+				UINT64_C(0x8080808080808080)) != 0)
+			break;
+	}
+#endif
+
+	for (; i < len; i++) {
+		if (s[i] >= 0x80)
+			return i;
+	}
+
+	return len;
+}
+
+/**
+ * Classify the UTF-8 sequence at the start of a string
+ *
+ * Overlong forms, surrogates and code points above U+10FFFF are invalid.
+ * Where a sequence is invalid, its maximal subpart (the longest prefix of
+ * it which could start a valid sequence, or its first byte if none) is the
+ * part which should be replaced by a single U+FFFD.
+ *
+ * \param s    String to examine
+ * \param len  Length of string, in bytes (at least 1)
+ * \param n    Pointer to location to receive the length of the sequence,
+ *             or of its maximal subpart if it is invalid or truncated
+ * \return HUBBUB_UTF8_VALID if s starts with a valid character,
+ *         HUBBUB_UTF8_TRUNCATED if it starts with the valid beginning of
+ *                               one which the end of the string cuts short,
+ *         HUBBUB_UTF8_INVALID otherwise
+ */
+hubbub_utf8_sequence hubbub_scan_utf8_sequence(const uint8_t *s, size_t len,
+		size_t *n)
+{
+	uint8_t c = s[0];
+	uint8_t lo = 0x80, hi = 0xBF;
+	size_t need, k;
+
+	assert(len > 0);
+
+	if (c < 0x80) {
+		*n = 1;
+		return HUBBUB_UTF8_VALID;
+	} else if (c < 0xC2) {
+		*n = 1;
+		return HUBBUB_UTF8_INVALID;
+	} else if (c < 0xE0) {
+		need = 1;
+	} else if (c < 0xF0) {
+		need = 2;
+		if (c == 0xE0)
+			lo = 0xA0;
+		else if (c == 0xED)
+			hi = 0x9F;
+	} else if (c < 0xF5) {
+		need = 3;
+		if (c == 0xF0)
+			lo = 0x90;
+		else if (c == 0xF4)
+			hi = 0x8F;
+	} else {
+		*n = 1;
+		return HUBBUB_UTF8_INVALID;
+	}
+
+	for (k = 1; k <= need; k++) {
+		if (k == len) {
+			*n = k;
+			return HUBBUB_UTF8_TRUNCATED;
+		}
+
+		if (s[k] < lo || s[k] > hi) {
+			*n = k;
+			return HUBBUB_UTF8_INVALID;
+		}
+
+		/* Only the first continuation byte is further constrained */
+		lo = 0x80;
+		hi = 0xBF;
+	}
+
+	*n = need + 1;
+	return HUBBUB_UTF8_VALID;
+}
+
+#if defined(__AVX2__) || defined(__SSSE3__)
+
+/*
+ * Block validation, after Keiser and Lemire, "Validating UTF-8 in less than
+ * one instruction per byte". Each byte is checked against the one, two and
+ * three before it: three table lookups, on the high and low nibbles of the
+ * previous byte and the high nibble of this one, give the set of errors
+ * each nibble permits, and any error permitted by all three is present.
+ * Missing or excess continuation bytes for three and four byte sequences
+ * are found separately, from the bytes two and three back.
+ */
+
+/* Lead not followed by continuation, and ASCII followed by continuation */
+#define UTF8_TOO_SHORT		(1 << 0)
+#define UTF8_TOO_LONG		(1 << 1)
+#define UTF8_OVERLONG_3		(1 << 2)
+#define UTF8_TOO_LARGE		(1 << 3)
+#define UTF8_SURROGATE		(1 << 4)
+#define UTF8_OVERLONG_2		(1 << 5)
+#define UTF8_TOO_LARGE_1000	(1 << 6)
+#define UTF8_OVERLONG_4		(1 << 6)
+#define UTF8_TWO_CONTS		(1 << 7)  /* Continuation after continuation */
+#define UTF8_CARRY	(UTF8_TOO_SHORT | UTF8_TOO_LONG | UTF8_TWO_CONTS)
+
+/** Errors permitted by the high nibble of the previous byte */
+static const uint8_t utf8_byte_1_high[16] = {
+	UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG,
+	UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG,
+	UTF8_TWO_CONTS, UTF8_TWO_CONTS, UTF8_TWO_CONTS, UTF8_TWO_CONTS,
+	UTF8_TOO_SHORT | UTF8_OVERLONG_2,
+	UTF8_TOO_SHORT,
+	UTF8_TOO_SHORT | UTF8_OVERLONG_3 | UTF8_SURROGATE,
+	UTF8_TOO_SHORT | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 |
+			UTF8_OVERLONG_4
+};
+
+/** Errors permitted by the low nibble of the previous byte */
+static const uint8_t utf8_byte_1_low[16] = {
+	UTF8_CARRY | UTF8_OVERLONG_3 | UTF8_OVERLONG_2 | UTF8_OVERLONG_4,
+	UTF8_CARRY | UTF8_OVERLONG_2,
+	UTF8_CARRY,
+	UTF8_CARRY,
+	UTF8_CARRY | UTF8_TOO_LARGE,
+	UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+	UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+	UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+	UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+	UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+	UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+	UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+	UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+	UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 | UTF8_SURROGATE,
+	UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+	UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000
+};
+
+/** Errors permitted by the high nibble of this byte */
+static const uint8_t utf8_byte_2_high[16] = {
+	UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+	UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+	UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3 |
+			UTF8_TOO_LARGE_1000 | UTF8_OVERLONG_4,
+	UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3 |
+			UTF8_TOO_LARGE,
+	UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_SURROGATE |
+			UTF8_TOO_LARGE,
+	UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_SURROGATE |
+			UTF8_TOO_LARGE,
+	UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT
+};
+
+#endif
+
+#if defined(__AVX2__)
+
+/**
+ * Validate the whole 32 byte blocks at the start of a string
+ *
+ * \param s    String to examine
+ * \param len  Length of string, in bytes
+ * \return Offset of the first block found to contain an error, or of the
+ *         first byte not in a whole block; everything before it is valid,
+ *         bar perhaps a character which it splits
+ */
+static size_t utf8_valid_blocks(const uint8_t *s, size_t len)
+{
+	const __m256i nibble = _mm256_set1_epi8(0x0F);
+	const __m256i b1h = _mm256_broadcastsi128_si256(_mm_loadu_si128(
+			(const __m128i *) (const void *) utf8_byte_1_high));
+	const __m256i b1l = _mm256_broadcastsi128_si256(_mm_loadu_si128(
+			(const __m128i *) (const void *) utf8_byte_1_low));
+	const __m256i b2h = _mm256_broadcastsi128_si256(_mm_loadu_si128(
+			(const __m128i *) (const void *) utf8_byte_2_high));
+	/* Leads too close to the end of a block for their sequence to fit */
+	const __m256i max = _mm256_setr_epi8(
+			-1, -1, -1, -1, -1, -1, -1, -1,
+			-1, -1, -1, -1, -1, -1, -1, -1,
+			-1, -1, -1, -1, -1, -1, -1, -1,
+			-1, -1, -1, -1, -1, (char) (0xF0 - 1),
+			(char) (0xE0 - 1), (char) (0xC0 - 1));
+	__m256i prev = _mm256_setzero_si256();
+	__m256i incomplete = _mm256_setzero_si256();
+	size_t i;
+
+	for (i = 0; i + 32 <= len; i += 32) {
+		__m256i in = _mm256_loadu_si256(
+				(const __m256i *) (const void *) (s + i));
+		__m256i error;
+
+		if (_mm256_movemask_epi8(in) == 0) {
+			/* All ASCII: only a sequence left incomplete at the
+			 * end of the last block can be in error */
+			error = incomplete;
+		} else {
+			__m256i carry = _mm256_permute2x128_si256(prev, in,
+					0x21);
+			__m256i prev1 = _mm256_alignr_epi8(in, carry, 15);
+			__m256i prev2 = _mm256_alignr_epi8(in, carry, 14);
+			__m256i prev3 = _mm256_alignr_epi8(in, carry, 13);
+			__m256i must23;
+
+			error = _mm256_and_si256(_mm256_and_si256(
+					_mm256_shuffle_epi8(b1h,
+						_mm256_and_si256(
+						_mm256_srli_epi16(prev1, 4),
+						nibble)),
+					_mm256_shuffle_epi8(b1l,
+						_mm256_and_si256(prev1,
+						nibble))),
+					_mm256_shuffle_epi8(b2h,
+						_mm256_and_si256(
+						_mm256_srli_epi16(in, 4),
+						nibble)));
+
+			/* Bytes which must be the third or fourth of a
+			 * sequence, given the lead two or three back */
+			must23 = _mm256_or_si256(
+					_mm256_subs_epu8(prev2,
+					_mm256_set1_epi8(0xE0 - 0x80)),
+					_mm256_subs_epu8(prev3,
+					_mm256_set1_epi8(0xF0 - 0x80)));
+			error = _mm256_xor_si256(error, _mm256_and_si256(
+					must23, _mm256_set1_epi8(
+					(char) 0x80)));
+		}
+
+		if (_mm256_testz_si256(error, error) == 0)
+			break;
+
+		incomplete = _mm256_subs_epu8(in, max);
+		prev = in;
+	}
+
+	return i;
+}
+
+#elif defined(__SSSE3__)
+
+/**
+ * Validate the whole 16 byte blocks at the start of a string
+ *
+ * \param s    String to examine
+ * \param len  Length of string, in bytes
+ * \return Offset of the first block found to contain an error, or of the
+ *         first byte not in a whole block; everything before it is valid,
+ *         bar perhaps a character which it splits
+ */
+static size_t utf8_valid_blocks(const uint8_t *s, size_t len)
+{
+	const __m128i nibble = _mm_set1_epi8(0x0F);
+	const __m128i b1h = _mm_loadu_si128(
+			(const __m128i *) (const void *) utf8_byte_1_high);
+	const __m128i b1l = _mm_loadu_si128(
+			(const __m128i *) (const void *) utf8_byte_1_low);
+	const __m128i b2h = _mm_loadu_si128(
+			(const __m128i *) (const void *) utf8_byte_2_high);
+	/* Leads too close to the end of a block for their sequence to fit */
+	const __m128i max = _mm_setr_epi8(
+			-1, -1, -1, -1, -1, -1, -1, -1,
+			-1, -1, -1, -1, -1, (char) (0xF0 - 1),
+			(char) (0xE0 - 1), (char) (0xC0 - 1));
+	const __m128i zero = _mm_setzero_si128();
+	__m128i prev = zero;
+	__m128i incomplete = zero;
+	size_t i;
+
+	for (i = 0; i + 16 <= len; i += 16) {
+		__m128i in = _mm_loadu_si128(
+				(const __m128i *) (const void *) (s + i));
+		__m128i error;
+
+		if (_mm_movemask_epi8(in) == 0) {
+			/* All ASCII: only a sequence left incomplete at the
+			 * end of the last block can be in error */
+			error = incomplete;
+		} else {
+			__m128i prev1 = _mm_alignr_epi8(in, prev, 15);
+			__m128i prev2 = _mm_alignr_epi8(in, prev, 14);
+			__m128i prev3 = _mm_alignr_epi8(in, prev, 13);
+			__m128i must23;
+
+			error = _mm_and_si128(_mm_and_si128(
+					_mm_shuffle_epi8(b1h, _mm_and_si128(
+						_mm_srli_epi16(prev1, 4),
+						nibble)),
+					_mm_shuffle_epi8(b1l, _mm_and_si128(
+						prev1, nibble))),
+					_mm_shuffle_epi8(b2h, _mm_and_si128(
+						_mm_srli_epi16(in, 4),
+						nibble)));
+
+			/* Bytes which must be the third or fourth of a
+			 * sequence, given the lead two or three back */
+			must23 = _mm_or_si128(
+					_mm_subs_epu8(prev2,
+					_mm_set1_epi8(0xE0 - 0x80)),
+					_mm_subs_epu8(prev3,
+					_mm_set1_epi8(0xF0 - 0x80)));
+			error = _mm_xor_si128(error, _mm_and_si128(must23,
+					_mm_set1_epi8((char) 0x80)));
+		}
+
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(error, zero)) != 0xFFFF)
+			break;
+
+		incomplete = _mm_subs_epu8(in, max);
+		prev = in;
+	}
+
+	return i;
+}
+
+#endif
+
+/**
+ * Find the length of the valid UTF-8 at the start of a string
+ *
+ * Overlong forms, surrogates and code points above U+10FFFF are invalid,
+ * as are sequences cut short by the end of the string. Where the target
+ * supports it, whole blocks of 16 or 32 bytes are validated at a time, and
+ * only the remainder, or a block containing an error, is examined a
+ * character at a time; otherwise, runs of ASCII are skipped in bulk.
+ *
+ * \param s    String to examine
+ * \param len  Length of string, in bytes
+ * \return Length of the longest prefix of s which is valid UTF-8
+ */
+size_t hubbub_scan_utf8_valid(const uint8_t *s, size_t len)
+{
+	size_t i = 0, n;
+
+#if defined(__AVX2__) || defined(__SSSE3__)
+	i = utf8_valid_blocks(s, len);
+
+	/* Step back to the start of the character the blocks ended in */
+	for (n = 0; i > 0 && n < 3 && (s[i - 1] & 0xC0) == 0x80; n++)
+		i--;
+	if (i > 0 && s[i - 1] >= 0xC0)
+		i--;
+#endif
+
+	while (i < len) {
+		if (s[i] < 0x80) {
+			i++;
+
+			/* Skip any ASCII after it in bulk */
+			if (((uintptr_t) (s + i) & 7) == 0)
+				i += hubbub_scan_ascii(s + i, len - i);
+			continue;
+		}
+
+		if (hubbub_scan_utf8_sequence(s + i, len - i, &n) !=
+				HUBBUB_UTF8_VALID)
+			return i;
+
+		i += n;
+	}
+
+	return len;
+}
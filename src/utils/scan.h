@@ -0,0 +1,50 @@
+/*
+ * This file is part of Hubbub.
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license.php
+ * Copyright 2026 agent <agent@local>
+ */
+
+#ifndef hubbub_utils_scan_h_
+#define hubbub_utils_scan_h_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <inttypes.h>
+
+/** Classification of a UTF-8 sequence */
+typedef enum hubbub_utf8_sequence {
+	HUBBUB_UTF8_VALID,		/**< A valid, complete character */
+	HUBBUB_UTF8_TRUNCATED,		/**< Valid, but cut short */
+	HUBBUB_UTF8_INVALID		/**< Invalid */
+} hubbub_utf8_sequence;
+
+/** Maximum number of stop bytes accepted by hubbub_scan_until_any */
+#define HUBBUB_SCAN_MAX_STOPS 8
+
+/** Find the first byte in a string which is one of a set of stop bytes */
+size_t hubbub_scan_until_any(const uint8_t *s, size_t len,
+		const uint8_t *stops, size_t n_stops);
+
+/** Count the line breaks in a string */
+size_t hubbub_scan_count_lines(const uint8_t *s, size_t len, bool *cr,
+		size_t *line_start);
+
+/** Trim a trailing incomplete UTF-8 sequence from a string */
+size_t hubbub_scan_utf8_complete(const uint8_t *s, size_t len);
+
+/** Find the length of the valid UTF-8 at the start of a string */
+size_t hubbub_scan_utf8_valid(const uint8_t *s, size_t len);
+
+/** Find the length of the whitespace at the start of a string */
+size_t hubbub_scan_whitespace(const uint8_t *s, size_t len);
+
+/** Find the length of the ASCII at the start of a string */
+size_t hubbub_scan_ascii(const uint8_t *s, size_t len);
+
+/** Classify the UTF-8 sequence at the start of a string */
+hubbub_utf8_sequence hubbub_scan_utf8_sequence(const uint8_t *s, size_t len,
+		size_t *n);
+
+#endif
+
@@ -0,0 +1,418 @@
+/*
+ * This file is part of Hubbub.
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license.php
+ * Copyright 2026 agent <agent@local>
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "utils/stats.h"
+#include "utils/trace.h"
+
+#ifdef HUBBUB_WRAP_TREE_HANDLER
+
+/*
+ * Counting the client's callbacks
+ *
+ * The client's allocator and tree handler are given to the tokeniser and
+ * treebuilder by way of our own, which count each call and pass it on.
+ * The size of each allocation is kept in a header ahead of it, so that the
+ * bytes allocated at once may be counted, as the allocator is not told the
+ * size of what it frees. Where calls are traced but not counted, only the
+ * tree handler is wrapped.
+ */
+
+#ifdef HUBBUB_WITH_STATS
+/**
+ * Header of an allocation, aligned as the allocator's result would be
+ */
+typedef union stats_header {
+	size_t size;			/**< Size of allocation */
+	void *align_ptr;		/**< Alignment of pointers */
+	long double align_float;	/**< Alignment of floats */
+	uint64_t align_int;		/**< Alignment of integers */
+} stats_header;
+#endif
+
+/** Count, and trace, a call to the client's tree handler */
+#define COUNT(ctx, call)						\
+	do {								\
+		HUBBUB_STATS_ADD(&((hubbub_stats *) (ctx))->counts,	\
+				tree_calls[(call)], 1);			\
+		HUBBUB_TRACE2(tree__call, CLIENT(ctx)->ctx, (call));	\
+	} while (0)
+
+/** The client's tree handler */
+#define CLIENT(ctx) (((hubbub_stats *) (ctx))->client)
+
+/** The client's extended tree handler */
+#define CLIENT_EXT(ctx) (((hubbub_stats *) (ctx))->client_ext)
+
+static hubbub_error count_create_comment(void *ctx,
+		const hubbub_string *data, void **result);
+static hubbub_error count_create_doctype(void *ctx,
+		const hubbub_doctype *doctype, void **result);
+static hubbub_error count_create_element(void *ctx, const hubbub_tag *tag,
+		void **result);
+static hubbub_error count_create_text(void *ctx, const hubbub_string *data,
+		void **result);
+static hubbub_error count_ref_node(void *ctx, void *node);
+static hubbub_error count_unref_node(void *ctx, void *node);
+static hubbub_error count_append_child(void *ctx, void *parent,
+		void *child, void **result);
+static hubbub_error count_insert_before(void *ctx, void *parent,
+		void *child, void *ref_child, void **result);
+static hubbub_error count_remove_child(void *ctx, void *parent,
+		void *child, void **result);
+static hubbub_error count_clone_node(void *ctx, void *node, bool deep,
+		void **result);
+static hubbub_error count_reparent_children(void *ctx, void *node,
+		void *new_parent);
+static hubbub_error count_get_parent(void *ctx, void *node,
+		bool element_only, void **result);
+static hubbub_error count_has_children(void *ctx, void *node,
+		bool *result);
+static hubbub_error count_form_associate(void *ctx, void *form,
+		void *node);
+static hubbub_error count_add_attributes(void *ctx, void *node,
+		const hubbub_attribute *attributes, uint32_t n_attributes);
+static hubbub_error count_set_quirks_mode(void *ctx,
+		hubbub_quirks_mode mode);
+static hubbub_error count_encoding_change(void *ctx, const char *encname);
+static hubbub_error count_complete_script(void *ctx, void *script);
+static hubbub_error count_complete_style(void *ctx, void *style);
+static hubbub_error count_create_and_append_element(void *ctx,
+		void *parent, const hubbub_tag *tag, void **result);
+static hubbub_error count_append_text(void *ctx, void *parent,
+		const hubbub_string *data);
+static hubbub_error count_skip_element(void *ctx, const hubbub_tag *tag,
+		bool *skip);
+static hubbub_error count_element_complete(void *ctx, void *node);
+
+/**
+ * Prepare to count a parser's work
+ *
+ * \param stats  Counters to initialise
+ * \param alloc  Client's memory (de)allocation function
+ * \param pw     Pointer to client data for alloc
+ * \return true on success, false if no lock could be created
+ */
+bool hubbub_stats_init(hubbub_stats *stats, hubbub_allocator_fn alloc,
+		void *pw)
+{
+	memset(stats, 0, sizeof(hubbub_stats));
+
+	stats->alloc = alloc;
+	stats->pw = pw;
+
+	return hubbub_mutex_init(&stats->lock);
+}
+
+/**
+ * Finish counting a parser's work
+ *
+ * \param stats  Counters to finish with
+ */
+void hubbub_stats_fini(hubbub_stats *stats)
+{
+	hubbub_mutex_destroy(&stats->lock);
+}
+
+#ifdef HUBBUB_WITH_STATS
+/**
+ * Counting allocator, passing calls on to the client's
+ *
+ * \param ptr  Allocation to resize or free, or NULL
+ * \param len  Size, in bytes, to allocate, or 0 to free
+ * \param pw   Counters
+ * \return Pointer to allocation, or NULL on failure or when freeing
+ */
+void *hubbub_stats_alloc(void *ptr, size_t len, void *pw)
+{
+	hubbub_stats *stats = pw;
+	stats_header *header = NULL;
+	size_t old = 0;
+
+	if (ptr != NULL) {
+		header = (stats_header *) ptr - 1;
+		old = header->size;
+	}
+
+	if (len == 0) {
+		if (header != NULL)
+			stats->alloc(header, 0, stats->pw);
+	} else if (len <= SIZE_MAX - sizeof(stats_header)) {
+		header = stats->alloc(header, len + sizeof(stats_header),
+				stats->pw);
+		if (header != NULL)
+			header->size = len;
+	} else {
+		header = NULL;
+	}
+
+	hubbub_mutex_lock(&stats->lock);
+
+	stats->counts.alloc_calls++;
+
+	/* A failed reallocation leaves what was there */
+	if (len == 0 || header != NULL) {
+		stats->allocated = stats->allocated - old + len;
+		if (stats->allocated > stats->counts.peak_alloc)
+			stats->counts.peak_alloc = stats->allocated;
+	}
+
+	hubbub_mutex_unlock(&stats->lock);
+
+	if (len == 0 || header == NULL)
+		return NULL;
+
+	return header + 1;
+}
+#endif
+
+/**
+ * Count, or trace, the calls made to a tree handler
+ *
+ * \param stats   Counters
+ * \param client  Client's tree handler, or NULL for none
+ * \return Tree handler to use in its place, or NULL if client is NULL
+ *
+ * Callbacks the client does not have are left NULL, so are treated just
+ * as the client's would be.
+ */
+hubbub_tree_handler *hubbub_stats_tree_handler(hubbub_stats *stats,
+		const hubbub_tree_handler *client)
+{
+	hubbub_tree_handler *h = &stats->handler;
+
+	stats->client = client;
+	if (client == NULL)
+		return NULL;
+
+#define WRAP(name) h->name = client->name != NULL ? count_##name : NULL
+	WRAP(create_comment);
+	WRAP(create_doctype);
+	WRAP(create_element);
+	WRAP(create_text);
+	WRAP(ref_node);
+	WRAP(unref_node);
+	WRAP(append_child);
+	WRAP(insert_before);
+	WRAP(remove_child);
+	WRAP(clone_node);
+	WRAP(reparent_children);
+	WRAP(get_parent);
+	WRAP(has_children);
+	WRAP(form_associate);
+	WRAP(add_attributes);
+	WRAP(set_quirks_mode);
+	WRAP(encoding_change);
+	WRAP(complete_script);
+	WRAP(complete_style);
+#undef WRAP
+
+	h->ctx = stats;
+
+	return h;
+}
+
+/**
+ * Count, or trace, the calls made to an extended tree handler
+ *
+ * \param stats   Counters
+ * \param client  Client's extended tree handler, or NULL for none
+ * \return Extended tree handler to use in its place, or NULL if client is
+ *         NULL
+ */
+hubbub_tree_handler_ext *hubbub_stats_tree_handler_ext(hubbub_stats *stats,
+		const hubbub_tree_handler_ext *client)
+{
+	hubbub_tree_handler_ext *h = &stats->handler_ext;
+
+	stats->client_ext = client;
+	if (client == NULL)
+		return NULL;
+
+#define WRAP(name) h->name = client->name != NULL ? count_##name : NULL
+	WRAP(create_and_append_element);
+	WRAP(append_text);
+	WRAP(skip_element);
+	WRAP(element_complete);
+#undef WRAP
+
+	h->flags = client->flags;
+
+	return h;
+}
+
+hubbub_error count_create_comment(void *ctx, const hubbub_string *data,
+		void **result)
+{
+	COUNT(ctx, HUBBUB_TREE_CREATE_COMMENT);
+	return CLIENT(ctx)->create_comment(CLIENT(ctx)->ctx, data, result);
+}
+
+hubbub_error count_create_doctype(void *ctx, const hubbub_doctype *doctype,
+		void **result)
+{
+	COUNT(ctx, HUBBUB_TREE_CREATE_DOCTYPE);
+	return CLIENT(ctx)->create_doctype(CLIENT(ctx)->ctx, doctype, result);
+}
+
+hubbub_error count_create_element(void *ctx, const hubbub_tag *tag,
+		void **result)
+{
+	COUNT(ctx, HUBBUB_TREE_CREATE_ELEMENT);
+	return CLIENT(ctx)->create_element(CLIENT(ctx)->ctx, tag, result);
+}
+
+hubbub_error count_create_text(void *ctx, const hubbub_string *data,
+		void **result)
+{
+	COUNT(ctx, HUBBUB_TREE_CREATE_TEXT);
+	return CLIENT(ctx)->create_text(CLIENT(ctx)->ctx, data, result);
+}
+
+hubbub_error count_ref_node(void *ctx, void *node)
+{
+	COUNT(ctx, HUBBUB_TREE_REF_NODE);
+	return CLIENT(ctx)->ref_node(CLIENT(ctx)->ctx, node);
+}
+
+hubbub_error count_unref_node(void *ctx, void *node)
+{
+	COUNT(ctx, HUBBUB_TREE_UNREF_NODE);
+	return CLIENT(ctx)->unref_node(CLIENT(ctx)->ctx, node);
+}
+
+hubbub_error count_append_child(void *ctx, void *parent, void *child,
+		void **result)
+{
+	COUNT(ctx, HUBBUB_TREE_APPEND_CHILD);
+	return CLIENT(ctx)->append_child(CLIENT(ctx)->ctx, parent, child,
+			result);
+}
+
+hubbub_error count_insert_before(void *ctx, void *parent, void *child,
+		void *ref_child, void **result)
+{
+	COUNT(ctx, HUBBUB_TREE_INSERT_BEFORE);
+	return CLIENT(ctx)->insert_before(CLIENT(ctx)->ctx, parent, child,
+			ref_child, result);
+}
+
+hubbub_error count_remove_child(void *ctx, void *parent, void *child,
+		void **result)
+{
+	COUNT(ctx, HUBBUB_TREE_REMOVE_CHILD);
+	return CLIENT(ctx)->remove_child(CLIENT(ctx)->ctx, parent, child,
+			result);
+}
+
+hubbub_error count_clone_node(void *ctx, void *node, bool deep,
+		void **result)
+{
+	COUNT(ctx, HUBBUB_TREE_CLONE_NODE);
+	return CLIENT(ctx)->clone_node(CLIENT(ctx)->ctx, node, deep, result);
+}
+
+hubbub_error count_reparent_children(void *ctx, void *node,
+		void *new_parent)
+{
+	COUNT(ctx, HUBBUB_TREE_REPARENT_CHILDREN);
+	return CLIENT(ctx)->reparent_children(CLIENT(ctx)->ctx, node,
+			new_parent);
+}
+
+hubbub_error count_get_parent(void *ctx, void *node, bool element_only,
+		void **result)
+{
+	COUNT(ctx, HUBBUB_TREE_GET_PARENT);
+	return CLIENT(ctx)->get_parent(CLIENT(ctx)->ctx, node, element_only,
+			result);
+}
+
+hubbub_error count_has_children(void *ctx, void *node, bool *result)
+{
+	COUNT(ctx, HUBBUB_TREE_HAS_CHILDREN);
+	return CLIENT(ctx)->has_children(CLIENT(ctx)->ctx, node, result);
+}
+
+hubbub_error count_form_associate(void *ctx, void *form, void *node)
+{
+	COUNT(ctx, HUBBUB_TREE_FORM_ASSOCIATE);
+	return CLIENT(ctx)->form_associate(CLIENT(ctx)->ctx, form, node);
+}
+
+hubbub_error count_add_attributes(void *ctx, void *node,
+		const hubbub_attribute *attributes, uint32_t n_attributes)
+{
+	COUNT(ctx, HUBBUB_TREE_ADD_ATTRIBUTES);
+	return CLIENT(ctx)->add_attributes(CLIENT(ctx)->ctx, node,
+			attributes, n_attributes);
+}
+
+hubbub_error count_set_quirks_mode(void *ctx, hubbub_quirks_mode mode)
+{
+	COUNT(ctx, HUBBUB_TREE_SET_QUIRKS_MODE);
+	return CLIENT(ctx)->set_quirks_mode(CLIENT(ctx)->ctx, mode);
+}
+
+hubbub_error count_encoding_change(void *ctx, const char *encname)
+{
+	hubbub_error error;
+
+	COUNT(ctx, HUBBUB_TREE_ENCODING_CHANGE);
+	error = CLIENT(ctx)->encoding_change(CLIENT(ctx)->ctx, encname);
+
+	/* The client is to start again, in the new charset */
+	if (error == HUBBUB_ENCODINGCHANGE)
+		HUBBUB_STATS_ADD(&((hubbub_stats *) ctx)->counts,
+				encoding_restarts, 1);
+
+	return error;
+}
+
+hubbub_error count_complete_script(void *ctx, void *script)
+{
+	COUNT(ctx, HUBBUB_TREE_COMPLETE_SCRIPT);
+	return CLIENT(ctx)->complete_script(CLIENT(ctx)->ctx, script);
+}
+
+hubbub_error count_complete_style(void *ctx, void *style)
+{
+	COUNT(ctx, HUBBUB_TREE_COMPLETE_STYLE);
+	return CLIENT(ctx)->complete_style(CLIENT(ctx)->ctx, style);
+}
+
+hubbub_error count_create_and_append_element(void *ctx, void *parent,
+		const hubbub_tag *tag, void **result)
+{
+	COUNT(ctx, HUBBUB_TREE_CREATE_AND_APPEND_ELEMENT);
+	return CLIENT_EXT(ctx)->create_and_append_element(CLIENT(ctx)->ctx,
+			parent, tag, result);
+}
+
+hubbub_error count_append_text(void *ctx, void *parent,
+		const hubbub_string *data)
+{
+	COUNT(ctx, HUBBUB_TREE_APPEND_TEXT);
+	return CLIENT_EXT(ctx)->append_text(CLIENT(ctx)->ctx, parent, data);
+}
+
+hubbub_error count_skip_element(void *ctx, const hubbub_tag *tag,
+		bool *skip)
+{
+	COUNT(ctx, HUBBUB_TREE_SKIP_ELEMENT);
+	return CLIENT_EXT(ctx)->skip_element(CLIENT(ctx)->ctx, tag, skip);
+}
+
+hubbub_error count_element_complete(void *ctx, void *node)
+{
+	COUNT(ctx, HUBBUB_TREE_ELEMENT_COMPLETE);
+	return CLIENT_EXT(ctx)->element_complete(CLIENT(ctx)->ctx, node);
+}
+
+#endif
@@ -0,0 +1,98 @@
+/*
+ * This file is part of Hubbub.
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license.php
+ * Copyright 2026 agent <agent@local>
+ */
+
+#ifndef hubbub_utils_stats_h_
+#define hubbub_utils_stats_h_
+
+#include <stddef.h>
+
+#include <hubbub/errors.h>
+#include <hubbub/functypes.h>
+#include <hubbub/stats.h>
+#include <hubbub/tree.h>
+
+#include "utils/thread.h"
+
+/*
+ * Counters are only kept when built with HUBBUB_WITH_STATS. Otherwise,
+ * the macros below expand to nothing, and neither the counters nor any
+ * pointer to them exist. Each counts into a hubbub_parser_stats, which
+ * may be NULL, for a tokeniser or treebuilder with no parser.
+ */
+#ifdef HUBBUB_WITH_STATS
+
+/** Add to a counter */
+#define HUBBUB_STATS_ADD(stats, counter, n)				\
+	do {								\
+		if ((stats) != NULL)					\
+			(stats)->counter += (n);			\
+	} while (0)
+
+/** Raise a counter to a value, if it is lower */
+#define HUBBUB_STATS_MAX(stats, counter, value)				\
+	do {								\
+		if ((stats) != NULL && (stats)->counter < (value))	\
+			(stats)->counter = (value);			\
+	} while (0)
+
+#else
+
+#define HUBBUB_STATS_ADD(stats, counter, n) ((void) 0)
+#define HUBBUB_STATS_MAX(stats, counter, value) ((void) 0)
+
+#endif
+
+/*
+ * The client's tree handler is wrapped by the parser, when its calls are
+ * to be counted or traced
+ */
+#if defined(HUBBUB_WITH_STATS) || defined(HUBBUB_WITH_TRACE)
+#define HUBBUB_WRAP_TREE_HANDLER
+
+/**
+ * Counters kept by a parser, with what is needed to count the calls made
+ * to the client's allocator and tree handler
+ */
+typedef struct hubbub_stats {
+	hubbub_parser_stats counts;	/**< Counters */
+
+	hubbub_allocator_fn alloc;	/**< Client's allocator */
+	void *pw;			/**< Client data for alloc */
+	size_t allocated;		/**< Bytes allocated at present */
+	hubbub_mutex lock;		/**< Lock on the allocation counters,
+					 * for allocations on other threads */
+
+	const hubbub_tree_handler *client;	/**< Client's tree handler */
+	const hubbub_tree_handler_ext *client_ext;
+					/**< Client's extended tree handler */
+	hubbub_tree_handler handler;	/**< Counting tree handler */
+	hubbub_tree_handler_ext handler_ext;
+					/**< Counting extended tree handler */
+} hubbub_stats;
+
+/* Prepare to count a parser's work */
+bool hubbub_stats_init(hubbub_stats *stats, hubbub_allocator_fn alloc,
+		void *pw);
+/* Finish counting a parser's work */
+void hubbub_stats_fini(hubbub_stats *stats);
+
+#ifdef HUBBUB_WITH_STATS
+/* Counting allocator, passing calls on to the client's */
+void *hubbub_stats_alloc(void *ptr, size_t len, void *pw);
+#endif
+
+/* Count, or trace, the calls made to a tree handler */
+hubbub_tree_handler *hubbub_stats_tree_handler(hubbub_stats *stats,
+		const hubbub_tree_handler *client);
+/* Count, or trace, the calls made to an extended tree handler */
+hubbub_tree_handler_ext *hubbub_stats_tree_handler_ext(hubbub_stats *stats,
+		const hubbub_tree_handler_ext *client);
+
+#endif
+
+#endif
+
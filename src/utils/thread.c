@@ -0,0 +1,209 @@
+/*
+ * This file is part of Hubbub.
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license.php
+ * Copyright 2026 agent <agent@local>
+ */
+
+#include <stddef.h>
+
+#include "utils/thread.h"
+
+#ifdef HUBBUB_WITH_PTHREADS
+/**
+ * Do the work of a thread
+ *
+ * \param arg  The thread
+ * \return NULL
+ */
+static void *hubbub_thread_main(void *arg)
+{
+	hubbub_thread *thread = arg;
+
+	thread->fn(thread->arg);
+
+	return NULL;
+}
+#endif
+
+/**
+ * Start work on a thread of its own, if one can be created
+ *
+ * \param thread  Thread to start
+ * \param fn      Work to do
+ * \param arg     Argument to fn
+ * \return true if the work was started, false if there is no thread
+ *         support or no thread can be created, in which case nothing is
+ *         done
+ */
+bool hubbub_thread_create(hubbub_thread *thread, hubbub_thread_fn fn,
+		void *arg)
+{
+	thread->fn = fn;
+	thread->arg = arg;
+	thread->running = false;
+
+#ifdef HUBBUB_WITH_PTHREADS
+	if (pthread_create(&thread->id, NULL, hubbub_thread_main,
+			thread) == 0)
+		thread->running = true;
+#endif
+
+	return thread->running;
+}
+
+/**
+ * Start work on a thread of its own
+ *
+ * \param thread  Thread to start
+ * \param fn      Work to do
+ * \param arg     Argument to fn
+ *
+ * The work is done by the caller, before returning, if there is no thread
+ * support or no thread can be created.
+ */
+void hubbub_thread_start(hubbub_thread *thread, hubbub_thread_fn fn,
+		void *arg)
+{
+	if (hubbub_thread_create(thread, fn, arg) == false)
+		fn(arg);
+}
+
+/**
+ * Wait for work on a thread to finish
+ *
+ * \param thread  Thread started by hubbub_thread_start()
+ */
+void hubbub_thread_join(hubbub_thread *thread)
+{
+#ifdef HUBBUB_WITH_PTHREADS
+	if (thread->running)
+		pthread_join(thread->id, NULL);
+#endif
+
+	thread->running = false;
+}
+
+/**
+ * Create a lock
+ *
+ * \param mutex  Lock to create
+ * \return true on success, false if the lock cannot be created
+ */
+bool hubbub_mutex_init(hubbub_mutex *mutex)
+{
+#ifdef HUBBUB_WITH_PTHREADS
+	return pthread_mutex_init(&mutex->id, NULL) == 0;
+#else
+	mutex->unused = 0;
+
+	return true;
+#endif
+}
+
+/**
+ * Destroy a lock
+ *
+ * \param mutex  Lock to destroy, which must not be held
+ */
+void hubbub_mutex_destroy(hubbub_mutex *mutex)
+{
+#ifdef HUBBUB_WITH_PTHREADS
+	pthread_mutex_destroy(&mutex->id);
+#else
+	(void) mutex;
+#endif
+}
+
+/**
+ * Take a lock, waiting for any other thread to release it
+ *
+ * \param mutex  Lock to take
+ */
+void hubbub_mutex_lock(hubbub_mutex *mutex)
+{
+#ifdef HUBBUB_WITH_PTHREADS
+	pthread_mutex_lock(&mutex->id);
+#else
+	(void) mutex;
+#endif
+}
+
+/**
+ * Release a lock
+ *
+ * \param mutex  Lock to release, held by the caller
+ */
+void hubbub_mutex_unlock(hubbub_mutex *mutex)
+{
+#ifdef HUBBUB_WITH_PTHREADS
+	pthread_mutex_unlock(&mutex->id);
+#else
+	(void) mutex;
+#endif
+}
+
+/**
+ * Create a condition
+ *
+ * \param cond  Condition to create
+ * \return true on success, false if the condition cannot be created
+ */
+bool hubbub_cond_init(hubbub_cond *cond)
+{
+#ifdef HUBBUB_WITH_PTHREADS
+	return pthread_cond_init(&cond->id, NULL) == 0;
+#else
+	cond->unused = 0;
+
+	return true;
+#endif
+}
+
+/**
+ * Destroy a condition
+ *
+ * \param cond  Condition to destroy, which no thread may be waiting on
+ */
+void hubbub_cond_destroy(hubbub_cond *cond)
+{
+#ifdef HUBBUB_WITH_PTHREADS
+	pthread_cond_destroy(&cond->id);
+#else
+	(void) cond;
+#endif
+}
+
+/**
+ * Release a lock, wait for a condition to be signalled, and retake it
+ *
+ * \param cond   Condition to wait on
+ * \param mutex  Lock, held by the caller
+ *
+ * Waits may end early, so the caller must check what it is waiting for
+ * each time. Without thread support, there is nothing to wait for, so
+ * this must not be called.
+ */
+void hubbub_cond_wait(hubbub_cond *cond, hubbub_mutex *mutex)
+{
+#ifdef HUBBUB_WITH_PTHREADS
+	pthread_cond_wait(&cond->id, &mutex->id);
+#else
+	(void) cond;
+	(void) mutex;
+#endif
+}
+
+/**
+ * Wake any threads waiting on a condition
+ *
+ * \param cond  Condition to signal
+ */
+void hubbub_cond_broadcast(hubbub_cond *cond)
+{
+#ifdef HUBBUB_WITH_PTHREADS
+	pthread_cond_broadcast(&cond->id);
+#else
+	(void) cond;
+#endif
+}
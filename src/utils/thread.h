@@ -0,0 +1,89 @@
+/*
+ * This file is part of Hubbub.
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license.php
+ * Copyright 2026 agent <agent@local>
+ */
+
+#ifndef hubbub_utils_thread_h_
+#define hubbub_utils_thread_h_
+
+#include <stdbool.h>
+
+#ifdef HUBBUB_WITH_PTHREADS
+#include <pthread.h>
+#endif
+
+/** Work to be done on a thread */
+typedef void (*hubbub_thread_fn)(void *arg);
+
+/**
+ * A thread of work
+ *
+ * Without thread support, or where a thread cannot be created, the work
+ * is done when the thread is started, by the caller.
+ */
+typedef struct hubbub_thread {
+	hubbub_thread_fn fn;		/**< Work to do */
+	void *arg;			/**< Argument to fn */
+#ifdef HUBBUB_WITH_PTHREADS
+	pthread_t id;			/**< The thread doing the work */
+#endif
+	bool running;			/**< Whether the work is being done
+					 * on a thread of its own */
+} hubbub_thread;
+
+/**
+ * A lock, held by one thread at a time
+ *
+ * Without thread support, there is only the one thread, so nothing to
+ * do.
+ */
+typedef struct hubbub_mutex {
+#ifdef HUBBUB_WITH_PTHREADS
+	pthread_mutex_t id;		/**< The lock */
+#else
+	char unused;			/**< Placeholder */
+#endif
+} hubbub_mutex;
+
+/**
+ * A condition, which threads holding a lock may wait on
+ */
+typedef struct hubbub_cond {
+#ifdef HUBBUB_WITH_PTHREADS
+	pthread_cond_t id;		/**< The condition */
+#else
+	char unused;			/**< Placeholder */
+#endif
+} hubbub_cond;
+
+/** Start work on a thread of its own, if one can be created */
+bool hubbub_thread_create(hubbub_thread *thread, hubbub_thread_fn fn,
+		void *arg);
+/** Start work on a thread of its own */
+void hubbub_thread_start(hubbub_thread *thread, hubbub_thread_fn fn,
+		void *arg);
+
+/** Wait for work on a thread to finish */
+void hubbub_thread_join(hubbub_thread *thread);
+
+/** Create a lock */
+bool hubbub_mutex_init(hubbub_mutex *mutex);
+/** Destroy a lock */
+void hubbub_mutex_destroy(hubbub_mutex *mutex);
+/** Take a lock, waiting for any other thread to release it */
+void hubbub_mutex_lock(hubbub_mutex *mutex);
+/** Release a lock */
+void hubbub_mutex_unlock(hubbub_mutex *mutex);
+
+/** Create a condition */
+bool hubbub_cond_init(hubbub_cond *cond);
+/** Destroy a condition */
+void hubbub_cond_destroy(hubbub_cond *cond);
+/** Release a lock, wait for a condition to be signalled, and retake it */
+void hubbub_cond_wait(hubbub_cond *cond, hubbub_mutex *mutex);
+/** Wake any threads waiting on a condition */
+void hubbub_cond_broadcast(hubbub_cond *cond);
+
+#endif
@@ -0,0 +1,46 @@
+/*
+ * This file is part of Hubbub.
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license.php
+ * Copyright 2026 agent <agent@local>
+ */
+
+#ifndef hubbub_utils_trace_h_
+#define hubbub_utils_trace_h_
+
+/*
+ * Tracepoints
+ *
+ * When built with HUBBUB_WITH_TRACE, these are static probes, in the
+ * "hubbub" provider, which tools such as bpftrace, perf, SystemTap and
+ * DTrace may attach to. Until they do, each is a single no-op
+ * instruction. Otherwise, they expand to nothing.
+ *
+ *   tokeniser__state(tokeniser, state)
+ *       The tokeniser enters a state, from the main loop
+ *   tokeniser__token(tokeniser, type, token)
+ *       The tokeniser emits a token, of a hubbub_token_type
+ *   treebuilder__mode(treebuilder, mode, type)
+ *       The treebuilder handles a token of a type, in an insertion mode
+ *   tree__call(ctx, call)
+ *       The treebuilder calls a tree handler callback, of a
+ *       hubbub_tree_call, with the client's context
+ */
+#ifdef HUBBUB_WITH_TRACE
+
+#include <sys/sdt.h>
+
+#define HUBBUB_TRACE2(probe, a, b)					\
+	DTRACE_PROBE2(hubbub, probe, a, b)
+#define HUBBUB_TRACE3(probe, a, b, c)					\
+	DTRACE_PROBE3(hubbub, probe, a, b, c)
+
+#else
+
+#define HUBBUB_TRACE2(probe, a, b) ((void) 0)
+#define HUBBUB_TRACE3(probe, a, b, c) ((void) 0)
+
+#endif
+
+#endif
+
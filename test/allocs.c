@@ -0,0 +1,188 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <hubbub/hubbub.h>
+
+#include <hubbub/dom.h>
+#include <hubbub/parser.h>
+
+#include "utils/utils.h"
+
+#include "testutils.h"
+
+/*
+ * Allocation budgets
+ *
+ * Each is a fixed allowance, for setting up, and an allowance for each KB
+ * of input. They have some headroom over the test data as it is, so that
+ * a change which costs, say, an allocation per token fails them, rather
+ * than slipping through unnoticed. Where a change makes fewer allocations,
+ * the budgets should be lowered to match.
+ */
+typedef struct budget {
+	const char *name;	/**< What is budgeted */
+	uint64_t calls;		/**< Allocations, beyond those per KB */
+	uint64_t calls_per_kb;	/**< Allocations per KB of input */
+	uint64_t peak;		/**< Peak live bytes, beyond those per KB */
+	uint64_t peak_per_kb;	/**< Peak live bytes per KB of input */
+} budget;
+
+static const budget parser_budget = { "parser", 64, 1, 65536, 10240 };
+static const budget dom_budget = { "dom", 96, 2, 65536, 40960 };
+
+/** Allocation counters, for one allocator */
+typedef struct counter {
+	uint64_t calls;		/**< Calls which allocate */
+	uint64_t bytes;		/**< Bytes allocated, in all */
+	uint64_t live;		/**< Bytes allocated at present */
+	uint64_t peak;		/**< Most bytes allocated at once */
+} counter;
+
+/** Header in front of each block, recording its size */
+typedef union header {
+	size_t len;
+	long double align_ld;
+	void *align_p;
+	uint64_t align_u64;
+} header;
+
+static void *counting_realloc(void *ptr, size_t len, void *pw)
+{
+	counter *c = pw;
+	header *h = NULL;
+	size_t old = 0;
+
+	if (ptr != NULL) {
+		h = (header *) ptr - 1;
+		old = h->len;
+	}
+
+	if (len == 0) {
+		c->live -= old;
+		free(h);
+		return NULL;
+	}
+
+	h = realloc(h, sizeof(header) + len);
+	if (h == NULL)
+		return NULL;
+	h->len = len;
+
+	c->calls++;
+	if (len > old)
+		c->bytes += len - old;
+	c->live += len;
+	c->live -= old;
+	if (c->peak < c->live)
+		c->peak = c->live;
+
+	return h + 1;
+}
+
+static uint8_t *load(const char *name, size_t *len)
+{
+	FILE *fp;
+	uint8_t *data;
+	long size;
+
+	fp = fopen(name, "rb");
+	if (fp == NULL) {
+		printf("Failed opening %s\n", name);
+		return NULL;
+	}
+
+	fseek(fp, 0, SEEK_END);
+	size = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+
+	data = malloc(size > 0 ? size : 1);
+	assert(data != NULL);
+	assert(fread(data, 1, size, fp) == (size_t) size);
+
+	fclose(fp);
+
+	*len = size;
+
+	return data;
+}
+
+static void check(const budget *b, const counter *c, size_t len,
+		size_t chunk)
+{
+	uint64_t kb = (len + 1023) / 1024;
+
+	printf("%s, chunks of %" PRIuPTR ": %" PRIu64 " allocations, "
+			"%" PRIu64 " bytes, %" PRIu64 " peak\n",
+			b->name, (uintptr_t) chunk, c->calls, c->bytes,
+			c->peak);
+
+	assert(c->calls <= b->calls + b->calls_per_kb * kb);
+	assert(c->peak <= b->peak + b->peak_per_kb * kb);
+
+	/* Everything is freed */
+	assert(c->live == 0);
+}
+
+static int run_test(const uint8_t *data, size_t len, size_t chunk)
+{
+	counter parser_count, dom_count;
+	hubbub_parser *parser;
+	hubbub_dom *dom;
+	size_t pos, n;
+
+	memset(&parser_count, 0, sizeof parser_count);
+	memset(&dom_count, 0, sizeof dom_count);
+
+	assert(hubbub_parser_create("UTF-8", false, counting_realloc,
+			&parser_count, &parser) == HUBBUB_OK);
+	assert(hubbub_dom_create(counting_realloc, &dom_count, &dom) ==
+			HUBBUB_OK);
+	assert(hubbub_dom_attach(dom, parser) == HUBBUB_OK);
+
+	for (pos = 0; pos < len; pos += n) {
+		n = len - pos < chunk ? len - pos : chunk;
+
+		assert(hubbub_parser_parse_chunk(parser, data + pos, n) ==
+				HUBBUB_OK);
+	}
+	assert(hubbub_parser_completed(parser) == HUBBUB_OK);
+
+	assert(hubbub_parser_destroy(parser) == HUBBUB_OK);
+	check(&parser_budget, &parser_count, len, chunk);
+
+	assert(hubbub_dom_destroy(dom) == HUBBUB_OK);
+	check(&dom_budget, &dom_count, len, chunk);
+
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	uint8_t *data;
+	size_t len;
+	int ret;
+
+	if (argc != 2) {
+		printf("Usage: %s <filename>\n", argv[0]);
+		return 1;
+	}
+
+	data = load(argv[1], &len);
+	if (data == NULL)
+		return 1;
+
+	if ((ret = run_test(data, len, 1)) != 0)
+		return ret;
+	if ((ret = run_test(data, len, 4096)) != 0)
+		return ret;
+	if ((ret = run_test(data, len, len > 0 ? len : 1)) != 0)
+		return ret;
+
+	free(data);
+
+	printf("PASS\n");
+
+	return 0;
+}
@@ -0,0 +1,190 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <hubbub/hubbub.h>
+
+#include <hubbub/arena.h>
+#include <hubbub/parser.h>
+
+#include "utils/utils.h"
+
+#include "testutils.h"
+
+/* Number of blocks the backing allocator has outstanding */
+static size_t outstanding;
+
+static void *myrealloc(void *ptr, size_t len, void *pw)
+{
+	UNUSED(pw);
+
+	if (ptr == NULL && len > 0)
+		outstanding++;
+	else if (ptr != NULL && len == 0)
+		outstanding--;
+
+	return realloc(ptr, len);
+}
+
+static hubbub_error token_handler(const hubbub_token *token, void *pw)
+{
+	UNUSED(token);
+	UNUSED(pw);
+
+	return HUBBUB_OK;
+}
+
+static void fill(uint8_t *p, size_t len, uint8_t seed)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		p[i] = (uint8_t) (seed + i);
+}
+
+static bool check(const uint8_t *p, size_t len, uint8_t seed)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		if (p[i] != (uint8_t) (seed + i))
+			return false;
+	}
+
+	return true;
+}
+
+static void test_allocator(void)
+{
+	static const size_t sizes[] = { 1, 15, 16, 17, 100, 2048, 2049,
+			100000 };
+	hubbub_arena *arena;
+	uint8_t *p[sizeof(sizes) / sizeof(sizes[0])];
+	uint8_t *q;
+	size_t i;
+
+	assert(hubbub_arena_create(myrealloc, NULL, &arena) == HUBBUB_OK);
+
+	for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		p[i] = hubbub_arena_alloc(NULL, sizes[i], arena);
+		assert(p[i] != NULL);
+		assert(((uintptr_t) p[i] % sizeof(void *)) == 0);
+		fill(p[i], sizes[i], (uint8_t) i);
+	}
+
+	for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+		assert(check(p[i], sizes[i], (uint8_t) i));
+
+	/* Growing preserves contents, whether small or large */
+	for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		p[i] = hubbub_arena_alloc(p[i], sizes[i] * 3, arena);
+		assert(p[i] != NULL);
+		assert(check(p[i], sizes[i], (uint8_t) i));
+	}
+
+	/* As does shrinking */
+	for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		p[i] = hubbub_arena_alloc(p[i], sizes[i], arena);
+		assert(p[i] != NULL);
+		assert(check(p[i], sizes[i], (uint8_t) i));
+	}
+
+	/* Freed small objects are reused for objects of the same class */
+	q = hubbub_arena_alloc(NULL, 40, arena);
+	assert(q != NULL);
+	assert(hubbub_arena_alloc(q, 0, arena) == NULL);
+	assert(hubbub_arena_alloc(NULL, 33, arena) == q);
+
+	/* Freed large objects go back to the backing allocator */
+	i = outstanding;
+	assert(hubbub_arena_alloc(p[7], 0, arena) == NULL);
+	assert(outstanding == i - 1);
+
+	/* Everything else goes with the arena */
+	assert(hubbub_arena_destroy(arena) == HUBBUB_OK);
+	assert(outstanding == 0);
+}
+
+static int run_test(int argc, char **argv, unsigned int CHUNK_SIZE)
+{
+	hubbub_parser *parser;
+	hubbub_parser_optparams params;
+	hubbub_arena *arena;
+	FILE *fp;
+	size_t len;
+	uint8_t *buf = alloca(CHUNK_SIZE);
+	void *object;
+
+	UNUSED(argc);
+
+	assert(hubbub_parser_create_arena("UTF-8", false, myrealloc, NULL,
+			&parser) == HUBBUB_OK);
+
+	params.token_handler.handler = token_handler;
+	params.token_handler.pw = NULL;
+	assert(hubbub_parser_setopt(parser, HUBBUB_PARSER_TOKEN_HANDLER,
+			&params) == HUBBUB_OK);
+
+	/* Clients may allocate from the parser's arena */
+	arena = hubbub_parser_get_arena(parser);
+	assert(arena != NULL);
+	object = hubbub_arena_alloc(NULL, 64, arena);
+	assert(object != NULL);
+
+	fp = fopen(argv[1], "rb");
+	if (fp == NULL) {
+		printf("Failed opening %s\n", argv[1]);
+		return 1;
+	}
+
+	fseek(fp, 0, SEEK_END);
+	len = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+
+	while (len > 0) {
+		ssize_t bytes_read = fread(buf, 1, CHUNK_SIZE, fp);
+
+		if (bytes_read < 1)
+			break;
+
+		assert(hubbub_parser_parse_chunk(parser,
+				buf, bytes_read) == HUBBUB_OK);
+
+		len -= bytes_read;
+	}
+
+	assert(len == 0);
+
+	fclose(fp);
+
+	assert(hubbub_parser_completed(parser) == HUBBUB_OK);
+
+	hubbub_parser_destroy(parser);
+
+	/* Destroying the parser released everything, object included */
+	assert(outstanding == 0);
+
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	int ret;
+
+	if (argc != 2) {
+		printf("Usage: %s <filename>\n", argv[0]);
+		return 1;
+	}
+
+	test_allocator();
+
+	if ((ret = run_test(argc, argv, 1)) != 0)
+		return ret;
+	if ((ret = run_test(argc, argv, 4096)) != 0)
+		return ret;
+
+	printf("PASS\n");
+
+	return 0;
+}
+
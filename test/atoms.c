@@ -0,0 +1,159 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <hubbub/hubbub.h>
+
+#include <hubbub/atoms.h>
+#include <hubbub/parser.h>
+
+#include "utils/utils.h"
+
+#include "testutils.h"
+
+/* Number of tags, and of attributes, with atoms */
+static size_t tags, attributes;
+
+static void *myrealloc(void *ptr, size_t len, void *pw)
+{
+	UNUSED(pw);
+
+	return realloc(ptr, len);
+}
+
+/* Check the atom of a name */
+static void check(const hubbub_string *name, hubbub_atom atom)
+{
+	hubbub_string str = hubbub_atom_string(atom);
+
+	assert(atom == hubbub_atom_find(name->ptr, name->len));
+
+	if (atom != HUBBUB_ATOM_NONE) {
+		assert(str.len == name->len);
+		assert(memcmp(str.ptr, name->ptr, str.len) == 0);
+	}
+}
+
+static hubbub_error token_handler(const hubbub_token *token, void *pw)
+{
+	const hubbub_tag *tag = &token->data.tag;
+	uint32_t i;
+
+	UNUSED(pw);
+
+	if (token->type != HUBBUB_TOKEN_START_TAG &&
+			token->type != HUBBUB_TOKEN_END_TAG)
+		return HUBBUB_OK;
+
+	check(&tag->name, tag->atom);
+	if (tag->atom != HUBBUB_ATOM_NONE)
+		tags++;
+
+	for (i = 0; i < tag->n_attributes; i++) {
+		check(&tag->attributes[i].name, tag->attributes[i].atom);
+		if (tag->attributes[i].atom != HUBBUB_ATOM_NONE)
+			attributes++;
+	}
+
+	return HUBBUB_OK;
+}
+
+/* Check that every atom is found from its name */
+static void test_names(void)
+{
+	static const char *unknown[] = { "", "DIV", "Div", "di", "divx",
+			"foreignObject", "viewBox", "definitionURL",
+			"xlink:href", "frobnicate" };
+	hubbub_string str;
+	hubbub_atom atom;
+	size_t i;
+
+	for (atom = HUBBUB_ATOM_NONE + 1; atom < HUBBUB_ATOM_COUNT; atom++) {
+		str = hubbub_atom_string(atom);
+
+		assert(str.ptr != NULL && str.len > 0);
+		assert(hubbub_atom_find(str.ptr, str.len) == atom);
+	}
+
+	assert(hubbub_atom_find((const uint8_t *) "div", 3) ==
+			HUBBUB_ATOM_DIV);
+	assert(hubbub_atom_find((const uint8_t *) "href", 4) ==
+			HUBBUB_ATOM_HREF);
+
+	for (i = 0; i < N_ELEMENTS(unknown); i++) {
+		assert(hubbub_atom_find((const uint8_t *) unknown[i],
+				strlen(unknown[i])) == HUBBUB_ATOM_NONE);
+	}
+
+	assert(hubbub_atom_string(HUBBUB_ATOM_NONE).len == 0);
+	assert(hubbub_atom_string(HUBBUB_ATOM_COUNT).ptr == NULL);
+}
+
+/* Check the URIs of the namespaces */
+static void test_namespaces(void)
+{
+	hubbub_string str;
+
+	str = hubbub_ns_uri(HUBBUB_NS_NULL);
+	assert(str.len == 0);
+
+	str = hubbub_ns_uri(HUBBUB_NS_HTML);
+	assert(str.len == SLEN("http://www.w3.org/1999/xhtml"));
+	assert(memcmp(str.ptr, "http://www.w3.org/1999/xhtml", str.len) == 0);
+
+	str = hubbub_ns_uri(HUBBUB_NS_XMLNS);
+	assert(str.len == SLEN("http://www.w3.org/2000/xmlns/"));
+	assert(memcmp(str.ptr, "http://www.w3.org/2000/xmlns/", str.len) == 0);
+
+	str = hubbub_ns_uri((hubbub_ns) (HUBBUB_NS_XMLNS + 1));
+	assert(str.ptr == NULL && str.len == 0);
+}
+
+int main(int argc, char **argv)
+{
+	hubbub_parser_optparams params;
+	hubbub_parser *parser;
+	FILE *fp;
+	uint8_t buf[4096];
+	size_t len;
+
+	if (argc != 2) {
+		printf("Usage: %s <filename>\n", argv[0]);
+		return 1;
+	}
+
+	test_names();
+	test_namespaces();
+
+	/* And check the atoms of the tokens in a document */
+	assert(hubbub_parser_create("UTF-8", false, myrealloc, NULL,
+			&parser) == HUBBUB_OK);
+
+	params.token_handler.handler = token_handler;
+	params.token_handler.pw = NULL;
+	assert(hubbub_parser_setopt(parser, HUBBUB_PARSER_TOKEN_HANDLER,
+			&params) == HUBBUB_OK);
+
+	fp = fopen(argv[1], "rb");
+	if (fp == NULL) {
+		printf("Failed opening %s\n", argv[1]);
+		return 1;
+	}
+
+	while ((len = fread(buf, 1, sizeof buf, fp)) > 0) {
+		assert(hubbub_parser_parse_chunk(parser, buf, len) ==
+				HUBBUB_OK);
+	}
+	assert(hubbub_parser_completed(parser) == HUBBUB_OK);
+
+	fclose(fp);
+
+	hubbub_parser_destroy(parser);
+
+	printf("%u tags and %u attributes with atoms\n",
+			(unsigned int) tags, (unsigned int) attributes);
+
+	printf("PASS\n");
+
+	return 0;
+}
@@ -0,0 +1,249 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <hubbub/hubbub.h>
+
+#include <hubbub/attribute.h>
+#include <hubbub/parser.h>
+
+#include "utils/utils.h"
+
+#include "testutils.h"
+
+typedef struct recorder {
+	text log;		/* Attribute values, decoded */
+	bool raw;		/* Whether values are raw */
+	size_t n_raw;		/* Number of raw values seen */
+} recorder;
+
+typedef struct testcase {
+	const char *data;	/* Document */
+	size_t len;		/* Length of document */
+} testcase;
+
+#define CASE(s) { s, sizeof(s) - 1 }
+
+/* Each value must be decoded just as the tokeniser decodes it */
+static const testcase cases[] = {
+	CASE("<a x=\"a&amp;b\" y='&lt;&gt' z=&quot;q>"),
+	CASE("<a x=\"&amp\" y=\"&ampx\" z=\"&amp;x\" w=\"&amp=\">"),
+	CASE("<a x=\"&notit;\" y=\"&noti\" z=\"&notin;\" w=\"&not\">"),
+	CASE("<a x=\"&#65;&#x41;&#X41\" y=\"&#;&#x;&#\" z=\"&#x;x\">"),
+	CASE("<a x=\"&#128;&#0;&#x110000;&#13;&#xD800;&#99999999999\">"),
+	CASE("<a x=\"&#x1F600;&Afr;&Afr\" y=\"&\" z=\"&&amp;\" w=\"& x\">"),
+	CASE("<a x=\"a\r\nb\rc\r\" y='\r\r\n' z=\"\r\">"),
+	CASE("<a x=\"\0a\0\" y='\0' z=\0a w=a\0 v=\0&lt;\0>"),
+	CASE("<a x=&amp y=&ampx z=a&lt= w=&#65 v=& u=&lt;>"),
+	CASE("<a x=\"&AMP;&amp;&AMP\" y=\"&lt&gt&lt;\">"),
+	CASE("<a x=\"&unknown;&#x26;amp;\" y=\"\xC3\xA9&eacute;\">"),
+	CASE("<a x=\"plain\" y='plain' z=plain>"),
+};
+
+static void *myrealloc(void *ptr, size_t len, void *pw)
+{
+	UNUSED(pw);
+
+	return realloc(ptr, len);
+}
+
+/* Log a value, after its length */
+static void put_value(recorder *r, const uint8_t *data, size_t len)
+{
+	put(&r->log, &len, sizeof(size_t));
+	put(&r->log, data, len);
+}
+
+static void put_attribute(recorder *r, const hubbub_attribute *attr)
+{
+	size_t size = HUBBUB_ATTRIBUTE_DECODED_MAX(attr->value.len);
+	uint8_t *buf = malloc(size > 0 ? size : 1);
+	size_t len = size;
+	size_t short_len;
+
+	assert(buf != NULL);
+
+	if (r->raw == false) {
+		assert(attr->raw == false);
+	} else if (attr->raw) {
+		r->n_raw++;
+	} else if (attr->value.len > 0) {
+		/* Values which are not raw have nothing to decode */
+		const uint8_t *v = attr->value.ptr;
+
+		assert(memchr(v, '&', attr->value.len) == NULL);
+		assert(memchr(v, '\0', attr->value.len) == NULL);
+		assert(memchr(v, '\r', attr->value.len) == NULL);
+	}
+
+	assert(hubbub_attribute_decode(attr, buf, &len) == HUBBUB_OK);
+	assert(len <= size);
+	assert(attr->raw || (len == attr->value.len && (len == 0 ||
+			memcmp(buf, attr->value.ptr, len) == 0)));
+
+	put_value(r, buf, len);
+
+	/* A buffer too small for the value is refused */
+	if (len > 0) {
+		short_len = len - 1;
+		assert(hubbub_attribute_decode(attr, buf, &short_len) ==
+				HUBBUB_BADPARM);
+	}
+
+	free(buf);
+}
+
+static hubbub_error token_handler(const hubbub_token *token, void *pw)
+{
+	recorder *r = pw;
+	uint32_t i;
+
+	if (token->type != HUBBUB_TOKEN_START_TAG &&
+			token->type != HUBBUB_TOKEN_END_TAG)
+		return HUBBUB_OK;
+
+	put_value(r, token->data.tag.name.ptr, token->data.tag.name.len);
+
+	for (i = 0; i < token->data.tag.n_attributes; i++)
+		put_attribute(r, &token->data.tag.attributes[i]);
+
+	return HUBBUB_OK;
+}
+
+static void parse(const uint8_t *data, size_t len, size_t chunk,
+		recorder *r)
+{
+	hubbub_parser *parser;
+	hubbub_parser_optparams params;
+	size_t pos, n;
+
+	assert(hubbub_parser_create("UTF-8", false, myrealloc, NULL,
+			&parser) == HUBBUB_OK);
+
+	/* The treebuilder needs decoded values */
+	params.raw_attribute_values = true;
+	assert(hubbub_parser_setopt(parser,
+			HUBBUB_PARSER_RAW_ATTRIBUTE_VALUES,
+			&params) == HUBBUB_BADPARM);
+
+	params.token_handler.handler = token_handler;
+	params.token_handler.pw = r;
+	assert(hubbub_parser_setopt(parser, HUBBUB_PARSER_TOKEN_HANDLER,
+			&params) == HUBBUB_OK);
+
+	params.raw_attribute_values = r->raw;
+	assert(hubbub_parser_setopt(parser,
+			HUBBUB_PARSER_RAW_ATTRIBUTE_VALUES,
+			&params) == HUBBUB_OK);
+
+	for (pos = 0; pos < len; pos += n) {
+		n = len - pos < chunk ? len - pos : chunk;
+
+		assert(hubbub_parser_parse_chunk(parser, data + pos, n) ==
+				HUBBUB_OK);
+	}
+	assert(hubbub_parser_completed(parser) == HUBBUB_OK);
+
+	hubbub_parser_destroy(parser);
+}
+
+static size_t run_test(const uint8_t *data, size_t len, size_t chunk)
+{
+	recorder v1, v2;
+	size_t n_raw;
+
+	memset(&v1, 0, sizeof v1);
+	memset(&v2, 0, sizeof v2);
+	v2.raw = true;
+
+	parse(data, len, chunk, &v1);
+	parse(data, len, chunk, &v2);
+
+	/* The raw values decode to the values the tokeniser gives */
+	assert(v1.log.len == v2.log.len);
+	assert(v1.log.len == 0 ||
+			memcmp(v1.log.data, v2.log.data, v1.log.len) == 0);
+
+	n_raw = v2.n_raw;
+
+	free(v1.log.data);
+	free(v2.log.data);
+
+	return n_raw;
+}
+
+static void test_cases(void)
+{
+	size_t i;
+
+	for (i = 0; i < N_ELEMENTS(cases); i++) {
+		const uint8_t *data = (const uint8_t *) cases[i].data;
+		size_t n_raw;
+
+		n_raw = run_test(data, cases[i].len, 1);
+		assert(n_raw == run_test(data, cases[i].len, cases[i].len));
+
+		/* Only the last has nothing to decode */
+		assert((n_raw == 0) == (i == N_ELEMENTS(cases) - 1));
+	}
+}
+
+static void test_badparm(void)
+{
+	hubbub_attribute attr;
+	uint8_t buf[4];
+	size_t len = sizeof(buf);
+
+	memset(&attr, 0, sizeof attr);
+
+	assert(hubbub_attribute_decode(NULL, buf, &len) == HUBBUB_BADPARM);
+	assert(hubbub_attribute_decode(&attr, buf, NULL) == HUBBUB_BADPARM);
+	assert(hubbub_attribute_decode(&attr, NULL, &len) == HUBBUB_BADPARM);
+
+	len = 0;
+	assert(hubbub_attribute_decode(&attr, NULL, &len) == HUBBUB_OK);
+	assert(len == 0);
+}
+
+int main(int argc, char **argv)
+{
+	FILE *fp;
+	uint8_t *data;
+	size_t len;
+
+	if (argc != 2) {
+		printf("Usage: %s <filename>\n", argv[0]);
+		return 1;
+	}
+
+	fp = fopen(argv[1], "rb");
+	if (fp == NULL) {
+		printf("Failed opening %s\n", argv[1]);
+		return 1;
+	}
+
+	fseek(fp, 0, SEEK_END);
+	len = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+
+	data = malloc(len > 0 ? len : 1);
+	assert(data != NULL);
+	assert(fread(data, 1, len, fp) == len);
+
+	fclose(fp);
+
+	test_badparm();
+	test_cases();
+
+	run_test(data, len, 1);
+	run_test(data, len, 7);
+	run_test(data, len, 4096);
+	run_test(data, len, len > 0 ? len : 1);
+
+	free(data);
+
+	printf("PASS\n");
+
+	return 0;
+}
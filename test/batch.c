@@ -0,0 +1,223 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <hubbub/hubbub.h>
+
+#include <hubbub/batch.h>
+#include <hubbub/dom.h>
+#include <hubbub/parser.h>
+
+#include "utils/utils.h"
+
+#include "testutils.h"
+
+/* Number of documents in each batch */
+#define N_DOCS 64
+
+/* Number of times each batch is parsed */
+#define ROUNDS 4
+
+/* State for each document of a batch, touched only by its own thread */
+typedef struct result {
+	hubbub_dom *dom;	/* Tree being built */
+	text tree;		/* Serialised tree */
+	bool started;		/* Whether the document was started */
+	bool finished;		/* Whether the document was finished */
+	hubbub_error error;	/* Error passed on finishing */
+} result;
+
+static void *myrealloc(void *ptr, size_t len, void *pw)
+{
+	UNUSED(pw);
+
+	return realloc(ptr, len);
+}
+
+static hubbub_error enter(const hubbub_dom *dom, hubbub_dom_node node,
+		void *pw)
+{
+	hubbub_string s;
+
+	switch (hubbub_dom_type(dom, node)) {
+	case HUBBUB_DOM_NODE_ELEMENT:
+		s = hubbub_dom_atom_string(dom, hubbub_dom_name(dom, node));
+		put(pw, "<", 1);
+		put(pw, (const char *) s.ptr, s.len);
+		break;
+	case HUBBUB_DOM_NODE_TEXT:
+	case HUBBUB_DOM_NODE_COMMENT:
+		s = hubbub_dom_data(dom, node);
+		put(pw, "\"", 1);
+		put(pw, (const char *) s.ptr, s.len);
+		break;
+	default:
+		break;
+	}
+
+	return HUBBUB_OK;
+}
+
+static hubbub_error leave(const hubbub_dom *dom, hubbub_dom_node node,
+		void *pw)
+{
+	if (hubbub_dom_type(dom, node) == HUBBUB_DOM_NODE_ELEMENT)
+		put(pw, ">", 1);
+
+	return HUBBUB_OK;
+}
+
+static hubbub_error start(void *pw, size_t index, hubbub_parser *parser)
+{
+	result *r = &((result *) pw)[index];
+
+	assert(r->started == false);
+	r->started = true;
+
+	assert(hubbub_dom_create(myrealloc, NULL, &r->dom) == HUBBUB_OK);
+
+	return hubbub_dom_attach(r->dom, parser);
+}
+
+static void finish(void *pw, size_t index, hubbub_error error)
+{
+	result *r = &((result *) pw)[index];
+
+	assert(r->finished == false);
+	r->finished = true;
+	r->error = error;
+
+	if (r->dom != NULL) {
+		assert(hubbub_dom_walk(r->dom, HUBBUB_DOM_ROOT, enter, leave,
+				&r->tree) == HUBBUB_OK);
+		/* The parser has let go of the tree */
+		assert(hubbub_dom_destroy(r->dom) == HUBBUB_OK);
+		r->dom = NULL;
+	}
+}
+
+/* Parse a document on its own, and serialise it */
+static hubbub_error parse(const hubbub_batch_document *doc, text *t)
+{
+	hubbub_parser *parser;
+	hubbub_dom *dom;
+	hubbub_error error;
+
+	memset(t, 0, sizeof *t);
+
+	error = hubbub_parser_create(doc->charset, false, myrealloc, NULL,
+			&parser);
+	if (error != HUBBUB_OK)
+		return error;
+
+	assert(hubbub_dom_create(myrealloc, NULL, &dom) == HUBBUB_OK);
+	assert(hubbub_dom_attach(dom, parser) == HUBBUB_OK);
+
+	error = hubbub_parser_parse_buffer(parser, doc->data, doc->len);
+
+	hubbub_parser_destroy(parser);
+
+	assert(hubbub_dom_walk(dom, HUBBUB_DOM_ROOT, enter, leave, t) ==
+			HUBBUB_OK);
+	assert(hubbub_dom_destroy(dom) == HUBBUB_OK);
+
+	return error;
+}
+
+static int run_test(hubbub_batch_document *docs, unsigned int threads,
+		const text *expected, const hubbub_error *errors)
+{
+	hubbub_batch_handler handler;
+	result results[N_DOCS];
+	size_t i;
+
+	memset(results, 0, sizeof results);
+
+	handler.start = start;
+	handler.finish = finish;
+	handler.pw = results;
+
+	assert(hubbub_parse_batch(docs, N_DOCS, &handler, threads, myrealloc,
+			NULL) == HUBBUB_OK);
+
+	/* Every document is parsed once, just as if on its own */
+	for (i = 0; i < N_DOCS; i++) {
+		assert(results[i].finished);
+		assert(results[i].error == errors[i]);
+		assert(docs[i].error == errors[i]);
+
+		assert(results[i].tree.len == expected[i].len);
+		assert(expected[i].len == 0 || memcmp(results[i].tree.data,
+				expected[i].data, expected[i].len) == 0);
+
+		free(results[i].tree.data);
+	}
+
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	const unsigned int threads[] = { 0, 1, 3, 8, 2 * N_DOCS };
+	hubbub_batch_document docs[N_DOCS];
+	hubbub_error errors[N_DOCS];
+	text expected[N_DOCS];
+	FILE *fp;
+	uint8_t *data;
+	size_t len, i, j;
+	int ret;
+
+	if (argc != 2) {
+		printf("Usage: %s <filename>\n", argv[0]);
+		return 1;
+	}
+
+	fp = fopen(argv[1], "rb");
+	if (fp == NULL) {
+		printf("Failed opening %s\n", argv[1]);
+		return 1;
+	}
+
+	fseek(fp, 0, SEEK_END);
+	len = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+
+	data = malloc(len + 1);
+	assert(data != NULL);
+	assert(fread(data, 1, len, fp) == len);
+
+	fclose(fp);
+
+	/* Documents of all lengths, cut from the file, in given charsets
+	 * or detected ones, and one in a charset which does not exist */
+	for (i = 0; i < N_DOCS; i++) {
+		docs[i].data = data;
+		docs[i].len = len * ((i * 37) % N_DOCS + 1) / N_DOCS;
+		docs[i].charset = i % 3 == 0 ? NULL : "UTF-8";
+		docs[i].error = HUBBUB_OK;
+	}
+	docs[N_DOCS / 2].charset = "no-such-charset";
+
+	/* Whatever becomes of each on its own becomes of it in a batch */
+	for (i = 0; i < N_DOCS; i++)
+		errors[i] = parse(&docs[i], &expected[i]);
+
+	for (j = 0; j < ROUNDS; j++) {
+		for (i = 0; i < N_ELEMENTS(threads); i++) {
+			ret = run_test(docs, threads[i], expected, errors);
+			if (ret != 0)
+				return ret;
+		}
+	}
+
+	for (i = 0; i < N_DOCS; i++)
+		free(expected[i].data);
+
+	free(data);
+
+	printf("PASS\n");
+
+	return 0;
+}
+
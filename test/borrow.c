@@ -0,0 +1,219 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <hubbub/hubbub.h>
+
+#include <hubbub/parser.h>
+
+#include "utils/utils.h"
+
+#include "testutils.h"
+
+typedef struct recorder {
+	text log;		/* Tokens, serialised */
+
+	bool in_chars;		/* Whether the last token was characters */
+	uint32_t tags;		/* Number of start tags seen */
+
+	const uint8_t *data;	/* Document being parsed */
+	size_t data_len;	/* Length of document */
+	size_t in_place;	/* Strings found in the document itself */
+} recorder;
+
+static hubbub_parser *parser;
+
+/* Whether to insert data after some start tags */
+static bool inserting;
+
+static void *myrealloc(void *ptr, size_t len, void *pw)
+{
+	UNUSED(pw);
+
+	return realloc(ptr, len);
+}
+
+static void put_string(recorder *r, const hubbub_string *s)
+{
+	if (s->len > 0 && s->ptr >= r->data &&
+			s->ptr + s->len <= r->data + r->data_len)
+		r->in_place++;
+
+	put(&r->log, (const char *) s->ptr, s->len);
+	put(&r->log, "\n", 1);
+}
+
+static hubbub_error token_handler(const hubbub_token *token, void *pw)
+{
+	/* This ends part way through a tag, whose attribute value goes on
+	 * into the document proper */
+	static const char insert[] = "<i>written</i><b title=\"";
+	recorder *r = pw;
+	uint32_t i;
+
+	/* Runs of characters may be split differently */
+	if (token->type == HUBBUB_TOKEN_CHARACTER) {
+		if (r->in_chars == false)
+			put(&r->log, "C\n", 2);
+		r->in_chars = true;
+		put_string(r, &token->data.character);
+		r->log.len--;
+		return HUBBUB_OK;
+	}
+
+	if (r->in_chars)
+		put(&r->log, "\n", 1);
+	r->in_chars = false;
+
+	switch (token->type) {
+	case HUBBUB_TOKEN_DOCTYPE:
+		put(&r->log, "D\n", 2);
+		put_string(r, &token->data.doctype.name);
+		put_string(r, &token->data.doctype.public_id);
+		put_string(r, &token->data.doctype.system_id);
+		break;
+	case HUBBUB_TOKEN_START_TAG:
+	case HUBBUB_TOKEN_END_TAG:
+		put(&r->log, token->type == HUBBUB_TOKEN_START_TAG ?
+				"S\n" : "E\n", 2);
+		put_string(r, &token->data.tag.name);
+		for (i = 0; i < token->data.tag.n_attributes; i++) {
+			put_string(r, &token->data.tag.attributes[i].name);
+			put_string(r, &token->data.tag.attributes[i].value);
+		}
+
+		if (inserting && token->type == HUBBUB_TOKEN_START_TAG &&
+				++r->tags % 5 == 0) {
+			assert(hubbub_parser_insert_chunk(parser,
+					(const uint8_t *) insert,
+					SLEN(insert)) == HUBBUB_OK);
+		}
+		break;
+	case HUBBUB_TOKEN_COMMENT:
+		put(&r->log, "M\n", 2);
+		put_string(r, &token->data.comment);
+		break;
+	case HUBBUB_TOKEN_CHARACTER:
+		break;
+	case HUBBUB_TOKEN_EOF:
+		put(&r->log, "F\n", 2);
+		break;
+	}
+
+	return HUBBUB_OK;
+}
+
+/* Parse a document, borrowed if chunk is 0, else in chunks of that size */
+static void parse(const uint8_t *data, size_t len, size_t chunk,
+		recorder *r)
+{
+	hubbub_parser_optparams params;
+	size_t pos;
+
+	memset(r, 0, sizeof *r);
+	r->data = data;
+	r->data_len = len;
+
+	assert(hubbub_parser_create("UTF-8", false, myrealloc, NULL,
+			&parser) == HUBBUB_OK);
+
+	params.token_handler.handler = token_handler;
+	params.token_handler.pw = r;
+	assert(hubbub_parser_setopt(parser, HUBBUB_PARSER_TOKEN_HANDLER,
+			&params) == HUBBUB_OK);
+
+	if (chunk == 0) {
+		assert(hubbub_parser_parse_buffer(parser, data, len) ==
+				HUBBUB_OK);
+
+		/* No more data may be given */
+		assert(hubbub_parser_parse_chunk(parser, data, len) ==
+				HUBBUB_BADPARM);
+	} else {
+		/* Characters split between chunks are reassembled */
+		for (pos = 0; pos < len; pos += chunk) {
+			size_t n = len - pos < chunk ? len - pos : chunk;
+
+			assert(hubbub_parser_parse_chunk(parser, data + pos,
+					n) == HUBBUB_OK);
+		}
+		assert(hubbub_parser_completed(parser) == HUBBUB_OK);
+	}
+
+	hubbub_parser_destroy(parser);
+}
+
+static int run_test(const uint8_t *data, size_t len)
+{
+	const size_t chunks[] = { 1, 7, len + 1 };
+	recorder copied, borrowed;
+	size_t i;
+
+	parse(data, len, 0, &borrowed);
+
+	for (i = 0; i < N_ELEMENTS(chunks); i++) {
+		parse(data, len, chunks[i], &copied);
+
+		/* The same tokens are produced either way */
+		assert(copied.log.len == borrowed.log.len);
+		assert(memcmp(copied.log.data, borrowed.log.data,
+				copied.log.len) == 0);
+
+		/* And only the borrowed document is read in place */
+		assert(copied.in_place == 0);
+
+		free(copied.log.data);
+	}
+
+	printf("%s: %" PRIuPTR " strings read in place\n",
+			inserting ? "Inserting" : "Plain",
+			(uintptr_t) borrowed.in_place);
+
+	free(borrowed.log.data);
+
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	FILE *fp;
+	uint8_t *data;
+	size_t len;
+	int ret;
+
+	if (argc != 2) {
+		printf("Usage: %s <filename>\n", argv[0]);
+		return 1;
+	}
+
+	fp = fopen(argv[1], "rb");
+	if (fp == NULL) {
+		printf("Failed opening %s\n", argv[1]);
+		return 1;
+	}
+
+	fseek(fp, 0, SEEK_END);
+	len = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+
+	data = malloc(len + 1);
+	assert(data != NULL);
+	assert(fread(data, 1, len, fp) == len);
+
+	fclose(fp);
+
+	if ((ret = run_test(data, len)) != 0)
+		return ret;
+
+	/* And again, with data inserted as the document is parsed */
+	inserting = true;
+	if ((ret = run_test(data, len)) != 0)
+		return ret;
+
+	free(data);
+
+	printf("PASS\n");
+
+	return 0;
+}
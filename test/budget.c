@@ -0,0 +1,254 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <hubbub/hubbub.h>
+
+#include <hubbub/dom.h>
+#include <hubbub/parser.h>
+
+#include "utils/utils.h"
+
+#include "testutils.h"
+
+/* Tokens the budget may be overspent by, as a token finishes a state */
+#define SLACK 2
+
+/* Tokens seen since the last call */
+static size_t seen;
+
+static void *myrealloc(void *ptr, size_t len, void *pw)
+{
+	UNUSED(pw);
+
+	return realloc(ptr, len);
+}
+
+static void put_string(text *t, const hubbub_string *s)
+{
+	put(t, (const char *) s->ptr, s->len);
+	put(t, "\n", 1);
+}
+
+static hubbub_error token_handler(const hubbub_token *token, void *pw)
+{
+	text *t = pw;
+	char type[16];
+	uint32_t i;
+
+	seen++;
+
+	sprintf(type, "%d\n", token->type);
+	put(t, type, strlen(type));
+
+	switch (token->type) {
+	case HUBBUB_TOKEN_DOCTYPE:
+		put_string(t, &token->data.doctype.name);
+		put_string(t, &token->data.doctype.public_id);
+		put_string(t, &token->data.doctype.system_id);
+		break;
+	case HUBBUB_TOKEN_START_TAG:
+	case HUBBUB_TOKEN_END_TAG:
+		put_string(t, &token->data.tag.name);
+		for (i = 0; i < token->data.tag.n_attributes; i++) {
+			put_string(t, &token->data.tag.attributes[i].name);
+			put_string(t, &token->data.tag.attributes[i].value);
+		}
+		break;
+	case HUBBUB_TOKEN_COMMENT:
+		put_string(t, &token->data.comment);
+		break;
+	case HUBBUB_TOKEN_CHARACTER:
+		put_string(t, &token->data.character);
+		break;
+	case HUBBUB_TOKEN_EOF:
+		break;
+	}
+
+	return HUBBUB_OK;
+}
+
+static hubbub_error enter(const hubbub_dom *dom, hubbub_dom_node node,
+		void *pw)
+{
+	hubbub_string s;
+
+	switch (hubbub_dom_type(dom, node)) {
+	case HUBBUB_DOM_NODE_ELEMENT:
+		s = hubbub_dom_atom_string(dom, hubbub_dom_name(dom, node));
+		put(pw, "<", 1);
+		put(pw, (const char *) s.ptr, s.len);
+		break;
+	case HUBBUB_DOM_NODE_TEXT:
+	case HUBBUB_DOM_NODE_COMMENT:
+		s = hubbub_dom_data(dom, node);
+		put(pw, "\"", 1);
+		put(pw, (const char *) s.ptr, s.len);
+		break;
+	default:
+		break;
+	}
+
+	return HUBBUB_OK;
+}
+
+static hubbub_error leave(const hubbub_dom *dom, hubbub_dom_node node,
+		void *pw)
+{
+	if (hubbub_dom_type(dom, node) == HUBBUB_DOM_NODE_ELEMENT)
+		put(pw, ">", 1);
+
+	return HUBBUB_OK;
+}
+
+/* Resume a paused parse until it is done, returning the number of pauses */
+static size_t resume(hubbub_parser *parser, hubbub_error error,
+		size_t tokens)
+{
+	hubbub_parser_optparams params;
+	size_t pauses = 0;
+
+	while (error == HUBBUB_PAUSED) {
+		/* No call does much more than its budget */
+		assert(tokens == 0 || seen <= tokens + SLACK);
+		seen = 0;
+		pauses++;
+
+		params.pause_parse = false;
+		error = hubbub_parser_setopt(parser, HUBBUB_PARSER_PAUSE,
+				&params);
+	}
+
+	assert(error == HUBBUB_OK);
+	assert(tokens == 0 || seen <= tokens + SLACK);
+	seen = 0;
+
+	return pauses;
+}
+
+/* Parse a document, within a budget for each call, and serialise it */
+static size_t parse(const uint8_t *data, size_t len, bool buffer,
+		size_t tokens, size_t bytes, bool tree, text *t)
+{
+	hubbub_parser_optparams params;
+	hubbub_parser *parser;
+	hubbub_dom *dom = NULL;
+	size_t pauses;
+
+	memset(t, 0, sizeof *t);
+	seen = 0;
+
+	assert(hubbub_parser_create("UTF-8", false, myrealloc, NULL,
+			&parser) == HUBBUB_OK);
+
+	if (tree) {
+		assert(hubbub_dom_create(myrealloc, NULL, &dom) == HUBBUB_OK);
+		assert(hubbub_dom_attach(dom, parser) == HUBBUB_OK);
+	} else {
+		params.token_handler.handler = token_handler;
+		params.token_handler.pw = t;
+		assert(hubbub_parser_setopt(parser,
+				HUBBUB_PARSER_TOKEN_HANDLER,
+				&params) == HUBBUB_OK);
+	}
+
+	params.budget.tokens = tokens;
+	params.budget.bytes = bytes;
+	assert(hubbub_parser_setopt(parser, HUBBUB_PARSER_BUDGET,
+			&params) == HUBBUB_OK);
+
+	if (buffer) {
+		pauses = resume(parser, hubbub_parser_parse_buffer(parser,
+				data, len), tree ? 0 : tokens);
+	} else {
+		pauses = resume(parser, hubbub_parser_parse_chunk(parser,
+				data, len), tree ? 0 : tokens);
+		pauses += resume(parser, hubbub_parser_completed(parser),
+				tree ? 0 : tokens);
+	}
+
+	hubbub_parser_destroy(parser);
+
+	if (tree) {
+		assert(hubbub_dom_walk(dom, HUBBUB_DOM_ROOT, enter, leave,
+				t) == HUBBUB_OK);
+		assert(hubbub_dom_destroy(dom) == HUBBUB_OK);
+	}
+
+	return pauses;
+}
+
+static int run_test(const uint8_t *data, size_t len, bool buffer, bool tree)
+{
+	const size_t budgets[][2] = { { 1, 0 }, { 7, 0 }, { 0, 1 },
+			{ 0, 100 }, { 5, 50 } };
+	text plain, budgeted;
+	size_t i, pauses;
+
+	assert(parse(data, len, buffer, 0, 0, tree, &plain) == 0);
+
+	for (i = 0; i < N_ELEMENTS(budgets); i++) {
+		pauses = parse(data, len, buffer, budgets[i][0],
+				budgets[i][1], tree, &budgeted);
+
+		/* Parsing was paused, but the result is unchanged */
+		assert(len < 1024 || pauses > 0);
+		assert(budgeted.len == plain.len);
+		assert(memcmp(budgeted.data, plain.data, plain.len) == 0);
+
+		free(budgeted.data);
+	}
+
+	printf("%s, %s: %" PRIuPTR " bytes\n", tree ? "Tree" : "Tokens",
+			buffer ? "buffer" : "chunk", (uintptr_t) plain.len);
+
+	free(plain.data);
+
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	FILE *fp;
+	uint8_t *data;
+	size_t len;
+	int ret;
+
+	if (argc != 2) {
+		printf("Usage: %s <filename>\n", argv[0]);
+		return 1;
+	}
+
+	fp = fopen(argv[1], "rb");
+	if (fp == NULL) {
+		printf("Failed opening %s\n", argv[1]);
+		return 1;
+	}
+
+	fseek(fp, 0, SEEK_END);
+	len = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+
+	data = malloc(len + 1);
+	assert(data != NULL);
+	assert(fread(data, 1, len, fp) == len);
+
+	fclose(fp);
+
+	if ((ret = run_test(data, len, false, false)) != 0)
+		return ret;
+	if ((ret = run_test(data, len, true, false)) != 0)
+		return ret;
+	if ((ret = run_test(data, len, false, true)) != 0)
+		return ret;
+	if ((ret = run_test(data, len, true, true)) != 0)
+		return ret;
+
+	free(data);
+
+	printf("PASS\n");
+
+	return 0;
+}
+
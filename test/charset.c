@@ -0,0 +1,186 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include <hubbub/hubbub.h>
+
+#include <hubbub/dom.h>
+#include <hubbub/parser.h>
+
+#include "utils/utils.h"
+
+#include "testutils.h"
+
+typedef struct testcase {
+	const char *title;	/* Title, ahead of the meta element */
+	const char *charset;	/* Charset given by the meta element */
+	const char *body;	/* Body, after it */
+	const char *switched;	/* Charset switched to in place, or NULL if
+				 * the client must start again */
+} testcase;
+
+static const testcase cases[] = {
+	{ "ascii", "windows-1252", "<p>plain</p>", "Windows-1252" },
+	/* The meta charset is fixed up, as ever */
+	{ "ascii", "iso-8859-1", "<p>plain</p>", "Windows-1252" },
+	/* The rest is read as UTF-8, once the switch is made */
+	{ "ascii", "utf-8", "<p>\xe2\x82\xac \xc3\xa9</p>", "UTF-8" },
+	/* The title, detected as Windows-1252, may not read the same in
+	 * the new charset */
+	{ "caf\xc3\xa9", "utf-8", "<p>plain</p>", NULL },
+	/* Nor may anything, in a charset which is not like ASCII */
+	{ "ascii", "shift_jis", "<p>plain</p>", NULL },
+};
+
+static void *myrealloc(void *ptr, size_t len, void *pw)
+{
+	UNUSED(pw);
+
+	return realloc(ptr, len);
+}
+
+static hubbub_error enter(const hubbub_dom *dom, hubbub_dom_node node,
+		void *pw)
+{
+	hubbub_string s;
+
+	switch (hubbub_dom_type(dom, node)) {
+	case HUBBUB_DOM_NODE_ELEMENT:
+		s = hubbub_dom_atom_string(dom, hubbub_dom_name(dom, node));
+		put(pw, "<", 1);
+		put(pw, (const char *) s.ptr, s.len);
+		break;
+	case HUBBUB_DOM_NODE_TEXT:
+	case HUBBUB_DOM_NODE_COMMENT:
+		s = hubbub_dom_data(dom, node);
+		put(pw, "\"", 1);
+		put(pw, (const char *) s.ptr, s.len);
+		break;
+	default:
+		break;
+	}
+
+	return HUBBUB_OK;
+}
+
+static hubbub_error leave(const hubbub_dom *dom, hubbub_dom_node node,
+		void *pw)
+{
+	if (hubbub_dom_type(dom, node) == HUBBUB_DOM_NODE_ELEMENT)
+		put(pw, ">", 1);
+
+	return HUBBUB_OK;
+}
+
+/* Parse a document, the head and the rest in chunks of up to chunk bytes,
+ * and serialise it */
+static const char *parse(const char *enc, const text *doc, size_t head,
+		size_t chunk, hubbub_charset_source *source, text *t)
+{
+	hubbub_parser *parser;
+	hubbub_dom *dom;
+	const char *charset;
+	size_t pos, end, n;
+
+	assert(hubbub_parser_create(enc, false, myrealloc, NULL,
+			&parser) == HUBBUB_OK);
+	assert(hubbub_dom_create(myrealloc, NULL, &dom) == HUBBUB_OK);
+	assert(hubbub_dom_attach(dom, parser) == HUBBUB_OK);
+
+	for (pos = 0; pos < doc->len; pos += n) {
+		end = pos < head ? head : doc->len;
+		n = end - pos < chunk ? end - pos : chunk;
+
+		assert(hubbub_parser_parse_chunk(parser,
+				(const uint8_t *) doc->data + pos, n) ==
+				HUBBUB_OK);
+	}
+	assert(hubbub_parser_completed(parser) == HUBBUB_OK);
+
+	charset = hubbub_parser_read_charset(parser, source);
+
+	assert(hubbub_dom_walk(dom, HUBBUB_DOM_ROOT, enter, leave, t) ==
+			HUBBUB_OK);
+
+	hubbub_parser_destroy(parser);
+	assert(hubbub_dom_destroy(dom) == HUBBUB_OK);
+
+	return charset;
+}
+
+static int run_test(const testcase *tc, size_t chunk)
+{
+	hubbub_charset_source source;
+	const char *charset;
+	text doc, detected, given;
+	size_t head, i;
+
+	memset(&doc, 0, sizeof doc);
+	memset(&detected, 0, sizeof detected);
+	memset(&given, 0, sizeof given);
+
+	/* The meta element comes too late for any prescan to find */
+	put(&doc, "<!DOCTYPE html><html><head><title>",
+			SLEN("<!DOCTYPE html><html><head><title>"));
+	put(&doc, tc->title, strlen(tc->title));
+	put(&doc, "</title><!-- ", SLEN("</title><!-- "));
+	for (i = 0; i < 1024; i++)
+		put(&doc, "x", 1);
+	put(&doc, " --><meta charset=\"", SLEN(" --><meta charset=\""));
+	put(&doc, tc->charset, strlen(tc->charset));
+	put(&doc, "\">", SLEN("\">"));
+	head = doc.len;
+	put(&doc, "</head><body>", SLEN("</head><body>"));
+	put(&doc, tc->body, strlen(tc->body));
+
+	charset = parse(NULL, &doc, head, chunk, &source, &detected);
+
+	if (tc->switched == NULL) {
+		/* The charset is left as detected, for the client to
+		 * change */
+		assert(charset != NULL);
+		assert(strcasecmp(charset, "Windows-1252") == 0);
+		assert(source == HUBBUB_CHARSET_TENTATIVE);
+	} else {
+		/* The charset is changed, and now certain */
+		assert(charset != NULL);
+		assert(strcasecmp(charset, tc->switched) == 0);
+		assert(source == HUBBUB_CHARSET_CONFIDENT);
+
+		/* And the tree is as if it had been given from the start */
+		parse(tc->switched, &doc, head, chunk, &source, &given);
+		assert(detected.len == given.len);
+		assert(memcmp(detected.data, given.data, given.len) == 0);
+	}
+
+	printf("%s, %s: %s\n", tc->title, tc->charset,
+			tc->switched != NULL ? "switched" : "left");
+
+	free(doc.data);
+	free(detected.data);
+	free(given.data);
+
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	size_t i;
+	int ret;
+
+	UNUSED(argc);
+	UNUSED(argv);
+
+	for (i = 0; i < N_ELEMENTS(cases); i++) {
+		if ((ret = run_test(&cases[i], 1)) != 0)
+			return ret;
+		if ((ret = run_test(&cases[i], (size_t) -1)) != 0)
+			return ret;
+	}
+
+	printf("PASS\n");
+
+	return 0;
+}
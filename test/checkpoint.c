@@ -0,0 +1,542 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <hubbub/hubbub.h>
+#include <hubbub/parser.h>
+#include <hubbub/tree.h>
+
+#include "utils/utils.h"
+
+#include "testutils.h"
+
+/* Number of checkpoints parsed from again, and edited after */
+#define N_RESUMES 8
+#define N_EDITS 4
+
+/* Text inserted by each edit */
+#define EDIT "<p>edit"
+
+typedef struct node {
+	char desc[32];		/* Description, for the log */
+	uint32_t refs;		/* References held */
+} node;
+
+typedef struct checkpoint {
+	hubbub_checkpoint *cp;	/* The checkpoint */
+	size_t offset;		/* Offset in the document */
+	size_t log;		/* Length of the log when it was taken */
+} checkpoint;
+
+/* Nodes are numbered from 1, and never reused, so references to those
+ * held by checkpoints can be told apart from those of later parses */
+static node *nodes;
+static uintptr_t n_nodes;
+static uintptr_t nodes_alloc;
+
+/* Log of the parse under way */
+static text *log_to;
+
+static void *myrealloc(void *ptr, size_t len, void *pw)
+{
+	UNUSED(pw);
+
+	return realloc(ptr, len);
+}
+
+/* Log an operation on nodes, by their descriptions */
+static void put_op(const char *op, void *a, void *b)
+{
+	put(log_to, op, strlen(op));
+	if (a != NULL) {
+		put(log_to, " ", 1);
+		put(log_to, nodes[(uintptr_t) a].desc,
+				strlen(nodes[(uintptr_t) a].desc));
+	}
+	if (b != NULL) {
+		put(log_to, " ", 1);
+		put(log_to, nodes[(uintptr_t) b].desc,
+				strlen(nodes[(uintptr_t) b].desc));
+	}
+	put(log_to, "\n", 1);
+}
+
+/* Make a node, described by its kind and data, or, if kind is NULL, by
+ * data alone */
+static void *new_node(const char *kind, const uint8_t *data, size_t len)
+{
+	node *n;
+
+	if (++n_nodes >= nodes_alloc) {
+		nodes_alloc = nodes_alloc == 0 ? 4096 : nodes_alloc * 2;
+		nodes = realloc(nodes, nodes_alloc * sizeof(node));
+		assert(nodes != NULL);
+	}
+
+	n = &nodes[n_nodes];
+	if (len > 16 && kind != NULL)
+		len = 16;
+	snprintf(n->desc, sizeof(n->desc), "%s%s%.*s",
+			kind != NULL ? kind : "", kind != NULL ? ":" : "",
+			(int) len, (const char *) data);
+	n->refs = 1;
+
+	put_op("create", (void *) n_nodes, NULL);
+
+	return (void *) n_nodes;
+}
+
+static hubbub_error create_comment(void *ctx, const hubbub_string *data,
+		void **result)
+{
+	UNUSED(ctx);
+
+	*result = new_node("#comment", data->ptr, data->len);
+
+	return HUBBUB_OK;
+}
+
+static hubbub_error create_doctype(void *ctx, const hubbub_doctype *doctype,
+		void **result)
+{
+	UNUSED(ctx);
+
+	*result = new_node("#doctype", doctype->name.ptr, doctype->name.len);
+
+	return HUBBUB_OK;
+}
+
+static hubbub_error create_element(void *ctx, const hubbub_tag *tag,
+		void **result)
+{
+	UNUSED(ctx);
+
+	*result = new_node("", tag->name.ptr, tag->name.len);
+
+	return HUBBUB_OK;
+}
+
+static hubbub_error create_text(void *ctx, const hubbub_string *data,
+		void **result)
+{
+	UNUSED(ctx);
+
+	*result = new_node("#text", data->ptr, data->len);
+
+	return HUBBUB_OK;
+}
+
+static hubbub_error ref_node(void *ctx, void *node)
+{
+	UNUSED(ctx);
+
+	nodes[(uintptr_t) node].refs++;
+
+	return HUBBUB_OK;
+}
+
+static hubbub_error unref_node(void *ctx, void *node)
+{
+	UNUSED(ctx);
+
+	assert(nodes[(uintptr_t) node].refs > 0);
+	nodes[(uintptr_t) node].refs--;
+
+	return HUBBUB_OK;
+}
+
+static hubbub_error append_child(void *ctx, void *parent, void *child,
+		void **result)
+{
+	put_op("append", parent, child);
+	*result = child;
+
+	return ref_node(ctx, child);
+}
+
+static hubbub_error insert_before(void *ctx, void *parent, void *child,
+		void *ref_child, void **result)
+{
+	UNUSED(ref_child);
+
+	put_op("insert", parent, child);
+	*result = child;
+
+	return ref_node(ctx, child);
+}
+
+static hubbub_error remove_child(void *ctx, void *parent, void *child,
+		void **result)
+{
+	put_op("remove", parent, child);
+	*result = child;
+
+	return ref_node(ctx, child);
+}
+
+static hubbub_error clone_node(void *ctx, void *node, bool deep,
+		void **result)
+{
+	char desc[sizeof(nodes[0].desc)];
+
+	UNUSED(ctx);
+
+	/* Making the clone may move the nodes */
+	memcpy(desc, nodes[(uintptr_t) node].desc, sizeof(desc));
+
+	put_op(deep ? "deep-clone" : "clone", node, NULL);
+	*result = new_node(NULL, (const uint8_t *) desc, strlen(desc));
+
+	return HUBBUB_OK;
+}
+
+static hubbub_error reparent_children(void *ctx, void *node,
+		void *new_parent)
+{
+	UNUSED(ctx);
+
+	put_op("reparent", node, new_parent);
+
+	return HUBBUB_OK;
+}
+
+/* The parent of every node is taken to be the document, which is held
+ * by every checkpoint, so the tree need not be brought back to the way it
+ * was at a checkpoint before parsing from it */
+static hubbub_error get_parent(void *ctx, void *node, bool element_only,
+		void **result)
+{
+	UNUSED(element_only);
+
+	put_op("parent", node, NULL);
+	*result = (void *) 1;
+
+	return ref_node(ctx, *result);
+}
+
+static hubbub_error has_children(void *ctx, void *node, bool *result)
+{
+	UNUSED(ctx);
+	UNUSED(node);
+
+	*result = false;
+
+	return HUBBUB_OK;
+}
+
+static hubbub_error form_associate(void *ctx, void *form, void *node)
+{
+	UNUSED(ctx);
+
+	put_op("form", form, node);
+
+	return HUBBUB_OK;
+}
+
+static hubbub_error add_attributes(void *ctx, void *node,
+		const hubbub_attribute *attributes, uint32_t n_attributes)
+{
+	UNUSED(ctx);
+	UNUSED(attributes);
+	UNUSED(n_attributes);
+
+	put_op("attributes", node, NULL);
+
+	return HUBBUB_OK;
+}
+
+static hubbub_error set_quirks_mode(void *ctx, hubbub_quirks_mode mode)
+{
+	UNUSED(ctx);
+	UNUSED(mode);
+
+	put_op("quirks", NULL, NULL);
+
+	return HUBBUB_OK;
+}
+
+static hubbub_error complete(void *ctx, void *node)
+{
+	UNUSED(ctx);
+
+	put_op("complete", node, NULL);
+
+	return HUBBUB_OK;
+}
+
+static hubbub_tree_handler tree_handler = {
+	create_comment,
+	create_doctype,
+	create_element,
+	create_text,
+	ref_node,
+	unref_node,
+	append_child,
+	insert_before,
+	remove_child,
+	clone_node,
+	reparent_children,
+	get_parent,
+	has_children,
+	form_associate,
+	add_attributes,
+	set_quirks_mode,
+	NULL,
+	complete,
+	complete,
+	NULL
+};
+
+static hubbub_parser *create_parser(void)
+{
+	hubbub_parser_optparams params;
+	hubbub_parser *parser;
+
+	assert(hubbub_parser_create("UTF-8", false, myrealloc, NULL,
+			&parser) == HUBBUB_OK);
+
+	params.tree_handler = &tree_handler;
+	assert(hubbub_parser_setopt(parser, HUBBUB_PARSER_TREE_HANDLER,
+			&params) == HUBBUB_OK);
+
+	/* Pause after every token, so checkpoints may be taken there */
+	params.budget.tokens = 1;
+	params.budget.bytes = 0;
+	assert(hubbub_parser_setopt(parser, HUBBUB_PARSER_BUDGET,
+			&params) == HUBBUB_OK);
+
+	return parser;
+}
+
+static void set_document(hubbub_parser *parser)
+{
+	hubbub_parser_optparams params;
+
+	/* The parser takes over the reference */
+	params.document_node = new_node("#document", (const uint8_t *) "", 0);
+	assert(hubbub_parser_setopt(parser, HUBBUB_PARSER_DOCUMENT_NODE,
+			&params) == HUBBUB_OK);
+}
+
+static hubbub_error resume(hubbub_parser *parser)
+{
+	hubbub_parser_optparams params;
+
+	params.pause_parse = false;
+	return hubbub_parser_setopt(parser, HUBBUB_PARSER_PAUSE, &params);
+}
+
+/* Parse a document, taking a checkpoint wherever one may be taken */
+static size_t parse(hubbub_parser *parser, const uint8_t *data, size_t len,
+		checkpoint **cps, text *log)
+{
+	size_t n_cps = 0, alloc = 0;
+	hubbub_checkpoint *cp;
+	hubbub_error error;
+
+	log_to = log;
+
+	set_document(parser);
+
+	for (error = hubbub_parser_parse_buffer(parser, data, len);
+			error == HUBBUB_PAUSED; error = resume(parser)) {
+		if (hubbub_parser_checkpoint(parser, &cp) != HUBBUB_OK)
+			continue;
+
+		if (n_cps == alloc) {
+			alloc = alloc == 0 ? 256 : alloc * 2;
+			*cps = realloc(*cps, alloc * sizeof(checkpoint));
+			assert(*cps != NULL);
+		}
+
+		(*cps)[n_cps].cp = cp;
+		(*cps)[n_cps].offset = hubbub_checkpoint_offset(cp);
+		(*cps)[n_cps].log = log->len;
+		n_cps++;
+	}
+
+	assert(error == HUBBUB_OK);
+
+	return n_cps;
+}
+
+/* Parsing from a checkpoint carries on just as the parse it was taken of */
+static void run_resume(hubbub_parser *parser, const uint8_t *data,
+		size_t len, const checkpoint *cp, const text *expected)
+{
+	hubbub_error error;
+	text log;
+
+	memset(&log, 0, sizeof log);
+	log_to = &log;
+
+	for (error = hubbub_parser_parse_from(parser, cp->cp, data, len);
+			error == HUBBUB_PAUSED; error = resume(parser))
+		;
+
+	assert(error == HUBBUB_OK);
+	assert(log.len == expected->len - cp->log);
+	assert(memcmp(log.data, expected->data + cp->log, log.len) == 0);
+
+	free(log.data);
+}
+
+/* After an edit, parsing from the checkpoint before it converges with the
+ * old parse, and the old tree operations from there on are the new ones */
+static void run_edit(hubbub_parser *parser, const uint8_t *data, size_t len,
+		const checkpoint *cps, size_t n_cps, size_t at,
+		const text *expected)
+{
+	const size_t delta = SLEN(EDIT);
+	const size_t edit_end = cps[at].offset + delta;
+	size_t edited_len = len + delta;
+	uint8_t *edited = malloc(edited_len);
+	hubbub_checkpoint *cp;
+	hubbub_error error;
+	text log, whole;
+	size_t old = at, tail;
+	bool converged = false;
+
+	assert(edited != NULL);
+	memcpy(edited, data, cps[at].offset);
+	memcpy(edited + cps[at].offset, EDIT, delta);
+	memcpy(edited + edit_end, data + cps[at].offset, len - cps[at].offset);
+
+	/* The whole of the edited document, from scratch */
+	memset(&whole, 0, sizeof whole);
+	log_to = &whole;
+	assert(hubbub_parser_reset(parser, "UTF-8") == HUBBUB_OK);
+	set_document(parser);
+	for (error = hubbub_parser_parse_buffer(parser, edited, edited_len);
+			error == HUBBUB_PAUSED; error = resume(parser))
+		;
+	assert(error == HUBBUB_OK);
+
+	memset(&log, 0, sizeof log);
+	log_to = &log;
+
+	for (error = hubbub_parser_parse_from(parser, cps[at].cp, edited,
+			edited_len); error == HUBBUB_PAUSED;
+			error = resume(parser)) {
+		size_t offset;
+
+		if (hubbub_parser_checkpoint(parser, &cp) != HUBBUB_OK)
+			continue;
+
+		offset = hubbub_checkpoint_offset(cp);
+		while (old < n_cps && cps[old].offset + delta < offset)
+			old++;
+
+		converged = offset >= edit_end && old < n_cps &&
+				cps[old].offset + delta == offset &&
+				hubbub_checkpoint_converged(cp, cps[old].cp);
+
+		hubbub_parser_checkpoint_destroy(parser, cp);
+
+		if (converged)
+			break;
+	}
+
+	/* What comes after the edit is all of the old parse's */
+	assert(converged || error == HUBBUB_OK);
+	if (converged == false)
+		old = n_cps;
+
+	tail = old < n_cps ? expected->len - cps[old].log : 0;
+
+	/* The old parse, up to the checkpoint, then the new, up to the point
+	 * of convergence, then the old, make up the whole */
+	assert(whole.len == cps[at].log + log.len + tail);
+	assert(memcmp(whole.data, expected->data, cps[at].log) == 0);
+	assert(memcmp(whole.data + cps[at].log, log.data, log.len) == 0);
+	assert(tail == 0 || memcmp(whole.data + cps[at].log + log.len,
+			expected->data + cps[old].log, tail) == 0);
+
+	free(log.data);
+	free(whole.data);
+	free(edited);
+}
+
+static int run_test(const uint8_t *data, size_t len)
+{
+	hubbub_parser *parser, *other;
+	checkpoint *cps = NULL;
+	size_t i, n_cps;
+	text log;
+
+	memset(&log, 0, sizeof log);
+
+	parser = create_parser();
+	other = create_parser();
+
+	n_cps = parse(parser, data, len, &cps, &log);
+
+	/* Parse from checkpoints all through the document, on a parser of
+	 * their own */
+	for (i = 0; i < N_RESUMES && i < n_cps; i++)
+		run_resume(other, data, len, &cps[i * n_cps / N_RESUMES], &log);
+
+	for (i = 0; i < N_EDITS && i < n_cps; i++) {
+		run_edit(other, data, len, cps, n_cps, i * n_cps / N_EDITS,
+				&log);
+	}
+
+	for (i = 0; i < n_cps; i++)
+		hubbub_parser_checkpoint_destroy(parser, cps[i].cp);
+
+	hubbub_parser_destroy(other);
+	hubbub_parser_destroy(parser);
+
+	/* Whatever the checkpoints held has been let go of */
+	for (i = 1; i <= n_nodes; i++)
+		assert(nodes[i].refs == 0);
+
+	printf("%" PRIuPTR " bytes, %" PRIuPTR " checkpoints\n",
+			(uintptr_t) len, (uintptr_t) n_cps);
+
+	free(cps);
+	free(log.data);
+
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	FILE *fp;
+	uint8_t *data;
+	size_t len;
+	int ret;
+
+	if (argc != 2) {
+		printf("Usage: %s <filename>\n", argv[0]);
+		return 1;
+	}
+
+	fp = fopen(argv[1], "rb");
+	if (fp == NULL) {
+		printf("Failed opening %s\n", argv[1]);
+		return 1;
+	}
+
+	fseek(fp, 0, SEEK_END);
+	len = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+
+	data = malloc(len + 1);
+	assert(data != NULL);
+	assert(fread(data, 1, len, fp) == len);
+
+	fclose(fp);
+
+	ret = run_test(data, len);
+
+	free(nodes);
+	free(data);
+
+	if (ret == 0)
+		printf("PASS\n");
+
+	return ret;
+}
+
@@ -0,0 +1,289 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <hubbub/hubbub.h>
+
+#include <hubbub/parser.h>
+
+#include "utils/utils.h"
+
+#include "testutils.h"
+
+typedef struct recorder {
+	text log;		/* Tokens, serialised */
+	size_t tokens;		/* Number of tokens seen */
+} recorder;
+
+/* Maximum size of token data, or 0 for none */
+static size_t token_limit;
+
+static void *myrealloc(void *ptr, size_t len, void *pw)
+{
+	UNUSED(pw);
+
+	return realloc(ptr, len);
+}
+
+static void put_number(recorder *r, uint64_t n)
+{
+	char buf[32];
+
+	put(&r->log, buf, sprintf(buf, "%" PRIu64 "\n", n));
+}
+
+static void put_data(recorder *r, const uint8_t *ptr, size_t len)
+{
+	put_number(r, len);
+	put(&r->log, (const char *) ptr, len);
+	put(&r->log, "\n", 1);
+}
+
+static void put_location(recorder *r, const hubbub_location *location)
+{
+	put_number(r, location->start);
+	put_number(r, location->end);
+	put_number(r, location->line);
+	put_number(r, location->col);
+}
+
+static hubbub_error token_handler(const hubbub_token *token, void *pw)
+{
+	const hubbub_doctype *doctype = &token->data.doctype;
+	const hubbub_tag *tag = &token->data.tag;
+	recorder *r = pw;
+	unsigned int flags = 0;
+	uint32_t i;
+
+	r->tokens++;
+
+	if (token->incomplete)
+		flags |= HUBBUB_COMPACT_INCOMPLETE;
+
+	switch (token->type) {
+	case HUBBUB_TOKEN_DOCTYPE:
+		if (doctype->force_quirks)
+			flags |= HUBBUB_COMPACT_FORCE_QUIRKS;
+		if (doctype->public_missing)
+			flags |= HUBBUB_COMPACT_PUBLIC_MISSING;
+		if (doctype->system_missing)
+			flags |= HUBBUB_COMPACT_SYSTEM_MISSING;
+		put_number(r, token->type);
+		put_number(r, flags);
+		put_data(r, doctype->name.ptr, doctype->name.len);
+		if (doctype->public_missing == false)
+			put_data(r, doctype->public_id.ptr,
+					doctype->public_id.len);
+		if (doctype->system_missing == false)
+			put_data(r, doctype->system_id.ptr,
+					doctype->system_id.len);
+		break;
+	case HUBBUB_TOKEN_START_TAG:
+	case HUBBUB_TOKEN_END_TAG:
+		if (tag->self_closing)
+			flags |= HUBBUB_COMPACT_SELF_CLOSING;
+		put_number(r, token->type);
+		put_number(r, flags);
+		put_number(r, tag->ns);
+		put_number(r, tag->atom);
+		put_data(r, tag->name.ptr, tag->name.len);
+		put_number(r, tag->n_attributes);
+		for (i = 0; i < tag->n_attributes; i++) {
+			put_number(r, tag->attributes[i].ns);
+			put_number(r, tag->attributes[i].atom);
+			put_data(r, tag->attributes[i].name.ptr,
+					tag->attributes[i].name.len);
+			put_data(r, tag->attributes[i].value.ptr,
+					tag->attributes[i].value.len);
+		}
+		break;
+	case HUBBUB_TOKEN_COMMENT:
+		put_number(r, token->type);
+		put_number(r, flags);
+		put_data(r, token->data.comment.ptr, token->data.comment.len);
+		break;
+	case HUBBUB_TOKEN_CHARACTER:
+		if (token->whitespace)
+			flags |= HUBBUB_COMPACT_WHITESPACE;
+		put_number(r, token->type);
+		put_number(r, flags);
+		put_data(r, token->data.character.ptr,
+				token->data.character.len);
+		break;
+	case HUBBUB_TOKEN_EOF:
+		put_number(r, token->type);
+		put_number(r, flags);
+		break;
+	}
+
+	put_location(r, &token->location);
+
+	return HUBBUB_OK;
+}
+
+static void put_span(recorder *r, const hubbub_compact_token *token,
+		const hubbub_span *span)
+{
+	put_data(r, token->base + span->off, span->len);
+}
+
+static hubbub_error compact_handler(const hubbub_compact_token *token,
+		void *pw)
+{
+	recorder *r = pw;
+	uint32_t i;
+
+	r->tokens++;
+
+	put_number(r, token->type);
+	put_number(r, token->flags);
+
+	switch (token->type) {
+	case HUBBUB_TOKEN_DOCTYPE:
+		put_span(r, token, &token->data);
+		if ((token->flags & HUBBUB_COMPACT_PUBLIC_MISSING) == 0)
+			put_span(r, token, &token->public_id);
+		if ((token->flags & HUBBUB_COMPACT_SYSTEM_MISSING) == 0)
+			put_span(r, token, &token->system_id);
+		break;
+	case HUBBUB_TOKEN_START_TAG:
+	case HUBBUB_TOKEN_END_TAG:
+		put_number(r, token->ns);
+		put_number(r, token->atom);
+		put_span(r, token, &token->data);
+		put_number(r, token->n_attributes);
+		for (i = 0; i < token->n_attributes; i++) {
+			put_number(r, token->attributes[i].ns);
+			put_number(r, token->attributes[i].atom);
+			put_span(r, token, &token->attributes[i].name);
+			put_span(r, token, &token->attributes[i].value);
+		}
+		break;
+	case HUBBUB_TOKEN_COMMENT:
+	case HUBBUB_TOKEN_CHARACTER:
+		put_span(r, token, &token->data);
+		break;
+	case HUBBUB_TOKEN_EOF:
+		assert(token->data.len == 0);
+		break;
+	}
+
+	assert(token->location != NULL);
+	put_location(r, token->location);
+
+	return HUBBUB_OK;
+}
+
+static void parse(const uint8_t *data, size_t len, size_t chunk,
+		bool compact, recorder *r)
+{
+	hubbub_parser *parser;
+	hubbub_parser_optparams params;
+	size_t pos, n;
+
+	assert(hubbub_parser_create("UTF-8", false, myrealloc, NULL,
+			&parser) == HUBBUB_OK);
+
+	if (compact) {
+		params.compact_token_handler.handler = compact_handler;
+		params.compact_token_handler.pw = r;
+		assert(hubbub_parser_setopt(parser,
+				HUBBUB_PARSER_COMPACT_TOKEN_HANDLER,
+				&params) == HUBBUB_OK);
+	} else {
+		params.token_handler.handler = token_handler;
+		params.token_handler.pw = r;
+		assert(hubbub_parser_setopt(parser,
+				HUBBUB_PARSER_TOKEN_HANDLER,
+				&params) == HUBBUB_OK);
+	}
+
+	params.track_position = true;
+	assert(hubbub_parser_setopt(parser, HUBBUB_PARSER_TRACK_POSITION,
+			&params) == HUBBUB_OK);
+
+	params.token_limit = token_limit;
+	assert(hubbub_parser_setopt(parser, HUBBUB_PARSER_TOKEN_LIMIT,
+			&params) == HUBBUB_OK);
+
+	for (pos = 0; pos < len; pos += n) {
+		n = len - pos < chunk ? len - pos : chunk;
+
+		assert(hubbub_parser_parse_chunk(parser, data + pos, n) ==
+				HUBBUB_OK);
+	}
+	assert(hubbub_parser_completed(parser) == HUBBUB_OK);
+
+	hubbub_parser_destroy(parser);
+}
+
+static int run_test(const uint8_t *data, size_t len, size_t chunk)
+{
+	recorder v1, v2;
+
+	memset(&v1, 0, sizeof v1);
+	memset(&v2, 0, sizeof v2);
+
+	parse(data, len, chunk, false, &v1);
+	parse(data, len, chunk, true, &v2);
+
+	/* The compact tokens are just the same tokens */
+	assert(v1.tokens > 0);
+	assert(v1.tokens == v2.tokens);
+	assert(v1.log.len == v2.log.len);
+	assert(v1.log.len == 0 ||
+			memcmp(v1.log.data, v2.log.data, v1.log.len) == 0);
+
+	free(v1.log.data);
+	free(v2.log.data);
+
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	FILE *fp;
+	uint8_t *data;
+	size_t len;
+	int ret;
+
+	if (argc != 2) {
+		printf("Usage: %s <filename>\n", argv[0]);
+		return 1;
+	}
+
+	fp = fopen(argv[1], "rb");
+	if (fp == NULL) {
+		printf("Failed opening %s\n", argv[1]);
+		return 1;
+	}
+
+	fseek(fp, 0, SEEK_END);
+	len = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+
+	data = malloc(len > 0 ? len : 1);
+	assert(data != NULL);
+	assert(fread(data, 1, len, fp) == len);
+
+	fclose(fp);
+
+#define DO_TEST(n) \
+	if ((ret = run_test(data, len, (n))) != 0) return ret
+	DO_TEST(1);
+	DO_TEST(7);
+	DO_TEST(4096);
+	DO_TEST(len > 0 ? len : 1);
+	/* And splitting long tokens */
+	token_limit = 5;
+	DO_TEST(1);
+	DO_TEST(4096);
+#undef DO_TEST
+
+	free(data);
+
+	printf("PASS\n");
+
+	return 0;
+}
@@ -0,0 +1,159 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <hubbub/hubbub.h>
+
+#include <hubbub/dom.h>
+#include <hubbub/parser.h>
+
+#include "utils/utils.h"
+
+#include "testutils.h"
+
+/* Levels of nesting in each document */
+#define LEVELS 2000
+
+static void *myrealloc(void *ptr, size_t len, void *pw)
+{
+	UNUSED(pw);
+
+	return realloc(ptr, len);
+}
+
+/* Generate a document of a prefix, LEVELS units, and a suffix */
+static char *generate(const char *prefix, const char *unit,
+		const char *suffix, size_t *len)
+{
+	size_t ulen = strlen(unit), i;
+	char *doc;
+
+	doc = malloc(strlen(prefix) + LEVELS * ulen + strlen(suffix) + 1);
+	assert(doc != NULL);
+
+	*len = sprintf(doc, "%s", prefix);
+	for (i = 0; i < LEVELS; i++) {
+		memcpy(doc + *len, unit, ulen);
+		*len += ulen;
+	}
+	*len += sprintf(doc + *len, "%s", suffix);
+
+	return doc;
+}
+
+/* Find the deepest element of a tree, and count its elements */
+static uint32_t depth(const hubbub_dom *dom, uint32_t *elements)
+{
+	hubbub_dom_node node, n;
+	uint32_t deepest = 0, d;
+
+	*elements = 0;
+
+	for (node = hubbub_dom_next(dom, HUBBUB_DOM_ROOT, HUBBUB_DOM_ROOT);
+			node != HUBBUB_DOM_NONE;
+			node = hubbub_dom_next(dom, node, HUBBUB_DOM_ROOT)) {
+		if (hubbub_dom_type(dom, node) != HUBBUB_DOM_NODE_ELEMENT)
+			continue;
+
+		(*elements)++;
+
+		d = 0;
+		for (n = node; n != HUBBUB_DOM_ROOT;
+				n = hubbub_dom_parent(dom, n))
+			d++;
+
+		if (deepest < d)
+			deepest = d;
+	}
+
+	return deepest;
+}
+
+static int run_test(const char *prefix, const char *unit,
+		const char *suffix, uint32_t per_unit, uint32_t max_depth,
+		size_t chunk)
+{
+	hubbub_parser_optparams params;
+	hubbub_parser *parser;
+	hubbub_dom *dom;
+	uint32_t deepest, elements;
+	size_t len, pos, n;
+	char *doc;
+
+	doc = generate(prefix, unit, suffix, &len);
+
+	assert(hubbub_parser_create("UTF-8", false, myrealloc, NULL,
+			&parser) == HUBBUB_OK);
+
+	params.max_depth = max_depth;
+	assert(hubbub_parser_setopt(parser, HUBBUB_PARSER_MAX_DEPTH,
+			&params) == HUBBUB_OK);
+
+	assert(hubbub_dom_create(myrealloc, NULL, &dom) == HUBBUB_OK);
+	assert(hubbub_dom_attach(dom, parser) == HUBBUB_OK);
+
+	for (pos = 0; pos < len; pos += n) {
+		n = len - pos < chunk ? len - pos : chunk;
+
+		assert(hubbub_parser_parse_chunk(parser,
+				(const uint8_t *) doc + pos, n) == HUBBUB_OK);
+	}
+	assert(hubbub_parser_completed(parser) == HUBBUB_OK);
+
+	deepest = depth(dom, &elements);
+
+	printf("max depth %u, chunks of %" PRIuPTR ": depth %u, "
+			"%u elements\n", max_depth, (uintptr_t) chunk,
+			deepest, elements);
+
+	/* Nothing is lost, only placed beside the deepest */
+	assert(elements >= LEVELS * per_unit);
+	if (max_depth == 0)
+		assert(deepest > LEVELS * per_unit);
+	else
+		assert(deepest <= max_depth);
+
+	hubbub_parser_destroy(parser);
+	hubbub_dom_destroy(dom);
+
+	free(doc);
+
+	return 0;
+}
+
+int main(void)
+{
+	hubbub_parser_optparams params;
+	hubbub_parser *parser;
+	int ret;
+
+	/* The html element must have room for the rest */
+	assert(hubbub_parser_create("UTF-8", false, myrealloc, NULL,
+			&parser) == HUBBUB_OK);
+	params.max_depth = 1;
+	assert(hubbub_parser_setopt(parser, HUBBUB_PARSER_MAX_DEPTH,
+			&params) == HUBBUB_BADPARM);
+	hubbub_parser_destroy(parser);
+
+#define DO_TEST(p, u, s, n, d, c) \
+	if ((ret = run_test((p), (u), (s), (n), (d), (c))) != 0) return ret
+	/* Nested blocks */
+	DO_TEST("", "<div>", "x", 1, 0, 4096);
+	DO_TEST("", "<div>", "x", 1, 64, 4096);
+	DO_TEST("", "<div>", "x", 1, 64, 1);
+	DO_TEST("", "<div>", "x", 1, 2, 4096);
+	/* Formatting elements, reconstructed for each piece of text */
+	DO_TEST("", "<b><i>x", "", 2, 32, 4096);
+	DO_TEST("", "<b><i>x", "", 2, 32, 1);
+	/* Foster parenting, out of tables nested in cells */
+	DO_TEST("", "<table><tr><td><span>", "", 5, 48, 4096);
+	DO_TEST("<table>", "x<b>", "", 1, 16, 4096);
+	/* Foreign content */
+	DO_TEST("<svg>", "<g>", "", 1, 100, 4096);
+#undef DO_TEST
+
+	printf("PASS\n");
+
+	return 0;
+}
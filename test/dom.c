@@ -0,0 +1,513 @@
+/*
+ * Tree construction tester, for the built-in tree.
+ */
+
+#define _GNU_SOURCE
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <hubbub/hubbub.h>
+#include <hubbub/dom.h>
+#include <hubbub/parser.h>
+
+#include "utils/utils.h"
+
+#include "testutils.h"
+
+typedef struct buf_t buf_t;
+
+struct buf_t {
+	char *buf;
+	size_t len;
+	size_t pos;
+};
+
+/* Parsers run side by side: one with the extended tree handler, one without */
+#define NUM_PARSERS 2
+
+typedef struct printer {
+	buf_t *buf;		/* Buffer to print into */
+	unsigned depth;		/* Depth of node being printed */
+	uint32_t n_nodes;	/* Number of nodes printed */
+} printer;
+
+
+#define NUM_NAMESPACES 7
+const char * const ns_names[NUM_NAMESPACES] =
+		{ NULL, NULL /*html*/, "math", "svg", "xlink", "xml", "xmlns" };
+
+
+static void *myrealloc(void *ptr, size_t len, void *pw)
+{
+	UNUSED(pw);
+
+	return realloc(ptr, len);
+}
+
+
+/*
+ * Create, initialise, and return, a parser instance building into a tree.
+ * If context is not NULL, the parser builds a fragment in that context.
+ */
+static hubbub_parser *setup_parser(hubbub_dom *dom, bool ext,
+		const char *context)
+{
+	hubbub_parser *parser;
+	hubbub_parser_optparams params;
+
+	assert(hubbub_parser_create("UTF-8", false, myrealloc, NULL, &parser) ==
+			HUBBUB_OK);
+
+	params.enable_scripting = true;
+	assert(hubbub_parser_setopt(parser, HUBBUB_PARSER_ENABLE_SCRIPTING,
+			&params) == HUBBUB_OK);
+
+	if (context != NULL) {
+		hubbub_string name;
+
+		name.ptr = (const uint8_t *) context;
+		name.len = strlen(context);
+
+		assert(hubbub_dom_attach_fragment(dom, parser, HUBBUB_NS_HTML,
+				&name, HUBBUB_DOM_ROOT) == HUBBUB_OK);
+	} else {
+		assert(hubbub_dom_attach(dom, parser) == HUBBUB_OK);
+	}
+
+	if (ext == false) {
+		params.tree_handler_ext = NULL;
+		assert(hubbub_parser_setopt(parser,
+				HUBBUB_PARSER_TREE_HANDLER_EXT,
+				&params) == HUBBUB_OK);
+	}
+
+	return parser;
+}
+
+
+
+/*** Buffer handling bits ***/
+static void buf_clear(buf_t *buf)
+{
+	if (!buf || !buf->buf) return;
+
+	buf->buf[0] = '\0';
+	buf->pos = 0;
+}
+
+static void buf_add(buf_t *buf, const char *str)
+{
+	size_t len = strlen(str) + 1;
+
+	if (buf->buf == NULL) {
+		buf->len = ((len + 1024) / 1024) * 1024;
+		buf->buf = calloc(1, buf->len);
+	}
+
+	while (buf->pos + len > buf->len) {
+		buf->len *= 2;
+		buf->buf = realloc(buf->buf, buf->len);
+	}
+
+	strcat(buf->buf, str);
+	buf->pos += len;
+}
+
+static void buf_add_string(buf_t *buf, const hubbub_string *str)
+{
+	char *s = strndup((const char *) str->ptr, str->len);
+
+	buf_add(buf, s);
+
+	free(s);
+}
+
+
+
+/*** Serialising bits ***/
+
+static const hubbub_dom *sort_dom;
+
+static int compare_attrs(const void *a, const void *b)
+{
+	hubbub_dom_attribute first, second;
+	hubbub_string fname, sname;
+	int cmp;
+
+	first = *(const hubbub_dom_attribute *) a;
+	second = *(const hubbub_dom_attribute *) b;
+
+	fname = hubbub_dom_atom_string(sort_dom, first.name);
+	sname = hubbub_dom_atom_string(sort_dom, second.name);
+
+	cmp = memcmp(fname.ptr, sname.ptr, min(fname.len, sname.len));
+	if (cmp == 0)
+		cmp = (int) fname.len - (int) sname.len;
+
+	return cmp;
+}
+
+static void indent(buf_t *buf, unsigned depth)
+{
+	unsigned int i;
+
+	buf_add(buf, "| ");
+
+	for (i = 0; i < depth; i++) {
+		buf_add(buf, "  ");
+	}
+}
+
+static void print_ns(buf_t *buf, hubbub_ns ns)
+{
+	assert(ns < NUM_NAMESPACES);
+
+	if (ns_names[ns] != NULL) {
+		buf_add(buf, ns_names[ns]);
+		buf_add(buf, " ");
+	}
+}
+
+static void print_element(buf_t *buf, const hubbub_dom *dom,
+		hubbub_dom_node node, unsigned depth)
+{
+	uint32_t n_attrs = hubbub_dom_attribute_count(dom, node);
+	hubbub_dom_attribute *attrs;
+	hubbub_string name;
+	uint32_t i;
+
+	name = hubbub_dom_atom_string(dom, hubbub_dom_name(dom, node));
+	assert(hubbub_dom_atom_find(dom, name.ptr, name.len) ==
+			hubbub_dom_name(dom, node));
+
+	buf_add(buf, "<");
+	print_ns(buf, hubbub_dom_ns(dom, node));
+	buf_add_string(buf, &name);
+	buf_add(buf, ">\n");
+
+	attrs = calloc(n_attrs + 1, sizeof *attrs);
+
+	for (i = 0; i < n_attrs; i++) {
+		hubbub_string value;
+
+		assert(hubbub_dom_attribute_get(dom, node, i, &attrs[i]) ==
+				HUBBUB_OK);
+		assert(hubbub_dom_attribute_find(dom, node, attrs[i].name,
+				&value));
+	}
+
+	assert(hubbub_dom_attribute_get(dom, node, n_attrs, &attrs[n_attrs]) ==
+			HUBBUB_BADPARM);
+
+	sort_dom = dom;
+	qsort(attrs, n_attrs, sizeof *attrs, compare_attrs);
+
+	for (i = 0; i < n_attrs; i++) {
+		name = hubbub_dom_atom_string(dom, attrs[i].name);
+
+		indent(buf, depth + 1);
+		print_ns(buf, attrs[i].ns);
+		buf_add_string(buf, &name);
+		buf_add(buf, "=");
+		buf_add(buf, "\"");
+		buf_add_string(buf, &attrs[i].value);
+		buf_add(buf, "\"\n");
+	}
+
+	free(attrs);
+}
+
+static void print_doctype(buf_t *buf, const hubbub_dom *dom,
+		hubbub_dom_node node)
+{
+	hubbub_doctype doctype;
+
+	assert(hubbub_dom_doctype(dom, node, &doctype) == HUBBUB_OK);
+
+	buf_add(buf, "<!DOCTYPE ");
+	buf_add_string(buf, &doctype.name);
+
+	if (!doctype.public_missing || !doctype.system_missing) {
+		if (!doctype.public_missing) {
+			buf_add(buf, " \"");
+			buf_add_string(buf, &doctype.public_id);
+			buf_add(buf, "\" ");
+		} else {
+			buf_add(buf, "\"\" ");
+		}
+
+		if (!doctype.system_missing) {
+			buf_add(buf, " \"");
+			buf_add_string(buf, &doctype.system_id);
+			buf_add(buf, "\"");
+		} else {
+			buf_add(buf, "\"\"");
+		}
+	}
+
+	buf_add(buf, ">\n");
+}
+
+static hubbub_error print_enter(const hubbub_dom *dom, hubbub_dom_node node,
+		void *pw)
+{
+	printer *p = pw;
+	hubbub_string data;
+
+	p->n_nodes++;
+
+	/* The document itself is not printed */
+	if (hubbub_dom_type(dom, node) == HUBBUB_DOM_NODE_DOCUMENT)
+		return HUBBUB_OK;
+
+	indent(p->buf, p->depth);
+
+	switch (hubbub_dom_type(dom, node)) {
+	case HUBBUB_DOM_NODE_DOCTYPE:
+		print_doctype(p->buf, dom, node);
+		break;
+	case HUBBUB_DOM_NODE_ELEMENT:
+		print_element(p->buf, dom, node, p->depth);
+		break;
+	case HUBBUB_DOM_NODE_TEXT:
+		data = hubbub_dom_data(dom, node);
+		buf_add(p->buf, "\"");
+		buf_add_string(p->buf, &data);
+		buf_add(p->buf, "\"\n");
+		break;
+	case HUBBUB_DOM_NODE_COMMENT:
+		data = hubbub_dom_data(dom, node);
+		buf_add(p->buf, "<!-- ");
+		buf_add_string(p->buf, &data);
+		buf_add(p->buf, " -->\n");
+		break;
+	default:
+		printf("Unexpected node type %d\n", hubbub_dom_type(dom, node));
+		assert(0);
+	}
+
+	p->depth++;
+
+	return HUBBUB_OK;
+}
+
+static hubbub_error print_leave(const hubbub_dom *dom, hubbub_dom_node node,
+		void *pw)
+{
+	printer *p = pw;
+
+	if (hubbub_dom_type(dom, node) != HUBBUB_DOM_NODE_DOCUMENT)
+		p->depth--;
+
+	return HUBBUB_OK;
+}
+
+static void dom_print(buf_t *buf, const hubbub_dom *dom)
+{
+	printer p = { buf, 0, 0 };
+	hubbub_dom_node node;
+	uint32_t n_nodes = 0;
+
+	buf_clear(buf);
+
+	assert(hubbub_dom_walk(dom, HUBBUB_DOM_ROOT, print_enter, print_leave,
+			&p) == HUBBUB_OK);
+
+	/* Stepping through the tree visits the same nodes */
+	for (node = HUBBUB_DOM_ROOT; node != HUBBUB_DOM_NONE;
+			node = hubbub_dom_next(dom, node, HUBBUB_DOM_ROOT))
+		n_nodes++;
+
+	assert(n_nodes == p.n_nodes);
+}
+
+
+
+/* States for reading in data from the tree construction file */
+enum reading_state {
+	ERASE_DATA,
+	EXPECT_DATA,
+	READING_DATA,
+	READING_ERRORS,
+	READING_CONTEXT,
+	READING_TREE
+};
+
+int main(int argc, char **argv)
+{
+	FILE *fp;
+	char line[2048];
+
+	bool reprocess = false;
+	bool passed = true;
+	bool have_tree = false;
+	bool fragment = false;
+	char context[64];
+	int i;
+
+	hubbub_dom *dom[NUM_PARSERS];
+	hubbub_parser *parser[NUM_PARSERS];
+	enum reading_state state = EXPECT_DATA;
+
+	buf_t data = { NULL, 0, 0 };
+	buf_t expected = { NULL, 0, 0 };
+	buf_t got = { NULL, 0, 0 };
+
+
+	if (argc != 2) {
+		printf("Usage: %s <filename>\n", argv[0]);
+		return 1;
+	}
+
+	fp = fopen(argv[1], "rb");
+	if (fp == NULL) {
+		printf("Failed opening %s\n", argv[1]);
+		return 1;
+	}
+
+	/* We rely on lines not being anywhere near 2048 characters... */
+	while (reprocess || (passed && fgets(line, sizeof line, fp) == line)) {
+		reprocess = false;
+
+		switch (state)
+		{
+		case ERASE_DATA:
+			buf_clear(&data);
+			buf_clear(&got);
+			buf_clear(&expected);
+
+			if (have_tree) {
+				for (i = 0; i < NUM_PARSERS; i++) {
+					hubbub_parser_destroy(parser[i]);
+					assert(hubbub_dom_destroy(dom[i]) ==
+							HUBBUB_OK);
+				}
+			}
+			have_tree = false;
+			fragment = false;
+
+			state = EXPECT_DATA;
+
+		case EXPECT_DATA:
+			if (strcmp(line, "#data\n") == 0) {
+				buf_add(&data, "");
+				state = READING_DATA;
+			}
+			break;
+
+		case READING_DATA:
+			if (strcmp(line, "#errors\n") == 0) {
+				/* Trim off the last newline */
+				size_t len = strlen(data.buf);
+
+				if (len > 0)
+					data.buf[len - 1] = '\0';
+
+				state = READING_ERRORS;
+			} else {
+				buf_add(&data, line);
+				printf(": %s", line);
+			}
+			break;
+
+		case READING_ERRORS:
+			if (strcmp(line, "#document-fragment\n") == 0)
+				state = READING_CONTEXT;
+
+			if (strcmp(line, "#document\n") == 0) {
+				for (i = 0; i < NUM_PARSERS; i++) {
+					hubbub_error err;
+
+					assert(hubbub_dom_create(myrealloc,
+							NULL, &dom[i]) ==
+							HUBBUB_OK);
+					parser[i] = setup_parser(dom[i],
+							i == 0, fragment ?
+							context : NULL);
+
+					err = hubbub_parser_parse_chunk(
+							parser[i],
+							(uint8_t *) data.buf,
+							strlen(data.buf));
+					assert(err == HUBBUB_OK);
+
+					assert(hubbub_parser_completed(
+							parser[i]) ==
+							HUBBUB_OK);
+				}
+				have_tree = true;
+				state = READING_TREE;
+			}
+			break;
+
+		case READING_CONTEXT:
+			assert(strlen(line) < sizeof context);
+			strcpy(context, line);
+			context[strcspn(context, "\n")] = '\0';
+			printf("# %s\n", context);
+
+			fragment = true;
+			state = READING_ERRORS;
+			break;
+
+		case READING_TREE:
+			if (strcmp(line, "#data\n") == 0) {
+				/* Trim off the last newline */
+				expected.buf[strlen(expected.buf) - 1] = '\0';
+
+				for (i = 0; passed && i < NUM_PARSERS; i++) {
+					dom_print(&got, dom[i]);
+
+					passed = !strcmp(got.buf, expected.buf);
+				}
+
+				if (!passed) {
+					printf("expected:\n");
+					printf("%s", expected.buf);
+					printf("got:\n");
+					printf("%s", got.buf);
+				}
+
+				state = ERASE_DATA;
+				reprocess = true;
+			} else {
+				buf_add(&expected, line);
+			}
+			break;
+		}
+	}
+
+	if (have_tree) {
+		for (i = 0; passed && i < NUM_PARSERS; i++) {
+			dom_print(&got, dom[i]);
+
+			passed = !strcmp(got.buf, expected.buf);
+		}
+
+		if (!passed) {
+			printf("expected:\n");
+			printf("%s", expected.buf);
+			printf("got:\n");
+			printf("%s", got.buf);
+		}
+
+		for (i = 0; i < NUM_PARSERS; i++) {
+			hubbub_parser_destroy(parser[i]);
+			assert(hubbub_dom_destroy(dom[i]) == HUBBUB_OK);
+		}
+	}
+
+	printf("%s\n", passed ? "PASS" : "FAIL");
+
+	fclose(fp);
+
+	free(data.buf);
+	free(got.buf);
+	free(expected.buf);
+
+	return 0;
+}
+
@@ -0,0 +1,207 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <hubbub/hubbub.h>
+
+#include <hubbub/dom.h>
+#include <hubbub/parser.h>
+
+#include "utils/utils.h"
+
+#include "testutils.h"
+
+/* Maximum depth of elements, for the purposes of this test */
+#define MAX_DEPTH 1024
+
+typedef struct recorder {
+	char *log;		/* Events, one per line */
+	size_t len;		/* Length of log */
+	size_t alloc;		/* Bytes allocated for log */
+
+	hubbub_string open[MAX_DEPTH];	/* Names of open elements */
+	char *names[MAX_DEPTH];		/* Storage for names */
+	uint32_t depth;		/* Number of open elements */
+
+	size_t text;		/* Bytes of text seen */
+} recorder;
+
+static void *myrealloc(void *ptr, size_t len, void *pw)
+{
+	UNUSED(pw);
+
+	return realloc(ptr, len);
+}
+
+static void record(recorder *r, const char *fmt, uint32_t depth,
+		const hubbub_string *name)
+{
+	char line[64];
+	int n = snprintf(line, sizeof line, fmt, depth, (int) name->len);
+
+	assert(n > 0);
+
+	while (r->len + n + name->len + 2 > r->alloc) {
+		r->alloc = r->alloc == 0 ? 4096 : r->alloc * 2;
+		r->log = realloc(r->log, r->alloc);
+		assert(r->log != NULL);
+	}
+
+	memcpy(r->log + r->len, line, n);
+	r->len += n;
+	memcpy(r->log + r->len, name->ptr, name->len);
+	r->len += name->len;
+	r->log[r->len++] = '\n';
+}
+
+static hubbub_error event_handler(const hubbub_event *event, void *pw)
+{
+	recorder *r = pw;
+	hubbub_string text;
+
+	switch (event->type) {
+	case HUBBUB_EVENT_OPEN:
+		/* Elements open just inside the last one open */
+		assert(event->depth == r->depth);
+		assert(r->depth < MAX_DEPTH);
+		assert(event->continued == false ||
+				event->n_attributes == 0);
+
+		r->names[r->depth] = realloc(r->names[r->depth],
+				event->name.len + 1);
+		memcpy(r->names[r->depth], event->name.ptr, event->name.len);
+		r->open[r->depth].ptr = (uint8_t *) r->names[r->depth];
+		r->open[r->depth].len = event->name.len;
+		r->depth++;
+
+		record(r, event->continued ? "+ %u %d " : "< %u %d ",
+				event->depth, &event->name);
+		break;
+	case HUBBUB_EVENT_CLOSE:
+		/* And close in the reverse order */
+		assert(r->depth > 0);
+		r->depth--;
+		assert(event->depth == r->depth);
+		assert(event->name.len == r->open[r->depth].len);
+		assert(memcmp(event->name.ptr, r->open[r->depth].ptr,
+				event->name.len) == 0);
+
+		record(r, "> %u %d ", event->depth, &event->name);
+		break;
+	case HUBBUB_EVENT_TEXT:
+		assert(event->depth == r->depth);
+
+		r->text += event->name.len;
+
+		text.ptr = (const uint8_t *) "";
+		text.len = 0;
+		record(r, "\" %u %d", event->depth, &text);
+		break;
+	}
+
+	return HUBBUB_OK;
+}
+
+static void parse(const char *filename, hubbub_parser *parser)
+{
+	uint8_t buf[4096];
+	FILE *fp;
+	size_t n;
+
+	fp = fopen(filename, "rb");
+	assert(fp != NULL);
+
+	while ((n = fread(buf, 1, sizeof buf, fp)) > 0) {
+		assert(hubbub_parser_parse_chunk(parser, buf, n) ==
+				HUBBUB_OK);
+	}
+
+	fclose(fp);
+
+	assert(hubbub_parser_completed(parser) == HUBBUB_OK);
+}
+
+static size_t dom_text(const hubbub_dom *dom)
+{
+	hubbub_dom_node node;
+	size_t len = 0;
+
+	for (node = HUBBUB_DOM_ROOT; node != HUBBUB_DOM_NONE;
+			node = hubbub_dom_next(dom, node, HUBBUB_DOM_ROOT)) {
+		if (hubbub_dom_type(dom, node) == HUBBUB_DOM_NODE_TEXT)
+			len += hubbub_dom_data(dom, node).len;
+	}
+
+	return len;
+}
+
+int main(int argc, char **argv)
+{
+	hubbub_parser *parser;
+	hubbub_parser_optparams params;
+	hubbub_dom *dom;
+	recorder only, with_tree;
+	uint32_t i;
+
+	if (argc != 2) {
+		printf("Usage: %s <filename>\n", argv[0]);
+		return 1;
+	}
+
+	memset(&only, 0, sizeof only);
+	memset(&with_tree, 0, sizeof with_tree);
+
+	/* Events alone, with no tree */
+	assert(hubbub_parser_create("UTF-8", false, myrealloc, NULL,
+			&parser) == HUBBUB_OK);
+
+	params.event_handler.handler = event_handler;
+	params.event_handler.pw = &only;
+	assert(hubbub_parser_setopt(parser, HUBBUB_PARSER_EVENT_HANDLER,
+			&params) == HUBBUB_OK);
+
+	parse(argv[1], parser);
+
+	hubbub_parser_destroy(parser);
+
+	/* Events, while building a tree */
+	assert(hubbub_parser_create("UTF-8", false, myrealloc, NULL,
+			&parser) == HUBBUB_OK);
+	assert(hubbub_dom_create(myrealloc, NULL, &dom) == HUBBUB_OK);
+	assert(hubbub_dom_attach(dom, parser) == HUBBUB_OK);
+
+	params.event_handler.handler = event_handler;
+	params.event_handler.pw = &with_tree;
+	assert(hubbub_parser_setopt(parser, HUBBUB_PARSER_EVENT_HANDLER,
+			&params) == HUBBUB_OK);
+
+	parse(argv[1], parser);
+
+	hubbub_parser_destroy(parser);
+
+	/* Everything was closed by the end */
+	assert(only.depth == 0);
+	assert(with_tree.depth == 0);
+
+	/* The structure is the same, tree or no tree */
+	assert(only.len == with_tree.len);
+	assert(memcmp(only.log, with_tree.log, only.len) == 0);
+
+	/* And all the text got into the tree */
+	assert(with_tree.text == dom_text(dom));
+
+	assert(hubbub_dom_destroy(dom) == HUBBUB_OK);
+
+	for (i = 0; i < MAX_DEPTH; i++) {
+		free(only.names[i]);
+		free(with_tree.names[i]);
+	}
+	free(only.log);
+	free(with_tree.log);
+
+	printf("PASS\n");
+
+	return 0;
+}
+
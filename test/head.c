@@ -0,0 +1,203 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <hubbub/hubbub.h>
+
+#include <hubbub/dom.h>
+#include <hubbub/parser.h>
+
+#include "utils/utils.h"
+
+#include "testutils.h"
+
+static void *myrealloc(void *ptr, size_t len, void *pw)
+{
+	UNUSED(pw);
+
+	return realloc(ptr, len);
+}
+
+static hubbub_error enter(const hubbub_dom *dom, hubbub_dom_node node,
+		void *pw)
+{
+	hubbub_string s;
+
+	switch (hubbub_dom_type(dom, node)) {
+	case HUBBUB_DOM_NODE_ELEMENT:
+		s = hubbub_dom_atom_string(dom, hubbub_dom_name(dom, node));
+		put(pw, "<", 1);
+		put(pw, (const char *) s.ptr, s.len);
+		break;
+	case HUBBUB_DOM_NODE_TEXT:
+	case HUBBUB_DOM_NODE_COMMENT:
+		s = hubbub_dom_data(dom, node);
+		put(pw, "\"", 1);
+		put(pw, (const char *) s.ptr, s.len);
+		break;
+	default:
+		break;
+	}
+
+	return HUBBUB_OK;
+}
+
+static hubbub_error leave(const hubbub_dom *dom, hubbub_dom_node node,
+		void *pw)
+{
+	if (hubbub_dom_type(dom, node) == HUBBUB_DOM_NODE_ELEMENT)
+		put(pw, ">", 1);
+
+	return HUBBUB_OK;
+}
+
+/* Find the child element of a node with the given name */
+static hubbub_dom_node child(const hubbub_dom *dom, hubbub_dom_node node,
+		const char *name)
+{
+	hubbub_dom_atom atom;
+	hubbub_dom_node c;
+
+	atom = hubbub_dom_atom_find(dom, (const uint8_t *) name,
+			strlen(name));
+	if (atom == HUBBUB_DOM_NONE || node == HUBBUB_DOM_NONE)
+		return HUBBUB_DOM_NONE;
+
+	for (c = hubbub_dom_first_child(dom, node); c != HUBBUB_DOM_NONE;
+			c = hubbub_dom_next_sibling(dom, c)) {
+		if (hubbub_dom_type(dom, c) == HUBBUB_DOM_NODE_ELEMENT &&
+				hubbub_dom_name(dom, c) == atom)
+			return c;
+	}
+
+	return HUBBUB_DOM_NONE;
+}
+
+/* Serialise the head of a document */
+static void serialise_head(const hubbub_dom *dom, text *t)
+{
+	hubbub_dom_node head;
+
+	head = child(dom, child(dom, HUBBUB_DOM_ROOT, "html"), "head");
+	if (head != HUBBUB_DOM_NONE) {
+		assert(hubbub_dom_walk(dom, head, enter, leave, t) ==
+				HUBBUB_OK);
+	}
+}
+
+static int run_test(const uint8_t *data, size_t len, size_t chunk)
+{
+	hubbub_parser *parser;
+	hubbub_parser_optparams params;
+	hubbub_dom *full, *head;
+	hubbub_dom_node body;
+	hubbub_error error = HUBBUB_OK;
+	text a, b;
+	size_t pos;
+
+	memset(&a, 0, sizeof a);
+	memset(&b, 0, sizeof b);
+
+	/* The whole document */
+	assert(hubbub_parser_create("UTF-8", false, myrealloc, NULL,
+			&parser) == HUBBUB_OK);
+	assert(hubbub_dom_create(myrealloc, NULL, &full) == HUBBUB_OK);
+	assert(hubbub_dom_attach(full, parser) == HUBBUB_OK);
+
+	assert(hubbub_parser_parse_chunk(parser, data, len) == HUBBUB_OK);
+	assert(hubbub_parser_completed(parser) == HUBBUB_OK);
+
+	hubbub_parser_destroy(parser);
+
+	/* Just the head, stopping as soon as the body is reached */
+	assert(hubbub_parser_create("UTF-8", false, myrealloc, NULL,
+			&parser) == HUBBUB_OK);
+	assert(hubbub_dom_create(myrealloc, NULL, &head) == HUBBUB_OK);
+	assert(hubbub_dom_attach(head, parser) == HUBBUB_OK);
+
+	params.head_only = true;
+	assert(hubbub_parser_setopt(parser, HUBBUB_PARSER_HEAD_ONLY,
+			&params) == HUBBUB_OK);
+
+	for (pos = 0; pos < len && error == HUBBUB_OK; pos += chunk) {
+		error = hubbub_parser_parse_chunk(parser, data + pos,
+				len - pos < chunk ? len - pos : chunk);
+		assert(error == HUBBUB_OK || error == HUBBUB_STOPPED);
+	}
+
+	if (error == HUBBUB_STOPPED) {
+		/* Once stopped, the parser stays stopped */
+		assert(hubbub_parser_parse_chunk(parser, data, len) ==
+				HUBBUB_STOPPED);
+		assert(hubbub_parser_completed(parser) == HUBBUB_STOPPED);
+	} else {
+		error = hubbub_parser_completed(parser);
+		assert(error == HUBBUB_OK || error == HUBBUB_STOPPED);
+	}
+
+	hubbub_parser_destroy(parser);
+
+	/* The head is all there, and there is nothing in the body */
+	serialise_head(full, &a);
+	serialise_head(head, &b);
+	assert(a.len == b.len);
+	assert(memcmp(a.data, b.data, a.len) == 0);
+
+	body = child(head, child(head, HUBBUB_DOM_ROOT, "html"), "body");
+	assert(body == HUBBUB_DOM_NONE ||
+			hubbub_dom_first_child(head, body) == HUBBUB_DOM_NONE);
+
+	printf("Read %" PRIuPTR " of %" PRIuPTR " bytes\n",
+			(uintptr_t) (pos < len ? pos : len), (uintptr_t) len);
+
+	assert(hubbub_dom_destroy(full) == HUBBUB_OK);
+	assert(hubbub_dom_destroy(head) == HUBBUB_OK);
+
+	free(a.data);
+	free(b.data);
+
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	FILE *fp;
+	uint8_t *data;
+	size_t len;
+	int ret;
+
+	if (argc != 2) {
+		printf("Usage: %s <filename>\n", argv[0]);
+		return 1;
+	}
+
+	fp = fopen(argv[1], "rb");
+	if (fp == NULL) {
+		printf("Failed opening %s\n", argv[1]);
+		return 1;
+	}
+
+	fseek(fp, 0, SEEK_END);
+	len = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+
+	data = malloc(len + 1);
+	assert(data != NULL);
+	assert(fread(data, 1, len, fp) == len);
+
+	fclose(fp);
+
+	if ((ret = run_test(data, len, 1)) != 0)
+		return ret;
+	if ((ret = run_test(data, len, 4096)) != 0)
+		return ret;
+	if ((ret = run_test(data, len, len + 1)) != 0)
+		return ret;
+
+	free(data);
+
+	printf("PASS\n");
+
+	return 0;
+}
@@ -0,0 +1,250 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <hubbub/hubbub.h>
+
+#include <hubbub/dom.h>
+#include <hubbub/parser.h>
+
+#include "utils/utils.h"
+
+#include "testutils.h"
+
+/* Documents are made at least this long, to be split into many chunks */
+#define MIN_LENGTH (1024 * 1024)
+
+/* Between copies of a document goes a title the treebuilder does not treat
+ * as a title, so the tokens found ahead of it are not all correct */
+static const char separator[] = "\n<svg><title><b>x</b></title></svg>\n";
+
+static hubbub_parser *parser;
+
+/* Whether to insert data after some start tags */
+static bool inserting;
+
+/* Number of start tags seen */
+static uint32_t tags;
+
+static void *myrealloc(void *ptr, size_t len, void *pw)
+{
+	UNUSED(pw);
+
+	return realloc(ptr, len);
+}
+
+static void put_string(text *t, const hubbub_string *s)
+{
+	put(t, (const char *) s->ptr, s->len);
+	put(t, "\n", 1);
+}
+
+static hubbub_error token_handler(const hubbub_token *token, void *pw)
+{
+	static const char insert[] = "<i>written</i><b title=\"";
+	text *t = pw;
+	char location[64];
+	uint32_t i;
+
+	/* Tokens are split in just the same places, and found in just the
+	 * same places */
+	sprintf(location, "%d %" PRIuPTR "-%" PRIuPTR " %" PRIu32 ":%" PRIu32
+			"\n", token->type, (uintptr_t) token->location.start,
+			(uintptr_t) token->location.end, token->location.line,
+			token->location.col);
+	put(t, location, strlen(location));
+
+	switch (token->type) {
+	case HUBBUB_TOKEN_DOCTYPE:
+		put_string(t, &token->data.doctype.name);
+		put_string(t, &token->data.doctype.public_id);
+		put_string(t, &token->data.doctype.system_id);
+		break;
+	case HUBBUB_TOKEN_START_TAG:
+	case HUBBUB_TOKEN_END_TAG:
+		put_string(t, &token->data.tag.name);
+		for (i = 0; i < token->data.tag.n_attributes; i++) {
+			put_string(t, &token->data.tag.attributes[i].name);
+			put_string(t, &token->data.tag.attributes[i].value);
+		}
+
+		if (inserting && token->type == HUBBUB_TOKEN_START_TAG &&
+				++tags % 1000 == 0) {
+			assert(hubbub_parser_insert_chunk(parser,
+					(const uint8_t *) insert,
+					SLEN(insert)) == HUBBUB_OK);
+		}
+		break;
+	case HUBBUB_TOKEN_COMMENT:
+		put_string(t, &token->data.comment);
+		break;
+	case HUBBUB_TOKEN_CHARACTER:
+		put_string(t, &token->data.character);
+		break;
+	case HUBBUB_TOKEN_EOF:
+		break;
+	}
+
+	return HUBBUB_OK;
+}
+
+static hubbub_error enter(const hubbub_dom *dom, hubbub_dom_node node,
+		void *pw)
+{
+	hubbub_string s;
+
+	switch (hubbub_dom_type(dom, node)) {
+	case HUBBUB_DOM_NODE_ELEMENT:
+		s = hubbub_dom_atom_string(dom, hubbub_dom_name(dom, node));
+		put(pw, "<", 1);
+		put(pw, (const char *) s.ptr, s.len);
+		break;
+	case HUBBUB_DOM_NODE_TEXT:
+	case HUBBUB_DOM_NODE_COMMENT:
+		s = hubbub_dom_data(dom, node);
+		put(pw, "\"", 1);
+		put(pw, (const char *) s.ptr, s.len);
+		break;
+	default:
+		break;
+	}
+
+	return HUBBUB_OK;
+}
+
+static hubbub_error leave(const hubbub_dom *dom, hubbub_dom_node node,
+		void *pw)
+{
+	if (hubbub_dom_type(dom, node) == HUBBUB_DOM_NODE_ELEMENT)
+		put(pw, ">", 1);
+
+	return HUBBUB_OK;
+}
+
+/* Parse a document into a tree, or a list of tokens, and serialise it */
+static void parse(const uint8_t *data, size_t len, unsigned int threads,
+		bool pipeline, bool tree, text *t)
+{
+	hubbub_parser_optparams params;
+	hubbub_dom *dom = NULL;
+
+	memset(t, 0, sizeof *t);
+	tags = 0;
+
+	assert(hubbub_parser_create("UTF-8", false, myrealloc, NULL,
+			&parser) == HUBBUB_OK);
+
+	if (tree) {
+		assert(hubbub_dom_create(myrealloc, NULL, &dom) == HUBBUB_OK);
+		assert(hubbub_dom_attach(dom, parser) == HUBBUB_OK);
+	} else {
+		params.token_handler.handler = token_handler;
+		params.token_handler.pw = t;
+		assert(hubbub_parser_setopt(parser,
+				HUBBUB_PARSER_TOKEN_HANDLER,
+				&params) == HUBBUB_OK);
+
+		params.track_position = true;
+		assert(hubbub_parser_setopt(parser,
+				HUBBUB_PARSER_TRACK_POSITION,
+				&params) == HUBBUB_OK);
+	}
+
+	params.threads = threads;
+	assert(hubbub_parser_setopt(parser, HUBBUB_PARSER_THREADS,
+			&params) == HUBBUB_OK);
+
+	params.pipeline = pipeline;
+	assert(hubbub_parser_setopt(parser, HUBBUB_PARSER_PIPELINE,
+			&params) == HUBBUB_OK);
+
+	assert(hubbub_parser_parse_buffer(parser, data, len) == HUBBUB_OK);
+
+	hubbub_parser_destroy(parser);
+
+	if (tree) {
+		assert(hubbub_dom_walk(dom, HUBBUB_DOM_ROOT, enter, leave,
+				t) == HUBBUB_OK);
+		assert(hubbub_dom_destroy(dom) == HUBBUB_OK);
+	}
+}
+
+static int run_test(const uint8_t *data, size_t len, bool tree)
+{
+	const unsigned int threads[] = { 0, 2, 4, 9 };
+	text plain, parallel;
+	size_t i;
+
+	parse(data, len, 0, false, tree, &plain);
+
+	for (i = 0; i < 2 * N_ELEMENTS(threads); i++) {
+		/* Speculating on some threads, or pipelining on one more */
+		parse(data, len, threads[i / 2], i % 2 == 1, tree, &parallel);
+
+		/* The result is the same, however many threads are used */
+		assert(parallel.len == plain.len);
+		assert(memcmp(parallel.data, plain.data, plain.len) == 0);
+
+		free(parallel.data);
+	}
+
+	printf("%s%s: %" PRIuPTR " bytes\n", tree ? "Tree" : "Tokens",
+			inserting ? ", inserting" : "", (uintptr_t) plain.len);
+
+	free(plain.data);
+
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	FILE *fp;
+	uint8_t *data;
+	size_t len, n;
+	int ret;
+
+	if (argc != 2) {
+		printf("Usage: %s <filename>\n", argv[0]);
+		return 1;
+	}
+
+	fp = fopen(argv[1], "rb");
+	if (fp == NULL) {
+		printf("Failed opening %s\n", argv[1]);
+		return 1;
+	}
+
+	fseek(fp, 0, SEEK_END);
+	n = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+
+	/* The document is repeated until it is long enough */
+	data = malloc(MIN_LENGTH + n + SLEN(separator));
+	assert(data != NULL);
+	assert(fread(data, 1, n, fp) == n);
+
+	fclose(fp);
+
+	for (len = n; n > 0 && len < MIN_LENGTH;
+			len += SLEN(separator) + n) {
+		memcpy(data + len, separator, SLEN(separator));
+		memcpy(data + len + SLEN(separator), data, n);
+	}
+
+	if ((ret = run_test(data, len, false)) != 0)
+		return ret;
+	if ((ret = run_test(data, len, true)) != 0)
+		return ret;
+
+	/* And again, with data inserted as the document is parsed */
+	inserting = true;
+	if ((ret = run_test(data, len, false)) != 0)
+		return ret;
+
+	free(data);
+
+	printf("PASS\n");
+
+	return 0;
+}
@@ -11,6 +11,14 @@
 #include "testutils.h"
 
 static hubbub_error token_handler(const hubbub_token *token, void *pw);
+static hubbub_error token_batch_handler(const hubbub_token *tokens,
+		size_t n_tokens, void *pw);
+
+/* Whether comments are being dropped */
+static bool drop_comments;
+
+/* Maximum size of token data, or 0 for none */
+static size_t token_limit;
 
 static void *myrealloc(void *ptr, size_t len, void *pw)
 {
@@ -19,7 +27,137 @@ static void *myrealloc(void *ptr, size_t len, void *pw)
 	return realloc(ptr, len);
 }
 
-static int run_test(int argc, char **argv, unsigned int CHUNK_SIZE)
+/* Character tokens split by a small token limit */
+typedef struct pieces {
+	size_t count;		/* Number of character tokens seen */
+	bool pause;		/* Whether to pause after each */
+} pieces;
+
+static hubbub_error piece_handler(const hubbub_token *token, void *pw)
+{
+	pieces *p = pw;
+
+	if (token->type != HUBBUB_TOKEN_CHARACTER)
+		return HUBBUB_OK;
+
+	/* Each piece is as large as the limit, and no larger */
+	assert(token->data.character.len == 8);
+	assert(token->incomplete);
+
+	p->count++;
+
+	return p->pause ? HUBBUB_PAUSED : HUBBUB_OK;
+}
+
+/* Split a run of text into pieces, pausing after each, either from the
+ * handler or once each call's budget of one token is spent */
+static void test_split_pause(bool budget)
+{
+	static const char text[] = "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa";
+	hubbub_parser *parser;
+	hubbub_parser_optparams params;
+	hubbub_error error;
+	pieces p;
+	size_t n;
+
+	p.count = 0;
+	p.pause = (budget == false);
+
+	assert(hubbub_parser_create("UTF-8", false, myrealloc, NULL,
+			&parser) == HUBBUB_OK);
+
+	params.token_handler.handler = piece_handler;
+	params.token_handler.pw = &p;
+	assert(hubbub_parser_setopt(parser, HUBBUB_PARSER_TOKEN_HANDLER,
+			&params) == HUBBUB_OK);
+
+	params.token_limit = 8;
+	assert(hubbub_parser_setopt(parser, HUBBUB_PARSER_TOKEN_LIMIT,
+			&params) == HUBBUB_OK);
+
+	if (budget) {
+		params.budget.tokens = 1;
+		params.budget.bytes = 0;
+		assert(hubbub_parser_setopt(parser, HUBBUB_PARSER_BUDGET,
+				&params) == HUBBUB_OK);
+	}
+
+	error = hubbub_parser_parse_chunk(parser,
+			(const uint8_t *) text, SLEN(text));
+
+	/* Each call passes on one piece, then pauses */
+	for (n = 1; error == HUBBUB_PAUSED; n++) {
+		assert(p.count == n);
+
+		params.pause_parse = false;
+		error = hubbub_parser_setopt(parser, HUBBUB_PARSER_PAUSE,
+				&params);
+	}
+
+	assert(error == HUBBUB_OK);
+	assert(p.count == SLEN(text) / 8);
+
+	p.pause = false;
+	assert(hubbub_parser_completed(parser) == HUBBUB_OK);
+	assert(p.count == SLEN(text) / 8);
+
+	hubbub_parser_destroy(parser);
+}
+
+/* Character tokens, and the text they make up */
+typedef struct joined {
+	size_t count;		/* Number of character tokens seen */
+	text t;			/* Their data */
+} joined;
+
+static hubbub_error joined_handler(const hubbub_token *token, void *pw)
+{
+	joined *j = pw;
+
+	if (token->type != HUBBUB_TOKEN_CHARACTER)
+		return HUBBUB_OK;
+
+	j->count++;
+	put(&j->t, token->data.character.ptr, token->data.character.len);
+
+	return HUBBUB_OK;
+}
+
+/* Normalise newlines and NULs in text without splitting it into more than
+ * one token */
+static void test_normalise_whole(void)
+{
+	static const char doc[] = "a\r\nb\rc\0d\r\n\r\ne<p>";
+	static const char expected[] = "a\nb\nc\xEF\xBF\xBD" "d\n\ne";
+	hubbub_parser *parser;
+	hubbub_parser_optparams params;
+	joined j;
+
+	memset(&j, 0, sizeof j);
+
+	assert(hubbub_parser_create("UTF-8", false, myrealloc, NULL,
+			&parser) == HUBBUB_OK);
+
+	params.token_handler.handler = joined_handler;
+	params.token_handler.pw = &j;
+	assert(hubbub_parser_setopt(parser, HUBBUB_PARSER_TOKEN_HANDLER,
+			&params) == HUBBUB_OK);
+
+	assert(hubbub_parser_parse_chunk(parser, (const uint8_t *) doc,
+			SLEN(doc)) == HUBBUB_OK);
+	assert(hubbub_parser_completed(parser) == HUBBUB_OK);
+
+	hubbub_parser_destroy(parser);
+
+	assert(j.count == 1);
+	assert(j.t.len == SLEN(expected));
+	assert(memcmp(j.t.data, expected, j.t.len) == 0);
+
+	free(j.t.data);
+}
+
+static int run_test(int argc, char **argv, unsigned int CHUNK_SIZE,
+		size_t batch_size)
 {
 	hubbub_parser *parser;
 	hubbub_parser_optparams params;
@@ -34,9 +172,27 @@ static int run_test(int argc, char **argv, unsigned int CHUNK_SIZE)
 	assert(hubbub_parser_create("UTF-8", false, myrealloc, NULL, &parser) ==
 			HUBBUB_OK);
 
-	params.token_handler.handler = token_handler;
-	params.token_handler.pw = NULL;
-	assert(hubbub_parser_setopt(parser, HUBBUB_PARSER_TOKEN_HANDLER,
+	if (batch_size > 0) {
+		params.token_batch_handler.handler = token_batch_handler;
+		params.token_batch_handler.pw = &batch_size;
+		params.token_batch_handler.size = batch_size;
+		assert(hubbub_parser_setopt(parser,
+				HUBBUB_PARSER_TOKEN_BATCH_HANDLER,
+				&params) == HUBBUB_OK);
+	} else {
+		params.token_handler.handler = token_handler;
+		params.token_handler.pw = NULL;
+		assert(hubbub_parser_setopt(parser,
+				HUBBUB_PARSER_TOKEN_HANDLER,
+				&params) == HUBBUB_OK);
+	}
+
+	params.drop_comments = drop_comments;
+	assert(hubbub_parser_setopt(parser, HUBBUB_PARSER_DROP_COMMENTS,
+			&params) == HUBBUB_OK);
+
+	params.token_limit = token_limit;
+	assert(hubbub_parser_setopt(parser, HUBBUB_PARSER_TOKEN_LIMIT,
 			&params) == HUBBUB_OK);
 
 	fp = fopen(argv[1], "rb");
@@ -85,10 +241,28 @@ int main(int argc, char **argv)
 		printf("Usage: %s <filename>\n", argv[0]);
 		return 1;
 	}
-#define DO_TEST(n) if ((ret = run_test(argc, argv, (n))) != 0) return ret
+	test_normalise_whole();
+	test_split_pause(false);
+	test_split_pause(true);
+
+#define DO_TEST(n, b) \
+	if ((ret = run_test(argc, argv, (n), (b))) != 0) return ret
         for (shift = 0; (1 << shift) != 16384; shift++)
         	for (offset = 0; offset < 10; offset += 3)
-	                DO_TEST((1 << shift) + offset);
+	                DO_TEST((1 << shift) + offset, 0);
+	/* And again, batching tokens */
+	DO_TEST(4096, 1);
+	DO_TEST(4096, 7);
+	DO_TEST(1, 64);
+	/* And without comments */
+	drop_comments = true;
+	DO_TEST(4096, 0);
+	DO_TEST(1, 0);
+	/* And splitting long tokens */
+	drop_comments = false;
+	token_limit = 5;
+	DO_TEST(4096, 0);
+	DO_TEST(1, 7);
         return 0;
 #undef DO_TEST
 }
@@ -103,6 +277,11 @@ hubbub_error token_handler(const hubbub_token *token, void *pw)
 
 	UNUSED(pw);
 
+	assert(token->type != HUBBUB_TOKEN_COMMENT || drop_comments == false);
+	assert(token->incomplete == false ||
+			token->type == HUBBUB_TOKEN_CHARACTER ||
+			token->type == HUBBUB_TOKEN_COMMENT);
+
 	printf("%s: ", token_names[token->type]);
 
 	switch (token->type) {
@@ -137,6 +316,9 @@ hubbub_error token_handler(const hubbub_token *token, void *pw)
 				(token->data.tag.n_attributes > 0) ?
 						"attributes:" : "");
 		for (i = 0; i < token->data.tag.n_attributes; i++) {
+			assert(token_limit == 0 || token->data.tag.
+					attributes[i].value.len <= token_limit);
+
 			printf("\t'%.*s' = '%.*s'\n",
 					(int) token->data.tag.attributes[i].name.len,
 					token->data.tag.attributes[i].name.ptr,
@@ -175,3 +357,16 @@ hubbub_error token_handler(const hubbub_token *token, void *pw)
 
 	return HUBBUB_OK;
 }
+
+hubbub_error token_batch_handler(const hubbub_token *tokens,
+		size_t n_tokens, void *pw)
+{
+	size_t i;
+
+	assert(n_tokens > 0 && n_tokens <= *((size_t *) pw));
+
+	for (i = 0; i < n_tokens; i++)
+		token_handler(&tokens[i], NULL);
+
+	return HUBBUB_OK;
+}
@@ -0,0 +1,195 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <hubbub/hubbub.h>
+
+#include <hubbub/parser.h>
+#include <hubbub/preload.h>
+
+#include "utils/utils.h"
+
+#include "testutils.h"
+
+typedef struct scan {
+	hubbub_parser *parser;	/* Parser being scanned */
+	const char *insert;	/* Data to insert at the pause, or NULL */
+	bool paused;		/* Whether the parser has been paused */
+	text found;		/* Resources found */
+} scan;
+
+/* The parser is paused after the first script, for the client to run */
+static const char document_start[] =
+	"<html><head><script src=\"first.js\"></script>"
+	"<link rel=\"icon Stylesheet\" href=\" style.css \">"
+	"<link rel=icon href=icon.png>"
+	"<base href=\"/base/\"><base href=\"/ignored/\">"
+	"<script src=second.js></script>"
+	"<script>document.write('<img src=written.png>')</script>"
+	"<style>p { background: url(bg.png) } <img src=styled.png></style>"
+	"</head><body><!-- <img src=commented.png> -->"
+	"<img src=a.png "
+	"srcset=\"b.png 1x, c,d.png 2x,e.png (x, y) 3x,,f.png\">"
+	"<input type=IMAGE src=input.png><input src=ignored.png>";
+
+/* Then, far enough on that it is decoded by a later refill of the input
+ * stream than the pause, comes the rest */
+static const char document_end[] =
+	"<picture><source srcset=picture.webp></picture>"
+	"<textarea><img src=textarea.png></textarea>"
+	"<img src=\"truncated.png";
+
+static const char found[] =
+	"stylesheet style.css\n"
+	"base /base/\n"
+	"script second.js\n"
+	"image a.png\n"
+	"image b.png\n"
+	"image c,d.png\n"
+	"image e.png\n"
+	"image f.png\n"
+	"image input.png\n"
+	"image picture.webp\n";
+
+static void *myrealloc(void *ptr, size_t len, void *pw)
+{
+	UNUSED(pw);
+
+	return realloc(ptr, len);
+}
+
+static hubbub_error preload_handler(const hubbub_preload *preload, void *pw)
+{
+	static const char *types[] = { "base", "script", "stylesheet",
+			"image" };
+	text *t = pw;
+
+	put(t, types[preload->type], strlen(types[preload->type]));
+	put(t, " ", 1);
+	put(t, (const char *) preload->url.ptr, preload->url.len);
+	put(t, "\n", 1);
+
+	return HUBBUB_OK;
+}
+
+static hubbub_error token_handler(const hubbub_token *token, void *pw)
+{
+	scan *s = pw;
+
+	/* Pause once the first script is complete, as if to run it */
+	if (s->paused || token->type != HUBBUB_TOKEN_END_TAG ||
+			token->data.tag.name.len != SLEN("script"))
+		return HUBBUB_OK;
+
+	s->paused = true;
+
+	if (s->insert != NULL) {
+		assert(hubbub_parser_insert_chunk(s->parser,
+				(const uint8_t *) s->insert,
+				strlen(s->insert)) == HUBBUB_OK);
+	}
+
+	return HUBBUB_PAUSED;
+}
+
+static int run_test(const text *document, const char *charset, bool buffer,
+		const char *insert)
+{
+	hubbub_parser_optparams params;
+	hubbub_error error;
+	text expected;
+	scan s;
+
+	memset(&s, 0, sizeof s);
+	s.insert = insert;
+
+	assert(hubbub_parser_create(charset, true, myrealloc, NULL,
+			&s.parser) == HUBBUB_OK);
+
+	params.token_handler.handler = token_handler;
+	params.token_handler.pw = &s;
+	assert(hubbub_parser_setopt(s.parser, HUBBUB_PARSER_TOKEN_HANDLER,
+			&params) == HUBBUB_OK);
+
+	if (buffer) {
+		error = hubbub_parser_parse_buffer(s.parser,
+				(const uint8_t *) document->data,
+				document->len);
+	} else {
+		error = hubbub_parser_parse_chunk(s.parser,
+				(const uint8_t *) document->data,
+				document->len);
+	}
+	assert(error == HUBBUB_PAUSED);
+
+	/* Inserted data is scanned first, then the rest of the document */
+	memset(&expected, 0, sizeof expected);
+	if (insert != NULL)
+		put(&expected, "image inserted.png\n",
+				SLEN("image inserted.png\n"));
+	put(&expected, found, SLEN(found));
+
+	assert(hubbub_parser_preload(s.parser, preload_handler,
+			&s.found) == HUBBUB_OK);
+	assert(s.found.len == expected.len);
+	assert(memcmp(s.found.data, expected.data, expected.len) == 0);
+
+	/* The parse carries on as before */
+	params.pause_parse = false;
+	assert(hubbub_parser_setopt(s.parser, HUBBUB_PARSER_PAUSE,
+			&params) == HUBBUB_OK);
+	if (buffer == false)
+		assert(hubbub_parser_completed(s.parser) == HUBBUB_OK);
+
+	hubbub_parser_destroy(s.parser);
+
+	printf("%s, %s%s: %" PRIuPTR " bytes\n", charset,
+			buffer ? "buffer" : "chunk",
+			insert != NULL ? ", inserted" : "",
+			(uintptr_t) s.found.len);
+
+	free(expected.data);
+	free(s.found.data);
+
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	static const char filler[] = "<p>Filler, between the resources</p>";
+	const char *inserted = "<p><img src=inserted.png><p>";
+	text document;
+	int ret;
+
+	UNUSED(argc);
+	UNUSED(argv);
+
+	/* Each refill decodes at most a few kilobytes */
+	memset(&document, 0, sizeof document);
+	put(&document, document_start, SLEN(document_start));
+	while (document.len < 16384)
+		put(&document, filler, SLEN(filler));
+	put(&document, document_end, SLEN(document_end));
+
+	if ((ret = run_test(&document, "UTF-8", true, NULL)) != 0)
+		return ret;
+	if ((ret = run_test(&document, "UTF-8", true, inserted)) != 0)
+		return ret;
+	if ((ret = run_test(&document, "UTF-8", false, NULL)) != 0)
+		return ret;
+	if ((ret = run_test(&document, "UTF-8", false, inserted)) != 0)
+		return ret;
+	/* Read through the input stream, rather than in place */
+	if ((ret = run_test(&document, "Windows-1252", false, NULL)) != 0)
+		return ret;
+	if ((ret = run_test(&document, "Windows-1252", false, inserted)) != 0)
+		return ret;
+
+	free(document.data);
+
+	printf("PASS\n");
+
+	return 0;
+}
+
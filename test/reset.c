@@ -0,0 +1,160 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <hubbub/hubbub.h>
+
+#include <hubbub/dom.h>
+#include <hubbub/parser.h>
+
+#include "utils/utils.h"
+
+#include "testutils.h"
+
+static void *myrealloc(void *ptr, size_t len, void *pw)
+{
+	UNUSED(pw);
+
+	return realloc(ptr, len);
+}
+
+static hubbub_error enter(const hubbub_dom *dom, hubbub_dom_node node,
+		void *pw)
+{
+	hubbub_string s;
+
+	switch (hubbub_dom_type(dom, node)) {
+	case HUBBUB_DOM_NODE_ELEMENT:
+		s = hubbub_dom_atom_string(dom, hubbub_dom_name(dom, node));
+		put(pw, "<", 1);
+		put(pw, (const char *) s.ptr, s.len);
+		break;
+	case HUBBUB_DOM_NODE_TEXT:
+	case HUBBUB_DOM_NODE_COMMENT:
+		s = hubbub_dom_data(dom, node);
+		put(pw, "\"", 1);
+		put(pw, (const char *) s.ptr, s.len);
+		break;
+	default:
+		break;
+	}
+
+	return HUBBUB_OK;
+}
+
+static hubbub_error leave(const hubbub_dom *dom, hubbub_dom_node node,
+		void *pw)
+{
+	if (hubbub_dom_type(dom, node) == HUBBUB_DOM_NODE_ELEMENT)
+		put(pw, ">", 1);
+
+	return HUBBUB_OK;
+}
+
+/* Parse a document into a new tree, and serialise it */
+static void parse(hubbub_parser *parser, const uint8_t *data, size_t len,
+		size_t chunk, text *t)
+{
+	hubbub_dom *dom;
+	size_t pos;
+
+	assert(hubbub_dom_create(myrealloc, NULL, &dom) == HUBBUB_OK);
+	assert(hubbub_dom_attach(dom, parser) == HUBBUB_OK);
+
+	for (pos = 0; pos < len; pos += chunk) {
+		assert(hubbub_parser_parse_chunk(parser, data + pos,
+				len - pos < chunk ? len - pos : chunk) ==
+				HUBBUB_OK);
+	}
+	assert(hubbub_parser_completed(parser) == HUBBUB_OK);
+
+	assert(hubbub_dom_walk(dom, HUBBUB_DOM_ROOT, enter, leave, t) ==
+			HUBBUB_OK);
+
+	assert(hubbub_dom_destroy(dom) == HUBBUB_OK);
+}
+
+static int run_test(const uint8_t *data, size_t len, size_t chunk)
+{
+	hubbub_parser *parser;
+	hubbub_dom *dom;
+	text fresh, reused;
+	int i;
+
+	memset(&fresh, 0, sizeof fresh);
+	memset(&reused, 0, sizeof reused);
+
+	/* A new parser */
+	assert(hubbub_parser_create("UTF-8", false, myrealloc, NULL,
+			&parser) == HUBBUB_OK);
+	parse(parser, data, len, chunk, &fresh);
+	hubbub_parser_destroy(parser);
+
+	/* One left part way through a document, then reset */
+	assert(hubbub_parser_create("UTF-8", false, myrealloc, NULL,
+			&parser) == HUBBUB_OK);
+	assert(hubbub_dom_create(myrealloc, NULL, &dom) == HUBBUB_OK);
+	assert(hubbub_dom_attach(dom, parser) == HUBBUB_OK);
+	assert(hubbub_parser_parse_chunk(parser, data, len / 2) ==
+			HUBBUB_OK);
+
+	for (i = 0; i < 3; i++) {
+		assert(hubbub_parser_reset(parser, "UTF-8") == HUBBUB_OK);
+
+		reused.len = 0;
+		parse(parser, data, len, chunk, &reused);
+
+		/* Gives the same tree as the new one, each time */
+		assert(fresh.len == reused.len);
+		assert(memcmp(fresh.data, reused.data, fresh.len) == 0);
+	}
+
+	hubbub_parser_destroy(parser);
+	assert(hubbub_dom_destroy(dom) == HUBBUB_OK);
+
+	free(fresh.data);
+	free(reused.data);
+
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	FILE *fp;
+	uint8_t *data;
+	size_t len;
+	int ret;
+
+	if (argc != 2) {
+		printf("Usage: %s <filename>\n", argv[0]);
+		return 1;
+	}
+
+	fp = fopen(argv[1], "rb");
+	if (fp == NULL) {
+		printf("Failed opening %s\n", argv[1]);
+		return 1;
+	}
+
+	fseek(fp, 0, SEEK_END);
+	len = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+
+	data = malloc(len + 1);
+	assert(data != NULL);
+	assert(fread(data, 1, len, fp) == len);
+
+	fclose(fp);
+
+	if ((ret = run_test(data, len, 1)) != 0)
+		return ret;
+	if ((ret = run_test(data, len, len + 1)) != 0)
+		return ret;
+
+	free(data);
+
+	printf("PASS\n");
+
+	return 0;
+}
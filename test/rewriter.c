@@ -0,0 +1,283 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <hubbub/hubbub.h>
+
+#include <hubbub/rewriter.h>
+
+#include "utils/scan.h"
+#include "utils/utils.h"
+
+#include "testutils.h"
+
+#define PREFIX "/proxy?"
+#define INJECTED "inject.js"
+
+typedef struct output {
+	text buf;		/* Output */
+
+	size_t heads;		/* Head end tags seen */
+	size_t injected;	/* Injected scripts seen */
+	size_t comments;	/* Comments seen */
+} output;
+
+static void *myrealloc(void *ptr, size_t len, void *pw)
+{
+	UNUSED(pw);
+
+	return realloc(ptr, len);
+}
+
+static hubbub_error sink(const uint8_t *data, size_t len, void *pw)
+{
+	output *out = pw;
+
+	put(&out->buf, data, len);
+
+	return HUBBUB_OK;
+}
+
+static const hubbub_attribute *find(const hubbub_tag *tag, const char *name)
+{
+	uint32_t i;
+
+	for (i = 0; i < tag->n_attributes; i++) {
+		if (tag->attributes[i].name.len == strlen(name) &&
+				memcmp(tag->attributes[i].name.ptr, name,
+				strlen(name)) == 0)
+			return &tag->attributes[i];
+	}
+
+	return NULL;
+}
+
+static bool is(const hubbub_string *str, const char *s)
+{
+	return str->len == strlen(s) && memcmp(str->ptr, s, str->len) == 0;
+}
+
+/* Prefix links, inject a script at the end of the head, drop comments */
+static hubbub_error rewrite(hubbub_rewriter *rewriter,
+		const hubbub_token *token, void *pw)
+{
+	static const char script[] = "<script src=" INJECTED "></script>";
+	const hubbub_tag *tag = &token->data.tag;
+	output *out = pw;
+
+	if (token->type == HUBBUB_TOKEN_COMMENT)
+		return hubbub_rewriter_drop(rewriter);
+
+	if (token->type == HUBBUB_TOKEN_END_TAG && is(&tag->name, "head")) {
+		out->heads++;
+		return hubbub_rewriter_write(rewriter,
+				(const uint8_t *) script, SLEN(script));
+	}
+
+	if (token->type == HUBBUB_TOKEN_START_TAG && find(tag, "href")) {
+		hubbub_attribute *attrs;
+		hubbub_token copy = *token;
+		uint8_t *value;
+		uint32_t i;
+		hubbub_error error;
+
+		attrs = malloc(tag->n_attributes * sizeof(hubbub_attribute));
+		assert(attrs != NULL);
+		memcpy(attrs, tag->attributes,
+				tag->n_attributes * sizeof(hubbub_attribute));
+
+		for (i = 0; is(&attrs[i].name, "href") == false; i++)
+			;
+
+		value = malloc(SLEN(PREFIX) + attrs[i].value.len);
+		assert(value != NULL);
+		memcpy(value, PREFIX, SLEN(PREFIX));
+		memcpy(value + SLEN(PREFIX), attrs[i].value.ptr,
+				attrs[i].value.len);
+		attrs[i].value.ptr = value;
+		attrs[i].value.len += SLEN(PREFIX);
+
+		copy.data.tag.attributes = attrs;
+
+		error = hubbub_rewriter_replace(rewriter, &copy);
+
+		free(value);
+		free(attrs);
+
+		return error;
+	}
+
+	/* Anything else is copied */
+	assert(hubbub_rewriter_copy(rewriter) == HUBBUB_OK);
+	assert(hubbub_rewriter_copy(rewriter) == HUBBUB_BADPARM);
+
+	return HUBBUB_OK;
+}
+
+/* Check the output of rewrite() */
+static hubbub_error check(hubbub_rewriter *rewriter,
+		const hubbub_token *token, void *pw)
+{
+	const hubbub_tag *tag = &token->data.tag;
+	const hubbub_attribute *attr;
+	output *out = pw;
+
+	UNUSED(rewriter);
+
+	if (token->type == HUBBUB_TOKEN_COMMENT)
+		out->comments++;
+
+	if (token->type == HUBBUB_TOKEN_START_TAG) {
+		attr = find(tag, "href");
+		if (attr != NULL) {
+			assert(attr->value.len >= SLEN(PREFIX));
+			assert(memcmp(attr->value.ptr, PREFIX,
+					SLEN(PREFIX)) == 0);
+		}
+
+		attr = find(tag, "src");
+		if (is(&tag->name, "script") && attr != NULL &&
+				is(&attr->value, INJECTED))
+			out->injected++;
+	}
+
+	return HUBBUB_OK;
+}
+
+static void run(const uint8_t *data, size_t len, size_t chunk,
+		hubbub_rewriter_handler handler, output *out)
+{
+	hubbub_rewriter *rewriter;
+	size_t pos, n;
+
+	assert(hubbub_rewriter_create(handler, sink, out, myrealloc, NULL,
+			&rewriter) == HUBBUB_OK);
+
+	/* Only from within the handler */
+	assert(hubbub_rewriter_copy(rewriter) == HUBBUB_BADPARM);
+
+	for (pos = 0; pos < len; pos += n) {
+		n = len - pos < chunk ? len - pos : chunk;
+
+		assert(hubbub_rewriter_process_chunk(rewriter, data + pos,
+				n) == HUBBUB_OK);
+	}
+	assert(hubbub_rewriter_completed(rewriter) == HUBBUB_OK);
+
+	hubbub_rewriter_destroy(rewriter);
+}
+
+static int run_test(const uint8_t *data, size_t len,
+		const text *expected, size_t chunk)
+{
+	output copied, rewritten, checked;
+
+	memset(&copied, 0, sizeof copied);
+	memset(&rewritten, 0, sizeof rewritten);
+	memset(&checked, 0, sizeof checked);
+
+	/* Untouched, the document is copied out as it is */
+	run(data, len, chunk, NULL, &copied);
+	assert(copied.buf.len == expected->len);
+	assert(memcmp(copied.buf.data, expected->data, copied.buf.len) == 0);
+
+	/* Rewritten, it has just the changes made */
+	run(data, len, chunk, rewrite, &rewritten);
+	run((const uint8_t *) rewritten.buf.data, rewritten.buf.len, 4096,
+			check, &checked);
+	assert(checked.buf.len == rewritten.buf.len);
+	assert(memcmp(checked.buf.data, rewritten.buf.data,
+			checked.buf.len) == 0);
+	assert(checked.comments == 0);
+	assert(checked.injected == rewritten.heads);
+
+	printf("chunks of %u: %u bytes rewritten to %u\n",
+			(unsigned int) chunk, (unsigned int) len,
+			(unsigned int) rewritten.buf.len);
+
+	free(copied.buf.data);
+	free(rewritten.buf.data);
+	free(checked.buf.data);
+
+	return 0;
+}
+
+/* Check that a byte order mark is copied out too */
+static void test_bom(void)
+{
+	static const char doc[] = "\xEF\xBB\xBF<p>BOM";
+	size_t chunk;
+	output out;
+
+	for (chunk = 1; chunk <= SLEN(doc); chunk++) {
+		memset(&out, 0, sizeof out);
+
+		run((const uint8_t *) doc, SLEN(doc), chunk, NULL, &out);
+		assert(out.buf.len == SLEN(doc));
+		assert(memcmp(out.buf.data, doc, out.buf.len) == 0);
+
+		free(out.buf.data);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	text expected;
+	FILE *fp;
+	uint8_t *data;
+	size_t len, pos, n;
+	int ret;
+
+	if (argc != 2) {
+		printf("Usage: %s <filename>\n", argv[0]);
+		return 1;
+	}
+
+	fp = fopen(argv[1], "rb");
+	if (fp == NULL) {
+		printf("Failed opening %s\n", argv[1]);
+		return 1;
+	}
+
+	fseek(fp, 0, SEEK_END);
+	len = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+
+	data = malloc(len > 0 ? len : 1);
+	assert(data != NULL);
+	assert(fread(data, 1, len, fp) == len);
+
+	fclose(fp);
+
+	/* The input, with invalid sequences replaced by U+FFFD */
+	memset(&expected, 0, sizeof expected);
+	pos = 0;
+	while (pos < len) {
+		n = hubbub_scan_utf8_valid(data + pos, len - pos);
+		put(&expected, data + pos, n);
+		pos += n;
+		if (pos == len)
+			break;
+
+		hubbub_scan_utf8_sequence(data + pos, len - pos, &n);
+		put(&expected, "\xEF\xBF\xBD", 3);
+		pos += n;
+	}
+
+	test_bom();
+
+#define DO_TEST(n) \
+	if ((ret = run_test(data, len, &expected, (n))) != 0) return ret
+	DO_TEST(1);
+	DO_TEST(7);
+	DO_TEST(4096);
+	DO_TEST(len > 0 ? len : 1);
+#undef DO_TEST
+
+	free(expected.data);
+	free(data);
+
+	printf("PASS\n");
+
+	return 0;
+}
@@ -0,0 +1,149 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <hubbub/hubbub.h>
+
+#include <hubbub/dom.h>
+#include <hubbub/parser.h>
+#include <hubbub/stats.h>
+
+#include "utils/utils.h"
+
+#include "testutils.h"
+
+/* Misnested formatting, text foster parented out of a table, and named
+ * character references, with or without a semicolon */
+static const char body[] =
+	"</head><body><table>x<tr><td>1</td></tr></table>"
+	"<p><b>bold<i>both</b>italic</i> &amp; &copy &#65;</p></body></html>";
+
+static uint64_t alloc_calls;
+
+static void *myrealloc(void *ptr, size_t len, void *pw)
+{
+	UNUSED(pw);
+
+	alloc_calls++;
+
+	return realloc(ptr, len);
+}
+
+static void *domrealloc(void *ptr, size_t len, void *pw)
+{
+	UNUSED(pw);
+
+	return realloc(ptr, len);
+}
+
+static int run_test(const char *enc, size_t chunk)
+{
+	hubbub_parser_stats stats;
+	hubbub_parser *parser;
+	hubbub_dom *dom;
+	hubbub_error error;
+	char doc[2048];
+	size_t len, pos, n;
+	uint64_t elements;
+
+	/* The meta element comes too late for any prescan to find */
+	len = sprintf(doc, "<!DOCTYPE html><html><head><!-- ");
+	memset(doc + len, 'x', 1024);
+	len += 1024;
+	len += sprintf(doc + len, " --><meta charset=windows-1252>%s", body);
+
+	alloc_calls = 0;
+
+	assert(hubbub_parser_create(enc, false, myrealloc, NULL,
+			&parser) == HUBBUB_OK);
+	assert(hubbub_dom_create(domrealloc, NULL, &dom) == HUBBUB_OK);
+	assert(hubbub_dom_attach(dom, parser) == HUBBUB_OK);
+
+	for (pos = 0; pos < len; pos += n) {
+		n = len - pos < chunk ? len - pos : chunk;
+
+		assert(hubbub_parser_parse_chunk(parser,
+				(const uint8_t *) doc + pos, n) == HUBBUB_OK);
+	}
+	assert(hubbub_parser_completed(parser) == HUBBUB_OK);
+
+	error = hubbub_parser_get_stats(parser, &stats);
+	if (error == HUBBUB_INVALID) {
+		/* Built without counters */
+		printf("not counted\n");
+		hubbub_parser_destroy(parser);
+		assert(hubbub_dom_destroy(dom) == HUBBUB_OK);
+		return 0;
+	}
+	assert(error == HUBBUB_OK);
+
+	assert(stats.bytes == len);
+
+	assert(stats.tokens[HUBBUB_TOKEN_DOCTYPE] == 1);
+	assert(stats.tokens[HUBBUB_TOKEN_START_TAG] == 10);
+	assert(stats.tokens[HUBBUB_TOKEN_END_TAG] == 9);
+	assert(stats.tokens[HUBBUB_TOKEN_COMMENT] == 1);
+	assert(stats.tokens[HUBBUB_TOKEN_CHARACTER] > 0);
+	assert(stats.tokens[HUBBUB_TOKEN_EOF] == 1);
+
+	/* Each element is made once, as is the tbody which is implied, and
+	 * the i element is cloned */
+	elements = stats.tree_calls[HUBBUB_TREE_CREATE_ELEMENT] +
+			stats.tree_calls[HUBBUB_TREE_CREATE_AND_APPEND_ELEMENT];
+	assert(elements == 10 + 1);
+	assert(stats.tree_calls[HUBBUB_TREE_CLONE_NODE] == 1);
+	assert(stats.tree_calls[HUBBUB_TREE_CREATE_DOCTYPE] == 1);
+	assert(stats.tree_calls[HUBBUB_TREE_CREATE_COMMENT] == 1);
+
+	/* The parser's allocations are all counted */
+	assert(stats.alloc_calls == alloc_calls);
+	assert(stats.peak_alloc > 0);
+
+	/* html, body, table, tbody, tr, td */
+	assert(stats.max_depth == 6);
+	/* b and i */
+	assert(stats.max_formatting == 2);
+	/* </b> and </i> */
+	assert(stats.adoptions == 2);
+	assert(stats.foster_parented == 1);
+	assert(stats.entity_lookups == 2);
+
+	/* The charset is switched in place, if it was not given */
+	assert(stats.encoding_restarts == (enc == NULL ? 1 : 0));
+
+	printf("%s, %s: %" PRIu64 " allocations\n",
+			enc != NULL ? enc : "detected",
+			chunk == 1 ? "bytewise" : "whole",
+			stats.alloc_calls);
+
+	hubbub_parser_destroy(parser);
+	assert(hubbub_dom_destroy(dom) == HUBBUB_OK);
+
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	hubbub_parser_stats stats;
+	int ret;
+
+	UNUSED(argc);
+	UNUSED(argv);
+
+	assert(hubbub_parser_get_stats(NULL, &stats) == HUBBUB_BADPARM);
+
+	if ((ret = run_test(NULL, 1)) != 0)
+		return ret;
+	if ((ret = run_test(NULL, (size_t) -1)) != 0)
+		return ret;
+	if ((ret = run_test("UTF-8", 1)) != 0)
+		return ret;
+	if ((ret = run_test("UTF-8", (size_t) -1)) != 0)
+		return ret;
+
+	printf("PASS\n");
+
+	return 0;
+}
+
@@ -148,6 +148,38 @@ size_t parse_filesize(const char *filename)
 }
 
 
+/**
+ * Growable buffer of output, such as a serialised tree or token stream
+ */
+typedef struct text {
+	char *data;		/* Output so far */
+	size_t len;		/* Length of data */
+	size_t alloc;		/* Bytes allocated for data */
+} text;
+
+void put(text *t, const void *data, size_t len);
+
+/**
+ * Append data to a text, growing it as needed
+ *
+ * \param t     Text to append to
+ * \param data  Data to append
+ * \param len   Length of data, in bytes
+ */
+void put(text *t, const void *data, size_t len)
+{
+	while (t->len + len > t->alloc) {
+		t->alloc = t->alloc == 0 ? 4096 : t->alloc * 2;
+		t->data = realloc(t->data, t->alloc);
+		assert(t->data != NULL);
+	}
+
+	if (len > 0)
+		memcpy(t->data + t->len, data, len);
+	t->len += len;
+}
+
+
 #ifndef strndup
 char *my_strndup(const char *s, size_t n);
 
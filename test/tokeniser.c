@@ -5,6 +5,7 @@
 
 #include <hubbub/hubbub.h>
 
+#include "utils/scan.h"
 #include "utils/utils.h"
 
 #include "tokeniser/tokeniser.h"
@@ -12,6 +13,11 @@
 #include "testutils.h"
 
 static hubbub_error token_handler(const hubbub_token *token, void *pw);
+static hubbub_error record_handler(const hubbub_token *token, void *pw);
+static void test_end_tag_split(void);
+
+/* Location of the last token seen */
+static hubbub_location last = { 0, 0, 1, 1 };
 
 static void *myrealloc(void *ptr, size_t len, void *pw)
 {
@@ -35,6 +41,8 @@ int main(int argc, char **argv)
 		return 1;
 	}
 
+	test_end_tag_split();
+
 	assert(parserutils_inputstream_create("UTF-8", 0, NULL,
 			myrealloc, NULL, &stream) == PARSERUTILS_OK);
 
@@ -46,6 +54,10 @@ int main(int argc, char **argv)
 	assert(hubbub_tokeniser_setopt(tok, HUBBUB_TOKENISER_TOKEN_HANDLER,
 			&params) == HUBBUB_OK);
 
+	params.track_position = true;
+	assert(hubbub_tokeniser_setopt(tok, HUBBUB_TOKENISER_TRACK_POSITION,
+			&params) == HUBBUB_OK);
+
 	fp = fopen(argv[1], "rb");
 	if (fp == NULL) {
 		printf("Failed opening %s\n", argv[1]);
@@ -83,6 +95,88 @@ int main(int argc, char **argv)
 	return 0;
 }
 
+/* Serialise the type and name or data of each token */
+hubbub_error record_handler(const hubbub_token *token, void *pw)
+{
+	const hubbub_string *s = NULL;
+	char type[16];
+
+	sprintf(type, "%d ", token->type);
+	put(pw, type, strlen(type));
+
+	if (token->type == HUBBUB_TOKEN_START_TAG ||
+			token->type == HUBBUB_TOKEN_END_TAG)
+		s = &token->data.tag.name;
+	else if (token->type == HUBBUB_TOKEN_CHARACTER)
+		s = &token->data.character;
+
+	if (s != NULL)
+		put(pw, s->ptr, s->len);
+	put(pw, "\n", 1);
+
+	return HUBBUB_OK;
+}
+
+/* Match an appropriate end tag, in CDATA, split across two chunks at each
+ * offset. The outcome must not depend on where the input runs out */
+void test_end_tag_split(void)
+{
+	static const char start[] = "<iframe>";
+	static const char input[] = "</IFRAME <>x";
+	static const char expected[] = "1 iframe\n2 iframe\n4 x\n5 \n";
+	parserutils_inputstream *stream;
+	hubbub_tokeniser *tok;
+	hubbub_tokeniser_optparams params;
+	size_t split;
+	text t;
+
+	for (split = 0; split <= SLEN(input); split++) {
+		memset(&t, 0, sizeof t);
+
+		assert(parserutils_inputstream_create("UTF-8", 0, NULL,
+				myrealloc, NULL, &stream) == PARSERUTILS_OK);
+		assert(hubbub_tokeniser_create(stream, myrealloc, NULL,
+				&tok) == HUBBUB_OK);
+
+		params.token_handler.handler = record_handler;
+		params.token_handler.pw = &t;
+		assert(hubbub_tokeniser_setopt(tok,
+				HUBBUB_TOKENISER_TOKEN_HANDLER,
+				&params) == HUBBUB_OK);
+
+		/* Start an iframe, as the treebuilder would */
+		assert(parserutils_inputstream_append(stream,
+				(const uint8_t *) start,
+				SLEN(start)) == PARSERUTILS_OK);
+		assert(hubbub_tokeniser_run(tok) == HUBBUB_OK);
+
+		params.content_model.model = HUBBUB_CONTENT_MODEL_CDATA;
+		assert(hubbub_tokeniser_setopt(tok,
+				HUBBUB_TOKENISER_CONTENT_MODEL,
+				&params) == HUBBUB_OK);
+
+		assert(parserutils_inputstream_append(stream,
+				(const uint8_t *) input,
+				split) == PARSERUTILS_OK);
+		assert(hubbub_tokeniser_run(tok) == HUBBUB_OK);
+
+		assert(parserutils_inputstream_append(stream,
+				(const uint8_t *) input + split,
+				SLEN(input) - split) == PARSERUTILS_OK);
+		assert(parserutils_inputstream_append(stream,
+				NULL, 0) == PARSERUTILS_OK);
+		assert(hubbub_tokeniser_run(tok) == HUBBUB_OK);
+
+		hubbub_tokeniser_destroy(tok);
+		parserutils_inputstream_destroy(stream);
+
+		assert(t.len == SLEN(expected));
+		assert(memcmp(t.data, expected, t.len) == 0);
+
+		free(t.data);
+	}
+}
+
 hubbub_error token_handler(const hubbub_token *token, void *pw)
 {
 	static const char *token_names[] = {
@@ -93,6 +187,16 @@ hubbub_error token_handler(const hubbub_token *token, void *pw)
 
 	UNUSED(pw);
 
+	/* Each token should start where the last one ended */
+	assert(token->location.start == last.end);
+	assert(token->location.end >= token->location.start);
+	assert(token->location.line >= last.line);
+	if (token->location.line == last.line) {
+		assert(token->location.col == last.col +
+				(token->location.start - last.start));
+	}
+	last = token->location;
+
 	printf("%s: ", token_names[token->type]);
 
 	switch (token->type) {
@@ -157,6 +261,19 @@ hubbub_error token_handler(const hubbub_token *token, void *pw)
 	case HUBBUB_TOKEN_CHARACTER:
 		printf("'%.*s'\n", (int) token->data.character.len,
 				token->data.character.ptr);
+
+		/* Whitespace flagged by the tokeniser is all whitespace,
+		 * as the treebuilder would find it */
+		for (i = 0; i < token->data.character.len; i++) {
+			uint8_t c = token->data.character.ptr[i];
+
+			if (c != 0x09 && c != 0x0A && c != 0x0C && c != 0x20)
+				break;
+		}
+		assert(hubbub_scan_whitespace(token->data.character.ptr,
+				token->data.character.len) == i);
+		assert(token->whitespace == false ||
+				i == token->data.character.len);
 		break;
 	case HUBBUB_TOKEN_EOF:
 		printf("\n");
@@ -13,9 +13,18 @@
 
 #define NODE_REF_CHUNK 8192
 static uint16_t *node_ref;
+static uint8_t *node_flags;
 static uintptr_t node_ref_alloc;
 static uintptr_t node_counter;
 
+/* Flags for each node */
+#define NODE_HEAD	(1 << 0)	/* The head element */
+#define NODE_COMPLETE	(1 << 1)	/* Reported complete */
+
+/* Nothing goes into a complete element, unless it is the head */
+#define OPEN(n) ((node_flags[(uintptr_t) (n)] &			\
+		(NODE_HEAD | NODE_COMPLETE)) != NODE_COMPLETE)
+
 #define GROW_REF							\
 	if (node_counter >= node_ref_alloc) {				\
 		uint16_t *temp = realloc(node_ref,			\
@@ -26,8 +35,15 @@ static uintptr_t node_counter;
 			exit(1);					\
 		}							\
 		node_ref = temp;					\
+		node_flags = realloc(node_flags, node_ref_alloc +	\
+				NODE_REF_CHUNK);			\
+		if (node_flags == NULL) {				\
+			printf("FAIL - no memory\n");			\
+			exit(1);					\
+		}							\
 		node_ref_alloc += NODE_REF_CHUNK;			\
-	}
+	}								\
+	node_flags[node_counter] = 0;
 
 static hubbub_error create_comment(void *ctx, const hubbub_string *data, 
 		void **result);
@@ -56,6 +72,17 @@ static hubbub_error add_attributes(void *ctx, void *node,
 static hubbub_error set_quirks_mode(void *ctx, hubbub_quirks_mode mode);
 static hubbub_error complete_script(void *ctx, void *script);
 static hubbub_error complete_style(void *ctx, void *style);
+static hubbub_error create_and_append_element(void *ctx, void *parent,
+		const hubbub_tag *tag, void **result);
+static hubbub_error append_text(void *ctx, void *parent,
+		const hubbub_string *data);
+static hubbub_error skip_element(void *ctx, const hubbub_tag *tag,
+		bool *skip);
+static bool is_skipped(const hubbub_tag *tag);
+static hubbub_error element_complete(void *ctx, void *node);
+
+/* Whether elements are being filtered */
+static bool filtering;
 
 static hubbub_tree_handler tree_handler = {
 	create_comment,
@@ -80,6 +107,38 @@ static hubbub_tree_handler tree_handler = {
 	NULL
 };
 
+static hubbub_tree_handler_ext tree_handler_ext = {
+	create_and_append_element,
+	append_text,
+	0,
+	NULL,
+	NULL
+};
+
+static hubbub_tree_handler_ext tree_handler_ext_norefs = {
+	create_and_append_element,
+	append_text,
+	HUBBUB_TREE_NO_REFCOUNT,
+	NULL,
+	NULL
+};
+
+static hubbub_tree_handler_ext tree_handler_ext_filter = {
+	create_and_append_element,
+	append_text,
+	0,
+	skip_element,
+	NULL
+};
+
+static hubbub_tree_handler_ext tree_handler_ext_complete = {
+	create_and_append_element,
+	append_text,
+	0,
+	NULL,
+	element_complete
+};
+
 static void *myrealloc(void *ptr, size_t len, void *pw)
 {
 	UNUSED(pw);
@@ -87,7 +146,8 @@ static void *myrealloc(void *ptr, size_t len, void *pw)
 	return realloc(ptr, len);
 }
 
-static int run_test(int argc, char **argv, unsigned int CHUNK_SIZE)
+static int run_test(int argc, char **argv, unsigned int CHUNK_SIZE,
+		hubbub_tree_handler_ext *ext)
 {
 	hubbub_parser *parser;
 	hubbub_parser_optparams params;
@@ -101,6 +161,8 @@ static int run_test(int argc, char **argv, unsigned int CHUNK_SIZE)
 
 	UNUSED(argc);
 
+	filtering = (ext != NULL && ext->skip_element != NULL);
+
 	node_ref = calloc(NODE_REF_CHUNK, sizeof(uint16_t));
 	if (node_ref == NULL) {
 		printf("Failed allocating node_ref\n");
@@ -108,6 +170,12 @@ static int run_test(int argc, char **argv, unsigned int CHUNK_SIZE)
 	}
 	node_ref_alloc = NODE_REF_CHUNK;
 
+	node_flags = calloc(NODE_REF_CHUNK, 1);
+	if (node_flags == NULL) {
+		printf("Failed allocating node_flags\n");
+		return 1;
+	}
+
 	assert(hubbub_parser_create("UTF-8", false, myrealloc, NULL, &parser) ==
 			HUBBUB_OK);
 
@@ -115,6 +183,10 @@ static int run_test(int argc, char **argv, unsigned int CHUNK_SIZE)
 	assert(hubbub_parser_setopt(parser, HUBBUB_PARSER_TREE_HANDLER,
 			&params) == HUBBUB_OK);
 
+	params.tree_handler_ext = ext;
+	assert(hubbub_parser_setopt(parser, HUBBUB_PARSER_TREE_HANDLER_EXT,
+			&params) == HUBBUB_OK);
+
 	params.document_node = (void *) ++node_counter;
 	ref_node(NULL, (void *) node_counter);
 	assert(hubbub_parser_setopt(parser, HUBBUB_PARSER_DOCUMENT_NODE,
@@ -146,14 +218,20 @@ static int run_test(int argc, char **argv, unsigned int CHUNK_SIZE)
         
 	fclose(fp);
 
+	assert(hubbub_parser_completed(parser) == HUBBUB_OK);
+
 	charset = hubbub_parser_read_charset(parser, &cssource);
 
 	printf("Charset: %s (from %d)\n", charset, cssource);
 
 	hubbub_parser_destroy(parser);
 
-	/* Ensure that all nodes have been released by the treebuilder */
+	/* Ensure that all nodes have been released by the treebuilder,
+	 * unless it was told not to count references */
 	for (n = 1; n <= node_counter; n++) {
+		if (ext != NULL && (ext->flags & HUBBUB_TREE_NO_REFCOUNT))
+			break;
+
 		if (node_ref[n] != 0) {
 			printf("%" PRIuPTR " still referenced (=%u)\n", n, node_ref[n]);
 			passed = false;
@@ -161,6 +239,7 @@ static int run_test(int argc, char **argv, unsigned int CHUNK_SIZE)
 	}
 
 	free(node_ref);
+	free(node_flags);
 	node_counter = 0;
 
 	printf("%s\n", passed ? "PASS" : "FAIL");
@@ -178,10 +257,24 @@ int main(int argc, char **argv)
 		return 1;
 	}
 
-#define DO_TEST(n) if ((ret = run_test(argc, argv, (n))) != 0) return ret
+#define DO_TEST(n, e) if ((ret = run_test(argc, argv, (n), (e))) != 0) \
+		return ret
         for (shift = 0; (1 << shift) != 16384; shift++)
         	for (offset = 0; offset < 10; offset += 3)
-	                DO_TEST((1 << shift) + offset);
+	                DO_TEST((1 << shift) + offset, NULL);
+
+	/* Fused callbacks */
+	DO_TEST(1, &tree_handler_ext);
+	DO_TEST(4096, &tree_handler_ext);
+	DO_TEST(4096, &tree_handler_ext_norefs);
+
+	/* Filtered elements */
+	DO_TEST(1, &tree_handler_ext_filter);
+	DO_TEST(4096, &tree_handler_ext_filter);
+
+	/* Completed elements */
+	DO_TEST(1, &tree_handler_ext_complete);
+	DO_TEST(4096, &tree_handler_ext_complete);
 
         return 0;
 #undef DO_TEST
@@ -238,6 +331,7 @@ hubbub_error create_element(void *ctx, const hubbub_tag *tag, void **result)
 			(int) tag->name.len, tag->name.ptr);
 
 	assert(memchr(tag->name.ptr, 0xff, tag->name.len) == NULL);
+	assert(filtering == false || is_skipped(tag) == false);
 	for (i = 0; i < tag->n_attributes; i++) {
 		hubbub_attribute *attr = &tag->attributes[i];
 
@@ -248,6 +342,10 @@ hubbub_error create_element(void *ctx, const hubbub_tag *tag, void **result)
 	GROW_REF
 	node_ref[node_counter] = 0;
 
+	if (tag->name.len == 4 && strncmp((const char *) tag->name.ptr,
+			"head", 4) == 0)
+		node_flags[node_counter] |= NODE_HEAD;
+
 	ref_node(ctx, (void *) node_counter);
 
 	*result = (void *) node_counter;
@@ -295,6 +393,7 @@ hubbub_error unref_node(void *ctx, void *node)
 hubbub_error append_child(void *ctx, void *parent, void *child, void **result)
 {
 	printf("Appending %" PRIuPTR " to %" PRIuPTR "\n", (uintptr_t) child, (uintptr_t) parent);
+	assert(OPEN(parent));
 	ref_node(ctx, child);
 
 	*result = (void *) child;
@@ -307,6 +406,7 @@ hubbub_error insert_before(void *ctx, void *parent, void *child,
 {
 	printf("Inserting %" PRIuPTR " in %" PRIuPTR " before %" PRIuPTR "\n", (uintptr_t) child, 
 			(uintptr_t) parent, (uintptr_t) ref_child);
+	assert(OPEN(parent));
 	ref_node(ctx, child);
 
 	*result = (void *) child;
@@ -345,6 +445,7 @@ hubbub_error reparent_children(void *ctx, void *node, void *new_parent)
 
 	printf("Reparenting children of %" PRIuPTR " to %" PRIuPTR "\n", 
 				(uintptr_t) node, (uintptr_t) new_parent);
+	assert(OPEN(node) && OPEN(new_parent));
 
 	return HUBBUB_OK;
 }
@@ -427,3 +528,65 @@ hubbub_error complete_style(void *ctx, void *style)
 	return HUBBUB_OK;
 }
 
+
+hubbub_error create_and_append_element(void *ctx, void *parent,
+		const hubbub_tag *tag, void **result)
+{
+	void *node;
+
+	assert(create_element(ctx, tag, &node) == HUBBUB_OK);
+	assert(append_child(ctx, parent, node, result) == HUBBUB_OK);
+
+	return unref_node(ctx, node);
+}
+
+hubbub_error append_text(void *ctx, void *parent, const hubbub_string *data)
+{
+	void *text, *appended;
+
+	assert(create_text(ctx, data, &text) == HUBBUB_OK);
+	assert(append_child(ctx, parent, text, &appended) == HUBBUB_OK);
+
+	unref_node(ctx, appended);
+
+	return unref_node(ctx, text);
+}
+
+/* Elements to skip, chosen for their part in error recovery */
+bool is_skipped(const hubbub_tag *tag)
+{
+	static const char *names[] = { "b", "script", "style", "table" };
+	size_t i;
+
+	for (i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+		if (tag->name.len == strlen(names[i]) &&
+				strncmp((const char *) tag->name.ptr, names[i],
+				tag->name.len) == 0)
+			return true;
+	}
+
+	return false;
+}
+
+hubbub_error skip_element(void *ctx, const hubbub_tag *tag, bool *skip)
+{
+	UNUSED(ctx);
+
+	*skip = is_skipped(tag);
+
+	return HUBBUB_OK;
+}
+
+hubbub_error element_complete(void *ctx, void *node)
+{
+	UNUSED(ctx);
+
+	printf("Completed %" PRIuPTR "\n", (uintptr_t) node);
+
+	/* Each element is complete once, unless it is the head */
+	assert(node_ref[(uintptr_t) node] > 0);
+	assert(OPEN(node));
+	node_flags[(uintptr_t) node] |= NODE_COMPLETE;
+
+	return HUBBUB_OK;
+}